@@ -0,0 +1,455 @@
+#ifndef CK2DBATCHER_H
+#define CK2DBATCHER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKRenderManager.h"
+#include "CK2dEntity.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "CKVertexRingBuffer.h"
+#include "XObjectArray.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Font whose glyphs are the cells of a texture, for CK2dBatcher text.
+
+Remarks:
+    o The texture of the material is a grid of Columns x Rows cells, the
+    cell i holding the character FirstChar + i. A text is drawn with one
+    quad per glyph from this texture: changing the text only changes the
+    quads, no bitmap is generated.
+    o Advances, if not NULL, gives the width of each glyph as a ratio of
+    the cell width (for proportional fonts), the cells are otherwise
+    drawn side by side.
+
+See Also: CK2dBatcher::SetText
+****************************************************************/
+struct CK2dFont
+{
+    CKMaterial *m_Material;
+    int m_FirstChar;
+    int m_Columns;
+    int m_Rows;
+    const float *m_Advances; // Columns x Rows ratios, or NULL
+};
+
+/****************************************************************
+Summary: Draws the 2D entities sharing a material with a single draw call.
+
+Remarks:
+    o The render context draws each foreground 2D entity with its own
+    primitive. The render function of the entities added to the batcher is
+    replaced: when the render context draws one of them, in the order of
+    the 2D hierarchy and of the Z order, its quad is appended to the
+    current batch. The batch is drawn (from a CKVertexRingBuffer, with
+    pre-transformed vertices) when an entity of another material comes or
+    after the last 2D entity, so the drawing order is kept. Entities bound
+    to the same page of a CKTextureAtlas share their material.
+    o The quad of an entity uses its rectangle, its source rectangle (in
+    pixels of the texture of its material) if used and the diffuse color
+    of its material, clipped to its parent and the view rectangle as the
+    render context does.
+    o The entities added which can not be batched (sprites, which draw
+    their own bitmap, and entities without material) are still drawn by
+    their Draw method, after the current batch, to keep the order. The
+    background entities, drawn before the 3D scene, are not handled.
+    o SetText draws a text with the glyphs of a CK2dFont in the rectangle
+    of a 2D entity (instead of its quad), a replacement for CKSpriteText
+    which generates a bitmap each time its text changes.
+
+    CK2dBatcher batcher(dev);
+    batcher.Build(context->GetObjectListByType(CKCID_2DENTITY, TRUE));
+    batcher.SetText(label, "Score: 100", &font, 16.0f);
+
+See Also: CKTextureAtlas,CKVertexRingBuffer,CKRenderObject::SetRenderCallBack
+****************************************************************/
+class CK2dBatcher
+{
+public:
+    /************************************************
+    Summary: Creates a batcher for a render context.
+
+    Arguments:
+        dev: Render context drawing the entities.
+        maxQuads: Number of quads of a draw call (at most 16383, the indices
+        are 16 bits).
+    ************************************************/
+    explicit CK2dBatcher(CKRenderContext *dev, int maxQuads = 4096)
+        : m_Dev(dev), m_Ring(dev->GetCKContext()->GetRenderManager(), (CKDWORD)Clamp(maxQuads) * 4 * CKVertexRingBuffer::FrameLatency, CKRST_DP_VCT),
+          m_MaxQuads(Clamp(maxQuads)), m_Current(NULL), m_Registered(FALSE), m_Draws(0), m_LastDraws(0)
+    {
+        m_Indices.Resize(m_MaxQuads * 6);
+        for (int q = 0; q < m_MaxQuads; ++q)
+        {
+            CKWORD *idx = &m_Indices[q * 6];
+            const CKWORD v = (CKWORD)(q * 4);
+            idx[0] = v;
+            idx[1] = (CKWORD)(v + 1);
+            idx[2] = (CKWORD)(v + 2);
+            idx[3] = v;
+            idx[4] = (CKWORD)(v + 2);
+            idx[5] = (CKWORD)(v + 3);
+        }
+    }
+
+    ~CK2dBatcher() { Clear(); }
+
+    /************************************************
+    Summary: Draws an entity through the batcher.
+
+    Return Value:
+        TRUE if the quad of the entity is batched, FALSE if it is drawn by
+        the entity (it keeps its place in the order) or not handled.
+    ************************************************/
+    CKBOOL Add(CK2dEntity *ent)
+    {
+        if (!ent || ent->IsBackground() || m_Index.FindPtr(ent->GetID()))
+            return FALSE;
+        Info info;
+        info.m_Entity = ent->GetID();
+        info.m_Batchable = !CKIsChildClassOf(ent, CKCID_SPRITE);
+        info.m_Font = NULL;
+        info.m_TextHeight = 0.0f;
+        info.m_TextColor = 0xFFFFFFFF;
+        m_Index.Insert(info.m_Entity, m_Entities.Size());
+        m_Entities.PushBack(info);
+        ent->SetRenderCallBack(RecordEntity, this);
+        if (!m_Registered)
+        {
+            m_Dev->AddPostSpriteRenderCallBack(EndFrame, this);
+            m_Registered = TRUE;
+        }
+        return info.m_Batchable;
+    }
+
+    // Adds an array of 2D entities, returns the number of batched ones.
+    int Build(const XObjectPointerArray &entities)
+    {
+        int count = 0;
+        for (int i = 0; i < entities.Size(); ++i)
+        {
+            CKObject *obj = entities[i];
+            if (obj && CKIsChildClassOf(obj, CKCID_2DENTITY))
+                count += Add((CK2dEntity *)obj) ? 1 : 0;
+        }
+        return count;
+    }
+
+    // Gives back its render function to an entity.
+    void Remove(CK2dEntity *ent)
+    {
+        int *index = ent ? m_Index.FindPtr(ent->GetID()) : NULL;
+        if (!index)
+            return;
+        const int i = *index;
+        ent->RemoveRenderCallBack();
+        m_Index.Remove(ent->GetID());
+        const int last = m_Entities.Size() - 1;
+        if (i != last)
+        {
+            m_Entities[i] = m_Entities[last];
+            m_Index.Insert(m_Entities[i].m_Entity, i, TRUE);
+        }
+        m_Entities.Resize(last);
+    }
+
+    // Removes all the entities.
+    void Clear()
+    {
+        CKContext *ctx = m_Dev->GetCKContext();
+        for (int i = 0; i < m_Entities.Size(); ++i)
+        {
+            CK2dEntity *ent = (CK2dEntity *)ctx->GetObject(m_Entities[i].m_Entity);
+            if (ent && !ent->IsToBeDeleted())
+                ent->RemoveRenderCallBack();
+        }
+        if (m_Registered)
+            m_Dev->RemovePostSpriteRenderCallBack(EndFrame, this);
+        m_Registered = FALSE;
+        m_Entities.Clear();
+        m_Index.Clear();
+        m_Quads.Clear();
+        m_Current = NULL;
+    }
+
+    /************************************************
+    Summary: Draws a text in the rectangle of an entity.
+
+    Arguments:
+        ent: Entity added to the batcher, its rectangle clips the text.
+        text: Text, lines are separated by '\n'. NULL to draw the quad of
+        the entity again.
+        font: Font of the glyphs, it must stay valid while it is used.
+        height: Height of the glyphs in pixels.
+        color: Color of the glyphs (ARGB).
+    ************************************************/
+    void SetText(CK2dEntity *ent, CKSTRING text, const CK2dFont *font, float height, CKDWORD color = 0xFFFFFFFF)
+    {
+        int *index = ent ? m_Index.FindPtr(ent->GetID()) : NULL;
+        if (!index)
+            return;
+        Info &info = m_Entities[*index];
+        info.m_Text = text;
+        info.m_Font = (text && font && font->m_Material) ? font : NULL;
+        info.m_TextHeight = height;
+        info.m_TextColor = color;
+    }
+
+    CKBOOL IsBatched(CK2dEntity *ent) const
+    {
+        const int *index = ent ? m_Index.FindPtr(ent->GetID()) : NULL;
+        return index && m_Entities[*index].m_Batchable;
+    }
+
+    int GetEntityCount() const { return m_Entities.Size(); }
+
+    // Number of draw calls of the batches during the last frame.
+    int GetDrawCount() const { return m_LastDraws; }
+
+protected:
+    struct Info
+    {
+        CK_ID m_Entity;
+        CKBOOL m_Batchable;
+        XString m_Text;
+        const CK2dFont *m_Font; // NULL to draw the quad of the entity
+        float m_TextHeight;
+        CKDWORD m_TextColor;
+    };
+
+    struct Quad
+    {
+        VxRect m_Rect; // screen pixels
+        VxRect m_UV;
+        CKDWORD m_Color;
+    };
+
+    static int Clamp(int maxQuads) { return maxQuads < 1 ? 1 : (maxQuads > 16383 ? 16383 : maxQuads); }
+
+    // Render function of the entities: called in the drawing order of the 2D entities.
+    static CKBOOL RecordEntity(CKRenderContext *dev, CKRenderObject *obj, void *arg)
+    {
+        ((CK2dBatcher *)arg)->Record(dev, (CK2dEntity *)obj);
+        return TRUE;
+    }
+
+    // Draws the last batch after all the 2D entities.
+    static void EndFrame(CKRenderContext *dev, void *arg)
+    {
+        CK2dBatcher *batcher = (CK2dBatcher *)arg;
+        batcher->Flush(dev);
+        batcher->m_Current = NULL;
+        batcher->m_LastDraws = batcher->m_Draws;
+        batcher->m_Draws = 0;
+        batcher->m_Ring.NewFrame();
+    }
+
+    void Record(CKRenderContext *dev, CK2dEntity *ent)
+    {
+        int *index = m_Index.FindPtr(ent->GetID());
+        const Info *info = index ? &m_Entities[*index] : NULL;
+        CKMaterial *mat = info && info->m_Font ? info->m_Font->m_Material : ent->GetMaterial();
+        if (!info || !info->m_Batchable || !mat)
+        {
+            Flush(dev);
+            ent->Draw(dev);
+            return;
+        }
+
+        VxRect clip;
+        ent->GetRect(clip);
+        if (ent->IsClippedToCamera())
+        {
+            VxRect view;
+            dev->GetViewRect(view);
+            if (!clip.Clip(view))
+                return;
+        }
+        for (CK2dEntity *e = ent; e->IsClipToParent() && e->GetParent(); e = e->GetParent())
+        {
+            VxRect parent;
+            e->GetParent()->GetRect(parent);
+            if (!clip.Clip(parent))
+                return;
+        }
+        if (clip.IsEmpty())
+            return;
+
+        if (mat != m_Current)
+        {
+            Flush(dev);
+            m_Current = mat;
+        }
+        if (info->m_Font)
+        {
+            AddText(ent, *info, clip);
+            return;
+        }
+
+        Quad q;
+        ent->GetRect(q.m_Rect);
+        q.m_UV.SetCorners(0.0f, 0.0f, 1.0f, 1.0f);
+        CKTexture *tex = mat->GetTexture();
+        if (tex && ent->IsUsingSourceRect() && tex->GetWidth() && tex->GetHeight())
+        {
+            VxRect src;
+            ent->GetSourceRect(src);
+            const float iw = 1.0f / tex->GetWidth();
+            const float ih = 1.0f / tex->GetHeight();
+            q.m_UV.SetCorners(src.left * iw, src.top * ih, src.right * iw, src.bottom * ih);
+        }
+        q.m_Color = mat->GetDiffuse().GetRGBA();
+        AddQuad(dev, q, clip);
+    }
+
+    void AddText(CK2dEntity *ent, const Info &info, const VxRect &clip)
+    {
+        const CK2dFont &font = *info.m_Font;
+        CKTexture *tex = font.m_Material->GetTexture();
+        if (!tex || font.m_Columns <= 0 || font.m_Rows <= 0)
+            return;
+        const float cellU = 1.0f / font.m_Columns;
+        const float cellV = 1.0f / font.m_Rows;
+        // the glyphs keep the aspect of the cells of the texture
+        const float cellWidth = info.m_TextHeight * (tex->GetWidth() * cellU) / (tex->GetHeight() * cellV);
+        const int cells = font.m_Columns * font.m_Rows;
+
+        VxRect rect;
+        ent->GetRect(rect);
+        float x = rect.left;
+        float y = rect.top;
+        for (const char *c = info.m_Text.CStr(); *c; ++c)
+        {
+            if (*c == '\n')
+            {
+                x = rect.left;
+                y += info.m_TextHeight;
+                continue;
+            }
+            const int cell = (int)(unsigned char)*c - font.m_FirstChar;
+            if (cell < 0 || cell >= cells)
+                continue;
+            const float advance = font.m_Advances ? font.m_Advances[cell] : 1.0f;
+            Quad q;
+            q.m_Rect.SetCorners(x, y, x + cellWidth * advance, y + info.m_TextHeight);
+            const float u = (cell % font.m_Columns) * cellU;
+            const float v = (cell / font.m_Columns) * cellV;
+            q.m_UV.SetCorners(u, v, u + cellU * advance, v + cellV);
+            q.m_Color = info.m_TextColor;
+            AddQuad(m_Dev, q, clip);
+            x += cellWidth * advance;
+        }
+    }
+
+    // Clips a quad (and its mapping) and appends it to the current batch.
+    void AddQuad(CKRenderContext *dev, Quad &q, const VxRect &clip)
+    {
+        VxRect &r = q.m_Rect;
+        if (r.right <= clip.left || r.left >= clip.right || r.bottom <= clip.top || r.top >= clip.bottom)
+            return;
+        const float du = (r.right != r.left) ? (q.m_UV.right - q.m_UV.left) / (r.right - r.left) : 0.0f;
+        const float dv = (r.bottom != r.top) ? (q.m_UV.bottom - q.m_UV.top) / (r.bottom - r.top) : 0.0f;
+        if (r.left < clip.left)
+        {
+            q.m_UV.left += (clip.left - r.left) * du;
+            r.left = clip.left;
+        }
+        if (r.right > clip.right)
+        {
+            q.m_UV.right -= (r.right - clip.right) * du;
+            r.right = clip.right;
+        }
+        if (r.top < clip.top)
+        {
+            q.m_UV.top += (clip.top - r.top) * dv;
+            r.top = clip.top;
+        }
+        if (r.bottom > clip.bottom)
+        {
+            q.m_UV.bottom -= (r.bottom - clip.bottom) * dv;
+            r.bottom = clip.bottom;
+        }
+        if (m_Quads.Size() == m_MaxQuads)
+            Flush(dev);
+        m_Quads.PushBack(q);
+    }
+
+    // Draws the current batch.
+    void Flush(CKRenderContext *dev)
+    {
+        const int count = m_Quads.Size();
+        if (!count || !m_Current)
+        {
+            m_Quads.Resize(0);
+            return;
+        }
+        CKDWORD start = 0;
+        VxDrawPrimitiveData *data = m_Ring.Lock(dev, count * 4, start);
+        const CKBOOL ring = data != NULL;
+        if (!data)
+            data = dev->GetDrawPrimitiveStructure(CKRST_DP_VCT, count * 4);
+        if (!data)
+        {
+            m_Quads.Resize(0);
+            return;
+        }
+        XBYTE *pos = (XBYTE *)data->PositionPtr;
+        XBYTE *col = (XBYTE *)data->ColorPtr;
+        XBYTE *uv = (XBYTE *)data->TexCoordPtr;
+        for (int i = 0; i < count; ++i)
+        {
+            const Quad &q = m_Quads[i];
+            const float x[4] = {q.m_Rect.left, q.m_Rect.right, q.m_Rect.right, q.m_Rect.left};
+            const float y[4] = {q.m_Rect.top, q.m_Rect.top, q.m_Rect.bottom, q.m_Rect.bottom};
+            const float u[4] = {q.m_UV.left, q.m_UV.right, q.m_UV.right, q.m_UV.left};
+            const float v[4] = {q.m_UV.top, q.m_UV.top, q.m_UV.bottom, q.m_UV.bottom};
+            for (int k = 0; k < 4; ++k)
+            {
+                VxVector4 *p = (VxVector4 *)pos;
+                p->Set(x[k], y[k], 0.0f, 1.0f);
+                *(CKDWORD *)col = q.m_Color;
+                ((float *)uv)[0] = u[k];
+                ((float *)uv)[1] = v[k];
+                pos += data->PositionStride;
+                col += data->ColorStride;
+                uv += data->TexCoordStride;
+            }
+        }
+
+        dev->SetCurrentMaterial(m_Current, FALSE);
+        dev->SetState(VXRENDERSTATE_ZENABLE, FALSE);
+        dev->SetState(VXRENDERSTATE_ZWRITEENABLE, FALSE);
+        dev->SetState(VXRENDERSTATE_CULLMODE, VXCULL_NONE);
+        if (ring)
+        {
+            m_Ring.Unlock(dev);
+            m_Ring.Draw(dev, VX_TRIANGLELIST, m_Indices.Begin(), count * 6, start, count * 4);
+        }
+        else
+        {
+            dev->DrawPrimitive(VX_TRIANGLELIST, m_Indices.Begin(), count * 6, data);
+        }
+        ++m_Draws;
+        m_Quads.Resize(0);
+    }
+
+    CKRenderContext *m_Dev;
+    CKVertexRingBuffer m_Ring;
+    int m_MaxQuads;
+    XArray<CKWORD> m_Indices; // 2 triangles per quad
+    XClassArray<Info> m_Entities;
+    XHashTable<int, CK_ID> m_Index; // index in m_Entities
+    XArray<Quad> m_Quads;           // current batch
+    CKMaterial *m_Current;          // material of the current batch
+    CKBOOL m_Registered;
+    int m_Draws;
+    int m_LastDraws;
+
+private:
+    CK2dBatcher(const CK2dBatcher &);
+    CK2dBatcher &operator=(const CK2dBatcher &);
+};
+
+#endif // CK2DBATCHER_H
@@ -0,0 +1,328 @@
+#ifndef CKANIMATIONSCHEDULER_H
+#define CKANIMATIONSCHEDULER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKCharacter.h"
+#include "CKBodyPart.h"
+#include "CKRenderCuller.h"
+#include "VxTimeProfiler.h"
+
+/****************************************************************
+Summary: Processes the animations of characters at a rate depending on their size on screen.
+
+Remarks:
+    o The characters added to the scheduler are no longer processed by the
+    engine (CKCharacter::SetAutomaticProcess). Each frame Update chooses a
+    tier for each character from the fraction of the screen height its
+    hierarchical box covers: a tier gives the number of frames between two
+    animation updates and the level of detail given to
+    CKCharacter::SetAnimationLevelOfDetail.
+    o The characters updated every N frames are processed with the time
+    elapsed since their last update. Their updates are spread over the N
+    frames so that the cost stays even.
+    o With interpolation enabled, the local matrices of the character and
+    its body parts are blended from the last shown pose to the newly
+    processed one during the following frames instead of jumping (the pose
+    shown is late by the update interval). The character itself is moved
+    by the change of its blended matrix, so a movement given by a script
+    or by physics between two updates is kept.
+    o Characters outside of the view frustum use the OffScreenInterval and
+    a null level of detail (only the character movement is processed).
+    o When the context profiling is enabled, the time spent is added to
+    the AnimationManagement statistics (CKContext::GetProfileStats), so
+    Update should be called during the behavior processing (from a
+    building block or a manager PreProcess).
+
+    CKAnimationScheduler scheduler(context);
+    scheduler.Add(character);
+    ...
+    scheduler.Update(dev, deltaTime); // each frame
+
+See Also: CKCharacter::ProcessAnimation,CKCharacter::SetAnimationLevelOfDetail
+****************************************************************/
+class CKAnimationScheduler
+{
+public:
+    enum
+    {
+        MaxTiers = 8,
+        OffScreenInterval = 8
+    };
+
+    // Update rate for the characters covering at least MinScreenSize of the screen height.
+    struct Tier
+    {
+        float m_MinScreenSize;
+        int m_Interval; // frames between two updates
+        float m_LOD;    // animation level of detail
+    };
+
+    explicit CKAnimationScheduler(CKContext *context)
+        : m_Context(context), m_Interpolate(TRUE), m_TierCount(0), m_UpdatedCount(0), m_Time(0.0f)
+    {
+        AddTier(0.25f, 1, 1.0f);
+        AddTier(0.10f, 2, 1.0f);
+        AddTier(0.04f, 4, 0.5f);
+        AddTier(0.0f, 8, 0.0f);
+    }
+
+    ~CKAnimationScheduler() { Clear(); }
+
+    /************************************************
+    Summary: Adds an update tier.
+
+    Remarks:
+        Tiers must be added by decreasing screen size, the last tier should
+        have a null screen size so that every character gets one.
+        ClearTiers removes the default tiers.
+    ************************************************/
+    CKBOOL AddTier(float minScreenSize, int interval, float lod)
+    {
+        if (m_TierCount == MaxTiers)
+            return FALSE;
+        Tier &t = m_Tiers[m_TierCount++];
+        t.m_MinScreenSize = minScreenSize;
+        t.m_Interval = XMax(interval, 1);
+        t.m_LOD = lod;
+        return TRUE;
+    }
+
+    void ClearTiers() { m_TierCount = 0; }
+    int GetTierCount() const { return m_TierCount; }
+    const Tier &GetTier(int i) const { return m_Tiers[i]; }
+
+    // Enables the blending of the poses between two sparse updates.
+    void EnableInterpolation(CKBOOL enable) { m_Interpolate = enable; }
+
+    // Takes over the animation processing of a character.
+    CKBOOL Add(CKCharacter *character)
+    {
+        if (!character || Find(character->GetID()) >= 0)
+            return FALSE;
+        Entry *e = new Entry;
+        e->m_Character = character->GetID();
+        e->m_Automatic = character->IsAutomaticProcess();
+        e->m_Interval = 1;
+        e->m_Tier = -1;
+        e->m_Frames = 0;
+        e->m_Elapsed = 0.0f;
+        e->m_Blending = FALSE;
+        m_Entries.PushBack(e);
+        character->SetAutomaticProcess(FALSE);
+        return TRUE;
+    }
+
+    // Gives the animation processing of a character back to the engine.
+    void Remove(CKCharacter *character)
+    {
+        int i = character ? Find(character->GetID()) : -1;
+        if (i < 0)
+            return;
+        Release(m_Entries[i]);
+        m_Entries.RemoveAt(i);
+    }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+            Release(m_Entries[i]);
+        m_Entries.Clear();
+    }
+
+    int GetCharacterCount() const { return m_Entries.Size(); }
+
+    // Tier used by a character at its last update, -1 if it is not in the scheduler or off screen.
+    int GetCharacterTier(CKCharacter *character) const
+    {
+        int i = character ? Find(character->GetID()) : -1;
+        return (i >= 0) ? m_Entries[i]->m_Tier : -1;
+    }
+
+    // Number of characters processed by the last Update.
+    int GetUpdatedCount() const { return m_UpdatedCount; }
+
+    // Time taken by the last Update (in milliseconds).
+    float GetUpdateTime() const { return m_Time; }
+
+    /************************************************
+    Summary: Processes the animations for the current frame.
+
+    Arguments:
+        dev: Render context whose camera gives the screen sizes, NULL to
+        update all the characters every frame.
+        deltaTime: Time elapsed since the last frame, in milliseconds.
+    ************************************************/
+    void Update(CKRenderContext *dev, float deltaTime)
+    {
+        VxTimeProfiler profiler;
+        m_UpdatedCount = 0;
+
+        CKRenderCuller view;
+        CKCamera *cam = dev ? dev->GetAttachedCamera() : NULL;
+        const CKBOOL hasView = cam && view.SetView(dev);
+        const VxVector eye = hasView ? *(const VxVector *)&cam->GetWorldMatrix()[3][0] : VxVector(0.0f, 0.0f, 0.0f);
+        const float tanHalfFov = hasView ? tanf(cam->GetFov() * 0.5f) : 1.0f;
+
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = *m_Entries[i];
+            CKCharacter *character = (CKCharacter *)m_Context->GetObject(e.m_Character);
+            if (!character)
+                continue;
+            e.m_Elapsed += deltaTime;
+            ++e.m_Frames;
+
+            if (e.m_Frames < e.m_Interval)
+            {
+                if (e.m_Blending && e.m_Frames > 0)
+                    Blend(e, character, (float)e.m_Frames / (float)e.m_Interval);
+                continue;
+            }
+
+            int tier = hasView ? ChooseTier(character, view.GetCuller(), eye, tanHalfFov) : 0;
+            int interval = (tier >= 0 && tier < m_TierCount) ? m_Tiers[tier].m_Interval : (int)OffScreenInterval;
+            if (!hasView)
+                interval = 1;
+            // off screen only the character movement is processed
+            character->SetAnimationLevelOfDetail((tier >= 0 && tier < m_TierCount) ? m_Tiers[tier].m_LOD : 0.0f);
+
+            // the processing starts from the pose reached by the last update
+            if (e.m_Blending)
+                Blend(e, character, 1.0f);
+            const CKBOOL blend = m_Interpolate && interval > 1 && tier >= 0;
+            if (blend)
+                SavePose(e.m_From, character);
+            character->ProcessAnimation(e.m_Elapsed);
+            ++m_UpdatedCount;
+            if (blend)
+            {
+                SavePose(e.m_To, character);
+                e.m_Root = e.m_To[0];
+                Blend(e, character, 0.0f);
+            }
+            else if (e.m_Blending)
+            {
+                e.m_From.Resize(0);
+                e.m_To.Resize(0);
+            }
+            e.m_Blending = blend;
+            e.m_Tier = tier;
+            e.m_Elapsed = 0.0f;
+            // spread the characters of an interval over its frames
+            e.m_Frames = (e.m_Interval != interval) ? -(i % interval) : 0;
+            e.m_Interval = interval;
+        }
+
+        m_Time = profiler.Current();
+        if (m_Context->IsProfilingEnable())
+            m_Context->m_Stats.AnimationManagement += m_Time;
+    }
+
+protected:
+    struct Entry
+    {
+        CK_ID m_Character;
+        CKBOOL m_Automatic; // automatic processing before the character was added
+        int m_Tier;
+        int m_Interval;
+        int m_Frames;       // frames since the last update
+        float m_Elapsed;    // time since the last update
+        CKBOOL m_Blending;
+        XArray<VxMatrix> m_From; // local matrices of the character and its body parts
+        XArray<VxMatrix> m_To;
+        VxMatrix m_Root; // interpolated root matrix of the last Blend
+    };
+
+    int Find(CK_ID id) const
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            if (m_Entries[i]->m_Character == id)
+                return i;
+        }
+        return -1;
+    }
+
+    void Release(Entry *e)
+    {
+        CKCharacter *character = (CKCharacter *)m_Context->GetObject(e->m_Character);
+        if (character && !character->IsToBeDeleted())
+        {
+            if (e->m_Blending)
+                Blend(*e, character, 1.0f);
+            character->SetAutomaticProcess(e->m_Automatic);
+            character->SetAnimationLevelOfDetail(1.0f);
+        }
+        delete e;
+    }
+
+    int ChooseTier(CKCharacter *character, const VxFrustumCuller &culler, const VxVector &eye, float tanHalfFov) const
+    {
+        const VxBbox &box = character->GetHierarchicalBox();
+        if (culler.CullBox(box) == VxFrustumCuller::OUTSIDE)
+            return -1;
+        const VxVector center = (box.Min + box.Max) * 0.5f;
+        const float radius = Magnitude(box.Max - box.Min) * 0.5f;
+        const float distance = Magnitude(center - eye);
+        const float size = (distance > radius) ? radius / (distance * tanHalfFov) : 1.0f;
+        for (int t = 0; t < m_TierCount; ++t)
+        {
+            if (size >= m_Tiers[t].m_MinScreenSize)
+                return t;
+        }
+        return m_TierCount - 1;
+    }
+
+    static void SavePose(XArray<VxMatrix> &pose, CKCharacter *character)
+    {
+        const int count = character->GetBodyPartCount();
+        pose.Resize(count + 1);
+        pose[0] = character->GetLocalMatrix();
+        for (int i = 0; i < count; ++i)
+        {
+            CKBodyPart *part = character->GetBodyPart(i);
+            if (part)
+                pose[i + 1] = part->GetLocalMatrix();
+        }
+    }
+
+    static void Blend(Entry &e, CKCharacter *character, float step)
+    {
+        const int count = character->GetBodyPartCount();
+        if (e.m_From.Size() != count + 1 || e.m_To.Size() != count + 1)
+            return;
+        VxMatrix m;
+        Vx3DInterpolateMatrix(step, m, e.m_From[0], e.m_To[0]);
+        // the root only moves by the change of the interpolated matrix since
+        // the last Blend: a movement given by a script or by physics is kept
+        VxMatrix inverse, delta, root;
+        Vx3DInverseMatrix(inverse, e.m_Root);
+        Vx3DMultiplyMatrix(delta, inverse, m);
+        Vx3DMultiplyMatrix(root, character->GetLocalMatrix(), delta);
+        character->SetLocalMatrix(root);
+        e.m_Root = m;
+        for (int i = 0; i < count; ++i)
+        {
+            CKBodyPart *part = character->GetBodyPart(i);
+            if (!part)
+                continue;
+            Vx3DInterpolateMatrix(step, m, e.m_From[i + 1], e.m_To[i + 1]);
+            part->SetLocalMatrix(m);
+        }
+    }
+
+    CKContext *m_Context;
+    CKBOOL m_Interpolate;
+    Tier m_Tiers[MaxTiers];
+    int m_TierCount;
+    int m_UpdatedCount;
+    float m_Time;
+    XArray<Entry *> m_Entries;
+
+private:
+    CKAnimationScheduler(const CKAnimationScheduler &);
+    CKAnimationScheduler &operator=(const CKAnimationScheduler &);
+};
+
+#endif // CKANIMATIONSCHEDULER_H
@@ -0,0 +1,659 @@
+#ifndef CKARCHIVE_H
+#define CKARCHIVE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CKGlobals.h"
+#include "CKContext.h"
+#include "CKTexture.h"
+#include "CKBitmapReader.h"
+#include "CKSoundReader.h"
+#include "CKPluginManager.h"
+#include "CKPathManager.h"
+#include "CKDirectoryParser.h"
+#include "CKPathSplitter.h"
+#include "VxMemoryMappedFile.h"
+#include "VxFastBlit.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Header of a pack file read by CKArchive. {secret}
+****************************************************************/
+struct CKArchiveHeader
+{
+    CKDWORD m_Magic;
+    CKDWORD m_Version;
+    CKDWORD m_EntryCount;
+    CKDWORD m_TableOffset; // CKArchiveEntry table
+    CKDWORD m_NamesOffset; // zero terminated names
+    CKDWORD m_NamesSize;
+};
+
+/****************************************************************
+Summary: A file stored in a pack file. {secret}
+****************************************************************/
+struct CKArchiveEntry
+{
+    CKDWORD m_Name;       // offset in the names
+    CKDWORD m_Offset;     // offset of the data in the pack file, aligned on 16 bytes
+    CKDWORD m_PackedSize; // size of the data in the pack file
+    CKDWORD m_Size;       // size of the file, m_PackedSize if stored
+    CKDWORD m_CRC;        // CKComputeDataCRC of the file
+    CKDWORD m_Flags;      // CKArchive::ENTRY_COMPRESSED
+};
+
+/****************************************************************
+Summary: Pack file holding many files, read from a memory mapping.
+
+Remarks:
+    o A pack file has an index of its files (names compared without case,
+    '/' and '\' being the same) and their data, stored or compressed with
+    CKPackData. It is written by CKArchiveWriter.
+    o The pack file is mapped with VxMemoryMappedFile: Lock returns a
+    pointer in the mapping for a stored file (nothing is copied, the system
+    reads the pages on first access) and a buffer decompressed with
+    CKUnPackData for a compressed one, to be given back to Unlock.
+    o Once opened, Find, Lock and Unlock can be called from any thread.
+
+See Also: CKArchiveWriter,CKArchiveSet
+****************************************************************/
+class CKArchive
+{
+public:
+    enum
+    {
+        Magic = 0x4B505856, // "KPXV", the value given by Visual C++ to 'KPXV'
+        Version = 1,
+        ENTRY_COMPRESSED = 1
+    };
+
+    CKArchive() : m_Mapping(NULL), m_Base(NULL), m_Entries(NULL), m_Names(NULL), m_EntryCount(0) {}
+    ~CKArchive() { Close(); }
+
+    CKERROR Open(CKSTRING fileName)
+    {
+        Close();
+        m_Mapping = new VxMemoryMappedFile(fileName);
+        if (!m_Mapping->IsValid() || m_Mapping->GetFileSize() < sizeof(CKArchiveHeader))
+        {
+            Close();
+            return CKERR_INVALIDFILE;
+        }
+        m_Base = (CKBYTE *)m_Mapping->GetBase();
+        const XULONG size = m_Mapping->GetFileSize();
+        const CKArchiveHeader *header = (const CKArchiveHeader *)m_Base;
+        if (header->m_Magic != Magic || header->m_Version != Version ||
+            header->m_TableOffset > size || header->m_EntryCount > (size - header->m_TableOffset) / sizeof(CKArchiveEntry) ||
+            header->m_NamesOffset > size || header->m_NamesSize > size - header->m_NamesOffset ||
+            (header->m_NamesSize && m_Base[header->m_NamesOffset + header->m_NamesSize - 1] != '\0'))
+        {
+            Close();
+            return CKERR_INVALIDFILE;
+        }
+        m_Entries = (const CKArchiveEntry *)(m_Base + header->m_TableOffset);
+        m_Names = (const char *)(m_Base + header->m_NamesOffset);
+        m_EntryCount = header->m_EntryCount;
+        for (int i = 0; i < m_EntryCount; ++i)
+        {
+            const CKArchiveEntry &e = m_Entries[i];
+            // Lock returns a stored file in place: its size is the one checked against the mapping
+            if (e.m_Name >= header->m_NamesSize || e.m_Offset > size || e.m_PackedSize > size - e.m_Offset ||
+                (!(e.m_Flags & ENTRY_COMPRESSED) && e.m_Size != e.m_PackedSize))
+            {
+                Close();
+                return CKERR_INVALIDFILE;
+            }
+            m_Index.Insert(m_Names + e.m_Name, i, FALSE);
+        }
+        m_FileName = fileName;
+        return CK_OK;
+    }
+
+    void Close()
+    {
+        delete m_Mapping;
+        m_Mapping = NULL;
+        m_Base = NULL;
+        m_Entries = NULL;
+        m_Names = NULL;
+        m_EntryCount = 0;
+        m_Index.Clear();
+        m_FileName = "";
+    }
+
+    CKBOOL IsOpen() const { return m_Base != NULL; }
+    const char *GetFileName() const { return m_FileName.CStr(); }
+
+    int GetEntryCount() const { return m_EntryCount; }
+    const char *GetEntryName(int index) const { return m_Names + m_Entries[index].m_Name; }
+    int GetEntrySize(int index) const { return m_Entries[index].m_Size; }
+    CKBOOL IsEntryCompressed(int index) const { return (m_Entries[index].m_Flags & ENTRY_COMPRESSED) != 0; }
+
+    // Index of a file, -1 if it is not in the pack.
+    int Find(const char *name) const
+    {
+        char normalized[_MAX_PATH];
+        if (!Normalize(name, normalized))
+            return -1;
+        const int *index = m_Index.FindPtr(normalized);
+        return index ? *index : -1;
+    }
+
+    /*************************************************
+    Summary: Gives access to the data of a file.
+
+    Arguments:
+        index: Index of the file.
+        size: Receives the size of the file.
+    Return Value:
+        Data to give back to Unlock, NULL if the data could not be decompressed.
+    *************************************************/
+    CKBYTE *Lock(int index, int &size) const
+    {
+        const CKArchiveEntry &e = m_Entries[index];
+        size = e.m_Size;
+        if (!(e.m_Flags & ENTRY_COMPRESSED))
+            return m_Base + e.m_Offset;
+        return (CKBYTE *)CKUnPackData(e.m_Size, (char *)m_Base + e.m_Offset, e.m_PackedSize);
+    }
+
+    void Unlock(int index, CKBYTE *data) const
+    {
+        if (data && (m_Entries[index].m_Flags & ENTRY_COMPRESSED))
+            CKDeletePointer(data); // allocated by CK2
+    }
+
+    // Checks the data of a file against its CRC.
+    CKBOOL Verify(int index) const
+    {
+        int size = 0;
+        CKBYTE *data = Lock(index, size);
+        const CKBOOL ok = data && CKComputeDataCRC((char *)data, size) == m_Entries[index].m_CRC;
+        Unlock(index, data);
+        return ok;
+    }
+
+    /*************************************************
+    Summary: Writes a file of the pack to a temporary file.
+
+    Arguments:
+        index: Index of the file.
+        path: Receives the path of the temporary file, which has the extension of the file.
+    Return Value:
+        FALSE if the file could not be written.
+    Remarks:
+        For the readers which can only read files (no CK_DATAREADER_MEMORYLOAD
+    flag). The temporary file must be deleted (remove) once read.
+    *************************************************/
+    CKBOOL Extract(int index, XString &path) const
+    {
+        char *temp = _tempnam(NULL, "ck");
+        if (!temp)
+            return FALSE;
+        path = temp;
+        free(temp);
+        const char *name = GetEntryName(index);
+        const char *ext = strrchr(name, '.');
+        if (ext && !strchr(ext, '\\'))
+            path << ext;
+
+        int size = 0;
+        CKBYTE *data = Lock(index, size);
+        FILE *file = data ? fopen(path.CStr(), "wb") : NULL;
+        CKBOOL ok = file && fwrite(data, 1, size, file) == (size_t)size;
+        if (file && fclose(file) != 0)
+            ok = FALSE;
+        Unlock(index, data);
+        if (file && !ok)
+            remove(path.CStr());
+        return ok;
+    }
+
+    // Converts a name to the form stored in the index ('\' separators, no leading ".\"), FALSE if too long.
+    static CKBOOL Normalize(const char *name, char *normalized)
+    {
+        while (name[0] == '.' && (name[1] == '\\' || name[1] == '/'))
+            name += 2;
+        const int length = (int)strlen(name);
+        if (length >= _MAX_PATH)
+            return FALSE;
+        for (int i = 0; i <= length; ++i)
+            normalized[i] = name[i] == '/' ? '\\' : name[i];
+        return TRUE;
+    }
+
+protected:
+    typedef XHashTable<int, const char *, XHashFunStringI, XEqualStringI> NameTable;
+
+    VxMemoryMappedFile *m_Mapping;
+    CKBYTE *m_Base;
+    const CKArchiveEntry *m_Entries;
+    const char *m_Names;
+    int m_EntryCount;
+    NameTable m_Index;
+    XString m_FileName;
+
+private:
+    CKArchive(const CKArchive &);
+    CKArchive &operator=(const CKArchive &);
+};
+
+/****************************************************************
+Summary: Writes a pack file read by CKArchive.
+
+Remarks:
+    o The files are added from memory, from disk or a whole directory,
+    each with a compression level (0 to store it, 1 to 9 for CKPackData).
+    A file compressed to more than 90% of its size is stored.
+    o Already compressed formats (jpg, png, ogg, mp3) are better stored:
+    they are then read in place from the mapping.
+
+    CKArchiveWriter writer;
+    writer.AddDirectory("Textures", "*.tga", 6);
+    writer.AddDirectory("Sounds", "*.ogg", 0);
+    writer.Write("Level.pak");
+
+See Also: CKArchive
+****************************************************************/
+class CKArchiveWriter
+{
+public:
+    CKArchiveWriter() {}
+    ~CKArchiveWriter()
+    {
+        for (int i = 0; i < m_Files.Size(); ++i)
+            Free(m_Files[i]);
+    }
+
+    // Adds a file from memory, the data is copied (or compressed).
+    void Add(const char *name, const void *data, int size, int compression = 0)
+    {
+        File f;
+        char normalized[_MAX_PATH];
+        if (!CKArchive::Normalize(name, normalized))
+            return;
+        f.m_Name = normalized;
+        f.m_Size = size;
+        f.m_CRC = CKComputeDataCRC((char *)data, size);
+        f.m_Data = NULL;
+        f.m_Packed = FALSE;
+        if (compression > 0 && size > 0)
+        {
+            int packedSize = 0;
+            char *packed = CKPackData((char *)data, size, packedSize, compression);
+            if (packed && packedSize < size - size / 10)
+            {
+                f.m_Data = (CKBYTE *)packed;
+                f.m_PackedSize = packedSize;
+                f.m_Packed = TRUE;
+            }
+            else if (packed)
+            {
+                CKDeletePointer(packed);
+            }
+        }
+        if (!f.m_Data)
+        {
+            f.m_Data = new CKBYTE[size > 0 ? size : 1];
+            memcpy(f.m_Data, data, size);
+            f.m_PackedSize = size;
+        }
+        m_Files.PushBack(f);
+    }
+
+    CKBOOL AddFile(const char *name, CKSTRING path, int compression = 0)
+    {
+        VxMemoryMappedFile file(path);
+        if (!file.IsValid())
+            return FALSE;
+        Add(name, file.GetBase(), file.GetFileSize(), compression);
+        return TRUE;
+    }
+
+    // Adds the files of a directory, named by their path relative to it, returns the number added.
+    int AddDirectory(CKSTRING directory, const char *mask = "*.*", int compression = 0, CKBOOL recurse = TRUE)
+    {
+        int count = 0;
+        size_t skip = strlen(directory);
+        CKDirectoryParser parser(directory, (char *)mask, recurse);
+        while (char *path = parser.GetNextFile())
+        {
+            const char *name = path + skip;
+            while (*name == '\\' || *name == '/')
+                ++name;
+            if (AddFile(name, path, compression))
+                ++count;
+        }
+        return count;
+    }
+
+    int GetFileCount() const { return m_Files.Size(); }
+
+    CKERROR Write(CKSTRING fileName)
+    {
+        FILE *file = fopen(fileName, "wb");
+        if (!file)
+            return CKERR_CANTWRITETOFILE;
+        CKArchiveHeader header;
+        memset(&header, 0, sizeof(header));
+        fwrite(&header, sizeof(header), 1, file);
+
+        XArray<CKArchiveEntry> entries;
+        XArray<char> names;
+        CKDWORD offset = sizeof(header);
+        for (int i = 0; i < m_Files.Size(); ++i)
+        {
+            const File &f = m_Files[i];
+            static const char padding[16] = {0};
+            const CKDWORD pad = (16 - offset % 16) % 16;
+            fwrite(padding, 1, pad, file);
+            offset += pad;
+            CKArchiveEntry e;
+            e.m_Name = names.Size();
+            e.m_Offset = offset;
+            e.m_PackedSize = f.m_PackedSize;
+            e.m_Size = f.m_Size;
+            e.m_CRC = f.m_CRC;
+            e.m_Flags = f.m_Packed ? CKArchive::ENTRY_COMPRESSED : 0;
+            entries.PushBack(e);
+            names.Resize(e.m_Name + f.m_Name.Length() + 1);
+            memcpy(&names[e.m_Name], f.m_Name.CStr(), f.m_Name.Length() + 1);
+            fwrite(f.m_Data, 1, f.m_PackedSize, file);
+            offset += f.m_PackedSize;
+        }
+
+        header.m_Magic = CKArchive::Magic;
+        header.m_Version = CKArchive::Version;
+        header.m_EntryCount = entries.Size();
+        header.m_TableOffset = offset;
+        header.m_NamesOffset = offset + entries.Size() * sizeof(CKArchiveEntry);
+        header.m_NamesSize = names.Size();
+        fwrite(entries.Begin(), sizeof(CKArchiveEntry), entries.Size(), file);
+        fwrite(names.Begin(), 1, names.Size(), file);
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        const CKBOOL ok = !ferror(file);
+        fclose(file);
+        return ok ? CK_OK : CKERR_CANTWRITETOFILE;
+    }
+
+protected:
+    struct File
+    {
+        XString m_Name;
+        CKBYTE *m_Data;
+        int m_Size;
+        int m_PackedSize;
+        CKDWORD m_CRC;
+        CKBOOL m_Packed;
+    };
+
+    static void Free(File &f)
+    {
+        if (f.m_Packed)
+            CKDeletePointer(f.m_Data);
+        else
+            delete[] f.m_Data;
+    }
+
+    XClassArray<File> m_Files;
+
+private:
+    CKArchiveWriter(const CKArchiveWriter &);
+    CKArchiveWriter &operator=(const CKArchiveWriter &);
+};
+
+/****************************************************************
+Summary: Pack files mounted in the path categories of a context.
+
+Remarks:
+    o A pack file mounted in a category (BITMAP_PATH_IDX, SOUND_PATH_IDX,
+    DATA_PATH_IDX or an application category) is searched before the
+    paths of the category, the last mounted first. A name is searched as
+    given, then by its file name alone (the textures of a composition keep
+    the path they were created with).
+    o The path manager and the objects of CK2 do not know about the
+    mounted packs: the files are loaded from them with LoadImage,
+    OpenSound and LoadComposition, which give the data in memory to the
+    bitmap and sound readers (CKBitmapReader::ReadMemory,
+    CKSoundReader::ReadMemory) and to CKContext::Load. CKBitmapLoader
+    decodes from the packs of a set given to SetArchives.
+    o The files included in a composition with CKFile::IncludeFile are
+    extracted by CK2 itself and cannot be read from a pack.
+
+    CKArchive pack;
+    pack.Open("Level.pak");
+    CKArchiveSet archives(context);
+    archives.Mount(&pack, BITMAP_PATH_IDX);
+    archives.Mount(&pack, DATA_PATH_IDX);
+    archives.LoadComposition("Level.nmo", list);
+    archives.LoadImage(texture, "wood.tga");
+
+See Also: CKArchive,CKPathManager
+****************************************************************/
+class CKArchiveSet
+{
+public:
+    explicit CKArchiveSet(CKContext *context) : m_Context(context) {}
+
+    ~CKArchiveSet()
+    {
+        while (m_Mounts.Size())
+            Unmount(m_Mounts[0].m_Archive);
+    }
+
+    void Mount(CKArchive *archive, int catIdx)
+    {
+        Mounted m;
+        m.m_Archive = archive;
+        m.m_Category = catIdx;
+        m_Mounts.PushBack(m);
+    }
+
+    // Unmounts a pack from all the categories, the sound data (or temporary files) taken from it are freed.
+    void Unmount(CKArchive *archive)
+    {
+        for (int i = m_Mounts.Size() - 1; i >= 0; --i)
+            if (m_Mounts[i].m_Archive == archive)
+                m_Mounts.RemoveAt(i);
+        for (int i = m_Kept.Size() - 1; i >= 0; --i)
+        {
+            if (m_Kept[i].m_Archive == archive)
+            {
+                archive->Unlock(m_Kept[i].m_Index, m_Kept[i].m_Data);
+                if (m_Kept[i].m_TempFile.Length())
+                    remove(m_Kept[i].m_TempFile.CStr());
+                m_Kept.RemoveAt(i);
+            }
+        }
+    }
+
+    /*************************************************
+    Summary: Finds a file in the packs mounted in a category.
+
+    Arguments:
+        name: File name, with or without a path.
+        catIdx: Category, -1 for all.
+        index: Receives the index of the file in the pack.
+    Return Value:
+        Pack holding the file, NULL if none.
+    *************************************************/
+    CKArchive *Find(const char *name, int catIdx, int &index) const
+    {
+        if (!name || !*name)
+            return NULL;
+        const char *fileName = XMax(strrchr(name, '\\'), strrchr(name, '/'));
+        for (int i = m_Mounts.Size() - 1; i >= 0; --i)
+        {
+            const Mounted &m = m_Mounts[i];
+            if (catIdx >= 0 && m.m_Category != catIdx)
+                continue;
+            index = m.m_Archive->Find(name);
+            if (index < 0 && fileName)
+                index = m.m_Archive->Find(fileName + 1);
+            if (index >= 0)
+                return m.m_Archive;
+        }
+        return NULL;
+    }
+
+    // Loads a slot of a texture from the packs of BITMAP_PATH_IDX, FALSE if the file is not in them.
+    CKBOOL LoadImage(CKTexture *tex, CKSTRING name, int slot = 0)
+    {
+        int index = -1;
+        CKArchive *archive = Find(name, BITMAP_PATH_IDX, index);
+        if (!tex || !archive)
+            return FALSE;
+        CKPathSplitter splitter(name);
+        CKFileExtension ext(splitter.GetExtension());
+        CKBitmapReader *reader = CKGetPluginManager()->GetBitmapReader(ext);
+        if (!reader)
+            return FALSE;
+
+        CKBOOL ok = FALSE;
+        int size = 0;
+        CKBYTE *data = NULL;
+        XString temp;
+        CKBitmapProperties *bp = NULL;
+        int err = -1;
+        if (reader->GetFlags() & CK_DATAREADER_MEMORYLOAD)
+        {
+            data = archive->Lock(index, size);
+            if (data)
+                err = reader->ReadMemory(data, size, &bp);
+        }
+        else if (archive->Extract(index, temp))
+        {
+            // the reader can only read files
+            err = reader->ReadFile(temp.Str(), &bp);
+        }
+        if (err == 0 && bp)
+        {
+            VxImageDescEx src = bp->m_Format;
+            if (!src.Image)
+                src.Image = (XBYTE *)bp->m_Data;
+            if (slot >= tex->GetSlotCount())
+                tex->SetSlotCount(slot + 1);
+            if (src.Image && tex->CreateImage(src.Width, src.Height, 32, slot))
+            {
+                VxImageDescEx dst;
+                tex->GetImageDesc(dst);
+                dst.Image = tex->LockSurfacePtr(slot);
+                if (dst.Image)
+                    VxFastBlit(src, dst);
+                tex->ReleaseSurfacePtr(slot);
+                tex->SetSlotFileName(slot, name);
+                ok = dst.Image != NULL;
+            }
+            reader->ReleaseMemory(bp->m_Data);
+            bp->m_Data = NULL;
+        }
+        archive->Unlock(index, data);
+        if (temp.Length())
+            remove(temp.CStr());
+        reader->Release();
+        return ok;
+    }
+
+    /*************************************************
+    Summary: Opens a sound reader on a file of the packs of SOUND_PATH_IDX.
+
+    Remarks:
+        o The reader reads the data in place: the data of a compressed file
+        is kept until the pack is unmounted, the sounds are better stored.
+        o A reader which can not read from memory (no CK_DATAREADER_MEMORYLOAD
+        flag) reads a temporary copy of the file, deleted when the pack is
+        unmounted.
+        o The reader can be given to CKSoundStreamer::AddStream, and must be
+        released (CKDataReader::Release) before the pack is unmounted.
+    *************************************************/
+    CKSoundReader *OpenSound(CKSTRING name)
+    {
+        int index = -1;
+        CKArchive *archive = Find(name, SOUND_PATH_IDX, index);
+        if (!archive)
+            return NULL;
+        CKPathSplitter splitter(name);
+        CKFileExtension ext(splitter.GetExtension());
+        CKSoundReader *reader = CKGetPluginManager()->GetSoundReader(ext);
+        if (!reader)
+            return NULL;
+        if (!(reader->GetFlags() & CK_DATAREADER_MEMORYLOAD))
+        {
+            Kept k;
+            k.m_Archive = archive;
+            k.m_Index = index;
+            k.m_Data = NULL;
+            if (!archive->Extract(index, k.m_TempFile) || reader->OpenFile(k.m_TempFile.Str()) != CK_OK)
+            {
+                if (k.m_TempFile.Length())
+                    remove(k.m_TempFile.CStr());
+                reader->Release();
+                return NULL;
+            }
+            m_Kept.PushBack(k);
+            return reader;
+        }
+        int size = 0;
+        CKBYTE *data = archive->Lock(index, size);
+        if (!data || reader->ReadMemory(data, size) != CK_OK)
+        {
+            archive->Unlock(index, data);
+            reader->Release();
+            return NULL;
+        }
+        if (archive->IsEntryCompressed(index))
+        {
+            Kept k;
+            k.m_Archive = archive;
+            k.m_Index = index;
+            k.m_Data = data;
+            m_Kept.PushBack(k);
+        }
+        return reader;
+    }
+
+    // CKContext::Load of a composition of the packs of DATA_PATH_IDX, CKERR_NOTFOUND if it is not in them.
+    CKERROR LoadComposition(CKSTRING name, CKObjectArray *list, CK_LOAD_FLAGS flags = CK_LOAD_DEFAULT)
+    {
+        int index = -1;
+        CKArchive *archive = Find(name, DATA_PATH_IDX, index);
+        if (!archive)
+            return CKERR_NOTFOUND;
+        int size = 0;
+        CKBYTE *data = archive->Lock(index, size);
+        if (!data)
+            return CKERR_INVALIDFILE;
+        CKERROR err = m_Context->Load(size, data, list, flags);
+        archive->Unlock(index, data);
+        return err;
+    }
+
+protected:
+    struct Mounted
+    {
+        CKArchive *m_Archive;
+        int m_Category;
+    };
+
+    struct Kept
+    {
+        CKArchive *m_Archive;
+        int m_Index;
+        CKBYTE *m_Data;     // data read in place by a sound reader
+        XString m_TempFile; // or copy read by a reader which can not read from memory
+    };
+
+    CKContext *m_Context;
+    XArray<Mounted> m_Mounts;
+    XClassArray<Kept> m_Kept;
+
+private:
+    CKArchiveSet(const CKArchiveSet &);
+    CKArchiveSet &operator=(const CKArchiveSet &);
+};
+
+#endif // CKARCHIVE_H
@@ -0,0 +1,273 @@
+#ifndef CKATTRIBUTEINDEX_H
+#define CKATTRIBUTEINDEX_H
+
+#include "CKContext.h"
+#include "CKAttributeManager.h"
+#include "CKBeObject.h"
+#include "XBitArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Sets of the objects having some attributes, with change counters and combined queries.
+
+Remarks:
+    o Each tracked attribute keeps the dense array of its objects and a
+    bit array indexed by object slot (an index given to each object the
+    first time it enters a set). Queries combining attributes (all of,
+    any of, none of) are bit array operations.
+    o Each set has a change counter incremented when its members change,
+    so the managers reading a set (floors, obstacles, grids...) can skip
+    it when the counter did not move since their last read.
+    o SetAttribute and RemoveAttribute change the attribute of the object
+    and update the sets at once. The attributes changed directly on the
+    objects are found by Update, which compares each tracked set with
+    CKAttributeManager::GetAttributeListPtr: its cost is the size of the
+    tracked sets, not the number of objects times attributes.
+
+    CKAttributeIndex index(ctx);
+    index.Track(floorAttribute);
+    index.Track(movingAttribute);
+    ...
+    index.Update();
+    if (index.GetChangeCount(floorAttribute) != lastCount)
+        ...
+    CKAttributeType none[1] = {movingAttribute};
+    index.Query(&floorAttribute, 1, NULL, 0, none, 1, staticFloors);
+
+See Also: CKAttributeManager,CKBeObject::SetAttribute,XBitArray
+****************************************************************/
+class CKAttributeIndex
+{
+public:
+    CKAttributeIndex(CKContext *ctx) : m_Context(ctx) {}
+
+    // Adds an attribute to the index and reads its objects.
+    void Track(CKAttributeType type)
+    {
+        if (type < 0 || FindSet(type))
+            return;
+        m_Sets.Expand(1);
+        AttributeSet &set = m_Sets.Back();
+        set.m_Type = type;
+        set.m_Changes = 0;
+        Refresh(set);
+    }
+
+    void Untrack(CKAttributeType type)
+    {
+        for (int i = 0; i < m_Sets.Size(); ++i)
+        {
+            if (m_Sets[i].m_Type == type)
+            {
+                m_Sets.RemoveAt(i);
+                return;
+            }
+        }
+    }
+
+    void Clear()
+    {
+        m_Sets.Resize(0);
+        m_Slots.Clear();
+        m_SlotObjects.Resize(0);
+    }
+
+    //---------------------------------------------
+    // Attribute changes
+
+    CKBOOL SetAttribute(CKBeObject *obj, CKAttributeType type, CK_ID parameter = 0)
+    {
+        if (!obj || !obj->SetAttribute(type, parameter))
+            return FALSE;
+        AttributeSet *set = FindSet(type);
+        if (set)
+        {
+            const int slot = GetSlot(obj->GetID());
+            if (set->m_Bits.TestSet(slot))
+            {
+                set->m_Members.PushBack(obj->GetID());
+                ++set->m_Changes;
+            }
+        }
+        return TRUE;
+    }
+
+    CKBOOL RemoveAttribute(CKBeObject *obj, CKAttributeType type)
+    {
+        if (!obj || !obj->RemoveAttribute(type))
+            return FALSE;
+        AttributeSet *set = FindSet(type);
+        const int *slot = m_Slots.FindPtr(obj->GetID());
+        if (set && slot && set->m_Bits.TestUnset(*slot))
+        {
+            set->m_Members.Remove(obj->GetID());
+            ++set->m_Changes;
+        }
+        return TRUE;
+    }
+
+    /************************************************
+    Summary: Reads again the sets changed outside of the index.
+
+    Return Value:
+        Number of sets whose members changed.
+    ************************************************/
+    int Update()
+    {
+        int changed = 0;
+        for (int i = 0; i < m_Sets.Size(); ++i)
+        {
+            AttributeSet &set = m_Sets[i];
+            if (IsUpToDate(set))
+                continue;
+            Refresh(set);
+            ++changed;
+        }
+        return changed;
+    }
+
+    //---------------------------------------------
+    // Queries
+
+    // Incremented each time the objects having the attribute change, -1 for an attribute not tracked.
+    int GetChangeCount(CKAttributeType type)
+    {
+        AttributeSet *set = FindSet(type);
+        return set ? set->m_Changes : -1;
+    }
+
+    // IDs of the objects having the attribute.
+    const XArray<CK_ID> *GetMembers(CKAttributeType type)
+    {
+        AttributeSet *set = FindSet(type);
+        return set ? &set->m_Members : NULL;
+    }
+
+    CKBOOL HasAttribute(CKBeObject *obj, CKAttributeType type)
+    {
+        AttributeSet *set = FindSet(type);
+        const int *slot = obj ? m_Slots.FindPtr(obj->GetID()) : NULL;
+        return set && slot && set->m_Bits.IsSet(*slot);
+    }
+
+    /************************************************
+    Summary: Finds the objects matching a combination of attributes.
+
+    Arguments:
+        all: The objects must have all these attributes...
+        any: ...and at least one of these...
+        none: ...and none of these. The attributes must be tracked.
+    Return Value:
+        Number of objects added to result, which is emptied first.
+    Remarks:
+        At least one attribute must be given in all or any.
+    ************************************************/
+    int Query(const CKAttributeType *all, int allCount, const CKAttributeType *any, int anyCount,
+              const CKAttributeType *none, int noneCount, XObjectPointerArray &result)
+    {
+        result.Resize(0);
+        if (allCount <= 0 && anyCount <= 0)
+            return 0;
+        XBitArray bits((m_SlotObjects.Size() >> 5) + 1);
+        int i;
+        AttributeSet *set;
+        if (anyCount > 0)
+        {
+            for (i = 0; i < anyCount; ++i)
+            {
+                if ((set = FindSet(any[i])) != NULL)
+                    bits.Or(set->m_Bits);
+            }
+        }
+        for (i = 0; i < allCount; ++i)
+        {
+            set = FindSet(all[i]);
+            if (!set)
+                return 0;
+            if (i == 0 && anyCount <= 0)
+                bits.Or(set->m_Bits);
+            else
+                bits.And(set->m_Bits);
+        }
+        for (i = 0; i < noneCount; ++i)
+        {
+            if ((set = FindSet(none[i])) != NULL)
+                bits -= set->m_Bits;
+        }
+        for (int slot = bits.GetNextSetBit(0); slot >= 0; slot = bits.GetNextSetBit(slot + 1))
+        {
+            CKObject *obj = m_Context->GetObject(m_SlotObjects[slot]);
+            if (obj)
+                result.PushBack(obj);
+        }
+        return result.Size();
+    }
+
+protected:
+    struct AttributeSet
+    {
+        CKAttributeType m_Type;
+        int m_Changes;
+        XArray<CK_ID> m_Members;
+        XBitArray m_Bits; // by object slot
+    };
+
+    AttributeSet *FindSet(CKAttributeType type)
+    {
+        for (int i = 0; i < m_Sets.Size(); ++i)
+        {
+            if (m_Sets[i].m_Type == type)
+                return &m_Sets[i];
+        }
+        return NULL;
+    }
+
+    int GetSlot(CK_ID id)
+    {
+        const int *slot = m_Slots.FindPtr(id);
+        if (slot)
+            return *slot;
+        const int s = m_SlotObjects.Size();
+        m_SlotObjects.PushBack(id);
+        m_Slots.Insert(id, s);
+        return s;
+    }
+
+    // Same objects as the list of the attribute manager.
+    CKBOOL IsUpToDate(AttributeSet &set)
+    {
+        const XObjectPointerArray &list = m_Context->GetAttributeManager()->GetAttributeListPtr(set.m_Type);
+        if (list.Size() != set.m_Members.Size())
+            return FALSE;
+        for (CKObject **it = list.Begin(); it != list.End(); ++it)
+        {
+            const int *slot = *it ? m_Slots.FindPtr((*it)->GetID()) : NULL;
+            if (!slot || !set.m_Bits.IsSet(*slot))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    void Refresh(AttributeSet &set)
+    {
+        const XObjectPointerArray &list = m_Context->GetAttributeManager()->GetAttributeListPtr(set.m_Type);
+        set.m_Members.Resize(0);
+        set.m_Bits.Clear();
+        for (CKObject **it = list.Begin(); it != list.End(); ++it)
+        {
+            if (!*it)
+                continue;
+            const CK_ID id = (*it)->GetID();
+            if (set.m_Bits.TestSet(GetSlot(id)))
+                set.m_Members.PushBack(id);
+        }
+        ++set.m_Changes;
+    }
+
+    CKContext *m_Context;
+    XClassArray<AttributeSet> m_Sets;
+    XHashTable<int, CK_ID> m_Slots;
+    XArray<CK_ID> m_SlotObjects;
+};
+
+#endif // CKATTRIBUTEINDEX_H
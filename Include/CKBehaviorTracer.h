@@ -0,0 +1,361 @@
+#ifndef CKBEHAVIORTRACER_H
+#define CKBEHAVIORTRACER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKBehavior.h"
+#include "CKTimeManager.h"
+#include "VxFrameProfiler.h"
+#include "XHashTable.h"
+
+#define BEHAVIOR_TRACER_GUID CKGUID(0x5b217e4c, 0x1d93a6f8)
+
+// An execution of a behavior function recorded by CKBehaviorTracer.
+struct CKBehaviorTraceRecord
+{
+    CK_ID m_Behavior;
+    CKDWORD m_Inputs; // bit i set if input i was active (first 32 inputs)
+    CKDWORD m_Frame;  // CKTimeManager::GetMainTickCount
+    int m_Result;     // returned by the function (CKBR_OK, CKBR_ACTIVATENEXTFRAME...)
+    int m_Thread;     // index of the ring of the executing thread
+    VxProfileTick m_Start;
+    VxProfileTick m_End;
+};
+
+/****************************************************************
+Summary: Records the executions of behavior functions in rings, without the debug mode.
+
+Remarks:
+    o CKDebugContext follows the execution step by step but needs the
+    debug mode of the context, which runs the behaviors differently. The
+    tracer leaves the execution as is: Trace replaces the function of the
+    behaviors (CKBehavior::SetFunction) by one which records the behavior,
+    its active inputs, the frame and the time, calls the original function
+    and records its return value.
+    o Disabled (Enable(FALSE)), the behaviors are given their original
+    function back: tracing costs nothing. Enabled, a call costs a lookup
+    of the original function and two timestamp reads.
+    o Each thread writes in its own ring (found through a TLS slot) which
+    keeps the last records: after a stall the last frames of logic are
+    available. GetRecords and ExportChromeTrace read the rings and must
+    be called by the thread executing the behaviors, between two process.
+    o ExportChromeTrace writes the records with the frames of a
+    VxFrameProfiler (usually the one of CKFrameProfiler): the behaviors
+    appear in the "Behaviors" zones of the thread driving the frames.
+    o The function is restored before saving (PreSave) and when the
+    context is cleared. Behaviors created later must be traced again.
+    o The trace function finds the tracer through a pointer of the module
+    (the last tracer created): one tracer per module.
+
+    CKBehaviorTracer *tracer = CKBehaviorTracer::Get(context);
+    tracer->TraceAll();
+    tracer->Enable(TRUE);
+    ...
+    // the logic stalled
+    tracer->ExportChromeTrace("behaviors.json", CKFrameProfiler::Get(context)->GetProfiler());
+
+See Also: CKDebugContext,CKFrameProfiler,VxFrameProfiler::ExportChromeTrace
+****************************************************************/
+class CKBehaviorTracer : public CKBaseManager
+{
+public:
+    // The tracer of the context, created on the first call.
+    static CKBehaviorTracer *Get(CKContext *context, int recordsPerThread = 16384)
+    {
+        CKBehaviorTracer *tracer = (CKBehaviorTracer *)context->GetManagerByGuid(BEHAVIOR_TRACER_GUID);
+        if (!tracer)
+            tracer = new CKBehaviorTracer(context, recordsPerThread);
+        return tracer;
+    }
+
+    ~CKBehaviorTracer()
+    {
+        Clear();
+        if (InstancePointer() == this)
+            InstancePointer() = NULL;
+        TlsFree(m_Tls);
+        for (int i = 0; i < m_Rings.Size(); ++i)
+            delete m_Rings[i];
+    }
+
+    /*************************************************
+    Summary: Traces a behavior and its sub-behaviors.
+
+    Return Value:
+        Number of behavior functions added.
+    *************************************************/
+    int Trace(CKBehavior *beh)
+    {
+        if (!beh)
+            return 0;
+        int count = 0;
+        CKBEHAVIORFCT fct = beh->IsUsingFunction() ? beh->GetFunction() : NULL;
+        if (fct && fct != TraceFunction && m_Functions.Insert(beh->GetID(), fct, FALSE))
+        {
+            if (m_Enabled)
+                beh->SetFunction(TraceFunction);
+            ++count;
+        }
+        for (int i = 0; i < beh->GetSubBehaviorCount(); ++i)
+            count += Trace(beh->GetSubBehavior(i));
+        return count;
+    }
+
+    // Traces all the behaviors of the context.
+    int TraceAll()
+    {
+        int count = 0;
+        const int behCount = m_Context->GetObjectsCountByClassID(CKCID_BEHAVIOR);
+        CK_ID *ids = m_Context->GetObjectsListByClassID(CKCID_BEHAVIOR);
+        for (int i = 0; i < behCount; ++i)
+        {
+            CKBehavior *beh = (CKBehavior *)m_Context->GetObject(ids[i]);
+            if (beh && !beh->GetParent())
+                count += Trace(beh);
+        }
+        return count;
+    }
+
+    // Gives a behavior and its sub-behaviors their function back.
+    void Untrace(CKBehavior *beh)
+    {
+        if (!beh)
+            return;
+        CKBEHAVIORFCT *fct = m_Functions.FindPtr(beh->GetID());
+        if (fct)
+        {
+            if (beh->GetFunction() == TraceFunction)
+                beh->SetFunction(*fct);
+            m_Functions.Remove(beh->GetID());
+        }
+        for (int i = 0; i < beh->GetSubBehaviorCount(); ++i)
+            Untrace(beh->GetSubBehavior(i));
+    }
+
+    // Gives all the traced behaviors their function back, the records are kept.
+    void Clear()
+    {
+        Install(FALSE);
+        m_Functions.Clear();
+    }
+
+    void Enable(CKBOOL enable)
+    {
+        enable = enable ? TRUE : FALSE;
+        if (enable == m_Enabled)
+            return;
+        m_Enabled = enable;
+        Install(enable);
+    }
+    CKBOOL IsEnabled() const { return m_Enabled; }
+
+    int GetTracedCount() const { return m_Functions.Size(); }
+
+    // Records of all the threads, oldest first.
+    void GetRecords(XArray<CKBehaviorTraceRecord> &records)
+    {
+        records.Resize(0);
+        VxMutexLock lock(m_Lock);
+        for (int i = 0; i < m_Rings.Size(); ++i)
+        {
+            Ring *ring = m_Rings[i];
+            const int written = VxAtomicLoad(&ring->m_Written);
+            const int capacity = ring->m_Records.Size();
+            const int count = XMin(written, capacity);
+            for (int r = written - count; r < written; ++r)
+                records.PushBack(ring->m_Records[r % capacity]);
+        }
+        records.Sort(CompareRecords);
+    }
+
+    // Forgets the records.
+    void ClearRecords()
+    {
+        VxMutexLock lock(m_Lock);
+        for (int i = 0; i < m_Rings.Size(); ++i)
+            VxAtomicStore(&m_Rings[i]->m_Written, 0);
+    }
+
+    /*************************************************
+    Summary: Writes the records with the frames of a profiler to a Chrome trace event file.
+
+    Arguments:
+        fileName: File to write.
+        profiler: Profiler whose frames are written with the records.
+        thread: Thread of the profiler the records of the first ring are shown on (0, the thread driving the frames).
+    Remarks:
+        o A record is a zone named after the behavior, followed by the active inputs ("Timer [0]").
+    *************************************************/
+    CKBOOL ExportChromeTrace(const char *fileName, const VxFrameProfiler &profiler, int thread = 0)
+    {
+        XArray<CKBehaviorTraceRecord> records;
+        GetRecords(records);
+        XClassArray<XString> names(records.Size());
+        XArray<VxProfileZone> zones;
+        names.Resize(records.Size());
+        zones.Resize(records.Size());
+        for (int i = 0; i < records.Size(); ++i)
+        {
+            const CKBehaviorTraceRecord &rec = records[i];
+            CKObject *beh = m_Context->GetObject(rec.m_Behavior);
+            XString &name = names[i];
+            if (beh && beh->GetName())
+                name = beh->GetName();
+            else
+                name.Format("Behavior %d", (int)rec.m_Behavior);
+            XString inputs;
+            for (int in = 0; in < 32; ++in)
+            {
+                if (!(rec.m_Inputs & (1 << in)))
+                    continue;
+                XString index;
+                index.Format(inputs.Length() ? ",%d" : "%d", in);
+                inputs << index;
+            }
+            if (inputs.Length())
+                name << " [" << inputs << "]";
+            zones[i].m_Name = name.CStr();
+            zones[i].m_Start = rec.m_Start;
+            zones[i].m_End = rec.m_End;
+            zones[i].m_Thread = thread + rec.m_Thread;
+            zones[i].m_Depth = 0;
+        }
+        return profiler.ExportChromeTrace(fileName, &zones);
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PreSave()
+    {
+        Install(FALSE);
+        return CK_OK;
+    }
+
+    virtual CKERROR PostSave()
+    {
+        Install(m_Enabled);
+        return CK_OK;
+    }
+
+    virtual CKERROR PreClearAll()
+    {
+        Clear();
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_PreSave |
+               CKMANAGER_FUNC_PostSave |
+               CKMANAGER_FUNC_PreClearAll;
+    }
+
+protected:
+    struct Ring
+    {
+        Ring(int capacity) : m_Written(0) { m_Records.Resize(XMax(capacity, 1)); }
+
+        XArray<CKBehaviorTraceRecord> m_Records;
+        volatile long m_Written; // records written since the start, the last ones are kept
+        int m_Index;
+    };
+
+    CKBehaviorTracer(CKContext *context, int recordsPerThread) : CKBaseManager(context, BEHAVIOR_TRACER_GUID, "Behavior Tracer"), m_RecordsPerThread(recordsPerThread), m_Enabled(FALSE)
+    {
+        m_Tls = TlsAlloc();
+        InstancePointer() = this;
+        context->RegisterNewManager(this);
+    }
+
+    static CKBehaviorTracer *&InstancePointer()
+    {
+        static CKBehaviorTracer *instance = NULL;
+        return instance;
+    }
+
+    static int CompareRecords(const void *elem1, const void *elem2)
+    {
+        const CKBehaviorTraceRecord *a = (const CKBehaviorTraceRecord *)elem1;
+        const CKBehaviorTraceRecord *b = (const CKBehaviorTraceRecord *)elem2;
+        if (a->m_Start == b->m_Start)
+            return 0;
+        return a->m_Start < b->m_Start ? -1 : 1;
+    }
+
+    // Sets the trace function (or the original one) on the traced behaviors.
+    void Install(CKBOOL trace)
+    {
+        for (XHashTable<CKBEHAVIORFCT, CK_ID>::Iterator it = m_Functions.Begin(); it != m_Functions.End(); ++it)
+        {
+            CKBehavior *beh = (CKBehavior *)m_Context->GetObject(it.GetKey());
+            if (!beh)
+                continue;
+            if (trace)
+            {
+                if (beh->GetFunction() == *it)
+                    beh->SetFunction(TraceFunction);
+            }
+            else if (beh->GetFunction() == TraceFunction)
+            {
+                beh->SetFunction(*it);
+            }
+        }
+    }
+
+    Ring *GetRing()
+    {
+        Ring *ring = (Ring *)TlsGetValue(m_Tls);
+        if (ring)
+            return ring;
+        VxMutexLock lock(m_Lock);
+        ring = new Ring(m_RecordsPerThread);
+        ring->m_Index = m_Rings.Size();
+        m_Rings.PushBack(ring);
+        TlsSetValue(m_Tls, ring);
+        return ring;
+    }
+
+    static int TraceFunction(const CKBehaviorContext &context)
+    {
+        CKBehaviorTracer *tracer = InstancePointer();
+        CKBehavior *beh = context.Behavior;
+        CKBEHAVIORFCT *fct = tracer ? tracer->m_Functions.FindPtr(beh->GetID()) : NULL;
+        if (!fct)
+            return CKBR_OK;
+
+        CKBehaviorTraceRecord rec;
+        rec.m_Behavior = beh->GetID();
+        rec.m_Inputs = 0;
+        const int inputs = XMin(beh->GetInputCount(), 32);
+        for (int i = 0; i < inputs; ++i)
+        {
+            if (beh->IsInputActive(i))
+                rec.m_Inputs |= 1 << i;
+        }
+        rec.m_Frame = context.TimeManager ? context.TimeManager->GetMainTickCount() : 0;
+        rec.m_Start = VxReadProfileTick();
+        rec.m_Result = (*fct)(context);
+        rec.m_End = VxReadProfileTick();
+
+        Ring *ring = tracer->GetRing();
+        rec.m_Thread = ring->m_Index;
+        const long written = ring->m_Written;
+        ring->m_Records[written % ring->m_Records.Size()] = rec;
+        VxAtomicStore(&ring->m_Written, written + 1);
+        return rec.m_Result;
+    }
+
+    DWORD m_Tls;
+    int m_RecordsPerThread;
+    CKBOOL m_Enabled;
+    XHashTable<CKBEHAVIORFCT, CK_ID> m_Functions; // original function of the traced behaviors
+    VxMutex m_Lock;
+    XArray<Ring *> m_Rings;
+
+private:
+    CKBehaviorTracer(const CKBehaviorTracer &);
+    CKBehaviorTracer &operator=(const CKBehaviorTracer &);
+};
+
+#endif // CKBEHAVIORTRACER_H
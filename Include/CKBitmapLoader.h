@@ -0,0 +1,444 @@
+#ifndef CKBITMAPLOADER_H
+#define CKBITMAPLOADER_H
+
+#include "CKContext.h"
+#include "CKTexture.h"
+#include "CKBitmapReader.h"
+#include "CKPluginManager.h"
+#include "CKPathManager.h"
+#include "VxFastBlit.h"
+#include "VxThread.h"
+#include "VxMutex.h"
+#include "VxAtomic.h"
+#include "VxSync.h"
+#include "CKArchive.h"
+#include "VxAsyncIO.h"
+
+/****************************************************************
+Summary: Decodes the images of texture slots on worker threads.
+
+Remarks:
+    o CKTexture::LoadImage reads and decodes the file on the calling
+    thread. Load only queues the file of a slot: the workers read it with
+    its CKBitmapReader and convert it to 32 bit ARGB, and Sync, called
+    from the main thread (once per frame or after queuing the textures of
+    a scene), gives the decoded images to their slots as LoadImage would.
+    o The queued files are decoded by order of priority, the highest
+    first; SetPriority changes the priority of the files not decoded yet
+    (for example from the screen size of the objects using the texture).
+    o The readers whose GetFlags includes CK_DATAREADER_THREADSAFE decode
+    several files at the same time. The other readers are used by one
+    worker at a time (the decoding of other formats goes on in parallel).
+    There is one reader per file extension.
+    o The textures deleted before Sync are skipped. A texture whose slot
+    image changed must be sent to video memory again (CKTexture::Restore
+    or SystemToVideoMemory) if it already was.
+    o With SetArchives, the files found in the packs mounted in
+    BITMAP_PATH_IDX are decoded from the pack (CKBitmapReader::ReadMemory)
+    instead of being opened.
+    o With SetAsyncIO, the files are read ahead by the VxAsyncIO (with the
+    priority of their request) as soon as they are queued, and decoded
+    from memory: the reading of the next files overlaps the decoding.
+
+    CKBitmapLoader loader(context, 3);
+    for (i = 0; i < textures.Size(); ++i)
+        loader.LoadTexture(textures[i]);
+    ...
+    // each frame
+    loader.Sync();
+
+See Also: CKBitmapReader,CKTexture::LoadImage,CK_DATAREADER_FLAGS
+****************************************************************/
+class CKBitmapLoader
+{
+public:
+    explicit CKBitmapLoader(CKContext *context, int threadCount = 2)
+        : m_Context(context), m_Archives(NULL), m_IO(NULL), m_Queued(0), m_Stop(0)
+    {
+        for (int i = 0; i < threadCount; ++i)
+        {
+            Worker *w = new Worker(this);
+            if (!w->CreateThread())
+            {
+                delete w;
+                break;
+            }
+            m_Workers.PushBack(w);
+        }
+    }
+
+    ~CKBitmapLoader()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        m_Work.NotifyAll();
+        int i;
+        for (i = 0; i < m_Workers.Size(); ++i)
+        {
+            m_Workers[i]->Wait();
+            delete m_Workers[i];
+        }
+        for (i = 0; i < m_Pending.Size(); ++i)
+            delete m_Pending[i];
+        for (i = 0; i < m_Done.Size(); ++i)
+            delete m_Done[i];
+        for (i = 0; i < m_Readers.Size(); ++i)
+        {
+            m_Readers[i]->m_Reader->Release();
+            delete m_Readers[i];
+        }
+    }
+
+    int GetThreadCount() const { return m_Workers.Size(); }
+
+    // Packs searched before the bitmap paths, NULL for none. The packs must stay mounted while files are queued.
+    void SetArchives(CKArchiveSet *archives) { m_Archives = archives; }
+
+    // Reads the files ahead with the given I/O queue, NULL to let the readers open them.
+    void SetAsyncIO(VxAsyncIO *io) { m_IO = io; }
+
+    /************************************************
+    Summary: Queues the loading of a slot image.
+
+    Arguments:
+        tex: Texture to load.
+        slot: Slot receiving the image, the slot count of the texture is
+        increased if needed.
+        file: File to load, NULL for the current file name of the slot.
+        priority: The files with the highest priority are decoded first.
+    Return Value:
+        FALSE if the file has no bitmap reader or there are no workers
+        (use CKTexture::LoadImage).
+    ************************************************/
+    CKBOOL Load(CKTexture *tex, int slot = 0, CKSTRING file = NULL, float priority = 0.0f)
+    {
+        if (!tex || slot < 0 || !m_Workers.Size())
+            return FALSE;
+        if (!file)
+            file = (slot < tex->GetSlotCount()) ? tex->GetSlotFileName(slot) : NULL;
+        if (!file || !*file)
+            return FALSE;
+        Reader *reader = GetReader(file);
+        if (!reader)
+            return FALSE;
+        Request *r = new Request;
+        r->m_Texture = tex->GetID();
+        r->m_Slot = slot;
+        r->m_Name = file;
+        // the workers can not use the path manager
+        r->m_File = file;
+        r->m_Archive = m_Archives ? m_Archives->Find(file, BITMAP_PATH_IDX, r->m_Entry) : NULL;
+        if (!r->m_Archive)
+            m_Context->GetPathManager()->ResolveFileName(r->m_File, BITMAP_PATH_IDX);
+        r->m_Reader = reader;
+        r->m_Priority = priority;
+        if (!r->m_Archive && m_IO && reader->m_MemoryLoad)
+        {
+            r->m_IO = m_IO;
+            r->m_Read = m_IO->Read(r->m_File.CStr(), priority);
+        }
+        ++m_Queued;
+        m_Lock.EnterMutex();
+        m_Pending.PushBack(r);
+        m_Lock.LeaveMutex();
+        m_Work.NotifyOne();
+        return TRUE;
+    }
+
+    // Queues all the slots of a texture, returns the number of slots queued.
+    int LoadTexture(CKTexture *tex, float priority = 0.0f)
+    {
+        int count = 0;
+        for (int s = 0; tex && s < tex->GetSlotCount(); ++s)
+            count += Load(tex, s, NULL, priority) ? 1 : 0;
+        return count;
+    }
+
+    // Changes the priority of the files of a texture not decoded yet.
+    void SetPriority(CKTexture *tex, float priority)
+    {
+        if (!tex)
+            return;
+        VxMutexLock lock(m_Lock);
+        for (int i = 0; i < m_Pending.Size(); ++i)
+        {
+            if (m_Pending[i]->m_Texture == tex->GetID())
+            {
+                m_Pending[i]->m_Priority = priority;
+                if (m_Pending[i]->m_Read)
+                    m_IO->SetPriority(m_Pending[i]->m_Read, priority);
+            }
+        }
+    }
+
+    // Removes the files of a texture not decoded yet, returns the number removed.
+    int Cancel(CKTexture *tex)
+    {
+        if (!tex)
+            return 0;
+        int count = 0;
+        m_Lock.EnterMutex();
+        for (int i = m_Pending.Size() - 1; i >= 0; --i)
+        {
+            if (m_Pending[i]->m_Texture == tex->GetID())
+            {
+                delete m_Pending[i];
+                m_Pending.RemoveAt(i);
+                ++count;
+            }
+        }
+        m_Lock.LeaveMutex();
+        m_Queued -= count;
+        return count;
+    }
+
+    // Number of files queued and not given to their texture by Sync yet.
+    int GetQueuedCount() const { return m_Queued; }
+
+    /************************************************
+    Summary: Gives the decoded images to their textures, from the main thread.
+
+    Return Value:
+        Number of slots set.
+    ************************************************/
+    int Sync()
+    {
+        int i;
+        m_Lock.EnterMutex();
+        m_Finished.Resize(0);
+        for (i = 0; i < m_Done.Size(); ++i)
+            m_Finished.PushBack(m_Done[i]);
+        m_Done.Resize(0);
+        m_Lock.LeaveMutex();
+
+        int count = 0;
+        for (i = 0; i < m_Finished.Size(); ++i)
+        {
+            count += Apply(m_Finished[i]) ? 1 : 0;
+            delete m_Finished[i];
+            --m_Queued;
+        }
+        return count;
+    }
+
+    // Waits for all the queued files and gives them to their textures.
+    int Flush()
+    {
+        int count = Sync();
+        while (m_Queued > 0)
+        {
+            VxSpinPause();
+            count += Sync();
+        }
+        return count;
+    }
+
+protected:
+    struct Reader
+    {
+        CKFileExtension m_Ext;
+        CKBitmapReader *m_Reader;
+        CKBOOL m_ThreadSafe;
+        CKBOOL m_MemoryLoad; // the reader can read from memory
+        VxMutex m_Lock; // held while a worker uses a reader which is not thread safe
+    };
+
+    struct Request
+    {
+        Request() : m_Texture(0), m_Slot(0), m_Archive(NULL), m_Entry(-1), m_IO(NULL), m_Read(NULL), m_Reader(NULL), m_Priority(0.0f), m_Ok(FALSE) {}
+        ~Request()
+        {
+            if (m_Image.Image)
+                VxDeleteAligned(m_Image.Image);
+            if (m_Read)
+            {
+                m_IO->Cancel(m_Read);
+                m_IO->Wait(m_Read);
+                m_IO->Release(m_Read);
+            }
+        }
+
+        CK_ID m_Texture;
+        int m_Slot;
+        XString m_Name; // name given to the slot
+        XString m_File; // resolved path
+        CKArchive *m_Archive; // pack holding the file, NULL if on disk
+        int m_Entry;
+        VxAsyncIO *m_IO;
+        VxIORequest *m_Read; // read ahead of the file, NULL if none
+        Reader *m_Reader;
+        float m_Priority;
+        VxImageDescEx m_Image; // 32 bit ARGB
+        CKBOOL m_Ok;
+    };
+
+    class Worker : public VxThread
+    {
+    public:
+        explicit Worker(CKBitmapLoader *loader) : m_Loader(loader) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_Loader->WorkerLoop();
+            return VXT_OK;
+        }
+
+        CKBitmapLoader *m_Loader;
+    };
+    friend class Worker;
+
+    Reader *GetReader(CKSTRING file)
+    {
+        CKPathSplitter splitter(file);
+        CKFileExtension ext(splitter.GetExtension());
+        for (int i = 0; i < m_Readers.Size(); ++i)
+        {
+            if (m_Readers[i]->m_Ext == ext)
+                return m_Readers[i];
+        }
+        CKBitmapReader *reader = CKGetPluginManager()->GetBitmapReader(ext);
+        if (!reader)
+            return NULL;
+        Reader *r = new Reader;
+        r->m_Ext = ext;
+        r->m_Reader = reader;
+        r->m_ThreadSafe = (reader->GetFlags() & CK_DATAREADER_THREADSAFE) != 0;
+        r->m_MemoryLoad = (reader->GetFlags() & CK_DATAREADER_MEMORYLOAD) != 0;
+        m_Readers.PushBack(r);
+        return r;
+    }
+
+    // Sets the slot of a decoded image (main thread).
+    CKBOOL Apply(Request *r)
+    {
+        CKTexture *tex = (CKTexture *)m_Context->GetObject(r->m_Texture);
+        if (!r->m_Ok || !tex || tex->IsToBeDeleted())
+            return FALSE;
+        if (r->m_Slot >= tex->GetSlotCount())
+            tex->SetSlotCount(r->m_Slot + 1);
+        const VxImageDescEx &img = r->m_Image;
+        if (!tex->CreateImage(img.Width, img.Height, 32, r->m_Slot))
+            return FALSE;
+        CKBYTE *dst = tex->LockSurfacePtr(r->m_Slot);
+        if (dst)
+            memcpy(dst, img.Image, img.BytesPerLine * img.Height);
+        tex->ReleaseSurfacePtr(r->m_Slot);
+        tex->SetSlotFileName(r->m_Slot, r->m_Name.Str());
+        return TRUE;
+    }
+
+    // Reads and converts the file of a request (worker thread).
+    static void Decode(Request *r)
+    {
+        Reader *reader = r->m_Reader;
+        int size = 0;
+        CKBYTE *data = NULL;
+        XString temp;
+        if (r->m_Archive && !reader->m_MemoryLoad)
+        {
+            // the reader can only read files
+            if (!r->m_Archive->Extract(r->m_Entry, temp))
+                return;
+        }
+        else if (r->m_Archive)
+        {
+            data = r->m_Archive->Lock(r->m_Entry, size);
+        }
+        else if (r->m_Read && r->m_IO->Wait(r->m_Read) && r->m_Read->GetState() == VX_IO_DONE)
+        {
+            data = r->m_Read->GetData();
+            size = r->m_Read->GetSize();
+        }
+        if (!reader->m_ThreadSafe)
+            reader->m_Lock.EnterMutex();
+        CKBitmapProperties *bp = NULL;
+        const CKBOOL inMemory = (r->m_Archive && !temp.Length()) || r->m_Read;
+        const char *file = temp.Length() ? temp.CStr() : r->m_File.CStr();
+        const int err = inMemory ? (data ? reader->m_Reader->ReadMemory(data, size, &bp) : -1) : reader->m_Reader->ReadFile((char *)file, &bp);
+        if (err == 0 && bp)
+        {
+            VxImageDescEx src = bp->m_Format;
+            if (!src.Image)
+                src.Image = (XBYTE *)bp->m_Data;
+            if (src.Image && src.Width > 0 && src.Height > 0)
+            {
+                VxImageDescEx &dst = r->m_Image;
+                dst.Width = src.Width;
+                dst.Height = src.Height;
+                dst.BitsPerPixel = 32;
+                dst.BytesPerLine = src.Width * 4;
+                dst.AlphaMask = 0xFF000000;
+                dst.RedMask = 0x00FF0000;
+                dst.GreenMask = 0x0000FF00;
+                dst.BlueMask = 0x000000FF;
+                dst.Image = (XBYTE *)VxNewAligned(dst.BytesPerLine * dst.Height, 16);
+                VxFastBlit(src, dst);
+                r->m_Ok = TRUE;
+            }
+            reader->m_Reader->ReleaseMemory(bp->m_Data);
+            bp->m_Data = NULL;
+        }
+        if (r->m_Archive)
+            r->m_Archive->Unlock(r->m_Entry, data);
+        if (!reader->m_ThreadSafe)
+            reader->m_Lock.LeaveMutex();
+        if (temp.Length())
+            remove(temp.CStr());
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            // read before looking at the queue: a file queued after the look changes it
+            const long seen = m_Work.GetSequence();
+            if (VxAtomicLoad(&m_Stop))
+                return;
+            Request *r = NULL;
+            m_Lock.EnterMutex();
+            int best = -1;
+            for (int i = 0; i < m_Pending.Size(); ++i)
+            {
+                if (best < 0 || m_Pending[i]->m_Priority > m_Pending[best]->m_Priority)
+                    best = i;
+            }
+            if (best >= 0)
+            {
+                r = m_Pending[best];
+                m_Pending.RemoveAt(best);
+            }
+            m_Lock.LeaveMutex();
+            if (!r)
+            {
+                // blocked until Load queues a file or the loader is destroyed
+                m_Work.WaitForChange(seen);
+                continue;
+            }
+            Decode(r);
+            m_Lock.EnterMutex();
+            m_Done.PushBack(r);
+            m_Lock.LeaveMutex();
+        }
+    }
+
+    CKContext *m_Context;
+    CKArchiveSet *m_Archives;
+    VxAsyncIO *m_IO;
+    XArray<Reader *> m_Readers;
+    XArray<Request *> m_Finished;
+    int m_Queued;
+
+    // shared with the workers
+    VxMutex m_Lock;
+    XArray<Request *> m_Pending;
+    XArray<Request *> m_Done;
+    volatile long m_Stop;
+    VxCondition m_Work; // notified when a file is queued
+    XArray<Worker *> m_Workers;
+
+private:
+    CKBitmapLoader(const CKBitmapLoader &);
+    CKBitmapLoader &operator=(const CKBitmapLoader &);
+};
+
+#endif // CKBITMAPLOADER_H
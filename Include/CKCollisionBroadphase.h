@@ -0,0 +1,386 @@
+#ifndef CKCOLLISIONBROADPHASE_H
+#define CKCOLLISIONBROADPHASE_H
+
+#include "CKContext.h"
+#include "CK3dEntity.h"
+#include "CKCollisionManager.h"
+#include "XHashTable.h"
+#include "VxAABBTree.h"
+#include "VxIntersectBatch.h"
+
+/****************************************************************
+Summary: Broadphase for the obstacles of the collision manager.
+
+Remarks:
+    o Fixed and moving objects are stored in two VxAABBTree, the fixed tree
+    is only updated when an object is added, removed or UpdateObject is
+    called, the moving tree is updated by Update from the world bounding
+    boxes of the objects.
+    o Update also maintains the list of the pairs of objects whose boxes
+    overlap (moving/moving and moving/fixed). The pairs of the previous frame
+    are kept while their boxes still overlap and only the objects which moved
+    out of their enlarged box are queried again.
+    o DetectCollision only calls CKCollisionManager::IsInCollision for the
+    objects near the tested entity, so its cost depends on the number of
+    neighbours instead of the number of obstacles.
+
+    CKCollisionBroadphase broadphase(context);
+    broadphase.SyncObstacles(collisionManager);
+    ...
+    // each frame
+    broadphase.Update();
+    CK3dEntity *obstacle = broadphase.DetectCollision(collisionManager, character);
+
+See Also: VxAABBTree,CKCollisionManager
+****************************************************************/
+class CKCollisionBroadphase
+{
+public:
+    // Two objects whose boxes overlap (m_A < m_B).
+    struct Pair
+    {
+        CK_ID m_A;
+        CK_ID m_B;
+    };
+
+    explicit CKCollisionBroadphase(CKContext *context, float margin = 0.1f)
+        : m_Context(context), m_Fixed(0.0f), m_Moving(margin) {}
+
+    void Clear()
+    {
+        m_Objects.Clear();
+        m_Fixed.Clear();
+        m_Moving.Clear();
+        m_Moved.Clear();
+        m_Pairs.Clear();
+    }
+
+    int GetObjectCount() const { return m_Fixed.GetProxyCount() + m_Moving.GetProxyCount(); }
+    XBOOL IsObject(CK3dEntity *ent) const { return ent && m_Objects.FindPtr(ent->GetID()) != NULL; }
+
+    // Adds an entity, moving entities have their box updated by Update.
+    void AddObject(CK3dEntity *ent, CKBOOL moving)
+    {
+        if (!ent)
+            return;
+        Proxy *p = m_Objects.FindPtr(ent->GetID());
+        if (p)
+        {
+            if ((p->m_Moving != 0) == (moving != 0))
+                return;
+            RemoveObject(ent);
+        }
+        Proxy proxy;
+        proxy.m_Moving = moving;
+        proxy.m_Index = Tree(moving).CreateProxy(ent->GetBoundingBox(FALSE), ent->GetID());
+        m_Objects.Insert(ent->GetID(), proxy, TRUE);
+        m_Moved.PushBack(ent->GetID());
+    }
+
+    void RemoveObject(CK3dEntity *ent)
+    {
+        if (ent)
+            RemoveObject(ent->GetID());
+    }
+
+    void RemoveObject(CK_ID id)
+    {
+        Proxy *p = m_Objects.FindPtr(id);
+        if (!p)
+            return;
+        Tree(p->m_Moving).DestroyProxy(p->m_Index);
+        m_Objects.Remove(id);
+    }
+
+    // Updates the box of an entity (needed for fixed entities which were moved).
+    void UpdateObject(CK3dEntity *ent)
+    {
+        Proxy *p = ent ? m_Objects.FindPtr(ent->GetID()) : NULL;
+        if (p && Tree(p->m_Moving).MoveProxy(p->m_Index, ent->GetBoundingBox(FALSE)))
+            m_Moved.PushBack(ent->GetID());
+    }
+
+    /************************************************
+    Summary: Makes the objects match the obstacles of the collision manager.
+
+    Arguments:
+        cm: Collision manager.
+        level: Same meaning than in CKCollisionManager::GetObstacleCount.
+    ************************************************/
+    void SyncObstacles(CKCollisionManager *cm, CKBOOL level = FALSE)
+    {
+        XHashTable<CKBYTE, CK_ID> seen;
+        int i;
+        int count = cm->GetFixedObstacleCount(level);
+        for (i = 0; i < count; ++i)
+        {
+            CK3dEntity *ent = cm->GetFixedObstacle(i, level);
+            if (!ent)
+                continue;
+            AddObject(ent, FALSE);
+            seen.Insert(ent->GetID(), 1, TRUE);
+        }
+        count = cm->GetMovingObstacleCount(level);
+        for (i = 0; i < count; ++i)
+        {
+            CK3dEntity *ent = cm->GetMovingObstacle(i, level);
+            if (!ent)
+                continue;
+            AddObject(ent, TRUE);
+            seen.Insert(ent->GetID(), 1, TRUE);
+        }
+
+        XArray<CK_ID> removed;
+        for (XHashTable<Proxy, CK_ID>::Iterator it = m_Objects.Begin(); it != m_Objects.End(); ++it)
+        {
+            if (!seen.FindPtr(it.GetKey()))
+                removed.PushBack(it.GetKey());
+        }
+        for (i = 0; i < removed.Size(); ++i)
+            RemoveObject(removed[i]);
+    }
+
+    /************************************************
+    Summary: Updates the moving objects and the overlapping pairs.
+
+    Remarks:
+        Objects which were deleted are removed.
+    ************************************************/
+    void Update()
+    {
+        int i;
+        XArray<CK_ID> removed;
+        for (XHashTable<Proxy, CK_ID>::Iterator it = m_Objects.Begin(); it != m_Objects.End(); ++it)
+        {
+            CK3dEntity *ent = GetEntity(it.GetKey());
+            if (!ent)
+            {
+                removed.PushBack(it.GetKey());
+                continue;
+            }
+            Proxy &p = *it;
+            if (p.m_Moving && m_Moving.MoveProxy(p.m_Index, ent->GetBoundingBox(FALSE)))
+                m_Moved.PushBack(it.GetKey());
+        }
+        for (i = 0; i < removed.Size(); ++i)
+            RemoveObject(removed[i]);
+
+        // pairs of the previous frame which still overlap
+        int kept = 0;
+        for (i = 0; i < m_Pairs.Size(); ++i)
+        {
+            const Proxy *a = m_Objects.FindPtr(m_Pairs[i].m_A);
+            const Proxy *b = m_Objects.FindPtr(m_Pairs[i].m_B);
+            if (a && b && VxAABBTree::Overlap(Tree(a->m_Moving).GetFatBox(a->m_Index), Tree(b->m_Moving).GetFatBox(b->m_Index)))
+                m_Pairs[kept++] = m_Pairs[i];
+        }
+        m_Pairs.Resize(kept);
+
+        // new pairs of the objects which moved
+        XArray<int> proxies;
+        for (i = 0; i < m_Moved.Size(); ++i)
+        {
+            CK_ID id = m_Moved[i];
+            const Proxy *p = m_Objects.FindPtr(id);
+            if (!p)
+                continue;
+            const VxBbox &box = Tree(p->m_Moving).GetFatBox(p->m_Index);
+            proxies.Resize(0);
+            m_Moving.Query(box, proxies);
+            AddPairs(id, m_Moving, proxies);
+            if (p->m_Moving)
+            {
+                proxies.Resize(0);
+                m_Fixed.Query(box, proxies);
+                AddPairs(id, m_Fixed, proxies);
+            }
+        }
+        m_Moved.Resize(0);
+
+        // remove the duplicates
+        m_Pairs.Sort(ComparePairs);
+        kept = 0;
+        for (i = 0; i < m_Pairs.Size(); ++i)
+        {
+            if (kept && m_Pairs[kept - 1].m_A == m_Pairs[i].m_A && m_Pairs[kept - 1].m_B == m_Pairs[i].m_B)
+                continue;
+            m_Pairs[kept++] = m_Pairs[i];
+        }
+        m_Pairs.Resize(kept);
+    }
+
+    // Pairs of overlapping objects, valid after Update.
+    int GetPairCount() const { return m_Pairs.Size(); }
+    const Pair &GetPair(int i) const { return m_Pairs[i]; }
+
+    /************************************************
+    Summary: Gets the pairs whose oriented bounding boxes intersect.
+
+    Arguments:
+        res: The pairs of objects whose oriented boxes (local bounding
+        box transformed by the world matrix) intersect are added to this array.
+    Return Value:
+        Number of pairs added.
+    Remarks:
+        The pairs found by Update are tested 4 at a time with
+        VxIntersectBatch::OBBPairs.
+    ************************************************/
+    int GetBoxCollisions(XArray<Pair> &res)
+    {
+        XHashTable<int, CK_ID> boxIndices;
+        XArray<VxOBB> boxes;
+        XArray<int> indices(2 * m_Pairs.Size());
+        XArray<int> pairs(m_Pairs.Size());
+        int i;
+        for (i = 0; i < m_Pairs.Size(); ++i)
+        {
+            int a = BoxIndex(m_Pairs[i].m_A, boxIndices, boxes);
+            int b = BoxIndex(m_Pairs[i].m_B, boxIndices, boxes);
+            if (a < 0 || b < 0)
+                continue;
+            indices.PushBack(a);
+            indices.PushBack(b);
+            pairs.PushBack(i);
+        }
+        if (!pairs.Size())
+            return 0;
+
+        XArray<XBOOL> results;
+        results.Resize(pairs.Size());
+        VxIntersectBatch::OBBPairs(boxes.Begin(), indices.Begin(), pairs.Size(), results.Begin());
+        int added = 0;
+        for (i = 0; i < pairs.Size(); ++i)
+        {
+            if (results[i])
+            {
+                res.PushBack(m_Pairs[pairs[i]]);
+                ++added;
+            }
+        }
+        return added;
+    }
+
+    /************************************************
+    Summary: Gets the objects whose box overlaps a box.
+
+    Arguments:
+        box: Box in world coordinates.
+        res: The objects found are added to this array.
+    Return Value:
+        Number of objects added.
+    ************************************************/
+    int Query(const VxBbox &box, XArray<CK3dEntity *> &res)
+    {
+        XArray<int> proxies;
+        m_Fixed.Query(box, proxies);
+        int fixedCount = proxies.Size();
+        m_Moving.Query(box, proxies);
+        int added = 0;
+        for (int i = 0; i < proxies.Size(); ++i)
+        {
+            const VxAABBTree &tree = (i < fixedCount) ? m_Fixed : m_Moving;
+            CK3dEntity *ent = GetEntity((CK_ID)tree.GetUserData(proxies[i]));
+            if (ent)
+            {
+                res.PushBack(ent);
+                ++added;
+            }
+        }
+        return added;
+    }
+
+    /************************************************
+    Summary: Finds an object colliding with an entity.
+
+    Arguments:
+        cm: Collision manager.
+        ent: Entity to test.
+        precision: Precision used for ent.
+        obstaclePrecision: Precision used for the objects.
+    Return Value:
+        The first object colliding with ent, NULL if none.
+    See Also: CKCollisionManager::IsInCollision
+    ************************************************/
+    CK3dEntity *DetectCollision(CKCollisionManager *cm, CK3dEntity *ent, CK_GEOMETRICPRECISION precision = CKCOLLISION_BOX, CK_GEOMETRICPRECISION obstaclePrecision = CKCOLLISION_BOX)
+    {
+        if (!ent)
+            return NULL;
+        XArray<CK3dEntity *> candidates;
+        Query(ent->GetBoundingBox(FALSE), candidates);
+        for (int i = 0; i < candidates.Size(); ++i)
+        {
+            if (candidates[i] != ent && cm->IsInCollision(ent, precision, candidates[i], obstaclePrecision))
+                return candidates[i];
+        }
+        return NULL;
+    }
+
+protected:
+    struct Proxy
+    {
+        int m_Index;
+        CKBOOL m_Moving;
+    };
+
+    VxAABBTree &Tree(CKBOOL moving) { return moving ? m_Moving : m_Fixed; }
+    const VxAABBTree &Tree(CKBOOL moving) const { return moving ? m_Moving : m_Fixed; }
+
+    CK3dEntity *GetEntity(CK_ID id)
+    {
+        CKObject *obj = m_Context->GetObject(id);
+        if (!obj || obj->IsToBeDeleted())
+            return NULL;
+        return (CK3dEntity *)obj;
+    }
+
+    int BoxIndex(CK_ID id, XHashTable<int, CK_ID> &boxIndices, XArray<VxOBB> &boxes)
+    {
+        int *index = boxIndices.FindPtr(id);
+        if (index)
+            return *index;
+        CK3dEntity *ent = GetEntity(id);
+        if (!ent)
+            return -1;
+        boxes.PushBack(VxOBB(ent->GetBoundingBox(TRUE), ent->GetWorldMatrix()));
+        boxIndices.Insert(id, boxes.Size() - 1, TRUE);
+        return boxes.Size() - 1;
+    }
+
+    void AddPairs(CK_ID id, const VxAABBTree &tree, const XArray<int> &proxies)
+    {
+        for (int i = 0; i < proxies.Size(); ++i)
+        {
+            CK_ID other = (CK_ID)tree.GetUserData(proxies[i]);
+            if (other == id)
+                continue;
+            Pair pair;
+            pair.m_A = XMin(id, other);
+            pair.m_B = XMax(id, other);
+            m_Pairs.PushBack(pair);
+        }
+    }
+
+    static int ComparePairs(const void *e1, const void *e2)
+    {
+        const Pair *a = (const Pair *)e1;
+        const Pair *b = (const Pair *)e2;
+        if (a->m_A != b->m_A)
+            return (a->m_A < b->m_A) ? -1 : 1;
+        if (a->m_B != b->m_B)
+            return (a->m_B < b->m_B) ? -1 : 1;
+        return 0;
+    }
+
+    CKContext *m_Context;
+    XHashTable<Proxy, CK_ID> m_Objects;
+    VxAABBTree m_Fixed;
+    VxAABBTree m_Moving;
+    XArray<CK_ID> m_Moved;
+    XArray<Pair> m_Pairs;
+
+private:
+    CKCollisionBroadphase(const CKCollisionBroadphase &);
+    CKCollisionBroadphase &operator=(const CKCollisionBroadphase &);
+};
+
+#endif // CKCOLLISIONBROADPHASE_H
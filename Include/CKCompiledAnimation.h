@@ -0,0 +1,407 @@
+#ifndef CKCOMPILEDANIMATION_H
+#define CKCOMPILEDANIMATION_H
+
+#include "CKContext.h"
+#include "CK3dEntity.h"
+#include "CKKeyframeData.h"
+#include "CKObjectAnimation.h"
+#include "CKKeyedAnimation.h"
+#include "VxMatrix.h"
+#include "VxMath.h"
+#include "VxKeyTrack.h"
+
+/****************************************************************
+Summary: Sampling position of a playback instance in a compiled object animation.
+
+Remarks:
+    One cursor per track, so that several instances (characters) playing
+    the same animation at different times each sample it in O(1).
+
+See Also: CKCompiledObjectAnimation
+****************************************************************/
+struct CKAnimationCursor
+{
+    CKAnimationCursor() { Reset(); }
+
+    void Reset()
+    {
+        for (int i = 0; i < 4; ++i)
+            m_Keys[i] = 0;
+    }
+
+    int m_Keys[4];
+};
+
+/****************************************************************
+Summary: Object animation compiled into VxKeyTrack tracks.
+
+Remarks:
+    o Compile reads the position, rotation, scale and off-axis scale
+    controllers of a CKObjectAnimation. The keys of linear controllers are
+    copied; the TCB and Bezier controllers (whose interpolation is done by
+    the controllers) are sampled every resample step with
+    CKAnimController::Evaluate into uniform tracks. Linear controllers can
+    also be resampled by giving a resampling step.
+    o Morph controllers are not compiled.
+    o Evaluate only reads the compiled data, it can be called from any
+    thread.
+
+    CKCompiledObjectAnimation compiled;
+    compiled.Compile(objectAnimation);
+    CKAnimationCursor cursor;
+    VxMatrix local;
+    compiled.EvaluateMatrix(frame, cursor, local);
+
+See Also: VxKeyTrack,CKCompiledAnimation,CKObjectAnimation::EvaluateKeys
+****************************************************************/
+class CKCompiledObjectAnimation
+{
+public:
+    enum Track
+    {
+        POSITION  = 0,
+        ROTATION  = 1,
+        SCALE     = 2,
+        SCALEAXIS = 3,
+        TRACKCOUNT
+    };
+
+    CKCompiledObjectAnimation() : m_Entity(0), m_Length(0.0f) {}
+
+    /************************************************
+    Summary: Compiles an object animation.
+
+    Arguments:
+        anim: Object animation to compile.
+        resampleStep: If not null, all the controllers are sampled every
+        resampleStep frames, otherwise only the non linear ones are (every frame).
+    Return Value:
+        FALSE if the animation has no position, rotation or scale controller.
+    ************************************************/
+    CKBOOL Compile(CKObjectAnimation *anim, float resampleStep = 0.0f)
+    {
+        for (int t = 0; t < TRACKCOUNT; ++t)
+            m_Tracks[t].Clear();
+        if (!anim)
+            return FALSE;
+        CK3dEntity *ent = anim->Get3dEntity();
+        m_Entity = ent ? ent->GetID() : 0;
+        m_Length = anim->GetLength();
+        CompileController(m_Tracks[POSITION], anim->GetPositionController(), 3, resampleStep);
+        CompileController(m_Tracks[ROTATION], anim->GetRotationController(), 4, resampleStep);
+        CompileController(m_Tracks[SCALE], anim->GetScaleController(), 3, resampleStep);
+        CompileController(m_Tracks[SCALEAXIS], anim->GetScaleAxisController(), 4, resampleStep);
+        return HasTrack(POSITION) || HasTrack(ROTATION) || HasTrack(SCALE);
+    }
+
+    // Entity animated by the object animation.
+    CK_ID GetEntity() const { return m_Entity; }
+    float GetLength() const { return m_Length; }
+
+    CKBOOL HasTrack(Track t) const { return m_Tracks[t].GetKeyCount() != 0; }
+    const VxKeyTrack &GetTrack(Track t) const { return m_Tracks[t]; }
+
+    int GetMemoryUsed() const
+    {
+        int size = 0;
+        for (int t = 0; t < TRACKCOUNT; ++t)
+            size += m_Tracks[t].GetMemoryUsed();
+        return size;
+    }
+
+    /************************************************
+    Summary: Samples the animation.
+
+    Arguments:
+        frame: Frame to sample.
+        cursor: Cursor of the playback instance.
+        rot, pos, scale, scaleAxis: Receive the values of the tracks, can be NULL.
+    Return Value:
+        Mask of the tracks written (1 << Track).
+    Remarks:
+        The values of missing tracks are not written.
+    ************************************************/
+    CKDWORD Evaluate(float frame, CKAnimationCursor &cursor, VxQuaternion *rot, VxVector *pos, VxVector *scale, VxQuaternion *scaleAxis = NULL) const
+    {
+        return EvaluateTracks(m_Tracks, frame, cursor, rot, pos, scale, scaleAxis);
+    }
+
+    /************************************************
+    Summary: Samples the animation into a local matrix.
+
+    Arguments:
+        frame: Frame to sample.
+        cursor: Cursor of the playback instance.
+        mat: Receives the local matrix.
+        rest: Local matrix used for the missing tracks, NULL for identity.
+    ************************************************/
+    void EvaluateMatrix(float frame, CKAnimationCursor &cursor, VxMatrix &mat, const VxMatrix *rest = NULL) const
+    {
+        EvaluateTracksMatrix(m_Tracks, frame, cursor, mat, rest);
+    }
+
+    // Evaluate of TRACKCOUNT tracks (VxKeyTrack or VxCompressedTrack).
+    template <class TRACK>
+    static CKDWORD EvaluateTracks(const TRACK *tracks, float frame, CKAnimationCursor &cursor, VxQuaternion *rot, VxVector *pos, VxVector *scale, VxQuaternion *scaleAxis)
+    {
+        CKDWORD mask = 0;
+        if (pos && tracks[POSITION].GetKeyCount())
+        {
+            tracks[POSITION].Sample(frame, cursor.m_Keys[POSITION], &pos->x);
+            mask |= 1 << POSITION;
+        }
+        if (rot && tracks[ROTATION].GetKeyCount())
+        {
+            tracks[ROTATION].SampleRotation(frame, cursor.m_Keys[ROTATION], *rot);
+            mask |= 1 << ROTATION;
+        }
+        if (scale && tracks[SCALE].GetKeyCount())
+        {
+            tracks[SCALE].Sample(frame, cursor.m_Keys[SCALE], &scale->x);
+            mask |= 1 << SCALE;
+        }
+        if (scaleAxis && tracks[SCALEAXIS].GetKeyCount())
+        {
+            tracks[SCALEAXIS].SampleRotation(frame, cursor.m_Keys[SCALEAXIS], *scaleAxis);
+            mask |= 1 << SCALEAXIS;
+        }
+        return mask;
+    }
+
+    // EvaluateMatrix of TRACKCOUNT tracks (VxKeyTrack or VxCompressedTrack).
+    template <class TRACK>
+    static void EvaluateTracksMatrix(const TRACK *tracks, float frame, CKAnimationCursor &cursor, VxMatrix &mat, const VxMatrix *rest)
+    {
+        VxQuaternion rot, scaleAxis;
+        VxVector pos, scale;
+        if (rest)
+            Vx3DDecomposeMatrix(*rest, rot, pos, scale);
+        else
+        {
+            rot = VxQuaternion(0.0f, 0.0f, 0.0f, 1.0f);
+            pos = VxVector(0.0f, 0.0f, 0.0f);
+            scale = VxVector(1.0f, 1.0f, 1.0f);
+        }
+        CKDWORD mask = EvaluateTracks(tracks, frame, cursor, &rot, &pos, &scale, &scaleAxis);
+        BuildMatrix(mat, rot, pos, scale, (mask & (1 << SCALEAXIS)) ? &scaleAxis : NULL);
+    }
+
+    /************************************************
+    Summary: Builds a local matrix from animation values.
+
+    Remarks:
+        The matrix scales (along the axes given by scaleAxis if it is not
+        NULL), then rotates and translates.
+    ************************************************/
+    static void BuildMatrix(VxMatrix &mat, const VxQuaternion &rot, const VxVector &pos, const VxVector &scale, const VxQuaternion *scaleAxis = NULL)
+    {
+        rot.ToMatrix(mat);
+        if (scaleAxis)
+        {
+            // S' = A * diag(scale) * transpose(A), then mat = R * S'
+            VxMatrix a, s, r = mat;
+            scaleAxis->ToMatrix(a);
+            s.SetIdentity();
+            for (int j = 0; j < 3; ++j)
+            {
+                for (int i = 0; i < 3; ++i)
+                    s[j][i] = a[0][i] * a[0][j] * scale.x + a[1][i] * a[1][j] * scale.y + a[2][i] * a[2][j] * scale.z;
+            }
+            Vx3DMultiplyMatrix(mat, r, s);
+        }
+        else
+        {
+            mat[0] *= scale.x;
+            mat[1] *= scale.y;
+            mat[2] *= scale.z;
+        }
+        mat[3][0] = pos.x;
+        mat[3][1] = pos.y;
+        mat[3][2] = pos.z;
+        mat[3][3] = 1.0f;
+    }
+
+protected:
+    static void CompileController(VxKeyTrack &track, CKAnimController *ctrl, int components, float resampleStep)
+    {
+        const int count = ctrl ? ctrl->GetKeyCount() : 0;
+        if (!count)
+            return;
+        const CKDWORD type = ctrl->GetType();
+        const CKBOOL linear = type == CKANIMATION_LINPOS_CONTROL || type == CKANIMATION_LINROT_CONTROL ||
+                              type == CKANIMATION_LINSCL_CONTROL || type == CKANIMATION_LINSCLAXIS_CONTROL;
+        XArray<float> values;
+        if (linear && resampleStep <= 0.0f)
+        {
+            XArray<float> times;
+            times.Resize(count);
+            values.Resize(count * components);
+            for (int k = 0; k < count; ++k)
+            {
+                CKKey *key = ctrl->GetKey(k);
+                times[k] = key->TimeStep;
+                const float *v = (components == 4) ? &((CKRotationKey *)key)->Rot.x : &((CKPositionKey *)key)->Pos.x;
+                memcpy(&values[k * components], v, components * sizeof(float));
+            }
+            if (components == 4)
+                MakeContinuous(values.Begin(), count);
+            track.SetKeys(times.Begin(), values.Begin(), count, components);
+            return;
+        }
+
+        const float start = ctrl->GetKey(0)->TimeStep;
+        const float end = ctrl->GetKey(count - 1)->TimeStep;
+        // at most the requested step, the last sample falls exactly on the last key
+        const float maxStep = (resampleStep > 0.0f) ? resampleStep : 1.0f;
+        const int samples = (int)((end - start) / maxStep + 0.999f) + 1;
+        const float step = (samples > 1) ? (end - start) / (float)(samples - 1) : maxStep;
+        values.Resize(samples * components);
+        for (int i = 0; i < samples; ++i)
+        {
+            float t = (i == samples - 1) ? end : start + i * step;
+            float v[4];
+            ctrl->Evaluate(t, v);
+            memcpy(&values[i * components], v, components * sizeof(float));
+        }
+        if (components == 4)
+            MakeContinuous(values.Begin(), samples);
+        track.SetUniformKeys(start, step, values.Begin(), samples, components);
+    }
+
+    // Flips the quaternions so that consecutive keys are in the same hemisphere.
+    static void MakeContinuous(float *q, int count)
+    {
+        for (int k = 1; k < count; ++k)
+        {
+            float *a = q + (k - 1) * 4;
+            float *b = q + k * 4;
+            if (a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3] < 0.0f)
+            {
+                for (int c = 0; c < 4; ++c)
+                    b[c] = -b[c];
+            }
+        }
+    }
+
+    CK_ID m_Entity;
+    float m_Length;
+    VxKeyTrack m_Tracks[TRACKCOUNT];
+};
+
+/****************************************************************
+Summary: Object animations of a compiled or compressed animation. {secret}
+
+Remarks:
+    Sampling and application of the poses shared by CKCompiledAnimation
+    and CKCompressedAnimation, OBJECT being the class of their object
+    animations.
+****************************************************************/
+template <class OBJECT>
+class CKAnimationObjects
+{
+public:
+    CKAnimationObjects() : m_Length(0.0f) {}
+
+    ~CKAnimationObjects() { Clear(); }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Objects.Size(); ++i)
+            delete m_Objects[i];
+        m_Objects.Clear();
+    }
+
+    float GetLength() const { return m_Length; }
+    int GetObjectCount() const { return m_Objects.Size(); }
+    const OBJECT &GetObject(int i) const { return *m_Objects[i]; }
+
+    // Creates the cursors of a playback instance.
+    void CreateCursors(XArray<CKAnimationCursor> &cursors) const
+    {
+        cursors.Resize(m_Objects.Size());
+        for (int i = 0; i < cursors.Size(); ++i)
+            cursors[i].Reset();
+    }
+
+    // Computes the local matrix of each animated entity (in the order of GetObject), can run on any thread.
+    void Sample(float frame, CKAnimationCursor *cursors, XArray<VxMatrix> &pose) const
+    {
+        pose.Resize(m_Objects.Size());
+        for (int i = 0; i < m_Objects.Size(); ++i)
+            m_Objects[i]->EvaluateMatrix(frame, cursors[i], pose[i]);
+    }
+
+    // Sets the local matrices of the entities, must be called from the main thread.
+    void Apply(CKContext *context, const VxMatrix *pose) const
+    {
+        for (int i = 0; i < m_Objects.Size(); ++i)
+        {
+            CK3dEntity *ent = (CK3dEntity *)context->GetObject(m_Objects[i]->GetEntity());
+            if (ent)
+                ent->SetLocalMatrix(pose[i]);
+        }
+    }
+
+    int GetMemoryUsed() const
+    {
+        int size = 0;
+        for (int i = 0; i < m_Objects.Size(); ++i)
+            size += m_Objects[i]->GetMemoryUsed();
+        return size;
+    }
+
+protected:
+    float m_Length;
+    XArray<OBJECT *> m_Objects;
+
+private:
+    CKAnimationObjects(const CKAnimationObjects &);
+    CKAnimationObjects &operator=(const CKAnimationObjects &);
+};
+
+/****************************************************************
+Summary: Keyed animation compiled into CKCompiledObjectAnimation.
+
+Remarks:
+    o Sample computes the local matrices of all the animated entities in a
+    pose buffer without touching the entities (it can run on a worker
+    thread), Apply then gives them to the entities.
+    o A playback instance keeps one CKAnimationCursor per object animation
+    (see CreateCursors).
+
+    CKCompiledAnimation walk;
+    walk.Compile(keyedAnimation);
+    XArray<CKAnimationCursor> cursors;
+    walk.CreateCursors(cursors);
+    XArray<VxMatrix> pose;
+    walk.Sample(frame, cursors.Begin(), pose);
+    walk.Apply(context, pose.Begin());
+
+See Also: CKCompiledObjectAnimation,CKKeyedAnimation
+****************************************************************/
+class CKCompiledAnimation : public CKAnimationObjects<CKCompiledObjectAnimation>
+{
+public:
+    // Compiles all the object animations of a keyed animation.
+    CKBOOL Compile(CKKeyedAnimation *anim, float resampleStep = 0.0f)
+    {
+        Clear();
+        if (!anim)
+            return FALSE;
+        m_Length = anim->GetLength();
+        for (int i = 0; i < anim->GetAnimationCount(); ++i)
+        {
+            CKObjectAnimation *oa = anim->GetAnimation(i);
+            CKCompiledObjectAnimation *c = new CKCompiledObjectAnimation;
+            if (!c->Compile(oa, resampleStep) || !c->GetEntity())
+            {
+                delete c;
+                continue;
+            }
+            m_Objects.PushBack(c);
+        }
+        return m_Objects.Size() != 0;
+    }
+};
+
+#endif // CKCOMPILEDANIMATION_H
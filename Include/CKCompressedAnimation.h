@@ -0,0 +1,130 @@
+#ifndef CKCOMPRESSEDANIMATION_H
+#define CKCOMPRESSEDANIMATION_H
+
+#include "CKCompiledAnimation.h"
+#include "VxCompressedTrack.h"
+
+/****************************************************************
+Summary: Tolerances used to compress an animation.
+
+See Also: CKCompressedAnimation
+****************************************************************/
+struct CKAnimationTolerance
+{
+    CKAnimationTolerance(float pos = 0.001f, float rot = 0.001f, float scl = 0.001f)
+        : m_Position(pos), m_Rotation(rot), m_Scale(scl) {}
+
+    float m_Position; // distance
+    float m_Rotation; // angle in radians
+    float m_Scale;
+};
+
+/****************************************************************
+Summary: Object animation with quantized and reduced keys.
+
+Remarks:
+    o Made from a CKCompiledObjectAnimation: each track becomes a
+    VxCompressedTrack, see there for the key format.
+    o The interface is the one of CKCompiledObjectAnimation, with the same
+    CKAnimationCursor.
+
+See Also: CKCompressedAnimation,VxCompressedTrack,CKCompiledObjectAnimation
+****************************************************************/
+class CKCompressedObjectAnimation
+{
+public:
+    typedef CKCompiledObjectAnimation::Track Track;
+
+    CKCompressedObjectAnimation() : m_Entity(0), m_Length(0.0f) {}
+
+    // FALSE if a track of the source can not be compressed (see VxCompressedTrack::Compress).
+    CKBOOL Compress(const CKCompiledObjectAnimation &src, const CKAnimationTolerance &tolerance = CKAnimationTolerance())
+    {
+        m_Entity = src.GetEntity();
+        m_Length = src.GetLength();
+        const float tolerances[CKCompiledObjectAnimation::TRACKCOUNT] = {tolerance.m_Position, tolerance.m_Rotation, tolerance.m_Scale, tolerance.m_Rotation};
+        CKBOOL ok = TRUE;
+        for (int t = 0; t < CKCompiledObjectAnimation::TRACKCOUNT; ++t)
+        {
+            const VxKeyTrack &track = src.GetTrack((Track)t);
+            if (track.GetKeyCount() && !m_Tracks[t].Compress(track, tolerances[t]))
+                ok = FALSE;
+        }
+        return ok;
+    }
+
+    CK_ID GetEntity() const { return m_Entity; }
+    float GetLength() const { return m_Length; }
+
+    CKBOOL HasTrack(Track t) const { return m_Tracks[t].GetKeyCount() != 0; }
+    const VxCompressedTrack &GetTrack(Track t) const { return m_Tracks[t]; }
+
+    int GetMemoryUsed() const
+    {
+        int size = 0;
+        for (int t = 0; t < CKCompiledObjectAnimation::TRACKCOUNT; ++t)
+            size += m_Tracks[t].GetMemoryUsed();
+        return size;
+    }
+
+    // Samples the animation (see CKCompiledObjectAnimation::Evaluate).
+    CKDWORD Evaluate(float frame, CKAnimationCursor &cursor, VxQuaternion *rot, VxVector *pos, VxVector *scale, VxQuaternion *scaleAxis = NULL) const
+    {
+        return CKCompiledObjectAnimation::EvaluateTracks(m_Tracks, frame, cursor, rot, pos, scale, scaleAxis);
+    }
+
+    // Samples the animation into a local matrix (see CKCompiledObjectAnimation::EvaluateMatrix).
+    void EvaluateMatrix(float frame, CKAnimationCursor &cursor, VxMatrix &mat, const VxMatrix *rest = NULL) const
+    {
+        CKCompiledObjectAnimation::EvaluateTracksMatrix(m_Tracks, frame, cursor, mat, rest);
+    }
+
+protected:
+    CK_ID m_Entity;
+    float m_Length;
+    VxCompressedTrack m_Tracks[CKCompiledObjectAnimation::TRACKCOUNT];
+};
+
+/****************************************************************
+Summary: Keyed animation with quantized and reduced keys.
+
+Remarks:
+    o Compress takes a CKCompiledAnimation, which can be destroyed
+    afterwards. A key takes 8 bytes instead of 16 (vectors) or 20
+    (quaternions), and the keys which can be interpolated within the
+    tolerances are removed.
+    o The keys are decoded while sampling, with the same Sample and Apply
+    methods and cursors as CKCompiledAnimation.
+    o Compress fails when a track is too long for the 16 bit key times of
+    VxCompressedTrack: the CKCompiledAnimation is then kept.
+
+    CKCompiledAnimation compiled;
+    compiled.Compile(keyedAnimation);
+    CKCompressedAnimation walk;
+    walk.Compress(compiled);
+
+See Also: CKCompiledAnimation,CKCompressedObjectAnimation,CKAnimationTolerance
+****************************************************************/
+class CKCompressedAnimation : public CKAnimationObjects<CKCompressedObjectAnimation>
+{
+public:
+    // FALSE if the animation is empty or one of its tracks can not be compressed (keep the CKCompiledAnimation then).
+    CKBOOL Compress(const CKCompiledAnimation &src, const CKAnimationTolerance &tolerance = CKAnimationTolerance())
+    {
+        Clear();
+        m_Length = src.GetLength();
+        for (int i = 0; i < src.GetObjectCount(); ++i)
+        {
+            CKCompressedObjectAnimation *c = new CKCompressedObjectAnimation;
+            m_Objects.PushBack(c);
+            if (!c->Compress(src.GetObject(i), tolerance))
+            {
+                Clear();
+                return FALSE;
+            }
+        }
+        return m_Objects.Size() != 0;
+    }
+};
+
+#endif // CKCOMPRESSEDANIMATION_H
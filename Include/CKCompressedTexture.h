@@ -0,0 +1,241 @@
+#ifndef CKCOMPRESSEDTEXTURE_H
+#define CKCOMPRESSEDTEXTURE_H
+
+#include "CKTexture.h"
+#include "CKStateChunk.h"
+#include "VxBlockCompression.h"
+
+/****************************************************************
+Summary: DXT compressed copy of a texture and its mipmap levels.
+
+Remarks:
+    o Compress encodes the system memory image of a texture (or any 32 bits
+    image) and its mipmap levels in DXT1, DXT3 or DXT5 once, offline or at
+    load time: a DXT1 texture takes 1/8 of the memory of the 32 bits image
+    and a DXT3 or DXT5 texture 1/4, in the composition files and in video
+    memory.
+    o Write and Read store the compressed levels in a state chunk (between
+    StartWrite and CloseChunk), for example in the chunk of a manager or of
+    a behavior, so the compression is not done again when the composition
+    is loaded.
+    o Apply gives the levels to the texture: the system memory image and the
+    user mipmap levels of the texture are decoded from the compressed data,
+    and the desired video format of the texture is set to the compressed
+    format before it is sent to video memory, so the video memory surface
+    is compressed with the mipmap levels stored. Since the system memory
+    copy of a texture is always a 32 bits image, SetSystemCaching(CKBITMAP_DISCARD)
+    can be used on the texture afterwards to only keep the compressed copies.
+
+    CKCompressedTexture c;
+    c.Compress(texture, _DXT5);
+    c.Write(chunk, MYMANAGER_CHUNK_TEXTURE);
+    ...
+    if (c.Read(chunk, MYMANAGER_CHUNK_TEXTURE) == CK_OK)
+        c.Apply(texture, renderContext);
+
+See Also: VxEncodeBlocks,VxEncodeMipChain,CKTexture::SetDesiredVideoFormat
+****************************************************************/
+class CKCompressedTexture
+{
+public:
+    CKCompressedTexture() : m_Format(_DXT1), m_Width(0), m_Height(0), m_LevelCount(0) {}
+
+    /************************************************
+    Summary: Compresses a slot of a texture.
+
+    Arguments:
+        tex: Texture whose system memory image is compressed.
+        format: _DXT1, _DXT3 or _DXT5.
+        mipmaps: TRUE to also compress all the mipmap levels.
+        slot: Slot to compress, -1 for the current slot.
+    Return Value:
+        TRUE if successful.
+    ************************************************/
+    CKBOOL Compress(CKTexture *tex, VX_PIXELFORMAT format = _DXT1, CKBOOL mipmaps = TRUE, int slot = -1)
+    {
+        if (!tex)
+            return FALSE;
+        const XBYTE *image = tex->LockSurfacePtr(slot);
+        if (!image)
+            return FALSE;
+        const CKBOOL ok = Compress(image, tex->GetWidth(), tex->GetHeight(), tex->GetWidth() * 4, format, mipmaps);
+        tex->ReleaseSurfacePtr(slot);
+        return ok;
+    }
+
+    // Compresses a 32 bits ARGB image, see VxEncodeMipChain.
+    CKBOOL Compress(const XBYTE *image, int width, int height, int pitch, VX_PIXELFORMAT format = _DXT1, CKBOOL mipmaps = TRUE, CKBOOL alpha1Bit = FALSE)
+    {
+        m_LevelCount = VxEncodeMipChain(image, width, height, pitch, format, m_Data, mipmaps ? -1 : 1, alpha1Bit);
+        if (!m_LevelCount)
+        {
+            m_Width = m_Height = 0;
+            return FALSE;
+        }
+        m_Format = format;
+        m_Width = width;
+        m_Height = height;
+        return TRUE;
+    }
+
+    // Compresses a 32 bits image description.
+    CKBOOL Compress(const VxImageDescEx &desc, VX_PIXELFORMAT format = _DXT1, CKBOOL mipmaps = TRUE)
+    {
+        if (desc.BitsPerPixel != 32 || !desc.Image)
+            return FALSE;
+        return Compress(desc.Image, desc.Width, desc.Height, desc.BytesPerLine, format, mipmaps, FALSE);
+    }
+
+    VX_PIXELFORMAT GetFormat() const { return m_Format; }
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+    int GetLevelCount() const { return m_LevelCount; }
+
+    int GetLevelWidth(int level) const
+    {
+        const int w = m_Width >> level;
+        return w ? w : 1;
+    }
+    int GetLevelHeight(int level) const
+    {
+        const int h = m_Height >> level;
+        return h ? h : 1;
+    }
+    int GetLevelSize(int level) const { return VxBlockCompressedSize(GetLevelWidth(level), GetLevelHeight(level), m_Format); }
+
+    // Compressed data of a level, the layout of a DirectX surface of the format.
+    const XBYTE *GetLevelData(int level) const
+    {
+        int offset = 0;
+        for (int i = 0; i < level; ++i)
+            offset += GetLevelSize(i);
+        return m_Data.Begin() + offset;
+    }
+
+    // Size in bytes of all the compressed levels.
+    int GetMemoryUsed() const { return m_Data.Size(); }
+
+    // Decodes a level into a 32 bits ARGB image.
+    CKBOOL Decompress(int level, XBYTE *image, int pitch) const
+    {
+        if (level < 0 || level >= m_LevelCount)
+            return FALSE;
+        return VxDecodeBlocks(GetLevelData(level), GetLevelWidth(level), GetLevelHeight(level), m_Format, image, pitch) != 0;
+    }
+
+    /************************************************
+    Summary: Gives the compressed image to a texture.
+
+    Arguments:
+        tex: Texture to set, it is resized to the size of the compressed image if needed.
+        dev: Render context used to send the texture to video memory, NULL
+        to let the texture be loaded when it is first used.
+        slot: Slot of the texture to set.
+    Return Value:
+        TRUE if successful.
+    ************************************************/
+    CKBOOL Apply(CKTexture *tex, CKRenderContext *dev = NULL, int slot = 0)
+    {
+        if (!tex || !m_LevelCount)
+            return FALSE;
+        if (tex->GetWidth() != m_Width || tex->GetHeight() != m_Height)
+        {
+            if (!tex->Create(m_Width, m_Height, 32, slot))
+                return FALSE;
+        }
+        XBYTE *image = tex->LockSurfacePtr(slot);
+        if (!image)
+            return FALSE;
+        Decompress(0, image, m_Width * 4);
+        tex->ReleaseSurfacePtr(slot);
+
+        // the stored levels rather than the filtered ones of the engine
+        if (m_LevelCount > 1 && tex->GetSlotCount() <= 1 && tex->SetUserMipMapMode(TRUE))
+        {
+            VxImageDescEx desc;
+            for (int i = 0; tex->GetUserMipMapLevel(i, desc); ++i)
+            {
+                const int level = FindLevel(desc.Width, desc.Height);
+                if (level > 0 && desc.Image && desc.BitsPerPixel == 32)
+                    Decompress(level, desc.Image, desc.BytesPerLine);
+            }
+        }
+        tex->SetDesiredVideoFormat(m_Format);
+        if (!dev)
+            return TRUE;
+        if (tex->IsInVideoMemory())
+            tex->FreeVideoMemory();
+        return tex->SystemToVideoMemory(dev);
+    }
+
+    // Stores the compressed levels in a chunk opened for writing.
+    void Write(CKStateChunk *chunk, CKDWORD identifier)
+    {
+        chunk->WriteIdentifier(identifier);
+        chunk->WriteInt((int)m_Format);
+        chunk->WriteInt(m_Width);
+        chunk->WriteInt(m_Height);
+        chunk->WriteInt(m_LevelCount);
+        chunk->WriteBuffer(m_Data.Size(), m_Data.Begin());
+    }
+
+    // Reads levels stored by Write, CKERR_NOTFOUND if the chunk does not have them.
+    CKERROR Read(CKStateChunk *chunk, CKDWORD identifier)
+    {
+        if (!chunk || !chunk->SeekIdentifier(identifier))
+            return CKERR_NOTFOUND;
+        const VX_PIXELFORMAT format = (VX_PIXELFORMAT)chunk->ReadInt();
+        const int width = chunk->ReadInt();
+        const int height = chunk->ReadInt();
+        const int levels = chunk->ReadInt();
+        void *buffer = NULL;
+        const int size = chunk->ReadBuffer(&buffer);
+
+        m_Format = format;
+        m_Width = width;
+        m_Height = height;
+        m_LevelCount = levels;
+        CKERROR err = CK_OK;
+        if (!VxIsBlockCompressed(format) || width <= 0 || height <= 0 || levels <= 0 || size != ComputeSize())
+        {
+            err = CKERR_INVALIDFILE;
+            m_Width = m_Height = m_LevelCount = 0;
+            m_Data.Resize(0);
+        }
+        else
+        {
+            m_Data.Resize(size);
+            memcpy(m_Data.Begin(), buffer, size);
+        }
+        if (buffer)
+            CKDeletePointer(buffer);
+        return err;
+    }
+
+protected:
+    int FindLevel(int width, int height) const
+    {
+        for (int i = 0; i < m_LevelCount; ++i)
+        {
+            if (GetLevelWidth(i) == width && GetLevelHeight(i) == height)
+                return i;
+        }
+        return -1;
+    }
+
+    int ComputeSize() const
+    {
+        int size = 0;
+        for (int i = 0; i < m_LevelCount; ++i)
+            size += GetLevelSize(i);
+        return size;
+    }
+
+    VX_PIXELFORMAT m_Format;
+    int m_Width;
+    int m_Height;
+    int m_LevelCount;
+    XArray<XBYTE> m_Data; // the levels, largest first
+};
+
+#endif // CKCOMPRESSEDTEXTURE_H
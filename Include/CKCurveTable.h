@@ -0,0 +1,354 @@
+#ifndef CKCURVETABLE_H
+#define CKCURVETABLE_H
+
+#include <math.h>
+#include <string.h>
+
+#include "VxMath.h"
+#include "CKCurve.h"
+#include "CKCurvePoint.h"
+#include "CK2dCurve.h"
+#include "CK2dCurvePoint.h"
+#include "XArray.h"
+
+/****************************************************************
+Summary: Arc-length table of a 3D curve giving positions and directions by distance.
+
+Remarks:
+    o CKCurve::GetPos takes a step (0..1) which is not proportional to
+    the distance along the curve, and evaluates the spline at each call.
+    The table samples the curve once (CKCurve::GetLocalPos at regular
+    steps) and keeps the cumulated length at each sample: GetPosAtDistance
+    and GetStep find the distance by binary search and interpolate the
+    two samples around it, GetDistance is a direct lookup.
+    o The table is built again by Update when the curve changed since it
+    was built: number of control points, their position relative to the
+    curve, tangents, TCB parameters, open or closed state and fitting
+    coefficient are compared to a signature kept with the table. Moving
+    the curve itself does not change the table, which is in the curve
+    referential (GetPosAtDistance applies the world matrix).
+    o The distances are the length of the sampled polyline: raise
+    samplesPerSegment for curves with sharp turns.
+    o On a closed curve the distances wrap around, on an open curve they
+    are clamped to 0..GetLength.
+
+    CKCurveTable table;
+    ...
+    table.Update(curve); // each frame, cheap when nothing changed
+    m_Distance += speed * deltaTime;
+    table.GetPosAtDistance(curve, m_Distance, &pos, &dir);
+
+See Also: CKCurve::GetPos,CK2dCurveTable
+****************************************************************/
+class CKCurveTable
+{
+public:
+    CKCurveTable() : m_Curve(0), m_Signature(0), m_PointCount(-1), m_Samples(0), m_Length(0.0f), m_Closed(FALSE) {}
+
+    /*************************************************
+    Summary: Builds the table if the curve changed since it was built.
+
+    Arguments:
+        curve: Curve to sample.
+        samplesPerSegment: Samples taken between two control points.
+    Return Value:
+        TRUE if the table was built again.
+    *************************************************/
+    CKBOOL Update(CKCurve *curve, int samplesPerSegment = 32)
+    {
+        if (!curve)
+        {
+            Invalidate();
+            return FALSE;
+        }
+        const CKDWORD signature = ComputeSignature(curve);
+        if (m_Curve == curve->GetID() && m_PointCount == curve->GetControlPointCount() &&
+            m_Signature == signature && m_Samples == samplesPerSegment)
+            return FALSE;
+        Build(curve, samplesPerSegment);
+        m_Signature = signature;
+        return TRUE;
+    }
+
+    // Samples the curve without comparing the signature.
+    void Build(CKCurve *curve, int samplesPerSegment = 32)
+    {
+        m_Curve = curve->GetID();
+        m_PointCount = curve->GetControlPointCount();
+        m_Samples = samplesPerSegment;
+        m_Closed = !curve->IsOpen();
+        const int segments = XMax(m_Closed ? m_PointCount : m_PointCount - 1, 1);
+        const int count = XMax(segments * XMax(samplesPerSegment, 1), 2) + 1;
+
+        m_Positions.Resize(count);
+        m_Directions.Resize(count);
+        m_Distances.Resize(count);
+        float length = 0.0f;
+        for (int i = 0; i < count; ++i)
+        {
+            VxVector pos(0.0f, 0.0f, 0.0f), dir(0.0f, 0.0f, 0.0f);
+            curve->GetLocalPos((float)i / (float)(count - 1), &pos, &dir);
+            if (i)
+                length += Magnitude(pos - m_Positions[i - 1]);
+            m_Positions[i] = pos;
+            m_Directions[i] = SafeNormalize(dir);
+            m_Distances[i] = length;
+        }
+        m_Length = length;
+    }
+
+    // Forces the next Update to build the table.
+    void Invalidate()
+    {
+        m_Curve = 0;
+        m_PointCount = -1;
+        m_Length = 0.0f;
+        m_Positions.Resize(0);
+        m_Directions.Resize(0);
+        m_Distances.Resize(0);
+    }
+
+    CKBOOL IsValid() const { return m_Distances.Size() >= 2; }
+
+    // Length of the sampled curve.
+    float GetLength() const { return m_Length; }
+
+    /*************************************************
+    Summary: Gets the position and direction at a distance from the start of the curve.
+
+    Arguments:
+        distance: Distance along the curve.
+        pos: Receives the position in the curve referential.
+        dir: If not NULL, receives the unit direction in the curve referential.
+    Return Value:
+        FALSE if the table is not built.
+    *************************************************/
+    CKBOOL GetLocalPosAtDistance(float distance, VxVector *pos, VxVector *dir = NULL) const
+    {
+        if (!IsValid())
+            return FALSE;
+        float t;
+        const int i = Find(distance, t);
+        *pos = m_Positions[i] + (m_Positions[i + 1] - m_Positions[i]) * t;
+        if (dir)
+            *dir = SafeNormalize(m_Directions[i] + (m_Directions[i + 1] - m_Directions[i]) * t);
+        return TRUE;
+    }
+
+    // Same as GetLocalPosAtDistance with the position and direction in the world referential.
+    CKBOOL GetPosAtDistance(CK3dEntity *curve, float distance, VxVector *pos, VxVector *dir = NULL) const
+    {
+        VxVector p, d;
+        if (!GetLocalPosAtDistance(distance, &p, dir ? &d : NULL))
+            return FALSE;
+        const VxMatrix &world = curve->GetWorldMatrix();
+        Vx3DMultiplyMatrixVector(pos, world, &p);
+        if (dir)
+        {
+            Vx3DRotateVector(dir, world, &d);
+            *dir = SafeNormalize(*dir);
+        }
+        return TRUE;
+    }
+
+    // Step (argument of CKCurve::GetPos) at a distance along the curve.
+    float GetStep(float distance) const
+    {
+        if (!IsValid())
+            return 0.0f;
+        float t;
+        const int i = Find(distance, t);
+        return ((float)i + t) / (float)(m_Distances.Size() - 1);
+    }
+
+    // Distance along the curve at a step.
+    float GetDistance(float step) const
+    {
+        if (!IsValid())
+            return 0.0f;
+        const int last = m_Distances.Size() - 1;
+        const float x = XMin(XMax(step, 0.0f), 1.0f) * (float)last;
+        const int i = XMin((int)x, last - 1);
+        return m_Distances[i] + (m_Distances[i + 1] - m_Distances[i]) * (x - (float)i);
+    }
+
+    int GetSampleCount() const { return m_Distances.Size(); }
+
+protected:
+    // Sample i such as distance is between samples i and i + 1, t is the position between them.
+    int Find(float distance, float &t) const
+    {
+        if (m_Closed && m_Length > 0.0f)
+        {
+            distance = fmodf(distance, m_Length);
+            if (distance < 0.0f)
+                distance += m_Length;
+        }
+        distance = XMin(XMax(distance, 0.0f), m_Length);
+
+        int lo = 0;
+        int hi = m_Distances.Size() - 1;
+        while (hi - lo > 1)
+        {
+            const int mid = (lo + hi) >> 1;
+            if (m_Distances[mid] <= distance)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        const float span = m_Distances[hi] - m_Distances[lo];
+        t = (span > 0.0f) ? (distance - m_Distances[lo]) / span : 0.0f;
+        return lo;
+    }
+
+    static VxVector SafeNormalize(const VxVector &v)
+    {
+        const float m = Magnitude(v);
+        return (m > 0.0f) ? v / m : v;
+    }
+
+    static CKDWORD Mix(CKDWORD h, float f)
+    {
+        CKDWORD bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return (h ^ bits) * 16777619;
+    }
+
+    static CKDWORD Mix(CKDWORD h, const VxVector &v) { return Mix(Mix(Mix(h, v.x), v.y), v.z); }
+
+    static CKDWORD ComputeSignature(CKCurve *curve)
+    {
+        CKDWORD h = 2166136261u;
+        h = Mix(h, curve->GetFittingCoeff());
+        h = Mix(h, curve->IsOpen() ? 1.0f : 0.0f);
+        const int count = curve->GetControlPointCount();
+        for (int i = 0; i < count; ++i)
+        {
+            CKCurvePoint *pt = curve->GetControlPoint(i);
+            if (!pt)
+                continue;
+            VxVector pos, in, out;
+            pt->GetPosition(&pos, curve);
+            pt->GetTangents(&in, &out);
+            h = Mix(Mix(Mix(h, pos), in), out);
+            h = Mix(Mix(Mix(h, pt->GetTension()), pt->GetContinuity()), pt->GetBias());
+            h = Mix(h, (float)((pt->IsLinear() ? 1 : 0) | (pt->IsTCB() ? 2 : 0)));
+        }
+        return h;
+    }
+
+    CK_ID m_Curve;
+    CKDWORD m_Signature;
+    int m_PointCount;
+    int m_Samples;
+    float m_Length;
+    CKBOOL m_Closed;
+    XArray<VxVector> m_Positions; // curve referential
+    XArray<VxVector> m_Directions;
+    XArray<float> m_Distances; // cumulated length at each sample
+};
+
+/****************************************************************
+Summary: Table of the Y values of a 2D curve sampled at regular X.
+
+Remarks:
+    o CK2dCurve::GetY evaluates the spline at each call. The table keeps
+    the Y values at regular X (0..1) and GetY interpolates the two values
+    around X, which is a direct lookup.
+    o Update builds the table again when the control points (positions,
+    tangents, TCB parameters and flags) changed since it was built.
+
+    CK2dCurveTable table;
+    table.Update(curve);
+    float y = table.GetY(x);
+
+See Also: CK2dCurve::GetY,CKCurveTable
+****************************************************************/
+class CK2dCurveTable
+{
+public:
+    CK2dCurveTable() : m_Curve(NULL), m_Signature(0), m_PointCount(-1) {}
+
+    /*************************************************
+    Summary: Builds the table if the curve changed since it was built.
+
+    Arguments:
+        curve: Curve to sample.
+        samples: Number of X values sampled.
+    Return Value:
+        TRUE if the table was built again.
+    *************************************************/
+    CKBOOL Update(CK2dCurve *curve, int samples = 256)
+    {
+        if (!curve)
+        {
+            Invalidate();
+            return FALSE;
+        }
+        samples = XMax(samples, 2);
+        const CKDWORD signature = ComputeSignature(curve);
+        if (m_Curve == curve && m_PointCount == curve->GetControlPointCount() &&
+            m_Signature == signature && m_Values.Size() == samples)
+            return FALSE;
+        m_Curve = curve;
+        m_PointCount = curve->GetControlPointCount();
+        m_Signature = signature;
+        m_Values.Resize(samples);
+        for (int i = 0; i < samples; ++i)
+            m_Values[i] = curve->GetY((float)i / (float)(samples - 1));
+        return TRUE;
+    }
+
+    void Invalidate()
+    {
+        m_Curve = NULL;
+        m_PointCount = -1;
+        m_Values.Resize(0);
+    }
+
+    CKBOOL IsValid() const { return m_Values.Size() >= 2; }
+
+    // Same as CK2dCurve::GetY, X is clamped to 0..1.
+    float GetY(float X) const
+    {
+        if (!IsValid())
+            return 0.0f;
+        const int last = m_Values.Size() - 1;
+        const float x = XMin(XMax(X, 0.0f), 1.0f) * (float)last;
+        const int i = XMin((int)x, last - 1);
+        return m_Values[i] + (m_Values[i + 1] - m_Values[i]) * (x - (float)i);
+    }
+
+protected:
+    static CKDWORD Mix(CKDWORD h, float f)
+    {
+        CKDWORD bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return (h ^ bits) * 16777619;
+    }
+
+    static CKDWORD ComputeSignature(CK2dCurve *curve)
+    {
+        CKDWORD h = 2166136261u;
+        const int count = curve->GetControlPointCount();
+        for (int i = 0; i < count; ++i)
+        {
+            CK2dCurvePoint *pt = curve->GetControlPoint(i);
+            const Vx2DVector &pos = pt->GetPosition();
+            const Vx2DVector &in = pt->GetInTangent();
+            const Vx2DVector &out = pt->GetOutTangent();
+            h = Mix(Mix(h, pos.x), pos.y);
+            h = Mix(Mix(Mix(Mix(h, in.x), in.y), out.x), out.y);
+            h = Mix(Mix(Mix(h, pt->GetTension()), pt->GetContinuity()), pt->GetBias());
+            h = Mix(h, (float)((pt->IsLinear() ? 1 : 0) | (pt->IsTCB() ? 2 : 0)));
+        }
+        return h;
+    }
+
+    CK2dCurve *m_Curve;
+    CKDWORD m_Signature;
+    int m_PointCount;
+    XArray<float> m_Values;
+};
+
+#endif // CKCURVETABLE_H
@@ -21,6 +21,7 @@ typedef enum CK_DATAREADER_FLAGS
     CK_DATAREADER_STREAMFILE   = 0x00000010,	// This reader can stream data from file
     CK_DATAREADER_STREAMURL    = 0x00000020,	// This reader can stream data from URL
     CK_DATAREADER_VXSTREAMLOAD = 0x00000040,	// This reader can load data from a VxStream
+    CK_DATAREADER_THREADSAFE   = 0x00000080,	// This reader can load data from several threads at the same time
 } CK_DATAREADER_FLAGS;
 
 /**********************************************************
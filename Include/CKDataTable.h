@@ -0,0 +1,656 @@
+#ifndef CKDATATABLE_H
+#define CKDATATABLE_H
+
+#include "CKDataArray.h"
+#include "XHashTable.h"
+#include "XString.h"
+#include "VxSIMD.h"
+
+/****************************************************************
+Summary: Columnar copy of a CKDataArray with a hash index on the key column and sorted column indices.
+
+Remarks:
+    o CKDataArray stores its rows, each one an array of the values of the
+    columns, and its searches walk the rows testing the type of each
+    cell. The table keeps each column in a contiguous array of its type
+    (the int, float and object values as CKDWORD, the strings as XString),
+    so the searches and the reductions run over one array without any
+    test on the type.
+    o SetKeyColumn builds a hash index of the key column: FindRowIndex with
+    CKEQUAL on the key column is a hash lookup.
+    o BuildSortedIndex keeps the rows of a column ordered by value, used by
+    GetNearest and by the counts and searches with the comparison
+    operators.
+    o Sum, GetHighest and GetLowest of the float columns run 4 values at a
+    time with SSE. The scalar code does the same additions in the same
+    order, so the results are identical.
+    o Sort and Unique change the data array, sorting the rows with a stable
+    radix sort of the column before moving them with SwapRows.
+    o The table is a copy: Build must be called again after the array was
+    changed by other means than SetElementValue, Sort and Unique.
+
+    CKDataTable table(array);
+    table.SetKeyColumn(0);
+    int row = table.FindRowIndex(0, CKEQUAL, (CKDWORD)itemId);
+    ...
+    CKDWORD total = table.Sum(2);
+
+See Also: CKDataArray
+****************************************************************/
+class CKDataTable
+{
+public:
+    CKDataTable(CKDataArray *array = NULL) : m_Array(NULL), m_RowCount(0), m_KeyColumn(-1)
+    {
+        if (array)
+            Build(array);
+    }
+
+    // Copies the columns of the array.
+    void Build(CKDataArray *array)
+    {
+        m_Array = array;
+        m_RowCount = array ? array->GetRowCount() : 0;
+        const int columns = array ? array->GetColumnCount() : 0;
+        m_Columns.Resize(columns);
+        XArray<char> buffer;
+        for (int c = 0; c < columns; ++c)
+        {
+            Column &col = m_Columns[c];
+            col.m_Type = array->GetColumnType(c);
+            col.m_Sorted.Resize(0);
+            col.m_Values.Resize(0);
+            col.m_Strings.Resize(0);
+            if (col.m_Type == CKARRAYTYPE_STRING)
+            {
+                col.m_Strings.Resize(m_RowCount);
+                for (int i = 0; i < m_RowCount; ++i)
+                {
+                    const int size = array->GetElementStringValue(i, c, NULL);
+                    buffer.Resize(size + 1);
+                    buffer[0] = 0;
+                    if (size > 0)
+                        array->GetElementStringValue(i, c, buffer.Begin());
+                    col.m_Strings[i] = buffer.Begin();
+                }
+            }
+            else
+            {
+                col.m_Values.Resize(m_RowCount);
+                for (int i = 0; i < m_RowCount; ++i)
+                    col.m_Values[i] = *array->GetElement(i, c);
+            }
+        }
+        const int key = m_KeyColumn;
+        m_KeyColumn = -1;
+        SetKeyColumn(key);
+    }
+
+    CKDataArray *GetArray() const { return m_Array; }
+    int GetRowCount() const { return m_RowCount; }
+    int GetColumnCount() const { return m_Columns.Size(); }
+
+    // Contiguous values of an int, float or object column, NULL for a string column.
+    const CKDWORD *GetColumn(int c) const { return m_Columns[c].m_Type == CKARRAYTYPE_STRING ? NULL : m_Columns[c].m_Values.Begin(); }
+    const char *GetString(int i, int c) const { return m_Columns[c].m_Strings[i].CStr(); }
+
+    // Sets a value in the array and in the table.
+    CKBOOL SetElementValue(int i, int c, CKDWORD value)
+    {
+        Column &col = m_Columns[c];
+        if (col.m_Type == CKARRAYTYPE_STRING || !m_Array->SetElementValue(i, c, &value, sizeof(CKDWORD)))
+            return FALSE;
+        if (c == m_KeyColumn)
+            RemoveFromKey(i);
+        col.m_Values[i] = value;
+        col.m_Sorted.Resize(0);
+        if (c == m_KeyColumn)
+            AddToKey(i);
+        return TRUE;
+    }
+
+    //---------------------------------------------
+    // Indices
+
+    // Hash index on a column, -1 for none.
+    void SetKeyColumn(int c)
+    {
+        if (c >= m_Columns.Size())
+            c = -1;
+        m_KeyColumn = c;
+        m_KeyFirst.Clear();
+        m_StringKeyFirst.Clear();
+        m_KeyNext.Resize(0);
+        if (c < 0)
+            return;
+        m_KeyNext.Resize(m_RowCount);
+        // from the last row so the chains are in row order
+        for (int i = m_RowCount - 1; i >= 0; --i)
+            AddToKey(i);
+    }
+    int GetKeyColumn() const { return m_KeyColumn; }
+
+    // Rows of the column sorted by value (ascending, stable).
+    const XArray<int> &BuildSortedIndex(int c)
+    {
+        Column &col = m_Columns[c];
+        if (col.m_Sorted.Size() != m_RowCount)
+            SortRows(c, TRUE, col.m_Sorted);
+        return col.m_Sorted;
+    }
+
+    //---------------------------------------------
+    // Searches
+
+    /************************************************
+    Summary: Finds the first row from startIndex whose value verifies a comparison.
+
+    Remarks:
+        The string columns are searched with the const char * version.
+        CKEQUAL on the key column uses the hash index.
+    ************************************************/
+    int FindRowIndex(int c, CK_COMPOPERATOR op, CKDWORD key, int startIndex = 0)
+    {
+        Key k = {key, ""};
+        return FindRow(c, op, k, startIndex);
+    }
+
+    int FindRowIndex(int c, CK_COMPOPERATOR op, const char *key, int startIndex = 0)
+    {
+        Key k = {0, key ? key : ""};
+        return FindRow(c, op, k, startIndex);
+    }
+
+    // Number of rows verifying a comparison, counted on the sorted index when it exists.
+    int GetCount(int c, CK_COMPOPERATOR op, CKDWORD key)
+    {
+        Key k = {key, ""};
+        return Count(c, op, k);
+    }
+
+    int GetCount(int c, CK_COMPOPERATOR op, const char *key)
+    {
+        Key k = {0, key ? key : ""};
+        return Count(c, op, k);
+    }
+
+    // Row of the value nearest to value (int or float column), through the sorted index.
+    CKBOOL GetNearest(int c, CKDWORD value, int &row)
+    {
+        const Column &col = m_Columns[c];
+        if (!m_RowCount || (col.m_Type != CKARRAYTYPE_INT && col.m_Type != CKARRAYTYPE_FLOAT))
+            return FALSE;
+        const XArray<int> &sorted = BuildSortedIndex(c);
+        Key key = {value, ""};
+        const int k = Bound(col, key, FALSE);
+        const double v = AsDouble(col, value);
+        row = -1;
+        double best = 0.0;
+        // the nearest is one of the neighbours of the insertion point, the first row of equal values wins
+        for (int j = k - 1; j <= k; ++j)
+        {
+            if (j < 0 || j >= m_RowCount)
+                continue;
+            int r = sorted[j];
+            if (j == k - 1)
+            {
+                // first row of this run of values
+                Key run = {col.m_Values[r], ""};
+                r = sorted[Bound(col, run, FALSE)];
+            }
+            double d = AsDouble(col, col.m_Values[r]) - v;
+            if (d < 0.0)
+                d = -d;
+            if (row < 0 || d < best || (d == best && r < row))
+            {
+                best = d;
+                row = r;
+            }
+        }
+        return TRUE;
+    }
+
+    //---------------------------------------------
+    // Reductions
+
+    // Sum of an int or float column (the float sum as the bits of a float, as CKDataArray::Sum).
+    CKDWORD Sum(int c) const
+    {
+        const Column &col = m_Columns[c];
+        if (col.m_Type == CKARRAYTYPE_FLOAT)
+        {
+            float sum = SumFloats((const float *)col.m_Values.Begin(), m_RowCount);
+            return *(CKDWORD *)&sum;
+        }
+        if (col.m_Type != CKARRAYTYPE_INT)
+            return 0;
+        int sum = 0;
+        for (int i = 0; i < m_RowCount; ++i)
+            sum += (int)col.m_Values[i];
+        return (CKDWORD)sum;
+    }
+
+    // Row of the highest value, the first one for equal values.
+    CKBOOL GetHighest(int c, int &row) const { return GetExtreme(c, TRUE, row); }
+    CKBOOL GetLowest(int c, int &row) const { return GetExtreme(c, FALSE, row); }
+
+    //---------------------------------------------
+    // Array changes
+
+    // Sorts the rows of the array on a column (stable), then the table.
+    void Sort(int c, CKBOOL ascending)
+    {
+        XArray<int> order;
+        SortRows(c, ascending, order);
+        ApplyOrder(order);
+    }
+
+    // Removes the rows whose value in the column appeared in a previous row.
+    int Unique(int c)
+    {
+        const Column &col = m_Columns[c];
+        XArray<int> order;
+        XHashTable<int, CKDWORD> seen;
+        XHashTable<int, XString> seenStrings;
+        for (int i = 0; i < m_RowCount; ++i)
+        {
+            const CKBOOL first = col.m_Type == CKARRAYTYPE_STRING ? !seenStrings.FindPtr(col.m_Strings[i]) : !seen.FindPtr(col.m_Values[i]);
+            if (!first)
+                continue;
+            if (col.m_Type == CKARRAYTYPE_STRING)
+                seenStrings.Insert(col.m_Strings[i], i);
+            else
+                seen.Insert(col.m_Values[i], i);
+            order.PushBack(i);
+        }
+        const int removed = m_RowCount - order.Size();
+        if (!removed)
+            return 0;
+        // the kept rows first, in order, then the duplicates are removed from the end
+        const int kept = order.Size();
+        XArray<XBYTE> used;
+        used.Resize(m_RowCount);
+        memset(used.Begin(), 0, m_RowCount);
+        int i;
+        for (i = 0; i < kept; ++i)
+            used[order[i]] = 1;
+        for (i = 0; i < m_RowCount; ++i)
+        {
+            if (!used[i])
+                order.PushBack(i);
+        }
+        ApplyOrder(order);
+        for (i = m_RowCount - 1; i >= kept; --i)
+            m_Array->RemoveRow(i);
+        Build(m_Array);
+        return removed;
+    }
+
+protected:
+    struct Key
+    {
+        CKDWORD m_Value;
+        const char *m_String; // for a string column
+    };
+
+    struct Column
+    {
+        CK_ARRAYTYPE m_Type;
+        XArray<CKDWORD> m_Values;
+        XClassArray<XString> m_Strings;
+        XArray<int> m_Sorted;
+    };
+
+    void AddToKey(int i)
+    {
+        const Column &col = m_Columns[m_KeyColumn];
+        int *first = col.m_Type == CKARRAYTYPE_STRING ? m_StringKeyFirst.FindPtr(col.m_Strings[i]) : m_KeyFirst.FindPtr(col.m_Values[i]);
+        if (first && *first < i)
+        {
+            // after the rows before it
+            int row = *first;
+            while (m_KeyNext[row] >= 0 && m_KeyNext[row] < i)
+                row = m_KeyNext[row];
+            m_KeyNext[i] = m_KeyNext[row];
+            m_KeyNext[row] = i;
+            return;
+        }
+        m_KeyNext[i] = first ? *first : -1;
+        if (col.m_Type == CKARRAYTYPE_STRING)
+            m_StringKeyFirst.Insert(col.m_Strings[i], i, TRUE);
+        else
+            m_KeyFirst.Insert(col.m_Values[i], i, TRUE);
+    }
+
+    void RemoveFromKey(int i)
+    {
+        const Column &col = m_Columns[m_KeyColumn];
+        int *first = col.m_Type == CKARRAYTYPE_STRING ? m_StringKeyFirst.FindPtr(col.m_Strings[i]) : m_KeyFirst.FindPtr(col.m_Values[i]);
+        if (!first)
+            return;
+        if (*first == i)
+        {
+            if (m_KeyNext[i] >= 0)
+                *first = m_KeyNext[i];
+            else if (col.m_Type == CKARRAYTYPE_STRING)
+                m_StringKeyFirst.Remove(col.m_Strings[i]);
+            else
+                m_KeyFirst.Remove(col.m_Values[i]);
+            return;
+        }
+        for (int row = *first; row >= 0; row = m_KeyNext[row])
+        {
+            if (m_KeyNext[row] == i)
+            {
+                m_KeyNext[row] = m_KeyNext[i];
+                return;
+            }
+        }
+    }
+
+    int FindRow(int c, CK_COMPOPERATOR op, const Key &key, int startIndex)
+    {
+        const Column &col = m_Columns[c];
+        if (startIndex < 0)
+            startIndex = 0;
+        if (c == m_KeyColumn && op == CKEQUAL)
+        {
+            const int *first = col.m_Type == CKARRAYTYPE_STRING ? m_StringKeyFirst.FindPtr(XString(key.m_String)) : m_KeyFirst.FindPtr(key.m_Value);
+            int row = first ? *first : -1;
+            while (row >= 0 && row < startIndex)
+                row = m_KeyNext[row];
+            return row;
+        }
+        for (int i = startIndex; i < m_RowCount; ++i)
+        {
+            if (Test(col, i, op, key))
+                return i;
+        }
+        return -1;
+    }
+
+    int Count(int c, CK_COMPOPERATOR op, const Key &k)
+    {
+        const Column &col = m_Columns[c];
+        if (col.m_Sorted.Size() == m_RowCount && op != CKNOTEQUAL)
+        {
+            const int lower = Bound(col, k, FALSE);
+            const int upper = Bound(col, k, TRUE);
+            switch (op)
+            {
+            case CKEQUAL: return upper - lower;
+            case CKLESSER: return lower;
+            case CKLESSEREQUAL: return upper;
+            case CKGREATER: return m_RowCount - upper;
+            case CKGREATEREQUAL: return m_RowCount - lower;
+            default: break;
+            }
+        }
+        int count = 0;
+        for (int i = 0; i < m_RowCount; ++i)
+            count += Test(col, i, op, k) ? 1 : 0;
+        return count;
+    }
+
+    template <class T>
+    static CKBOOL Compare(T a, CK_COMPOPERATOR op, T b)
+    {
+        switch (op)
+        {
+        case CKEQUAL: return a == b;
+        case CKNOTEQUAL: return a != b;
+        case CKLESSER: return a < b;
+        case CKLESSEREQUAL: return a <= b;
+        case CKGREATER: return a > b;
+        case CKGREATEREQUAL: return a >= b;
+        default: return FALSE;
+        }
+    }
+
+    static CKBOOL Test(const Column &col, int i, CK_COMPOPERATOR op, const Key &key)
+    {
+        switch (col.m_Type)
+        {
+        case CKARRAYTYPE_INT: return Compare((int)col.m_Values[i], op, (int)key.m_Value);
+        case CKARRAYTYPE_FLOAT: return Compare(*(const float *)&col.m_Values[i], op, *(const float *)&key.m_Value);
+        case CKARRAYTYPE_STRING: return Compare(strcmp(col.m_Strings[i].CStr(), key.m_String), op, 0);
+        default: return Compare(col.m_Values[i], op, key.m_Value);
+        }
+    }
+
+    static double AsDouble(const Column &col, CKDWORD v) { return col.m_Type == CKARRAYTYPE_FLOAT ? (double)*(const float *)&v : (double)(int)v; }
+
+    // Order preserving unsigned keys of the values.
+    static CKDWORD RadixKey(CK_ARRAYTYPE type, CKDWORD v)
+    {
+        if (type == CKARRAYTYPE_INT)
+            return v ^ 0x80000000;
+        if (type == CKARRAYTYPE_FLOAT)
+            return (v & 0x80000000) ? ~v : (v | 0x80000000);
+        return v;
+    }
+
+    // First position of the sorted index whose value is not lower than key (upper: greater than key).
+    int Bound(const Column &col, const Key &key, CKBOOL upper) const
+    {
+        int lo = 0, hi = m_RowCount;
+        while (lo < hi)
+        {
+            const int mid = (lo + hi) >> 1;
+            const int row = col.m_Sorted[mid];
+            const CKBOOL before = col.m_Type == CKARRAYTYPE_STRING ? (upper ? Test(col, row, CKLESSEREQUAL, key) : Test(col, row, CKLESSER, key)) : (upper ? RadixKey(col.m_Type, col.m_Values[row]) <= RadixKey(col.m_Type, key.m_Value) : RadixKey(col.m_Type, col.m_Values[row]) < RadixKey(col.m_Type, key.m_Value));
+            if (before)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Stable order of the rows on a column.
+    void SortRows(int c, CKBOOL ascending, XArray<int> &order) const
+    {
+        const Column &col = m_Columns[c];
+        order.Resize(m_RowCount);
+        int i;
+        for (i = 0; i < m_RowCount; ++i)
+            order[i] = i;
+        if (col.m_Type == CKARRAYTYPE_STRING)
+        {
+            XArray<int> temp;
+            temp.Resize(m_RowCount);
+            MergeSort(col, ascending, order.Begin(), temp.Begin(), m_RowCount);
+            return;
+        }
+        // LSD radix sort, 4 passes of 8 bits
+        XArray<CKDWORD> keys, keys2;
+        XArray<int> order2;
+        keys.Resize(m_RowCount);
+        keys2.Resize(m_RowCount);
+        order2.Resize(m_RowCount);
+        for (i = 0; i < m_RowCount; ++i)
+        {
+            const CKDWORD k = RadixKey(col.m_Type, col.m_Values[i]);
+            keys[i] = ascending ? k : ~k;
+        }
+        int *src = order.Begin(), *dst = order2.Begin();
+        CKDWORD *ksrc = keys.Begin(), *kdst = keys2.Begin();
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            int counts[257];
+            memset(counts, 0, sizeof(counts));
+            for (i = 0; i < m_RowCount; ++i)
+                ++counts[((ksrc[i] >> shift) & 0xFF) + 1];
+            for (i = 1; i < 257; ++i)
+                counts[i] += counts[i - 1];
+            for (i = 0; i < m_RowCount; ++i)
+            {
+                const int p = counts[(ksrc[i] >> shift) & 0xFF]++;
+                dst[p] = src[i];
+                kdst[p] = ksrc[i];
+            }
+            int *t = src;
+            src = dst;
+            dst = t;
+            CKDWORD *kt = ksrc;
+            ksrc = kdst;
+            kdst = kt;
+        }
+        // after an even number of passes the result is back in order
+    }
+
+    static void MergeSort(const Column &col, CKBOOL ascending, int *rows, int *temp, int count)
+    {
+        if (count < 2)
+            return;
+        const int half = count >> 1;
+        MergeSort(col, ascending, rows, temp, half);
+        MergeSort(col, ascending, rows + half, temp, count - half);
+        int a = 0, b = half, k = 0;
+        while (a < half && b < count)
+        {
+            const int cmp = strcmp(col.m_Strings[rows[b]].CStr(), col.m_Strings[rows[a]].CStr());
+            // takes b only when strictly before a, to stay stable
+            if (ascending ? cmp < 0 : cmp > 0)
+                temp[k++] = rows[b++];
+            else
+                temp[k++] = rows[a++];
+        }
+        while (a < half)
+            temp[k++] = rows[a++];
+        while (b < count)
+            temp[k++] = rows[b++];
+        memcpy(rows, temp, count * sizeof(int));
+    }
+
+    // Moves the rows of the array so that row order[i] becomes row i.
+    void ApplyOrder(const XArray<int> &order)
+    {
+        XArray<int> position, rowAt;
+        position.Resize(m_RowCount);
+        rowAt.Resize(m_RowCount);
+        int i;
+        for (i = 0; i < m_RowCount; ++i)
+            position[i] = rowAt[i] = i;
+        for (i = 0; i < m_RowCount; ++i)
+        {
+            const int row = order[i];
+            const int p = position[row];
+            if (p == i)
+                continue;
+            m_Array->SwapRows(i, p);
+            rowAt[p] = rowAt[i];
+            position[rowAt[p]] = p;
+            rowAt[i] = row;
+            position[row] = i;
+        }
+        Build(m_Array);
+    }
+
+    static float SumFloats(const float *v, int count)
+    {
+        const int count4 = count & ~3;
+        float lanes[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        int i = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            __m128 s = _mm_setzero_ps();
+            for (; i < count4; i += 4)
+                s = _mm_add_ps(s, _mm_loadu_ps(v + i));
+            _mm_storeu_ps(lanes, s);
+        }
+        else
+#endif
+        {
+            for (; i < count4; i += 4)
+            {
+                lanes[0] += v[i];
+                lanes[1] += v[i + 1];
+                lanes[2] += v[i + 2];
+                lanes[3] += v[i + 3];
+            }
+        }
+        float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < count; ++i)
+            sum += v[i];
+        return sum;
+    }
+
+    // The extreme value is found 4 values at a time, then its first row.
+    static float ExtremeFloat(const float *v, int count, CKBOOL highest)
+    {
+        float best = v[0];
+        int i = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE() && count >= 4)
+        {
+            const int count4 = count & ~3;
+            __m128 m = _mm_loadu_ps(v);
+            for (i = 4; i < count4; i += 4)
+                m = highest ? _mm_max_ps(m, _mm_loadu_ps(v + i)) : _mm_min_ps(m, _mm_loadu_ps(v + i));
+            float lanes[4];
+            _mm_storeu_ps(lanes, m);
+            best = lanes[0];
+            for (int k = 1; k < 4; ++k)
+                best = (highest ? lanes[k] > best : lanes[k] < best) ? lanes[k] : best;
+        }
+#endif
+        for (; i < count; ++i)
+            best = (highest ? v[i] > best : v[i] < best) ? v[i] : best;
+        return best;
+    }
+
+    CKBOOL GetExtreme(int c, CKBOOL highest, int &row) const
+    {
+        const Column &col = m_Columns[c];
+        if (!m_RowCount)
+            return FALSE;
+        int i;
+        row = 0;
+        if (col.m_Type == CKARRAYTYPE_FLOAT)
+        {
+            const float *v = (const float *)col.m_Values.Begin();
+            const float best = ExtremeFloat(v, m_RowCount, highest);
+            for (i = 0; i < m_RowCount; ++i)
+            {
+                if (v[i] == best)
+                {
+                    row = i;
+                    return TRUE;
+                }
+            }
+            return TRUE;
+        }
+        for (i = 1; i < m_RowCount; ++i)
+        {
+            CKBOOL better;
+            if (col.m_Type == CKARRAYTYPE_STRING)
+            {
+                const int cmp = strcmp(col.m_Strings[i].CStr(), col.m_Strings[row].CStr());
+                better = highest ? cmp > 0 : cmp < 0;
+            }
+            else if (col.m_Type == CKARRAYTYPE_INT)
+            {
+                better = highest ? (int)col.m_Values[i] > (int)col.m_Values[row] : (int)col.m_Values[i] < (int)col.m_Values[row];
+            }
+            else
+            {
+                better = highest ? col.m_Values[i] > col.m_Values[row] : col.m_Values[i] < col.m_Values[row];
+            }
+            if (better)
+                row = i;
+        }
+        return TRUE;
+    }
+
+    CKDataArray *m_Array;
+    int m_RowCount;
+    XClassArray<Column> m_Columns;
+    int m_KeyColumn;
+    XHashTable<int, CKDWORD> m_KeyFirst;      // first row of each key
+    XHashTable<int, XString> m_StringKeyFirst; // same for a string key column
+    XArray<int> m_KeyNext;                     // next row with the same key, -1 at the end
+};
+
+#endif // CKDATATABLE_H
@@ -0,0 +1,230 @@
+#ifndef CKDEPENDENCIESPOOL_H
+#define CKDEPENDENCIESPOOL_H
+
+#include "CKContext.h"
+#include "CKObject.h"
+#include "CKObjectArray.h"
+#include "CKDependencies.h"
+#include "XBitArray.h"
+
+/****************************************************************
+Summary: Reusable dependencies context computing the closure of a set of objects once for copy, delete and save operations.
+
+Remarks:
+    o CKContext::CopyObjects, DestroyObjects and Save build their dependencies
+    in a context which is cleared (and its arrays freed) for each call. A
+    CKDependenciesPool is kept alive between operations: Reset empties its
+    arrays, the remapping table and the sets without releasing their memory,
+    so building a closure again only allocates when it is larger than all
+    the previous ones.
+    o The objects of the closure are marked in a bit array indexed by CK_ID:
+    IsHere is a bit test instead of a hash lookup, and resetting it only
+    clears the bits of the previous closure (not the whole array).
+    o GetClassObjects walks the closure once and keeps the objects of a class and
+    its derived classes, tested against the children mask of the class
+    description (one bit test per object, no walk up the class hierarchy).
+    o Copy, Destroy and Save give the closure to the context with
+    CK_DEPENDENCIES_NONE options: every dependency is already in the list,
+    so the context does not look for them a second time. The closure can be
+    filtered (or extended) before the operation with Remove, RemoveClass
+    and Add.
+    o Each object still builds its own dependencies with
+    CKObject::PrepareDependencies, implemented by the classes in CK2.
+
+    CKDependenciesPool pool(context);
+    ...
+    pool.Collect(ids.Begin(), ids.Size(), CK_DEPENDENCIES_COPY);
+    pool.RemoveClass(CKCID_TEXTURE); // Share the textures with the originals
+    const XObjectArray &copies = pool.Copy(CK_OBJECTCREATION_RENAME, "_copy");
+
+See Also: CKDependenciesContext,CKDependencies,CKContext::CopyObjects,CKContext::DestroyObjects
+****************************************************************/
+class CKDependenciesPool : public CKDependenciesContext
+{
+public:
+    CKDependenciesPool(CKContext *context) : CKDependenciesContext(context), m_Gathered(0)
+    {
+        m_NoDependencies.m_Flags = CK_DEPENDENCIES_NONE;
+    }
+
+    // Empties the closure, keeping the memory of all the arrays.
+    void Reset()
+    {
+        for (CK_ID *it = m_Closure.Begin(); it != m_Closure.End(); ++it)
+            m_Visited.Unset(*it);
+        m_Closure.Resize(0);
+        m_Gathered = 0;
+        m_MapID.Clear();
+        m_Objects.Resize(0);
+        m_Scripts.Resize(0);
+        m_DynamicObjects.Resize(0);
+        m_DependenciesStack.Resize(0);
+        m_Dependencies = NULL;
+        m_ObjectsClassMask.Clear();
+    }
+
+    /*************************************************
+    Summary: Builds the closure of a set of objects.
+
+    Arguments:
+        ids: Objects to start from.
+        count: Number of objects.
+        mode: Operation the dependencies are taken for.
+        deps: Dependencies options, NULL for the default options of the mode.
+    Return Value:
+        Number of objects in the closure.
+    *************************************************/
+    int Collect(const CK_ID *ids, int count, CK_DEPENDENCIES_OPMODE mode, CKDependencies *deps = NULL)
+    {
+        Reset();
+        SetOperationMode(mode);
+        StartDependencies(deps ? deps : CKGetDefaultClassDependencies(mode));
+        for (int i = 0; i < count; ++i)
+        {
+            if (IsHere(ids[i]))
+                continue;
+            CKObject *obj = m_CKContext->GetObject(ids[i]);
+            if (!obj)
+                continue;
+            obj->PrepareDependencies(*this);
+            Gather();
+        }
+        StopDependencies();
+        return m_Closure.Size();
+    }
+
+    int Collect(const XObjectArray &objects, CK_DEPENDENCIES_OPMODE mode, CKDependencies *deps = NULL)
+    {
+        return Collect(objects.Begin(), objects.Size(), mode, deps);
+    }
+
+    //---------------------------------------------
+    // Closure
+
+    const XObjectArray &GetClosure() const { return m_Closure; }
+
+    CKBOOL IsHere(CK_ID id) { return m_Visited.IsSet(id) != 0; }
+
+    // Fills objects with the objects of the closure of class cid (or derived from it if derived is TRUE).
+    int GetClassObjects(CK_CLASSID cid, XObjectPointerArray &objects, CKBOOL derived = TRUE)
+    {
+        objects.Resize(0);
+        BuildClassMask(cid, derived);
+        for (CK_ID *it = m_Closure.Begin(); it != m_Closure.End(); ++it)
+        {
+            CKObject *obj = m_CKContext->GetObject(*it);
+            if (obj && m_ClassMask.IsSet(obj->GetClassID()))
+                objects.PushBack(obj);
+        }
+        return objects.Size();
+    }
+
+    // Adds an object (not its dependencies) to the closure.
+    void Add(CK_ID id)
+    {
+        if (id && !m_Visited.TestSet(id))
+            m_Closure.PushBack(id);
+    }
+
+    // Removes an object from the closure.
+    void Remove(CK_ID id)
+    {
+        if (!m_Visited.TestUnset(id))
+            return;
+        for (int i = 0; i < m_Closure.Size(); ++i)
+        {
+            if (m_Closure[i] == id)
+            {
+                m_Closure.RemoveAt(i);
+                return;
+            }
+        }
+    }
+
+    // Removes the objects of class cid (or derived from it if derived is TRUE) from the closure.
+    int RemoveClass(CK_CLASSID cid, CKBOOL derived = TRUE)
+    {
+        BuildClassMask(cid, derived);
+        CK_ID *dst = m_Closure.Begin();
+        for (CK_ID *it = m_Closure.Begin(); it != m_Closure.End(); ++it)
+        {
+            CKObject *obj = m_CKContext->GetObject(*it);
+            if (obj && m_ClassMask.IsSet(obj->GetClassID()))
+                m_Visited.Unset(*it);
+            else
+                *dst++ = *it;
+        }
+        const int removed = (int)(m_Closure.End() - dst);
+        m_Closure.Resize((int)(dst - m_Closure.Begin()));
+        return removed;
+    }
+
+    //---------------------------------------------
+    // Operations on the closure
+
+    const XObjectArray &Copy(CK_OBJECTCREATION_OPTIONS options = CK_OBJECTCREATION_NONAMECHECK, CKSTRING appendName = NULL)
+    {
+        return m_CKContext->CopyObjects(m_Closure, &m_NoDependencies, options, appendName);
+    }
+
+    // The closure is emptied since its objects no longer exist.
+    CKERROR Destroy(CKDWORD flags = 0)
+    {
+        CKERROR err = m_CKContext->DestroyObjects(m_Closure.Begin(), m_Closure.Size(), flags, &m_NoDependencies);
+        Reset();
+        return err;
+    }
+
+    CKERROR Save(CKSTRING fileName, CKDWORD saveFlags = CK_STATESAVE_ALL)
+    {
+        CKObjectArray *array = CreateCKObjectArray();
+        for (CK_ID *it = m_Closure.Begin(); it != m_Closure.End(); ++it)
+            array->InsertRear(*it);
+        CKERROR err = m_CKContext->Save(fileName, array, saveFlags, &m_NoDependencies);
+        DeleteCKObjectArray(array);
+        return err;
+    }
+
+protected:
+    // Appends the objects added to the context since the last call.
+    void Gather()
+    {
+        const int count = GetObjectsCount();
+        for (int i = (m_Gathered <= count) ? m_Gathered : 0; i < count; ++i)
+        {
+            CKObject *obj = GetObjects(i);
+            if (obj)
+                Add(obj->GetID());
+        }
+        m_Gathered = count;
+    }
+
+    void BuildClassMask(CK_CLASSID cid, CKBOOL derived)
+    {
+        m_ClassMask.Clear();
+        m_ClassMask.Set(cid);
+        if (!derived)
+            return;
+        CKClassDesc *desc = CKGetClassDesc(cid);
+        if (!desc)
+            return;
+        const int classCount = CKGetClassCount();
+        for (int c = desc->Children.GetNextSetBit(0); c >= 0 && c < classCount; c = desc->Children.GetNextSetBit(c + 1))
+            m_ClassMask.Set(c);
+    }
+
+    // Objects of the closure, in the order they were added
+    XObjectArray m_Closure;
+    // Objects of the context already appended to the closure
+    int m_Gathered;
+    // Bit set for each CK_ID of the closure
+    XBitArray m_Visited;
+    XBitArray m_ClassMask;
+    CKDependencies m_NoDependencies;
+
+private:
+    CKDependenciesPool(const CKDependenciesPool &);
+    CKDependenciesPool &operator=(const CKDependenciesPool &);
+};
+
+#endif // CKDEPENDENCIESPOOL_H
@@ -0,0 +1,326 @@
+#ifndef CKDIRTYRECTRENDERER_H
+#define CKDIRTYRECTRENDERER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CK2dEntity.h"
+#include "VxMath.h"
+#include "XObjectArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Renders a frame only when something changed on screen.
+
+Remarks:
+    o Mostly static screens (menus, kiosk and attract mode screens) are
+    cleared and drawn again each frame. Render compares the 3D and 2D
+    entities with their state of the last rendered frame: world matrix
+    and visibility of the 3D entities, rectangle, source rectangle,
+    material and visibility of the 2D entities, appearance and removal of
+    entities, and the viewpoint and projection. When nothing changed the
+    frame is skipped: no clear, no drawing and no copy to the screen, the
+    last image stays displayed.
+    o The dirty rectangle of a frame is the union of the screen extents
+    (VxTransformBox2D of the bounding boxes) of the changed entities, at
+    their old and new position. An entity with blending or a depth
+    interaction with the others can not be drawn alone over the
+    previous image, so a dirty frame clears and draws the whole scene,
+    and only the dirty rectangle is given to the render context with
+    AddDirtyRect before the copy to the screen.
+    o Changes of the viewpoint, of the projection or of a light dirty the
+    whole screen. The changes which are not visible from the entities
+    (vertices of a deformed mesh, material colors, animated textures,
+    particles, the window being exposed) must be signaled with Invalidate.
+
+    CKDirtyRectRenderer renderer(dev);
+    // instead of dev->Render() in the main loop
+    renderer.Render();
+    ...
+    // a texture of a 2D entity was changed
+    renderer.Invalidate(frame);
+
+See Also: CKRenderContext::Render,CKRenderContext::AddDirtyRect,VxTransformBox2D
+****************************************************************/
+class CKDirtyRectRenderer
+{
+public:
+    explicit CKDirtyRectRenderer(CKRenderContext *dev)
+        : m_Dev(dev), m_Frame(0), m_Full(TRUE), m_HasDirty(FALSE), m_Rendered(0), m_Skipped(0)
+    {
+        m_Viewpoint.SetIdentity();
+        m_Projection.SetIdentity();
+    }
+
+    // The whole screen is drawn by the next frame.
+    void Invalidate() { m_Full = TRUE; }
+
+    // An entity changed in a way its state does not show.
+    void Invalidate(CKRenderObject *obj)
+    {
+        State *s = obj ? m_States.FindPtr(obj->GetID()) : NULL;
+        if (s)
+            s->m_Forced = TRUE;
+        else
+            m_Full = TRUE;
+    }
+
+    // Adds a screen rectangle to the next frame.
+    void InvalidateRect(const VxRect &rect) { AddDirty(rect); }
+
+    /************************************************
+    Summary: Compares the entities with the last rendered frame.
+
+    Return Value:
+        TRUE if the frame must be rendered, GetDirtyRect gives the region
+        which changed.
+    Remarks:
+        Render calls it, it is only needed to render with other calls than
+        Render.
+    ************************************************/
+    CKBOOL Update()
+    {
+        ++m_Frame;
+        m_Dev->GetViewRect(m_ViewRect);
+        CheckCamera();
+        CKContext *ctx = m_Dev->GetCKContext();
+        const XObjectPointerArray &entities3d = ctx->GetObjectListByType(CKCID_3DENTITY, TRUE);
+        int i;
+        for (i = 0; i < entities3d.Size(); ++i)
+        {
+            CK3dEntity *ent = (CK3dEntity *)entities3d[i];
+            if (ent && !CKIsChildClassOf(ent, CKCID_CAMERA))
+                Check(ent);
+        }
+        const XObjectPointerArray &entities2d = ctx->GetObjectListByType(CKCID_2DENTITY, TRUE);
+        for (i = 0; i < entities2d.Size(); ++i)
+        {
+            if (entities2d[i])
+                Check((CK2dEntity *)entities2d[i]);
+        }
+
+        // the entities deleted since the last frame
+        XArray<CK_ID> removed;
+        for (XHashTable<State, CK_ID>::Iterator it = m_States.Begin(); it != m_States.End(); ++it)
+        {
+            State &s = *it;
+            if (s.m_Frame == m_Frame)
+                continue;
+            if (s.m_OnScreen)
+                AddDirty(s.m_Extents);
+            removed.PushBack(it.GetKey());
+        }
+        for (i = 0; i < removed.Size(); ++i)
+            m_States.Remove(removed[i]);
+
+        if (m_Full)
+        {
+            m_DirtyRect = m_ViewRect;
+            m_HasDirty = TRUE;
+        }
+        else if (m_HasDirty && !m_DirtyRect.Clip(m_ViewRect))
+        {
+            m_HasDirty = FALSE;
+        }
+        return m_HasDirty && !m_DirtyRect.IsEmpty();
+    }
+
+    /************************************************
+    Summary: Renders the frame if something changed.
+
+    Arguments:
+        flags: Render options, see CKRenderContext::Render.
+    Return Value:
+        CK_OK if the frame was rendered or skipped.
+    ************************************************/
+    CKERROR Render(CK_RENDER_FLAGS flags = CK_RENDER_USECURRENTSETTINGS)
+    {
+        if (!Update())
+        {
+            ++m_Skipped;
+            return CK_OK;
+        }
+        CKERROR err = m_Dev->Clear(flags);
+        if (err == CK_OK)
+            err = m_Dev->DrawScene(flags);
+        if (err == CK_OK)
+        {
+            if (!m_Full)
+            {
+                CKRECT rect;
+                rect.left = (int)m_DirtyRect.left;
+                rect.top = (int)m_DirtyRect.top;
+                rect.right = (int)(m_DirtyRect.right + 0.999f);
+                rect.bottom = (int)(m_DirtyRect.bottom + 0.999f);
+                m_Dev->AddDirtyRect(&rect);
+            }
+            err = m_Dev->BackToFront(flags);
+        }
+        ++m_Rendered;
+        EndFrame();
+        return err;
+    }
+
+    // Forgets the dirty region, to call after rendering a frame returned by Update.
+    void EndFrame()
+    {
+        m_Full = FALSE;
+        m_HasDirty = FALSE;
+    }
+
+    // Region which changed, valid after Update.
+    const VxRect &GetDirtyRect() const { return m_DirtyRect; }
+    CKBOOL IsFullFrame() const { return m_Full; }
+
+    int GetRenderedFrameCount() const { return m_Rendered; }
+    int GetSkippedFrameCount() const { return m_Skipped; }
+
+protected:
+    struct State
+    {
+        State() : m_Rect(0.0f, 0.0f, 0.0f, 0.0f), m_Source(0.0f, 0.0f, 0.0f, 0.0f), m_Material(NULL), m_Extents(0.0f, 0.0f, 0.0f, 0.0f),
+                  m_Frame(0), m_Visible(FALSE), m_OnScreen(FALSE), m_Forced(FALSE) { m_World.Clear(); }
+
+        VxMatrix m_World;   // 3D entities
+        VxRect m_Rect;      // 2D entities
+        VxRect m_Source;    // 2D entities
+        CKMaterial *m_Material;
+        VxRect m_Extents;   // on screen when last drawn
+        int m_Frame;        // last frame the entity existed
+        CKBOOL m_Visible;
+        CKBOOL m_OnScreen;
+        CKBOOL m_Forced;
+    };
+
+    void AddDirty(const VxRect &rect)
+    {
+        if (rect.IsEmpty())
+            return;
+        if (m_HasDirty)
+        {
+            m_DirtyRect.Merge(rect);
+        }
+        else
+        {
+            m_DirtyRect = rect;
+            m_HasDirty = TRUE;
+        }
+    }
+
+    // The extents of the entities move with the viewpoint and the projection.
+    void CheckCamera()
+    {
+        m_Dev->PrepareCameras();
+        CK3dEntity *viewpoint = m_Dev->GetViewpoint();
+        const VxMatrix &view = viewpoint ? viewpoint->GetWorldMatrix() : VxMatrix::Identity();
+        const VxMatrix &proj = m_Dev->GetProjectionTransformationMatrix();
+        if (memcmp(&view, &m_Viewpoint, sizeof(VxMatrix)) || memcmp(&proj, &m_Projection, sizeof(VxMatrix)) ||
+            memcmp(&m_ViewRect, &m_LastViewRect, sizeof(VxRect)))
+        {
+            m_Full = TRUE;
+            m_Viewpoint = view;
+            m_Projection = proj;
+            m_LastViewRect = m_ViewRect;
+        }
+    }
+
+    State &GetState(CKObject *obj, CKBOOL &created)
+    {
+        State *s = m_States.FindPtr(obj->GetID());
+        created = (s == NULL);
+        if (!s)
+        {
+            m_States.Insert(obj->GetID(), State());
+            s = m_States.FindPtr(obj->GetID());
+        }
+        s->m_Frame = m_Frame;
+        return *s;
+    }
+
+    void Check(CK3dEntity *ent)
+    {
+        CKBOOL created;
+        State &s = GetState(ent, created);
+        const CKBOOL visible = ent->IsVisible() && !ent->IsHiddenByParent();
+        const VxMatrix &world = ent->GetWorldMatrix();
+        const CKBOOL changed = created || s.m_Forced || visible != s.m_Visible ||
+                               (visible && memcmp(&world, &s.m_World, sizeof(VxMatrix)));
+        if (!changed && !m_Full)
+            return;
+        if (changed && CKIsChildClassOf(ent, CKCID_LIGHT))
+            m_Full = TRUE;
+        if (s.m_OnScreen)
+            AddDirty(s.m_Extents);
+        s.m_World = world;
+        s.m_Visible = visible;
+        s.m_Forced = FALSE;
+        s.m_OnScreen = visible && Project(ent, s.m_Extents);
+        if (s.m_OnScreen)
+            AddDirty(s.m_Extents);
+    }
+
+    void Check(CK2dEntity *ent)
+    {
+        CKBOOL created;
+        State &s = GetState(ent, created);
+        const CKBOOL visible = ent->IsVisible() && !ent->IsHiddenByParent();
+        VxRect rect, source;
+        ent->GetRect(rect);
+        ent->GetSourceRect(source);
+        CKMaterial *mat = ent->GetMaterial();
+        const CKBOOL changed = created || s.m_Forced || visible != s.m_Visible ||
+                               (visible && (memcmp(&rect, &s.m_Rect, sizeof(VxRect)) || memcmp(&source, &s.m_Source, sizeof(VxRect)) || mat != s.m_Material));
+        if (!changed)
+            return;
+        if (s.m_OnScreen)
+            AddDirty(s.m_Extents);
+        s.m_Rect = rect;
+        s.m_Source = source;
+        s.m_Material = mat;
+        s.m_Visible = visible;
+        s.m_Forced = FALSE;
+        s.m_Extents = rect;
+        s.m_OnScreen = visible && !rect.IsEmpty();
+        if (s.m_OnScreen)
+            AddDirty(s.m_Extents);
+    }
+
+    // Screen extents of the bounding box of an entity.
+    CKBOOL Project(CK3dEntity *ent, VxRect &extents)
+    {
+        const VxBbox &box = ent->GetBoundingBox(TRUE);
+        if (box.Min.x > box.Max.x)
+            return FALSE;
+        VxMatrix viewWorld, projViewWorld;
+        Vx3DMultiplyMatrix(viewWorld, m_Dev->GetViewTransformationMatrix(), ent->GetWorldMatrix());
+        Vx3DMultiplyMatrix4(projViewWorld, m_Dev->GetProjectionTransformationMatrix(), viewWorld);
+        VXCLIP_FLAGS orFlags, andFlags;
+        if (!VxTransformBox2D(projViewWorld, box, &m_ViewRect, &extents, orFlags, andFlags))
+            return FALSE;
+        // rasterization rounding
+        extents.left -= 1.0f;
+        extents.top -= 1.0f;
+        extents.right += 1.0f;
+        extents.bottom += 1.0f;
+        return TRUE;
+    }
+
+    CKRenderContext *m_Dev;
+    XHashTable<State, CK_ID> m_States;
+    VxMatrix m_Viewpoint;
+    VxMatrix m_Projection;
+    VxRect m_ViewRect;
+    VxRect m_LastViewRect;
+    VxRect m_DirtyRect;
+    int m_Frame;
+    CKBOOL m_Full;
+    CKBOOL m_HasDirty;
+    int m_Rendered;
+    int m_Skipped;
+
+private:
+    CKDirtyRectRenderer(const CKDirtyRectRenderer &);
+    CKDirtyRectRenderer &operator=(const CKDirtyRectRenderer &);
+};
+
+#endif // CKDIRTYRECTRENDERER_H
@@ -0,0 +1,284 @@
+#ifndef CKDUPLICATEMERGER_H
+#define CKDUPLICATEMERGER_H
+
+#include <string.h>
+
+#include "CKContext.h"
+#include "CKGlobals.h"
+#include "CKStateChunk.h"
+#include "CK3dEntity.h"
+#include "CK2dEntity.h"
+#include "CKSprite3D.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "XArray.h"
+
+/****************************************************************
+Summary: Finds textures, materials and meshes with identical saved data and makes their users share one of them.
+
+Remarks:
+    o A composition built by merging or copying parts often contains the
+    same texture, material or mesh several times, and CKFile saves each
+    copy. Merge saves the state of each object (CKSaveObjectState), hashes
+    the chunk data (an FNV-1a hash along with CKStateChunk::ComputeCRC,
+    64 bits in all), sorts the objects by hash and compares the chunks of
+    the objects with the same hash byte per byte. The users of a duplicate
+    are then given the first object with the same data: materials for
+    textures, meshes, 2D entities and 3D sprites for materials, 3D
+    entities for meshes.
+    o Textures are merged first, then materials, then meshes: the chunk of
+    a material refers to its textures, two materials which only differed by
+    duplicated textures become identical once their textures are merged.
+    o The names are not part of the saved state: objects with different
+    names can be merged. Dynamic objects are left out.
+    o Only the references above are changed. Parameters, arrays and
+    behaviors referring to a duplicate still use it: when such references
+    exist, keep the duplicates (Merge(FALSE)) and check GetDuplicates
+    before destroying them.
+    o The file format is unchanged: the merged composition is saved and
+    loaded by any version, and the shared objects are loaded once.
+
+    CKDuplicateMerger merger(context);
+    if (merger.Merge(TRUE))
+        context->OutputToConsoleEx("%d duplicates merged", merger.GetDuplicates().Size());
+    context->Save(fileName, objects, 0xFFFFFFFF);
+
+See Also: CKSaveObjectState,CKStateChunk::ComputeCRC,CKMesh::ReplaceMaterial
+****************************************************************/
+class CKDuplicateMerger
+{
+public:
+    CKDuplicateMerger(CKContext *context) : m_Context(context), m_SavedSize(0) {}
+
+    /*************************************************
+    Summary: Merges the duplicated textures, materials and meshes.
+
+    Arguments:
+        destroyDuplicates: TRUE to destroy the duplicates once their users were changed.
+    Return Value:
+        Number of duplicates found.
+    *************************************************/
+    int Merge(CKBOOL destroyDuplicates = FALSE)
+    {
+        m_Duplicates.Resize(0);
+        m_Originals.Resize(0);
+        m_SavedSize = 0;
+        MergeClass(CKCID_TEXTURE);
+        MergeClass(CKCID_MATERIAL);
+        MergeClass(CKCID_MESH);
+        if (destroyDuplicates)
+        {
+            for (int i = 0; i < m_Duplicates.Size(); ++i)
+                m_Context->DestroyObject(m_Duplicates[i]);
+        }
+        return m_Duplicates.Size();
+    }
+
+    // Duplicates found by the last Merge (destroyed if it was asked).
+    const XArray<CK_ID> &GetDuplicates() const { return m_Duplicates; }
+
+    // Object kept instead of each duplicate.
+    const XArray<CK_ID> &GetOriginals() const { return m_Originals; }
+
+    // Bytes of chunk data of the duplicates, not saved any more once they are destroyed.
+    int GetSavedSize() const { return m_SavedSize; }
+
+protected:
+    struct Entry
+    {
+        CKDWORD m_Hash;
+        CKDWORD m_CRC;
+        int m_Size; // in double words
+        CK_ID m_Object;
+    };
+
+    static int CompareEntries(const void *elem1, const void *elem2)
+    {
+        const Entry *a = (const Entry *)elem1;
+        const Entry *b = (const Entry *)elem2;
+        if (a->m_Hash != b->m_Hash)
+            return a->m_Hash < b->m_Hash ? -1 : 1;
+        if (a->m_CRC != b->m_CRC)
+            return a->m_CRC < b->m_CRC ? -1 : 1;
+        if (a->m_Size != b->m_Size)
+            return a->m_Size - b->m_Size;
+        return (int)a->m_Object - (int)b->m_Object; // the oldest object is kept
+    }
+
+    static CKDWORD Hash(CKStateChunk *chunk)
+    {
+        CKDWORD h = 2166136261u;
+        h = (h ^ (CKDWORD)chunk->m_ChunkClassID) * 16777619;
+        h = (h ^ (CKDWORD)chunk->GetDataVersion()) * 16777619;
+        const CKBYTE *data = (const CKBYTE *)chunk->m_Data;
+        const int size = chunk->m_ChunkSize * (int)sizeof(int);
+        for (int i = 0; i < size; ++i)
+            h = (h ^ data[i]) * 16777619;
+        return h;
+    }
+
+    static CKBOOL SameData(CKObject *a, CKObject *b)
+    {
+        CKStateChunk *ca = CKSaveObjectState(a);
+        CKStateChunk *cb = CKSaveObjectState(b);
+        CKBOOL same = ca && cb && ca->m_ChunkClassID == cb->m_ChunkClassID &&
+                      ca->GetDataVersion() == cb->GetDataVersion() &&
+                      ca->m_ChunkSize == cb->m_ChunkSize &&
+                      !memcmp(ca->m_Data, cb->m_Data, ca->m_ChunkSize * sizeof(int));
+        if (ca)
+            DeleteCKStateChunk(ca);
+        if (cb)
+            DeleteCKStateChunk(cb);
+        return same;
+    }
+
+    void MergeClass(CK_CLASSID cid)
+    {
+        XArray<Entry> entries;
+        const int count = m_Context->GetObjectsCountByClassID(cid);
+        CK_ID *ids = m_Context->GetObjectsListByClassID(cid);
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            CKObject *obj = m_Context->GetObject(ids[i]);
+            if (!obj || obj->IsDynamic())
+                continue;
+            CKStateChunk *chunk = CKSaveObjectState(obj);
+            if (!chunk)
+                continue;
+            Entry e;
+            e.m_Hash = Hash(chunk);
+            e.m_CRC = chunk->ComputeCRC(0);
+            e.m_Size = chunk->m_ChunkSize;
+            e.m_Object = ids[i];
+            entries.PushBack(e);
+            DeleteCKStateChunk(chunk);
+        }
+        entries.Sort(CompareEntries);
+
+        for (i = 0; i < entries.Size();)
+        {
+            int end = i + 1;
+            while (end < entries.Size() && entries[end].m_Hash == entries[i].m_Hash &&
+                   entries[end].m_CRC == entries[i].m_CRC && entries[end].m_Size == entries[i].m_Size)
+                ++end;
+            CKObject *original = m_Context->GetObject(entries[i].m_Object);
+            for (int j = i + 1; j < end; ++j)
+            {
+                CKObject *duplicate = m_Context->GetObject(entries[j].m_Object);
+                if (!SameData(original, duplicate))
+                    continue; // hash collision
+                Replace(cid, duplicate, original);
+                m_Duplicates.PushBack(duplicate->GetID());
+                m_Originals.PushBack(original->GetID());
+                m_SavedSize += entries[j].m_Size * (int)sizeof(int);
+            }
+            i = end;
+        }
+    }
+
+    // Objects of a class and of its derived classes.
+    void GetObjects(CK_CLASSID cid, XArray<CKObject *> &objects)
+    {
+        objects.Resize(0);
+        const int classCount = CKGetClassCount();
+        for (CK_CLASSID c = 0; c < classCount; ++c)
+        {
+            if (!CKIsChildClassOf(c, cid))
+                continue;
+            const int count = m_Context->GetObjectsCountByClassID(c);
+            CK_ID *ids = m_Context->GetObjectsListByClassID(c);
+            for (int i = 0; i < count; ++i)
+            {
+                CKObject *obj = m_Context->GetObject(ids[i]);
+                if (obj)
+                    objects.PushBack(obj);
+            }
+        }
+    }
+
+    // Gives the users of a duplicate the original object.
+    void Replace(CK_CLASSID cid, CKObject *duplicate, CKObject *original)
+    {
+        XArray<CKObject *> users;
+        int i;
+        if (cid == CKCID_TEXTURE)
+        {
+            GetObjects(CKCID_MATERIAL, users);
+            for (i = 0; i < users.Size(); ++i)
+            {
+                CKMaterial *mat = (CKMaterial *)users[i];
+                for (int t = 0; t < 4; ++t)
+                {
+                    if (mat->GetTexture(t) == duplicate)
+                        mat->SetTexture(t, (CKTexture *)original);
+                }
+            }
+        }
+        else if (cid == CKCID_MATERIAL)
+        {
+            CKMaterial *dup = (CKMaterial *)duplicate;
+            CKMaterial *mat = (CKMaterial *)original;
+            GetObjects(CKCID_MESH, users);
+            for (i = 0; i < users.Size(); ++i)
+            {
+                CKMesh *mesh = (CKMesh *)users[i];
+                mesh->ReplaceMaterial(dup, mat);
+                for (int c = 0; c < mesh->GetChannelCount(); ++c)
+                {
+                    if (mesh->GetChannelMaterial(c) == dup)
+                        mesh->SetChannelMaterial(c, mat);
+                }
+            }
+            GetObjects(CKCID_2DENTITY, users);
+            for (i = 0; i < users.Size(); ++i)
+            {
+                CK2dEntity *ent = (CK2dEntity *)users[i];
+                if (ent->GetMaterial() == dup)
+                    ent->SetMaterial(mat);
+            }
+            GetObjects(CKCID_SPRITE3D, users);
+            for (i = 0; i < users.Size(); ++i)
+            {
+                CKSprite3D *sprite = (CKSprite3D *)users[i];
+                if (sprite->GetMaterial() == dup)
+                    sprite->SetMaterial(mat);
+            }
+        }
+        else if (cid == CKCID_MESH)
+        {
+            CKMesh *dup = (CKMesh *)duplicate;
+            CKMesh *mesh = (CKMesh *)original;
+            GetObjects(CKCID_3DENTITY, users);
+            for (i = 0; i < users.Size(); ++i)
+            {
+                CK3dEntity *ent = (CK3dEntity *)users[i];
+                int m;
+                for (m = 0; m < ent->GetMeshCount(); ++m)
+                {
+                    if (ent->GetMesh(m) == dup)
+                        break;
+                }
+                if (m == ent->GetMeshCount())
+                    continue;
+                const CKBOOL current = ent->GetCurrentMesh() == dup;
+                ent->AddMesh(mesh);
+                ent->RemoveMesh(dup);
+                if (current)
+                    ent->SetCurrentMesh(mesh);
+            }
+        }
+    }
+
+    CKContext *m_Context;
+    XArray<CK_ID> m_Duplicates;
+    XArray<CK_ID> m_Originals; // kept instead of m_Duplicates[i]
+    int m_SavedSize;
+
+private:
+    CKDuplicateMerger(const CKDuplicateMerger &);
+    CKDuplicateMerger &operator=(const CKDuplicateMerger &);
+};
+
+#endif // CKDUPLICATEMERGER_H
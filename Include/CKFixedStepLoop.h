@@ -0,0 +1,292 @@
+#ifndef CKFIXEDSTEPLOOP_H
+#define CKFIXEDSTEPLOOP_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKTimeManager.h"
+#include "CK3dEntity.h"
+#include "VxTimeProfiler.h"
+#include "VxFastMath.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+#define FIXED_STEP_LOOP_GUID CKGUID(0x35a9e0c4, 0x6f21d7b3)
+
+/****************************************************************
+Summary: Process loop running the behaviors at a fixed time step and rendering interpolated positions.
+
+Remarks:
+    o Frame accumulates the real time elapsed and calls CKContext::Process
+    once per whole step, so the behaviors and the physics always see the
+    same delta time (the step, multiplied by the time scale factor of the
+    time manager, set by the PreProcess of the loop right after the one of
+    the time manager). At most SetMaxSteps steps run per frame: time the
+    simulation cannot catch up with is dropped rather than making the next
+    frame longer.
+    o The tracked entities have their world matrix of the last two steps
+    kept (decomposed in position, rotation and scale). Before rendering,
+    Frame sets them to the interpolation between the two at the fraction of
+    step left in the accumulator, and puts the simulated matrices back
+    after, so rendering shows a motion as smooth as the refresh rate
+    whatever the step.
+    o Rendering is one step behind the simulation (the interpolation goes
+    from the previous step to the last one). An entity moved in one go
+    (a teleport, a reset) should be given to Teleport so that it is not
+    shown sliding for one step.
+    o The children of a tracked entity follow it: only the roots of rigid
+    hierarchies need to be tracked, children moving by themselves must be
+    tracked after their parent.
+    o CK_3DENTITY_UPDATELASTFRAME and GetLastFrameMatrix save the matrix of
+    the last rendering rather than of the last step, so they cannot be used
+    for this when several steps (or none) run between two renderings.
+
+    CKFixedStepLoop *loop = CKFixedStepLoop::Get(context);
+    loop->SetStep(1000.0f / 30.0f);
+    loop->Track(car);
+    while (running)
+        loop->Frame(renderContext);
+
+See Also: CKTimeManager,CKFramePacer
+****************************************************************/
+class CKFixedStepLoop : public CKBaseManager
+{
+public:
+    // The loop of the context, created on the first call.
+    static CKFixedStepLoop *Get(CKContext *context)
+    {
+        CKFixedStepLoop *loop = (CKFixedStepLoop *)context->GetManagerByGuid(FIXED_STEP_LOOP_GUID);
+        if (!loop)
+            loop = new CKFixedStepLoop(context);
+        return loop;
+    }
+
+    ~CKFixedStepLoop() {}
+
+    // Step in milliseconds of real time.
+    void SetStep(float ms) { m_Step = XMax(ms, 0.1f); }
+    float GetStep() const { return m_Step; }
+
+    void SetMaxSteps(int count) { m_MaxSteps = XMax(count, 1); }
+    int GetMaxSteps() const { return m_MaxSteps; }
+
+    // Fraction of step the last rendering was interpolated at.
+    float GetAlpha() const { return m_Alpha; }
+
+    //---------------------------------------------
+    // Tracked entities
+
+    void Track(CK3dEntity *ent)
+    {
+        if (!ent || m_Index.FindPtr(ent->GetID()))
+            return;
+        State s;
+        s.m_Entity = ent->GetID();
+        Capture(ent, s);
+        s.m_Previous = s.m_Current;
+        m_Index.Insert(s.m_Entity, m_States.Size());
+        m_States.PushBack(s);
+    }
+
+    void Untrack(CK3dEntity *ent)
+    {
+        int *index = ent ? m_Index.FindPtr(ent->GetID()) : NULL;
+        if (!index)
+            return;
+        m_States.RemoveAt(*index);
+        Reindex();
+    }
+
+    void ClearTracked()
+    {
+        m_States.Resize(0);
+        m_Index.Clear();
+    }
+
+    // Shows the entity at its current position without interpolating from the previous step.
+    void Teleport(CK3dEntity *ent)
+    {
+        int *index = ent ? m_Index.FindPtr(ent->GetID()) : NULL;
+        if (!index)
+            return;
+        State &s = m_States[*index];
+        Capture(ent, s);
+        s.m_Previous = s.m_Current;
+    }
+
+    //---------------------------------------------
+    // Loop
+
+    /*************************************************
+    Summary: Runs the steps due and renders.
+
+    Arguments:
+        dev: Render context, NULL to only run the steps.
+    Return Value:
+        Number of steps run.
+    *************************************************/
+    int Frame(CKRenderContext *dev)
+    {
+        float elapsed = m_Chrono.Current();
+        m_Chrono.Reset();
+        if (m_Context->IsPlaying())
+            m_Accumulator += XMin(elapsed, m_Step * m_MaxSteps);
+
+        int steps = 0;
+        while (m_Accumulator >= m_Step && steps < m_MaxSteps)
+        {
+            Step();
+            m_Accumulator -= m_Step;
+            ++steps;
+        }
+        if (m_Accumulator >= m_Step)
+            m_Accumulator = 0.0f; // too late, drop the time not simulated
+
+        m_Alpha = m_Accumulator / m_Step;
+        if (dev)
+        {
+            Interpolate(m_Alpha);
+            dev->Render();
+            Restore();
+        }
+        return steps;
+    }
+
+    // Runs one step, Frame calls it.
+    void Step()
+    {
+        m_InStep = TRUE;
+        m_Context->Process();
+        m_InStep = FALSE;
+        for (int i = 0; i < m_States.Size(); ++i)
+        {
+            State &s = m_States[i];
+            CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(s.m_Entity);
+            s.m_Previous = s.m_Current;
+            if (ent)
+                Capture(ent, s);
+        }
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PreProcess()
+    {
+        if (m_InStep)
+        {
+            CKTimeManager *tm = m_Context->GetTimeManager();
+            tm->SetLastDeltaTime(m_Step * tm->GetTimeScaleFactor());
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR SequenceDeleted(CK_ID *objids, int count)
+    {
+        // drop the entities which do not exist anymore
+        int kept = 0;
+        for (int i = 0; i < m_States.Size(); ++i)
+            if (m_Context->GetObject(m_States[i].m_Entity))
+                m_States[kept++] = m_States[i];
+        if (kept != m_States.Size())
+        {
+            m_States.Resize(kept);
+            Reindex();
+        }
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_PreProcess |
+               CKMANAGER_FUNC_OnSequenceDeleted;
+    }
+
+    virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function)
+    {
+        // right after the time manager
+        return MAX_MANAGERFUNC_PRIORITY - 1;
+    }
+
+protected:
+    struct Transform
+    {
+        VxQuaternion m_Rot;
+        VxVector m_Pos;
+        VxVector m_Scale;
+    };
+
+    struct State
+    {
+        CK_ID m_Entity;
+        VxMatrix m_Matrix; // world matrix of the last step
+        Transform m_Current;
+        Transform m_Previous;
+    };
+
+    CKFixedStepLoop(CKContext *context) : CKBaseManager(context, FIXED_STEP_LOOP_GUID, "Fixed Step Loop"),
+                                          m_Step(1000.0f / 60.0f), m_MaxSteps(4), m_Accumulator(0.0f), m_Alpha(0.0f), m_InStep(FALSE)
+    {
+        context->RegisterNewManager(this);
+    }
+
+    static void Capture(CK3dEntity *ent, State &s)
+    {
+        s.m_Matrix = ent->GetWorldMatrix();
+        Vx3DDecomposeMatrix(s.m_Matrix, s.m_Current.m_Rot, s.m_Current.m_Pos, s.m_Current.m_Scale);
+    }
+
+    void Interpolate(float alpha)
+    {
+        for (int i = 0; i < m_States.Size(); ++i)
+        {
+            const State &s = m_States[i];
+            CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(s.m_Entity);
+            if (!ent)
+                continue;
+            const Transform &a = s.m_Previous;
+            const Transform &b = s.m_Current;
+            VxMatrix mat;
+            VxFastSlerp(alpha, a.m_Rot, b.m_Rot).ToMatrix(mat);
+            const VxVector scale = a.m_Scale + (b.m_Scale - a.m_Scale) * alpha;
+            const VxVector pos = a.m_Pos + (b.m_Pos - a.m_Pos) * alpha;
+            mat[0] *= scale.x;
+            mat[1] *= scale.y;
+            mat[2] *= scale.z;
+            mat[3][0] = pos.x;
+            mat[3][1] = pos.y;
+            mat[3][2] = pos.z;
+            mat[3][3] = 1.0f;
+            ent->SetWorldMatrix(mat);
+        }
+    }
+
+    // Puts the matrices of the last step back.
+    void Restore()
+    {
+        for (int i = 0; i < m_States.Size(); ++i)
+        {
+            CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(m_States[i].m_Entity);
+            if (ent)
+                ent->SetWorldMatrix(m_States[i].m_Matrix);
+        }
+    }
+
+    void Reindex()
+    {
+        m_Index.Clear();
+        for (int i = 0; i < m_States.Size(); ++i)
+            m_Index.Insert(m_States[i].m_Entity, i);
+    }
+
+    float m_Step;
+    int m_MaxSteps;
+    float m_Accumulator;
+    float m_Alpha;
+    CKBOOL m_InStep;
+    VxTimeProfiler m_Chrono;
+    XClassArray<State> m_States;
+    XHashTable<int, CK_ID> m_Index;
+};
+
+#endif // CKFIXEDSTEPLOOP_H
@@ -0,0 +1,181 @@
+#ifndef CKFLATSCENEHIERARCHY_H
+#define CKFLATSCENEHIERARCHY_H
+
+#include "CKContext.h"
+#include "CKObjectManager.h"
+#include "CK3dEntity.h"
+#include "VxFlatHierarchy.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Flattened copy of the 3D entity hierarchy of a context.
+
+Remarks:
+    o The entities are kept in a VxFlatHierarchy (parent index, local and
+    world matrices, boxes in depth first order), so a whole scene pass
+    over the transformations or the boxes reads contiguous memory instead
+    of following the children arrays of the entities as HierarchyParser
+    does.
+    o Synchronize follows the changes of parents (the subtree moved gets
+    new indexes) and compares the local matrices and the local boxes of
+    the entities with the ones it has: only the entities which moved or
+    whose mesh changed have their world matrices and boxes computed
+    again, and the hierarchical boxes are refitted along the paths to the
+    root (see VxFlatHierarchy::Refit). The cached boxes can then be read
+    by culling, picking or collision code at no cost; the hierarchical
+    boxes are the same as CK3dEntity::GetHierarchicalBox.
+    o The entities created after Build are not in the hierarchy until the
+    next Build; a deleted entity or a parent which is not in the hierarchy
+    makes Synchronize build it again from all the root entities.
+
+    CKFlatSceneHierarchy scene(context);
+    scene.Build();
+    ...
+    // each frame
+    scene.Synchronize();
+    for (int i = 0; i < scene.GetCount(); ++i)
+        ... scene.GetHierarchy().GetHierarchicalBox(i) ...
+
+See Also: VxFlatHierarchy,CK3dEntity::GetHierarchicalBox
+****************************************************************/
+class CKFlatSceneHierarchy
+{
+public:
+    explicit CKFlatSceneHierarchy(CKContext *context) : m_Context(context) {}
+
+    // Builds the hierarchy from all the root entities of the context.
+    int Build()
+    {
+        XObjectPointerArray roots;
+        m_Context->m_ObjectManager->GetRootEntities(roots);
+        return Build(roots);
+    }
+
+    // Builds the hierarchy from a list of root entities and their descendants.
+    int Build(const XObjectPointerArray &roots)
+    {
+        m_Entities.Resize(0);
+        m_Handles.Clear();
+        m_Parents.Resize(0);
+        for (int i = 0; i < roots.Size(); ++i)
+        {
+            CK3dEntity *ent = CK3dEntity::Cast(roots[i]);
+            if (ent)
+                AddTree(ent, -1);
+        }
+        m_Locals.Resize(m_Entities.Size());
+        for (int h = 0; h < m_Entities.Size(); ++h)
+            m_Locals[h] = ((CK3dEntity *)m_Context->GetObject(m_Entities[h]))->GetLocalMatrix();
+        m_Hierarchy.Build(m_Parents.Begin(), m_Locals.Begin(), m_Parents.Size());
+        return m_Entities.Size();
+    }
+
+    int GetCount() const { return m_Hierarchy.GetCount(); }
+
+    // Current index of an entity, -1 if it is not in the hierarchy.
+    int GetIndex(CK3dEntity *ent) const
+    {
+        int *h = ent ? m_Handles.FindPtr(ent->GetID()) : NULL;
+        return h ? m_Hierarchy.GetIndex(*h) : -1;
+    }
+
+    CK3dEntity *GetEntity(int index) const { return (CK3dEntity *)m_Context->GetObject(m_Entities[m_Hierarchy.GetHandle(index)]); }
+
+    // Same as CK3dEntity::GetBoundingBox, as of the last Synchronize.
+    const VxBbox &GetWorldBox(CK3dEntity *ent) const
+    {
+        const int i = GetIndex(ent);
+        return (i >= 0) ? m_Hierarchy.GetWorldBox(i) : ent->GetBoundingBox();
+    }
+
+    // Same as CK3dEntity::GetHierarchicalBox, as of the last Synchronize.
+    const VxBbox &GetHierarchicalBox(CK3dEntity *ent) const
+    {
+        const int i = GetIndex(ent);
+        return (i >= 0) ? m_Hierarchy.GetHierarchicalBox(i) : ent->GetHierarchicalBox();
+    }
+
+    // Reads the changes of the entities and refits the world matrices and boxes.
+    void Synchronize()
+    {
+        if (!UpdateParents())
+            Build();
+        const int count = m_Hierarchy.GetCount();
+        for (int i = 0; i < count; ++i)
+        {
+            CK3dEntity *ent = GetEntity(i);
+            const VxMatrix &local = ent->GetLocalMatrix();
+            if (memcmp(&local, &m_Hierarchy.GetLocalMatrix(i), sizeof(VxMatrix)))
+                m_Hierarchy.SetLocalMatrix(i, local);
+            VxBbox box;
+            if (ent->GetCurrentMesh())
+                box = ent->GetBoundingBox(TRUE);
+            const VxBbox &old = m_Hierarchy.GetLocalBox(i);
+            if (!(box.Min == old.Min) || !(box.Max == old.Max))
+                m_Hierarchy.SetLocalBox(i, box);
+        }
+        m_Hierarchy.Refit();
+    }
+
+    VxFlatHierarchy &GetHierarchy() { return m_Hierarchy; }
+
+protected:
+    void AddTree(CK3dEntity *ent, int parent)
+    {
+        if (m_Handles.FindPtr(ent->GetID()))
+            return;
+        const int h = m_Entities.Size();
+        m_Entities.PushBack(ent->GetID());
+        m_Parents.PushBack(parent);
+        m_Handles.Insert(ent->GetID(), h);
+        for (int c = 0; c < ent->GetChildrenCount(); ++c)
+        {
+            CK3dEntity *child = ent->GetChild(c);
+            if (child)
+                AddTree(child, h);
+        }
+    }
+
+    // Follows the changes of parents, FALSE if the hierarchy must be built again.
+    CKBOOL UpdateParents()
+    {
+        CKBOOL changed = FALSE;
+        for (int h = 0; h < m_Entities.Size(); ++h)
+        {
+            CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(m_Entities[h]);
+            if (!ent || ent->IsToBeDeleted())
+                return FALSE;
+            CK3dEntity *parent = ent->GetParent();
+            int p = -1;
+            if (parent)
+            {
+                int *ph = m_Handles.FindPtr(parent->GetID());
+                if (!ph)
+                    return FALSE;
+                p = *ph;
+            }
+            if (p != m_Parents[h])
+            {
+                m_Parents[h] = p;
+                changed = TRUE;
+            }
+        }
+        // all at once, the intermediate hierarchies could have cycles
+        if (changed)
+            m_Hierarchy.SetParents(m_Parents.Begin());
+        return TRUE;
+    }
+
+    CKContext *m_Context;
+    VxFlatHierarchy m_Hierarchy;
+    XArray<CK_ID> m_Entities;        // entity of each handle
+    XArray<int> m_Parents;           // parent handle of each handle
+    XArray<VxMatrix> m_Locals;
+    XHashTable<int, CK_ID> m_Handles; // handle of each entity
+
+private:
+    CKFlatSceneHierarchy(const CKFlatSceneHierarchy &);
+    CKFlatSceneHierarchy &operator=(const CKFlatSceneHierarchy &);
+};
+
+#endif // CKFLATSCENEHIERARCHY_H
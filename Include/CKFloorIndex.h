@@ -0,0 +1,491 @@
+#ifndef CKFLOORINDEX_H
+#define CKFLOORINDEX_H
+
+#include "CKContext.h"
+#include "CKFloorManager.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "VxTriangleGrid.h"
+#include "VxParallel.h"
+
+/****************************************************************
+Summary: Spatial index of the floors answering the floor queries of many characters.
+
+Remarks:
+    o The floor manager looks for the floors under a point by testing the
+    floor objects and their faces, with a small cache of the last results.
+    The index puts the faces of the floors (or the top of their box for
+    the CKFLOOR_BOX floors) in uniform grids of the XZ plane
+    (VxTriangleGrid), in world coordinates, so a query only tests the
+    faces of one cell.
+    o The static floors share one grid. Each moving floor has its own grid,
+    which Update rebuilds when its world matrix changed.
+    o Build reads the floors registered in the floor manager, with their
+    geometry, moving and hierarchy settings, and its limit angle. It is
+    called when the scene is activated, and again after floors are added
+    or removed. The floors can also be added directly with AddFloor.
+    o GetNearestFloors, GetNearestFloor and ConstrainToFloor answer the
+    queries of the floor manager methods of the same name, with the same
+    distance conventions (negative for the floors below the point).
+    o The batch versions of GetNearestFloors and ConstrainToFloor process
+    the positions of a whole crowd in one call, optionally on the threads
+    of a VxParallelPool: the queries only read the index.
+
+    CKFloorIndex floors(ctx);
+    floors.Build();
+    ...
+    // each frame
+    floors.Update();
+    for (i = 0; i < characters.Size(); ++i)
+        floors.GetNearestFloor(positions[i], &floor, NULL, NULL, &distance);
+
+See Also: CKFloorManager,VxTriangleGrid
+****************************************************************/
+class CKFloorIndex
+{
+public:
+    CKFloorIndex(CKContext *ctx, float cellSize = 0.0f)
+        : m_Context(ctx), m_CellSize(cellSize), m_MinNormalY(0.0f), m_StaticDirty(FALSE), m_ExcludedAttribute(-1) {}
+
+    ~CKFloorIndex() { Clear(); }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Floors.Size(); ++i)
+            delete m_Floors[i].m_Grid;
+        m_Floors.Resize(0);
+        m_Static.Clear();
+        m_StaticDirty = FALSE;
+        m_ExcludedAttribute = -1;
+    }
+
+    /************************************************
+    Summary: Indexes the floors of the floor manager.
+
+    Return Value:
+        Number of floor entities indexed.
+    ************************************************/
+    int Build()
+    {
+        Clear();
+        CKFloorManager *fm = (CKFloorManager *)m_Context->GetManagerByGuid(FLOOR_MANAGER_GUID);
+        if (!fm)
+            return 0;
+        SetLimitAngle(fm->GetLimitAngle());
+        for (int i = 0; i < fm->GetFloorObjectCount(); ++i)
+        {
+            CK3dEntity *ent = fm->GetFloorObject(i);
+            if (!ent)
+                continue;
+            CKDWORD geo = CKFLOOR_FACES;
+            CKBOOL moving = FALSE, hiera = FALSE;
+            fm->ReadAttributeValues(ent, &geo, &moving, NULL, &hiera, NULL);
+            AddFloor(ent, (CK_FLOORGEOMETRY)geo, moving, hiera);
+        }
+        Update();
+        return m_Floors.Size();
+    }
+
+    /************************************************
+    Summary: Adds a floor to the index.
+
+    Arguments:
+        ent: Floor entity.
+        geo: CKFLOOR_FACES to use the faces of its mesh, CKFLOOR_BOX to use the top of its bounding box.
+        moving: TRUE if the entity moves, its grid then follows it.
+        hiera: TRUE to add its children too.
+    Remarks:
+        The static grid is rebuilt by the next Update.
+    ************************************************/
+    void AddFloor(CK3dEntity *ent, CK_FLOORGEOMETRY geo = CKFLOOR_FACES, CKBOOL moving = FALSE, CKBOOL hiera = FALSE)
+    {
+        if (!ent || FindFloor(ent) >= 0)
+            return;
+        Floor f;
+        f.m_Entity = ent->GetID();
+        f.m_Geometry = geo;
+        f.m_Grid = moving ? new VxTriangleGrid : NULL;
+        f.m_World.Clear();
+        m_Floors.PushBack(f);
+        if (!moving)
+            m_StaticDirty = TRUE;
+        if (hiera)
+        {
+            for (int i = 0; i < ent->GetChildrenCount(); ++i)
+                AddFloor(ent->GetChild(i), geo, moving, TRUE);
+        }
+    }
+
+    void RemoveFloor(CK3dEntity *ent)
+    {
+        const int i = FindFloor(ent);
+        if (i < 0)
+            return;
+        delete m_Floors[i].m_Grid;
+        m_Floors.RemoveAt(i);
+        // the owners of the triangles are floor indices: all the grids are rebuilt
+        for (int k = 0; k < m_Floors.Size(); ++k)
+            m_Floors[k].m_World.Clear();
+        m_StaticDirty = TRUE;
+    }
+
+    int GetFloorCount() const { return m_Floors.Size(); }
+
+    // Faces steeper than the angle (in radians) are not floors.
+    void SetLimitAngle(float angle) { m_MinNormalY = cosf(angle); }
+
+    // Rebuilds the grids of the moving floors which moved, and the static grid after a change.
+    void Update()
+    {
+        m_ExcludedAttribute = -1;
+        if (m_StaticDirty)
+        {
+            m_Static.Clear();
+            for (int i = 0; i < m_Floors.Size(); ++i)
+            {
+                CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(m_Floors[i].m_Entity);
+                if (!m_Floors[i].m_Grid && ent)
+                    AddTriangles(m_Static, ent, m_Floors[i].m_Geometry, i);
+            }
+            m_Static.Build(m_CellSize);
+            m_StaticDirty = FALSE;
+        }
+        for (int i = 0; i < m_Floors.Size(); ++i)
+        {
+            Floor &f = m_Floors[i];
+            CK3dEntity *ent = f.m_Grid ? (CK3dEntity *)m_Context->GetObject(f.m_Entity) : NULL;
+            if (!ent || !memcmp(&ent->GetWorldMatrix(), &f.m_World, sizeof(VxMatrix)))
+                continue;
+            f.m_World = ent->GetWorldMatrix();
+            f.m_Grid->Clear();
+            AddTriangles(*f.m_Grid, ent, f.m_Geometry, i);
+            f.m_Grid->Build(m_CellSize);
+        }
+    }
+
+    /************************************************
+    Summary: Finds the nearest floors below and above a point.
+
+    See Also: CKFloorManager::GetNearestFloors
+    ************************************************/
+    CK_FLOORNEAREST GetNearestFloors(const VxVector &position, CKFloorPoint *fp, CK3dEntity *excludeFloor = NULL, CKAttributeType excludeAttribute = -1) const
+    {
+        VxTriangleGrid::Hit down, up;
+        const int found = Find(position, down, up, excludeFloor, excludeAttribute);
+        fp->Clear();
+        if (found & VxTriangleGrid::FOUND_DOWN)
+        {
+            fp->m_DownFloor = m_Floors[down.m_Owner].m_Entity;
+            fp->m_DownFaceIndex = down.m_Face;
+            fp->m_DownNormal = down.m_Normal;
+            fp->m_DownDistance = down.m_Distance;
+        }
+        if (found & VxTriangleGrid::FOUND_UP)
+        {
+            fp->m_UpFloor = m_Floors[up.m_Owner].m_Entity;
+            fp->m_UpFaceIndex = up.m_Face;
+            fp->m_UpNormal = up.m_Normal;
+            fp->m_UpDistance = up.m_Distance;
+        }
+        return Nearest(found, down, up);
+    }
+
+    /************************************************
+    Summary: Finds the floors of many points.
+
+    Arguments:
+        positions: Points to test.
+        count: Number of points.
+        results: Receives the floors of each point.
+        pool: Worker threads to use, NULL to do all the work in the calling thread.
+        excludeAttribute: Floors with this attribute are ignored.
+    Return Value:
+        Number of points having a floor below or above them.
+    ************************************************/
+    int GetNearestFloors(const VxVector *positions, int count, CKFloorPoint *results, VxParallelPool *pool = NULL, CKAttributeType excludeAttribute = -1) const
+    {
+        BatchJob job;
+        job.m_Index = this;
+        job.m_Old = NULL;
+        job.m_Positions = positions;
+        job.m_Points = results;
+        job.m_Results = NULL;
+        job.m_Radius = 0.0f;
+        job.m_Attribute = excludeAttribute;
+        job.m_Count = 0;
+        Run(pool, count, NearestRange, job);
+        return (int)job.m_Count;
+    }
+
+    // Gives the nearest floor, above or below the point.
+    CK_FLOORNEAREST GetNearestFloor(const VxVector &position, CK3dEntity **floor, int *faceIndex = NULL, VxVector *normal = NULL, float *distance = NULL, CK3dEntity *excludeFloor = NULL) const
+    {
+        VxTriangleGrid::Hit down, up;
+        const int found = Find(position, down, up, excludeFloor, -1);
+        const CK_FLOORNEAREST nearest = Nearest(found, down, up);
+        if (floor)
+            *floor = NULL;
+        if (nearest == CKFLOOR_NOFLOOR)
+            return nearest;
+        const VxTriangleGrid::Hit &hit = (nearest == CKFLOOR_DOWN) ? down : up;
+        if (floor)
+            *floor = (CK3dEntity *)m_Context->GetObject(m_Floors[hit.m_Owner].m_Entity);
+        if (faceIndex)
+            *faceIndex = hit.m_Face;
+        if (normal)
+            *normal = hit.m_Normal;
+        if (distance)
+            *distance = hit.m_Distance;
+        return nearest;
+    }
+
+    /************************************************
+    Summary: Keeps a moving point over the floors.
+
+    Arguments:
+        oldPosition: Position before the move, over a floor.
+        position: Position after the move.
+        radius: Radius of the object, the floor must be under the points at this distance on X and Z.
+        result: Receives the constrained position.
+        excludeAttribute: Floors with this attribute are ignored.
+    Return Value:
+        TRUE if the position was constrained.
+    Remarks:
+        The constrained position is the last point of the move over the floors, found by bisection.
+    See Also: CKFloorManager::ConstrainToFloor
+    ************************************************/
+    CKBOOL ConstrainToFloor(const VxVector &oldPosition, const VxVector &position, float radius, VxVector *result, CKAttributeType excludeAttribute = -1) const
+    {
+        if (IsOverFloor(position, radius, excludeAttribute))
+            return FALSE;
+        if (!IsOverFloor(oldPosition, radius, excludeAttribute))
+            return FALSE;
+        float lo = 0.0f, hi = 1.0f;
+        for (int k = 0; k < 10; ++k)
+        {
+            const float mid = (lo + hi) * 0.5f;
+            if (IsOverFloor(oldPosition + (position - oldPosition) * mid, radius, excludeAttribute))
+                lo = mid;
+            else
+                hi = mid;
+        }
+        *result = oldPosition + (position - oldPosition) * lo;
+        return TRUE;
+    }
+
+    /************************************************
+    Summary: Keeps many moving points over the floors.
+
+    Arguments:
+        oldPositions: Positions before the move.
+        positions: Positions after the move.
+        count: Number of points.
+        radius: Radius of the objects.
+        results: Receives the constrained positions, or the positions when they were not constrained.
+        pool: Worker threads to use, NULL to do all the work in the calling thread.
+        excludeAttribute: Floors with this attribute are ignored.
+    Return Value:
+        Number of points constrained.
+    ************************************************/
+    int ConstrainToFloor(const VxVector *oldPositions, const VxVector *positions, int count, float radius, VxVector *results, VxParallelPool *pool = NULL, CKAttributeType excludeAttribute = -1) const
+    {
+        BatchJob job;
+        job.m_Index = this;
+        job.m_Old = oldPositions;
+        job.m_Positions = positions;
+        job.m_Points = NULL;
+        job.m_Results = results;
+        job.m_Radius = radius;
+        job.m_Attribute = excludeAttribute;
+        job.m_Count = 0;
+        Run(pool, count, ConstrainRange, job);
+        return (int)job.m_Count;
+    }
+
+protected:
+    struct Floor
+    {
+        CK_ID m_Entity;
+        CK_FLOORGEOMETRY m_Geometry;
+        VxTriangleGrid *m_Grid; // moving floors, NULL for the static grid
+        VxMatrix m_World;       // when the grid was built
+    };
+
+    struct BatchJob
+    {
+        const CKFloorIndex *m_Index;
+        const VxVector *m_Old;
+        const VxVector *m_Positions;
+        CKFloorPoint *m_Points;
+        VxVector *m_Results;
+        float m_Radius;
+        CKAttributeType m_Attribute;
+        volatile long m_Count;
+    };
+
+    enum
+    {
+        Grain = 64 // points per job
+    };
+
+    void Run(VxParallelPool *pool, int count, VxRangeFunction *func, BatchJob &job) const
+    {
+        // fills the cache of the excluded floors before the threads read it
+        if (job.m_Attribute >= 0)
+            GetExcluded(job.m_Attribute);
+        if (pool)
+            pool->For(count, Grain, func, &job);
+        else
+            func(&job, 0, count);
+    }
+
+    static void NearestRange(void *arg, int begin, int end)
+    {
+        BatchJob &job = *(BatchJob *)arg;
+        long found = 0;
+        for (int i = begin; i < end; ++i)
+        {
+            if (job.m_Index->GetNearestFloors(job.m_Positions[i], &job.m_Points[i], NULL, job.m_Attribute) != CKFLOOR_NOFLOOR)
+                ++found;
+        }
+        VxAtomicExchangeAdd(&job.m_Count, found);
+    }
+
+    static void ConstrainRange(void *arg, int begin, int end)
+    {
+        BatchJob &job = *(BatchJob *)arg;
+        long constrained = 0;
+        for (int i = begin; i < end; ++i)
+        {
+            if (job.m_Index->ConstrainToFloor(job.m_Old[i], job.m_Positions[i], job.m_Radius, &job.m_Results[i], job.m_Attribute))
+                ++constrained;
+            else
+                job.m_Results[i] = job.m_Positions[i];
+        }
+        VxAtomicExchangeAdd(&job.m_Count, constrained);
+    }
+
+    int FindFloor(CK3dEntity *ent) const
+    {
+        for (int i = 0; i < m_Floors.Size(); ++i)
+        {
+            if (m_Floors[i].m_Entity == ent->GetID())
+                return i;
+        }
+        return -1;
+    }
+
+    // Adds the world space faces of a floor to a grid.
+    static void AddTriangles(VxTriangleGrid &grid, CK3dEntity *ent, CK_FLOORGEOMETRY geo, int owner)
+    {
+        const VxMatrix &world = ent->GetWorldMatrix();
+        CKMesh *mesh = ent->GetCurrentMesh();
+        if (geo == CKFLOOR_BOX || !mesh)
+        {
+            const VxBbox &box = ent->GetBoundingBox(TRUE);
+            if (box.Min.x > box.Max.x)
+                return;
+            VxVector local[4] = {
+                VxVector(box.Min.x, box.Max.y, box.Min.z), VxVector(box.Min.x, box.Max.y, box.Max.z),
+                VxVector(box.Max.x, box.Max.y, box.Max.z), VxVector(box.Max.x, box.Max.y, box.Min.z)};
+            VxVector corners[4];
+            for (int k = 0; k < 4; ++k)
+                Vx3DMultiplyMatrixVector(&corners[k], world, &local[k]);
+            grid.AddTriangle(corners[0], corners[1], corners[2], owner, 0);
+            grid.AddTriangle(corners[0], corners[2], corners[3], owner, 1);
+            return;
+        }
+        CKDWORD stride;
+        const CKBYTE *positions = (const CKBYTE *)mesh->GetPositionsPtr(&stride);
+        const CKWORD *indices = mesh->GetFacesIndices();
+        const int vertexCount = mesh->GetVertexCount();
+        if (!positions || !indices)
+            return;
+        XArray<VxVector> vertices;
+        vertices.Resize(vertexCount);
+        Vx3DMultiplyMatrixVectorMany(vertices.Begin(), world, (const VxVector *)positions, vertexCount, stride);
+        for (int f = 0; f < mesh->GetFaceCount(); ++f, indices += 3)
+            grid.AddTriangle(vertices[indices[0]], vertices[indices[1]], vertices[indices[2]], owner, f);
+    }
+
+    int Find(const VxVector &position, VxTriangleGrid::Hit &down, VxTriangleGrid::Hit &up, CK3dEntity *excludeFloor, CKAttributeType excludeAttribute) const
+    {
+        const int exclude = excludeFloor ? FindFloor(excludeFloor) : -1;
+        const XBYTE *excluded = (excludeAttribute >= 0) ? GetExcluded(excludeAttribute) : NULL;
+        int found = m_Static.GetNearest(position, m_MinNormalY, down, up, exclude, excluded);
+        for (int i = 0; i < m_Floors.Size(); ++i)
+        {
+            const Floor &f = m_Floors[i];
+            if (!f.m_Grid || i == exclude || (excluded && excluded[i]))
+                continue;
+            VxTriangleGrid::Hit d, u;
+            const int hit = f.m_Grid->GetNearest(position, m_MinNormalY, d, u);
+            if ((hit & VxTriangleGrid::FOUND_DOWN) && (!(found & VxTriangleGrid::FOUND_DOWN) || d.m_Distance > down.m_Distance))
+            {
+                down = d;
+                found |= VxTriangleGrid::FOUND_DOWN;
+            }
+            if ((hit & VxTriangleGrid::FOUND_UP) && (!(found & VxTriangleGrid::FOUND_UP) || u.m_Distance < up.m_Distance))
+            {
+                up = u;
+                found |= VxTriangleGrid::FOUND_UP;
+            }
+        }
+        return found;
+    }
+
+    // One byte per floor telling whether it has the attribute, computed once per Update.
+    const XBYTE *GetExcluded(CKAttributeType attribute) const
+    {
+        if (attribute != m_ExcludedAttribute || m_Excluded.Size() != m_Floors.Size())
+        {
+            m_ExcludedAttribute = attribute;
+            m_Excluded.Resize(m_Floors.Size());
+            for (int i = 0; i < m_Floors.Size(); ++i)
+            {
+                CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(m_Floors[i].m_Entity);
+                m_Excluded[i] = (!ent || ent->HasAttribute(attribute)) ? 1 : 0;
+            }
+        }
+        return m_Excluded.Begin();
+    }
+
+    static CK_FLOORNEAREST Nearest(int found, const VxTriangleGrid::Hit &down, const VxTriangleGrid::Hit &up)
+    {
+        if (found == (VxTriangleGrid::FOUND_DOWN | VxTriangleGrid::FOUND_UP))
+            return (-down.m_Distance <= up.m_Distance) ? CKFLOOR_DOWN : CKFLOOR_UP;
+        if (found & VxTriangleGrid::FOUND_DOWN)
+            return CKFLOOR_DOWN;
+        if (found & VxTriangleGrid::FOUND_UP)
+            return CKFLOOR_UP;
+        return CKFLOOR_NOFLOOR;
+    }
+
+    CKBOOL IsOverFloor(const VxVector &p, float radius, CKAttributeType excludeAttribute) const
+    {
+        static const float dirs[5][2] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {-1.0f, 0.0f}, {0.0f, 1.0f}, {0.0f, -1.0f}};
+        for (int k = 0; k < (radius > 0.0f ? 5 : 1); ++k)
+        {
+            VxTriangleGrid::Hit down, up;
+            const VxVector q(p.x + dirs[k][0] * radius, p.y, p.z + dirs[k][1] * radius);
+            if (!(Find(q, down, up, NULL, excludeAttribute) & VxTriangleGrid::FOUND_DOWN))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    CKContext *m_Context;
+    float m_CellSize;
+    float m_MinNormalY;
+    CKBOOL m_StaticDirty;
+    XArray<Floor> m_Floors;
+    VxTriangleGrid m_Static;
+    mutable CKAttributeType m_ExcludedAttribute;
+    mutable XArray<XBYTE> m_Excluded;
+
+private:
+    CKFloorIndex(const CKFloorIndex &);
+    CKFloorIndex &operator=(const CKFloorIndex &);
+};
+
+#endif // CKFLOORINDEX_H
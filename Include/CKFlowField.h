@@ -0,0 +1,303 @@
+#ifndef CKFLOWFIELD_H
+#define CKFLOWFIELD_H
+
+#include "CKContext.h"
+#include "CKGridManager.h"
+#include "CKGrid.h"
+#include "CKLayer.h"
+#include "VxFlowField.h"
+
+/****************************************************************
+Summary: Flow fields on the grids of the scene, giving a whole crowd the way to common goals.
+
+Remarks:
+    o Each grid containing a goal gets a VxFlowField whose costs are read
+    from one of its layers: a square whose value is lower than the block
+    value costs 1 + value, the other squares are blocked (with the default
+    block value of 1, the squares at 0 are free).
+    o Update places the goals on their grid (CKGridManager::GetPreferredGrid),
+    reads the changed layers and computes the changes of the fields. A
+    moved goal only changes the field of its grid, and an added goal (or
+    a square getting cheaper) only propagates from its cell. The number of
+    cells processed per field and per call can be limited, the previous
+    field being used until the new one is complete.
+    o GetDirection gives the world direction to follow at a position. The
+    grid of the previous lookup is tried first (CKGridManager::IsInGrid),
+    the agents of a crowd being mostly on the same grid, otherwise the
+    preferred grid at the position is used. The cost of a frame does not
+    depend on the number of agents beyond one lookup each.
+
+    CKFlowField flow(ctx, gm->GetTypeFromName("Obstacle"));
+    flow.SetGoal(target->GetWorldPosition());
+    ...
+    // each frame
+    flow.Update(4000);
+    for (i = 0; i < agents.Size(); ++i)
+        if (flow.GetDirection(positions[i], dir))
+            ...
+
+See Also: VxFlowField,CKGridManager,CKGridPathfinder
+****************************************************************/
+class CKFlowField
+{
+public:
+    CKFlowField(CKContext *ctx, int layerType, int blockValue = 1)
+        : m_Context(ctx), m_LayerType(layerType), m_BlockValue(blockValue), m_GoalsChanged(FALSE), m_LastGrid(0) {}
+
+    ~CKFlowField() { Clear(); }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Fields.Size(); ++i)
+            delete m_Fields[i];
+        m_Fields.Resize(0);
+        m_Goals.Resize(0);
+        m_GoalsChanged = FALSE;
+        m_LastGrid = 0;
+    }
+
+    void SetBlockValue(int value)
+    {
+        m_BlockValue = value;
+        for (int i = 0; i < m_Fields.Size(); ++i)
+            m_Fields[i]->m_Values.Resize(0);
+    }
+
+    // Goals in world coordinates.
+    void SetGoal(const VxVector &pos)
+    {
+        m_Goals.Resize(0);
+        AddGoal(pos);
+    }
+    void AddGoal(const VxVector &pos)
+    {
+        m_Goals.PushBack(pos);
+        m_GoalsChanged = TRUE;
+    }
+    void ClearGoals()
+    {
+        m_Goals.Resize(0);
+        m_GoalsChanged = TRUE;
+    }
+    int GetGoalCount() const { return m_Goals.Size(); }
+
+    /************************************************
+    Summary: Computes the fields for the current goals and layers.
+
+    Arguments:
+        maxCells: Number of cells processed per field, 0 for no limit.
+    Return Value:
+        TRUE if all the fields are up to date.
+    ************************************************/
+    CKBOOL Update(int maxCells = 0)
+    {
+        CKGridManager *gm = GetGridManager();
+        if (!gm)
+            return FALSE;
+        int i;
+        if (m_GoalsChanged)
+        {
+            m_GoalsChanged = FALSE;
+            for (i = 0; i < m_Fields.Size(); ++i)
+                m_Fields[i]->m_NewGoals.Resize(0);
+            for (i = 0; i < m_Goals.Size(); ++i)
+            {
+                CKGrid *grid = gm->GetPreferredGrid(&m_Goals[i]);
+                if (!grid)
+                    continue;
+                GridField *f = GetOrCreate(grid);
+                int x, z;
+                grid->Get2dCoordsFrom3dPos(&m_Goals[i], &x, &z);
+                f->m_NewGoals.PushBack(z * grid->GetWidth() + x);
+            }
+            for (i = 0; i < m_Fields.Size(); ++i)
+                m_Fields[i]->m_GoalsToSet = TRUE;
+        }
+
+        CKBOOL done = TRUE;
+        for (i = 0; i < m_Fields.Size(); ++i)
+        {
+            GridField *f = m_Fields[i];
+            CKGrid *grid = (CKGrid *)m_Context->GetObject(f->m_Grid);
+            if (!grid || !ReadLayer(grid, f))
+                continue;
+            if (f->m_GoalsToSet)
+            {
+                SetGoals(f);
+                f->m_GoalsToSet = FALSE;
+            }
+            if (!f->m_Field.Update(maxCells))
+                done = FALSE;
+        }
+        return done;
+    }
+
+    /************************************************
+    Summary: Gets the direction to follow at a world position.
+
+    Arguments:
+        pos: Position of the agent.
+        dir: Receives the unit direction in world coordinates.
+    Return Value:
+        FALSE if the position is not on a grid with a goal, reaches no goal, or is on a goal.
+    ************************************************/
+    CKBOOL GetDirection(const VxVector &pos, VxVector &dir)
+    {
+        dir.Set(0.0f, 0.0f, 0.0f);
+        int x, z;
+        GridField *f = Lookup(pos, x, z);
+        float dx, dz;
+        if (!f || !f->m_Field.GetDirection(x, z, dx, dz))
+            return FALSE;
+        dir = f->m_AxisX * dx + f->m_AxisZ * dz;
+        dir.Normalize();
+        return TRUE;
+    }
+
+    // Path cost to the nearest goal, in squares of cost 1, or -1 if no goal can be reached.
+    float GetDistance(const VxVector &pos)
+    {
+        int x, z;
+        GridField *f = Lookup(pos, x, z);
+        if (!f)
+            return -1.0f;
+        const int d = f->m_Field.GetDistance(x, z);
+        return d == VxFlowField::Unreached ? -1.0f : d * 0.1f;
+    }
+
+    // The field of a grid, NULL if no goal was ever placed on it.
+    VxFlowField *GetField(CKGrid *grid)
+    {
+        GridField *f = Find(grid);
+        return f ? &f->m_Field : NULL;
+    }
+
+protected:
+    struct GridField
+    {
+        CK_ID m_Grid;
+        VxFlowField m_Field;
+        VxVector m_AxisX; // world vector between two squares along the width
+        VxVector m_AxisZ; // and along the length
+        XArray<int> m_OldGoals; // cells of the goals given to the field
+        XArray<int> m_NewGoals;
+        CKBOOL m_GoalsToSet;
+        XArray<CKSquare> m_Values; // the layer at the last update
+        XArray<XBYTE> m_Costs;
+    };
+
+    CKGridManager *GetGridManager() { return (CKGridManager *)m_Context->GetManagerByGuid(GRID_MANAGER_GUID); }
+
+    GridField *Find(CKGrid *grid)
+    {
+        if (!grid)
+            return NULL;
+        for (int i = 0; i < m_Fields.Size(); ++i)
+        {
+            if (m_Fields[i]->m_Grid == grid->GetID())
+                return m_Fields[i];
+        }
+        return NULL;
+    }
+
+    GridField *GetOrCreate(CKGrid *grid)
+    {
+        GridField *f = Find(grid);
+        if (f)
+            return f;
+        f = new GridField;
+        f->m_Grid = grid->GetID();
+        f->m_GoalsToSet = FALSE;
+        VxVector o, x, z;
+        grid->Get3dPosFrom2dCoords(&o, 0, 0);
+        grid->Get3dPosFrom2dCoords(&x, 1, 0);
+        grid->Get3dPosFrom2dCoords(&z, 0, 1);
+        f->m_AxisX = x - o;
+        f->m_AxisZ = z - o;
+        m_Fields.PushBack(f);
+        return f;
+    }
+
+    // The field of the grid under an agent, trying the grid of the previous lookup first.
+    GridField *Lookup(const VxVector &pos, int &x, int &z)
+    {
+        CKGridManager *gm = GetGridManager();
+        if (!gm)
+            return NULL;
+        VxVector p = pos;
+        CKGrid *grid = (CKGrid *)m_Context->GetObject(m_LastGrid);
+        if (!grid || !gm->IsInGrid(grid, &p))
+            grid = gm->GetPreferredGrid(&p);
+        GridField *f = Find(grid);
+        if (!f)
+            return NULL;
+        m_LastGrid = f->m_Grid;
+        grid->Get2dCoordsFrom3dPos(&p, &x, &z);
+        if (x < 0 || z < 0 || x >= f->m_Field.GetWidth() || z >= f->m_Field.GetLength())
+            return NULL;
+        return f;
+    }
+
+    // Keeps the goals still in place, so only the moved ones change the field.
+    void SetGoals(GridField *f)
+    {
+        VxFlowField &field = f->m_Field;
+        const int width = field.GetWidth();
+        int i;
+        for (i = 0; i < f->m_OldGoals.Size(); ++i)
+        {
+            const int cell = f->m_OldGoals[i];
+            if (!f->m_NewGoals.IsHere(cell))
+                field.RemoveGoal(cell % width, cell / width);
+        }
+        for (i = 0; i < f->m_NewGoals.Size(); ++i)
+        {
+            const int cell = f->m_NewGoals[i];
+            field.AddGoal(cell % width, cell / width);
+        }
+        f->m_OldGoals = f->m_NewGoals;
+    }
+
+    CKBOOL ReadLayer(CKGrid *grid, GridField *f)
+    {
+        CKLayer *layer = grid->GetLayer(m_LayerType);
+        if (!layer)
+            return FALSE;
+        const int width = grid->GetWidth();
+        const int length = grid->GetLength();
+        const int count = width * length;
+        const CKSquare *squares = layer->GetSquareArray();
+        if (!squares || !count)
+            return FALSE;
+        if (width != f->m_Field.GetWidth() || length != f->m_Field.GetLength())
+        {
+            f->m_Field.SetSize(width, length);
+            f->m_OldGoals.Resize(0);
+            f->m_GoalsToSet = TRUE;
+            f->m_Values.Resize(0);
+        }
+        // squares stored [length][width], as the field cells
+        if (f->m_Values.Size() == count && !memcmp(f->m_Values.Begin(), squares, count * sizeof(CKSquare)))
+            return TRUE;
+        f->m_Values.Resize(count);
+        memcpy(f->m_Values.Begin(), squares, count * sizeof(CKSquare));
+        f->m_Costs.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            const int value = squares[i].ival;
+            f->m_Costs[i] = value >= m_BlockValue ? 0 : (XBYTE)(value < 0 ? 1 : XMin(value + 1, 255));
+        }
+        f->m_Field.SetCosts(f->m_Costs.Begin());
+        return TRUE;
+    }
+
+    CKContext *m_Context;
+    int m_LayerType;
+    int m_BlockValue;
+    XArray<VxVector> m_Goals;
+    CKBOOL m_GoalsChanged;
+    XArray<GridField *> m_Fields;
+    CK_ID m_LastGrid;
+};
+
+#endif // CKFLOWFIELD_H
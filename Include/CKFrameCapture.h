@@ -0,0 +1,261 @@
+#ifndef CKFRAMECAPTURE_H
+#define CKFRAMECAPTURE_H
+
+#include <string.h>
+#include <windows.h>
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKPluginManager.h"
+#include "CKBitmapReader.h"
+#include "CKPathSplitter.h"
+#include "VxAtomic.h"
+#include "VxSync.h"
+#include "VxThread.h"
+#include "XClassArray.h"
+
+typedef void CKFrameCaptureCallback(const VxImageDescEx &image, int frame, CKSTRING file, void *arg);
+
+/****************************************************************
+Summary: Captures of the back buffer written to files on a worker thread and delivered one or more frames later.
+
+Remarks:
+    o DumpToFile reads the back buffer, converts the image and encodes the
+    file in the render loop. Capture only does the read: the image goes in
+    a slot of a ring of buffers allocated once (the slots are reused, no
+    allocation per frame), and a worker thread encodes it with a bitmap
+    reader (chosen from the file extension) while the next frames render.
+    o Poll, called once per frame, gives the captures finished since the
+    previous call to the callback, in capture order and on the calling
+    thread: the callback can use the image (copy it, send it to a video
+    encoder...) until it returns, then the slot is reused.
+    o When all the slots are busy (the worker does not keep up), Capture
+    drops the frame and returns FALSE instead of waiting: a larger ring
+    absorbs the encoding spikes. GetDroppedCount tells how many were lost.
+    o The read of the back buffer itself (DumpToMemory) is still done by
+    the render engine when it is called: the staging surfaces of the driver
+    are not accessible from the SDK. Call Capture right after
+    CKRenderContext::Render, before the next frame is cleared.
+
+    CKFrameCapture capture(context, 4);
+    capture.SetCallback(OnFrame, recorder);
+    while (recording)
+    {
+        dev->Render();
+        sprintf(name, "frames\\%05d.png", frame++);
+        capture.Capture(dev, name);
+        capture.Poll();
+    }
+    capture.Flush();
+
+See Also: CKRenderContext::DumpToMemory,CKRenderContext::DumpToFile,CKBitmapReader::SaveFile
+****************************************************************/
+class CKFrameCapture
+{
+public:
+    explicit CKFrameCapture(CKContext *context, int ringSize = 3)
+        : m_Context(context), m_Callback(NULL), m_CallbackArg(NULL), m_Reader(NULL),
+          m_Next(0), m_Encode(0), m_Deliver(0), m_Frame(0), m_Dropped(0), m_Stop(0), m_Worker(this)
+    {
+        m_Slots.Resize(XMax(ringSize, 1));
+        for (int i = 0; i < m_Slots.Size(); ++i)
+        {
+            m_Slots[i].m_State = SLOT_FREE;
+            m_Slots[i].m_Frame = 0;
+        }
+        m_Worker.CreateThread();
+    }
+
+    ~CKFrameCapture()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        m_Wake.Set();
+        m_Worker.Wait();
+        if (m_Reader)
+            m_Reader->Release();
+    }
+
+    // Function given the finished captures by Poll.
+    void SetCallback(CKFrameCaptureCallback *callback, void *arg)
+    {
+        m_Callback = callback;
+        m_CallbackArg = arg;
+    }
+
+    /*************************************************
+    Summary: Reads the back buffer and queues it to be saved.
+
+    Arguments:
+        dev: Render context to read.
+        file: File to write the image to (its extension selects the format), NULL to only give it to the callback.
+        rect: Part of the buffer to read, NULL for the whole buffer.
+    Return Value:
+        FALSE if the frame was dropped because all the slots are busy, or
+    if the buffer could not be read or no reader saves this file format.
+    *************************************************/
+    CKBOOL Capture(CKRenderContext *dev, CKSTRING file = NULL, const VxRect *rect = NULL)
+    {
+        Slot &slot = m_Slots[m_Next];
+        if (VxAtomicLoad(&slot.m_State) != SLOT_FREE)
+        {
+            ++m_Dropped;
+            return FALSE;
+        }
+        if (file && !GetReader(file))
+            return FALSE;
+
+        slot.m_Desc.Image = NULL;
+        const int size = dev->DumpToMemory(rect, VXBUFFER_BACKBUFFER, slot.m_Desc);
+        if (size <= 0)
+            return FALSE;
+        if (slot.m_Pixels.Size() < size)
+            slot.m_Pixels.Resize(size);
+        slot.m_Desc.Image = slot.m_Pixels.Begin();
+        dev->DumpToMemory(rect, VXBUFFER_BACKBUFFER, slot.m_Desc);
+
+        slot.m_File = file ? file : "";
+        slot.m_Frame = m_Frame++;
+        VxAtomicStore(&slot.m_State, SLOT_QUEUED);
+        m_Next = (m_Next + 1) % m_Slots.Size();
+        m_Wake.Set();
+        return TRUE;
+    }
+
+    // Gives the finished captures to the callback and frees their slots. Returns their number.
+    int Poll()
+    {
+        int count = 0;
+        for (;;)
+        {
+            Slot &slot = m_Slots[m_Deliver];
+            if (VxAtomicLoad(&slot.m_State) != SLOT_DONE)
+                break;
+            if (m_Callback)
+                m_Callback(slot.m_Desc, slot.m_Frame, slot.m_File.Length() ? slot.m_File.Str() : NULL, m_CallbackArg);
+            VxAtomicStore(&slot.m_State, SLOT_FREE);
+            m_Deliver = (m_Deliver + 1) % m_Slots.Size();
+            ++count;
+        }
+        return count;
+    }
+
+    // Waits until every queued capture is saved and delivered.
+    void Flush()
+    {
+        for (;;)
+        {
+            Poll();
+            if (VxAtomicLoad(&m_Slots[m_Deliver].m_State) == SLOT_FREE)
+                return;
+            m_Saved.Wait(10);
+        }
+    }
+
+    int GetDroppedCount() const { return m_Dropped; }
+    int GetCapturedCount() const { return m_Frame; }
+
+protected:
+    enum SlotState
+    {
+        SLOT_FREE   = 0, // owned by the render thread
+        SLOT_QUEUED = 1, // owned by the worker
+        SLOT_DONE   = 2  // saved, waiting for Poll
+    };
+
+    struct Slot
+    {
+        VxImageDescEx m_Desc;
+        XArray<CKBYTE> m_Pixels;
+        XString m_File;
+        int m_Frame;
+        volatile long m_State;
+    };
+
+    class Worker : public VxThread
+    {
+    public:
+        explicit Worker(CKFrameCapture *capture) : m_Capture(capture) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_Capture->WorkerLoop();
+            return VXT_OK;
+        }
+
+        CKFrameCapture *m_Capture;
+    };
+    friend class Worker;
+
+    // Reader of the extension of file, created by the render thread and used by the worker only.
+    CKBitmapReader *GetReader(CKSTRING file)
+    {
+        CKPathSplitter splitter(file);
+        CKFileExtension ext(splitter.GetExtension());
+        if (m_Reader && m_ReaderExt == ext)
+            return m_Reader;
+        // the worker may still be saving with the previous reader
+        for (int i = 0; i < m_Slots.Size(); ++i)
+            while (VxAtomicLoad(&m_Slots[i].m_State) == SLOT_QUEUED)
+                m_Saved.Wait(10);
+        if (m_Reader)
+            m_Reader->Release();
+        m_Reader = CKGetPluginManager()->GetBitmapReader(ext);
+        m_ReaderExt = ext;
+        return m_Reader;
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            m_Wake.Wait();
+            if (VxAtomicLoad(&m_Stop))
+                return;
+            for (;;)
+            {
+                Slot &slot = m_Slots[m_Encode];
+                if (VxAtomicLoad(&slot.m_State) != SLOT_QUEUED)
+                    break;
+                if (slot.m_File.Length() && m_Reader)
+                {
+                    CKBitmapProperties *bp = NULL;
+                    m_Reader->GetBitmapDefaultProperties(&bp);
+                    if (bp)
+                    {
+                        bp->m_Format = slot.m_Desc;
+                        bp->m_Data = slot.m_Desc.Image;
+                        m_Reader->SaveFile(slot.m_File.Str(), bp);
+                        bp->m_Data = NULL;
+                    }
+                }
+                m_Encode = (m_Encode + 1) % m_Slots.Size();
+                VxAtomicStore(&slot.m_State, SLOT_DONE);
+                m_Saved.Set();
+            }
+        }
+    }
+
+    CKContext *m_Context;
+    CKFrameCaptureCallback *m_Callback;
+    void *m_CallbackArg;
+    CKBitmapReader *m_Reader;
+    CKFileExtension m_ReaderExt;
+    XClassArray<Slot> m_Slots;
+    int m_Next;    // next slot captured (render thread)
+    int m_Encode;  // next slot saved (worker)
+    int m_Deliver; // next slot given to the callback (render thread)
+    int m_Frame;
+    int m_Dropped;
+
+    volatile long m_Stop;
+    VxEvent m_Wake;
+    VxEvent m_Saved;
+    Worker m_Worker;
+
+private:
+    CKFrameCapture(const CKFrameCapture &);
+    CKFrameCapture &operator=(const CKFrameCapture &);
+};
+
+#endif // CKFRAMECAPTURE_H
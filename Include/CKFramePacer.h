@@ -0,0 +1,323 @@
+#ifndef CKFRAMEPACER_H
+#define CKFRAMEPACER_H
+
+#include <windows.h>
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKTimeManager.h"
+#include "VxAtomic.h"
+
+#define FRAME_PACER_GUID CKGUID(0x4d0f7b62, 0x1a93e5c8)
+
+/****************************************************************
+Summary: Precise waits for the time manager limits and smoothing of the delta time.
+
+Remarks:
+    o WaitForLimits replaces the loop around
+    CKTimeManager::GetTimeToWaitForLimits: it sleeps until shortly before
+    the limit and spins the rest, so that a 60 or 120 Hz limit is hit
+    within a few microseconds instead of a scheduler quantum. The sleep
+    margin follows the oversleeps measured (about 1 ms with a 1 ms timer
+    resolution, up to 16 ms without), so the spin stays short.
+    o SetTimerResolution changes the resolution of the system timer
+    (timeBeginPeriod, loaded from winmm.dll) while the pacer exists.
+    o Render replaces CKRenderContext::Render and records the time each
+    frame is presented. With CK_FRAMERATE_SYNC the interval between
+    presents gives the refresh period (GetRefreshPeriod) and the time of
+    the next present (GetPredictedPresentTime), so an application can
+    start its frame as late as possible.
+    o When smoothing is enabled, the PreProcess of the pacer, right after
+    the one of the time manager, replaces the delta time of the frame:
+    a delta far from the median of the last frames (a hitch, a breakpoint,
+    a window drag) is replaced by the median unless it lasts, a delta near
+    a multiple of the refresh period is snapped to it, and the result is
+    averaged. GetLastDeltaTimeFree and GetAbsoluteTime keep the measured
+    times.
+
+    CKFramePacer *pacer = CKFramePacer::Get(context);
+    pacer->SetTimerResolution(1);
+    pacer->EnableSmoothing(TRUE);
+    while (running)
+    {
+        CKBOOL doRender, doBehaviors;
+        pacer->WaitForLimits(doRender, doBehaviors);
+        if (doBehaviors)
+            context->Process();
+        if (doRender)
+            pacer->Render(renderContext);
+    }
+
+See Also: CKTimeManager::GetTimeToWaitForLimits,CK_FRAMERATE_LIMITS
+****************************************************************/
+class CKFramePacer : public CKBaseManager
+{
+public:
+    enum
+    {
+        HistorySize = 16
+    };
+
+    // The pacer of the context, created on the first call.
+    static CKFramePacer *Get(CKContext *context)
+    {
+        CKFramePacer *pacer = (CKFramePacer *)context->GetManagerByGuid(FRAME_PACER_GUID);
+        if (!pacer)
+            pacer = new CKFramePacer(context);
+        return pacer;
+    }
+
+    ~CKFramePacer()
+    {
+        SetTimerResolution(0);
+        if (m_WinMM)
+            FreeLibrary(m_WinMM);
+    }
+
+    //---------------------------------------------
+    // Waiting
+
+    // Milliseconds since the creation of the pacer.
+    double Now()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (double)(now.QuadPart - m_Origin.QuadPart) * m_MsPerTick;
+    }
+
+    // Resolution of the system timer in milliseconds while the pacer exists, 0 for the default one.
+    CKBOOL SetTimerResolution(CKDWORD ms)
+    {
+        if (!m_TimeBeginPeriod || !m_TimeEndPeriod)
+            return FALSE;
+        if (m_TimerResolution)
+            m_TimeEndPeriod(m_TimerResolution);
+        m_TimerResolution = ms;
+        if (ms && m_TimeBeginPeriod(ms) != 0)
+        {
+            m_TimerResolution = 0;
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    // Waits until a time given by Now, sleeping first and spinning the last part.
+    void WaitUntil(double target)
+    {
+        for (;;)
+        {
+            const double remaining = target - Now();
+            if (remaining <= m_SleepMargin)
+                break;
+            const DWORD asked = (DWORD)(remaining - m_SleepMargin);
+            const double start = Now();
+            Sleep(asked);
+            // the margin follows the largest recent oversleeps
+            const double over = Now() - start - asked;
+            m_SleepMargin = over > m_SleepMargin ? over : m_SleepMargin + (over - m_SleepMargin) * 0.05;
+            if (m_SleepMargin < 0.25)
+                m_SleepMargin = 0.25;
+        }
+        while (Now() < target)
+            VxSpinPause();
+    }
+
+    /*************************************************
+    Summary: Waits until a process loop or a rendering is due.
+
+    Arguments:
+        doRender: TRUE if the rendering must be done.
+        doBehaviors: TRUE if the process loop must be done.
+    Remarks:
+        The chronos of the time manager are reset for the loop(s) which are
+        due, as in the loop documented with GetTimeToWaitForLimits.
+    *************************************************/
+    void WaitForLimits(CKBOOL &doRender, CKBOOL &doBehaviors)
+    {
+        CKTimeManager *tm = m_Context->GetTimeManager();
+        for (;;)
+        {
+            float beforeRender = 0.0f, beforeBeh = 0.0f;
+            tm->GetTimeToWaitForLimits(beforeRender, beforeBeh);
+            doRender = beforeRender <= 0.0f;
+            doBehaviors = beforeBeh <= 0.0f;
+            if (doRender || doBehaviors)
+                break;
+            WaitUntil(Now() + XMin(beforeRender, beforeBeh));
+        }
+        tm->ResetChronos(doRender, doBehaviors);
+    }
+
+    float GetSleepMargin() const { return (float)m_SleepMargin; }
+
+    //---------------------------------------------
+    // Presents
+
+    // Renders and records the time of the present.
+    CKERROR Render(CKRenderContext *dev, CK_RENDER_FLAGS flags = CK_RENDER_USECURRENTSETTINGS)
+    {
+        CKERROR err = dev->Render(flags);
+        OnPresent();
+        return err;
+    }
+
+    // Records a present done by the application (when it does not use Render).
+    void OnPresent()
+    {
+        const double now = Now();
+        if (m_LastPresent > 0.0)
+        {
+            const double interval = now - m_LastPresent;
+            // intervals of missed refreshes are multiples of the period, keep the shortest ones
+            if (m_RefreshPeriod <= 0.0)
+                m_RefreshPeriod = interval;
+            else if (interval < m_RefreshPeriod * 1.5)
+                m_RefreshPeriod += (interval - m_RefreshPeriod) * 0.1;
+        }
+        m_LastPresent = now;
+    }
+
+    // Estimated refresh period in milliseconds, 0 before two frames were presented.
+    float GetRefreshPeriod() const { return (float)m_RefreshPeriod; }
+
+    // Time (given by Now) of the next present with vertical synchronization.
+    double GetPredictedPresentTime()
+    {
+        if (m_RefreshPeriod <= 0.0)
+            return Now();
+        const double now = Now();
+        double next = m_LastPresent + m_RefreshPeriod;
+        while (next < now)
+            next += m_RefreshPeriod;
+        return next;
+    }
+
+    //---------------------------------------------
+    // Delta time
+
+    void EnableSmoothing(CKBOOL enable, float weight = 0.3f, float outlierRatio = 2.5f)
+    {
+        m_Smoothing = enable;
+        m_Weight = weight;
+        m_OutlierRatio = outlierRatio;
+        m_HistoryCount = 0;
+        m_Smoothed = 0.0f;
+    }
+
+    CKBOOL IsSmoothing() const { return m_Smoothing; }
+
+    // Delta times replaced since the smoothing was enabled.
+    int GetOutlierCount() const { return m_Outliers; }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PreProcess()
+    {
+        if (!m_Smoothing)
+            return CK_OK;
+        CKTimeManager *tm = m_Context->GetTimeManager();
+        tm->SetLastDeltaTime(Smooth(tm->GetLastDeltaTime(), tm));
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask() { return CKMANAGER_FUNC_PreProcess; }
+
+    virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function)
+    {
+        // right after the time manager
+        return MAX_MANAGERFUNC_PRIORITY - 1;
+    }
+
+protected:
+    typedef UINT(WINAPI *TimePeriodFct)(UINT);
+
+    CKFramePacer(CKContext *context) : CKBaseManager(context, FRAME_PACER_GUID, "Frame Pacer"),
+                                       m_SleepMargin(2.0), m_TimerResolution(0), m_LastPresent(0.0), m_RefreshPeriod(0.0),
+                                       m_Smoothing(FALSE), m_Weight(0.3f), m_OutlierRatio(2.5f), m_HistoryCount(0), m_HistoryIndex(0), m_LastOutliers(0), m_Outliers(0), m_Smoothed(0.0f)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        m_MsPerTick = 1000.0 / (double)frequency.QuadPart;
+        QueryPerformanceCounter(&m_Origin);
+        m_WinMM = LoadLibraryA("winmm.dll");
+        m_TimeBeginPeriod = m_WinMM ? (TimePeriodFct)GetProcAddress(m_WinMM, "timeBeginPeriod") : NULL;
+        m_TimeEndPeriod = m_WinMM ? (TimePeriodFct)GetProcAddress(m_WinMM, "timeEndPeriod") : NULL;
+        context->RegisterNewManager(this);
+    }
+
+    float Median() const
+    {
+        float sorted[HistorySize];
+        for (int i = 0; i < m_HistoryCount; ++i)
+        {
+            // insertion sort, the history is small
+            int j = i;
+            for (; j > 0 && sorted[j - 1] > m_History[i]; --j)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = m_History[i];
+        }
+        return sorted[m_HistoryCount / 2];
+    }
+
+    float Smooth(float delta, CKTimeManager *tm)
+    {
+        float value = delta;
+        if (m_HistoryCount >= 4)
+        {
+            const float median = Median();
+            const CKBOOL outlier = delta > median * m_OutlierRatio || delta * m_OutlierRatio < median;
+            // a change lasting a few frames is a new frame rate rather than a hitch
+            if (outlier && ++m_LastOutliers < 4)
+            {
+                value = median;
+                ++m_Outliers;
+            }
+            else if (!outlier)
+            {
+                m_LastOutliers = 0;
+            }
+        }
+        m_History[m_HistoryIndex] = delta;
+        m_HistoryIndex = (m_HistoryIndex + 1) % HistorySize;
+        if (m_HistoryCount < HistorySize)
+            ++m_HistoryCount;
+
+        // frames shown with vertical synchronization last a whole number of refreshes
+        if ((tm->GetLimitOptions() & CK_FRAMERATE_SYNC) && m_RefreshPeriod > 0.0)
+        {
+            const float period = (float)m_RefreshPeriod * tm->GetTimeScaleFactor();
+            const float refreshes = (float)(int)(value / period + 0.5f);
+            if (refreshes >= 1.0f && XAbs(value - refreshes * period) < period * 0.1f)
+                value = refreshes * period;
+        }
+
+        m_Smoothed = m_Smoothed > 0.0f ? m_Smoothed + (value - m_Smoothed) * m_Weight : value;
+        return XMin(XMax(m_Smoothed, tm->GetMinimumDeltaTime()), tm->GetMaximumDeltaTime());
+    }
+
+    LARGE_INTEGER m_Origin;
+    double m_MsPerTick;
+    double m_SleepMargin; // time left to spin after a sleep
+
+    HMODULE m_WinMM;
+    TimePeriodFct m_TimeBeginPeriod;
+    TimePeriodFct m_TimeEndPeriod;
+    CKDWORD m_TimerResolution;
+
+    double m_LastPresent;
+    double m_RefreshPeriod;
+
+    CKBOOL m_Smoothing;
+    float m_Weight;
+    float m_OutlierRatio;
+    float m_History[HistorySize]; // measured delta times
+    int m_HistoryCount;
+    int m_HistoryIndex;
+    int m_LastOutliers; // consecutive outliers
+    int m_Outliers;
+    float m_Smoothed;
+};
+
+#endif // CKFRAMEPACER_H
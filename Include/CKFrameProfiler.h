@@ -0,0 +1,228 @@
+#ifndef CKFRAMEPROFILER_H
+#define CKFRAMEPROFILER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKTimeManager.h"
+#include "VxFrameProfiler.h"
+
+#define FRAME_PROFILER_GUID CKGUID(0x3c5d2a71, 0x6e1b4f09)
+
+/****************************************************************
+Summary: Manager recording the phases of the process loop in a VxFrameProfiler.
+
+Remarks:
+    o The manager owns a VxFrameProfiler and makes it the instance of the
+    module (VX_PROFILE_ZONE records in it). It is created and registered by
+    the first call to Get and deleted with the context.
+    o Process and Render replace CKContext::Process and CKRenderContext::Render
+    in the loop of the application and record:
+        - "Process", split by the manager callbacks into "PreProcess" (the
+        PreProcess of all the managers, this one being called last),
+        "Behaviors" (the behavior execution, up to the first PostProcess) and
+        "PostProcess".
+        - "Render", which contains "Scene" from the first OnPreRender to the
+        last OnPostRender of the managers.
+    o A composition load between PreLoad and PostLoad is recorded as a
+    "Load" zone. Note: allocations are not seen by the manager, the code
+    doing them can open its own zones.
+    o EnableSpikeCapture writes the last frames to a trace file when a frame
+    exceeds a threshold, by default the one implied by the limits of the
+    time manager (twice the period of the frame rate limit, or the maximum
+    delta time when the frame rate is not limited).
+    o EndFrame adds the fixed categories of CKStats as counters of the frame
+    (behaviors, animations, parametric operations...) when the profiling of
+    the context is enabled, so they can be compared with the zones.
+
+    CKFrameProfiler *profiler = CKFrameProfiler::Get(context);
+    profiler->Enable(TRUE);
+    // each frame
+    profiler->BeginFrame();
+    profiler->Process();
+    profiler->Render(renderContext);
+    profiler->EndFrame();
+    ...
+    profiler->GetProfiler().ExportChromeTrace("frames.json");
+
+See Also: VxFrameProfiler,CKContext::GetProfileStats,CKTimeProfiler
+****************************************************************/
+class CKFrameProfiler : public CKBaseManager
+{
+public:
+    // The profiler of the context, created on the first call.
+    static CKFrameProfiler *Get(CKContext *context, int maxFrames = 120)
+    {
+        CKFrameProfiler *profiler = (CKFrameProfiler *)context->GetManagerByGuid(FRAME_PROFILER_GUID);
+        if (!profiler)
+            profiler = new CKFrameProfiler(context, maxFrames);
+        return profiler;
+    }
+
+    ~CKFrameProfiler() {}
+
+    VxFrameProfiler &GetProfiler() { return m_Profiler; }
+
+    void Enable(CKBOOL enable) { m_Profiler.Enable(enable); }
+    CKBOOL IsEnabled() const { return m_Profiler.IsEnabled(); }
+
+    void BeginFrame() { m_Profiler.BeginFrame(); }
+
+    // 0 to follow the limits of the time manager, a negative threshold disables the capture.
+    void EnableSpikeCapture(const char *filePrefix = "spike", float thresholdMs = 0.0f)
+    {
+        m_SpikeFromLimits = thresholdMs == 0.0f;
+        m_Profiler.SetSpikeCapture(m_SpikeFromLimits ? GetLimitThreshold() : XMax(thresholdMs, 0.0f), filePrefix);
+    }
+
+    // Frame time above which a frame is a spike for the current time manager limits.
+    float GetLimitThreshold()
+    {
+        CKTimeManager *tm = m_Context->GetTimeManager();
+        if (!tm)
+            return 100.0f;
+        if ((tm->GetLimitOptions() & CK_FRAMERATE_LIMIT) && tm->GetFrameRateLimit() > 0.0f)
+            return 2000.0f / tm->GetFrameRateLimit();
+        return tm->GetMaximumDeltaTime();
+    }
+
+    void EndFrame()
+    {
+        if (m_SpikeFromLimits && m_Profiler.GetSpikeThreshold() > 0.0f)
+            m_Profiler.SetSpikeThreshold(GetLimitThreshold());
+        if (m_Context->IsProfilingEnable())
+        {
+            CKStats stats;
+            m_Context->GetProfileStats(&stats);
+            m_Profiler.AddCounter("Behaviors (ms)", stats.TotalBehaviorExecution);
+            m_Profiler.AddCounter("Behavior code (ms)", stats.BehaviorCodeExecution);
+            m_Profiler.AddCounter("Animations (ms)", stats.AnimationManagement);
+            m_Profiler.AddCounter("IK (ms)", stats.IKManagement);
+            m_Profiler.AddCounter("Parametric operations (ms)", stats.ParametricOperations);
+            m_Profiler.AddCounter("Active objects", (float)stats.ActiveObjectsExecuted);
+            m_Profiler.AddCounter("Building blocks", (float)stats.BuildingBlockExecuted);
+            m_Profiler.AddCounter("Behavior links", (float)stats.BehaviorLinksParsed);
+        }
+        m_Profiler.EndFrame();
+    }
+
+    CKERROR Process()
+    {
+        const CKBOOL process = m_Profiler.BeginZone("Process");
+        m_Phase = m_Profiler.BeginZone("PreProcess") ? PHASE_PREPROCESS : PHASE_NONE;
+        CKERROR err = m_Context->Process();
+        if (m_Phase != PHASE_NONE)
+            m_Profiler.EndZone();
+        m_Phase = PHASE_NONE;
+        if (process)
+            m_Profiler.EndZone();
+        return err;
+    }
+
+    CKERROR Render(CKRenderContext *dev, CK_RENDER_FLAGS flags = CK_RENDER_USECURRENTSETTINGS)
+    {
+        const CKBOOL render = m_Profiler.BeginZone("Render");
+        m_InScene = FALSE;
+        CKERROR err = dev->Render(flags);
+        if (m_InScene)
+            m_Profiler.EndZone();
+        m_InScene = FALSE;
+        if (render)
+            m_Profiler.EndZone();
+        return err;
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PreProcess()
+    {
+        if (m_Phase == PHASE_PREPROCESS)
+        {
+            m_Profiler.EndZone();
+            m_Phase = m_Profiler.BeginZone("Behaviors") ? PHASE_BEHAVIORS : PHASE_NONE;
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR PostProcess()
+    {
+        if (m_Phase == PHASE_BEHAVIORS)
+        {
+            m_Profiler.EndZone();
+            m_Phase = m_Profiler.BeginZone("PostProcess") ? PHASE_POSTPROCESS : PHASE_NONE;
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR PreLoad()
+    {
+        if (!m_InLoad)
+            m_InLoad = m_Profiler.BeginZone("Load");
+        return CK_OK;
+    }
+
+    virtual CKERROR PostLoad()
+    {
+        if (m_InLoad)
+            m_Profiler.EndZone();
+        m_InLoad = FALSE;
+        return CK_OK;
+    }
+
+    virtual CKERROR OnPreRender(CKRenderContext *dev)
+    {
+        if (!m_InScene)
+            m_InScene = m_Profiler.BeginZone("Scene");
+        return CK_OK;
+    }
+
+    virtual CKERROR OnPostRender(CKRenderContext *dev)
+    {
+        if (m_InScene)
+            m_Profiler.EndZone();
+        m_InScene = FALSE;
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_PreProcess |
+               CKMANAGER_FUNC_PostProcess |
+               CKMANAGER_FUNC_PreLoad |
+               CKMANAGER_FUNC_PostLoad |
+               CKMANAGER_FUNC_OnPreRender |
+               CKMANAGER_FUNC_OnPostRender;
+    }
+
+    virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function)
+    {
+        // PostProcess, OnPreRender and PreLoad first, PreProcess, OnPostRender and PostLoad last
+        if (Function == CKMANAGER_FUNC_PostProcess || Function == CKMANAGER_FUNC_OnPreRender || Function == CKMANAGER_FUNC_PreLoad)
+            return MAX_MANAGERFUNC_PRIORITY;
+        return -MAX_MANAGERFUNC_PRIORITY;
+    }
+
+protected:
+    enum Phase
+    {
+        PHASE_NONE,
+        PHASE_PREPROCESS,
+        PHASE_BEHAVIORS,
+        PHASE_POSTPROCESS
+    };
+
+    CKFrameProfiler(CKContext *context, int maxFrames) : CKBaseManager(context, FRAME_PROFILER_GUID, "Frame Profiler"), m_Profiler(maxFrames), m_Phase(PHASE_NONE), m_InScene(FALSE), m_InLoad(FALSE), m_SpikeFromLimits(FALSE)
+    {
+        VxFrameProfiler::SetInstance(&m_Profiler);
+        context->RegisterNewManager(this);
+    }
+
+    VxFrameProfiler m_Profiler;
+    Phase m_Phase;
+    CKBOOL m_InScene;
+    CKBOOL m_InLoad;
+    CKBOOL m_SpikeFromLimits;
+};
+
+#endif // CKFRAMEPROFILER_H
@@ -0,0 +1,236 @@
+#ifndef CKGRIDPATHFINDER_H
+#define CKGRIDPATHFINDER_H
+
+#include "CKGrid.h"
+#include "CKLayer.h"
+#include "VxTimeProfiler.h"
+#include "VxHierarchicalPathfinder.h"
+
+/****************************************************************
+Summary: Path requests on a layer of a grid, answered within a time budget per frame.
+
+Remarks:
+    o The costs of the cells are read from a layer of the grid: a square
+    whose value is lower than the block value costs 1 + value, the other
+    squares are blocked. With the default block value of 1, the squares
+    at 0 are free and the others are obstacles.
+    o The searches go through a VxHierarchicalPathfinder. Update compares
+    the layer with the values of the previous frame, so only the clusters
+    whose squares changed have their entrances computed again, and only
+    the cached paths crossing them are dropped.
+    o RequestPath queues a request and returns its handle. Update takes
+    the pending requests in order until the time budget is spent (at
+    least one per call), then GetPathStatus and GetPath give the result.
+    The handle must be released with ReleasePath.
+
+    CKGridPathfinder finder(grid, gm->GetTypeFromName("Obstacle"));
+    int request = finder.RequestPath(from, to);
+    ...
+    // each frame
+    finder.Update(2.0f);
+    if (finder.GetPathStatus(request) == CKGridPathfinder::PATH_FOUND)
+    {
+        finder.GetPath(request, points);
+        finder.ReleasePath(request);
+    }
+
+See Also: VxHierarchicalPathfinder,CKGrid,CKLayer
+****************************************************************/
+class CKGridPathfinder
+{
+public:
+    enum PathStatus
+    {
+        PATH_INVALID = 0,  // unknown or released handle
+        PATH_PENDING = 1,  // waiting for Update
+        PATH_FOUND = 2,
+        PATH_NOTFOUND = 3  // blocked or outside the grid
+    };
+
+    CKGridPathfinder(CKGrid *grid, int layerType, int blockValue = 1, int clusterSize = 16)
+        : m_Grid(grid), m_LayerType(layerType), m_BlockValue(blockValue), m_Finder(clusterSize) {}
+
+    void SetBlockValue(int value)
+    {
+        m_BlockValue = value;
+        m_Values.Resize(0); // all the costs are read again
+    }
+
+    VxHierarchicalPathfinder &GetFinder() { return m_Finder; }
+
+    /************************************************
+    Summary: Queues a path request between two world positions.
+
+    Return Value:
+        Handle of the request.
+    ************************************************/
+    int RequestPath(const VxVector &from, const VxVector &to)
+    {
+        int handle = 0;
+        while (handle < m_Requests.Size() && m_Requests[handle].m_Status != PATH_INVALID)
+            ++handle;
+        if (handle == m_Requests.Size())
+            m_Requests.Expand(1);
+        Request &r = m_Requests[handle];
+        r.m_From = from;
+        r.m_To = to;
+        r.m_Status = PATH_PENDING;
+        r.m_Cells.Resize(0);
+        m_Pending.PushBack(handle);
+        return handle;
+    }
+
+    int GetPathStatus(int handle) const
+    {
+        if (handle < 0 || handle >= m_Requests.Size())
+            return PATH_INVALID;
+        return m_Requests[handle].m_Status;
+    }
+
+    int GetPendingCount() const { return m_Pending.Size(); }
+
+    // The squares of a found path (z * width + x).
+    const XArray<int> *GetPathCells(int handle) const
+    {
+        if (GetPathStatus(handle) != PATH_FOUND)
+            return NULL;
+        return &m_Requests[handle].m_Cells;
+    }
+
+    // The centers of the squares of a found path, in world coordinates.
+    CKBOOL GetPath(int handle, XArray<VxVector> &points) const
+    {
+        const XArray<int> *cells = GetPathCells(handle);
+        if (!cells)
+            return FALSE;
+        ToPoints(*cells, points);
+        return TRUE;
+    }
+
+    void ReleasePath(int handle)
+    {
+        if (GetPathStatus(handle) == PATH_INVALID)
+            return;
+        Request &r = m_Requests[handle];
+        if (r.m_Status == PATH_PENDING)
+            m_Pending.Remove(handle);
+        r.m_Status = PATH_INVALID;
+        r.m_Cells.Resize(0);
+    }
+
+    /************************************************
+    Summary: Reads the layer and answers the pending requests.
+
+    Arguments:
+        budget: Time given to the searches, in milliseconds.
+    Return Value:
+        Number of requests answered.
+    ************************************************/
+    int Update(float budget = 2.0f)
+    {
+        if (!ReadLayer())
+            return 0;
+        VxTimeProfiler profiler;
+        int done = 0;
+        while (m_Pending.Size())
+        {
+            if (done && profiler.Current() >= budget)
+                break;
+            const int handle = m_Pending[0];
+            m_Pending.RemoveAt(0);
+            Request &r = m_Requests[handle];
+            r.m_Status = Search(r.m_From, r.m_To, r.m_Cells) ? PATH_FOUND : PATH_NOTFOUND;
+            ++done;
+        }
+        return done;
+    }
+
+    // Immediate search, without going through the requests.
+    CKBOOL FindPath(const VxVector &from, const VxVector &to, XArray<VxVector> &points)
+    {
+        points.Resize(0);
+        if (!ReadLayer())
+            return FALSE;
+        XArray<int> cells;
+        if (!Search(from, to, cells))
+            return FALSE;
+        ToPoints(cells, points);
+        return TRUE;
+    }
+
+protected:
+    struct Request
+    {
+        VxVector m_From;
+        VxVector m_To;
+        int m_Status;
+        XArray<int> m_Cells;
+    };
+
+    XBYTE CostOf(int value) const
+    {
+        if (value >= m_BlockValue)
+            return 0;
+        if (value < 0)
+            return 1;
+        return (XBYTE)XMin(value + 1, 255);
+    }
+
+    // Gives the changed squares of the layer to the pathfinder.
+    CKBOOL ReadLayer()
+    {
+        if (!m_Grid)
+            return FALSE;
+        CKLayer *layer = m_Grid->GetLayer(m_LayerType);
+        if (!layer)
+            return FALSE;
+        const int width = m_Grid->GetWidth();
+        const int length = m_Grid->GetLength();
+        const int count = width * length;
+        const CKSquare *squares = layer->GetSquareArray();
+        if (!squares || !count)
+            return FALSE;
+        if (width != m_Finder.GetWidth() || length != m_Finder.GetLength())
+        {
+            m_Finder.SetSize(width, length);
+            m_Values.Resize(0);
+        }
+        // squares stored [length][width], as the pathfinder cells
+        if (m_Values.Size() == count && !memcmp(m_Values.Begin(), squares, count * sizeof(CKSquare)))
+            return TRUE;
+        m_Values.Resize(count);
+        memcpy(m_Values.Begin(), squares, count * sizeof(CKSquare));
+        m_Costs.Resize(count);
+        for (int i = 0; i < count; ++i)
+            m_Costs[i] = CostOf(squares[i].ival);
+        m_Finder.SetCosts(m_Costs.Begin());
+        return TRUE;
+    }
+
+    CKBOOL Search(const VxVector &from, const VxVector &to, XArray<int> &cells)
+    {
+        int sx, sz, gx, gz;
+        m_Grid->Get2dCoordsFrom3dPos(&from, &sx, &sz);
+        m_Grid->Get2dCoordsFrom3dPos(&to, &gx, &gz);
+        return m_Finder.FindPath(sx, sz, gx, gz, cells);
+    }
+
+    void ToPoints(const XArray<int> &cells, XArray<VxVector> &points) const
+    {
+        const int width = m_Finder.GetWidth();
+        points.Resize(cells.Size());
+        for (int i = 0; i < cells.Size(); ++i)
+            m_Grid->Get3dPosFrom2dCoords(&points[i], cells[i] % width, cells[i] / width);
+    }
+
+    CKGrid *m_Grid;
+    int m_LayerType;
+    int m_BlockValue;
+    VxHierarchicalPathfinder m_Finder;
+    XClassArray<Request> m_Requests;
+    XArray<int> m_Pending;
+    XArray<CKSquare> m_Values; // the layer at the last update
+    XArray<XBYTE> m_Costs;
+};
+
+#endif // CKGRIDPATHFINDER_H
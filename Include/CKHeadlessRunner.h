@@ -0,0 +1,204 @@
+#ifndef CKHEADLESSRUNNER_H
+#define CKHEADLESSRUNNER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKGlobals.h"
+#include "CKTimeManager.h"
+#include "CK3dEntity.h"
+#include "VxIntersect.h"
+#include "VxRay.h"
+#include "VxTimeProfiler.h"
+#include "XArray.h"
+
+#define HEADLESS_RUNNER_GUID CKGUID(0x4b1e7c52, 0x2d90a3f6)
+
+/****************************************************************
+Summary: Runs a composition without rendering, at a fixed simulated time step and as fast as possible.
+
+Remarks:
+    o Nothing is rasterized when no render context is created and
+    CKRenderContext::Render is never called: Run only calls CKContext::Process,
+    back to back, with the delta time of the time manager forced to the step
+    (set by the PreProcess of the runner, right after the one of the time
+    manager), so the simulation does not depend on how fast it runs and a
+    server can run thousands of ticks per second.
+    o World matrices are updated when the entities move, and bounding boxes
+    are computed on demand (CK3dEntity::GetBoundingBox) without the render
+    engine. Pick replaces CKRenderContext::Pick with a ray cast on the CPU:
+    a ray/box test on the world box of each pickable visible entity, then
+    CK3dEntity::RayIntersection on the faces of the ones crossed.
+    o What depends on a render context does not run: the OnPreRender and
+    OnPostRender manager functions, the render callbacks, and the building
+    blocks using behcontext.CurrentRenderContext (which is NULL) must check
+    for it. The compositions used headless should avoid them or be tested.
+    o The render engine plugin does not need to be loaded: the context is
+    created as usual and no render context is created.
+
+    CKHeadlessRunner *runner = CKHeadlessRunner::Get(context);
+    runner->SetStep(1000.0f / 60.0f);
+    context->Play();
+    runner->Run(60 * 60); // one minute of simulation
+    CK3dEntity *hit = runner->Pick(VxRay(eye, target), &desc);
+
+See Also: CKFixedStepLoop,CKTimeManager,CK3dEntity::RayIntersection
+****************************************************************/
+class CKHeadlessRunner : public CKBaseManager
+{
+public:
+    // The runner of the context, created on the first call.
+    static CKHeadlessRunner *Get(CKContext *context)
+    {
+        CKHeadlessRunner *runner = (CKHeadlessRunner *)context->GetManagerByGuid(HEADLESS_RUNNER_GUID);
+        if (!runner)
+            runner = new CKHeadlessRunner(context);
+        return runner;
+    }
+
+    ~CKHeadlessRunner() {}
+
+    // Simulated time step in milliseconds.
+    void SetStep(float ms) { m_Step = XMax(ms, 0.001f); }
+    float GetStep() const { return m_Step; }
+
+    /*************************************************
+    Summary: Runs ticks of simulation.
+
+    Arguments:
+        count: Number of ticks to run.
+    Return Value:
+        Number of ticks run: less than count if the context was paused
+    during the ticks (by a behavior, for example).
+    *************************************************/
+    int Run(int count)
+    {
+        VxTimeProfiler chrono;
+        int ticks = 0;
+        for (; ticks < count && m_Context->IsPlaying(); ++ticks)
+        {
+            m_InTick = TRUE;
+            m_Context->Process();
+            m_InTick = FALSE;
+        }
+        m_TickCount += ticks;
+        m_RunTime += chrono.Current();
+        return ticks;
+    }
+
+    // Ticks run since the creation of the runner, or the last ResetStats.
+    int GetTickCount() const { return m_TickCount; }
+
+    // Real time spent in Run, in milliseconds.
+    float GetRunTime() const { return m_RunTime; }
+
+    float GetTicksPerSecond() const { return (m_RunTime > 0.0f) ? m_TickCount * 1000.0f / m_RunTime : 0.0f; }
+
+    void ResetStats()
+    {
+        m_TickCount = 0;
+        m_RunTime = 0.0f;
+    }
+
+    //---------------------------------------------
+    // Picking
+
+    /*************************************************
+    Summary: Finds the nearest entity crossed by a ray.
+
+    Arguments:
+        ray: Ray in world coordinates (the origin and a point on the ray).
+        desc: Intersection with the entity returned (in its local coordinates), or NULL.
+        dist: Distance in world units from the origin of the ray to the intersection, or NULL.
+    Return Value:
+        The nearest pickable and visible entity crossed, NULL if none.
+    *************************************************/
+    CK3dEntity *Pick(const VxRay &ray, VxIntersectionDesc *desc = NULL, float *dist = NULL)
+    {
+        if (m_EntityClasses.Size() == 0)
+        {
+            const int classCount = CKGetClassCount();
+            for (CK_CLASSID cid = 0; cid < classCount; ++cid)
+                if (CKIsChildClassOf(cid, CKCID_3DENTITY))
+                    m_EntityClasses.PushBack(cid);
+        }
+
+        const VxVector end = ray.m_Origin + ray.m_Direction;
+        CK3dEntity *nearest = NULL;
+        float nearestDist = 0.0f;
+        VxIntersectionDesc d;
+        for (CK_CLASSID *cid = m_EntityClasses.Begin(); cid != m_EntityClasses.End(); ++cid)
+        {
+            const int count = m_Context->GetObjectsCountByClassID(*cid);
+            CK_ID *ids = m_Context->GetObjectsListByClassID(*cid);
+            for (int i = 0; i < count; ++i)
+            {
+                CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(ids[i]);
+                if (!ent || !ent->IsPickable() || !ent->IsVisible())
+                    continue;
+                if (!VxIntersect::RayBox(ray, ent->GetBoundingBox()))
+                    continue;
+                if (!ent->RayIntersection(&ray.m_Origin, &end, &d, NULL))
+                    continue;
+                VxVector point;
+                ent->Transform(&point, &d.IntersectionPoint);
+                const float distance = Magnitude(point - ray.m_Origin);
+                if (nearest && distance >= nearestDist)
+                    continue;
+                nearest = ent;
+                nearestDist = distance;
+                if (desc)
+                    *desc = d;
+            }
+        }
+        if (dist)
+            *dist = nearestDist;
+        return nearest;
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PreProcess()
+    {
+        if (m_InTick)
+        {
+            CKTimeManager *tm = m_Context->GetTimeManager();
+            tm->SetLastDeltaTime(m_Step * tm->GetTimeScaleFactor());
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR PostClearAll()
+    {
+        // classes may have been registered by the plugins loaded since
+        m_EntityClasses.Resize(0);
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_PreProcess |
+               CKMANAGER_FUNC_PostClearAll;
+    }
+
+    virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function)
+    {
+        // right after the time manager
+        return MAX_MANAGERFUNC_PRIORITY - 1;
+    }
+
+protected:
+    CKHeadlessRunner(CKContext *context) : CKBaseManager(context, HEADLESS_RUNNER_GUID, "Headless Runner"),
+                                           m_Step(1000.0f / 60.0f), m_InTick(FALSE), m_TickCount(0), m_RunTime(0.0f)
+    {
+        context->RegisterNewManager(this);
+    }
+
+    float m_Step;
+    CKBOOL m_InTick;
+    int m_TickCount;
+    float m_RunTime;
+    XArray<CK_CLASSID> m_EntityClasses;
+};
+
+#endif // CKHEADLESSRUNNER_H
@@ -0,0 +1,278 @@
+#ifndef CKIKSOLVER_H
+#define CKIKSOLVER_H
+
+#include "CKContext.h"
+#include "CKKinematicChain.h"
+#include "CKBodyPart.h"
+#include "VxMath.h"
+#include "VxFabrik.h"
+#include "VxTimeProfiler.h"
+
+/****************************************************************
+Summary: Solves kinematic chains with an iterative solver warm started from the previous frame.
+
+Remarks:
+    o An alternative to CKKinematicChain::IKSetEffectorPos for chains
+    solved every frame (foot placement, hands on a prop...): the chains of
+    one or several characters are added to the solver, each one is given a
+    target, and Solve moves all the end effectors in one call.
+    o The joint positions are solved with VxFabrikSolver (FABRIK), the
+    chains with the same number of body parts 4 at a time with SSE. The
+    solver starts from the solution of the previous frame (kept relative
+    to the parent of the start effector so it follows the character) and
+    stops as soon as the end effector is within the tolerance, which
+    usually takes one or two iterations once the chain has converged.
+    o The body parts are then rotated so that each one points to the new
+    position of the next one. The joint limits of the body parts are not
+    taken into account.
+    o When the context profiling is enabled, the time spent is added to
+    CKStats::IKManagement.
+
+    CKIKSolver ik(context);
+    int left = ik.AddChain(leftLeg);
+    int right = ik.AddChain(rightLeg);
+    ...
+    // each frame, after the animations
+    ik.SetTarget(left, leftFootGround);
+    ik.SetTarget(right, rightFootGround);
+    ik.Solve();
+
+See Also: CKKinematicChain,VxFabrikSolver
+****************************************************************/
+class CKIKSolver
+{
+public:
+    CKIKSolver(CKContext *context, float tolerance = 0.001f, int maxIterations = 10)
+        : m_Context(context), m_Solver(tolerance, maxIterations), m_SolveTime(0.0f) {}
+
+    ~CKIKSolver() { Clear(); }
+
+    VxFabrikSolver &GetSolver() { return m_Solver; }
+
+    /************************************************
+    Summary: Adds a kinematic chain.
+
+    Return Value:
+        Index of the chain, -1 if the chain has less than two body parts.
+    Remarks:
+        The chain starts with no target, and is not moved until SetTarget is called.
+    ************************************************/
+    int AddChain(CKKinematicChain *chain)
+    {
+        if (!chain)
+            return -1;
+        const int count = chain->GetChainBodyCount();
+        if (count < 2)
+            return -1;
+        Entry *e = new Entry;
+        e->m_Chain = CKOBJID(chain);
+        e->m_Bodies.Resize(count);
+        for (int i = 0; i < count; ++i)
+            e->m_Bodies[i] = CKOBJID(chain->GetEffector(i));
+        e->m_Joints.Resize(count);
+        e->m_Previous.Resize(count);
+        e->m_Lengths.Resize(count - 1);
+        m_Entries.PushBack(e);
+        return m_Entries.Size() - 1;
+    }
+
+    void RemoveChain(CKKinematicChain *chain)
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            if (m_Entries[i]->m_Chain == CKOBJID(chain))
+            {
+                delete m_Entries[i];
+                m_Entries.RemoveAt(i);
+                return;
+            }
+        }
+    }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+            delete m_Entries[i];
+        m_Entries.Clear();
+    }
+
+    int GetChainCount() const { return m_Entries.Size(); }
+
+    // Sets the position the end effector of a chain goes to, in the ref referential (NULL for world).
+    void SetTarget(int index, const VxVector &pos, CK3dEntity *ref = NULL)
+    {
+        Entry *e = m_Entries[index];
+        if (ref)
+            Vx3DMultiplyMatrixVector(&e->m_Target, ref->GetWorldMatrix(), &pos);
+        else
+            e->m_Target = pos;
+        e->m_Active = TRUE;
+    }
+
+    // Stops moving a chain until its next SetTarget.
+    void DisableTarget(int index)
+    {
+        m_Entries[index]->m_Active = FALSE;
+        m_Entries[index]->m_Warm = FALSE;
+    }
+
+    // Discards the previous solution of a chain (or of all chains), the next solve starts from the current pose.
+    void ResetWarmStart(int index = -1)
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            if (index < 0 || index == i)
+                m_Entries[i]->m_Warm = FALSE;
+        }
+    }
+
+    int GetIterations(int index) const { return m_Entries[index]->m_Iterations; }
+    float GetError(int index) const { return m_Entries[index]->m_Error; }
+
+    // Time taken by the last Solve, in milliseconds.
+    float GetSolveTime() const { return m_SolveTime; }
+
+    // Moves all the chains with a target.
+    void Solve()
+    {
+        VxTimeProfiler profiler;
+        int i;
+        m_Chains.Resize(0);
+        m_Solved.Resize(0);
+        for (i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry *e = m_Entries[i];
+            if (!e->m_Active || !Gather(e))
+                continue;
+            VxFabrikChain c;
+            c.m_Joints = e->m_Joints.Begin();
+            c.m_Lengths = e->m_Lengths.Begin();
+            c.m_JointCount = e->m_Joints.Size();
+            c.m_Target = e->m_Target;
+            c.m_Iterations = 0;
+            c.m_Error = 0.0f;
+            m_Chains.PushBack(c);
+            m_Solved.PushBack(e);
+        }
+
+        m_Solver.SolveBatch(m_Chains.Begin(), m_Chains.Size());
+
+        for (i = 0; i < m_Solved.Size(); ++i)
+        {
+            m_Solved[i]->m_Iterations = m_Chains[i].m_Iterations;
+            m_Solved[i]->m_Error = m_Chains[i].m_Error;
+            Apply(m_Solved[i]);
+        }
+
+        m_SolveTime = profiler.Current();
+        if (m_Context->IsProfilingEnable())
+            m_Context->m_Stats.IKManagement += m_SolveTime;
+    }
+
+protected:
+    struct Entry
+    {
+        Entry() : m_Chain(0), m_Active(FALSE), m_Warm(FALSE), m_Iterations(0), m_Error(0.0f) {}
+
+        CK_ID m_Chain;
+        XArray<CK_ID> m_Bodies;       // start effector first
+        XArray<VxVector> m_Joints;    // world positions, solved in place
+        XArray<VxVector> m_Previous;  // last solution in the referential of the start effector parent
+        XArray<float> m_Lengths;
+        VxVector m_Target;
+        XBOOL m_Active;
+        XBOOL m_Warm;
+        int m_Iterations;
+        float m_Error;
+    };
+
+    CK3dEntity *GetBody(Entry *e, int i)
+    {
+        CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(e->m_Bodies[i]);
+        return (ent && !ent->IsToBeDeleted()) ? ent : NULL;
+    }
+
+    // Fills the joints from the current pose or the previous solution.
+    XBOOL Gather(Entry *e)
+    {
+        const int count = e->m_Bodies.Size();
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            CK3dEntity *ent = GetBody(e, i);
+            if (!ent)
+                return FALSE;
+            ent->GetPosition(&e->m_Joints[i]);
+        }
+        // the bone lengths come from the current pose (the character can be scaled)
+        for (i = 0; i < count - 1; ++i)
+            e->m_Lengths[i] = Magnitude(e->m_Joints[i + 1] - e->m_Joints[i]);
+        if (e->m_Warm)
+        {
+            CK3dEntity *parent = GetBody(e, 0)->GetParent();
+            for (i = 1; i < count; ++i)
+            {
+                if (parent)
+                    Vx3DMultiplyMatrixVector(&e->m_Joints[i], parent->GetWorldMatrix(), &e->m_Previous[i]);
+                else
+                    e->m_Joints[i] = e->m_Previous[i];
+            }
+        }
+        return TRUE;
+    }
+
+    // Rotates the body parts toward the solved joints and keeps the solution.
+    void Apply(Entry *e)
+    {
+        const int count = e->m_Bodies.Size();
+        int i;
+        for (i = 0; i < count - 1; ++i)
+        {
+            CK3dEntity *body = GetBody(e, i);
+            CK3dEntity *next = GetBody(e, i + 1);
+            VxVector origin, current;
+            body->GetPosition(&origin);
+            next->GetPosition(&current);
+            VxVector from = current - origin;
+            VxVector to = e->m_Joints[i + 1] - origin;
+            const float l2 = SquareMagnitude(from) * SquareMagnitude(to);
+            if (l2 <= 0.0f)
+                continue;
+            VxVector axis = CrossProduct(from, to);
+            const float s = Magnitude(axis);
+            const float c = DotProduct(from, to);
+            const float angle = atan2f(s, c);
+            if (angle < 1e-5f || s <= 0.0f)
+                continue;
+            axis /= s;
+            body->Rotate(&axis, angle);
+        }
+
+        CK3dEntity *parent = GetBody(e, 0)->GetParent();
+        if (parent)
+        {
+            const VxMatrix &inv = parent->GetInverseWorldMatrix();
+            for (i = 0; i < count; ++i)
+                Vx3DMultiplyMatrixVector(&e->m_Previous[i], inv, &e->m_Joints[i]);
+        }
+        else
+        {
+            for (i = 0; i < count; ++i)
+                e->m_Previous[i] = e->m_Joints[i];
+        }
+        e->m_Warm = TRUE;
+    }
+
+    CKContext *m_Context;
+    VxFabrikSolver m_Solver;
+    XArray<Entry *> m_Entries;
+    XArray<VxFabrikChain> m_Chains;
+    XArray<Entry *> m_Solved;
+    float m_SolveTime;
+
+private:
+    CKIKSolver(const CKIKSolver &);
+    CKIKSolver &operator=(const CKIKSolver &);
+};
+
+#endif // CKIKSOLVER_H
@@ -0,0 +1,197 @@
+#ifndef CKINPUTCAPTURE_H
+#define CKINPUTCAPTURE_H
+
+#include <windows.h>
+
+#include "CKInputStream.h"
+#include "VxThread.h"
+
+/****************************************************************
+Summary: Thread capturing the keyboard and the mouse into a CKInputStream.
+
+Remarks:
+    o The thread installs low-level keyboard and mouse hooks and runs
+    their message loop: the events are received as they happen, whatever
+    the frame rate of the process loop, and stamped with the clock of the
+    stream. The hooks do not change the input received by the window or
+    by the input manager.
+    o Only the presses and moves happening while a window of the process is
+    in the foreground are pushed (the releases always are, so no key stays
+    down when the focus is lost). The keys are given in the CKKEYBOARD codes (the
+    scan codes, the extended keys having 0x80 added), the repeats of a held
+    key are filtered out.
+    o The mouse displacements are computed from the cursor positions, so
+    they stop at the edges of the screen: a mouse look with a clipped
+    cursor should still use CKInputManager::GetMouseRelativePosition.
+    o The hooks are shared by the process, only one capture can run at a
+    time. The joysticks are still sampled by the input manager.
+
+    CKInputStream stream;
+    CKInputCapture capture(stream);
+    if (!capture.Start())
+        ...
+    // each frame
+    stream.Update();
+    ...
+    capture.Stop();
+
+See Also: CKInputStream,CKInputManager
+****************************************************************/
+class CKInputCapture : public VxThread
+{
+public:
+    CKInputCapture(CKInputStream &stream) : m_Stream(stream), m_ThreadId(0), m_Ready(0), m_LastX(0), m_LastY(0), m_HasCursor(FALSE)
+    {
+        memset(m_Keys, 0, sizeof(m_Keys));
+    }
+
+    ~CKInputCapture() { Stop(); }
+
+    // Starts the thread and waits for the hooks, FALSE if they could not be installed.
+    XBOOL Start()
+    {
+        if (IsStarted())
+            return TRUE;
+        if (GetInstance())
+            return FALSE;
+        GetInstance() = this;
+        VxAtomicStore(&m_Ready, 0);
+        SetName("Input Capture");
+        if (!CreateThread())
+        {
+            GetInstance() = NULL;
+            return FALSE;
+        }
+        SetPriority(VXTP_HIGHLEVEL);
+        long ready;
+        while ((ready = VxAtomicLoad(&m_Ready)) == 0)
+            Sleep(0);
+        if (ready < 0)
+        {
+            Wait();
+            GetInstance() = NULL;
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    void Stop()
+    {
+        if (GetInstance() != this)
+            return;
+        PostThreadMessage(m_ThreadId, WM_QUIT, 0, 0);
+        Wait();
+        GetInstance() = NULL;
+    }
+
+protected:
+    virtual unsigned int Run()
+    {
+        MSG msg;
+        // creates the message queue before Stop can post to it
+        PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+        m_ThreadId = GetCurrentThreadId();
+
+        HINSTANCE instance = GetModuleHandle(NULL);
+        HHOOK keyboard = SetWindowsHookEx(WH_KEYBOARD_LL, KeyboardProc, instance, 0);
+        HHOOK mouse = SetWindowsHookEx(WH_MOUSE_LL, MouseProc, instance, 0);
+        if (!keyboard || !mouse)
+        {
+            if (keyboard)
+                UnhookWindowsHookEx(keyboard);
+            if (mouse)
+                UnhookWindowsHookEx(mouse);
+            VxAtomicStore(&m_Ready, -1);
+            return VXT_OK;
+        }
+        VxAtomicStore(&m_Ready, 1);
+
+        while (GetMessage(&msg, NULL, 0, 0) > 0)
+        {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+        UnhookWindowsHookEx(keyboard);
+        UnhookWindowsHookEx(mouse);
+        return VXT_OK;
+    }
+
+    static CKInputCapture *&GetInstance()
+    {
+        static CKInputCapture *instance = NULL;
+        return instance;
+    }
+
+    static XBOOL IsForeground()
+    {
+        HWND window = GetForegroundWindow();
+        DWORD process = 0;
+        if (window)
+            GetWindowThreadProcessId(window, &process);
+        return process == GetCurrentProcessId();
+    }
+
+    static LRESULT CALLBACK KeyboardProc(int code, WPARAM wParam, LPARAM lParam)
+    {
+        CKInputCapture *capture = GetInstance();
+        if (code == HC_ACTION && capture)
+        {
+            const KBDLLHOOKSTRUCT *k = (const KBDLLHOOKSTRUCT *)lParam;
+            const CKDWORD key = (k->scanCode & 0x7F) | ((k->flags & LLKHF_EXTENDED) ? 0x80 : 0);
+            const XBOOL down = !(k->flags & LLKHF_UP);
+            if (key && capture->m_Keys[key] != down && (!down || IsForeground()))
+            {
+                capture->m_Keys[key] = (XBYTE)down;
+                capture->m_Stream.PushKey(key, down);
+            }
+        }
+        return CallNextHookEx(NULL, code, wParam, lParam);
+    }
+
+    static LRESULT CALLBACK MouseProc(int code, WPARAM wParam, LPARAM lParam)
+    {
+        CKInputCapture *capture = GetInstance();
+        if (code == HC_ACTION && capture)
+        {
+            const MSLLHOOKSTRUCT *m = (const MSLLHOOKSTRUCT *)lParam;
+            CKInputStream &stream = capture->m_Stream;
+            const XBOOL up = wParam == WM_LBUTTONUP || wParam == WM_RBUTTONUP || wParam == WM_MBUTTONUP || wParam == WM_XBUTTONUP;
+            if (!up && !IsForeground())
+            {
+                capture->m_HasCursor = FALSE;
+                return CallNextHookEx(NULL, code, wParam, lParam);
+            }
+            switch (wParam)
+            {
+            case WM_LBUTTONDOWN: stream.PushMouseButton(CK_MOUSEBUTTON_LEFT, TRUE); break;
+            case WM_LBUTTONUP: stream.PushMouseButton(CK_MOUSEBUTTON_LEFT, FALSE); break;
+            case WM_RBUTTONDOWN: stream.PushMouseButton(CK_MOUSEBUTTON_RIGHT, TRUE); break;
+            case WM_RBUTTONUP: stream.PushMouseButton(CK_MOUSEBUTTON_RIGHT, FALSE); break;
+            case WM_MBUTTONDOWN: stream.PushMouseButton(CK_MOUSEBUTTON_MIDDLE, TRUE); break;
+            case WM_MBUTTONUP: stream.PushMouseButton(CK_MOUSEBUTTON_MIDDLE, FALSE); break;
+            case WM_XBUTTONDOWN: stream.PushMouseButton(CK_MOUSEBUTTON_4, TRUE); break;
+            case WM_XBUTTONUP: stream.PushMouseButton(CK_MOUSEBUTTON_4, FALSE); break;
+            case WM_MOUSEWHEEL: stream.PushMouseWheel((short)HIWORD(m->mouseData)); break;
+            case WM_MOUSEMOVE:
+                if (capture->m_HasCursor && (m->pt.x != capture->m_LastX || m->pt.y != capture->m_LastY))
+                    stream.PushMouseMove(m->pt.x - capture->m_LastX, m->pt.y - capture->m_LastY);
+                capture->m_LastX = m->pt.x;
+                capture->m_LastY = m->pt.y;
+                capture->m_HasCursor = TRUE;
+                break;
+            }
+        }
+        return CallNextHookEx(NULL, code, wParam, lParam);
+    }
+
+    CKInputStream &m_Stream;
+    DWORD m_ThreadId;
+    volatile long m_Ready; // 1 hooks installed, -1 failed
+    // owned by the capture thread
+    XBYTE m_Keys[CKInputStream::KeyCount];
+    LONG m_LastX;
+    LONG m_LastY;
+    XBOOL m_HasCursor;
+};
+
+#endif // CKINPUTCAPTURE_H
@@ -0,0 +1,244 @@
+#ifndef CKINPUTSTREAM_H
+#define CKINPUTSTREAM_H
+
+#include "CKInputManager.h"
+#include "VxTimeProfiler.h"
+#include "VxSPSCQueue.h"
+
+/*************************************************
+Summary: Type of a CKInputEvent.
+
+See also: CKInputStream
+*************************************************/
+typedef enum CK_INPUTEVENT_TYPE
+{
+    CK_INPUTEVENT_KEYDOWN     = 0, // m_Code is a CKKEYBOARD code
+    CK_INPUTEVENT_KEYUP       = 1,
+    CK_INPUTEVENT_MOUSEDOWN   = 2, // m_Code is a CK_MOUSEBUTTON
+    CK_INPUTEVENT_MOUSEUP     = 3,
+    CK_INPUTEVENT_MOUSEMOVE   = 4, // m_X,m_Y relative displacement
+    CK_INPUTEVENT_MOUSEWHEEL  = 5, // m_Y wheel displacement
+} CK_INPUTEVENT_TYPE;
+
+/*************************************************
+Summary: Input event captured by a CKInputStream.
+
+See also: CKInputStream,CK_INPUTEVENT_TYPE
+*************************************************/
+struct CKInputEvent
+{
+    CKDWORD m_Type; // CK_INPUTEVENT_TYPE
+    CKDWORD m_Code;
+    int m_X;
+    int m_Y;
+    float m_Time; // in milliseconds, CKInputStream::GetTime when the event was captured
+};
+
+/****************************************************************
+Summary: Stream of timestamped input events between a capture thread and the process loop.
+
+Remarks:
+    o The input manager samples the devices once per process loop: the
+    presses and releases happening between two frames are lost and the
+    time of an event is only known to the frame. A CKInputStream receives
+    the events from a capture thread (see CKInputCapture) or from the
+    window procedure, in a lock-free single producer queue, each with the
+    time it was captured.
+    o Update, called once per frame from the process loop, takes the events
+    received since the previous call and computes the states: IsKeyDown,
+    IsKeyToggled, IsMouseClicked... have the meaning of the CKInputManager
+    methods of the same name, but a key pressed and released between two
+    frames is still reported as toggled (and GetPressCount counts all the
+    presses).
+    o The events of the frame are kept in order (GetEvent) with their time,
+    so a behavior can use the exact time of a click, and the age of the
+    oldest event (GetLatency) measures the delay added by the frame rate.
+    o The Push methods must be called by one thread only.
+
+    CKInputStream stream;
+    CKInputCapture capture(stream);
+    capture.Start();
+    ...
+    // each frame
+    stream.Update();
+    if (stream.IsMouseClicked(CK_MOUSEBUTTON_LEFT))
+        ...
+
+See Also: CKInputManager,CKInputCapture,VxSPSCQueue
+****************************************************************/
+class CKInputStream
+{
+public:
+    enum
+    {
+        KeyCount = 256,
+        ButtonCount = 4
+    };
+
+    CKInputStream(int capacity = 1024) : m_Queue(capacity), m_FrameTime(0.0f), m_Dropped(0) { Reset(); }
+
+    // Forgets the states and the events of the frame.
+    void Reset()
+    {
+        memset(m_Keys, 0, sizeof(m_Keys));
+        memset(m_KeyStamps, 0, sizeof(m_KeyStamps));
+        memset(m_KeyPresses, 0, sizeof(m_KeyPresses));
+        memset(m_Buttons, 0, sizeof(m_Buttons));
+        memset(m_ButtonPresses, 0, sizeof(m_ButtonPresses));
+        m_Motion.Set(0.0f, 0.0f, 0.0f);
+        m_Events.Resize(0);
+    }
+
+    // The clock of the event times, in milliseconds. Can be called from any thread.
+    float GetTime() { return m_Clock.Current(); }
+
+    //---------------------------------------------
+    // Producer thread
+
+    XBOOL PushKey(CKDWORD key, XBOOL down) { return Push(down ? CK_INPUTEVENT_KEYDOWN : CK_INPUTEVENT_KEYUP, key & 0xFF, 0, 0); }
+    XBOOL PushMouseButton(CK_MOUSEBUTTON button, XBOOL down) { return Push(down ? CK_INPUTEVENT_MOUSEDOWN : CK_INPUTEVENT_MOUSEUP, button, 0, 0); }
+    XBOOL PushMouseMove(int dx, int dy) { return Push(CK_INPUTEVENT_MOUSEMOVE, 0, dx, dy); }
+    XBOOL PushMouseWheel(int delta) { return Push(CK_INPUTEVENT_MOUSEWHEEL, 0, 0, delta); }
+
+    XBOOL Push(CKDWORD type, CKDWORD code, int x, int y)
+    {
+        CKInputEvent e;
+        e.m_Type = type;
+        e.m_Code = code;
+        e.m_X = x;
+        e.m_Y = y;
+        e.m_Time = GetTime();
+        return m_Queue.Push(e);
+    }
+
+    //---------------------------------------------
+    // Process loop
+
+    /************************************************
+    Summary: Takes the events received since the previous call.
+
+    Return Value:
+        Number of events of the frame.
+    ************************************************/
+    int Update()
+    {
+        int i;
+        for (i = 0; i < KeyCount; ++i)
+            m_Keys[i] &= KS_PRESSED;
+        for (i = 0; i < ButtonCount; ++i)
+            m_Buttons[i] &= KS_PRESSED;
+        memset(m_KeyPresses, 0, sizeof(m_KeyPresses));
+        memset(m_ButtonPresses, 0, sizeof(m_ButtonPresses));
+        m_Motion.Set(0.0f, 0.0f, 0.0f);
+        m_Events.Resize(0);
+
+        m_FrameTime = GetTime();
+        m_Dropped = m_Queue.GetDroppedCount();
+        CKInputEvent e;
+        while (m_Queue.Pop(e))
+        {
+            m_Events.PushBack(e);
+            switch (e.m_Type)
+            {
+            case CK_INPUTEVENT_KEYDOWN:
+                // the repeats of a held key are not presses
+                if (!(m_Keys[e.m_Code] & KS_PRESSED))
+                {
+                    if (!m_KeyPresses[e.m_Code])
+                        m_KeyStamps[e.m_Code] = e.m_Time;
+                    if (m_KeyPresses[e.m_Code] < 255)
+                        ++m_KeyPresses[e.m_Code];
+                    m_Keys[e.m_Code] |= KS_PRESSED | Pressed;
+                }
+                break;
+            case CK_INPUTEVENT_KEYUP:
+                if (m_Keys[e.m_Code] & KS_PRESSED)
+                    m_Keys[e.m_Code] = (CKBYTE)((m_Keys[e.m_Code] & ~KS_PRESSED) | Released);
+                break;
+            case CK_INPUTEVENT_MOUSEDOWN:
+                if (e.m_Code < ButtonCount && !(m_Buttons[e.m_Code] & KS_PRESSED))
+                {
+                    if (m_ButtonPresses[e.m_Code] < 255)
+                        ++m_ButtonPresses[e.m_Code];
+                    m_Buttons[e.m_Code] |= KS_PRESSED | Pressed;
+                }
+                break;
+            case CK_INPUTEVENT_MOUSEUP:
+                if (e.m_Code < ButtonCount && (m_Buttons[e.m_Code] & KS_PRESSED))
+                    m_Buttons[e.m_Code] = (CKBYTE)((m_Buttons[e.m_Code] & ~KS_PRESSED) | Released);
+                break;
+            case CK_INPUTEVENT_MOUSEMOVE:
+                m_Motion.x += (float)e.m_X;
+                m_Motion.y += (float)e.m_Y;
+                break;
+            case CK_INPUTEVENT_MOUSEWHEEL:
+                m_Motion.z += (float)e.m_Y;
+                break;
+            }
+        }
+        return m_Events.Size();
+    }
+
+    //---------------------------------------------
+    // States of the frame
+
+    CKBOOL IsKeyDown(CKDWORD key) const { return (m_Keys[key & 0xFF] & KS_PRESSED) != 0; }
+    CKBOOL IsKeyUp(CKDWORD key) const { return !IsKeyDown(key); }
+
+    // Pressed since the previous frame, even if already released. oStamp receives the time of the first press.
+    CKBOOL IsKeyToggled(CKDWORD key, float *oStamp = NULL) const
+    {
+        key &= 0xFF;
+        if (!(m_Keys[key] & Pressed))
+            return FALSE;
+        if (oStamp)
+            *oStamp = m_KeyStamps[key];
+        return TRUE;
+    }
+    CKBOOL IsKeyReleased(CKDWORD key) const { return (m_Keys[key & 0xFF] & Released) != 0; }
+    int GetPressCount(CKDWORD key) const { return m_KeyPresses[key & 0xFF]; }
+
+    CKBOOL IsMouseButtonDown(CK_MOUSEBUTTON button) const { return (int)button < (int)ButtonCount && (m_Buttons[button] & KS_PRESSED); }
+    // Pressed since the previous frame, even if already released.
+    CKBOOL IsMouseClicked(CK_MOUSEBUTTON button) const { return (int)button < (int)ButtonCount && (m_Buttons[button] & Pressed); }
+    // Released since the previous frame.
+    CKBOOL IsMouseToggled(CK_MOUSEBUTTON button) const { return (int)button < (int)ButtonCount && (m_Buttons[button] & Released); }
+    int GetClickCount(CK_MOUSEBUTTON button) const { return (int)button < (int)ButtonCount ? m_ButtonPresses[button] : 0; }
+
+    // Sum of the mouse displacements of the frame, the wheel in z.
+    void GetMouseRelativePosition(VxVector &oPosition) const { oPosition = m_Motion; }
+
+    //---------------------------------------------
+    // Events of the frame
+
+    int GetEventCount() const { return m_Events.Size(); }
+    const CKInputEvent &GetEvent(int i) const { return m_Events[i]; }
+
+    // Age in milliseconds of the oldest event of the frame, when Update took it.
+    float GetLatency() const { return m_Events.Size() ? m_FrameTime - m_Events[0].m_Time : 0.0f; }
+
+    // Events lost because the queue was full, the capacity should be increased.
+    int GetDroppedCount() const { return m_Dropped; }
+
+protected:
+    // besides KS_PRESSED, changes since the previous frame
+    enum
+    {
+        Pressed = 0x10,
+        Released = 0x20
+    };
+
+    VxSPSCQueue<CKInputEvent> m_Queue;
+    VxTimeProfiler m_Clock;
+    XArray<CKInputEvent> m_Events;
+    float m_FrameTime;
+    int m_Dropped;
+    CKBYTE m_Keys[KeyCount];
+    float m_KeyStamps[KeyCount];
+    CKBYTE m_KeyPresses[KeyCount];
+    CKBYTE m_Buttons[ButtonCount];
+    CKBYTE m_ButtonPresses[ButtonCount];
+    VxVector m_Motion;
+};
+
+#endif // CKINPUTSTREAM_H
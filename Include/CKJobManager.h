@@ -0,0 +1,78 @@
+#ifndef CKJOBMANAGER_H
+#define CKJOBMANAGER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "VxJobSystem.h"
+
+#define JOB_MANAGER_GUID CKGUID(0x5a1e7c03, 0x2d8f6b41)
+
+/****************************************************************
+Summary: Manager owning the VxJobSystem shared by the managers and building blocks of a context.
+
+Remarks:
+    o The manager is created and registered by the first call to Get, which
+    must come from the main thread (it takes part in the jobs as the owner
+    of the first deque), and deleted with the context.
+    o The workers stay alive for the whole life of the context, the jobs
+    started during a frame must be waited for before the end of the frame
+    (or before the objects they use are deleted).
+    o Before a reset or a clear of the context the manager waits until no
+    job is left.
+
+    VxJobSystem &jobs = CKJobManager::Get(context)->GetJobSystem();
+    jobs.ParallelFor(vertexCount, 512, SkinVertices, &data);
+
+See Also: VxJobSystem,VxParallelPool
+****************************************************************/
+class CKJobManager : public CKBaseManager
+{
+public:
+    // The job manager of the context, created on the first call (a negative workerCount uses one worker per processor but one).
+    static CKJobManager *Get(CKContext *context, int workerCount = -1, CKBOOL pinWorkers = FALSE)
+    {
+        CKJobManager *manager = (CKJobManager *)context->GetManagerByGuid(JOB_MANAGER_GUID);
+        if (!manager)
+            manager = new CKJobManager(context, workerCount, pinWorkers);
+        return manager;
+    }
+
+    ~CKJobManager() {}
+
+    VxJobSystem &GetJobSystem() { return m_Jobs; }
+
+    // Counter of the jobs which must be finished before a reset or a clear of the context (can be used by any manager).
+    VxJobCounter &GetFrameCounter() { return m_FrameCounter; }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR OnCKReset()
+    {
+        m_Jobs.WaitForCounter(&m_FrameCounter);
+        return CK_OK;
+    }
+
+    virtual CKERROR PreClearAll()
+    {
+        m_Jobs.WaitForCounter(&m_FrameCounter);
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_OnCKReset |
+               CKMANAGER_FUNC_PreClearAll;
+    }
+
+protected:
+    CKJobManager(CKContext *context, int workerCount, CKBOOL pinWorkers) : CKBaseManager(context, JOB_MANAGER_GUID, "Job Manager"), m_Jobs(workerCount, pinWorkers)
+    {
+        context->RegisterNewManager(this);
+    }
+
+    VxJobSystem m_Jobs;
+    VxJobCounter m_FrameCounter;
+};
+
+#endif // CKJOBMANAGER_H
@@ -0,0 +1,187 @@
+#ifndef CKLARGEINDEXBUFFER_H
+#define CKLARGEINDEXBUFFER_H
+
+#include "CKRenderContext.h"
+#include "CKVertexBuffer.h"
+#include "XArray.h"
+
+/****************************************************************
+Summary: Triangle list with 32-bit indices drawn from a single vertex buffer of more than 65535 vertices.
+
+Remarks:
+    o CKVertexBuffer::Draw and CKRenderContext::DrawPrimitive only take
+    WORD indices, but the indices given to CKVertexBuffer::Draw are
+    relative to its StartVertex argument and a vertex buffer can hold
+    more than 65536 vertices. Build cuts the triangles in segments whose
+    vertices span at most 65536 consecutive vertices and stores the
+    indices of each segment as WORD relative to its first vertex. Draw
+    then draws the segments from the same vertex buffer: the vertices are
+    not duplicated or split in several buffers, and the split is done once
+    instead of every time the mesh is drawn.
+    o With sortFaces, the triangles are sorted by their smallest index
+    before being cut, which keeps the segments few when the triangles are
+    not ordered like their vertices. A grid (terrain) of width w with its
+    triangles in row order gives about w * h / 65536 segments either way.
+    o A triangle whose own vertices are more than 65535 apart can not be
+    drawn with WORD indices and is skipped (GetSkippedFaceCount).
+
+    CKLargeIndexBuffer faces;
+    faces.Build(indices, indexCount, TRUE);
+    ...
+    if (vb->Check(dev, vertexCount, CKRST_DP_TR_CL_VNT) == CK_VB_LOST)
+        ... // fill the vertices
+    faces.Draw(dev, vb);
+
+See Also: CKVertexBuffer::Draw,CKRenderManager::CreateVertexBuffer
+****************************************************************/
+class CKLargeIndexBuffer
+{
+public:
+    enum
+    {
+        MaxSegmentVertices = 0x10000
+    };
+
+    CKLargeIndexBuffer() : m_FaceCount(0), m_Skipped(0) {}
+
+    /*************************************************
+    Summary: Cuts a triangle list in segments drawable with WORD indices.
+
+    Arguments:
+        indices: Three vertex indices per triangle.
+        indexCount: Number of indices.
+        sortFaces: TRUE to sort the triangles by their first vertex before cutting them.
+    Return Value:
+        Number of segments.
+    *************************************************/
+    int Build(const CKDWORD *indices, int indexCount, CKBOOL sortFaces = FALSE)
+    {
+        Clear();
+        const int faceCount = indexCount / 3;
+
+        XArray<FaceEntry> faces;
+        faces.Reserve(faceCount);
+        int i;
+        for (i = 0; i < faceCount; ++i)
+        {
+            const CKDWORD *f = indices + i * 3;
+            FaceEntry e;
+            e.m_Min = XMin(f[0], XMin(f[1], f[2]));
+            e.m_Max = XMax(f[0], XMax(f[1], f[2]));
+            e.m_Face = i;
+            if (e.m_Max - e.m_Min >= MaxSegmentVertices)
+            {
+                ++m_Skipped;
+                continue;
+            }
+            faces.PushBack(e);
+        }
+        if (sortFaces)
+            faces.Sort(CompareFaces);
+
+        // the segments are grown while the span of their vertices fits in a WORD
+        m_Indices.Reserve(faces.Size() * 3);
+        int first = 0;
+        while (first < faces.Size())
+        {
+            CKDWORD lo = faces[first].m_Min;
+            CKDWORD hi = faces[first].m_Max;
+            int last = first + 1;
+            for (; last < faces.Size(); ++last)
+            {
+                const CKDWORD l = XMin(lo, faces[last].m_Min);
+                const CKDWORD h = XMax(hi, faces[last].m_Max);
+                if (h - l >= MaxSegmentVertices)
+                    break;
+                lo = l;
+                hi = h;
+            }
+
+            Segment s;
+            s.m_StartVertex = lo;
+            s.m_VertexCount = hi - lo + 1;
+            s.m_FirstIndex = m_Indices.Size();
+            s.m_IndexCount = (last - first) * 3;
+            for (i = first; i < last; ++i)
+            {
+                const CKDWORD *f = indices + faces[i].m_Face * 3;
+                m_Indices.PushBack((CKWORD)(f[0] - lo));
+                m_Indices.PushBack((CKWORD)(f[1] - lo));
+                m_Indices.PushBack((CKWORD)(f[2] - lo));
+            }
+            m_Segments.PushBack(s);
+            first = last;
+        }
+        m_FaceCount = faces.Size();
+        return m_Segments.Size();
+    }
+
+    /*************************************************
+    Summary: Draws the triangles from a vertex buffer.
+
+    Arguments:
+        dev: Render context to draw on.
+        vb: Vertex buffer holding the vertices indexed by the indices given to Build, checked (CKVertexBuffer::Check) for dev.
+    Return Value:
+        FALSE if one of the segments could not be drawn.
+    *************************************************/
+    CKBOOL Draw(CKRenderContext *dev, CKVertexBuffer *vb)
+    {
+        CKBOOL ok = TRUE;
+        for (int i = 0; i < m_Segments.Size(); ++i)
+        {
+            const Segment &s = m_Segments[i];
+            if (!vb->Draw(dev, VX_TRIANGLELIST, m_Indices.Begin() + s.m_FirstIndex, s.m_IndexCount, s.m_StartVertex, s.m_VertexCount))
+                ok = FALSE;
+        }
+        return ok;
+    }
+
+    void Clear()
+    {
+        m_Segments.Resize(0);
+        m_Indices.Resize(0);
+        m_FaceCount = 0;
+        m_Skipped = 0;
+    }
+
+    // Number of draw calls done by Draw.
+    int GetSegmentCount() const { return m_Segments.Size(); }
+
+    int GetFaceCount() const { return m_FaceCount; }
+
+    // Triangles spanning more than 65536 vertices, not drawn.
+    int GetSkippedFaceCount() const { return m_Skipped; }
+
+protected:
+    struct FaceEntry
+    {
+        CKDWORD m_Min;
+        CKDWORD m_Max;
+        int m_Face;
+    };
+
+    struct Segment
+    {
+        CKDWORD m_StartVertex;
+        CKDWORD m_VertexCount;
+        int m_FirstIndex;
+        int m_IndexCount;
+    };
+
+    static int CompareFaces(const void *a, const void *b)
+    {
+        const FaceEntry *f1 = (const FaceEntry *)a;
+        const FaceEntry *f2 = (const FaceEntry *)b;
+        if (f1->m_Min != f2->m_Min)
+            return (f1->m_Min < f2->m_Min) ? -1 : 1;
+        return f1->m_Face - f2->m_Face;
+    }
+
+    XArray<Segment> m_Segments;
+    XArray<CKWORD> m_Indices;
+    int m_FaceCount;
+    int m_Skipped;
+};
+
+#endif // CKLARGEINDEXBUFFER_H
@@ -0,0 +1,383 @@
+#ifndef CKLIGHTGRID_H
+#define CKLIGHTGRID_H
+
+#include <math.h>
+#include <string.h>
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKGlobals.h"
+#include "CKRenderContext.h"
+#include "CKCamera.h"
+#include "CKLight.h"
+#include "XArray.h"
+
+#define LIGHT_GRID_GUID CKGUID(0x19c6f2a8, 0x6e5b3d07)
+
+/****************************************************************
+Summary: Lights binned in a view space cluster grid each frame, giving the lights reaching an object without testing all of them.
+
+Remarks:
+    o Before each rendering (OnPreRender) the view frustum of the camera of
+    the render context is cut in tiles (SetGridSize: X by Y tiles, Z slices
+    of exponential depth) and each active point or spot light is added to
+    the clusters its range sphere overlaps. Directional lights reach
+    everything and are kept apart.
+    o GetLights gives the lights of a bounding sphere: it reads the clusters
+    the sphere overlaps and tests the range of the lights found, so its
+    cost depends on the lights near the object and not on the number of
+    lights in the scene. It is meant for the code choosing lights itself
+    (shaders, custom render callbacks, lighting of sprites or particles).
+    o With SetCullLights(TRUE), the point and spot lights whose range does
+    not reach the view frustum are deactivated while the render context is
+    rendered and activated again after (OnPostRender): the render engine,
+    which tests every active light for every object, only sees the lights
+    which can light something visible.
+    o The grid is built for the last render context rendered, from the
+    camera attached to it. Without a camera, the lights are not binned and
+    GetLights returns every active light.
+
+    CKLightGrid *grid = CKLightGrid::Get(context);
+    grid->SetCullLights(TRUE);
+    ...
+    XArray<CKLight *> lights;
+    grid->GetLights(center, radius, lights);
+
+See Also: CKLight,CKRenderCuller,CKRenderContext::GetAttachedCamera
+****************************************************************/
+class CKLightGrid : public CKBaseManager
+{
+public:
+    // The grid of the context, created on the first call.
+    static CKLightGrid *Get(CKContext *context)
+    {
+        CKLightGrid *grid = (CKLightGrid *)context->GetManagerByGuid(LIGHT_GRID_GUID);
+        if (!grid)
+            grid = new CKLightGrid(context);
+        return grid;
+    }
+
+    ~CKLightGrid() {}
+
+    void SetGridSize(int x, int y, int z)
+    {
+        m_SizeX = XMax(x, 1);
+        m_SizeY = XMax(y, 1);
+        m_SizeZ = XMax(z, 1);
+    }
+
+    // Deactivates the lights out of the view while rendering.
+    void SetCullLights(CKBOOL cull) { m_CullLights = cull; }
+    CKBOOL GetCullLights() const { return m_CullLights; }
+
+    // Lights binned in the last build, directional ones excluded.
+    int GetBinnedLightCount() const { return m_Binned; }
+
+    // Lights deactivated for the last rendering.
+    int GetCulledLightCount() const { return m_Culled.Size(); }
+
+    /*************************************************
+    Summary: Gets the lights reaching a sphere.
+
+    Arguments:
+        center: Center of the sphere in world coordinates.
+        radius: Radius of the sphere.
+        lights: Filled with the directional lights and the lights whose range reaches the sphere.
+    Return Value:
+        Number of lights.
+    *************************************************/
+    int GetLights(const VxVector &center, float radius, XArray<CKLight *> &lights)
+    {
+        lights.Resize(0);
+        for (int i = 0; i < m_Lights.Size(); ++i)
+            if (m_Lights[i].m_Directional)
+                lights.PushBack(m_Lights[i].m_Light);
+
+        if (!m_Valid)
+        {
+            for (int i = 0; i < m_Lights.Size(); ++i)
+                if (!m_Lights[i].m_Directional && Reaches(m_Lights[i], center, radius))
+                    lights.PushBack(m_Lights[i].m_Light);
+            return lights.Size();
+        }
+
+        int x0, x1, y0, y1, z0, z1;
+        VxVector c;
+        Vx3DMultiplyMatrixVector(&c, m_View, &center);
+        if (!GetClusterRange(c, radius, x0, x1, y0, y1, z0, z1))
+            return lights.Size();
+
+        ++m_Stamp;
+        for (int z = z0; z <= z1; ++z)
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                {
+                    const int cluster = (z * m_SizeY + y) * m_SizeX + x;
+                    for (int k = m_Offsets[cluster]; k < m_Offsets[cluster + 1]; ++k)
+                    {
+                        LightEntry &e = m_Lights[m_Indices[k]];
+                        if (e.m_Stamp == m_Stamp)
+                            continue;
+                        e.m_Stamp = m_Stamp;
+                        if (Reaches(e, center, radius))
+                            lights.PushBack(e.m_Light);
+                    }
+                }
+        return lights.Size();
+    }
+
+    // Bins the lights for the camera of a render context (done by OnPreRender).
+    void Build(CKRenderContext *dev)
+    {
+        GatherLights();
+        CKCamera *cam = dev ? dev->GetAttachedCamera() : NULL;
+        m_Valid = cam != NULL;
+        m_Binned = 0;
+        if (!m_Valid)
+            return;
+
+        m_View = cam->GetInverseWorldMatrix();
+        int width = 4, height = 3;
+        cam->GetAspectRatio(width, height);
+        m_Near = XMax(cam->GetFrontPlane(), 0.001f);
+        m_Far = XMax(cam->GetBackPlane(), m_Near * 1.001f);
+        m_TanX = tanf(cam->GetFov() * 0.5f);
+        m_TanY = m_TanX * (width ? (float)height / (float)width : 1.0f);
+        m_LogDepth = m_SizeZ / logf(m_Far / m_Near);
+
+        // counts, then offsets, then indices
+        const int clusterCount = m_SizeX * m_SizeY * m_SizeZ;
+        m_Offsets.Resize(clusterCount + 1);
+        memset(m_Offsets.Begin(), 0, m_Offsets.Size() * sizeof(int));
+        int i;
+        for (i = 0; i < m_Lights.Size(); ++i)
+        {
+            LightEntry &e = m_Lights[i];
+            e.m_Visible = e.m_Directional;
+            if (e.m_Directional)
+                continue;
+            VxVector c;
+            Vx3DMultiplyMatrixVector(&c, m_View, &e.m_Center);
+            if (!GetClusterRange(c, e.m_Range, e.m_X0, e.m_X1, e.m_Y0, e.m_Y1, e.m_Z0, e.m_Z1))
+                continue;
+            e.m_Visible = TRUE;
+            ++m_Binned;
+            for (int z = e.m_Z0; z <= e.m_Z1; ++z)
+                for (int y = e.m_Y0; y <= e.m_Y1; ++y)
+                    for (int x = e.m_X0; x <= e.m_X1; ++x)
+                        ++m_Offsets[(z * m_SizeY + y) * m_SizeX + x];
+        }
+        int total = 0;
+        for (i = 0; i <= clusterCount; ++i)
+        {
+            const int count = m_Offsets[i];
+            m_Offsets[i] = total;
+            total += count;
+        }
+        m_Indices.Resize(total);
+        // m_Offsets[c] is used as the insertion point of cluster c and ends at the start of c + 1
+        for (i = 0; i < m_Lights.Size(); ++i)
+        {
+            const LightEntry &e = m_Lights[i];
+            if (!e.m_Visible || e.m_Directional)
+                continue;
+            for (int z = e.m_Z0; z <= e.m_Z1; ++z)
+                for (int y = e.m_Y0; y <= e.m_Y1; ++y)
+                    for (int x = e.m_X0; x <= e.m_X1; ++x)
+                        m_Indices[m_Offsets[(z * m_SizeY + y) * m_SizeX + x]++] = i;
+        }
+        for (i = clusterCount; i > 0; --i)
+            m_Offsets[i] = m_Offsets[i - 1];
+        m_Offsets[0] = 0;
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR OnPreRender(CKRenderContext *dev)
+    {
+        Build(dev);
+        if (m_CullLights && m_Valid)
+        {
+            for (int i = 0; i < m_Lights.Size(); ++i)
+            {
+                if (m_Lights[i].m_Visible)
+                    continue;
+                m_Lights[i].m_Light->Active(FALSE);
+                m_Culled.PushBack(m_Lights[i].m_Light->GetID());
+            }
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR OnPostRender(CKRenderContext *dev)
+    {
+        Restore();
+        return CK_OK;
+    }
+
+    virtual CKERROR PreClearAll()
+    {
+        Restore();
+        m_Lights.Resize(0);
+        m_Valid = FALSE;
+        return CK_OK;
+    }
+
+    virtual CKERROR PostClearAll()
+    {
+        // classes may have been registered by the plugins loaded since
+        m_LightClasses.Resize(0);
+        return CK_OK;
+    }
+
+    virtual CKERROR SequenceToBeDeleted(CK_ID *objids, int count)
+    {
+        // the light pointers are gathered again at the next rendering
+        m_Lights.Resize(0);
+        m_Valid = FALSE;
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_OnPreRender |
+               CKMANAGER_FUNC_OnPostRender |
+               CKMANAGER_FUNC_PreClearAll |
+               CKMANAGER_FUNC_PostClearAll |
+               CKMANAGER_FUNC_OnSequenceToBeDeleted;
+    }
+
+protected:
+    struct LightEntry
+    {
+        CKLight *m_Light;
+        VxVector m_Center;
+        float m_Range;
+        CKBOOL m_Directional;
+        CKBOOL m_Visible;
+        int m_Stamp;
+        int m_X0, m_X1, m_Y0, m_Y1, m_Z0, m_Z1;
+    };
+
+    CKLightGrid(CKContext *context) : CKBaseManager(context, LIGHT_GRID_GUID, "Light Grid"),
+                                      m_SizeX(16), m_SizeY(8), m_SizeZ(24), m_CullLights(FALSE), m_Valid(FALSE),
+                                      m_Binned(0), m_Stamp(0), m_Near(1.0f), m_Far(100.0f), m_TanX(1.0f), m_TanY(1.0f), m_LogDepth(1.0f)
+    {
+        context->RegisterNewManager(this);
+    }
+
+    void GatherLights()
+    {
+        if (m_LightClasses.Size() == 0)
+        {
+            const int classCount = CKGetClassCount();
+            for (CK_CLASSID cid = 0; cid < classCount; ++cid)
+                if (CKIsChildClassOf(cid, CKCID_LIGHT))
+                    m_LightClasses.PushBack(cid);
+        }
+        m_Lights.Resize(0);
+        for (CK_CLASSID *cid = m_LightClasses.Begin(); cid != m_LightClasses.End(); ++cid)
+        {
+            const int count = m_Context->GetObjectsCountByClassID(*cid);
+            CK_ID *ids = m_Context->GetObjectsListByClassID(*cid);
+            for (int i = 0; i < count; ++i)
+            {
+                CKLight *light = (CKLight *)m_Context->GetObject(ids[i]);
+                if (!light || !light->GetActivity() || !light->IsVisible())
+                    continue;
+                LightEntry e;
+                e.m_Light = light;
+                const VxMatrix &mat = light->GetWorldMatrix();
+                e.m_Center = VxVector(mat[3][0], mat[3][1], mat[3][2]);
+                e.m_Range = light->GetRange();
+                e.m_Directional = light->GetType() == VX_LIGHTDIREC;
+                e.m_Visible = FALSE;
+                e.m_Stamp = 0;
+                e.m_X0 = e.m_X1 = e.m_Y0 = e.m_Y1 = e.m_Z0 = e.m_Z1 = 0;
+                m_Lights.PushBack(e);
+            }
+        }
+    }
+
+    static CKBOOL Reaches(const LightEntry &e, const VxVector &center, float radius)
+    {
+        const float d = e.m_Range + radius;
+        return SquareMagnitude(e.m_Center - center) <= d * d;
+    }
+
+    // Clusters overlapped by a sphere given in view space, FALSE if it is out of the frustum.
+    CKBOOL GetClusterRange(const VxVector &c, float r, int &x0, int &x1, int &y0, int &y1, int &z0, int &z1) const
+    {
+        float zmin = c.z - r;
+        const float zmax = c.z + r;
+        if (zmax < m_Near || zmin > m_Far)
+            return FALSE;
+        zmin = XMax(zmin, m_Near);
+
+        // extreme projections of the box of the sphere (x / z is monotonic in z for a given x)
+        const float xmin = c.x - r, xmax = c.x + r;
+        const float ymin = c.y - r, ymax = c.y + r;
+        const float nx0 = xmin / ((xmin < 0.0f ? zmin : zmax) * m_TanX);
+        const float nx1 = xmax / ((xmax > 0.0f ? zmin : zmax) * m_TanX);
+        const float ny0 = ymin / ((ymin < 0.0f ? zmin : zmax) * m_TanY);
+        const float ny1 = ymax / ((ymax > 0.0f ? zmin : zmax) * m_TanY);
+        if (nx0 > 1.0f || nx1 < -1.0f || ny0 > 1.0f || ny1 < -1.0f)
+            return FALSE;
+
+        x0 = ToCell(nx0, m_SizeX);
+        x1 = ToCell(nx1, m_SizeX);
+        y0 = ToCell(ny0, m_SizeY);
+        y1 = ToCell(ny1, m_SizeY);
+        z0 = ToSlice(zmin);
+        z1 = ToSlice(XMin(zmax, m_Far));
+        return TRUE;
+    }
+
+    static int ToCell(float n, int size)
+    {
+        const int cell = (int)((n + 1.0f) * 0.5f * size);
+        return XMax(0, XMin(cell, size - 1));
+    }
+
+    int ToSlice(float z) const
+    {
+        const int slice = (int)(logf(z / m_Near) * m_LogDepth);
+        return XMax(0, XMin(slice, m_SizeZ - 1));
+    }
+
+    void Restore()
+    {
+        for (int i = 0; i < m_Culled.Size(); ++i)
+        {
+            CKLight *light = (CKLight *)m_Context->GetObject(m_Culled[i]);
+            if (light)
+                light->Active(TRUE);
+        }
+        m_Culled.Resize(0);
+    }
+
+    int m_SizeX;
+    int m_SizeY;
+    int m_SizeZ;
+    CKBOOL m_CullLights;
+    CKBOOL m_Valid;
+    int m_Binned;
+    int m_Stamp;
+
+    // view of the last build
+    VxMatrix m_View;
+    float m_Near;
+    float m_Far;
+    float m_TanX;
+    float m_TanY;
+    float m_LogDepth;
+
+    XArray<CK_CLASSID> m_LightClasses;
+    XArray<LightEntry> m_Lights;
+    XArray<int> m_Offsets; // first index of each cluster, and the end of the last one
+    XArray<int> m_Indices; // lights of the clusters
+    XArray<CK_ID> m_Culled;
+};
+
+#endif // CKLIGHTGRID_H
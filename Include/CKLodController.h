@@ -0,0 +1,395 @@
+#ifndef CKLODCONTROLLER_H
+#define CKLODCONTROLLER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKAttributeManager.h"
+#include "CK3dEntity.h"
+#include "CKCamera.h"
+#include "CKMesh.h"
+#include "CKRenderCuller.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Chooses the level of detail of the entities from their screen size, within a triangle budget.
+
+Remarks:
+    o Two kinds of entities are handled: the entities whose current mesh is
+    a progressive mesh (CKMesh::CreatePM), whose number of rendered vertices
+    is set with SetVerticesRendered, and the entities with the "LOD Chain"
+    attribute, whose meshes (CK3dEntity::GetMesh) are the levels of a
+    discrete chain, the current mesh being changed with SetCurrentMesh.
+    o The error of a mesh of n vertices is taken as the spacing of n
+    vertices spread on its bounding sphere (3.5 r / sqrt(n)). Update
+    projects it on the screen and gives each visible entity the number of
+    vertices keeping that error under the tolerance (1 pixel by default).
+    o When the visible entities need more triangles than the budget, the
+    tolerance of all the entities is raised by the same factor until they
+    fit, so the quality degrades evenly under load. The factor goes back
+    down slowly when the load drops.
+    o A level is changed only when the needed vertex count differs from the
+    current one by more than the hysteresis (15% by default), which
+    avoids the popping of the objects at the distance where two levels
+    are equal. The geomorphing of the progressive meshes is enabled when
+    they are added.
+    o A progressive mesh used by several entities is rendered with the
+    vertex count of its most detailed entity.
+
+    CKLodController lod(ctx, dev, 300000);
+    lod.AddEntities(ctx->GetObjectListByType(CKCID_3DENTITY, TRUE), TRUE);
+    ...
+    // each frame, before rendering
+    lod.Update();
+
+See Also: CKMesh::CreatePM,CKMesh::SetVerticesRendered,CK3dEntity::SetCurrentMesh
+****************************************************************/
+class CKLodController
+{
+public:
+    enum
+    {
+        MaxLevels = 8 // meshes of a discrete chain
+    };
+
+    CKLodController(CKContext *ctx, CKRenderContext *dev, int triangleBudget = 200000, float tolerance = 1.0f)
+        : m_Context(ctx), m_Dev(dev), m_Budget(triangleBudget), m_Tolerance(tolerance), m_Hysteresis(0.15f),
+          m_MinVertices(16), m_GeoMorph(TRUE), m_Scale(1.0f), m_Triangles(0)
+    {
+        CKAttributeManager *am = ctx->GetAttributeManager();
+        m_ChainAttribute = am->GetAttributeTypeByName("LOD Chain");
+        if (m_ChainAttribute < 0)
+            m_ChainAttribute = am->RegisterNewAttributeType("LOD Chain", CKPGUID_NONE, CKCID_3DENTITY);
+    }
+
+    // Attribute marking the entities whose meshes are a discrete chain.
+    CKAttributeType GetLodChainAttribute() const { return m_ChainAttribute; }
+
+    void SetTriangleBudget(int triangles) { m_Budget = triangles; }
+    int GetTriangleBudget() const { return m_Budget; }
+
+    // Largest error on screen in pixels.
+    void SetTolerance(float pixels) { m_Tolerance = pixels > 0.01f ? pixels : 0.01f; }
+    float GetTolerance() const { return m_Tolerance; }
+
+    // Relative change of the vertex count needed to change a level.
+    void SetHysteresis(float ratio) { m_Hysteresis = ratio > 0.0f ? ratio : 0.0f; }
+
+    // Fewest vertices rendered for a progressive mesh.
+    void SetMinVertices(int count) { m_MinVertices = count; }
+
+    // Enables the geomorphing of the progressive meshes added afterwards.
+    void EnableGeoMorph(CKBOOL enable) { m_GeoMorph = enable; }
+
+    /************************************************
+    Summary: Adds an entity to the controller.
+
+    Arguments:
+        ent: An entity with the "LOD Chain" attribute and several meshes,
+        or whose current mesh is a progressive mesh.
+        createPM: TRUE to turn the current mesh into a progressive mesh if
+        it is not one.
+    Return Value:
+        FALSE if the entity has no levels of detail.
+    ************************************************/
+    CKBOOL AddEntity(CK3dEntity *ent, CKBOOL createPM = FALSE)
+    {
+        if (!ent || Find(ent) >= 0)
+            return FALSE;
+        Entry e;
+        memset(&e, 0, sizeof(e));
+        e.m_Entity = ent->GetID();
+        if (ent->HasAttribute(m_ChainAttribute) && ent->GetMeshCount() > 1)
+        {
+            if (!BuildChain(ent, e))
+                return FALSE;
+        }
+        else
+        {
+            CKMesh *mesh = ent->GetCurrentMesh();
+            if (!mesh || (!mesh->IsPM() && (!createPM || mesh->CreatePM() != CK_OK)))
+                return FALSE;
+            if (m_GeoMorph)
+                mesh->EnablePMGeoMorph(TRUE);
+            e.m_Mesh = mesh->GetID();
+            e.m_Vertices = mesh->GetVertexCount();
+            e.m_Faces = mesh->GetFaceCount();
+            e.m_Current = mesh->GetVerticesRendered();
+            if (e.m_Vertices <= 0)
+                return FALSE;
+        }
+        m_Entries.PushBack(e);
+        return TRUE;
+    }
+
+    // Adds the entities having levels of detail, returns the number added.
+    int AddEntities(const XObjectPointerArray &entities, CKBOOL createPM = FALSE)
+    {
+        int added = 0;
+        for (int i = 0; i < entities.Size(); ++i)
+        {
+            CKObject *obj = entities[i];
+            if (obj && CKIsChildClassOf(obj, CKCID_3DENTITY) && AddEntity((CK3dEntity *)obj, createPM))
+                ++added;
+        }
+        return added;
+    }
+
+    void RemoveEntity(CK3dEntity *ent)
+    {
+        const int i = Find(ent);
+        if (i >= 0)
+            m_Entries.RemoveAt(i);
+    }
+
+    void Clear() { m_Entries.Resize(0); }
+
+    int GetEntityCount() const { return m_Entries.Size(); }
+
+    /************************************************
+    Summary: Sets the levels of detail for the current viewpoint.
+
+    Return Value:
+        Number of triangles of the visible entities.
+    Remarks:
+        The levels of the entities out of the view frustum are not changed.
+    ************************************************/
+    int Update()
+    {
+        m_Triangles = 0;
+        CKRenderCuller view;
+        CKCamera *cam = m_Dev ? m_Dev->GetAttachedCamera() : NULL;
+        if (!cam || !view.SetView(m_Dev))
+            return 0;
+        const VxVector eye = *(const VxVector *)&cam->GetWorldMatrix()[3][0];
+        const float tanHalfFov = tanf(cam->GetFov() * 0.5f);
+        const float halfHeight = (float)m_Dev->GetHeight() * 0.5f;
+
+        int i;
+        for (i = m_Entries.Size() - 1; i >= 0; --i)
+        {
+            Entry &e = m_Entries[i];
+            CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(e.m_Entity);
+            if (!ent || ent->IsToBeDeleted())
+            {
+                m_Entries.RemoveAt(i);
+                continue;
+            }
+            e.m_Pixels = 0.0f;
+            if (!ent->IsVisible() || ent->IsHiddenByParent())
+                continue;
+            const VxBbox &box = ent->GetBoundingBox();
+            if (view.GetCuller().CullBox(box) == VxFrustumCuller::OUTSIDE)
+                continue;
+            const VxVector center = (box.Min + box.Max) * 0.5f;
+            const float radius = Magnitude(box.Max - box.Min) * 0.5f;
+            const float distance = Magnitude(center - eye);
+            // radius of the bounding sphere on screen, in pixels
+            e.m_Pixels = (distance > radius) ? radius * halfHeight / (distance * tanHalfFov) : halfHeight;
+        }
+
+        // the tolerance factor fitting the budget
+        float target = 1.0f;
+        if (m_Budget > 0 && CountTriangles(m_Tolerance) > m_Budget)
+        {
+            float lo = 1.0f, hi = 2.0f;
+            while (hi < 1024.0f && CountTriangles(m_Tolerance * hi) > m_Budget)
+            {
+                lo = hi;
+                hi *= 2.0f;
+            }
+            for (int k = 0; k < 8; ++k)
+            {
+                const float mid = (lo + hi) * 0.5f;
+                if (CountTriangles(m_Tolerance * mid) > m_Budget)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            target = hi;
+        }
+        // the detail drops at once under load and comes back over a few frames
+        m_Scale = (target >= m_Scale) ? target : XMax(target, m_Scale * 0.9f);
+
+        const float tolerance = m_Tolerance * m_Scale;
+        m_MeshVertices.Clear();
+        for (i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = m_Entries[i];
+            if (e.m_Pixels <= 0.0f)
+                continue;
+            const int needed = NeededVertices(e, tolerance);
+            if (e.m_LevelCount)
+                Apply(e, needed);
+            else
+                Apply(e, needed, m_MeshVertices);
+            m_Triangles += Triangles(e, e.m_Current);
+        }
+        for (XHashTable<int, CK_ID>::Iterator it = m_MeshVertices.Begin(); it != m_MeshVertices.End(); ++it)
+        {
+            CKMesh *mesh = (CKMesh *)m_Context->GetObject(it.GetKey());
+            if (mesh && mesh->GetVerticesRendered() != *it)
+                mesh->SetVerticesRendered(*it);
+        }
+        return m_Triangles;
+    }
+
+    // Triangles of the visible entities at the last Update.
+    int GetTriangleCount() const { return m_Triangles; }
+
+    // Factor applied to the tolerance to meet the budget, 1 when the budget is not reached.
+    float GetErrorScale() const { return m_Scale; }
+
+protected:
+    struct Entry
+    {
+        CK_ID m_Entity;
+        CK_ID m_Mesh; // progressive mesh
+        int m_Vertices;
+        int m_Faces;
+        int m_Current; // vertices rendered or index of the current level
+        float m_Pixels; // screen radius, 0 if not visible
+        int m_LevelCount;
+        CK_ID m_Levels[MaxLevels]; // from the most detailed
+        int m_LevelVertices[MaxLevels];
+        int m_LevelFaces[MaxLevels];
+    };
+
+    int Find(CK3dEntity *ent) const
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            if (m_Entries[i].m_Entity == ent->GetID())
+                return i;
+        }
+        return -1;
+    }
+
+    // The meshes of the entity sorted by decreasing vertex count.
+    CKBOOL BuildChain(CK3dEntity *ent, Entry &e)
+    {
+        CKMesh *current = ent->GetCurrentMesh();
+        const int count = XMin(ent->GetMeshCount(), (int)MaxLevels);
+        for (int i = 0; i < count; ++i)
+        {
+            CKMesh *mesh = ent->GetMesh(i);
+            if (!mesh || mesh->GetVertexCount() <= 0)
+                continue;
+            const int vertices = mesh->GetVertexCount();
+            int k = e.m_LevelCount++;
+            for (; k > 0 && e.m_LevelVertices[k - 1] < vertices; --k)
+            {
+                e.m_Levels[k] = e.m_Levels[k - 1];
+                e.m_LevelVertices[k] = e.m_LevelVertices[k - 1];
+                e.m_LevelFaces[k] = e.m_LevelFaces[k - 1];
+            }
+            e.m_Levels[k] = mesh->GetID();
+            e.m_LevelVertices[k] = vertices;
+            e.m_LevelFaces[k] = mesh->GetFaceCount();
+        }
+        e.m_Current = 0;
+        for (int l = 0; l < e.m_LevelCount; ++l)
+        {
+            if (current && e.m_Levels[l] == current->GetID())
+                e.m_Current = l;
+        }
+        return e.m_LevelCount > 1;
+    }
+
+    // Vertices keeping the error of the entity under the tolerance.
+    int NeededVertices(const Entry &e, float tolerance) const
+    {
+        const float n = 3.5f * e.m_Pixels / tolerance;
+        const float squared = n * n;
+        const int full = e.m_LevelCount ? e.m_LevelVertices[0] : e.m_Vertices;
+        return squared >= (float)full ? full : (int)squared + 1;
+    }
+
+    // Coarsest level having at least the given vertex count.
+    static int LevelFor(const Entry &e, int vertices)
+    {
+        int l = e.m_LevelCount - 1;
+        while (l > 0 && e.m_LevelVertices[l] < vertices)
+            --l;
+        return l;
+    }
+
+    int Triangles(const Entry &e, int current) const
+    {
+        if (e.m_LevelCount)
+            return e.m_LevelFaces[current];
+        return (int)((float)e.m_Faces * (float)current / (float)e.m_Vertices);
+    }
+
+    int RenderedVertices(const Entry &e, int needed) const
+    {
+        const int vertices = XMax(needed, XMin(m_MinVertices, e.m_Vertices));
+        return XMin(vertices, e.m_Vertices);
+    }
+
+    int CountTriangles(float tolerance) const
+    {
+        int triangles = 0;
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            const Entry &e = m_Entries[i];
+            if (e.m_Pixels <= 0.0f)
+                continue;
+            const int needed = NeededVertices(e, tolerance);
+            triangles += Triangles(e, e.m_LevelCount ? LevelFor(e, needed) : RenderedVertices(e, needed));
+        }
+        return triangles;
+    }
+
+    // Discrete chain: finer at once, coarser only past the hysteresis.
+    void Apply(Entry &e, int needed)
+    {
+        int level = LevelFor(e, needed);
+        if (level > e.m_Current)
+        {
+            level = LevelFor(e, (int)((float)needed * (1.0f + m_Hysteresis)));
+            if (level <= e.m_Current)
+                return;
+        }
+        if (level == e.m_Current)
+            return;
+        CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(e.m_Entity);
+        CKMesh *mesh = (CKMesh *)m_Context->GetObject(e.m_Levels[level]);
+        if (!mesh)
+            return;
+        ent->SetCurrentMesh(mesh, FALSE);
+        e.m_Current = level;
+    }
+
+    // Progressive mesh: changed when the vertex count is out of the hysteresis band.
+    void Apply(Entry &e, int needed, XHashTable<int, CK_ID> &meshVertices)
+    {
+        const int vertices = RenderedVertices(e, needed);
+        if ((float)vertices > (float)e.m_Current * (1.0f + m_Hysteresis) ||
+            (float)vertices * (1.0f + m_Hysteresis) < (float)e.m_Current || e.m_Current <= 0)
+            e.m_Current = vertices;
+        int *shared = meshVertices.FindPtr(e.m_Mesh);
+        if (!shared)
+            meshVertices.Insert(e.m_Mesh, e.m_Current, TRUE);
+        else if (*shared < e.m_Current)
+            *shared = e.m_Current;
+    }
+
+    CKContext *m_Context;
+    CKRenderContext *m_Dev;
+    CKAttributeType m_ChainAttribute;
+    int m_Budget;
+    float m_Tolerance;
+    float m_Hysteresis;
+    int m_MinVertices;
+    CKBOOL m_GeoMorph;
+    float m_Scale;
+    int m_Triangles;
+    XArray<Entry> m_Entries;
+    XHashTable<int, CK_ID> m_MeshVertices; // vertices rendered per progressive mesh
+
+private:
+    CKLodController(const CKLodController &);
+    CKLodController &operator=(const CKLodController &);
+};
+
+#endif // CKLODCONTROLLER_H
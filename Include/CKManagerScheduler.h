@@ -0,0 +1,367 @@
+#ifndef CKMANAGERSCHEDULER_H
+#define CKMANAGERSCHEDULER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKJobManager.h"
+
+#define MANAGER_SCHEDULER_GUID CKGUID(0x0e4d93a7, 0x5b2c61f8)
+
+/****************************************************************
+Summary: Runs the PreProcess and PostProcess of independent managers concurrently on the job system.
+
+Remarks:
+    o A manager takes part once its accesses are declared (Declare,
+    DeclareRead, DeclareWrite): resources are identified by CKGUID, the
+    GUID of another manager (its state) or any tag chosen by the
+    application. A manager always writes its own GUID. Declaring a manager
+    states that its PreProcess and PostProcess only touch the declared
+    resources and can run on any thread.
+    o Install replaces each run of consecutive declared managers of the
+    PreProcess and PostProcess lists of the context by one proxy. Each
+    frame the proxy runs a dependency graph of the run: a manager waits for
+    the managers before it in priority order which write what it reads or
+    writes, or read what it writes; the others run in parallel on the
+    VxJobSystem of CKJobManager, the main thread taking part.
+    o Managers which are not declared stay where they are and run alone on
+    the main thread, which keeps the order of the priorities across them.
+    o Update must be called once per frame, before CKContext::Process: it
+    builds the graphs again when the context rebuilt its lists (managers
+    registered or activated) or when declarations changed.
+    o Uninstall (or the destructor) must be called before the context is
+    closed: it puts the lists back.
+
+    CKManagerScheduler scheduler(context);
+    scheduler.DeclareRead(SOUND_MANAGER_GUID, CKGUID(0x7c2b1ea4, 0x3dd4a1a1)); // listener tag
+    scheduler.Declare(NETWORK_MANAGER_GUID);
+    scheduler.Install();
+    // each frame
+    scheduler.Update();
+    context->Process();
+
+See Also: CKJobManager,CKManagerTimer,CKBaseManager::GetFunctionPriority
+****************************************************************/
+class CKManagerScheduler
+{
+public:
+    enum
+    {
+        FunctionCount = 2
+    };
+
+    explicit CKManagerScheduler(CKContext *context) : m_Context(context), m_Jobs(NULL), m_Installed(FALSE), m_Dirty(TRUE) {}
+
+    ~CKManagerScheduler()
+    {
+        Uninstall();
+        for (int i = 0; i < m_Accesses.Size(); ++i)
+            delete m_Accesses[i];
+    }
+
+    //---------------------------------------------
+    // Declarations
+
+    // Declares a manager which only accesses its own state.
+    void Declare(CKGUID manager) { GetAccess(manager); }
+
+    void DeclareRead(CKGUID manager, CKGUID resource)
+    {
+        GetAccess(manager)->m_Reads.PushBack(resource);
+        m_Dirty = TRUE;
+    }
+
+    void DeclareWrite(CKGUID manager, CKGUID resource)
+    {
+        GetAccess(manager)->m_Writes.PushBack(resource);
+        m_Dirty = TRUE;
+    }
+
+    // The manager runs alone on the main thread again.
+    void Undeclare(CKGUID manager)
+    {
+        for (int i = 0; i < m_Accesses.Size(); ++i)
+        {
+            if (m_Accesses[i]->m_Manager == manager)
+            {
+                delete m_Accesses[i];
+                m_Accesses.RemoveAt(i);
+                m_Dirty = TRUE;
+                return;
+            }
+        }
+    }
+
+    CKBOOL IsDeclared(CKGUID manager) const { return FindAccess(manager) != NULL; }
+
+    //---------------------------------------------
+    // Installation
+
+    void Install()
+    {
+        // created now rather than during Process, registering a manager makes the context rebuild its lists
+        m_Jobs = &CKJobManager::Get(m_Context)->GetJobSystem();
+        m_Installed = TRUE;
+        m_Dirty = TRUE;
+        Update();
+    }
+
+    void Uninstall()
+    {
+        if (!m_Installed)
+            return;
+        for (int f = 0; f < FunctionCount; ++f)
+        {
+            // lists rebuilt by the context since do not contain the proxies anymore
+            if (Same(GetList(f), m_InstalledLists[f]))
+                GetList(f) = m_Originals[f];
+        }
+        DeleteProxies();
+        m_Installed = FALSE;
+    }
+
+    CKBOOL IsInstalled() const { return m_Installed; }
+
+    // Builds the graphs again if the lists of the context or the declarations changed.
+    void Update()
+    {
+        if (!m_Installed)
+            return;
+        CKBOOL rebuild = m_Dirty;
+        for (int f = 0; f < FunctionCount; ++f)
+            if (!Same(GetList(f), m_InstalledLists[f]))
+                rebuild = TRUE;
+        if (!rebuild)
+            return;
+
+        for (int f = 0; f < FunctionCount; ++f)
+        {
+            XArray<CKBaseManager *> &list = GetList(f);
+            if (!Same(list, m_InstalledLists[f]))
+                m_Originals[f] = list;
+        }
+        DeleteProxies();
+        for (int g = 0; g < FunctionCount; ++g)
+        {
+            Build(g);
+            m_InstalledLists[g] = GetList(g);
+        }
+        m_Dirty = FALSE;
+    }
+
+    // Number of managers run on worker threads in the PreProcess (0) or PostProcess (1) list.
+    int GetParallelManagerCount(int function) const
+    {
+        int count = 0;
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+            if (m_Proxies[i]->m_Function == function)
+                count += m_Proxies[i]->m_Nodes.Size();
+        return count;
+    }
+
+protected:
+    struct Access
+    {
+        CKGUID m_Manager;
+        XArray<CKGUID> m_Reads;
+        XArray<CKGUID> m_Writes; // the manager itself is implied
+    };
+
+    class Proxy;
+
+    struct NodeJob
+    {
+        Proxy *m_Proxy;
+        int m_Index;
+    };
+
+    struct Node
+    {
+        CKBaseManager *m_Manager;
+        XArray<int> m_Successors;
+        int m_Predecessors;
+        volatile long m_Remaining; // predecessors not finished this frame
+        NodeJob m_Arg;
+        VxJob m_Job;
+    };
+
+    // Runs the dependency graph of a run of declared managers.
+    class Proxy : public CKBaseManager
+    {
+    public:
+        Proxy(CKContext *context, VxJobSystem *jobs, int function, CKBaseManager *first)
+            : CKBaseManager(context, MANAGER_SCHEDULER_GUID, "Parallel Managers"), m_Function(function), m_Priority(first->GetFunctionPriority(function ? CKMANAGER_FUNC_PostProcess : CKMANAGER_FUNC_PreProcess)), m_Jobs(jobs), m_Error(CK_OK) {}
+
+        ~Proxy()
+        {
+            for (int i = 0; i < m_Nodes.Size(); ++i)
+                delete m_Nodes[i];
+        }
+
+        virtual CKERROR PreProcess() { return Run(); }
+        virtual CKERROR PostProcess() { return Run(); }
+        virtual CKDWORD GetValidFunctionsMask() { return m_Function ? CKMANAGER_FUNC_PostProcess : CKMANAGER_FUNC_PreProcess; }
+        virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function) { return m_Priority; }
+
+        CKERROR Run()
+        {
+            m_Error = CK_OK;
+            for (int i = 0; i < m_Nodes.Size(); ++i)
+                m_Nodes[i]->m_Remaining = m_Nodes[i]->m_Predecessors;
+            // the successors are started by the jobs of their predecessors
+            for (int j = 0; j < m_Nodes.Size(); ++j)
+                if (!m_Nodes[j]->m_Predecessors)
+                    m_Jobs->Run(&m_Nodes[j]->m_Job, 1, &m_Counter);
+            m_Jobs->WaitForCounter(&m_Counter);
+            return m_Error;
+        }
+
+        static void RunNode(void *arg)
+        {
+            NodeJob *job = (NodeJob *)arg;
+            Proxy *proxy = job->m_Proxy;
+            Node *node = proxy->m_Nodes[job->m_Index];
+            CKERROR err = proxy->m_Function ? node->m_Manager->PostProcess() : node->m_Manager->PreProcess();
+            if (err != CK_OK)
+                VxAtomicCompareExchange(&proxy->m_Error, err, CK_OK);
+            for (int i = 0; i < node->m_Successors.Size(); ++i)
+            {
+                Node *next = proxy->m_Nodes[node->m_Successors[i]];
+                if (VxAtomicDecrement(&next->m_Remaining) == 0)
+                    proxy->m_Jobs->Run(&next->m_Job, 1, &proxy->m_Counter);
+            }
+        }
+
+        int m_Function;
+        int m_Priority;
+        XArray<Node *> m_Nodes;
+        VxJobCounter m_Counter;
+        VxJobSystem *m_Jobs;
+        volatile long m_Error; // first error of the frame
+    };
+    friend class Proxy;
+
+    Access *GetAccess(CKGUID manager)
+    {
+        Access *access = FindAccess(manager);
+        if (!access)
+        {
+            access = new Access;
+            access->m_Manager = manager;
+            m_Accesses.PushBack(access);
+            m_Dirty = TRUE;
+        }
+        return access;
+    }
+
+    Access *FindAccess(CKGUID manager) const
+    {
+        for (int i = 0; i < m_Accesses.Size(); ++i)
+            if (m_Accesses[i]->m_Manager == manager)
+                return m_Accesses[i];
+        return NULL;
+    }
+
+    static CKBOOL Contains(const XArray<CKGUID> &resources, CKGUID guid)
+    {
+        for (int i = 0; i < resources.Size(); ++i)
+            if (resources[i] == guid)
+                return TRUE;
+        return FALSE;
+    }
+
+    static CKBOOL Writes(const Access *a, CKGUID guid) { return a->m_Manager == guid || Contains(a->m_Writes, guid); }
+
+    // TRUE if b writes something a reads or writes.
+    static CKBOOL WritesInto(const Access *a, const Access *b)
+    {
+        if (Writes(b, a->m_Manager))
+            return TRUE;
+        for (int i = 0; i < a->m_Reads.Size(); ++i)
+            if (Writes(b, a->m_Reads[i]))
+                return TRUE;
+        for (int j = 0; j < a->m_Writes.Size(); ++j)
+            if (Writes(b, a->m_Writes[j]))
+                return TRUE;
+        return FALSE;
+    }
+
+    static CKBOOL Conflict(const Access *a, const Access *b) { return WritesInto(a, b) || WritesInto(b, a); }
+
+    // Replaces the runs of declared managers of a list by proxies.
+    void Build(int f)
+    {
+        const XArray<CKBaseManager *> &managers = m_Originals[f];
+        XArray<CKBaseManager *> &list = GetList(f);
+        list.Resize(0);
+        for (int i = 0; i < managers.Size();)
+        {
+            int end = i;
+            while (end < managers.Size() && FindAccess(managers[end]->GetGuid()))
+                ++end;
+            if (end - i < 2)
+            {
+                // nothing to run in parallel
+                list.PushBack(managers[i]);
+                i = XMax(end, i + 1);
+                continue;
+            }
+
+            Proxy *proxy = new Proxy(m_Context, m_Jobs, f, managers[i]);
+            for (int n = i; n < end; ++n)
+            {
+                Node *node = new Node;
+                node->m_Manager = managers[n];
+                node->m_Predecessors = 0;
+                node->m_Remaining = 0;
+                node->m_Arg.m_Proxy = proxy;
+                node->m_Arg.m_Index = n - i;
+                node->m_Job = VxJob(Proxy::RunNode, &node->m_Arg);
+                const Access *a = FindAccess(managers[n]->GetGuid());
+                for (int p = i; p < n; ++p)
+                {
+                    if (Conflict(a, FindAccess(managers[p]->GetGuid())))
+                    {
+                        proxy->m_Nodes[p - i]->m_Successors.PushBack(n - i);
+                        ++node->m_Predecessors;
+                    }
+                }
+                proxy->m_Nodes.PushBack(node);
+            }
+            m_Proxies.PushBack(proxy);
+            list.PushBack(proxy);
+            i = end;
+        }
+    }
+
+    static CKBOOL Same(const XArray<CKBaseManager *> &a, const XArray<CKBaseManager *> &b)
+    {
+        return a.Size() == b.Size() && (!a.Size() || !memcmp(a.Begin(), b.Begin(), a.Size() * sizeof(CKBaseManager *)));
+    }
+
+    void DeleteProxies()
+    {
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+            delete m_Proxies[i];
+        m_Proxies.Resize(0);
+    }
+
+    XArray<CKBaseManager *> &GetList(int index)
+    {
+        return index ? m_Context->m_ManagersPostProcess : m_Context->m_ManagersPreProcess;
+    }
+
+    CKContext *m_Context;
+    VxJobSystem *m_Jobs;
+    CKBOOL m_Installed;
+    CKBOOL m_Dirty;
+    XArray<Access *> m_Accesses;
+    XArray<Proxy *> m_Proxies;
+    XArray<CKBaseManager *> m_Originals[FunctionCount];      // lists of the context without the proxies
+    XArray<CKBaseManager *> m_InstalledLists[FunctionCount]; // lists given to the context
+
+private:
+    CKManagerScheduler(const CKManagerScheduler &);
+    CKManagerScheduler &operator=(const CKManagerScheduler &);
+};
+
+#endif // CKMANAGERSCHEDULER_H
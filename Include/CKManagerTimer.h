@@ -0,0 +1,330 @@
+#ifndef CKMANAGERTIMER_H
+#define CKMANAGERTIMER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "VxTimeProfiler.h"
+
+/****************************************************************
+Summary: Time taken by the calls of one manager function.
+
+Remarks:
+    o m_Last is the total time of the calls during the last frame (a render
+    callback is called once per render context), m_Average its exponential
+    average and m_Max the longest frame over the last one or two windows of
+    frames (see CKManagerTimer). The times are in milliseconds.
+
+See Also: CKManagerTimer
+****************************************************************/
+struct CKManagerTiming
+{
+    int m_Calls;     // Total number of calls
+    float m_Last;    // Time during the last frame
+    float m_Average; // Rolling average per frame
+    float m_Max;     // Largest frame time in the recent frames
+
+    // recent maximum is max(m_WindowMax, m_PreviousMax)
+    float m_Frame;
+    float m_WindowMax;
+    float m_PreviousMax;
+};
+
+/****************************************************************
+Summary: Measures each manager in the per-frame dispatch loops of a context.
+
+Remarks:
+    o Install replaces the managers of the PreProcess, PostProcess,
+    OnPreRender, OnPostRender and OnPostSpriteRender lists of the context
+    with proxies that time the call and forward it to the manager: the
+    order and the priorities are unchanged, third-party managers are measured
+    without being modified.
+    o Update must be called once per frame, before CKContext::Process. It
+    closes the timings of the previous frame and wraps the managers
+    registered or activated since (the context rebuilds its lists then).
+    o The maximums are kept over windows of windowFrames frames: GetTiming
+    returns the largest frame of the current and previous windows, so a spike
+    is reported for one to two windows.
+    o Uninstall (or the destructor) must be called before the context is
+    closed: it puts the managers back and deletes the proxies.
+
+    CKManagerTimer timer(context);
+    timer.Install();
+    // each frame
+    timer.Update();
+    context->Process();
+    renderContext->Render();
+    ...
+    float worst;
+    CKBaseManager *bm = timer.GetSlowestManager(&worst);
+
+See Also: CKBaseManager::GetFunctionPriority,CKFrameProfiler,CKContext::GetProfileStats
+****************************************************************/
+class CKManagerTimer
+{
+public:
+    enum
+    {
+        FunctionCount = 5
+    };
+
+    CKManagerTimer(CKContext *context, int windowFrames = 120, float averageWeight = 0.05f)
+        : m_Context(context), m_Installed(FALSE), m_Window(XMax(windowFrames, 1)), m_WindowFrame(0), m_Weight(averageWeight) {}
+
+    ~CKManagerTimer() { Uninstall(); }
+
+    void Install()
+    {
+        m_Installed = TRUE;
+        Wrap();
+    }
+
+    void Uninstall()
+    {
+        if (!m_Installed)
+            return;
+        for (int f = 0; f < FunctionCount; ++f)
+        {
+            XArray<CKBaseManager *> &managers = GetList(f);
+            for (CKBaseManager **it = managers.Begin(); it != managers.End(); ++it)
+            {
+                Proxy *proxy = FindProxy(*it);
+                if (proxy)
+                    *it = proxy->m_Manager;
+            }
+        }
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+            delete m_Proxies[i];
+        m_Proxies.Resize(0);
+        m_Installed = FALSE;
+    }
+
+    CKBOOL IsInstalled() const { return m_Installed; }
+
+    // Closes the frame and wraps the managers added to the lists since the last call.
+    void Update()
+    {
+        if (!m_Installed)
+            return;
+        const CKBOOL newWindow = ++m_WindowFrame >= m_Window;
+        if (newWindow)
+            m_WindowFrame = 0;
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+        {
+            for (int f = 0; f < FunctionCount; ++f)
+            {
+                CKManagerTiming &t = m_Proxies[i]->m_Timings[f];
+                t.m_Last = t.m_Frame;
+                t.m_Average += (t.m_Frame - t.m_Average) * m_Weight;
+                if (t.m_Frame > t.m_WindowMax)
+                    t.m_WindowMax = t.m_Frame;
+                if (newWindow)
+                {
+                    t.m_PreviousMax = t.m_WindowMax;
+                    t.m_WindowMax = 0.0f;
+                }
+                t.m_Max = XMax(t.m_WindowMax, t.m_PreviousMax);
+                t.m_Frame = 0.0f;
+            }
+        }
+        Wrap();
+    }
+
+    //---------------------------------------------
+    // Results
+
+    int GetManagerCount() const { return m_Proxies.Size(); }
+    CKBaseManager *GetManager(int index) const { return m_Proxies[index]->m_Manager; }
+
+    // Function is one of PreProcess, PostProcess, OnPreRender, OnPostRender or OnPostSpriteRender.
+    const CKManagerTiming *GetTiming(CKBaseManager *bm, CKMANAGER_FUNCTIONS function) const
+    {
+        const int f = GetFunctionIndex(function);
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+            if (m_Proxies[i]->m_Manager == bm)
+                return f >= 0 ? &m_Proxies[i]->m_Timings[f] : NULL;
+        return NULL;
+    }
+
+    // Sum of the average frame times of the measured functions of a manager.
+    float GetAverageTime(CKBaseManager *bm) const
+    {
+        float total = 0.0f;
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+            if (m_Proxies[i]->m_Manager == bm)
+                for (int f = 0; f < FunctionCount; ++f)
+                    total += m_Proxies[i]->m_Timings[f].m_Average;
+        return total;
+    }
+
+    // The manager with the largest recent spike in one of its functions.
+    CKBaseManager *GetSlowestManager(float *maxTime = NULL, CKMANAGER_FUNCTIONS *function = NULL) const
+    {
+        CKBaseManager *slowest = NULL;
+        float worst = 0.0f;
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+        {
+            for (int f = 0; f < FunctionCount; ++f)
+            {
+                if (m_Proxies[i]->m_Timings[f].m_Max > worst)
+                {
+                    worst = m_Proxies[i]->m_Timings[f].m_Max;
+                    slowest = m_Proxies[i]->m_Manager;
+                    if (function)
+                        *function = GetFunction(f);
+                }
+            }
+        }
+        if (maxTime)
+            *maxTime = worst;
+        return slowest;
+    }
+
+    // Writes the average and maximum of each measured function to the console.
+    void Dump()
+    {
+        static const char *names[FunctionCount] = {"PreProcess", "PostProcess", "OnPreRender", "OnPostRender", "OnPostSpriteRender"};
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+        {
+            Proxy *proxy = m_Proxies[i];
+            for (int f = 0; f < FunctionCount; ++f)
+            {
+                const CKManagerTiming &t = proxy->m_Timings[f];
+                if (t.m_Calls)
+                    m_Context->OutputToConsoleEx((CKSTRING) "%s::%s : avg %.3f ms, max %.3f ms, %d calls", proxy->m_Manager->GetName(), names[f], t.m_Average, t.m_Max, t.m_Calls);
+            }
+        }
+    }
+
+protected:
+    class Proxy : public CKBaseManager
+    {
+    public:
+        Proxy(CKContext *context, CKBaseManager *bm) : CKBaseManager(context, bm->GetGuid(), bm->GetName()), m_Manager(bm)
+        {
+            memset(m_Timings, 0, sizeof(m_Timings));
+        }
+
+        virtual CKERROR PreProcess()
+        {
+            Timer t(m_Timings[0]);
+            return m_Manager->PreProcess();
+        }
+        virtual CKERROR PostProcess()
+        {
+            Timer t(m_Timings[1]);
+            return m_Manager->PostProcess();
+        }
+        virtual CKERROR OnPreRender(CKRenderContext *dev)
+        {
+            Timer t(m_Timings[2]);
+            return m_Manager->OnPreRender(dev);
+        }
+        virtual CKERROR OnPostRender(CKRenderContext *dev)
+        {
+            Timer t(m_Timings[3]);
+            return m_Manager->OnPostRender(dev);
+        }
+        virtual CKERROR OnPostSpriteRender(CKRenderContext *dev)
+        {
+            Timer t(m_Timings[4]);
+            return m_Manager->OnPostSpriteRender(dev);
+        }
+        virtual CKDWORD GetValidFunctionsMask() { return m_Manager->GetValidFunctionsMask(); }
+        virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function) { return m_Manager->GetFunctionPriority(Function); }
+
+        CKBaseManager *m_Manager;
+        CKManagerTiming m_Timings[FunctionCount];
+    };
+
+    // Adds the time of a call to the current frame.
+    class Timer
+    {
+    public:
+        Timer(CKManagerTiming &timing) : m_Timing(timing) {}
+        ~Timer()
+        {
+            m_Timing.m_Frame += m_Profiler.Current();
+            ++m_Timing.m_Calls;
+        }
+
+    protected:
+        CKManagerTiming &m_Timing;
+        VxTimeProfiler m_Profiler;
+    };
+
+    static int GetFunctionIndex(CKMANAGER_FUNCTIONS function)
+    {
+        switch (function)
+        {
+        case CKMANAGER_FUNC_PreProcess: return 0;
+        case CKMANAGER_FUNC_PostProcess: return 1;
+        case CKMANAGER_FUNC_OnPreRender: return 2;
+        case CKMANAGER_FUNC_OnPostRender: return 3;
+        case CKMANAGER_FUNC_OnPostSpriteRender: return 4;
+        default: return -1;
+        }
+    }
+
+    static CKMANAGER_FUNCTIONS GetFunction(int index)
+    {
+        static const CKMANAGER_FUNCTIONS functions[FunctionCount] = {CKMANAGER_FUNC_PreProcess, CKMANAGER_FUNC_PostProcess, CKMANAGER_FUNC_OnPreRender, CKMANAGER_FUNC_OnPostRender, CKMANAGER_FUNC_OnPostSpriteRender};
+        return functions[index];
+    }
+
+    XArray<CKBaseManager *> &GetList(int index)
+    {
+        switch (index)
+        {
+        case 0: return m_Context->m_ManagersPreProcess;
+        case 1: return m_Context->m_ManagersPostProcess;
+        case 2: return m_Context->m_ManagersOnPreRender;
+        case 3: return m_Context->m_ManagersOnPostRender;
+        default: return m_Context->m_ManagersOnPostSpriteRender;
+        }
+    }
+
+    Proxy *FindProxy(CKBaseManager *bm) const
+    {
+        for (int i = 0; i < m_Proxies.Size(); ++i)
+            if (m_Proxies[i] == bm)
+                return m_Proxies[i];
+        return NULL;
+    }
+
+    // Replaces the managers of the lists by their proxy, creating the missing ones.
+    void Wrap()
+    {
+        for (int f = 0; f < FunctionCount; ++f)
+        {
+            XArray<CKBaseManager *> &managers = GetList(f);
+            for (CKBaseManager **it = managers.Begin(); it != managers.End(); ++it)
+            {
+                if (FindProxy(*it))
+                    continue;
+                Proxy *proxy = NULL;
+                for (int i = 0; i < m_Proxies.Size(); ++i)
+                    if (m_Proxies[i]->m_Manager == *it)
+                        proxy = m_Proxies[i];
+                if (!proxy)
+                {
+                    proxy = new Proxy(m_Context, *it);
+                    m_Proxies.PushBack(proxy);
+                }
+                *it = proxy;
+            }
+        }
+    }
+
+    CKContext *m_Context;
+    CKBOOL m_Installed;
+    int m_Window;
+    int m_WindowFrame;
+    float m_Weight;
+    XArray<Proxy *> m_Proxies;
+
+private:
+    CKManagerTimer(const CKManagerTimer &);
+    CKManagerTimer &operator=(const CKManagerTimer &);
+};
+
+#endif // CKMANAGERTIMER_H
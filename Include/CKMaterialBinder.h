@@ -0,0 +1,260 @@
+#ifndef CKMATERIALBINDER_H
+#define CKMATERIALBINDER_H
+
+#include <string.h>
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "XArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Compiled render states of a material, as set by CKMaterial::SetAsCurrent.
+
+Remarks:
+    o Compile reads the properties of a material once (colors, blending,
+    z, alpha test, culling, fill, shade, texture filtering, addressing and
+    blend mode) in a flat block which can be compared to another block
+    without calling the material.
+    o Materials with an effect or a callback can not be compiled: they set
+    more than the properties of the block.
+
+See Also: CKMaterialBinder,CKMaterial::SetAsCurrent
+****************************************************************/
+struct CKMaterialStateBlock
+{
+    enum
+    {
+        STATE_SRCBLEND = 0,
+        STATE_DESTBLEND,
+        STATE_ALPHABLEND,
+        STATE_ZWRITE,
+        STATE_ZFUNC,
+        STATE_ALPHATEST,
+        STATE_ALPHAFUNC,
+        STATE_ALPHAREF,
+        STATE_TWOSIDED,
+        STATE_FILLMODE,
+        STATE_SHADEMODE,
+        STATE_PERSPECTIVE,
+        STATE_TEXBLEND,
+        STATE_TEXMIN,
+        STATE_TEXMAG,
+        STATE_TEXADDRESS,
+        STATE_TEXBORDER,
+        STATE_TEXTRANSPARENT,
+        STATE_COUNT
+    };
+
+    VxColor m_Diffuse;
+    VxColor m_Ambient;
+    VxColor m_Specular;
+    VxColor m_Emissive;
+    float m_Power;
+    CKDWORD m_States[STATE_COUNT];
+    CKTexture *m_Texture;
+    CKBOOL m_Valid;
+
+    CKMaterialStateBlock() : m_Power(0.0f), m_Texture(NULL), m_Valid(FALSE) { memset(m_States, 0, sizeof(m_States)); }
+
+    // Reads the material, returns FALSE if it can not be compiled.
+    CKBOOL Compile(CKMaterial *mat)
+    {
+        m_Valid = FALSE;
+        if (!mat || mat->GetEffect() != VXEFFECT_NONE || mat->GetCallback())
+            return FALSE;
+        m_Diffuse = mat->GetDiffuse();
+        m_Ambient = mat->GetAmbient();
+        m_Specular = mat->GetSpecular();
+        m_Emissive = mat->GetEmissive();
+        m_Power = mat->GetPower();
+        m_Texture = mat->GetTexture();
+        m_States[STATE_SRCBLEND] = mat->GetSourceBlend();
+        m_States[STATE_DESTBLEND] = mat->GetDestBlend();
+        m_States[STATE_ALPHABLEND] = mat->AlphaBlendEnabled();
+        m_States[STATE_ZWRITE] = mat->ZWriteEnabled();
+        m_States[STATE_ZFUNC] = mat->GetZFunc();
+        m_States[STATE_ALPHATEST] = mat->AlphaTestEnabled();
+        m_States[STATE_ALPHAFUNC] = mat->GetAlphaFunc();
+        m_States[STATE_ALPHAREF] = mat->GetAlphaRef();
+        m_States[STATE_TWOSIDED] = mat->IsTwoSided();
+        m_States[STATE_FILLMODE] = mat->GetFillMode();
+        m_States[STATE_SHADEMODE] = mat->GetShadeMode();
+        m_States[STATE_PERSPECTIVE] = mat->PerspectiveCorrectionEnabled();
+        m_States[STATE_TEXBLEND] = mat->GetTextureBlendMode();
+        m_States[STATE_TEXMIN] = mat->GetTextureMinMode();
+        m_States[STATE_TEXMAG] = mat->GetTextureMagMode();
+        m_States[STATE_TEXADDRESS] = mat->GetTextureAddressMode();
+        m_States[STATE_TEXBORDER] = mat->GetTextureBorderColor();
+        // a transparent texture also enables the alpha test when it is set
+        m_States[STATE_TEXTRANSPARENT] = m_Texture ? m_Texture->IsTransparent() : FALSE;
+        m_Valid = TRUE;
+        return TRUE;
+    }
+
+    // TRUE if both blocks set the same states, their textures can differ. The colors are ignored when not lit.
+    CKBOOL SameStates(const CKMaterialStateBlock &b, CKBOOL lit) const
+    {
+        if (!m_Valid || !b.m_Valid || (m_Texture == NULL) != (b.m_Texture == NULL))
+            return FALSE;
+        if (memcmp(m_States, b.m_States, sizeof(m_States)))
+            return FALSE;
+        if (!lit)
+            return TRUE;
+        return m_Power == b.m_Power && m_Diffuse == b.m_Diffuse && m_Ambient == b.m_Ambient &&
+               m_Specular == b.m_Specular && m_Emissive == b.m_Emissive;
+    }
+
+    CKBOOL IsClamped() const { return m_States[STATE_TEXADDRESS] == VXTEXTURE_ADDRESSCLAMP; }
+};
+
+/****************************************************************
+Summary: Sets materials as current, only sending what differs from the material already set.
+
+Remarks:
+    o The binder keeps a compiled CKMaterialStateBlock per material. When
+    a material sets the same states as the material already set (only
+    its texture differs, or nothing differs), Bind only sets the texture,
+    or nothing, instead of calling CKRenderContext::SetCurrentMaterial
+    which sets all the states again. Otherwise the material is set as
+    usual.
+    o The lighting colors of a material can only be sent through
+    SetCurrentMaterial, so two materials with different colors (lit) or
+    different states still cost a full material change. Sorting the draws
+    by material (CKRenderQueue) groups the cheap changes.
+    o The blocks are compiled again the first time their material is bound
+    after Refresh. Call Refresh once per frame, or after materials were
+    modified. Invalidate must be called after code which changes the states
+    without the binder (CKMesh::Render, CKMaterial::SetAsCurrent...).
+
+    CKMaterialBinder binder(dev);
+    binder.Refresh();
+    for (i = 0; i < count; ++i)
+    {
+        binder.Bind(materials[i]);
+        dev->DrawPrimitive(VX_TRIANGLELIST, indices[i], indexCounts[i], data[i]);
+    }
+
+See Also: CKMaterialStateBlock,CKRenderStateCache,CKRenderContext::SetCurrentMaterial
+****************************************************************/
+class CKMaterialBinder
+{
+public:
+    explicit CKMaterialBinder(CKRenderContext *dev) : m_Dev(dev), m_Frame(1), m_Bound(NULL), m_BoundLit(TRUE),
+                                                      m_FullCount(0), m_TextureCount(0), m_SkippedCount(0) {}
+
+    // Compiles the blocks again when they are next used.
+    void Refresh() { ++m_Frame; }
+
+    // Forgets the material set (to call after the states were changed without the binder).
+    void Invalidate() { m_Bound = NULL; }
+
+    /************************************************
+    Summary: Sets a material as current.
+
+    Arguments:
+        mat: Material to set, NULL to set no material.
+        lit: Same as CKRenderContext::SetCurrentMaterial.
+    ************************************************/
+    void Bind(CKMaterial *mat, CKBOOL lit = TRUE)
+    {
+        if (!mat)
+        {
+            m_Dev->SetCurrentMaterial(NULL, lit);
+            m_Bound = NULL;
+            return;
+        }
+        const CKMaterialStateBlock &block = GetBlock(mat);
+        if (m_Bound && lit == m_BoundLit && block.SameStates(m_BoundBlock, lit))
+        {
+            if (block.m_Texture == m_BoundBlock.m_Texture)
+            {
+                ++m_SkippedCount;
+            }
+            else
+            {
+                m_Dev->SetTexture(block.m_Texture, block.IsClamped(), 0);
+                ++m_TextureCount;
+            }
+        }
+        else
+        {
+            m_Dev->SetCurrentMaterial(mat, lit);
+            ++m_FullCount;
+        }
+        m_Bound = mat;
+        m_BoundLit = lit;
+        m_BoundBlock = block;
+    }
+
+    // Compiled block of a material, compiled again if Refresh was called since.
+    const CKMaterialStateBlock &GetBlock(CKMaterial *mat)
+    {
+        const CK_ID id = mat->GetID();
+        int *index = m_Index.FindPtr(id);
+        if (!index)
+        {
+            m_Index.Insert(id, m_Blocks.Size());
+            m_Blocks.Expand();
+            index = m_Index.FindPtr(id);
+            m_Blocks[*index].m_Frame = 0;
+        }
+        Entry &e = m_Blocks[*index];
+        if (e.m_Frame != m_Frame)
+        {
+            e.m_Block.Compile(mat);
+            e.m_Frame = m_Frame;
+        }
+        return e.m_Block;
+    }
+
+    // Removes the blocks (materials were destroyed).
+    void Clear()
+    {
+        m_Blocks.Resize(0);
+        m_Index.Clear();
+        m_Bound = NULL;
+    }
+
+    // Binds which called SetCurrentMaterial.
+    int GetFullBindCount() const { return m_FullCount; }
+
+    // Binds which only set a texture.
+    int GetTextureBindCount() const { return m_TextureCount; }
+
+    // Binds which did not send anything.
+    int GetSkippedBindCount() const { return m_SkippedCount; }
+
+    void ResetCounts()
+    {
+        m_FullCount = 0;
+        m_TextureCount = 0;
+        m_SkippedCount = 0;
+    }
+
+protected:
+    struct Entry
+    {
+        CKMaterialStateBlock m_Block;
+        int m_Frame; // value of m_Frame when compiled
+    };
+
+    CKRenderContext *m_Dev;
+    int m_Frame;
+    XArray<Entry> m_Blocks;
+    XHashTable<int, CK_ID> m_Index; // block of each material
+    CKMaterial *m_Bound;
+    CKBOOL m_BoundLit;
+    CKMaterialStateBlock m_BoundBlock;
+    int m_FullCount;
+    int m_TextureCount;
+    int m_SkippedCount;
+
+private:
+    CKMaterialBinder(const CKMaterialBinder &);
+    CKMaterialBinder &operator=(const CKMaterialBinder &);
+};
+
+#endif // CKMATERIALBINDER_H
@@ -0,0 +1,142 @@
+#ifndef CKMEMORYREPORT_H
+#define CKMEMORYREPORT_H
+
+#include "CKContext.h"
+#include "CKGlobals.h"
+#include "CKObject.h"
+#include "VxMemoryTracker.h"
+
+// Objects of one class (not including the derived classes).
+struct CKClassMemory
+{
+    CK_CLASSID m_ClassID;
+    int m_Count;
+    int m_Bytes; // Sum of CKObject::GetMemoryOccupation
+};
+
+/****************************************************************
+Summary: Snapshot of the memory used per object class and per subsystem.
+
+Remarks:
+    o Take sums CKObject::GetMemoryOccupation over the objects of each class
+    of the context, and takes a VxMemorySnapshot of the tracked allocations
+    of the module (see VxMemoryTracker, empty unless VX_MEMORY_TRACKING is
+    defined).
+    o Diff gives the growth between two reports: comparing reports taken
+    at the same point of a loop (after each scene change of an installation
+    running all day) shows the classes and subsystems that keep growing.
+    o Taking a report walks all the objects: it is meant to be done now and
+    then, not every frame.
+
+    CKMemoryReport start, now, growth;
+    start.Take(context);
+    ...
+    now.Take(context);
+    now.Diff(start, growth);
+    growth.Dump(context);
+
+See Also: VxMemoryTracker,CKObject::GetMemoryOccupation
+****************************************************************/
+class CKMemoryReport
+{
+public:
+    CKMemoryReport() { memset(&m_Tracked, 0, sizeof(m_Tracked)); }
+
+    void Take(CKContext *context)
+    {
+        m_Classes.Resize(0);
+        const int classCount = CKGetClassCount();
+        for (CK_CLASSID cid = 0; cid < classCount; ++cid)
+        {
+            const int count = context->GetObjectsCountByClassID(cid);
+            if (!count)
+                continue;
+            CK_ID *ids = context->GetObjectsListByClassID(cid);
+            CKClassMemory c;
+            c.m_ClassID = cid;
+            c.m_Count = 0;
+            c.m_Bytes = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                CKObject *obj = context->GetObject(ids[i]);
+                if (!obj)
+                    continue;
+                ++c.m_Count;
+                c.m_Bytes += obj->GetMemoryOccupation();
+            }
+            m_Classes.PushBack(c);
+        }
+        VxMemoryTracker::TakeSnapshot(m_Tracked);
+    }
+
+    // this - before, per class and per tag. Classes without change are left out.
+    void Diff(const CKMemoryReport &before, CKMemoryReport &diff) const
+    {
+        diff.m_Classes.Resize(0);
+        for (int i = 0; i < m_Classes.Size(); ++i)
+        {
+            CKClassMemory c = m_Classes[i];
+            const CKClassMemory *old = before.GetClass(c.m_ClassID);
+            if (old)
+            {
+                c.m_Count -= old->m_Count;
+                c.m_Bytes -= old->m_Bytes;
+            }
+            if (c.m_Count || c.m_Bytes)
+                diff.m_Classes.PushBack(c);
+        }
+        for (int j = 0; j < before.m_Classes.Size(); ++j)
+        {
+            if (GetClass(before.m_Classes[j].m_ClassID))
+                continue;
+            CKClassMemory c = before.m_Classes[j];
+            c.m_Count = -c.m_Count;
+            c.m_Bytes = -c.m_Bytes;
+            diff.m_Classes.PushBack(c);
+        }
+        m_Tracked.Diff(before.m_Tracked, diff.m_Tracked);
+    }
+
+    int GetClassCount() const { return m_Classes.Size(); }
+    const CKClassMemory &GetClassMemory(int index) const { return m_Classes[index]; }
+
+    const CKClassMemory *GetClass(CK_CLASSID cid) const
+    {
+        for (int i = 0; i < m_Classes.Size(); ++i)
+            if (m_Classes[i].m_ClassID == cid)
+                return &m_Classes[i];
+        return NULL;
+    }
+
+    int GetObjectBytes() const
+    {
+        int total = 0;
+        for (int i = 0; i < m_Classes.Size(); ++i)
+            total += m_Classes[i].m_Bytes;
+        return total;
+    }
+
+    const VxMemorySnapshot &GetTracked() const { return m_Tracked; }
+
+    // Writes the classes and the tags with a non zero size to the console.
+    void Dump(CKContext *context) const
+    {
+        for (int i = 0; i < m_Classes.Size(); ++i)
+        {
+            const CKClassMemory &c = m_Classes[i];
+            context->OutputToConsoleEx((CKSTRING) "%s : %d objects, %d bytes", CKClassIDToString(c.m_ClassID), c.m_Count, c.m_Bytes);
+        }
+        for (int t = 0; t < VX_MEMORY_TAGCOUNT; ++t)
+        {
+            const VxMemoryTagStats &s = m_Tracked.m_Tags[t];
+            if (s.m_Bytes || s.m_Count)
+                context->OutputToConsoleEx((CKSTRING) "[%s] : %ld bytes in %ld blocks (peak %ld)", VxMemoryTracker::GetTagName(t), s.m_Bytes, s.m_Count, s.m_PeakBytes);
+        }
+    }
+
+protected:
+    XArray<CKClassMemory> m_Classes;
+    VxMemorySnapshot m_Tracked;
+};
+
+#endif // CKMEMORYREPORT_H
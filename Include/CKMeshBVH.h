@@ -0,0 +1,188 @@
+#ifndef CKMESHBVH_H
+#define CKMESHBVH_H
+
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "XHashTable.h"
+#include "VxTriangleBVH.h"
+
+/****************************************************************
+Summary: Cache of bounding volume hierarchies for meshes.
+
+Remarks:
+    o The tree of a mesh is built the first time the mesh is queried and
+    kept until its face or vertex count changes or Invalidate is called.
+    o The trees use their own copy of the mesh vertices: after moving the
+    vertices of a mesh call Refit (deforming meshes, same topology) or
+    Invalidate (the tree will be rebuilt on next query).
+    o RayIntersection gives the same results than CK3dEntity::RayIntersection
+    but only tests the faces near the ray, which makes it worth using on
+    meshes with more than a few hundred faces.
+
+    CKMeshBVHCache cache;
+    ...
+    VxIntersectionDesc desc;
+    if (cache.RayIntersection(floor, &pos1, &pos2, &desc, NULL))
+        ...
+
+See Also: VxTriangleBVH,CK3dEntity::RayIntersection,CKRayPacket
+****************************************************************/
+class CKMeshBVHCache
+{
+public:
+    CKMeshBVHCache() {}
+    ~CKMeshBVHCache() { Clear(); }
+
+    // Deletes all the trees.
+    void Clear()
+    {
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+            delete *it;
+        m_Entries.Clear();
+    }
+
+    // Deletes the tree of a mesh, it will be rebuilt on next query.
+    void Invalidate(CKMesh *mesh)
+    {
+        if (!mesh)
+            return;
+        Entry **e = m_Entries.FindPtr(mesh->GetID());
+        if (e)
+        {
+            delete *e;
+            m_Entries.Remove(mesh->GetID());
+        }
+    }
+
+    /************************************************
+    Summary: Updates the tree of a mesh whose vertices moved.
+
+    Remarks:
+        If the topology of the mesh changed or if it has no tree yet,
+        the tree is rebuilt.
+    ************************************************/
+    void Refit(CKMesh *mesh)
+    {
+        if (!mesh)
+            return;
+        Entry **e = m_Entries.FindPtr(mesh->GetID());
+        if (!e || (*e)->m_FaceCount != mesh->GetFaceCount() || (*e)->m_VertexCount != mesh->GetVertexCount())
+        {
+            Get(mesh);
+            return;
+        }
+        CKDWORD stride = 0;
+        void *positions = mesh->GetPositionsPtr(&stride);
+        (*e)->m_Tree.Refit(VxStridedData(positions, stride));
+    }
+
+    // Returns the tree of a mesh, building it if needed.
+    const VxTriangleBVH *Get(CKMesh *mesh)
+    {
+        if (!mesh)
+            return NULL;
+        int faceCount = mesh->GetFaceCount();
+        int vertexCount = mesh->GetVertexCount();
+        Entry **e = m_Entries.FindPtr(mesh->GetID());
+        Entry *entry = e ? *e : NULL;
+        if (entry && entry->m_FaceCount == faceCount && entry->m_VertexCount == vertexCount)
+            return &entry->m_Tree;
+        if (!entry)
+        {
+            entry = new Entry;
+            m_Entries.Insert(mesh->GetID(), entry, TRUE);
+        }
+        CKDWORD stride = 0;
+        void *positions = mesh->GetPositionsPtr(&stride);
+        entry->m_Tree.Build(VxStridedData(positions, stride), vertexCount, mesh->GetFacesIndices(), faceCount);
+        entry->m_FaceCount = faceCount;
+        entry->m_VertexCount = vertexCount;
+        return &entry->m_Tree;
+    }
+
+    /************************************************
+    Summary: Intersects a ray with the current mesh of an entity.
+
+    Arguments:
+        Entity: Entity to test.
+        Pos1: Origin of the ray, in the Ref referential.
+        Pos2: A second point on the ray, in the Ref referential.
+        Desc: Filled with the intersection (see CK3dEntity::RayIntersection).
+        Ref: Referential of Pos1 and Pos2, NULL for world coordinates.
+        iOptions: CKRAYINTERSECTION_SEGMENT and CKRAYINTERSECTION_FIRSTCONTACT
+        are supported.
+    Return Value:
+        1 if the ray hits the entity, 0 otherwise.
+    ************************************************/
+    int RayIntersection(CK3dEntity *Entity, const VxVector *Pos1, const VxVector *Pos2, VxIntersectionDesc *Desc, CK3dEntity *Ref, CK_RAYINTERSECTION iOptions = CKRAYINTERSECTION_DEFAULT)
+    {
+        CKMesh *mesh = Entity ? Entity->GetCurrentMesh() : NULL;
+        const VxTriangleBVH *tree = Get(mesh);
+        if (!tree || tree->IsEmpty())
+            return 0;
+
+        // ray in the entity referential
+        VxVector p1, p2;
+        if (Ref)
+        {
+            VxVector w1, w2;
+            Vx3DMultiplyMatrixVector(&w1, Ref->GetWorldMatrix(), Pos1);
+            Vx3DMultiplyMatrixVector(&w2, Ref->GetWorldMatrix(), Pos2);
+            Vx3DMultiplyMatrixVector(&p1, Entity->GetInverseWorldMatrix(), &w1);
+            Vx3DMultiplyMatrixVector(&p2, Entity->GetInverseWorldMatrix(), &w2);
+        }
+        else
+        {
+            Vx3DMultiplyMatrixVector(&p1, Entity->GetInverseWorldMatrix(), Pos1);
+            Vx3DMultiplyMatrixVector(&p2, Entity->GetInverseWorldMatrix(), Pos2);
+        }
+        VxRay ray(p1, p2);
+
+        float t = 0.0f, u = 0.0f, v = 0.0f;
+        int face = tree->RayIntersection(ray, t, &u, &v,
+                                         (iOptions & CKRAYINTERSECTION_SEGMENT) != 0, FALSE,
+                                         (iOptions & CKRAYINTERSECTION_FIRSTCONTACT) != 0);
+        if (face < 0)
+            return 0;
+
+        if (Desc)
+        {
+            Desc->Object = Entity;
+            Desc->FaceIndex = face;
+            ray.Interpolate(Desc->IntersectionPoint, t);
+            Desc->IntersectionNormal = mesh->GetFaceNormal(face);
+            Desc->Distance = t * Magnitude(*Pos2 - *Pos1);
+            Desc->TexU = Desc->TexV = 0.0f;
+            CKDWORD uvStride = 0;
+            CKBYTE *uvs = (CKBYTE *)mesh->GetTextureCoordinatesPtr(&uvStride);
+            if (uvs)
+            {
+                CKWORD *indices = mesh->GetFacesIndices();
+                const float *uv0 = (const float *)(uvs + indices[3 * face] * uvStride);
+                const float *uv1 = (const float *)(uvs + indices[3 * face + 1] * uvStride);
+                const float *uv2 = (const float *)(uvs + indices[3 * face + 2] * uvStride);
+                Desc->TexU = uv0[0] + (uv1[0] - uv0[0]) * u + (uv2[0] - uv0[0]) * v;
+                Desc->TexV = uv0[1] + (uv1[1] - uv0[1]) * u + (uv2[1] - uv0[1]) * v;
+            }
+        }
+        return 1;
+    }
+
+protected:
+    struct Entry
+    {
+        Entry() : m_FaceCount(0), m_VertexCount(0) {}
+
+        VxTriangleBVH m_Tree;
+        int m_FaceCount;
+        int m_VertexCount;
+    };
+
+    XHashTable<Entry *, CK_ID> m_Entries;
+
+private:
+    CKMeshBVHCache(const CKMeshBVHCache &);
+    CKMeshBVHCache &operator=(const CKMeshBVHCache &);
+};
+
+#endif // CKMESHBVH_H
@@ -0,0 +1,265 @@
+#ifndef CKMESHINSTANCER_H
+#define CKMESHINSTANCER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Draws the entities sharing a small mesh with a few large draw calls.
+
+Remarks:
+    o The entities added to the instancer are grouped by mesh. Their
+    render function is replaced: when the render context draws one of them
+    (it passed the visibility and frustum tests), it is only recorded in
+    the group of its mesh.
+    o After the opaque objects, the recorded instances of each mesh are
+    transformed to world space in a dynamic vertex buffer (as many
+    instances as 65535 vertices allow) and drawn with one DrawPrimitive,
+    the material being set once per group instead of once per entity.
+    o Unlike CKStaticBatcher the entities can move and their mesh can be
+    animated, the vertices are transformed every frame. This is worth it
+    for meshes of a few hundred vertices (trees, coins, rails) which are
+    draw call bound; only lit, single material, single channel meshes
+    with an opaque material of at most MaxInstanceVertices vertices are
+    accepted.
+
+    CKMeshInstancer instancer(dev);
+    for (i = 0; i < coins.Size(); ++i)
+        instancer.Add(coins[i]);
+
+See Also: CKStaticBatcher,CKRenderContext::GetDrawPrimitiveStructure
+****************************************************************/
+class CKMeshInstancer
+{
+public:
+    enum
+    {
+        MaxInstanceVertices = 1024
+    };
+
+    explicit CKMeshInstancer(CKRenderContext *dev) : m_Dev(dev), m_Registered(FALSE) {}
+
+    ~CKMeshInstancer() { Clear(); }
+
+    /************************************************
+    Summary: Draws an entity through the instancer.
+
+    Return Value:
+        FALSE if the mesh of the entity can not be instanced.
+    Remarks:
+        The current mesh of the entity must not change while it is
+        instanced.
+    ************************************************/
+    CKBOOL Add(CK3dEntity *ent)
+    {
+        if (!ent || m_Groups.FindPtr(ent->GetID()) || !CanInstance(ent->GetCurrentMesh()))
+            return FALSE;
+        CKMesh *mesh = ent->GetCurrentMesh();
+        Group **group = m_Meshes.FindPtr(mesh->GetID());
+        Group *g = group ? *group : NULL;
+        if (!g)
+        {
+            g = new Group;
+            g->m_Mesh = mesh->GetID();
+            m_Meshes.Insert(g->m_Mesh, g);
+        }
+        ++g->m_EntityCount;
+        m_Groups.Insert(ent->GetID(), g);
+        ent->SetRenderCallBack(RecordEntity, this);
+        if (!m_Registered && m_Dev)
+        {
+            m_Dev->AddPostRenderCallBack(DrawInstances, this, FALSE, TRUE);
+            m_Registered = TRUE;
+        }
+        return TRUE;
+    }
+
+    // Restores the render function of an entity.
+    void Remove(CK3dEntity *ent)
+    {
+        Group **group = ent ? m_Groups.FindPtr(ent->GetID()) : NULL;
+        if (!group)
+            return;
+        Group *g = *group;
+        m_Groups.Remove(ent->GetID());
+        ent->RemoveRenderCallBack();
+        if (--g->m_EntityCount == 0)
+        {
+            m_Meshes.Remove(g->m_Mesh);
+            delete g;
+        }
+    }
+
+    // Restores the render function of all the entities.
+    void Clear()
+    {
+        CKContext *ctx = m_Dev ? m_Dev->GetCKContext() : NULL;
+        for (XHashTable<Group *, CK_ID>::Iterator it = m_Groups.Begin(); it != m_Groups.End(); ++it)
+        {
+            CK3dEntity *ent = ctx ? (CK3dEntity *)ctx->GetObject(it.GetKey()) : NULL;
+            if (ent && !ent->IsToBeDeleted())
+                ent->RemoveRenderCallBack();
+        }
+        for (XHashTable<Group *, CK_ID>::Iterator m = m_Meshes.Begin(); m != m_Meshes.End(); ++m)
+            delete *m;
+        if (m_Registered)
+            m_Dev->RemovePostRenderCallBack(DrawInstances, this);
+        m_Registered = FALSE;
+        m_Groups.Clear();
+        m_Meshes.Clear();
+    }
+
+    // Number of meshes drawn through the instancer.
+    int GetGroupCount() const { return m_Meshes.Size(); }
+
+    static CKBOOL CanInstance(CKMesh *mesh)
+    {
+        if (!mesh || !mesh->GetFaceCount() || mesh->GetVertexCount() > MaxInstanceVertices)
+            return FALSE;
+        if (mesh->GetChannelCount() || mesh->GetLitMode() != VX_LITMESH || mesh->IsPM() || mesh->GetMaterialCount() != 1)
+            return FALSE;
+        CKMaterial *mat = mesh->GetMaterial(0);
+        if (!mat || mat->IsAlphaTransparent())
+            return FALSE;
+        for (int f = 0; f < mesh->GetFaceCount(); ++f)
+        {
+            if (mesh->GetFaceMaterial(f) != mat)
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+protected:
+    struct Group
+    {
+        Group() : m_Mesh(0), m_EntityCount(0) {}
+
+        CK_ID m_Mesh;
+        int m_EntityCount;
+        XArray<CK3dEntity *> m_Visible; // instances recorded during the current frame
+    };
+
+    // Render function of the instanced entities: the entity is visible for this frame.
+    static CKBOOL RecordEntity(CKRenderContext *dev, CKRenderObject *ent, void *arg)
+    {
+        CKMeshInstancer *instancer = (CKMeshInstancer *)arg;
+        Group **group = instancer->m_Groups.FindPtr(ent->GetID());
+        if (group)
+            (*group)->m_Visible.PushBack((CK3dEntity *)ent);
+        return TRUE;
+    }
+
+    static void DrawInstances(CKRenderContext *dev, void *arg)
+    {
+        CKMeshInstancer *instancer = (CKMeshInstancer *)arg;
+        CKContext *ctx = dev->GetCKContext();
+        VxMatrix identity;
+        identity.SetIdentity();
+        CKBOOL identitySet = FALSE;
+        for (XHashTable<Group *, CK_ID>::Iterator it = instancer->m_Meshes.Begin(); it != instancer->m_Meshes.End(); ++it)
+        {
+            Group *g = *it;
+            CKMesh *mesh = g->m_Visible.Size() ? (CKMesh *)ctx->GetObject(g->m_Mesh) : NULL;
+            if (mesh && CanInstance(mesh))
+            {
+                if (!identitySet)
+                {
+                    dev->SetWorldTransformationMatrix(identity);
+                    identitySet = TRUE;
+                }
+                dev->SetCurrentMaterial(mesh->GetMaterial(0));
+                DrawGroup(dev, mesh, g->m_Visible);
+            }
+            g->m_Visible.Resize(0);
+        }
+    }
+
+    static void DrawGroup(CKRenderContext *dev, CKMesh *mesh, const XArray<CK3dEntity *> &instances)
+    {
+        const int vertexCount = mesh->GetVertexCount();
+        const int indexCount = 3 * mesh->GetFaceCount();
+        const CKWORD *indices = mesh->GetFacesIndices();
+        CKDWORD pStride = 0, nStride = 0, uvStride = 0;
+        void *srcPositions = mesh->GetPositionsPtr(&pStride);
+        void *srcNormals = mesh->GetNormalsPtr(&nStride);
+        VxStridedData positions(srcPositions, pStride);
+        VxStridedData normals(srcNormals, nStride);
+        const CKBYTE *uvs = (const CKBYTE *)mesh->GetTextureCoordinatesPtr(&uvStride);
+
+        const int perDraw = 0xFFFF / vertexCount;
+        for (int first = 0; first < instances.Size(); first += perDraw)
+        {
+            const int count = XMin(perDraw, instances.Size() - first);
+            VxDrawPrimitiveData *data = dev->GetDrawPrimitiveStructure((CKRST_DPFLAGS)(CKRST_DP_TR_CL_VNT | CKRST_DP_VBUFFER), count * vertexCount);
+            if (!data)
+                return;
+            CKBYTE *pos = (CKBYTE *)data->PositionPtr;
+            CKBYTE *nrm = (CKBYTE *)data->NormalPtr;
+            CKBYTE *uv = (CKBYTE *)data->TexCoordPtr;
+            CKWORD *drawIndices = dev->GetDrawPrimitiveIndices(count * indexCount);
+            CKWORD *dst = drawIndices;
+            for (int i = 0; i < count; ++i)
+            {
+                const VxMatrix &world = instances[first + i]->GetWorldMatrix();
+                const int base = i * vertexCount;
+                VxStridedData p(pos + base * data->PositionStride, data->PositionStride);
+                Vx3DMultiplyMatrixVectorStrided(&p, &positions, world, vertexCount);
+                if (nrm)
+                {
+                    VxStridedData n(nrm + base * data->NormalStride, data->NormalStride);
+                    if (IsUnscaled(world))
+                    {
+                        Vx3DRotateVectorStrided(&n, &normals, world, vertexCount);
+                    }
+                    else
+                    {
+                        // scaled entity: the normals go through the inverse transpose and are renormalized
+                        VxMatrix inverse, normalMatrix;
+                        Vx3DInverseMatrix(inverse, world);
+                        Vx3DTransposeMatrix(normalMatrix, inverse);
+                        Vx3DRotateVectorStrided(&n, &normals, normalMatrix, vertexCount);
+                        for (int v = 0; v < vertexCount; ++v)
+                            ((VxVector *)(nrm + (base + v) * data->NormalStride))->Normalize();
+                    }
+                }
+                if (uv)
+                {
+                    for (int v = 0; v < vertexCount; ++v)
+                        *(VxUV *)(uv + (base + v) * data->TexCoordStride) = *(const VxUV *)(uvs + v * uvStride);
+                }
+                for (int k = 0; k < indexCount; ++k)
+                    *dst++ = (CKWORD)(indices[k] + base);
+            }
+            if (data->Flags & CKRST_DP_VBUFFER)
+                dev->ReleaseCurrentVB();
+            dev->DrawPrimitive(VX_TRIANGLELIST, drawIndices, count * indexCount, data);
+        }
+    }
+
+    // TRUE if the axes of the matrix have a unit length.
+    static CKBOOL IsUnscaled(const VxMatrix &world)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            const float len = SquareMagnitude(VxVector(world[a][0], world[a][1], world[a][2]));
+            if (XAbs(len - 1.0f) > 1e-3f)
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    CKRenderContext *m_Dev;
+    CKBOOL m_Registered;
+    XHashTable<Group *, CK_ID> m_Groups; // group of each instanced entity
+    XHashTable<Group *, CK_ID> m_Meshes; // group of each mesh
+
+private:
+    CKMeshInstancer(const CKMeshInstancer &);
+    CKMeshInstancer &operator=(const CKMeshInstancer &);
+};
+
+#endif // CKMESHINSTANCER_H
@@ -0,0 +1,180 @@
+#ifndef CKMESHNORMALS_H
+#define CKMESHNORMALS_H
+
+#include "CKMesh.h"
+#include "VxParallel.h"
+#include "VxFastMath.h"
+
+/****************************************************************
+Summary: Rebuilds the face and vertex normals of meshes, possibly in parallel.
+
+Remarks:
+    o The vertex to face adjacency of the last mesh is kept, so rebuilding
+    the normals of a deforming mesh every frame only costs the normal
+    computations. It is rebuilt when the mesh or its face or vertex count
+    changes, or when Invalidate is called (after the faces were modified).
+    o Face normals are computed per range of faces, then vertex normals per
+    range of vertices as the normalized sum of the normals of the faces
+    using them (weighted by the face areas), so no two threads write the
+    same normal. The normalizations use VxNormalizeMany.
+    o Use a CKMeshNormalBuilder per deforming mesh, with a VxParallelPool
+    shared by all of them, instead of CKMesh::BuildNormals and
+    CKMesh::BuildFaceNormals.
+
+    // after moving the vertices
+    builder.Build(mesh, &pool);
+
+See Also: CKMesh::BuildNormals,CKMesh::BuildFaceNormals,VxParallelPool
+****************************************************************/
+class CKMeshNormalBuilder
+{
+public:
+    enum
+    {
+        Grain = 2048 // faces or vertices processed by each job
+    };
+
+    CKMeshNormalBuilder() : m_Mesh(NULL), m_FaceCount(0), m_VertexCount(0) {}
+
+    // Forces the adjacency to be rebuilt (after the faces of the mesh changed).
+    void Invalidate() { m_Mesh = NULL; }
+
+    /************************************************
+    Summary: Rebuilds the normals of a mesh.
+
+    Arguments:
+        mesh: Mesh whose normals are rebuilt.
+        pool: Worker threads to use, NULL to do all the work in the calling thread.
+        faceNormals: TRUE to store the face normals in the mesh.
+        vertexNormals: TRUE to store the vertex normals in the mesh.
+    ************************************************/
+    void Build(CKMesh *mesh, VxParallelPool *pool = NULL, CKBOOL faceNormals = TRUE, CKBOOL vertexNormals = TRUE)
+    {
+        if (!mesh)
+            return;
+        Prepare(mesh);
+
+        Job job;
+        job.m_Builder = this;
+        job.m_Indices = mesh->GetFacesIndices();
+        CKDWORD stride = 0;
+        job.m_Positions = (CKBYTE *)mesh->GetPositionsPtr(&stride);
+        job.m_PositionStride = stride;
+        job.m_FaceNormals = faceNormals ? mesh->GetFaceNormalsPtr(&stride) : NULL;
+        job.m_FaceNormalStride = stride;
+        job.m_Normals = vertexNormals ? (CKBYTE *)mesh->GetNormalsPtr(&stride) : NULL;
+        job.m_NormalStride = stride;
+        if (!job.m_Positions || !job.m_Indices)
+            return;
+
+        Run(pool, m_FaceCount, FaceNormalsRange, &job);
+        if (job.m_Normals)
+        {
+            Run(pool, m_VertexCount, VertexNormalsRange, &job);
+            mesh->NormalChanged();
+        }
+    }
+
+protected:
+    struct Job
+    {
+        CKMeshNormalBuilder *m_Builder;
+        const CKWORD *m_Indices;
+        const CKBYTE *m_Positions;
+        int m_PositionStride;
+        CKBYTE *m_FaceNormals;
+        int m_FaceNormalStride;
+        CKBYTE *m_Normals;
+        int m_NormalStride;
+    };
+
+    static void Run(VxParallelPool *pool, int count, VxRangeFunction *func, Job *job)
+    {
+        if (pool)
+            pool->For(count, Grain, func, job);
+        else
+            func(job, 0, count);
+    }
+
+    // Area weighted face normals, normalized copy in the mesh.
+    static void FaceNormalsRange(void *arg, int begin, int end)
+    {
+        Job &job = *(Job *)arg;
+        VxVector *raw = job.m_Builder->m_RawFaceNormals.Begin();
+        for (int f = begin; f < end; ++f)
+        {
+            const CKWORD *idx = job.m_Indices + 3 * f;
+            const VxVector &p0 = *(const VxVector *)(job.m_Positions + idx[0] * job.m_PositionStride);
+            const VxVector &p1 = *(const VxVector *)(job.m_Positions + idx[1] * job.m_PositionStride);
+            const VxVector &p2 = *(const VxVector *)(job.m_Positions + idx[2] * job.m_PositionStride);
+            raw[f] = CrossProduct(p1 - p0, p2 - p0);
+        }
+        if (!job.m_FaceNormals)
+            return;
+        CKBYTE *dst = job.m_FaceNormals + begin * job.m_FaceNormalStride;
+        for (int i = begin; i < end; ++i, dst += job.m_FaceNormalStride)
+            *(VxVector *)dst = raw[i];
+        VxNormalizeMany(job.m_FaceNormals + begin * job.m_FaceNormalStride, end - begin, job.m_FaceNormalStride);
+    }
+
+    static void VertexNormalsRange(void *arg, int begin, int end)
+    {
+        Job &job = *(Job *)arg;
+        const CKMeshNormalBuilder &b = *job.m_Builder;
+        const VxVector *raw = b.m_RawFaceNormals.Begin();
+        const int *start = b.m_VertexFaceStart.Begin();
+        const int *faces = b.m_VertexFaces.Begin();
+        CKBYTE *dst = job.m_Normals + begin * job.m_NormalStride;
+        for (int v = begin; v < end; ++v, dst += job.m_NormalStride)
+        {
+            VxVector n(0.0f, 0.0f, 0.0f);
+            for (int i = start[v]; i < start[v + 1]; ++i)
+                n += raw[faces[i]];
+            *(VxVector *)dst = n;
+        }
+        VxNormalizeMany(job.m_Normals + begin * job.m_NormalStride, end - begin, job.m_NormalStride);
+    }
+
+    // Builds the vertex to face adjacency (compressed rows).
+    void Prepare(CKMesh *mesh)
+    {
+        int faceCount = mesh->GetFaceCount();
+        int vertexCount = mesh->GetVertexCount();
+        if (mesh == m_Mesh && faceCount == m_FaceCount && vertexCount == m_VertexCount)
+            return;
+        m_Mesh = mesh;
+        m_FaceCount = faceCount;
+        m_VertexCount = vertexCount;
+        m_RawFaceNormals.Resize(faceCount);
+
+        m_VertexFaceStart.Resize(vertexCount + 1);
+        memset(m_VertexFaceStart.Begin(), 0, (vertexCount + 1) * sizeof(int));
+        const CKWORD *indices = mesh->GetFacesIndices();
+        int i;
+        for (i = 0; i < 3 * faceCount; ++i)
+            ++m_VertexFaceStart[indices[i] + 1];
+        for (i = 0; i < vertexCount; ++i)
+            m_VertexFaceStart[i + 1] += m_VertexFaceStart[i];
+
+        m_VertexFaces.Resize(3 * faceCount);
+        XArray<int> fill(vertexCount);
+        fill.Resize(vertexCount);
+        if (vertexCount)
+            memcpy(fill.Begin(), m_VertexFaceStart.Begin(), vertexCount * sizeof(int));
+        for (i = 0; i < 3 * faceCount; ++i)
+            m_VertexFaces[fill[indices[i]]++] = i / 3;
+    }
+
+    CKMesh *m_Mesh;
+    int m_FaceCount;
+    int m_VertexCount;
+    XArray<VxVector> m_RawFaceNormals;
+    XArray<int> m_VertexFaceStart; // first entry of each vertex in m_VertexFaces
+    XArray<int> m_VertexFaces;
+
+private:
+    CKMeshNormalBuilder(const CKMeshNormalBuilder &);
+    CKMeshNormalBuilder &operator=(const CKMeshNormalBuilder &);
+};
+
+#endif // CKMESHNORMALS_H
@@ -0,0 +1,168 @@
+#ifndef CKMESHOPTIMIZER_H
+#define CKMESHOPTIMIZER_H
+
+#include "CKMesh.h"
+#include "VxMeshOptimizer.h"
+
+/****************************************************************
+Summary: Reorders the faces and vertices of meshes for faster rendering.
+
+Remarks:
+    o Optimize reorders the faces for the vertex cache and the overdraw,
+    then the vertices in the order of the faces, with VxMeshOptimizer. The
+    face materials, channel masks, vertex colors, normals, texture
+    coordinates of every channel, vertex weights and lines follow.
+    o The mesh saves its faces and vertices in their new order, so the
+    optimization is meant to be done once when exporting or loading a
+    composition (after CKMesh::Consolidate), not every frame.
+    o Progressive meshes are not modified, their vertex order is part of
+    the simplification data.
+
+    mesh->Consolidate();
+    CKMeshOptimizer::Optimize(mesh);
+
+See Also: VxMeshOptimizer,CKMesh::Consolidate
+****************************************************************/
+class CKMeshOptimizer
+{
+public:
+    enum
+    {
+        VertexCache = 1, // reorder the faces for the vertex cache
+        Overdraw = 2,    // reorder the clusters of faces to reduce the overdraw
+        VertexFetch = 4, // renumber the vertices in the order of the faces
+        All = 7
+    };
+
+    /************************************************
+    Summary: Optimizes the faces and vertices order of a mesh.
+
+    Arguments:
+        mesh: Mesh to optimize.
+        flags: Combination of VertexCache, Overdraw and VertexFetch.
+        overdrawThreshold: Cache efficiency loss allowed to reduce the
+        overdraw (see VxMeshOptimizer::OptimizeOverdraw).
+    Return Value:
+        FALSE if the mesh could not be optimized (no faces or progressive mesh).
+    ************************************************/
+    static CKBOOL Optimize(CKMesh *mesh, CKDWORD flags = All, float overdrawThreshold = 1.05f)
+    {
+        if (!mesh || mesh->IsPM())
+            return FALSE;
+        const int faceCount = mesh->GetFaceCount();
+        const int vertexCount = mesh->GetVertexCount();
+        CKWORD *indices = mesh->GetFacesIndices();
+        if (!faceCount || !vertexCount || !indices)
+            return FALSE;
+
+        if (flags & (VertexCache | Overdraw))
+        {
+            // order[new face] = old face
+            XArray<int> order(faceCount);
+            order.Resize(faceCount);
+            int f;
+            for (f = 0; f < faceCount; ++f)
+                order[f] = f;
+            XArray<int> remap(faceCount);
+            remap.Resize(faceCount);
+            if (flags & VertexCache)
+            {
+                VxMeshOptimizer::OptimizeVertexCache(indices, faceCount, vertexCount, order.Begin());
+            }
+            if (flags & Overdraw)
+            {
+                CKDWORD stride = 0;
+                void *positions = mesh->GetPositionsPtr(&stride);
+                VxMeshOptimizer::OptimizeOverdraw(indices, faceCount, VxStridedData(positions, stride), vertexCount, remap.Begin(), overdrawThreshold);
+                for (f = 0; f < faceCount; ++f)
+                    remap[f] = order[remap[f]];
+                order.Swap(remap);
+            }
+            ReorderFaces(mesh, order);
+        }
+
+        if (flags & VertexFetch)
+        {
+            XArray<int> remap(vertexCount);
+            remap.Resize(vertexCount);
+            VxMeshOptimizer::OptimizeVertexFetch(indices, faceCount, vertexCount, remap.Begin());
+            ReorderVertices(mesh, remap);
+        }
+
+        mesh->BuildFaceNormals();
+        mesh->UnOptimize();
+        return TRUE;
+    }
+
+protected:
+    // Moves the per face data of the old faces to their new position.
+    static void ReorderFaces(CKMesh *mesh, const XArray<int> &order)
+    {
+        const int faceCount = order.Size();
+        XArray<CKMaterial *> materials(faceCount);
+        XArray<CKWORD> masks(faceCount);
+        int f;
+        for (f = 0; f < faceCount; ++f)
+        {
+            materials.PushBack(mesh->GetFaceMaterial(order[f]));
+            masks.PushBack(mesh->GetFaceChannelMask(order[f]));
+        }
+        for (f = 0; f < faceCount; ++f)
+        {
+            mesh->SetFaceMaterial(f, materials[f]);
+            mesh->SetFaceChannelMask(f, masks[f]);
+        }
+    }
+
+    // Moves the vertex data and updates the lines, remap gives the new index of each vertex.
+    static void ReorderVertices(CKMesh *mesh, const XArray<int> &remap)
+    {
+        const int vertexCount = remap.Size();
+        XArray<CKBYTE> temp;
+        CKDWORD stride = 0;
+        void *ptr = mesh->GetPositionsPtr(&stride);
+        Permute(ptr, stride, sizeof(VxVector), remap, temp);
+        ptr = mesh->GetNormalsPtr(&stride);
+        Permute(ptr, stride, sizeof(VxVector), remap, temp);
+        ptr = mesh->GetColorsPtr(&stride);
+        Permute(ptr, stride, sizeof(CKDWORD), remap, temp);
+        ptr = mesh->GetSpecularColorsPtr(&stride);
+        Permute(ptr, stride, sizeof(CKDWORD), remap, temp);
+        ptr = mesh->GetTextureCoordinatesPtr(&stride, -1);
+        Permute(ptr, stride, sizeof(VxUV), remap, temp);
+        for (int c = 0; c < mesh->GetChannelCount(); ++c)
+        {
+            ptr = mesh->GetTextureCoordinatesPtr(&stride, c);
+            Permute(ptr, stride, sizeof(VxUV), remap, temp);
+        }
+        if (mesh->GetVertexWeightsCount() == vertexCount)
+            Permute(mesh->GetVertexWeightsPtr(), sizeof(float), sizeof(float), remap, temp);
+
+        CKWORD *lines = mesh->GetLineIndices();
+        if (lines)
+        {
+            for (int i = 0; i < 2 * mesh->GetLineCount(); ++i)
+                lines[i] = (CKWORD)remap[lines[i]];
+        }
+        mesh->VertexMove();
+        mesh->NormalChanged();
+        mesh->ColorChanged();
+        mesh->UVChanged();
+    }
+
+    static void Permute(void *data, CKDWORD stride, int size, const XArray<int> &remap, XArray<CKBYTE> &temp)
+    {
+        if (!data || !stride)
+            return;
+        const int count = remap.Size();
+        temp.Resize(count * size);
+        CKBYTE *src = (CKBYTE *)data;
+        int i;
+        for (i = 0; i < count; ++i)
+            memcpy(temp.Begin() + remap[i] * size, src + i * stride, size);
+        for (i = 0; i < count; ++i)
+            memcpy(src + i * stride, temp.Begin() + i * size, size);
+    }
+};
+
+#endif // CKMESHOPTIMIZER_H
@@ -0,0 +1,343 @@
+#ifndef CKMESSAGEDISPATCHER_H
+#define CKMESSAGEDISPATCHER_H
+
+#include "CKContext.h"
+#include "CKMessageManager.h"
+#include "CKMessage.h"
+#include "CKBehavior.h"
+#include "CKBeObject.h"
+#include "CKGroup.h"
+#include "CKScene.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Message sent through a CKMessageDispatcher.
+
+Remarks:
+    o The messages live in arrays reused from frame to frame, they are
+    never allocated one by one. The data of a message up to InlineSize
+    bytes is stored in the message itself, larger data goes in a buffer of
+    the frame.
+    o A message is valid from the CKMessageDispatcher::Process that
+    delivered it to the next one.
+
+See Also: CKMessageDispatcher
+****************************************************************/
+struct CKDispatchedMessage
+{
+    enum
+    {
+        InlineSize = 16
+    };
+
+    CKMessageType m_Type;
+    CK_MESSAGE_SENDINGTYPE m_SendingType;
+    CK_ID m_Sender;
+    CK_ID m_Recipient; // object or group, unused for a broadcast
+    CK_CLASSID m_BroadcastCid;
+    CKAttributeType m_Attribute; // broadcast to the objects having this attribute, -1 for all
+    int m_Size;   // size of the data
+    int m_Offset; // in the data buffer of the frame, -1 when inline
+    XBYTE m_Inline[InlineSize];
+};
+
+/****************************************************************
+Summary: Message dispatch without allocation, through per-type lists of receivers.
+
+Remarks:
+    o CKMessageManager creates a CKMessage for each message sent, and
+    dispatches it by walking the recipients: the whole group, or all the
+    objects of a class for a broadcast. The dispatcher keeps, for each
+    message type, the list of the behaviors and objects waiting for it,
+    so a message only visits these receivers: a broadcast skips all the
+    objects that wait for nothing.
+    o A broadcast can be limited to the objects having an attribute. The
+    class of each receiver is kept in the lists, so a broadcast to a
+    class only tests the class ids of the listeners of the type.
+    o The message types are those of the message manager (AddMessageType).
+    o RegisterWait behaves as CKMessageManager::RegisterWait: the output of
+    the behavior is activated by the first message of the type received
+    by the object, then the wait is removed. As for the "Wait Message"
+    building block, a wait whose script is no longer active in the
+    current scene is removed instead of being answered.
+    o AddReceiver makes an object receive all the messages of a type,
+    readable during the next frame with GetReceivedMessageCount and
+    GetReceivedMessage (as the "last frame messages" of
+    CKBeObject::SetAsWaitingForMessages).
+    o The messages sent during a frame are dispatched by Process, to be
+    called once per frame. The arrays of the messages and of their data
+    are kept from one frame to the next, so once they have grown no
+    memory is allocated.
+
+    CKMessageDispatcher dispatcher(ctx);
+    CKMessageType hit = dispatcher.GetMessageType("Hit");
+    dispatcher.AddReceiver(hit, enemy);
+    ...
+    float damage = 12.0f;
+    dispatcher.SendMessageSingle(hit, enemy, player, &damage, sizeof(damage));
+    ...
+    // each frame
+    dispatcher.Process();
+    for (int i = 0; i < dispatcher.GetReceivedMessageCount(enemy); ++i)
+        ...
+
+See Also: CKMessageManager,CKDispatchedMessage
+****************************************************************/
+class CKMessageDispatcher
+{
+public:
+    CKMessageDispatcher(CKContext *ctx) : m_Context(ctx), m_Sending(0) {}
+
+    // Type of a message name, shared with the message manager.
+    CKMessageType GetMessageType(CKSTRING name) { return m_Context->GetMessageManager()->AddMessageType(name); }
+
+    //---------------------------------------------
+    // Sending: the messages are dispatched by the next Process
+
+    const CKDispatchedMessage *SendMessageSingle(CKMessageType type, CKBeObject *dest, CKBeObject *sender = NULL, const void *data = NULL, int size = 0)
+    {
+        return Push(type, CK_MESSAGE_SINGLE, CKOBJID(dest), 0, sender, data, size);
+    }
+
+    const CKDispatchedMessage *SendMessageGroup(CKMessageType type, CKGroup *group, CKBeObject *sender = NULL, const void *data = NULL, int size = 0)
+    {
+        return Push(type, CK_MESSAGE_GROUP, CKOBJID(group), 0, sender, data, size);
+    }
+
+    // attribute: only the objects having this attribute receive the message, -1 for all.
+    const CKDispatchedMessage *SendMessageBroadcast(CKMessageType type, CK_CLASSID cid = CKCID_BEOBJECT, CKBeObject *sender = NULL, const void *data = NULL, int size = 0, CKAttributeType attribute = -1)
+    {
+        return Push(type, CK_MESSAGE_BROADCAST, 0, cid, sender, data, size, attribute);
+    }
+
+    //---------------------------------------------
+    // Receivers
+
+    // One message of the type received by obj activates the output of the behavior, then the wait is removed.
+    void RegisterWait(CKMessageType type, CKBehavior *behavior, int output, CKBeObject *obj)
+    {
+        UnRegisterWait(type, behavior, output);
+        if (!obj || !behavior)
+            return;
+        Receiver r = {CKOBJID(obj), obj->GetClassID(), CKOBJID(behavior), output};
+        GetReceivers(type).PushBack(r);
+    }
+
+    void UnRegisterWait(CKMessageType type, CKBehavior *behavior, int output)
+    {
+        if (type < 0 || type >= m_Receivers.Size())
+            return;
+        XArray<Receiver> &list = m_Receivers[type];
+        const CK_ID id = CKOBJID(behavior);
+        for (int i = list.Size() - 1; i >= 0; --i)
+        {
+            if (list[i].m_Behavior == id && list[i].m_Output == output)
+                list.RemoveAt(i);
+        }
+    }
+
+    // All the messages of the type received by obj are kept for a frame.
+    void AddReceiver(CKMessageType type, CKBeObject *obj)
+    {
+        if (!obj || FindReceiver(type, CKOBJID(obj)) >= 0)
+            return;
+        Receiver r = {CKOBJID(obj), obj->GetClassID(), 0, -1};
+        GetReceivers(type).PushBack(r);
+    }
+
+    void RemoveReceiver(CKMessageType type, CKBeObject *obj)
+    {
+        const int i = FindReceiver(type, CKOBJID(obj));
+        if (i >= 0)
+            m_Receivers[type].RemoveAt(i);
+    }
+
+    //---------------------------------------------
+    // Dispatch
+
+    /************************************************
+    Summary: Dispatches the messages sent since the last call.
+
+    Return Value:
+        Number of messages delivered to a behavior or an object.
+    ************************************************/
+    int Process()
+    {
+        // the messages received during the previous frame are dropped
+        for (int o = 0; o < m_Mailboxes.Size(); ++o)
+            m_Mailboxes[o].Resize(0);
+        m_Sending ^= 1;
+        Frame &frame = m_Frames[m_Sending ^ 1];
+        CKScene *scene = m_Context->GetCurrentScene();
+        int delivered = 0;
+        for (int m = 0; m < frame.m_Messages.Size(); ++m)
+        {
+            const CKDispatchedMessage &msg = frame.m_Messages[m];
+            if (msg.m_Type < 0 || msg.m_Type >= m_Receivers.Size())
+                continue;
+            CKGroup *group = NULL;
+            if (msg.m_SendingType == CK_MESSAGE_GROUP)
+            {
+                group = (CKGroup *)m_Context->GetObject(msg.m_Recipient);
+                if (!group)
+                    continue;
+            }
+            XArray<Receiver> &list = m_Receivers[msg.m_Type];
+            for (int i = 0; i < list.Size(); ++i)
+            {
+                Receiver &r = list[i];
+                if (msg.m_SendingType == CK_MESSAGE_BROADCAST && !CKIsChildClassOf(r.m_ClassID, msg.m_BroadcastCid))
+                    continue;
+                CKBeObject *obj = (CKBeObject *)m_Context->GetObject(r.m_Object);
+                CKBehavior *behavior = r.m_Behavior ? (CKBehavior *)m_Context->GetObject(r.m_Behavior) : NULL;
+                if (!obj || (r.m_Behavior && (!behavior || (scene && !behavior->IsParentScriptActiveInScene(scene)))))
+                {
+                    // deleted receiver, or wait of a deactivated script
+                    list.RemoveAt(i--);
+                    continue;
+                }
+                if (!IsRecipient(msg, obj, group))
+                    continue;
+                ++delivered;
+                if (!behavior)
+                {
+                    GetMailbox(r.m_Object).PushBack(m);
+                    continue;
+                }
+                behavior->ActivateOutput(r.m_Output);
+                list.RemoveAt(i--);
+            }
+        }
+        // the frame being sent starts empty, keeping its memory
+        m_Frames[m_Sending].m_Messages.Resize(0);
+        m_Frames[m_Sending].m_Data.Resize(0);
+        return delivered;
+    }
+
+    // Messages of the types obj receives, delivered by the last Process.
+    int GetReceivedMessageCount(CKBeObject *obj)
+    {
+        const int *slot = m_MailboxIndex.FindPtr(CKOBJID(obj));
+        return slot ? m_Mailboxes[*slot].Size() : 0;
+    }
+
+    const CKDispatchedMessage *GetReceivedMessage(CKBeObject *obj, int index)
+    {
+        const int *slot = m_MailboxIndex.FindPtr(CKOBJID(obj));
+        if (!slot || index < 0 || index >= m_Mailboxes[*slot].Size())
+            return NULL;
+        return &m_Frames[m_Sending ^ 1].m_Messages[m_Mailboxes[*slot][index]];
+    }
+
+    // Data of a delivered message, NULL if it has none.
+    const void *GetData(const CKDispatchedMessage *msg) const
+    {
+        if (!msg || !msg->m_Size)
+            return NULL;
+        if (msg->m_Offset < 0)
+            return msg->m_Inline;
+        return m_Frames[m_Sending ^ 1].m_Data.Begin() + msg->m_Offset;
+    }
+
+    CKBeObject *GetSender(const CKDispatchedMessage *msg) { return (CKBeObject *)m_Context->GetObject(msg->m_Sender); }
+
+    // Messages waiting for the next Process.
+    int GetSentMessageCount() const { return m_Frames[m_Sending].m_Messages.Size(); }
+
+protected:
+    struct Receiver
+    {
+        CK_ID m_Object;
+        CK_CLASSID m_ClassID;
+        CK_ID m_Behavior; // 0 for an object receiving all the messages of the type
+        int m_Output;
+    };
+
+    struct Frame
+    {
+        XArray<CKDispatchedMessage> m_Messages;
+        XArray<XBYTE> m_Data;
+    };
+
+    const CKDispatchedMessage *Push(CKMessageType type, CK_MESSAGE_SENDINGTYPE sendingType, CK_ID recipient, CK_CLASSID cid, CKBeObject *sender, const void *data, int size, CKAttributeType attribute = -1)
+    {
+        Frame &frame = m_Frames[m_Sending];
+        frame.m_Messages.Expand(1);
+        CKDispatchedMessage &msg = frame.m_Messages.Back();
+        msg.m_Type = type;
+        msg.m_SendingType = sendingType;
+        msg.m_Sender = CKOBJID(sender);
+        msg.m_Recipient = recipient;
+        msg.m_BroadcastCid = cid;
+        msg.m_Attribute = attribute;
+        msg.m_Size = data ? size : 0;
+        msg.m_Offset = -1;
+        if (msg.m_Size > CKDispatchedMessage::InlineSize)
+        {
+            msg.m_Offset = frame.m_Data.Size();
+            frame.m_Data.Resize(msg.m_Offset + msg.m_Size);
+            memcpy(frame.m_Data.Begin() + msg.m_Offset, data, msg.m_Size);
+        }
+        else if (msg.m_Size > 0)
+        {
+            memcpy(msg.m_Inline, data, msg.m_Size);
+        }
+        return &msg;
+    }
+
+    static CKBOOL IsRecipient(const CKDispatchedMessage &msg, CKBeObject *obj, CKGroup *group)
+    {
+        switch (msg.m_SendingType)
+        {
+        case CK_MESSAGE_SINGLE:
+            return obj->GetID() == msg.m_Recipient;
+        case CK_MESSAGE_GROUP:
+            return obj->IsInGroup(group);
+        case CK_MESSAGE_BROADCAST:
+            // the class was tested on the receiver
+            return msg.m_Attribute < 0 || obj->HasAttribute(msg.m_Attribute);
+        default:
+            return FALSE;
+        }
+    }
+
+    XArray<Receiver> &GetReceivers(CKMessageType type)
+    {
+        if (type >= m_Receivers.Size())
+            m_Receivers.Resize(type + 1);
+        return m_Receivers[type];
+    }
+
+    int FindReceiver(CKMessageType type, CK_ID obj) const
+    {
+        if (type < 0 || type >= m_Receivers.Size())
+            return -1;
+        const XArray<Receiver> &list = m_Receivers[type];
+        for (int i = 0; i < list.Size(); ++i)
+        {
+            if (list[i].m_Object == obj && !list[i].m_Behavior)
+                return i;
+        }
+        return -1;
+    }
+
+    XArray<int> &GetMailbox(CK_ID obj)
+    {
+        int *slot = m_MailboxIndex.FindPtr(obj);
+        if (slot)
+            return m_Mailboxes[*slot];
+        m_MailboxIndex.Insert(obj, m_Mailboxes.Size());
+        m_Mailboxes.Expand(1);
+        return m_Mailboxes.Back();
+    }
+
+    CKContext *m_Context;
+    // messages being sent (m_Sending) and delivered by the last Process
+    Frame m_Frames[2];
+    int m_Sending;
+    XClassArray<XArray<Receiver> > m_Receivers; // by message type
+    XClassArray<XArray<int> > m_Mailboxes;       // messages delivered to an object receiver
+    XHashTable<int, CK_ID> m_MailboxIndex;
+};
+
+#endif // CKMESSAGEDISPATCHER_H
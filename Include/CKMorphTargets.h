@@ -0,0 +1,309 @@
+#ifndef CKMORPHTARGETS_H
+#define CKMORPHTARGETS_H
+
+#include <string.h>
+
+#include "CKContext.h"
+#include "CKMesh.h"
+#include "CKKeyframeData.h"
+#include "VxSIMD.h"
+#include "VxFastMath.h"
+#include "XArray.h"
+
+/****************************************************************
+Summary: Weighted morph targets of a mesh stored as sparse deltas.
+
+Remarks:
+    o CKMorphController keeps every vertex of every key and interpolates
+    them all. A target here only keeps the vertices it moves (index and
+    position delta, with the normal delta when normals are given): a
+    facial target moving 5% of the vertices takes 5% of the memory of a
+    morph key.
+    o Evaluate starts from the base vertices and adds the deltas of the
+    targets with a non null weight, 4 floats at a time with SSE: the cost
+    is the copy of the base plus the vertices of the active targets, the
+    other targets are skipped.
+    o Apply writes the result in a mesh and notifies it. It does nothing
+    when no weight changed since the previous Apply on the same mesh.
+    o AddTargets converts the keys of a CKMorphController to targets, so
+    existing morph animations can be blended by weight instead of time.
+
+    CKMorphTargets morph;
+    morph.SetBase(mesh);
+    int smile = morph.AddTarget(smilePositions, smileNormals);
+    ...
+    morph.SetWeight(smile, 0.7f);
+    morph.Apply(mesh); // each frame, before rendering
+
+See Also: CKMorphController,CKMesh::GetPositionsPtr
+****************************************************************/
+class CKMorphTargets
+{
+public:
+    CKMorphTargets() : m_VertexCount(0), m_HasNormals(FALSE), m_Changed(TRUE), m_LastMesh(0) {}
+
+    /*************************************************
+    Summary: Sets the vertices the targets are relative to.
+
+    Arguments:
+        positions: Position of each vertex.
+        normals: Normal of each vertex, or NULL.
+        vertexCount: Number of vertices.
+    Remarks:
+        The targets are removed.
+    *************************************************/
+    void SetBase(const VxVector *positions, const VxVector *normals, int vertexCount)
+    {
+        SetBase(positions, sizeof(VxVector), normals, sizeof(VxVector), vertexCount);
+    }
+
+    // Takes the current vertices of a mesh as the base.
+    CKBOOL SetBase(CKMesh *mesh)
+    {
+        if (!mesh)
+            return FALSE;
+        CKDWORD pStride = 0, nStride = 0;
+        const void *positions = mesh->GetPositionsPtr(&pStride);
+        const void *normals = mesh->GetNormalsPtr(&nStride);
+        if (!positions)
+            return FALSE;
+        SetBase(positions, pStride, normals, nStride, mesh->GetVertexCount());
+        return TRUE;
+    }
+
+    /*************************************************
+    Summary: Adds a target from the vertices of a full pose.
+
+    Arguments:
+        positions: Position of each vertex of the base in this pose.
+        normals: Normal of each vertex in this pose, or NULL to leave the normals of the base.
+        threshold: Vertices which move less than this distance (and whose normal moves less) are not stored.
+    Return Value:
+        Index of the target, its weight is 0.
+    *************************************************/
+    int AddTarget(const VxVector *positions, const VxVector *normals, float threshold = 0.0001f)
+    {
+        Target t;
+        t.m_First = m_Indices.Size();
+        t.m_HasNormals = normals && m_HasNormals;
+        const float t2 = threshold * threshold;
+        for (int i = 0; i < m_VertexCount; ++i)
+        {
+            const float *base = m_Base.Begin() + i * 8;
+            const VxVector dp(positions[i].x - base[0], positions[i].y - base[1], positions[i].z - base[2]);
+            VxVector dn(0.0f, 0.0f, 0.0f);
+            if (t.m_HasNormals)
+                dn = VxVector(normals[i].x - base[4], normals[i].y - base[5], normals[i].z - base[6]);
+            if (SquareMagnitude(dp) <= t2 && SquareMagnitude(dn) <= t2)
+                continue;
+            m_Indices.PushBack(i);
+            const float delta[8] = {dp.x, dp.y, dp.z, 0.0f, dn.x, dn.y, dn.z, 0.0f};
+            for (int k = 0; k < 8; ++k)
+                m_Deltas.PushBack(delta[k]);
+        }
+        t.m_Count = m_Indices.Size() - t.m_First;
+        t.m_Weight = 0.0f;
+        m_Targets.PushBack(t);
+        return m_Targets.Size() - 1;
+    }
+
+    /*************************************************
+    Summary: Adds a target for each key of a morph controller.
+
+    Arguments:
+        controller: Morph controller whose keys have as many vertices as the base.
+        threshold: Same as AddTarget.
+    Return Value:
+        Index of the target of the first key.
+    *************************************************/
+    int AddTargets(CKMorphController *controller, float threshold = 0.0001f)
+    {
+        const int first = m_Targets.Size();
+        if (!controller)
+            return first;
+        XArray<VxVector> normals;
+        for (int k = 0; k < controller->GetKeyCount(); ++k)
+        {
+            CKMorphKey *key = (CKMorphKey *)controller->GetKey(k);
+            if (!key || !key->PosArray)
+                continue;
+            const VxVector *n = NULL;
+            if (key->NormArray)
+            {
+                normals.Resize(m_VertexCount);
+                for (int i = 0; i < m_VertexCount; ++i)
+                    normals[i] = key->NormArray[i];
+                n = normals.Begin();
+            }
+            AddTarget(key->PosArray, n, threshold);
+        }
+        return first;
+    }
+
+    int GetTargetCount() const { return m_Targets.Size(); }
+
+    // Number of vertices stored for a target.
+    int GetTargetVertexCount(int target) const { return m_Targets[target].m_Count; }
+
+    void SetWeight(int target, float weight)
+    {
+        if (m_Targets[target].m_Weight != weight)
+        {
+            m_Targets[target].m_Weight = weight;
+            m_Changed = TRUE;
+        }
+    }
+
+    float GetWeight(int target) const { return m_Targets[target].m_Weight; }
+
+    /*************************************************
+    Summary: Computes the vertices for the current weights.
+
+    Arguments:
+        positions: Receives the positions of all the vertices.
+        normals: If its pointer is not NULL and the base has normals, receives the normalized normals.
+    *************************************************/
+    void Evaluate(const VxStridedData &positions, const VxStridedData &normals)
+    {
+        memcpy(m_Work.Begin(), m_Base.Begin(), m_Base.Size() * sizeof(float));
+        CKBOOL normalsMoved = FALSE;
+        for (int t = 0; t < m_Targets.Size(); ++t)
+        {
+            const Target &target = m_Targets[t];
+            if (target.m_Weight == 0.0f || !target.m_Count)
+                continue;
+            Accumulate(target);
+            normalsMoved |= target.m_HasNormals;
+        }
+
+        const CKBOOL writeNormals = normals.Ptr && m_HasNormals;
+        const float *w = m_Work.Begin();
+        for (int i = 0; i < m_VertexCount; ++i, w += 8)
+        {
+            VxVector &p = *(VxVector *)(positions.CPtr + i * positions.Stride);
+            p.x = w[0];
+            p.y = w[1];
+            p.z = w[2];
+            if (writeNormals)
+            {
+                VxVector &n = *(VxVector *)(normals.CPtr + i * normals.Stride);
+                n.x = w[4];
+                n.y = w[5];
+                n.z = w[6];
+            }
+        }
+        if (writeNormals && normalsMoved)
+            VxNormalizeMany(normals.Ptr, m_VertexCount, normals.Stride);
+        m_Changed = FALSE;
+    }
+
+    /*************************************************
+    Summary: Writes the vertices for the current weights in a mesh.
+
+    Return Value:
+        FALSE if the mesh does not have as many vertices as the base.
+    *************************************************/
+    CKBOOL Apply(CKMesh *mesh)
+    {
+        if (!mesh || mesh->GetVertexCount() != m_VertexCount)
+            return FALSE;
+        if (!m_Changed && mesh->GetID() == m_LastMesh)
+            return TRUE;
+        CKDWORD pStride = 0, nStride = 0;
+        void *positions = mesh->GetPositionsPtr(&pStride);
+        void *normals = m_HasNormals ? mesh->GetNormalsPtr(&nStride) : NULL;
+        if (!positions)
+            return FALSE;
+        Evaluate(VxStridedData(positions, pStride), VxStridedData(normals, nStride));
+        mesh->VertexMove();
+        if (normals)
+            mesh->NormalChanged();
+        m_LastMesh = mesh->GetID();
+        return TRUE;
+    }
+
+    // Bytes used by the deltas of the targets.
+    int GetMemorySize() const { return m_Indices.Size() * sizeof(int) + m_Deltas.Size() * sizeof(float); }
+
+protected:
+    struct Target
+    {
+        int m_First; // first vertex in m_Indices (8 floats each in m_Deltas)
+        int m_Count;
+        CKBOOL m_HasNormals;
+        float m_Weight;
+    };
+
+    void SetBase(const void *positions, CKDWORD pStride, const void *normals, CKDWORD nStride, int vertexCount)
+    {
+        m_VertexCount = vertexCount;
+        m_HasNormals = normals != NULL;
+        m_Base.Resize(vertexCount * 8);
+        m_Work.Resize(vertexCount * 8);
+        for (int i = 0; i < vertexCount; ++i)
+        {
+            float *b = m_Base.Begin() + i * 8;
+            const VxVector &p = *(const VxVector *)((const CKBYTE *)positions + i * pStride);
+            b[0] = p.x;
+            b[1] = p.y;
+            b[2] = p.z;
+            b[3] = 0.0f;
+            const VxVector n = normals ? *(const VxVector *)((const CKBYTE *)normals + i * nStride) : VxVector(0.0f, 0.0f, 0.0f);
+            b[4] = n.x;
+            b[5] = n.y;
+            b[6] = n.z;
+            b[7] = 0.0f;
+        }
+        m_Targets.Resize(0);
+        m_Indices.Resize(0);
+        m_Deltas.Resize(0);
+        m_Changed = TRUE;
+        m_LastMesh = 0;
+    }
+
+    // Adds the weighted deltas of a target to the work vertices (position and normal, 4 floats each).
+    void Accumulate(const Target &target)
+    {
+        const int *indices = m_Indices.Begin() + target.m_First;
+        const float *delta = m_Deltas.Begin() + target.m_First * 8;
+        float *work = m_Work.Begin();
+        const float weight = target.m_Weight;
+        const int span = target.m_HasNormals ? 8 : 4;
+        int k = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            const __m128 w = _mm_set1_ps(weight);
+            for (; k < target.m_Count; ++k, delta += 8)
+            {
+                float *dst = work + indices[k] * 8;
+                _mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), _mm_mul_ps(w, _mm_loadu_ps(delta))));
+                if (span == 8)
+                    _mm_storeu_ps(dst + 4, _mm_add_ps(_mm_loadu_ps(dst + 4), _mm_mul_ps(w, _mm_loadu_ps(delta + 4))));
+            }
+        }
+#endif
+        for (; k < target.m_Count; ++k, delta += 8)
+        {
+            float *dst = work + indices[k] * 8;
+            for (int j = 0; j < span; ++j)
+                dst[j] += weight * delta[j];
+        }
+    }
+
+    int m_VertexCount;
+    CKBOOL m_HasNormals;
+    CKBOOL m_Changed;
+    CK_ID m_LastMesh;
+    XArray<float> m_Base; // position and normal of each vertex, 4 floats each
+    XArray<float> m_Work;
+    XArray<Target> m_Targets;
+    XArray<int> m_Indices; // moved vertices of the targets
+    XArray<float> m_Deltas;
+
+private:
+    CKMorphTargets(const CKMorphTargets &);
+    CKMorphTargets &operator=(const CKMorphTargets &);
+};
+
+#endif // CKMORPHTARGETS_H
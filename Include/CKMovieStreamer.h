@@ -0,0 +1,422 @@
+#ifndef CKMOVIESTREAMER_H
+#define CKMOVIESTREAMER_H
+
+#include <windows.h>
+
+#include "CKContext.h"
+#include "CKTexture.h"
+#include "CKMovieReader.h"
+#include "CKPluginManager.h"
+#include "CKPathManager.h"
+#include "VxFastBlit.h"
+#include "VxSPSCQueue.h"
+#include "VxThread.h"
+#include "VxMutex.h"
+#include "VxAtomic.h"
+
+/****************************************************************
+Summary: Plays movies on textures, the frames being decoded ahead on a thread.
+
+Remarks:
+    o A texture playing a movie (CKTexture::LoadMovie) reads each new
+    frame with CKMovieReader::ReadFrame on the main thread. The streamer
+    opens the movie with a reader of its own and a thread decodes the next
+    frames, converted to 32 bit ARGB, in a small ring of images. Update
+    only copies the frame to show into the texture surface, which is sent
+    to video memory when the texture is next used.
+    o The frame shown is the last decoded one whose time is reached; when
+    the decoding falls behind, the frames not decoded in time are skipped
+    by the thread rather than shown late.
+    o The ring images go between the threads through two lock-free queues
+    (the free images to the thread, the decoded ones back), a seek flushes
+    them without waiting for the thread.
+    o The texture must not also play the movie with LoadMovie. A texture
+    must be removed (RemoveMovie) before being deleted: RemoveMovie waits
+    for the current pass of the thread.
+
+    CKMovieStreamer movies(ctx);
+    movies.AddMovie(screen, "attract.avi", TRUE);
+    ...
+    // each frame
+    movies.Update(deltaTime);
+
+See Also: CKMovieReader,CKTexture,CKBitmapLoader
+****************************************************************/
+class CKMovieStreamer
+{
+public:
+    CKMovieStreamer(CKContext *ctx, int ringSize = 4)
+        : m_Context(ctx), m_RingSize(ringSize < 2 ? 2 : ringSize), m_Stop(0), m_Passes(0)
+    {
+        m_Worker = new Worker(this);
+        m_Running = m_Worker->CreateThread();
+    }
+
+    ~CKMovieStreamer()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        m_Worker->Wait();
+        delete m_Worker;
+        for (int i = 0; i < m_Movies.Size(); ++i)
+            delete m_Movies[i];
+    }
+
+    /************************************************
+    Summary: Starts playing a movie file on a texture.
+
+    Arguments:
+        tex: Texture showing the movie, its image is created at the size of the movie.
+        file: Movie file, resolved with the bitmap paths.
+        loop: TRUE to restart the movie at its end.
+    Return Value:
+        CK_OK if successful, an error if the file has no reader or can not be opened.
+    ************************************************/
+    CKERROR AddMovie(CKTexture *tex, CKSTRING file, CKBOOL loop = TRUE)
+    {
+        if (!tex || !file)
+            return CKERR_INVALIDPARAMETER;
+        if (!m_Running)
+            return CKERR_INVALIDOPERATION;
+        RemoveMovie(tex);
+        XString path = file;
+        m_Context->GetPathManager()->ResolveFileName(path, BITMAP_PATH_IDX);
+        CKPathSplitter splitter(path.Str());
+        CKFileExtension ext(splitter.GetExtension());
+        CKMovieReader *reader = CKGetPluginManager()->GetMovieReader(ext);
+        if (!reader)
+            return CKERR_NOTFOUND;
+        if (reader->OpenFile(path.Str()) != CK_OK || reader->GetMovieFrameCount() <= 0 || reader->GetMovieLength() <= 0)
+        {
+            reader->Release();
+            return CKERR_INVALIDFILE;
+        }
+
+        Movie *m = new Movie(m_RingSize);
+        m->m_Texture = tex->GetID();
+        m->m_Reader = reader;
+        m->m_FrameCount = reader->GetMovieFrameCount();
+        m->m_FrameTime = (float)reader->GetMovieLength() / m->m_FrameCount;
+        m->m_Loop = loop;
+        for (int i = 0; i < m_RingSize; ++i)
+            m->m_Free.Push(i);
+
+        VxMutexLock lock(m_Lock);
+        m_Movies.PushBack(m);
+        return CK_OK;
+    }
+
+    // Stops a movie, waiting for the thread to leave it.
+    void RemoveMovie(CKTexture *tex)
+    {
+        Movie *m = NULL;
+        {
+            VxMutexLock lock(m_Lock);
+            const int i = FindIndex(tex);
+            if (i < 0)
+                return;
+            m = m_Movies[i];
+            m_Movies.RemoveAt(i);
+        }
+        // a pass started before the removal is over when the counter moves
+        const long passes = VxAtomicLoad(&m_Passes);
+        while (VxAtomicLoad(&m_Passes) == passes)
+            Sleep(1);
+        delete m;
+    }
+
+    //---------------------------------------------
+    // Main thread
+
+    // Shows a frame at the next Update, the frames after it are decoded from now on.
+    void Seek(CKTexture *tex, int frame)
+    {
+        Movie *m = Find(tex);
+        if (!m)
+            return;
+        frame = XMax(0, XMin(frame, m->m_FrameCount - 1));
+        m->m_Time = frame * m->m_FrameTime;
+        m->m_Shown = frame - 1;
+        // the thread starts again from the frame, the images decoded before are given back
+        VxAtomicStore(&m->m_Target, frame);
+        VxAtomicStore(&m->m_SeekFrame, frame);
+        VxAtomicIncrement(&m->m_Epoch);
+        int slot;
+        while (m->m_Ready.Pop(slot))
+            m->m_Free.Push(slot);
+    }
+
+    void SetSpeed(CKTexture *tex, float speed)
+    {
+        Movie *m = Find(tex);
+        if (m)
+            m->m_Speed = speed;
+    }
+
+    /************************************************
+    Summary: Advances the movies and shows their current frame.
+
+    Arguments:
+        deltaMs: Time elapsed since the previous update, in milliseconds.
+    Return Value:
+        Number of textures whose frame changed.
+    ************************************************/
+    int Update(float deltaMs)
+    {
+        int changed = 0;
+        for (int i = 0; i < m_Movies.Size(); ++i)
+        {
+            Movie *m = m_Movies[i];
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(m->m_Texture);
+            if (!tex)
+                continue;
+            m->m_Time += deltaMs * m->m_Speed;
+            // sequence numbers go on across the loops of the movie
+            int target = (int)(m->m_Time / m->m_FrameTime);
+            if (!m->m_Loop)
+                target = XMin(target, m->m_FrameCount - 1);
+
+            const long epoch = VxAtomicLoad(&m->m_Epoch);
+            int show = -1;
+            int slot;
+            while (const int *next = m->m_Ready.Peek())
+            {
+                Frame &f = m->m_Frames[*next];
+                if (!f.m_Failed && f.m_Epoch == epoch && f.m_Sequence > target)
+                    break;
+                m->m_Ready.Pop(slot);
+                if (f.m_Failed || f.m_Epoch != epoch)
+                {
+                    m->m_Free.Push(slot);
+                    continue;
+                }
+                if (show >= 0)
+                    m->m_Free.Push(show);
+                show = slot;
+            }
+            // the thread skips what is already late
+            VxAtomicStore(&m->m_Target, target);
+            if (show < 0)
+                continue;
+            Frame &f = m->m_Frames[show];
+            if (f.m_Sequence != m->m_Shown && Upload(tex, f.m_Image))
+                ++changed;
+            m->m_Shown = f.m_Sequence;
+            m->m_Free.Push(show);
+        }
+        return changed;
+    }
+
+    // Frame of the movie being shown, -1 if none yet.
+    int GetCurrentFrame(CKTexture *tex)
+    {
+        Movie *m = Find(tex);
+        return (m && m->m_Shown >= 0) ? m->m_Shown % m->m_FrameCount : -1;
+    }
+
+    // Frames skipped by the thread because they were late.
+    int GetSkippedCount(CKTexture *tex)
+    {
+        Movie *m = Find(tex);
+        return m ? (int)VxAtomicLoad(&m->m_Skipped) : 0;
+    }
+
+protected:
+    struct Frame
+    {
+        Frame() : m_Sequence(0), m_Epoch(0), m_Failed(FALSE) {}
+        ~Frame()
+        {
+            if (m_Image.Image)
+                VxDeleteAligned(m_Image.Image);
+        }
+
+        VxImageDescEx m_Image; // 32 bit ARGB
+        int m_Sequence;        // frame number, counting the loops
+        long m_Epoch;          // seek the frame was decoded for
+        CKBOOL m_Failed;       // not decoded, the main thread gives the slot back
+    };
+
+    struct Movie
+    {
+        Movie(int ringSize)
+            : m_Reader(NULL), m_Speed(1.0f), m_Time(0.0f), m_Shown(-1), m_Frames(new Frame[ringSize]), m_Free(ringSize), m_Ready(ringSize),
+              m_Epoch(0), m_SeekFrame(0), m_Target(0), m_Skipped(0), m_Next(0), m_DecodedEpoch(0) {}
+        ~Movie()
+        {
+            delete[] m_Frames;
+            if (m_Reader)
+                m_Reader->Release();
+        }
+
+        CK_ID m_Texture;
+        CKMovieReader *m_Reader;
+        int m_FrameCount;
+        float m_FrameTime; // in milliseconds
+        CKBOOL m_Loop;
+
+        // main thread
+        float m_Speed;
+        float m_Time;
+        int m_Shown;
+
+        Frame *m_Frames;
+        VxSPSCQueue<int> m_Free;  // main thread to decoding thread
+        VxSPSCQueue<int> m_Ready; // decoding thread to main thread, by sequence
+        volatile long m_Epoch;    // incremented by each seek
+        volatile long m_SeekFrame;
+        volatile long m_Target; // sequence due at the last Update
+
+        // decoding thread
+        volatile long m_Skipped;
+        int m_Next; // next sequence to decode
+        long m_DecodedEpoch;
+    };
+
+    class Worker : public VxThread
+    {
+    public:
+        explicit Worker(CKMovieStreamer *streamer) : m_Streamer(streamer) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_Streamer->DecodeLoop();
+            return VXT_OK;
+        }
+
+        CKMovieStreamer *m_Streamer;
+    };
+    friend class Worker;
+
+    int FindIndex(CKTexture *tex)
+    {
+        if (!tex)
+            return -1;
+        for (int i = 0; i < m_Movies.Size(); ++i)
+        {
+            if (m_Movies[i]->m_Texture == tex->GetID())
+                return i;
+        }
+        return -1;
+    }
+
+    Movie *Find(CKTexture *tex)
+    {
+        const int i = FindIndex(tex);
+        return i >= 0 ? m_Movies[i] : NULL;
+    }
+
+    CKBOOL Upload(CKTexture *tex, const VxImageDescEx &img)
+    {
+        if (!img.Image)
+            return FALSE;
+        if (tex->GetWidth() != img.Width || tex->GetHeight() != img.Height || tex->GetSlotCount() < 1)
+        {
+            if (!tex->CreateImage(img.Width, img.Height, 32, 0))
+                return FALSE;
+        }
+        CKBYTE *dst = tex->LockSurfacePtr();
+        if (!dst)
+            return FALSE;
+        memcpy(dst, img.Image, img.BytesPerLine * img.Height);
+        tex->ReleaseSurfacePtr();
+        return TRUE;
+    }
+
+    //---------------------------------------------
+    // Decoding thread
+
+    void DecodeLoop()
+    {
+        XArray<Movie *> movies;
+        while (!VxAtomicLoad(&m_Stop))
+        {
+            {
+                VxMutexLock lock(m_Lock);
+                movies = m_Movies;
+            }
+            CKBOOL busy = FALSE;
+            for (int i = 0; i < movies.Size(); ++i)
+                busy |= Decode(movies[i]);
+            VxAtomicIncrement(&m_Passes);
+            if (!busy)
+                Sleep(2);
+        }
+    }
+
+    // Decodes the next frame into a free image, returns TRUE if one was decoded.
+    CKBOOL Decode(Movie *m)
+    {
+        const long epoch = VxAtomicLoad(&m->m_Epoch);
+        if (epoch != m->m_DecodedEpoch)
+        {
+            m->m_DecodedEpoch = epoch;
+            m->m_Next = (int)VxAtomicLoad(&m->m_SeekFrame);
+        }
+        if (!m->m_Loop && m->m_Next >= m->m_FrameCount)
+            return FALSE;
+        // the frames already late are not decoded
+        const int target = (int)VxAtomicLoad(&m->m_Target);
+        if (m->m_Next < target)
+        {
+            VxAtomicExchangeAdd(&m->m_Skipped, target - m->m_Next);
+            m->m_Next = target;
+        }
+        int slot;
+        if (!m->m_Free.Pop(slot))
+            return FALSE;
+
+        Frame &f = m->m_Frames[slot];
+        CKMovieProperties *mp = NULL;
+        const CKBOOL ok = m->m_Reader->ReadFrame(m->m_Next % m->m_FrameCount, &mp) == CK_OK && mp && Convert(mp, f.m_Image);
+        f.m_Sequence = m->m_Next;
+        f.m_Epoch = epoch;
+        f.m_Failed = !ok;
+        ++m->m_Next;
+        // only the main thread pushes to m_Free: a failed slot goes through m_Ready
+        m->m_Ready.Push(slot);
+        return TRUE;
+    }
+
+    static CKBOOL Convert(CKMovieProperties *mp, VxImageDescEx &dst)
+    {
+        VxImageDescEx src = mp->m_Format;
+        if (!src.Image)
+            src.Image = (XBYTE *)mp->m_Data;
+        if (!src.Image || src.Width <= 0 || src.Height <= 0)
+            return FALSE;
+        if (!dst.Image || dst.Width != src.Width || dst.Height != src.Height)
+        {
+            if (dst.Image)
+                VxDeleteAligned(dst.Image);
+            dst.Width = src.Width;
+            dst.Height = src.Height;
+            dst.BitsPerPixel = 32;
+            dst.BytesPerLine = src.Width * 4;
+            dst.AlphaMask = 0xFF000000;
+            dst.RedMask = 0x00FF0000;
+            dst.GreenMask = 0x0000FF00;
+            dst.BlueMask = 0x000000FF;
+            dst.Image = (XBYTE *)VxNewAligned(dst.BytesPerLine * dst.Height, 16);
+        }
+        VxFastBlit(src, dst);
+        return TRUE;
+    }
+
+    CKContext *m_Context;
+    int m_RingSize;
+    CKBOOL m_Running;
+
+    // shared with the thread
+    VxMutex m_Lock; // the list of movies, changed by the main thread only
+    XArray<Movie *> m_Movies;
+    volatile long m_Stop;
+    volatile long m_Passes;
+    Worker *m_Worker;
+
+private:
+    CKMovieStreamer(const CKMovieStreamer &);
+    CKMovieStreamer &operator=(const CKMovieStreamer &);
+};
+
+#endif // CKMOVIESTREAMER_H
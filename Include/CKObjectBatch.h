@@ -0,0 +1,125 @@
+#ifndef CKOBJECTBATCH_H
+#define CKOBJECTBATCH_H
+
+#include "CKContext.h"
+#include "CKObjectManager.h"
+#include "CKObject.h"
+
+/****************************************************************
+Summary: Contiguous array of the objects referenced by a list of CK_ID.
+
+Remarks:
+    o Resolve() translates the ids of an XObjectArray (or XSObjectArray)
+    to object pointers in one pass through the object table of the
+    CKObjectManager, and keeps only the objects that still exist, are
+    not about to be deleted and are of class T (checked with T::Cast).
+    o The lookups are done in two passes, each prefetching a few
+    entries ahead: the object table slots first, then the object
+    headers, so a loop over thousands of ids does not wait for each memory
+    access in turn.
+    o The batch keeps its memory between two calls to Resolve, so it
+    can be stored in a manager and refreshed once a frame.
+    o The pointers are only valid until objects are deleted.
+
+    // In the manager
+    CKObjectBatch<CK3dEntity> m_Floors;
+    ...
+    // Once per frame
+    m_Floors.Resolve(m_Context, m_FloorIds);
+    for (CK3dEntity **it = m_Floors.Begin(); it != m_Floors.End(); ++it)
+        (*it)->...
+
+See Also: XObjectArray::ConvertToObjects,CKObjectManager
+****************************************************************/
+template <class T = CKObject>
+class CKObjectBatch
+{
+public:
+    typedef T **Iterator;
+
+    enum
+    {
+        PrefetchDistance = 8
+    };
+
+    CKObjectBatch() {}
+
+    // Resolves count ids, returns the number of objects kept.
+    int Resolve(CKContext *Context, const CK_ID *ids, int count)
+    {
+        m_Objects.Resize(count);
+
+        CKObjectManager *om = Context->m_ObjectManager;
+        CKObject **table = om->m_Objects;
+        const CK_ID tableSize = (CK_ID)om->m_ObjectsCount;
+
+        // first pass: table lookups
+        CKObject **objs = (CKObject **)m_Objects.Begin();
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            if (i + PrefetchDistance < count)
+            {
+                CK_ID next = ids[i + PrefetchDistance];
+                if (next < tableSize)
+                    VxPrefetch(&table[next]);
+            }
+            CK_ID id = ids[i];
+            objs[i] = (id < tableSize) ? table[id] : NULL;
+        }
+
+        // second pass: we remove the deleted objects and the ones of another class
+        T **kept = m_Objects.Begin();
+        for (i = 0; i < count; ++i)
+        {
+            if (i + PrefetchDistance < count && objs[i + PrefetchDistance])
+                VxPrefetch(objs[i + PrefetchDistance]);
+            CKObject *obj = objs[i];
+            if (!obj || obj->IsToBeDeleted())
+                continue;
+            T *t = T::Cast(obj);
+            if (t)
+                *kept++ = t;
+        }
+        m_Objects.Resize((int)(kept - m_Objects.Begin()));
+        return m_Objects.Size();
+    }
+
+    int Resolve(CKContext *Context, const XObjectArray &ids)
+    {
+        return Resolve(Context, ids.Begin(), ids.Size());
+    }
+
+    int Resolve(CKContext *Context, const XSObjectArray &ids)
+    {
+        return Resolve(Context, ids.Begin(), ids.Size());
+    }
+
+    // Empties the batch, keeping its memory.
+    void Clear() { m_Objects.Resize(0); }
+
+    // Frees the memory of the batch.
+    void Free() { m_Objects.Clear(); }
+
+    Iterator Begin() const { return m_Objects.Begin(); }
+    Iterator End() const { return m_Objects.End(); }
+    int Size() const { return m_Objects.Size(); }
+
+    T *operator[](int i) const { return m_Objects[i]; }
+
+    // Prefetches the header of the object at index i (when iterating on the batch).
+    void Prefetch(int i) const
+    {
+        if (i < m_Objects.Size())
+            VxPrefetch(m_Objects[i]);
+    }
+
+protected:
+    XArray<T *> m_Objects;
+
+private:
+    CKObjectBatch(const CKObjectBatch &);
+    CKObjectBatch &operator=(const CKObjectBatch &);
+};
+
+#endif // CKOBJECTBATCH_H
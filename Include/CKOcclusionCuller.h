@@ -0,0 +1,215 @@
+#ifndef CKOCCLUSIONCULLER_H
+#define CKOCCLUSIONCULLER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKAttributeManager.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "XObjectArray.h"
+#include "VxDepthRasterizer.h"
+
+/****************************************************************
+Summary: Hides the objects which are behind the occluders of the scene.
+
+Remarks:
+    o The frustum culling of the render context draws the objects which are
+    behind a wall or a building. The entities given the "Occluder" attribute
+    are rasterized each frame in a small software depth buffer
+    (VxDepthRasterizer) from the viewpoint of the render context, and the
+    bounding boxes of the other objects are tested against it.
+    o The occluders should be a few simple meshes (the walls, the ground or
+    a low polygon version of the buildings): SetMaxOccluderFaces ignores
+    the meshes which are too detailed to be drawn quickly.
+    o Attach registers a pre-render callback hiding the 3D objects found
+    occluded and a post-render callback showing them again, so the
+    visibility states of the objects are unchanged outside of the rendering.
+    Begin and IsVisible can also be used directly, for example to skip the
+    update of hidden characters.
+    o The tests are conservative: an object is hidden only when its whole
+    bounding box is behind the occluders.
+
+    CKOcclusionCuller culler(ctx);
+    wall->SetAttribute(culler.GetOccluderAttribute());
+    culler.Attach(dev);
+    ...
+    culler.Detach();
+
+See Also: VxDepthRasterizer,CKRenderContext::AddPreRenderCallBack
+****************************************************************/
+class CKOcclusionCuller
+{
+public:
+    CKOcclusionCuller(CKContext *ctx, int width = 256, int height = 128)
+        : m_Context(ctx), m_Dev(NULL), m_Raster(width, height), m_MaxFaces(4096), m_Hierarchical(FALSE), m_Attached(FALSE)
+    {
+        CKAttributeManager *am = ctx->GetAttributeManager();
+        m_Attribute = am->GetAttributeTypeByName("Occluder");
+        if (m_Attribute < 0)
+            m_Attribute = am->RegisterNewAttributeType("Occluder", CKPGUID_NONE, CKCID_3DENTITY);
+    }
+
+    ~CKOcclusionCuller() { Detach(); }
+
+    // Attribute marking the entities used as occluders.
+    CKAttributeType GetOccluderAttribute() const { return m_Attribute; }
+
+    // Meshes with more faces are not drawn as occluders.
+    void SetMaxOccluderFaces(int count) { m_MaxFaces = count; }
+    int GetMaxOccluderFaces() const { return m_MaxFaces; }
+
+    // TRUE to test the hierarchical box of the objects (a whole character) instead of their own box.
+    void SetHierarchical(CKBOOL hierarchical) { m_Hierarchical = hierarchical; }
+
+    /************************************************
+    Summary: Rasterizes the occluders from the viewpoint of a render context.
+
+    Return Value:
+        Number of occluders drawn.
+    Remarks:
+        The cameras must be prepared (CKRenderContext::PrepareCameras),
+        which is the case in a pre-render callback.
+    ************************************************/
+    int Begin(CKRenderContext *dev)
+    {
+        m_Dev = dev;
+        VxMatrix viewProj;
+        Vx3DMultiplyMatrix4(viewProj, dev->GetProjectionTransformationMatrix(), dev->GetViewTransformationMatrix());
+        m_Raster.SetViewProjection(viewProj);
+        m_Raster.Clear();
+
+        int drawn = 0;
+        const XObjectPointerArray &occluders = m_Context->GetAttributeManager()->GetAttributeListPtr(m_Attribute);
+        for (int i = 0; i < occluders.Size(); ++i)
+        {
+            CK3dEntity *ent = (CK3dEntity *)occluders[i];
+            if (!ent || !CKIsChildClassOf(ent, CKCID_3DENTITY) || !ent->IsVisible() || ent->IsHiddenByParent())
+                continue;
+            CKMesh *mesh = ent->GetCurrentMesh();
+            if (!mesh || mesh->GetFaceCount() > m_MaxFaces)
+                continue;
+            CKDWORD stride;
+            const void *positions = mesh->GetPositionsPtr(&stride);
+            const XWORD *indices = (const XWORD *)mesh->GetFacesIndices();
+            if (!positions || !indices)
+                continue;
+            // skips the occluders off screen or behind the ones already drawn
+            if (!m_Raster.IsVisible(ent->GetBoundingBox(TRUE), ent->GetWorldMatrix()))
+                continue;
+            m_Raster.DrawTriangles(ent->GetWorldMatrix(), positions, (int)stride, mesh->GetVertexCount(), indices, mesh->GetFaceCount());
+            ++drawn;
+        }
+        return drawn;
+    }
+
+    // Tests an entity against the occluders drawn by the last Begin.
+    CKBOOL IsVisible(CK3dEntity *ent) const
+    {
+        if (m_Hierarchical)
+            return m_Raster.IsVisible(ent->GetHierarchicalBox(FALSE));
+        const VxBbox &box = ent->GetBoundingBox(TRUE);
+        if (box.Min.x > box.Max.x)
+            return TRUE;
+        return m_Raster.IsVisible(box, ent->GetWorldMatrix());
+    }
+
+    /************************************************
+    Summary: Tests several entities.
+
+    Arguments:
+        entities: Entities to test.
+        count: Number of entities.
+        visible: Receives the result for each entity.
+    Return Value:
+        Number of entities found occluded.
+    ************************************************/
+    int Cull(CK3dEntity **entities, int count, CKBOOL *visible) const
+    {
+        int occluded = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            visible[i] = entities[i] ? IsVisible(entities[i]) : FALSE;
+            if (entities[i] && !visible[i])
+                ++occluded;
+        }
+        return occluded;
+    }
+
+    // Registers the callbacks hiding the occluded objects of each frame.
+    void Attach(CKRenderContext *dev)
+    {
+        Detach();
+        m_Dev = dev;
+        dev->AddPreRenderCallBack(PreRender, this);
+        dev->AddPostRenderCallBack(PostRender, this);
+        m_Attached = TRUE;
+    }
+
+    void Detach()
+    {
+        if (!m_Attached)
+            return;
+        m_Dev->RemovePreRenderCallBack(PreRender, this);
+        m_Dev->RemovePostRenderCallBack(PostRender, this);
+        Restore();
+        m_Attached = FALSE;
+    }
+
+    // Number of objects hidden in the current frame.
+    int GetOccludedCount() const { return m_Hidden.Size(); }
+
+    VxDepthRasterizer &GetRasterizer() { return m_Raster; }
+
+protected:
+    static void PreRender(CKRenderContext *dev, void *arg)
+    {
+        CKOcclusionCuller *self = (CKOcclusionCuller *)arg;
+        self->Restore();
+        if (!self->Begin(dev))
+            return;
+        const XObjectPointerArray &objects = self->m_Context->GetObjectListByType(CKCID_3DOBJECT, TRUE);
+        for (int i = 0; i < objects.Size(); ++i)
+        {
+            CK3dEntity *ent = (CK3dEntity *)objects[i];
+            if (!ent || !ent->IsVisible() || ent->HasAttribute(self->m_Attribute))
+                continue;
+            if (!self->IsVisible(ent))
+            {
+                ent->Show(CKHIDE);
+                self->m_Hidden.PushBack(ent->GetID());
+            }
+        }
+    }
+
+    static void PostRender(CKRenderContext *dev, void *arg)
+    {
+        ((CKOcclusionCuller *)arg)->Restore();
+    }
+
+    // Shows the objects hidden for the frame.
+    void Restore()
+    {
+        for (int i = 0; i < m_Hidden.Size(); ++i)
+        {
+            CKObject *obj = m_Context->GetObject(m_Hidden[i]);
+            if (obj)
+                obj->Show(CKSHOW);
+        }
+        m_Hidden.Resize(0);
+    }
+
+    CKContext *m_Context;
+    CKRenderContext *m_Dev;
+    VxDepthRasterizer m_Raster;
+    CKAttributeType m_Attribute;
+    int m_MaxFaces;
+    CKBOOL m_Hierarchical;
+    CKBOOL m_Attached;
+    XArray<CK_ID> m_Hidden;
+
+private:
+    CKOcclusionCuller(const CKOcclusionCuller &);
+    CKOcclusionCuller &operator=(const CKOcclusionCuller &);
+};
+
+#endif // CKOCCLUSIONCULLER_H
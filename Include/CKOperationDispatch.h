@@ -0,0 +1,155 @@
+#ifndef CKOPERATIONDISPATCH_H
+#define CKOPERATIONDISPATCH_H
+
+#include "CKContext.h"
+#include "CKParameterManager.h"
+#include "CKParameterIn.h"
+#include "CKParameterOut.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Cache of the parameter operation functions resolved by operation and parameter types.
+
+Remarks:
+    o CKParameterManager::GetOperationFunction searches the operation tree and
+    walks the derivation of the parameter types for each call. The dispatch
+    keeps each resolved function (NULL included) in a hash table indexed by
+    the four GUIDs (operation, result, first and second parameter) so the
+    search is done once per combination of types.
+    o CKOperationCall binds an operation to its parameters: Run calls the
+    function directly and only resolves it again when the type of one of
+    the parameters changed since the previous call.
+    o CKParameterOperation objects already keep their function once it is
+    resolved; the dispatch is meant for the code which calls operation
+    functions itself (building blocks computing operations on their own
+    parameters, tools evaluating expressions...).
+    o Clear must be called when operation functions are registered or
+    unregistered (plugins loaded after the cache was filled).
+
+    CKOperationDispatch dispatch(context);
+    CKOperationCall add;
+    add.Bind(pm->OperationNameToGuid("Addition"), res, p1, p2);
+    ...
+    add.Run(dispatch);
+
+See Also: CKParameterManager::GetOperationFunction,CKParameterOperation,CK_PARAMETEROPERATION
+****************************************************************/
+class CKOperationDispatch
+{
+public:
+    CKOperationDispatch(CKContext *context) : m_Context(context) {}
+
+    CKContext *GetCKContext() { return m_Context; }
+
+    // Same as CKParameterManager::GetOperationFunction.
+    CK_PARAMETEROPERATION GetFunction(CKGUIDCONSTREF operation, CKGUIDCONSTREF res, CKGUIDCONSTREF p1, CKGUIDCONSTREF p2)
+    {
+        OperationKey key;
+        key.m_Operation = operation;
+        key.m_Res = res;
+        key.m_P1 = p1;
+        key.m_P2 = p2;
+        if (CK_PARAMETEROPERATION *fct = m_Functions.FindPtr(key))
+            return *fct;
+
+        CK_PARAMETEROPERATION fct = m_Context->GetParameterManager()->GetOperationFunction(key.m_Operation, key.m_Res, key.m_P1, key.m_P2);
+        m_Functions.Insert(key, fct, TRUE);
+        return fct;
+    }
+
+    void Clear() { m_Functions.Clear(); }
+
+    int GetSize() { return m_Functions.Size(); }
+
+protected:
+    struct OperationKey
+    {
+        CKGUID m_Operation;
+        CKGUID m_Res;
+        CKGUID m_P1;
+        CKGUID m_P2;
+
+        int operator==(const OperationKey &k) const
+        {
+            return m_Operation == k.m_Operation && m_Res == k.m_Res && m_P1 == k.m_P1 && m_P2 == k.m_P2;
+        }
+    };
+
+    struct OperationKeyHash
+    {
+        int operator()(const OperationKey &k) const
+        {
+            return (int)(k.m_Operation.d1 ^ (k.m_Res.d1 * 31) ^ (k.m_P1.d1 * 131) ^ (k.m_P2.d1 * 1031) ^ k.m_Operation.d2);
+        }
+    };
+
+    CKContext *m_Context;
+    XHashTable<CK_PARAMETEROPERATION, OperationKey, OperationKeyHash> m_Functions;
+
+private:
+    CKOperationDispatch(const CKOperationDispatch &);
+    CKOperationDispatch &operator=(const CKOperationDispatch &);
+};
+
+/****************************************************************
+Summary: Parameter operation bound to its parameters, resolved again only when their types change.
+
+See Also: CKOperationDispatch
+****************************************************************/
+class CKOperationCall
+{
+public:
+    CKOperationCall() : m_Res(NULL), m_P1(NULL), m_P2(NULL), m_Function(NULL), m_ResType(-1), m_P1Type(-1), m_P2Type(-1), m_Resolved(FALSE) {}
+
+    void Bind(CKGUIDCONSTREF operation, CKParameterOut *res, CKParameterIn *p1, CKParameterIn *p2)
+    {
+        m_Operation = operation;
+        m_Res = res;
+        m_P1 = p1;
+        m_P2 = p2;
+        m_Resolved = FALSE;
+    }
+
+    // Resolves the function if the types changed. Returns NULL if there is no function for these types.
+    CK_PARAMETEROPERATION GetFunction(CKOperationDispatch &dispatch)
+    {
+        const CKParameterType resType = m_Res ? m_Res->GetType() : -1;
+        const CKParameterType p1Type = m_P1 ? m_P1->GetType() : -1;
+        const CKParameterType p2Type = m_P2 ? m_P2->GetType() : -1;
+        if (!m_Resolved || resType != m_ResType || p1Type != m_P1Type || p2Type != m_P2Type)
+        {
+            m_ResType = resType;
+            m_P1Type = p1Type;
+            m_P2Type = p2Type;
+            m_Function = dispatch.GetFunction(m_Operation,
+                                              m_Res ? m_Res->GetGUID() : CKGUID(0),
+                                              m_P1 ? m_P1->GetGUID() : CKGUID(0),
+                                              m_P2 ? m_P2->GetGUID() : CKGUID(0));
+            m_Resolved = TRUE;
+        }
+        return m_Function;
+    }
+
+    // Returns CKERR_NOTFOUND if there is no function for the types of the parameters.
+    CKERROR Run(CKOperationDispatch &dispatch)
+    {
+        CK_PARAMETEROPERATION fct = GetFunction(dispatch);
+        if (!fct)
+            return CKERR_NOTFOUND;
+        fct(dispatch.GetCKContext(), m_Res, m_P1, m_P2);
+        return CK_OK;
+    }
+
+protected:
+    CKGUID m_Operation;
+    CKParameterOut *m_Res;
+    CKParameterIn *m_P1;
+    CKParameterIn *m_P2;
+    CK_PARAMETEROPERATION m_Function;
+    CKParameterType m_ResType;
+    CKParameterType m_P1Type;
+    CKParameterType m_P2Type;
+    CKBOOL m_Resolved;
+};
+
+#endif // CKOPERATIONDISPATCH_H
@@ -0,0 +1,361 @@
+#ifndef CKPARALLELANIMATOR_H
+#define CKPARALLELANIMATOR_H
+
+#include "CKContext.h"
+#include "CKCharacter.h"
+#include "CKBodyPart.h"
+#include "CKCompiledAnimation.h"
+#include "CKCompressedAnimation.h"
+#include "VxParallel.h"
+#include "VxTimeProfiler.h"
+
+/****************************************************************
+Summary: Animates characters with compiled clips on the threads of a VxParallelPool.
+
+Remarks:
+    o Clip is CKCompiledAnimation or CKCompressedAnimation. The clips only
+    contain data, so the sampling and the blending of all the characters
+    can run in parallel: each character samples its current clip (and the
+    previous one during a cross fade) into its own pose buffer, on a
+    worker thread.
+    o The local matrices of the body parts are then set from the pose
+    buffers on the main thread, which is the only one calling the
+    characters.
+    o The object animations of a clip are given to the body parts of the
+    same name, so a clip compiled from one character plays on all the
+    characters sharing its skeleton. The body parts keep their rest pose
+    (local matrix when the character was added) for the missing tracks.
+    o The characters are not processed by the engine while they are in
+    the animator (CKCharacter::SetAutomaticProcess).
+
+    VxParallelPool pool(3);
+    CKParallelAnimator<CKCompressedAnimation> animator(context, &pool);
+    animator.Add(character);
+    animator.Play(character, &walk, 5.0f);
+    ...
+    animator.Update(deltaTime); // each frame
+
+See Also: CKCompiledAnimation,CKCompressedAnimation,VxParallelPool,CKAnimationScheduler
+****************************************************************/
+template <class Clip>
+class CKParallelAnimator
+{
+public:
+    CKParallelAnimator(CKContext *context, VxParallelPool *pool = NULL, float fps = 30.0f)
+        : m_Context(context), m_Pool(pool), m_FrameRate(fps), m_Time(0.0f) {}
+
+    ~CKParallelAnimator() { Clear(); }
+
+    // Takes over the animation of a character.
+    CKBOOL Add(CKCharacter *character)
+    {
+        if (!character || Find(character->GetID()) >= 0)
+            return FALSE;
+        Entry *e = new Entry;
+        e->m_Character = character->GetID();
+        e->m_Automatic = character->IsAutomaticProcess();
+        e->m_Blend = 1.0f;
+        e->m_BlendSpeed = 0.0f;
+        const int count = character->GetBodyPartCount();
+        e->m_Parts.Resize(count);
+        e->m_Rest.Resize(count);
+        e->m_Pose.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            CKBodyPart *part = character->GetBodyPart(i);
+            e->m_Parts[i] = part ? part->GetID() : 0;
+            if (part)
+                Vx3DDecomposeMatrix(part->GetLocalMatrix(), e->m_Rest[i].m_Rot, e->m_Rest[i].m_Pos, e->m_Rest[i].m_Scale);
+            else
+                e->m_Rest[i].SetIdentity();
+        }
+        m_Entries.PushBack(e);
+        character->SetAutomaticProcess(FALSE);
+        return TRUE;
+    }
+
+    void Remove(CKCharacter *character)
+    {
+        int i = character ? Find(character->GetID()) : -1;
+        if (i < 0)
+            return;
+        Release(m_Entries[i]);
+        m_Entries.RemoveAt(i);
+    }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+            Release(m_Entries[i]);
+        m_Entries.Clear();
+    }
+
+    int GetCharacterCount() const { return m_Entries.Size(); }
+
+    /************************************************
+    Summary: Plays a clip on a character.
+
+    Arguments:
+        character: Character of the animator.
+        clip: Clip to play, it must stay valid while it is played.
+        fadeFrames: Length of the cross fade from the current clip, in frames.
+        loop: TRUE to loop the clip, otherwise it stops on its last frame.
+        speed: Playback speed.
+    ************************************************/
+    CKBOOL Play(CKCharacter *character, const Clip *clip, float fadeFrames = 0.0f, CKBOOL loop = TRUE, float speed = 1.0f)
+    {
+        int i = character ? Find(character->GetID()) : -1;
+        if (i < 0 || !clip)
+            return FALSE;
+        Entry &e = *m_Entries[i];
+        if (fadeFrames > 0.0f && e.m_Current.m_Clip)
+        {
+            e.m_Previous.Swap(e.m_Current);
+            e.m_Blend = 0.0f;
+            e.m_BlendSpeed = 1.0f / fadeFrames;
+        }
+        else
+        {
+            e.m_Previous.m_Clip = NULL;
+            e.m_Blend = 1.0f;
+        }
+        e.m_Current.Start(clip, loop, speed);
+        MapClip(e.m_Current, character);
+        return TRUE;
+    }
+
+    // Frame played by a character, -1 if it plays nothing.
+    float GetFrame(CKCharacter *character) const
+    {
+        int i = character ? Find(character->GetID()) : -1;
+        return (i >= 0 && m_Entries[i]->m_Current.m_Clip) ? m_Entries[i]->m_Current.m_Frame : -1.0f;
+    }
+
+    // Time taken by the last Update (in milliseconds).
+    float GetUpdateTime() const { return m_Time; }
+
+    /************************************************
+    Summary: Animates all the characters.
+
+    Arguments:
+        deltaTime: Time elapsed since the last frame, in milliseconds.
+    ************************************************/
+    void Update(float deltaTime)
+    {
+        VxTimeProfiler profiler;
+        const float frames = deltaTime * m_FrameRate * 0.001f;
+        int i;
+        for (i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = *m_Entries[i];
+            e.m_Active = m_Context->GetObject(e.m_Character) != NULL && e.m_Current.m_Clip;
+            if (!e.m_Active)
+                continue;
+            e.m_Current.Advance(frames);
+            if (e.m_Previous.m_Clip)
+            {
+                e.m_Previous.Advance(frames);
+                e.m_Blend += frames * e.m_BlendSpeed;
+                if (e.m_Blend >= 1.0f)
+                {
+                    e.m_Blend = 1.0f;
+                    e.m_Previous.m_Clip = NULL;
+                }
+            }
+        }
+
+        if (m_Pool)
+            m_Pool->For(m_Entries.Size(), 1, SampleRange, this);
+        else
+            SampleRange(this, 0, m_Entries.Size());
+
+        for (i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = *m_Entries[i];
+            if (!e.m_Active)
+                continue;
+            for (int p = 0; p < e.m_Parts.Size(); ++p)
+            {
+                CK3dEntity *part = (CK3dEntity *)m_Context->GetObject(e.m_Parts[p]);
+                if (part)
+                    part->SetLocalMatrix(e.m_Pose[p]);
+            }
+        }
+
+        m_Time = profiler.Current();
+        if (m_Context->IsProfilingEnable())
+            m_Context->m_Stats.AnimationManagement += m_Time;
+    }
+
+protected:
+    // Local transformation of a body part.
+    struct Transform
+    {
+        void SetIdentity()
+        {
+            m_Rot = VxQuaternion(0.0f, 0.0f, 0.0f, 1.0f);
+            m_Pos = VxVector(0.0f, 0.0f, 0.0f);
+            m_Scale = VxVector(1.0f, 1.0f, 1.0f);
+        }
+
+        VxQuaternion m_Rot;
+        VxVector m_Pos;
+        VxVector m_Scale;
+    };
+
+    // Clip played by a character.
+    struct Layer
+    {
+        Layer() : m_Clip(NULL), m_Frame(0.0f), m_Speed(1.0f), m_Loop(TRUE) {}
+
+        void Start(const Clip *clip, CKBOOL loop, float speed)
+        {
+            m_Clip = clip;
+            m_Frame = 0.0f;
+            m_Loop = loop;
+            m_Speed = speed;
+            clip->CreateCursors(m_Cursors);
+        }
+
+        void Advance(float frames)
+        {
+            const float length = m_Clip->GetLength();
+            m_Frame += frames * m_Speed;
+            if (length <= 0.0f)
+                m_Frame = 0.0f;
+            else if (m_Loop)
+                m_Frame = fmodf(m_Frame, length) + ((m_Frame < 0.0f) ? length : 0.0f);
+            else
+                m_Frame = XMax(0.0f, XMin(m_Frame, length));
+        }
+
+        void Swap(Layer &o)
+        {
+            XSwap(m_Clip, o.m_Clip);
+            XSwap(m_Frame, o.m_Frame);
+            XSwap(m_Speed, o.m_Speed);
+            XSwap(m_Loop, o.m_Loop);
+            m_Cursors.Swap(o.m_Cursors);
+            m_Targets.Swap(o.m_Targets);
+        }
+
+        const Clip *m_Clip;
+        float m_Frame;
+        float m_Speed;
+        CKBOOL m_Loop;
+        XArray<CKAnimationCursor> m_Cursors;
+        XArray<int> m_Targets; // body part of each object animation, -1 if none
+    };
+
+    struct Entry
+    {
+        CK_ID m_Character;
+        CKBOOL m_Automatic;
+        CKBOOL m_Active;
+        float m_Blend;      // weight of the current clip during a cross fade
+        float m_BlendSpeed; // per frame
+        Layer m_Current;
+        Layer m_Previous;
+        XArray<CK_ID> m_Parts;
+        XArray<Transform> m_Rest;
+        XArray<Transform> m_Sampled; // pose of the current clip
+        XArray<Transform> m_Work;    // pose of the previous clip during a cross fade
+        XArray<VxMatrix> m_Pose;  // local matrices, written by the workers
+    };
+
+    int Find(CK_ID id) const
+    {
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            if (m_Entries[i]->m_Character == id)
+                return i;
+        }
+        return -1;
+    }
+
+    void Release(Entry *e)
+    {
+        CKCharacter *character = (CKCharacter *)m_Context->GetObject(e->m_Character);
+        if (character && !character->IsToBeDeleted())
+            character->SetAutomaticProcess(e->m_Automatic);
+        delete e;
+    }
+
+    // Finds the body part animated by each object animation of a clip (by name).
+    void MapClip(Layer &layer, CKCharacter *character)
+    {
+        const int count = layer.m_Clip->GetObjectCount();
+        layer.m_Targets.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            layer.m_Targets[i] = -1;
+            CKObject *src = m_Context->GetObject(layer.m_Clip->GetObject(i).GetEntity());
+            const char *name = src ? src->GetName() : NULL;
+            for (int p = 0; p < character->GetBodyPartCount(); ++p)
+            {
+                CKBodyPart *part = character->GetBodyPart(p);
+                if (part == (CKObject *)src || (name && part && part->GetName() && !strcmp(part->GetName(), name)))
+                {
+                    layer.m_Targets[i] = p;
+                    break;
+                }
+            }
+        }
+    }
+
+    static void SampleLayer(Layer &layer, XArray<Transform> &pose)
+    {
+        for (int i = 0; i < layer.m_Targets.Size(); ++i)
+        {
+            const int p = layer.m_Targets[i];
+            if (p < 0)
+                continue;
+            Transform &t = pose[p];
+            layer.m_Clip->GetObject(i).Evaluate(layer.m_Frame, layer.m_Cursors[i], &t.m_Rot, &t.m_Pos, &t.m_Scale);
+        }
+    }
+
+    // Samples and blends the poses of a range of characters, runs on the workers.
+    static void SampleRange(void *arg, int begin, int end)
+    {
+        CKParallelAnimator &a = *(CKParallelAnimator *)arg;
+        for (int i = begin; i < end; ++i)
+        {
+            Entry &e = *a.m_Entries[i];
+            if (!e.m_Active)
+                continue;
+            const int count = e.m_Parts.Size();
+            XArray<Transform> &pose = e.m_Sampled;
+            pose = e.m_Rest;
+            SampleLayer(e.m_Current, pose);
+            if (e.m_Previous.m_Clip)
+            {
+                e.m_Work = e.m_Rest;
+                SampleLayer(e.m_Previous, e.m_Work);
+                const float w = e.m_Blend;
+                for (int p = 0; p < count; ++p)
+                {
+                    Transform &t = pose[p];
+                    const Transform &o = e.m_Work[p];
+                    t.m_Rot = VxFastNlerp(w, o.m_Rot, t.m_Rot);
+                    t.m_Pos = o.m_Pos + (t.m_Pos - o.m_Pos) * w;
+                    t.m_Scale = o.m_Scale + (t.m_Scale - o.m_Scale) * w;
+                }
+            }
+            for (int p = 0; p < count; ++p)
+                CKCompiledObjectAnimation::BuildMatrix(e.m_Pose[p], pose[p].m_Rot, pose[p].m_Pos, pose[p].m_Scale);
+        }
+    }
+
+    CKContext *m_Context;
+    VxParallelPool *m_Pool;
+    float m_FrameRate;
+    float m_Time;
+    XArray<Entry *> m_Entries;
+
+private:
+    CKParallelAnimator(const CKParallelAnimator &);
+    CKParallelAnimator &operator=(const CKParallelAnimator &);
+};
+
+#endif // CKPARALLELANIMATOR_H
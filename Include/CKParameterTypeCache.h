@@ -0,0 +1,172 @@
+#ifndef CKPARAMETERTYPECACHE_H
+#define CKPARAMETERTYPECACHE_H
+
+#include "CKContext.h"
+#include "CKParameterManager.h"
+#include "CKParameter.h"
+#include "XArray.h"
+
+/****************************************************************
+Summary: Snapshot of the parameter types with a sorted GUID table and a flat derivation matrix.
+
+Remarks:
+    o ParameterGuidToType and IsDerivedFrom of the parameter manager go through
+    its GUID hash table and its derivation masks, rebuilt each time a type is
+    registered. Once the types are registered (after the plugins are loaded)
+    they no longer change: the cache copies them into
+        - a table of (GUID, type) sorted by GUID, searched by dichotomy,
+        - a bit matrix with a row per type where the bit of each type it
+        derives from (and its own) is set: IsDerivedFrom is a single bit test,
+        - the array of the type descriptions, indexed by type.
+    o The snapshot is rebuilt by Update when the number of registered types
+    changed (new plugin, new structure, enum or flags); Invalidate forces
+    it after a type was unregistered.
+    o A parameter already keeps a pointer to its type description
+    (CKParameter::GetParameterType) which should be preferred to a lookup by
+    type for checks on existing parameters.
+
+    CKParameterTypeCache types(context);
+    ...
+    types.Update();
+    if (types.IsDerivedFrom(out->GetParameterType()->Index, types.GuidToType(CKPGUID_FLOAT)))
+        in->SetDirectSource(out);
+
+See Also: CKParameterManager,CKParameterTypeDesc,CKParameter::GetParameterType
+****************************************************************/
+class CKParameterTypeCache
+{
+public:
+    CKParameterTypeCache(CKContext *context) : m_Context(context), m_Count(-1), m_RowSize(0) {}
+
+    // Rebuilds the tables if the number of types changed. Returns TRUE if they were rebuilt.
+    CKBOOL Update()
+    {
+        CKParameterManager *pm = m_Context->GetParameterManager();
+        if (pm->GetParameterTypesCount() == m_Count)
+            return FALSE;
+        Build(pm);
+        return TRUE;
+    }
+
+    void Invalidate() { m_Count = -1; }
+
+    int GetTypeCount() const { return m_Count; }
+
+    // Type of a GUID, -1 if it is not a registered type.
+    CKParameterType GuidToType(CKGUIDCONSTREF guid) const
+    {
+        int lo = 0;
+        int hi = m_Guids.Size() - 1;
+        while (lo <= hi)
+        {
+            const int mid = (lo + hi) >> 1;
+            const GuidEntry &e = m_Guids[mid];
+            if (e.m_Guid == guid)
+                return e.m_Type;
+            if (e.m_Guid < guid)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+        return -1;
+    }
+
+    CKParameterTypeDesc *GetTypeDesc(CKParameterType type) const
+    {
+        return (type >= 0 && type < m_Descs.Size()) ? m_Descs[type] : NULL;
+    }
+
+    CKParameterTypeDesc *GetTypeDesc(CKGUIDCONSTREF guid) const { return GetTypeDesc(GuidToType(guid)); }
+
+    // TRUE if child is parent or derives from it, directly or not.
+    CKBOOL IsDerivedFrom(CKParameterType child, CKParameterType parent) const
+    {
+        if (child < 0 || parent < 0 || child >= m_Count || parent >= m_Count)
+            return FALSE;
+        return (m_Derivation[child * m_RowSize + (parent >> 5)] >> (parent & 31)) & 1;
+    }
+
+    CKBOOL IsDerivedFrom(CKGUIDCONSTREF child, CKGUIDCONSTREF parent) const
+    {
+        return IsDerivedFrom(GuidToType(child), GuidToType(parent));
+    }
+
+    // TRUE if one of the types derives from the other.
+    CKBOOL IsTypeCompatible(CKParameterType type1, CKParameterType type2) const
+    {
+        return IsDerivedFrom(type1, type2) || IsDerivedFrom(type2, type1);
+    }
+
+    CKBOOL IsDerivedFrom(CKParameter *child, CKParameterType parent) const
+    {
+        CKParameterTypeDesc *desc = child ? child->GetParameterType() : NULL;
+        return desc && IsDerivedFrom(desc->Index, parent);
+    }
+
+protected:
+    struct GuidEntry
+    {
+        CKGUID m_Guid;
+        CKParameterType m_Type;
+    };
+
+    static int CompareGuids(const void *a, const void *b)
+    {
+        const CKGUID &g1 = ((const GuidEntry *)a)->m_Guid;
+        const CKGUID &g2 = ((const GuidEntry *)b)->m_Guid;
+        if (g1 == g2)
+            return 0;
+        return (g1 < g2) ? -1 : 1;
+    }
+
+    void Build(CKParameterManager *pm)
+    {
+        const int count = pm->GetParameterTypesCount();
+        m_Descs.Resize(count);
+        m_Guids.Resize(0);
+        for (int t = 0; t < count; ++t)
+        {
+            CKParameterTypeDesc *desc = pm->GetParameterTypeDescription(t);
+            m_Descs[t] = (desc && desc->Valid) ? desc : NULL;
+            if (!m_Descs[t])
+                continue;
+            GuidEntry e;
+            e.m_Guid = desc->Guid;
+            e.m_Type = t;
+            m_Guids.PushBack(e);
+        }
+        m_Guids.Sort(CompareGuids);
+        m_Count = count;
+
+        // Each type sets its own bit and the bits of its parents (the chain
+        // is at most count long, which also stops on an erroneous cycle).
+        m_RowSize = (count + 31) >> 5;
+        m_Derivation.Resize(count * m_RowSize);
+        if (m_Derivation.Size())
+            memset(m_Derivation.Begin(), 0, m_Derivation.Size() * sizeof(CKDWORD));
+        for (int t = 0; t < count; ++t)
+        {
+            CKDWORD *row = m_Derivation.Begin() + t * m_RowSize;
+            int type = t;
+            for (int depth = 0; type >= 0 && depth < count; ++depth)
+            {
+                row[type >> 5] |= 1 << (type & 31);
+                CKParameterTypeDesc *desc = m_Descs[type];
+                type = (desc && desc->DerivedFrom != CKGUID()) ? GuidToType(desc->DerivedFrom) : -1;
+            }
+        }
+    }
+
+    CKContext *m_Context;
+    int m_Count;
+    int m_RowSize;
+    XArray<CKParameterTypeDesc *> m_Descs;
+    XArray<GuidEntry> m_Guids;
+    XArray<CKDWORD> m_Derivation;
+
+private:
+    CKParameterTypeCache(const CKParameterTypeCache &);
+    CKParameterTypeCache &operator=(const CKParameterTypeCache &);
+};
+
+#endif // CKPARAMETERTYPECACHE_H
@@ -0,0 +1,585 @@
+#ifndef CKPATCHTESSELLATOR_H
+#define CKPATCHTESSELLATOR_H
+
+#include "CKPatchMesh.h"
+#include "CKMaterial.h"
+#include "VxParallel.h"
+#include "XClassArray.h"
+
+/****************************************************************
+Summary: Tessellates the patches of a CKPatchMesh into a mesh, keeping the result of each iteration count.
+
+Remarks:
+    o The tessellation of a CKPatchMesh is rebuilt completely each time a
+    control point moves or the iteration count changes. The tessellator
+    evaluates the patches in a target CKMesh and keeps, for each iteration
+    count used, the vertices, normals and texture coordinates of all the
+    patches with the control points they were computed from.
+    o Update compares the control points (verts, vecs and interiors) and the
+    corner texture coordinates of each patch with the cached ones: only the
+    patches which changed are evaluated again, and only their vertices are
+    copied to the target mesh. Going back to an iteration count already
+    used copies the cached level as is.
+    o The moved patches are evaluated on the threads of a VxParallelPool,
+    each patch writing its own vertices.
+    o Each patch gets (n+1)x(n+1) vertices (quad patches) or (n+1)(n+2)/2
+    vertices (triangular patches) for n = iteration count + 1 segments per
+    edge, with normals computed from the derivatives of the surface so the
+    patches joining smoothly have the same normals on their common edge.
+    The triangular patches are evaluated as cubic Bezier triangles whose
+    center is the mean of their three interior vecs.
+    o The faces are given the material of their patch. The mesh must stay
+    under 65536 vertices.
+
+    CKPatchTessellator tess(&pool);
+    ...
+    // each frame, after the control points were moved
+    tess.Update(patchMesh, renderMesh);
+
+See Also: CKPatchMesh,CKPatchMesh::GetVerts,VxParallelPool
+****************************************************************/
+class CKPatchTessellator
+{
+public:
+    explicit CKPatchTessellator(VxParallelPool *pool = NULL) : m_Pool(pool), m_Target(0), m_TargetSteps(-1), m_PatchCount(0), m_Signature(0), m_Evaluated(0) {}
+
+    // Drops the cached levels, to call when the patches of the mesh were changed.
+    void Invalidate()
+    {
+        m_Levels.Resize(0);
+        m_TargetSteps = -1;
+    }
+
+    /************************************************
+    Summary: Updates the tessellation of a patch mesh in a mesh.
+
+    Arguments:
+        patchMesh: Patches to tessellate.
+        target: Mesh receiving the triangles.
+        steps: Iteration count, -1 to use the one of the patch mesh.
+    Return Value:
+        FALSE if the tessellation has too many vertices.
+    ************************************************/
+    CKBOOL Update(CKPatchMesh *patchMesh, CKMesh *target, int steps = -1)
+    {
+        if (!patchMesh || !target)
+            return FALSE;
+        if (steps < 0)
+            steps = patchMesh->GetIterationCount();
+        if (steps < 0)
+            steps = 0;
+
+        // a change of the patches themselves invalidates all the levels
+        const CKDWORD signature = Signature(patchMesh);
+        if (signature != m_Signature || patchMesh->GetPatchCount() != m_PatchCount)
+        {
+            Invalidate();
+            m_Signature = signature;
+            m_PatchCount = patchMesh->GetPatchCount();
+        }
+        if (target->GetID() != m_Target)
+        {
+            m_Target = target->GetID();
+            m_TargetSteps = -1;
+        }
+
+        Level *level = FindLevel(steps);
+        if (!level)
+        {
+            level = CreateLevel(patchMesh, steps);
+            if (!level)
+                return FALSE;
+        }
+
+        Job job;
+        job.m_Level = level;
+        job.m_Patches = patchMesh->GetPatches();
+        job.m_Changed.Resize(0);
+        FindChanged(patchMesh, *level, job);
+        Evaluate(job);
+        m_Evaluated = job.m_Changed.Size();
+
+        // the whole level when the target shows another level, else the changed patches
+        const CKBOOL full = (m_TargetSteps != steps) || target->GetVertexCount() != level->m_Positions.Size();
+        if (full)
+        {
+            WriteFaces(patchMesh, *level, target);
+            WriteVertices(*level, target, 0, m_PatchCount);
+            m_TargetSteps = steps;
+        }
+        else
+        {
+            for (int i = 0; i < job.m_Changed.Size(); ++i)
+                WriteVertices(*level, target, job.m_Changed[i], job.m_Changed[i] + 1);
+            UpdateMaterials(patchMesh, *level, target);
+        }
+        if (full || job.m_Changed.Size())
+        {
+            target->VertexMove();
+            target->NormalChanged();
+            target->UVChanged();
+        }
+        return TRUE;
+    }
+
+    // Patches evaluated by the last Update.
+    int GetEvaluatedPatchCount() const { return m_Evaluated; }
+
+    // Number of iteration counts cached.
+    int GetCachedLevelCount() const { return m_Levels.Size(); }
+
+protected:
+    // Inputs of a patch at the time it was evaluated.
+    struct Snapshot
+    {
+        VxVector m_Points[16]; // 4x4 net of a quad patch, 10 points of a triangular patch
+        VxUV m_UVs[4];
+        XBOOL m_Valid;         // FALSE until the patch is evaluated
+
+        Snapshot() : m_Valid(FALSE) {}
+
+        XBOOL IsSame(const Snapshot &s) const
+        {
+            return m_Valid && s.m_Valid &&
+                   !memcmp(m_Points, s.m_Points, sizeof(m_Points)) &&
+                   !memcmp(m_UVs, s.m_UVs, sizeof(m_UVs));
+        }
+    };
+
+    struct PatchState
+    {
+        int m_FirstVertex;
+        int m_FirstFace;
+        int m_Segments;
+        CK_ID m_Material;
+        XBOOL m_Quad;
+    };
+
+    struct Level
+    {
+        int m_Steps;
+        XArray<PatchState> m_States;
+        XArray<Snapshot> m_Snapshots;
+        XArray<VxVector> m_Positions;
+        XArray<VxVector> m_Normals;
+        XArray<VxUV> m_UVs;
+        XArray<CKWORD> m_Indices;
+    };
+
+    struct Job
+    {
+        Level *m_Level;
+        CKPatch *m_Patches;
+        XArray<int> m_Changed;
+    };
+
+    // Checksum of the patch types and indices.
+    static CKDWORD Signature(CKPatchMesh *patchMesh)
+    {
+        CKDWORD sum = (CKDWORD)patchMesh->GetVertCount() * 31 + (CKDWORD)patchMesh->GetVecCount();
+        CKPatch *patches = patchMesh->GetPatches();
+        CKTVPatch *tvs = patchMesh->GetTVPatches(-1);
+        for (int i = 0; i < patchMesh->GetPatchCount(); ++i)
+        {
+            const CKPatch &p = patches[i];
+            sum = sum * 33 + p.type;
+            int k;
+            for (k = 0; k < 4; ++k)
+                sum = sum * 33 + (CKDWORD)(p.v[k] + 7 * p.interior[k]);
+            for (k = 0; k < 8; ++k)
+                sum = sum * 33 + (CKDWORD)p.vec[k];
+            if (tvs)
+                sum = sum * 33 + (CKDWORD)(tvs[i].tv[0] + 3 * tvs[i].tv[1] + 5 * tvs[i].tv[2] + 7 * tvs[i].tv[3]);
+        }
+        return sum;
+    }
+
+    Level *FindLevel(int steps)
+    {
+        for (int i = 0; i < m_Levels.Size(); ++i)
+        {
+            if (m_Levels[i].m_Steps == steps)
+                return &m_Levels[i];
+        }
+        return NULL;
+    }
+
+    // Allocates the vertices of a level and builds its faces.
+    Level *CreateLevel(CKPatchMesh *patchMesh, int steps)
+    {
+        const int segments = steps + 1;
+        CKPatch *patches = patchMesh->GetPatches();
+        XArray<PatchState> states;
+        states.Resize(m_PatchCount);
+        int vertices = 0, faces = 0;
+        int i;
+        for (i = 0; i < m_PatchCount; ++i)
+        {
+            PatchState &s = states[i];
+            s.m_Quad = patches[i].type == CK_PATCH_QUAD;
+            s.m_Segments = segments;
+            s.m_FirstVertex = vertices;
+            s.m_FirstFace = faces;
+            s.m_Material = patches[i].Material;
+            vertices += s.m_Quad ? (segments + 1) * (segments + 1) : (segments + 1) * (segments + 2) / 2;
+            faces += s.m_Quad ? 2 * segments * segments : segments * segments;
+        }
+        if (vertices > 65535)
+            return NULL;
+
+        m_Levels.Expand(1);
+        Level &level = m_Levels[m_Levels.Size() - 1];
+        level.m_Steps = steps;
+        level.m_States = states;
+        // invalid snapshots: all the patches are evaluated the first time
+        level.m_Snapshots.Resize(m_PatchCount);
+        for (i = 0; i < m_PatchCount; ++i)
+            level.m_Snapshots[i].m_Valid = FALSE;
+        level.m_Positions.Resize(vertices);
+        level.m_Normals.Resize(vertices);
+        level.m_UVs.Resize(vertices);
+        level.m_Indices.Resize(3 * faces);
+
+        CKWORD *idx = level.m_Indices.Begin();
+        for (i = 0; i < m_PatchCount; ++i)
+        {
+            const PatchState &s = states[i];
+            const int n = s.m_Segments;
+            const int base = s.m_FirstVertex;
+            if (s.m_Quad)
+            {
+                for (int r = 0; r < n; ++r)
+                {
+                    for (int c = 0; c < n; ++c)
+                    {
+                        const int v00 = base + r * (n + 1) + c;
+                        const int v10 = v00 + n + 1;
+                        *idx++ = (CKWORD)v00;
+                        *idx++ = (CKWORD)(v00 + 1);
+                        *idx++ = (CKWORD)(v10 + 1);
+                        *idx++ = (CKWORD)v00;
+                        *idx++ = (CKWORD)(v10 + 1);
+                        *idx++ = (CKWORD)v10;
+                    }
+                }
+            }
+            else
+            {
+                int row = base;
+                for (int r = 0; r < n; ++r)
+                {
+                    const int next = row + n + 1 - r;
+                    for (int q = 0; q < n - r; ++q)
+                    {
+                        *idx++ = (CKWORD)(row + q);
+                        *idx++ = (CKWORD)(row + q + 1);
+                        *idx++ = (CKWORD)(next + q);
+                        if (q + 1 < n - r)
+                        {
+                            *idx++ = (CKWORD)(row + q + 1);
+                            *idx++ = (CKWORD)(next + q + 1);
+                            *idx++ = (CKWORD)(next + q);
+                        }
+                    }
+                    row = next;
+                }
+            }
+        }
+        return &level;
+    }
+
+    // Gathers the control net of each patch and lists the ones which moved.
+    void FindChanged(CKPatchMesh *patchMesh, Level &level, Job &job)
+    {
+        const CKBOOL autoSmooth = (patchMesh->GetPatchFlags() & CK_PATCHMESH_AUTOSMOOTH) != 0;
+        const VxVector *verts = patchMesh->GetVerts();
+        const VxVector *vecs = patchMesh->GetVecs();
+        const CKPatch *patches = job.m_Patches;
+        const CKTVPatch *tvPatches = patchMesh->GetTVPatches(-1);
+        const VxUV *tvs = patchMesh->GetTVs(-1);
+        for (int i = 0; i < m_PatchCount; ++i)
+        {
+            Snapshot s;
+            Gather(patches[i], verts, vecs, tvPatches ? &tvPatches[i] : NULL, tvs, s);
+            if (s.IsSame(level.m_Snapshots[i]))
+                continue;
+            if (autoSmooth)
+            {
+                // the interiors follow the edges
+                patchMesh->ComputePatchInteriors(i);
+                vecs = patchMesh->GetVecs();
+                Gather(patches[i], verts, vecs, tvPatches ? &tvPatches[i] : NULL, tvs, s);
+            }
+            level.m_Snapshots[i] = s;
+            job.m_Changed.PushBack(i);
+        }
+    }
+
+    static void Gather(const CKPatch &p, const VxVector *verts, const VxVector *vecs, const CKTVPatch *tv, const VxUV *tvs, Snapshot &s)
+    {
+        int k;
+        for (k = 0; k < 16; ++k)
+            s.m_Points[k] = VxVector(0.0f, 0.0f, 0.0f);
+        for (k = 0; k < 4; ++k)
+            s.m_UVs[k] = VxUV(0.0f, 0.0f);
+        s.m_Valid = TRUE;
+        if (p.type == CK_PATCH_QUAD)
+        {
+            // rows go from edge v0-v1 to edge v3-v2
+            static const int corner[4] = {0, 3, 15, 12};
+            static const int edge[8] = {1, 2, 7, 11, 14, 13, 8, 4};
+            static const int inner[4] = {5, 6, 10, 9};
+            for (k = 0; k < 4; ++k)
+            {
+                s.m_Points[corner[k]] = verts[p.v[k]];
+                s.m_Points[inner[k]] = vecs[p.interior[k]];
+            }
+            for (int e = 0; e < 8; ++e)
+                s.m_Points[edge[e]] = vecs[p.vec[e]];
+        }
+        else
+        {
+            // b300 b030 b003, b210 b120 b021 b012 b102 b201, b111
+            for (k = 0; k < 3; ++k)
+                s.m_Points[k] = verts[p.v[k]];
+            for (k = 0; k < 6; ++k)
+                s.m_Points[3 + k] = vecs[p.vec[k]];
+            s.m_Points[9] = (vecs[p.interior[0]] + vecs[p.interior[1]] + vecs[p.interior[2]]) * (1.0f / 3.0f);
+        }
+        if (tv && tvs)
+        {
+            for (k = 0; k < (int)p.type && k < 4; ++k)
+                s.m_UVs[k] = tvs[tv->tv[k]];
+        }
+    }
+
+    void Evaluate(Job &job)
+    {
+        if (!job.m_Changed.Size())
+            return;
+        if (m_Pool)
+            m_Pool->For(job.m_Changed.Size(), 1, EvaluateRange, &job);
+        else
+            EvaluateRange(&job, 0, job.m_Changed.Size());
+    }
+
+    static void EvaluateRange(void *arg, int begin, int end)
+    {
+        Job &job = *(Job *)arg;
+        Level &level = *job.m_Level;
+        for (int i = begin; i < end; ++i)
+        {
+            const int p = job.m_Changed[i];
+            const PatchState &s = level.m_States[p];
+            VxVector *pos = level.m_Positions.Begin() + s.m_FirstVertex;
+            VxVector *nrm = level.m_Normals.Begin() + s.m_FirstVertex;
+            VxUV *uv = level.m_UVs.Begin() + s.m_FirstVertex;
+            if (s.m_Quad)
+                EvaluateQuad(level.m_Snapshots[p], s.m_Segments, pos, nrm, uv);
+            else
+                EvaluateTri(level.m_Snapshots[p], s.m_Segments, pos, nrm, uv);
+        }
+    }
+
+    static void Bernstein(float t, float b[4], float d[4])
+    {
+        const float s = 1.0f - t;
+        b[0] = s * s * s;
+        b[1] = 3.0f * t * s * s;
+        b[2] = 3.0f * t * t * s;
+        b[3] = t * t * t;
+        d[0] = -3.0f * s * s;
+        d[1] = 3.0f * s * s - 6.0f * t * s;
+        d[2] = 6.0f * t * s - 3.0f * t * t;
+        d[3] = 3.0f * t * t;
+    }
+
+    static void SetNormal(const VxVector &du, const VxVector &dv, VxVector &n)
+    {
+        n = CrossProduct(du, dv);
+        const float len = Magnitude(n);
+        if (len > 1e-12f)
+            n *= 1.0f / len;
+        else
+            n = VxVector(0.0f, 1.0f, 0.0f);
+    }
+
+    static void EvaluateQuad(const Snapshot &s, int n, VxVector *pos, VxVector *nrm, VxUV *uv)
+    {
+        const float step = 1.0f / (float)n;
+        for (int r = 0; r <= n; ++r)
+        {
+            float bv[4], dv[4];
+            const float v = r * step;
+            Bernstein(v, bv, dv);
+            for (int c = 0; c <= n; ++c)
+            {
+                float bu[4], du[4];
+                const float u = c * step;
+                Bernstein(u, bu, du);
+                VxVector p(0.0f, 0.0f, 0.0f), pu(0.0f, 0.0f, 0.0f), pv(0.0f, 0.0f, 0.0f);
+                for (int j = 0; j < 4; ++j)
+                {
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        const VxVector &cp = s.m_Points[j * 4 + i];
+                        p += cp * (bu[i] * bv[j]);
+                        pu += cp * (du[i] * bv[j]);
+                        pv += cp * (bu[i] * dv[j]);
+                    }
+                }
+                *pos++ = p;
+                SetNormal(pu, pv, *nrm++);
+                uv->u = (1.0f - u) * (1.0f - v) * s.m_UVs[0].u + u * (1.0f - v) * s.m_UVs[1].u + u * v * s.m_UVs[2].u + (1.0f - u) * v * s.m_UVs[3].u;
+                uv->v = (1.0f - u) * (1.0f - v) * s.m_UVs[0].v + u * (1.0f - v) * s.m_UVs[1].v + u * v * s.m_UVs[2].v + (1.0f - u) * v * s.m_UVs[3].v;
+                ++uv;
+            }
+        }
+    }
+
+    // Control point b(i,j,k) of the cubic triangle, i + j + k = 3.
+    static const VxVector &TriPoint(const Snapshot &s, int i, int j, int k)
+    {
+        // index by (j, k): the weights of v1 and v2
+        static const int index[4][4] = {
+            {0, 8, 7, 2},  // b300 b201 b102 b003
+            {3, 9, 6, -1}, // b210 b111 b012
+            {4, 5, -1, -1}, // b120 b021
+            {1, -1, -1, -1}, // b030
+        };
+        (void)i;
+        return s.m_Points[index[j][k]];
+    }
+
+    static void EvaluateTri(const Snapshot &s, int n, VxVector *pos, VxVector *nrm, VxUV *uv)
+    {
+        static const float trinomial2[3][3] = {{1.0f, 2.0f, 1.0f}, {2.0f, 2.0f, 0.0f}, {1.0f, 0.0f, 0.0f}};
+        static const float trinomial3[4][4] = {{1.0f, 3.0f, 3.0f, 1.0f}, {3.0f, 6.0f, 3.0f, 0.0f}, {3.0f, 3.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f, 0.0f}};
+        const float step = 1.0f / (float)n;
+        for (int r = 0; r <= n; ++r)
+        {
+            const float c = r * step;
+            for (int q = 0; q <= n - r; ++q)
+            {
+                const float b = q * step;
+                const float a = XMax(0.0f, 1.0f - b - c);
+                const float pa[4] = {1.0f, a, a * a, a * a * a};
+                const float pb[4] = {1.0f, b, b * b, b * b * b};
+                const float pc[4] = {1.0f, c, c * c, c * c * c};
+                VxVector p(0.0f, 0.0f, 0.0f), pu(0.0f, 0.0f, 0.0f), pv(0.0f, 0.0f, 0.0f);
+                int j, k;
+                for (j = 0; j <= 3; ++j)
+                {
+                    for (k = 0; j + k <= 3; ++k)
+                        p += TriPoint(s, 3 - j - k, j, k) * (trinomial3[j][k] * pa[3 - j - k] * pb[j] * pc[k]);
+                }
+                // derivatives towards v1 and v2
+                for (j = 0; j <= 2; ++j)
+                {
+                    for (k = 0; j + k <= 2; ++k)
+                    {
+                        const int i = 2 - j - k;
+                        const float w = 3.0f * trinomial2[j][k] * pa[i] * pb[j] * pc[k];
+                        const VxVector &base = TriPoint(s, i + 1, j, k);
+                        pu += (TriPoint(s, i, j + 1, k) - base) * w;
+                        pv += (TriPoint(s, i, j, k + 1) - base) * w;
+                    }
+                }
+                *pos++ = p;
+                SetNormal(pu, pv, *nrm++);
+                uv->u = a * s.m_UVs[0].u + b * s.m_UVs[1].u + c * s.m_UVs[2].u;
+                uv->v = a * s.m_UVs[0].v + b * s.m_UVs[1].v + c * s.m_UVs[2].v;
+                ++uv;
+            }
+        }
+    }
+
+    void WriteFaces(CKPatchMesh *patchMesh, Level &level, CKMesh *target)
+    {
+        const int faceCount = level.m_Indices.Size() / 3;
+        target->SetVertexCount(level.m_Positions.Size());
+        target->SetFaceCount(faceCount);
+        CKWORD *indices = target->GetFacesIndices();
+        if (indices)
+            memcpy(indices, level.m_Indices.Begin(), level.m_Indices.Size() * sizeof(CKWORD));
+        for (int i = 0; i < m_PatchCount; ++i)
+        {
+            PatchState &s = level.m_States[i];
+            s.m_Material = PatchMaterial(patchMesh, i);
+            SetMaterial(level, i, patchMesh->GetPatchMaterial(i), target);
+        }
+    }
+
+    static CK_ID PatchMaterial(CKPatchMesh *patchMesh, int index)
+    {
+        CKMaterial *mat = patchMesh->GetPatchMaterial(index);
+        return mat ? mat->GetID() : 0;
+    }
+
+    // Gives the faces of the patches whose material changed their new material.
+    void UpdateMaterials(CKPatchMesh *patchMesh, Level &level, CKMesh *target)
+    {
+        for (int i = 0; i < m_PatchCount; ++i)
+        {
+            const CK_ID mat = PatchMaterial(patchMesh, i);
+            if (mat == level.m_States[i].m_Material)
+                continue;
+            level.m_States[i].m_Material = mat;
+            SetMaterial(level, i, patchMesh->GetPatchMaterial(i), target);
+        }
+    }
+
+    void SetMaterial(const Level &level, int patch, CKMaterial *mat, CKMesh *target)
+    {
+        const PatchState &s = level.m_States[patch];
+        const int end = (patch + 1 < m_PatchCount) ? level.m_States[patch + 1].m_FirstFace : level.m_Indices.Size() / 3;
+        for (int f = s.m_FirstFace; f < end; ++f)
+            target->SetFaceMaterial(f, mat);
+    }
+
+    // Copies the vertices of the patches [begin,end[ to the target.
+    void WriteVertices(const Level &level, CKMesh *target, int begin, int end)
+    {
+        if (begin >= end)
+            return;
+        const int first = level.m_States[begin].m_FirstVertex;
+        const int last = (end < m_PatchCount) ? level.m_States[end].m_FirstVertex : level.m_Positions.Size();
+        CKDWORD stride;
+        CKBYTE *dst = (CKBYTE *)target->GetPositionsPtr(&stride);
+        int v;
+        if (dst)
+        {
+            dst += first * stride;
+            for (v = first; v < last; ++v, dst += stride)
+                *(VxVector *)dst = level.m_Positions[v];
+        }
+        dst = (CKBYTE *)target->GetNormalsPtr(&stride);
+        if (dst)
+        {
+            dst += first * stride;
+            for (v = first; v < last; ++v, dst += stride)
+                *(VxVector *)dst = level.m_Normals[v];
+        }
+        dst = (CKBYTE *)target->GetTextureCoordinatesPtr(&stride, -1);
+        if (dst)
+        {
+            dst += first * stride;
+            for (v = first; v < last; ++v, dst += stride)
+                *(VxUV *)dst = level.m_UVs[v];
+        }
+    }
+
+    VxParallelPool *m_Pool;
+    XClassArray<Level> m_Levels;
+    CK_ID m_Target;
+    int m_TargetSteps; // level shown by the target, -1 if none
+    int m_PatchCount;
+    CKDWORD m_Signature;
+    int m_Evaluated;
+
+private:
+    CKPatchTessellator(const CKPatchTessellator &);
+    CKPatchTessellator &operator=(const CKPatchTessellator &);
+};
+
+#endif // CKPATCHTESSELLATOR_H
@@ -0,0 +1,185 @@
+#ifndef CKPATHCACHE_H
+#define CKPATHCACHE_H
+
+#include <string.h>
+#include <windows.h>
+
+#include "CKContext.h"
+#include "CKPathManager.h"
+#include "CKDirectoryParser.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Cache of the directory listings of the path categories resolving file names without probing the disk.
+
+Remarks:
+    o CKPathManager::ResolveFileName tries to open the file in each path
+    of the category, for every name. Resolve gives the same result from
+    a listing of each directory, read once (one FindFirstFile enumeration
+    per directory instead of one open per name and per path): resolving
+    a name is a hash lookup per path.
+    o A category is listed again when its paths change (they are compared
+    with the ones of the path manager at each call, which covers AddPath,
+    RemovePath, RenamePath and SwapPaths) and when one of its directories
+    changes on disk (a change notification is set on each directory and
+    tested at each call). Invalidate forces it.
+    o Only the simple names found in the listings are resolved from the
+    cache: absolute paths, URLs, names with a directory part and names
+    which are in no listing go through CKPathManager::ResolveFileName.
+    o The cache is only used by the code calling Resolve: the files loaded
+    by CK2 itself (textures of a composition, for example) still resolve
+    their names with the path manager.
+
+    CKPathCache paths(context);
+    XString file("wood.jpg");
+    if (paths.Resolve(file, BITMAP_PATH_IDX) == CK_OK)
+        texture->LoadImage(file.Str());
+
+See Also: CKPathManager::ResolveFileName
+****************************************************************/
+class CKPathCache
+{
+public:
+    CKPathCache(CKContext *context, CKBOOL watch = TRUE) : m_Context(context), m_Watch(watch), m_Hits(0), m_Misses(0) {}
+
+    ~CKPathCache() { Invalidate(); }
+
+    /*************************************************
+    Summary: Same as CKPathManager::ResolveFileName.
+
+    Arguments:
+        file: Name to resolve, replaced by the full path when found.
+        catIdx: Category of paths.
+        startIdx: First path of the category to look in, -1 for all.
+    Return Value:
+        CK_OK if the file was found, CKERR_NOTFOUND otherwise.
+    *************************************************/
+    CKERROR Resolve(XString &file, int catIdx, int startIdx = -1)
+    {
+        CKPathManager *pm = m_Context->GetPathManager();
+        if (catIdx < 0 || catIdx >= pm->GetCategoryCount() || !IsSimpleName(file))
+            return pm->ResolveFileName(file, catIdx, startIdx);
+
+        Category &cat = GetCategory(pm, catIdx);
+        for (int i = XMax(startIdx, 0); i < cat.m_Dirs.Size(); ++i)
+        {
+            Directory &dir = cat.m_Dirs[i];
+            if (!dir.m_Files.FindPtr(file))
+                continue;
+            XString path(dir.m_Path);
+            if (path.Length() && path[path.Length() - 1] != '\\' && path[path.Length() - 1] != '/')
+                path << '\\';
+            path << file;
+            file = path;
+            ++m_Hits;
+            return CK_OK;
+        }
+        ++m_Misses;
+        return pm->ResolveFileName(file, catIdx, startIdx);
+    }
+
+    // Drops the listings of a category, -1 for all.
+    void Invalidate(int catIdx = -1)
+    {
+        for (int c = 0; c < m_Categories.Size(); ++c)
+            if (catIdx < 0 || c == catIdx)
+                Clear(m_Categories[c]);
+    }
+
+    // Names resolved from the listings, and names which were not in them.
+    int GetHitCount() const { return m_Hits; }
+    int GetMissCount() const { return m_Misses; }
+
+protected:
+    typedef XHashTable<int, XString, XHashFunXStringI, XEqualXStringI> FileTable;
+
+    struct Directory
+    {
+        XString m_Path;
+        FileTable m_Files;
+        HANDLE m_Change;
+    };
+
+    struct Category
+    {
+        CKBOOL m_Valid;
+        XClassArray<Directory> m_Dirs;
+    };
+
+    static CKBOOL IsSimpleName(XString &file)
+    {
+        const char *s = file.CStr();
+        return s && *s && !strchr(s, '\\') && !strchr(s, '/') && !strchr(s, ':');
+    }
+
+    Category &GetCategory(CKPathManager *pm, int catIdx)
+    {
+        while (m_Categories.Size() <= catIdx)
+        {
+            Category cat;
+            cat.m_Valid = FALSE;
+            m_Categories.PushBack(cat);
+        }
+        Category &cat = m_Categories[catIdx];
+        if (cat.m_Valid && !HasChanged(pm, catIdx, cat))
+            return cat;
+
+        Clear(cat);
+        const int count = pm->GetPathCount(catIdx);
+        cat.m_Dirs.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            Directory &dir = cat.m_Dirs[i];
+            pm->GetPathName(catIdx, i, dir.m_Path);
+            dir.m_Change = m_Watch ? FindFirstChangeNotificationA(dir.m_Path.CStr(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME) : INVALID_HANDLE_VALUE;
+            CKDirectoryParser parser(dir.m_Path.Str(), "*.*", FALSE);
+            while (char *path = parser.GetNextFile())
+            {
+                const char *name = XMax(strrchr(path, '\\'), strrchr(path, '/'));
+                dir.m_Files.Insert(XString(name ? name + 1 : path), 1, TRUE);
+            }
+        }
+        cat.m_Valid = TRUE;
+        return cat;
+    }
+
+    // TRUE if the paths of the category or the content of one of its directories changed.
+    CKBOOL HasChanged(CKPathManager *pm, int catIdx, Category &cat)
+    {
+        if (pm->GetPathCount(catIdx) != cat.m_Dirs.Size())
+            return TRUE;
+        XString path;
+        for (int i = 0; i < cat.m_Dirs.Size(); ++i)
+        {
+            Directory &dir = cat.m_Dirs[i];
+            pm->GetPathName(catIdx, i, path);
+            if (path != dir.m_Path)
+                return TRUE;
+            if (dir.m_Change != INVALID_HANDLE_VALUE && WaitForSingleObject(dir.m_Change, 0) == WAIT_OBJECT_0)
+                return TRUE;
+        }
+        return FALSE;
+    }
+
+    static void Clear(Category &cat)
+    {
+        for (int i = 0; i < cat.m_Dirs.Size(); ++i)
+            if (cat.m_Dirs[i].m_Change != INVALID_HANDLE_VALUE)
+                FindCloseChangeNotification(cat.m_Dirs[i].m_Change);
+        cat.m_Dirs.Resize(0);
+        cat.m_Valid = FALSE;
+    }
+
+    CKContext *m_Context;
+    CKBOOL m_Watch;
+    XClassArray<Category> m_Categories;
+    int m_Hits;
+    int m_Misses;
+
+private:
+    CKPathCache(const CKPathCache &);
+    CKPathCache &operator=(const CKPathCache &);
+};
+
+#endif // CKPATHCACHE_H
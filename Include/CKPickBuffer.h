@@ -0,0 +1,350 @@
+#ifndef CKPICKBUFFER_H
+#define CKPICKBUFFER_H
+
+#include <string.h>
+
+#include "VxMath.h"
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "XArray.h"
+#include "XObjectArray.h"
+
+/****************************************************************
+Summary: Buffer of the object visible at each pixel, answering picks without ray tests.
+
+Remarks:
+    o CKRenderContext::Pick and RectPick test a ray (or the rectangle)
+    against the objects and their faces, which is slow in dense scenes and
+    for large rectangles. The pick buffer draws the visible pickable 3D
+    objects with a flat color encoding their index (an ID pass) and reads
+    it back once: Pick is then one pixel lookup and RectPick reads the
+    pixels of the rectangle, whatever the number of objects.
+    o The ID pass is done at the beginning of the next rendering of the
+    context (pre-render callback) after Request, or at each rendering with
+    SetContinuous. It draws in a viewport divided by the scale given to the
+    constructor, reads it (CKRenderContext::DumpToMemory), and clears the
+    viewport again before the scene is drawn: the frame is not changed.
+    o The buffer keeps the objects as they were at the ID pass, which is a
+    frame late for moving objects. The index is encoded on 16 bits (5, 6
+    and 5 bits of red, green and blue) so it survives 16-bit back buffers.
+    o Objects are drawn with their current mesh, without alpha test:
+    transparent parts of a texture are picked like opaque ones.
+    o The read is synchronous: the staging surfaces of the driver are not
+    accessible from the SDK. Use Request only when a pick is pending (mouse
+    click, selection rectangle) rather than SetContinuous.
+    o Pick falls back to CKRenderContext::Pick when the buffer is not valid
+    or when the intersection data (CKPICKRESULT) is needed.
+
+    CKPickBuffer picker(dev);
+    ...
+    if (mouseDown)
+        picker.Request(); // the buffer is ready after the next Render
+    ...
+    CKRenderObject *obj = picker.Pick(x, y); // CKRenderContext::Pick until then
+
+See Also: CKRenderContext::Pick,CKRenderContext::RectPick
+****************************************************************/
+class CKPickBuffer
+{
+public:
+    enum
+    {
+        MaxObjects = 0xFFFF
+    };
+
+    explicit CKPickBuffer(CKRenderContext *dev, int scale = 2)
+        : m_Dev(dev), m_Scale(XMax(scale, 1)), m_Requested(FALSE), m_Continuous(FALSE), m_Valid(FALSE),
+          m_Frame(0), m_PassFrame(0), m_Width(0), m_Height(0), m_Stamp(0)
+    {
+        m_Dev->AddPreRenderCallBack(RenderCallback, this);
+    }
+
+    ~CKPickBuffer() { m_Dev->RemovePreRenderCallBack(RenderCallback, this); }
+
+    // Asks for an ID pass at the next rendering.
+    void Request() { m_Requested = TRUE; }
+
+    // TRUE to do an ID pass at each rendering.
+    void SetContinuous(CKBOOL continuous) { m_Continuous = continuous; }
+
+    void Invalidate() { m_Valid = FALSE; }
+
+    CKBOOL IsValid() const { return m_Valid; }
+
+    // Renderings since the last ID pass.
+    int GetAge() const { return m_Frame - m_PassFrame; }
+
+    // Objects drawn by the last ID pass.
+    int GetObjectCount() const { return m_Objects.Size(); }
+
+    /*************************************************
+    Summary: Returns the object visible at a position of the render context.
+
+    Arguments:
+        x: X position in the render context.
+        y: Y position in the render context.
+        oRes: If not NULL, the pick is done by CKRenderContext::Pick which gives the intersection.
+    Return Value:
+        The object, or NULL if there is none.
+    *************************************************/
+    CKRenderObject *Pick(int x, int y, CKPICKRESULT *oRes = NULL)
+    {
+        if (oRes || !m_Valid)
+            return m_Dev->Pick(x, y, oRes);
+        int px, py;
+        if (!ToBuffer(x, y, px, py))
+            return NULL;
+        return GetObject(m_Ids[py * m_Width + px]);
+    }
+
+    /*************************************************
+    Summary: Returns the objects visible in a rectangle of the render context.
+
+    Arguments:
+        r: Rectangle in the render context.
+        oObjects: Receives the objects, each once.
+    Return Value:
+        CK_OK, or the result of CKRenderContext::RectPick when the buffer is not valid.
+    Remarks:
+        Unlike CKRenderContext::RectPick, objects hidden by others are not returned.
+    *************************************************/
+    CKERROR RectPick(const VxRect &r, XObjectPointerArray &oObjects)
+    {
+        if (!m_Valid)
+            return m_Dev->RectPick(r, oObjects, TRUE);
+        oObjects.Resize(0);
+        int x0, y0, x1, y1;
+        ToBuffer((int)r.left, (int)r.top, x0, y0);
+        ToBuffer((int)r.right, (int)r.bottom, x1, y1);
+        x0 = XMax(x0, 0);
+        y0 = XMax(y0, 0);
+        x1 = XMin(x1, m_Width - 1);
+        y1 = XMin(y1, m_Height - 1);
+
+        ++m_Stamp;
+        for (int y = y0; y <= y1; ++y)
+        {
+            const CKWORD *ids = m_Ids.Begin() + y * m_Width;
+            for (int x = x0; x <= x1; ++x)
+            {
+                const int id = ids[x];
+                if (!id || m_Stamps[id - 1] == m_Stamp)
+                    continue;
+                m_Stamps[id - 1] = m_Stamp;
+                CKRenderObject *obj = GetObject(id);
+                if (obj)
+                    oObjects.PushBack(obj);
+            }
+        }
+        return CK_OK;
+    }
+
+protected:
+    static void RenderCallback(CKRenderContext *dev, void *arg)
+    {
+        CKPickBuffer *buffer = (CKPickBuffer *)arg;
+        ++buffer->m_Frame;
+        if (!buffer->m_Requested && !buffer->m_Continuous)
+            return;
+        buffer->m_Requested = FALSE;
+        buffer->RenderIds();
+    }
+
+    void RenderIds()
+    {
+        CKContext *ctx = m_Dev->GetCKContext();
+        VxRect view;
+        m_Dev->GetViewRect(view);
+        const int w = (int)view.GetWidth() / m_Scale;
+        const int h = (int)view.GetHeight() / m_Scale;
+        if (w <= 0 || h <= 0)
+            return;
+        m_View = view;
+        VxRect pass(view.left, view.top, view.left + (float)w, view.top + (float)h);
+        m_Dev->SetViewRect(pass);
+
+        // black background, no texture
+        CKMaterial *background = m_Dev->GetBackgroundMaterial();
+        VxColor backColor;
+        CKTexture *backTexture = NULL;
+        if (background)
+        {
+            backColor = background->GetDiffuse();
+            backTexture = background->GetTexture();
+            background->SetDiffuse(VxColor(0.0f, 0.0f, 0.0f, 1.0f));
+            background->SetTexture(0, NULL);
+        }
+        m_Dev->Clear((CK_RENDER_FLAGS)(CK_RENDER_CLEARBACK | CK_RENDER_CLEARZ | CK_RENDER_CLEARVIEWPORT));
+
+        static const VXRENDERSTATETYPE states[] = {
+            VXRENDERSTATE_LIGHTING, VXRENDERSTATE_FOGENABLE, VXRENDERSTATE_ALPHABLENDENABLE,
+            VXRENDERSTATE_ALPHATESTENABLE, VXRENDERSTATE_DITHERENABLE, VXRENDERSTATE_SPECULARENABLE,
+            VXRENDERSTATE_SHADEMODE, VXRENDERSTATE_CULLMODE, VXRENDERSTATE_ZENABLE,
+            VXRENDERSTATE_ZWRITEENABLE, VXRENDERSTATE_ZFUNC};
+        static const CKDWORD values[] = {
+            FALSE, FALSE, FALSE,
+            FALSE, FALSE, FALSE,
+            VXSHADE_FLAT, VXCULL_NONE, TRUE,
+            TRUE, VXCMP_LESSEQUAL};
+        const int stateCount = sizeof(states) / sizeof(states[0]);
+        CKDWORD saved[sizeof(states) / sizeof(states[0])];
+        int i;
+        for (i = 0; i < stateCount; ++i)
+        {
+            saved[i] = m_Dev->GetState(states[i]);
+            m_Dev->SetState(states[i], values[i]);
+        }
+        m_Dev->SetTexture(NULL);
+
+        m_Objects.Resize(0);
+        const XObjectArray &roots = m_Dev->Compute3dRootObjects();
+        for (i = 0; i < roots.Size(); ++i)
+            DrawHierarchy((CK3dEntity *)ctx->GetObject(roots[i]));
+        ReadBack(pass, w, h);
+
+        for (i = 0; i < stateCount; ++i)
+            m_Dev->SetState(states[i], saved[i]);
+        if (background)
+        {
+            background->SetDiffuse(backColor);
+            background->SetTexture(0, backTexture);
+        }
+        m_Dev->SetViewRect(view);
+        m_Dev->Clear((CK_RENDER_FLAGS)(CK_RENDER_CLEARBACK | CK_RENDER_CLEARZ | CK_RENDER_CLEARVIEWPORT));
+        m_PassFrame = m_Frame;
+    }
+
+    void DrawHierarchy(CK3dEntity *ent)
+    {
+        if (!ent || !ent->IsVisible())
+            return;
+        CKMesh *mesh = ent->GetCurrentMesh();
+        if (mesh && ent->IsPickable() && m_Objects.Size() < MaxObjects && ent->IsInViewFrustrum(m_Dev))
+        {
+            m_Objects.PushBack(ent->GetID());
+            DrawMesh(ent, mesh, EncodeId(m_Objects.Size()));
+        }
+        for (int i = 0; i < ent->GetChildrenCount(); ++i)
+            DrawHierarchy(ent->GetChild(i));
+    }
+
+    void DrawMesh(CK3dEntity *ent, CKMesh *mesh, CKDWORD color)
+    {
+        const int vertexCount = mesh->GetVertexCount();
+        const int indexCount = mesh->GetFaceCount() * 3;
+        CKDWORD pStride = 0;
+        void *positions = mesh->GetPositionsPtr(&pStride);
+        if (!vertexCount || !indexCount || !positions)
+            return;
+        VxDrawPrimitiveData *data = m_Dev->GetDrawPrimitiveStructure((CKRST_DPFLAGS)(CKRST_DP_TR_CL_VC | CKRST_DP_VBUFFER), vertexCount);
+        if (!data)
+            return;
+        m_Dev->SetWorldTransformationMatrix(ent->GetWorldMatrix());
+        VxCopyStructure(vertexCount, data->PositionPtr, data->PositionStride, sizeof(VxVector), positions, pStride);
+        VxFillStructure(vertexCount, data->ColorPtr, data->ColorStride, sizeof(CKDWORD), &color);
+        if (data->Flags & CKRST_DP_VBUFFER)
+            m_Dev->ReleaseCurrentVB();
+        m_Dev->DrawPrimitive(VX_TRIANGLELIST, mesh->GetFacesIndices(), indexCount, data);
+    }
+
+    void ReadBack(const VxRect &pass, int w, int h)
+    {
+        m_Valid = FALSE;
+        VxImageDescEx desc;
+        desc.Image = NULL;
+        const int size = m_Dev->DumpToMemory(&pass, VXBUFFER_BACKBUFFER, desc);
+        if (size <= 0)
+            return;
+        m_Raw.Resize(size);
+        desc.Image = m_Raw.Begin();
+        m_Dev->DumpToMemory(&pass, VXBUFFER_BACKBUFFER, desc);
+        w = XMin(w, desc.Width);
+        h = XMin(h, desc.Height);
+
+        // any back buffer format to 32 bits, then to indices
+        m_Pixels.Resize(desc.Width * desc.Height);
+        VxImageDescEx argb;
+        argb.Width = desc.Width;
+        argb.Height = desc.Height;
+        argb.BitsPerPixel = 32;
+        argb.BytesPerLine = desc.Width * 4;
+        argb.AlphaMask = 0xFF000000;
+        argb.RedMask = 0x00FF0000;
+        argb.GreenMask = 0x0000FF00;
+        argb.BlueMask = 0x000000FF;
+        argb.Image = (XBYTE *)m_Pixels.Begin();
+        VxDoBlit(desc, argb);
+
+        m_Width = w;
+        m_Height = h;
+        m_Ids.Resize(w * h);
+        for (int y = 0; y < h; ++y)
+        {
+            const CKDWORD *src = m_Pixels.Begin() + y * desc.Width;
+            CKWORD *dst = m_Ids.Begin() + y * w;
+            for (int x = 0; x < w; ++x)
+                dst[x] = DecodeId(src[x]);
+        }
+        m_Stamps.Resize(m_Objects.Size());
+        memset(m_Stamps.Begin(), 0, m_Stamps.Size() * sizeof(int));
+        m_Stamp = 0;
+        m_Valid = TRUE;
+    }
+
+    // The index in the top 5, 6 and 5 bits of red, green and blue.
+    static CKDWORD EncodeId(int id)
+    {
+        const CKDWORD r = ((id >> 11) & 31) << 3;
+        const CKDWORD g = ((id >> 5) & 63) << 2;
+        const CKDWORD b = (id & 31) << 3;
+        return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+
+    static CKWORD DecodeId(CKDWORD color)
+    {
+        const CKDWORD r = (color >> 19) & 31;
+        const CKDWORD g = (color >> 10) & 63;
+        const CKDWORD b = (color >> 3) & 31;
+        return (CKWORD)((r << 11) | (g << 5) | b);
+    }
+
+    CKBOOL ToBuffer(int x, int y, int &px, int &py) const
+    {
+        px = (x - (int)m_View.left) / m_Scale;
+        py = (y - (int)m_View.top) / m_Scale;
+        return px >= 0 && py >= 0 && px < m_Width && py < m_Height;
+    }
+
+    CKRenderObject *GetObject(int id) const
+    {
+        if (!id || id > m_Objects.Size())
+            return NULL;
+        return (CKRenderObject *)m_Dev->GetCKContext()->GetObject(m_Objects[id - 1]);
+    }
+
+    CKRenderContext *m_Dev;
+    int m_Scale;
+    CKBOOL m_Requested;
+    CKBOOL m_Continuous;
+    CKBOOL m_Valid;
+    int m_Frame;
+    int m_PassFrame;
+    VxRect m_View; // viewport at the ID pass
+    int m_Width;
+    int m_Height;
+    XArray<CK_ID> m_Objects; // object of each index - 1
+    XArray<CKWORD> m_Ids;    // index at each pixel, 0 for none
+    XArray<CKDWORD> m_Pixels;
+    XArray<XBYTE> m_Raw;
+    XArray<int> m_Stamps; // RectPick call which last added each object
+    int m_Stamp;
+
+private:
+    CKPickBuffer(const CKPickBuffer &);
+    CKPickBuffer &operator=(const CKPickBuffer &);
+};
+
+#endif // CKPICKBUFFER_H
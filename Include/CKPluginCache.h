@@ -0,0 +1,495 @@
+#ifndef CKPLUGINCACHE_H
+#define CKPLUGINCACHE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "CKGlobals.h"
+#include "CKContext.h"
+#include "CKFile.h"
+#include "CKPluginManager.h"
+#include "CKDirectoryParser.h"
+#include "VxMemoryMappedFile.h"
+#include "VxJobSystem.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Manifest of the plugin DLLs letting the plugins be loaded on demand.
+
+Remarks:
+    o CKPluginManager::ParsePlugins loads every DLL of a directory and
+    registers all their plugins. Scan replaces it: the DLLs are listed
+    with their size and modification time, and only the ones which are
+    not in the manifest (new or changed) are loaded to record the GUIDs
+    of their plugins, their reader extensions and the GUIDs of their
+    behavior prototypes. The files of these DLLs are read ahead in
+    parallel on the job system given, the registrations themselves go
+    through the plugin manager one at a time.
+    o The DLLs declaring a manager, a render engine or an extension are
+    always loaded by Scan: they must be registered before the creation of
+    the CKContext. The other ones (behaviors only by default, see
+    SetLazyTypes) are loaded by Require: for the dependencies of a
+    composition (RequireDependencies, LoadFile), before creating a
+    behavior from its prototype (RequirePrototype), or before reading a
+    file with a reader (RequireReader).
+    o The manifest is kept in a file with Load and Save, and is only
+    valid for the same directories: an entry whose DLL changed or
+    disappeared is rebuilt or dropped by the next Scan.
+    o Like the plugin manager, the cache is shared by the contexts of the
+    process and must only be used from the main thread.
+
+    CKPluginCache cache;
+    cache.Load("Plugins.cache");
+    cache.Scan("BuildingBlocks", &jobs);
+    cache.Scan("Plugins", &jobs);
+    cache.Save("Plugins.cache");
+    CKCreateContext(&context, window);
+    ...
+    cache.LoadFile(context, "Level.cmo", list);
+
+See Also: CKPluginManager,CKFilePluginDependencies
+****************************************************************/
+class CKPluginCache
+{
+public:
+    enum
+    {
+        Magic = 0x434B5043, // "CKPC", the value given by Visual C++ to 'CKPC'
+        Version = 1
+    };
+
+    CKPluginCache() : m_Manager(CKGetPluginManager()), m_LazyTypes(1 << CKPLUGIN_BEHAVIOR_DLL) {}
+    ~CKPluginCache() {}
+
+    // Plugin types loaded on demand, as a mask of (1 << CK_PLUGIN_TYPE). Managers, render engines and extensions are never.
+    void SetLazyTypes(CKDWORD mask)
+    {
+        m_LazyTypes = mask & ~((1 << CKPLUGIN_MANAGER_DLL) | (1 << CKPLUGIN_RENDERENGINE_DLL) | (1 << CKPLUGIN_EXTENSION_DLL));
+    }
+    CKDWORD GetLazyTypes() const { return m_LazyTypes; }
+
+    //---------------------------------------------
+    // Manifest
+
+    // Reads a manifest saved by Save, FALSE (and an empty manifest) if the file is missing or invalid.
+    CKBOOL Load(CKSTRING fileName)
+    {
+        Clear();
+        FILE *file = fopen(fileName, "rb");
+        if (!file)
+            return FALSE;
+        CKBOOL ok = Read(file);
+        fclose(file);
+        if (!ok)
+            Clear();
+        Reindex();
+        return ok;
+    }
+
+    CKERROR Save(CKSTRING fileName)
+    {
+        FILE *file = fopen(fileName, "wb");
+        if (!file)
+            return CKERR_CANTWRITETOFILE;
+        const int header[3] = {Magic, Version, m_Dlls.Size()};
+        CKBOOL ok = fwrite(header, sizeof(header), 1, file) == 1;
+        for (int i = 0; ok && i < m_Dlls.Size(); ++i)
+        {
+            const Dll &dll = m_Dlls[i];
+            const int pathLength = dll.m_Path.Length();
+            const int counts[2] = {dll.m_Plugins.Size(), dll.m_Behaviors.Size()};
+            ok = fwrite(&pathLength, sizeof(int), 1, file) == 1 &&
+                 fwrite(dll.m_Path.CStr(), 1, pathLength, file) == (size_t)pathLength &&
+                 fwrite(&dll.m_Stamp, sizeof(Stamp), 1, file) == 1 &&
+                 fwrite(counts, sizeof(counts), 1, file) == 1 &&
+                 fwrite(dll.m_Plugins.Begin(), sizeof(Plugin), counts[0], file) == (size_t)counts[0] &&
+                 fwrite(dll.m_Behaviors.Begin(), sizeof(CKGUID), counts[1], file) == (size_t)counts[1];
+        }
+        fclose(file);
+        return ok ? CK_OK : CKERR_CANTWRITETOFILE;
+    }
+
+    void Clear()
+    {
+        m_Dlls.Resize(0);
+        m_Index.Clear();
+    }
+
+    int GetDllCount() const { return m_Dlls.Size(); }
+
+    // Number of DLLs of the manifest registered in the plugin manager.
+    int GetLoadedDllCount() const
+    {
+        int count = 0;
+        for (int i = 0; i < m_Dlls.Size(); ++i)
+            if (m_Dlls[i].m_Loaded)
+                ++count;
+        return count;
+    }
+
+    //---------------------------------------------
+    // Scanning
+
+    /*************************************************
+    Summary: Updates the manifest with the DLLs of a directory and its sub-directories.
+
+    Arguments:
+        directory: Directory given to CKPluginManager::ParsePlugins before.
+        jobs: Job system checking and reading the files in parallel, NULL to do it on the calling thread.
+    Return Value:
+        Number of DLLs loaded.
+    *************************************************/
+    int Scan(CKSTRING directory, VxJobSystem *jobs = NULL)
+    {
+        XClassArray<ScanFile> files;
+        CKDirectoryParser parser(directory, "*.dll", TRUE);
+        while (char *path = parser.GetNextFile())
+        {
+            ScanFile f;
+            f.m_Path = path;
+            files.PushBack(f);
+        }
+        ForEach(jobs, files.Size(), 8, StampFiles, &files);
+
+        // DLLs of this directory which disappeared are forgotten
+        const int dirLength = (int)strlen(directory);
+        const CKBOOL dirSeparator = dirLength > 0 && (directory[dirLength - 1] == '\\' || directory[dirLength - 1] == '/');
+        for (int i = m_Dlls.Size() - 1; i >= 0; --i)
+        {
+            // "Plugins" must not match the DLLs of "PluginsOld"
+            const char *path = m_Dlls[i].m_Path.CStr();
+            if (strncmp(path, directory, dirLength) != 0)
+                continue;
+            if (!dirSeparator && path[dirLength] != '\\' && path[dirLength] != '/')
+                continue;
+            CKBOOL found = FALSE;
+            for (int j = 0; j < files.Size() && !found; ++j)
+                found = files[j].m_Path == m_Dlls[i].m_Path;
+            if (!found)
+                m_Dlls.RemoveAt(i);
+        }
+
+        // new or changed DLLs have to be loaded to know what they declare
+        XClassArray<ScanFile> changed;
+        int loaded = 0;
+        for (int i = 0; i < files.Size(); ++i)
+        {
+            const ScanFile &f = files[i];
+            if (!f.m_Valid)
+                continue;
+            const int index = FindDll(f.m_Path.CStr());
+            if (index >= 0 && memcmp(&m_Dlls[index].m_Stamp, &f.m_Stamp, sizeof(Stamp)) == 0)
+            {
+                if (!IsLazy(m_Dlls[index]) && LoadDll(m_Dlls[index]))
+                    ++loaded;
+            }
+            else
+            {
+                if (index >= 0)
+                    m_Dlls.RemoveAt(index);
+                changed.PushBack(f);
+            }
+        }
+
+        ForEach(jobs, changed.Size(), 1, PrefetchFiles, &changed);
+        for (int i = 0; i < changed.Size(); ++i)
+        {
+            Dll dll;
+            dll.m_Path = changed[i].m_Path;
+            dll.m_Stamp = changed[i].m_Stamp;
+            dll.m_Loaded = FALSE;
+            if (LoadDll(dll))
+            {
+                ++loaded;
+                Record(dll);
+            }
+            // DLLs which are not plugins are kept too, so that they are not loaded again
+            m_Dlls.PushBack(dll);
+        }
+        Reindex();
+        return loaded;
+    }
+
+    // Loads every DLL of the manifest, returns the number loaded.
+    int LoadAll()
+    {
+        int loaded = 0;
+        for (int i = 0; i < m_Dlls.Size(); ++i)
+            if (LoadDll(m_Dlls[i]))
+                ++loaded;
+        return loaded;
+    }
+
+    //---------------------------------------------
+    // Loading on demand
+
+    /*************************************************
+    Summary: Makes sure the plugin declaring a GUID is registered.
+
+    Arguments:
+        guid: GUID of a plugin or of a behavior prototype.
+        category: CK_PLUGIN_TYPE of the plugin, -1 for any.
+    Return Value:
+        TRUE if the plugin is registered.
+    *************************************************/
+    CKBOOL Require(CKGUID guid, int category = -1)
+    {
+        if (m_Manager->FindComponent(guid, category))
+            return TRUE;
+        int *index = m_Index.FindPtr(guid);
+        if (!index || !LoadDll(m_Dlls[*index]))
+            return FALSE;
+        return m_Manager->FindComponent(guid, category) != NULL;
+    }
+
+    // To call before creating a behavior from a prototype (CKBehavior::InitFromGuid, CKBuildingBlock creation).
+    CKBOOL RequirePrototype(CKGUID guid) { return Require(guid, CKPLUGIN_BEHAVIOR_DLL); }
+
+    // Loads the DLLs declaring a reader of a type (CKPLUGIN_BITMAP_READER, ...) for an extension.
+    CKBOOL RequireReader(CK_PLUGIN_TYPE type, CKFileExtension ext)
+    {
+        CKBOOL found = FALSE;
+        for (int i = 0; i < m_Dlls.Size(); ++i)
+        {
+            const Dll &dll = m_Dlls[i];
+            for (int j = 0; j < dll.m_Plugins.Size(); ++j)
+            {
+                Plugin p = dll.m_Plugins[j];
+                if (p.m_Type == type && p.m_Extension == ext)
+                {
+                    LoadDll(m_Dlls[i]);
+                    found |= m_Dlls[i].m_Loaded;
+                }
+            }
+        }
+        return found;
+    }
+
+    // Loads the DLLs a file opened with CKFile::OpenFile depends on, returns the number of GUIDs still missing.
+    int RequireDependencies(CKFile *file)
+    {
+        int missing = 0;
+        for (int i = 0; i < file->m_PluginsDep.Size(); ++i)
+        {
+            CKFilePluginDependencies &dep = file->m_PluginsDep[i];
+            for (int j = 0; j < dep.m_Guids.Size(); ++j)
+                if (!Require(dep.m_Guids[j], dep.m_PluginCategory))
+                    ++missing;
+        }
+        return missing;
+    }
+
+    /*************************************************
+    Summary: Loads a composition after loading the plugins it depends on.
+
+    Remarks:
+        Same as CKContext::Load for a Virtools file (the file is opened,
+        the DLLs of its dependencies loaded, then the objects are loaded).
+    *************************************************/
+    CKERROR LoadFile(CKContext *context, CKSTRING fileName, CKObjectArray *list, CK_LOAD_FLAGS flags = CK_LOAD_DEFAULT)
+    {
+        CKFile *file = context->CreateCKFile();
+        CKERROR err = file->OpenFile(fileName, flags);
+        if (err == CKERR_PLUGINSMISSING)
+        {
+            // the missing plugins are resolved when the file is opened, open it again
+            RequireDependencies(file);
+            context->DeleteCKFile(file);
+            file = context->CreateCKFile();
+            err = file->OpenFile(fileName, flags);
+        }
+        else if (err == CK_OK)
+        {
+            RequireDependencies(file);
+        }
+        if (err == CK_OK || err == CKERR_PLUGINSMISSING)
+            err = file->LoadFileData(list);
+        context->DeleteCKFile(file);
+        return err;
+    }
+
+protected:
+    struct Stamp
+    {
+        CKDWORD m_SizeLow;
+        CKDWORD m_SizeHigh;
+        CKDWORD m_TimeLow;
+        CKDWORD m_TimeHigh;
+    };
+
+    struct Plugin
+    {
+        CKGUID m_Guid;
+        int m_Type;
+        CKFileExtension m_Extension;
+    };
+
+    struct Dll
+    {
+        XString m_Path;
+        Stamp m_Stamp;
+        XArray<Plugin> m_Plugins;
+        XArray<CKGUID> m_Behaviors;
+        CKBOOL m_Loaded;
+    };
+
+    struct ScanFile
+    {
+        XString m_Path;
+        Stamp m_Stamp;
+        CKBOOL m_Valid;
+    };
+
+    // Runs a range function on the job system, or on the calling thread without one.
+    static void ForEach(VxJobSystem *jobs, int count, int grain, VxRangeFunction *func, void *arg)
+    {
+        if (jobs)
+            jobs->ParallelFor(count, grain, func, arg);
+        else if (count > 0)
+            func(arg, 0, count);
+    }
+
+    static void StampFiles(void *arg, int begin, int end)
+    {
+        XClassArray<ScanFile> &files = *(XClassArray<ScanFile> *)arg;
+        for (int i = begin; i < end; ++i)
+        {
+            WIN32_FILE_ATTRIBUTE_DATA data;
+            ScanFile &f = files[i];
+            f.m_Valid = GetFileAttributesExA(f.m_Path.CStr(), GetFileExInfoStandard, &data) != 0;
+            if (!f.m_Valid)
+                continue;
+            f.m_Stamp.m_SizeLow = data.nFileSizeLow;
+            f.m_Stamp.m_SizeHigh = data.nFileSizeHigh;
+            f.m_Stamp.m_TimeLow = data.ftLastWriteTime.dwLowDateTime;
+            f.m_Stamp.m_TimeHigh = data.ftLastWriteTime.dwHighDateTime;
+        }
+    }
+
+    // Touches every page of the files so that the loader finds them in the system cache.
+    static void PrefetchFiles(void *arg, int begin, int end)
+    {
+        XClassArray<ScanFile> &files = *(XClassArray<ScanFile> *)arg;
+        for (int i = begin; i < end; ++i)
+        {
+            VxMemoryMappedFile mapped(files[i].m_Path.Str());
+            if (!mapped.IsValid())
+                continue;
+            const volatile CKBYTE *base = (const volatile CKBYTE *)mapped.GetBase();
+            const XULONG size = mapped.GetFileSize();
+            CKBYTE sum = 0;
+            for (XULONG offset = 0; offset < size; offset += 4096)
+                sum += base[offset];
+            (void)sum;
+        }
+    }
+
+    CKBOOL IsLazy(const Dll &dll) const
+    {
+        if (!dll.m_Plugins.Size())
+            return TRUE; // not a plugin
+        for (int i = 0; i < dll.m_Plugins.Size(); ++i)
+            if (!(m_LazyTypes & (1 << dll.m_Plugins[i].m_Type)))
+                return FALSE;
+        return TRUE;
+    }
+
+    // Registers a DLL, TRUE if it was loaded by this call.
+    CKBOOL LoadDll(Dll &dll)
+    {
+        if (dll.m_Loaded)
+            return FALSE;
+        if (m_Manager->GetPluginDllInfo(dll.m_Path.Str()))
+        {
+            dll.m_Loaded = TRUE; // registered by someone else
+            return FALSE;
+        }
+        dll.m_Loaded = m_Manager->RegisterPlugin(dll.m_Path.Str()) == CK_OK;
+        return dll.m_Loaded;
+    }
+
+    // Records the plugins a registered DLL declared.
+    void Record(Dll &dll)
+    {
+        int dllIndex = -1;
+        if (!m_Manager->GetPluginDllInfo(dll.m_Path.Str(), &dllIndex))
+            return;
+        for (int c = 0; c < m_Manager->GetCategoryCount(); ++c)
+        {
+            for (int i = 0; i < m_Manager->GetPluginCount(c); ++i)
+            {
+                CKPluginEntry *entry = m_Manager->GetPluginInfo(c, i);
+                if (!entry || entry->m_PluginDllIndex != dllIndex)
+                    continue;
+                Plugin p;
+                p.m_Guid = entry->m_PluginInfo.m_GUID;
+                p.m_Type = entry->m_PluginInfo.m_Type;
+                p.m_Extension = entry->m_PluginInfo.m_Extension;
+                dll.m_Plugins.PushBack(p);
+                if (entry->m_BehaviorsInfo)
+                    dll.m_Behaviors += entry->m_BehaviorsInfo->m_BehaviorsGUID;
+            }
+        }
+    }
+
+    CKBOOL Read(FILE *file)
+    {
+        int header[3];
+        if (fread(header, sizeof(header), 1, file) != 1 || header[0] != Magic || header[1] != Version || header[2] < 0)
+            return FALSE;
+        m_Dlls.Resize(header[2]);
+        for (int i = 0; i < m_Dlls.Size(); ++i)
+        {
+            Dll &dll = m_Dlls[i];
+            int pathLength = 0;
+            int counts[2] = {0, 0};
+            if (fread(&pathLength, sizeof(int), 1, file) != 1 || pathLength <= 0 || pathLength >= _MAX_PATH)
+                return FALSE;
+            char path[_MAX_PATH];
+            if (fread(path, 1, pathLength, file) != (size_t)pathLength ||
+                fread(&dll.m_Stamp, sizeof(Stamp), 1, file) != 1 ||
+                fread(counts, sizeof(counts), 1, file) != 1 || counts[0] < 0 || counts[1] < 0)
+                return FALSE;
+            path[pathLength] = '\0';
+            dll.m_Path = path;
+            dll.m_Loaded = FALSE;
+            dll.m_Plugins.Resize(counts[0]);
+            dll.m_Behaviors.Resize(counts[1]);
+            if (fread(dll.m_Plugins.Begin(), sizeof(Plugin), counts[0], file) != (size_t)counts[0] ||
+                fread(dll.m_Behaviors.Begin(), sizeof(CKGUID), counts[1], file) != (size_t)counts[1])
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    int FindDll(const char *path) const
+    {
+        for (int i = 0; i < m_Dlls.Size(); ++i)
+            if (m_Dlls[i].m_Path == path)
+                return i;
+        return -1;
+    }
+
+    // Maps the plugin and prototype GUIDs to the DLLs declaring them.
+    void Reindex()
+    {
+        m_Index.Clear();
+        for (int i = 0; i < m_Dlls.Size(); ++i)
+        {
+            const Dll &dll = m_Dlls[i];
+            for (int j = 0; j < dll.m_Plugins.Size(); ++j)
+                m_Index.Insert(dll.m_Plugins[j].m_Guid, i, FALSE);
+            for (int j = 0; j < dll.m_Behaviors.Size(); ++j)
+                m_Index.Insert(dll.m_Behaviors[j], i, FALSE);
+        }
+    }
+
+    CKPluginManager *m_Manager;
+    CKDWORD m_LazyTypes;
+    XClassArray<Dll> m_Dlls;
+    XHashTable<int, CKGUID> m_Index;
+};
+
+#endif // CKPLUGINCACHE_H
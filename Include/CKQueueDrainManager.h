@@ -0,0 +1,140 @@
+#ifndef CKQUEUEDRAINMANAGER_H
+#define CKQUEUEDRAINMANAGER_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "VxMPSCQueue.h"
+
+#define QUEUE_DRAIN_MANAGER_GUID CKGUID(0x61b04e2f, 0x1c7a5d93)
+
+/*************************************************
+Summary: Function emptying a queue filled by other threads.
+
+Arguments:
+    context: Context being processed.
+    arg: Argument given at the registration.
+
+See also: CKQueueDrainManager::Register
+*************************************************/
+typedef void CKQueueDrainFunction(CKContext *context, void *arg);
+
+/*************************************************
+Summary: Moment of CKContext::Process at which a queue is drained.
+
+See also: CKQueueDrainManager::Register
+*************************************************/
+typedef enum CK_QUEUEDRAIN_POINT
+{
+    CK_QUEUEDRAIN_PREPROCESS  = 0, // Before the PreProcess of the other managers, before the behaviors
+    CK_QUEUEDRAIN_POSTPROCESS = 1, // After the PostProcess of the other managers, after the behaviors
+} CK_QUEUEDRAIN_POINT;
+
+/****************************************************************
+Summary: Manager draining the queues filled by worker threads at fixed points of the process loop.
+
+Remarks:
+    o Threads (network, audio, loaders) post their results in lock-free
+    queues (VxMPSCQueue, VxMPSCIntrusiveQueue, VxSPSCQueue); the functions
+    registered here pop them on the main thread, either at the very
+    beginning of CKContext::Process (before any manager and behavior) or
+    at its very end, in their order of registration.
+    o The manager is created and registered by the first call to Get and
+    deleted with the context. Register and Unregister must be called from
+    the main thread, but not from a drain function.
+
+    static void DrainResults(CKContext *context, void *arg)
+    {
+        NetResult r;
+        while (((VxMPSCQueue<NetResult> *)arg)->Pop(r))
+            ...
+    }
+    CKQueueDrainManager::Get(context)->Register(DrainResults, &results);
+
+See Also: VxMPSCQueue,VxMPSCIntrusiveQueue
+****************************************************************/
+class CKQueueDrainManager : public CKBaseManager
+{
+public:
+    // The manager of the context, created on the first call.
+    static CKQueueDrainManager *Get(CKContext *context)
+    {
+        CKQueueDrainManager *manager = (CKQueueDrainManager *)context->GetManagerByGuid(QUEUE_DRAIN_MANAGER_GUID);
+        if (!manager)
+            manager = new CKQueueDrainManager(context);
+        return manager;
+    }
+
+    ~CKQueueDrainManager() {}
+
+    void Register(CKQueueDrainFunction *func, void *arg, CK_QUEUEDRAIN_POINT point = CK_QUEUEDRAIN_PREPROCESS)
+    {
+        Drain d;
+        d.m_Func = func;
+        d.m_Arg = arg;
+        m_Drains[point].PushBack(d);
+    }
+
+    // Removes the registrations of func with arg at any point.
+    void Unregister(CKQueueDrainFunction *func, void *arg)
+    {
+        for (int p = 0; p < 2; ++p)
+        {
+            for (int i = m_Drains[p].Size() - 1; i >= 0; --i)
+                if (m_Drains[p][i].m_Func == func && m_Drains[p][i].m_Arg == arg)
+                    m_Drains[p].RemoveAt(i);
+        }
+    }
+
+    // Drains the queues registered for a point, called by the manager during Process.
+    void DrainQueues(CK_QUEUEDRAIN_POINT point)
+    {
+        XArray<Drain> &drains = m_Drains[point];
+        for (int i = 0; i < drains.Size(); ++i)
+            drains[i].m_Func(m_Context, drains[i].m_Arg);
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PreProcess()
+    {
+        DrainQueues(CK_QUEUEDRAIN_PREPROCESS);
+        return CK_OK;
+    }
+
+    virtual CKERROR PostProcess()
+    {
+        DrainQueues(CK_QUEUEDRAIN_POSTPROCESS);
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_PreProcess |
+               CKMANAGER_FUNC_PostProcess;
+    }
+
+    virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function)
+    {
+        // PreProcess first, PostProcess last
+        if (Function == CKMANAGER_FUNC_PreProcess)
+            return MAX_MANAGERFUNC_PRIORITY;
+        return -MAX_MANAGERFUNC_PRIORITY;
+    }
+
+protected:
+    struct Drain
+    {
+        CKQueueDrainFunction *m_Func;
+        void *m_Arg;
+    };
+
+    CKQueueDrainManager(CKContext *context) : CKBaseManager(context, QUEUE_DRAIN_MANAGER_GUID, "Queue Drain Manager")
+    {
+        context->RegisterNewManager(this);
+    }
+
+    XArray<Drain> m_Drains[2];
+};
+
+#endif // CKQUEUEDRAINMANAGER_H
@@ -0,0 +1,150 @@
+#ifndef CKRAYPACKET_H
+#define CKRAYPACKET_H
+
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "VxIntersectBatch.h"
+
+/****************************************************************
+Summary: Casts arrays of rays against the current mesh of a 3D entity.
+
+Remarks:
+    o The faces of the mesh are prepared once (VxFaceSoA) and kept until
+    the mesh changes or Invalidate is called, so a CKRayPacket should be
+    kept for an entity which is tested every frame (floors, occluders...).
+    o The rays are tested 4 at a time with VxIntersectBatch::RayPacketFaces.
+    o The results are the same than CK3dEntity::RayIntersection with a
+    VxRay built as VxRay(Pos1, Pos2) (the IntersectionPoint and
+    IntersectionNormal are in the entity local coordinates, the Distance
+    in the Ref coordinates).
+
+    CKRayPacket packet;
+    ...
+    int hits = packet.Intersect(wall, rays, rayCount, descs);
+
+See Also: CK3dEntity::RayIntersection,VxIntersectBatch,VxIntersectionDesc
+****************************************************************/
+class CKRayPacket
+{
+public:
+    CKRayPacket() : m_Mesh(NULL), m_FaceCount(0), m_VertexCount(0) {}
+
+    // Forces the faces to be prepared again (after the mesh vertices moved).
+    void Invalidate() { m_Mesh = NULL; }
+
+    /************************************************
+    Summary: Intersects rays with the current mesh of an entity.
+
+    Arguments:
+        Entity: Entity to test.
+        Rays: Rays to test, expressed in the Ref referential.
+        RayCount: Number of rays.
+        Descs: Filled with the nearest intersection of each ray. Desc.Object is
+        set to NULL for the rays that do not hit the entity.
+        Ref: Referential of the rays, NULL for world coordinates.
+        iOptions: CKRAYINTERSECTION_SEGMENT to test segments.
+    Return Value:
+        Number of rays hitting the entity.
+    ************************************************/
+    int Intersect(CK3dEntity *Entity, const VxRay *Rays, int RayCount, VxIntersectionDesc *Descs, CK3dEntity *Ref = NULL, CK_RAYINTERSECTION iOptions = CKRAYINTERSECTION_DEFAULT)
+    {
+        CKMesh *mesh = Entity ? Entity->GetCurrentMesh() : NULL;
+        if (!mesh || RayCount <= 0)
+        {
+            for (int i = 0; i < RayCount; ++i)
+                Descs[i].Object = NULL;
+            return 0;
+        }
+        Prepare(mesh);
+
+        // rays in the entity referential
+        VxMatrix toLocal;
+        if (Ref)
+            Vx3DMultiplyMatrix(toLocal, Entity->GetInverseWorldMatrix(), Ref->GetWorldMatrix());
+        else
+            toLocal = Entity->GetInverseWorldMatrix();
+        m_LocalRays.Resize(RayCount);
+        for (int i = 0; i < RayCount; ++i)
+        {
+            Vx3DMultiplyMatrixVector(&m_LocalRays[i].m_Origin, toLocal, &Rays[i].m_Origin);
+            Vx3DRotateVector(&m_LocalRays[i].m_Direction, toLocal, &Rays[i].m_Direction);
+        }
+
+        m_FaceIndices.Resize(RayCount);
+        m_Dist.Resize(RayCount);
+        m_U.Resize(RayCount);
+        m_V.Resize(RayCount);
+        int hits = VxIntersectBatch::RayPacketFaces(m_LocalRays.Begin(), RayCount, m_Faces, m_FaceIndices.Begin(),
+                                                    m_Dist.Begin(), m_U.Begin(), m_V.Begin(),
+                                                    (iOptions & CKRAYINTERSECTION_SEGMENT) != 0);
+        if (!hits)
+        {
+            for (int i = 0; i < RayCount; ++i)
+                Descs[i].Object = NULL;
+            return 0;
+        }
+
+        CKDWORD uvStride = 0;
+        CKBYTE *uvs = (CKBYTE *)mesh->GetTextureCoordinatesPtr(&uvStride);
+        CKWORD *indices = mesh->GetFacesIndices();
+        for (int i = 0; i < RayCount; ++i)
+        {
+            VxIntersectionDesc &desc = Descs[i];
+            int face = m_FaceIndices[i];
+            if (face < 0)
+            {
+                desc.Object = NULL;
+                continue;
+            }
+            const float t = m_Dist[i];
+            const float u = m_U[i];
+            const float v = m_V[i];
+            desc.Object = Entity;
+            desc.FaceIndex = face;
+            m_LocalRays[i].Interpolate(desc.IntersectionPoint, t);
+            desc.IntersectionNormal = mesh->GetFaceNormal(face);
+            desc.Distance = t * Magnitude(Rays[i].m_Direction);
+            desc.TexU = desc.TexV = 0.0f;
+            if (uvs)
+            {
+                const float *uv0 = (const float *)(uvs + indices[3 * face] * uvStride);
+                const float *uv1 = (const float *)(uvs + indices[3 * face + 1] * uvStride);
+                const float *uv2 = (const float *)(uvs + indices[3 * face + 2] * uvStride);
+                desc.TexU = uv0[0] + (uv1[0] - uv0[0]) * u + (uv2[0] - uv0[0]) * v;
+                desc.TexV = uv0[1] + (uv1[1] - uv0[1]) * u + (uv2[1] - uv0[1]) * v;
+            }
+        }
+        return hits;
+    }
+
+protected:
+    void Prepare(CKMesh *mesh)
+    {
+        int faceCount = mesh->GetFaceCount();
+        int vertexCount = mesh->GetVertexCount();
+        if (mesh == m_Mesh && faceCount == m_FaceCount && vertexCount == m_VertexCount)
+            return;
+        CKDWORD stride = 0;
+        void *positions = mesh->GetPositionsPtr(&stride);
+        m_Faces.Build(VxStridedData(positions, stride), mesh->GetFacesIndices(), faceCount);
+        m_Mesh = mesh;
+        m_FaceCount = faceCount;
+        m_VertexCount = vertexCount;
+    }
+
+    CKMesh *m_Mesh;
+    int m_FaceCount;
+    int m_VertexCount;
+    VxFaceSoA m_Faces;
+    XArray<VxRay> m_LocalRays;
+    XArray<int> m_FaceIndices;
+    XArray<float> m_Dist;
+    XArray<float> m_U;
+    XArray<float> m_V;
+
+private:
+    CKRayPacket(const CKRayPacket &);
+    CKRayPacket &operator=(const CKRayPacket &);
+};
+
+#endif // CKRAYPACKET_H
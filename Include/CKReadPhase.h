@@ -0,0 +1,350 @@
+#ifndef CKREADPHASE_H
+#define CKREADPHASE_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CK3dEntity.h"
+#include "CKParameter.h"
+#include "VxMatrix.h"
+#include "VxMPSCQueue.h"
+
+#define READ_PHASE_MANAGER_GUID CKGUID(0x2f6c18d5, 0x74e30ab9)
+
+/*************************************************
+Summary: Function called on the main thread by a deferred command.
+
+See also: CKObjectCommandBuffer::Call
+*************************************************/
+typedef void CKCommandFunction(CKContext *context, void *arg);
+
+/****************************************************************
+Summary: Object changes recorded from any thread and applied later on the main thread.
+
+Remarks:
+    o The commands go through a VxMPSCIntrusiveQueue: recording is one
+    allocation and one atomic exchange, and Apply replays them in the
+    order they were recorded (per thread, and in push order across
+    threads).
+    o Objects are referenced by CK_ID: a command on an object deleted in
+    the meantime is skipped. The deletions are grouped in one
+    CKContext::DestroyObjects call after the other commands.
+    o Anything else (object creation for example) goes through Call.
+
+See Also: CKReadPhaseManager
+****************************************************************/
+class CKObjectCommandBuffer
+{
+public:
+    explicit CKObjectCommandBuffer(CKContext *context) : m_Context(context) {}
+
+    ~CKObjectCommandBuffer()
+    {
+        // not applied commands are dropped
+        while (Command *c = m_Commands.Pop())
+            Delete(c);
+    }
+
+    //---------------------------------------------
+    // Any thread
+
+    void SetWorldMatrix(CK3dEntity *ent, const VxMatrix &mat, CKBOOL keepChildren = FALSE)
+    {
+        Command *c = New(CMD_SETWORLDMATRIX, ent);
+        c->m_Matrix = mat;
+        c->m_Flag = keepChildren;
+        m_Commands.Push(c);
+    }
+
+    void SetLocalMatrix(CK3dEntity *ent, const VxMatrix &mat, CKBOOL keepChildren = FALSE)
+    {
+        Command *c = New(CMD_SETLOCALMATRIX, ent);
+        c->m_Matrix = mat;
+        c->m_Flag = keepChildren;
+        m_Commands.Push(c);
+    }
+
+    // World position.
+    void SetPosition(CK3dEntity *ent, const VxVector &pos, CKBOOL keepChildren = FALSE)
+    {
+        Command *c = New(CMD_SETPOSITION, ent);
+        c->m_Matrix[0] = VxVector4(pos.x, pos.y, pos.z, 0.0f);
+        c->m_Flag = keepChildren;
+        m_Commands.Push(c);
+    }
+
+    // The value is copied.
+    void SetParameterValue(CKParameter *param, const void *value, int size)
+    {
+        Command *c = New(CMD_SETPARAMETER, param);
+        c->m_Data = new CKBYTE[size];
+        c->m_Size = size;
+        memcpy(c->m_Data, value, size);
+        m_Commands.Push(c);
+    }
+
+    void DestroyObject(CKObject *obj)
+    {
+        m_Commands.Push(New(CMD_DESTROY, obj));
+    }
+
+    void Call(CKCommandFunction *func, void *arg)
+    {
+        Command *c = New(CMD_CALL, NULL);
+        c->m_Func = func;
+        c->m_Arg = arg;
+        m_Commands.Push(c);
+    }
+
+    //---------------------------------------------
+    // Main thread
+
+    // Applies and removes the commands recorded so far, returns their number.
+    int Apply()
+    {
+        int count = 0;
+        m_Destroyed.Resize(0);
+        while (Command *c = m_Commands.Pop())
+        {
+            Execute(c);
+            Delete(c);
+            ++count;
+        }
+        if (m_Destroyed.Size())
+            m_Context->DestroyObjects(m_Destroyed.Begin(), m_Destroyed.Size());
+        return count;
+    }
+
+    CKBOOL IsEmpty() const { return m_Commands.IsEmpty(); }
+
+protected:
+    enum CommandType
+    {
+        CMD_SETWORLDMATRIX,
+        CMD_SETLOCALMATRIX,
+        CMD_SETPOSITION,
+        CMD_SETPARAMETER,
+        CMD_DESTROY,
+        CMD_CALL
+    };
+
+    struct Command : public VxMPSCNode
+    {
+        CommandType m_Type;
+        CK_ID m_Object;
+        VxMatrix m_Matrix;
+        CKBOOL m_Flag;
+        CKBYTE *m_Data;
+        int m_Size;
+        CKCommandFunction *m_Func;
+        void *m_Arg;
+    };
+
+    static Command *New(CommandType type, CKObject *obj)
+    {
+        Command *c = new Command;
+        c->m_Type = type;
+        c->m_Object = obj ? obj->GetID() : 0;
+        c->m_Data = NULL;
+        return c;
+    }
+
+    static void Delete(Command *c)
+    {
+        delete[] c->m_Data;
+        delete c;
+    }
+
+    void Execute(Command *c)
+    {
+        if (c->m_Type == CMD_CALL)
+        {
+            c->m_Func(m_Context, c->m_Arg);
+            return;
+        }
+        if (c->m_Type == CMD_DESTROY)
+        {
+            m_Destroyed.PushBack(c->m_Object);
+            return;
+        }
+        CKObject *obj = m_Context->GetObject(c->m_Object);
+        if (!obj)
+            return;
+        // an id reused by an object of another class: the command is dropped
+        CK3dEntity *ent = (c->m_Type == CMD_SETPARAMETER) ? NULL : CK3dEntity::Cast(obj);
+        CKParameter *param = (c->m_Type == CMD_SETPARAMETER) ? CKParameter::Cast(obj) : NULL;
+        switch (c->m_Type)
+        {
+        case CMD_SETWORLDMATRIX:
+            if (ent)
+                ent->SetWorldMatrix(c->m_Matrix, c->m_Flag);
+            break;
+        case CMD_SETLOCALMATRIX:
+            if (ent)
+                ent->SetLocalMatrix(c->m_Matrix, c->m_Flag);
+            break;
+        case CMD_SETPOSITION:
+            if (ent)
+            {
+                VxVector pos(c->m_Matrix[0][0], c->m_Matrix[0][1], c->m_Matrix[0][2]);
+                ent->SetPosition(&pos, NULL, c->m_Flag);
+            }
+            break;
+        case CMD_SETPARAMETER:
+            if (param)
+                param->SetValue(c->m_Data, c->m_Size);
+            break;
+        default:
+            break;
+        }
+    }
+
+    CKContext *m_Context;
+    VxMPSCIntrusiveQueue<Command> m_Commands;
+    XArray<CK_ID> m_Destroyed;
+
+private:
+    CKObjectCommandBuffer(const CKObjectCommandBuffer &);
+    CKObjectCommandBuffer &operator=(const CKObjectCommandBuffer &);
+};
+
+/*************************************************
+Summary: Function run on the main thread during the read phase.
+
+See also: CKReadPhaseManager::RegisterReader
+*************************************************/
+typedef void CKReadPhaseFunction(CKContext *context, CKObjectCommandBuffer *commands, void *arg);
+
+/****************************************************************
+Summary: Manager opening a phase of CKContext::Process during which worker threads can read the objects.
+
+Remarks:
+    o The phase is opened in the PostProcess of the manager, after the
+    behaviors and the PostProcess of the other managers, and before the
+    rendering. The registered readers are called on the main thread; they
+    start jobs (CKJobManager) and must wait for them before returning.
+    While the phase is open the main thread runs nothing else, so no
+    object is created, deleted or moved.
+    o Workers must not change objects: they record the changes in the
+    command buffer given to the readers, which is applied on the main
+    thread when the phase is closed (deletions last).
+    o During the phase these getters can be called from any thread:
+        - CKContext::GetObject,
+        - CK3dEntity::GetWorldMatrix, GetLocalMatrix, GetInverseWorldMatrix,
+        GetParent, GetChildrenCount and GetChild,
+        - CKMesh::GetVertexCount, GetFaceCount, GetPositionsPtr,
+        GetModifierVertices, GetFacesIndices and GetFaceVertexIndex,
+        - CKParameter::GetReadDataPtr(FALSE), GetDataSize and GetGUID.
+    GetReadDataPtr(TRUE) (the default) may run the parameter operations
+    feeding the parameter and is not safe; the parameters must be updated
+    before (by reading them on the main thread in a reader).
+    o Deleting an object on the main thread while the phase is open (from
+    a reader) is reported to the console: it must go through the command
+    buffer.
+    o BeginReadPhase and EndReadPhase open a phase at another point of the
+    frame (between two Process for example), with the same rules.
+
+    static void SampleBones(CKContext *context, CKObjectCommandBuffer *commands, void *arg)
+    {
+        VxJobSystem &jobs = CKJobManager::Get(context)->GetJobSystem();
+        jobs.ParallelFor(boneCount, 16, SampleBoneRange, arg);
+    }
+    CKReadPhaseManager::Get(context)->RegisterReader(SampleBones, &skeleton);
+
+See Also: CKObjectCommandBuffer,CKJobManager
+****************************************************************/
+class CKReadPhaseManager : public CKBaseManager
+{
+public:
+    // The manager of the context, created on the first call.
+    static CKReadPhaseManager *Get(CKContext *context)
+    {
+        CKReadPhaseManager *manager = (CKReadPhaseManager *)context->GetManagerByGuid(READ_PHASE_MANAGER_GUID);
+        if (!manager)
+            manager = new CKReadPhaseManager(context);
+        return manager;
+    }
+
+    ~CKReadPhaseManager() {}
+
+    void RegisterReader(CKReadPhaseFunction *func, void *arg)
+    {
+        Reader r;
+        r.m_Func = func;
+        r.m_Arg = arg;
+        m_Readers.PushBack(r);
+    }
+
+    void UnregisterReader(CKReadPhaseFunction *func, void *arg)
+    {
+        for (int i = m_Readers.Size() - 1; i >= 0; --i)
+            if (m_Readers[i].m_Func == func && m_Readers[i].m_Arg == arg)
+                m_Readers.RemoveAt(i);
+    }
+
+    CKObjectCommandBuffer &GetCommands() { return m_Commands; }
+
+    // TRUE between BeginReadPhase and EndReadPhase, can be tested from any thread.
+    CKBOOL IsInReadPhase() const { return m_InPhase != 0; }
+
+    void BeginReadPhase() { m_InPhase = 1; }
+
+    // Closes the phase and applies the recorded commands.
+    void EndReadPhase()
+    {
+        m_InPhase = 0;
+        m_Commands.Apply();
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR PostProcess()
+    {
+        if (!m_Readers.Size())
+            return CK_OK;
+        BeginReadPhase();
+        for (int i = 0; i < m_Readers.Size(); ++i)
+            m_Readers[i].m_Func(m_Context, &m_Commands, m_Readers[i].m_Arg);
+        EndReadPhase();
+        return CK_OK;
+    }
+
+    virtual CKERROR SequenceToBeDeleted(CK_ID *objids, int count)
+    {
+        if (m_InPhase)
+            m_Context->OutputToConsoleEx("Read phase: %d object(s) deleted while worker threads may read them", count);
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_PostProcess |
+               CKMANAGER_FUNC_OnSequenceToBeDeleted;
+    }
+
+    virtual int GetFunctionPriority(CKMANAGER_FUNCTIONS Function)
+    {
+        // PostProcess last
+        if (Function == CKMANAGER_FUNC_PostProcess)
+            return -MAX_MANAGERFUNC_PRIORITY;
+        return 0;
+    }
+
+protected:
+    struct Reader
+    {
+        CKReadPhaseFunction *m_Func;
+        void *m_Arg;
+    };
+
+    CKReadPhaseManager(CKContext *context) : CKBaseManager(context, READ_PHASE_MANAGER_GUID, "Read Phase Manager"), m_Commands(context), m_InPhase(0)
+    {
+        context->RegisterNewManager(this);
+    }
+
+    XArray<Reader> m_Readers;
+    CKObjectCommandBuffer m_Commands;
+    volatile long m_InPhase;
+};
+
+#endif // CKREADPHASE_H
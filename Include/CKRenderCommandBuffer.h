@@ -0,0 +1,330 @@
+#ifndef CKRENDERCOMMANDBUFFER_H
+#define CKRENDERCOMMANDBUFFER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "XHashTable.h"
+#include "XRadixSort.h"
+#include "VxParallel.h"
+#include "CKRenderCuller.h"
+
+/****************************************************************
+Summary: Draw packet recorded in a CKRenderCommandBuffer.
+
+See Also: CKRenderCommandBuffer
+****************************************************************/
+struct CKDrawPacket
+{
+    CK3dEntity *m_Entity;
+    CKMesh *m_Mesh;
+    XDWORD m_KeyHigh; // sort key, most significant bits
+    XDWORD m_KeyLow;
+};
+
+/****************************************************************
+Summary: List of draw packets recorded by several threads.
+
+Remarks:
+    o Each recording thread writes to its own stream, so no locking is
+    needed. Merge concatenates the streams in their index order (the
+    result does not depend on which thread recorded which stream) and
+    sorts the packets by key.
+    o Submit must be called from the thread owning the render context.
+
+See Also: CKParallelRenderer,CKDrawPacket
+****************************************************************/
+class CKRenderCommandBuffer
+{
+public:
+    CKRenderCommandBuffer() : m_Order(NULL) {}
+
+    ~CKRenderCommandBuffer() { SetStreamCount(0); }
+
+    // Clears the buffer and prepares count streams.
+    void Reset(int count)
+    {
+        SetStreamCount(count);
+        for (int i = 0; i < m_Streams.Size(); ++i)
+            m_Streams[i]->Resize(0);
+        m_Packets.Resize(0);
+        m_Order = NULL;
+    }
+
+    int GetStreamCount() const { return m_Streams.Size(); }
+
+    // Records a packet in a stream, the streams must be written by one thread each.
+    void Record(int stream, const CKDrawPacket &packet) { m_Streams[stream]->PushBack(packet); }
+
+    /************************************************
+    Summary: Gathers the packets of all the streams and sorts them.
+
+    Return Value:
+        Number of packets.
+    ************************************************/
+    int Merge()
+    {
+        int count = 0;
+        int i;
+        for (i = 0; i < m_Streams.Size(); ++i)
+            count += m_Streams[i]->Size();
+        m_Packets.Resize(count);
+        m_Low.Resize(count);
+        m_High.Resize(count);
+        int n = 0;
+        for (i = 0; i < m_Streams.Size(); ++i)
+        {
+            const XArray<CKDrawPacket> &s = *m_Streams[i];
+            for (int j = 0; j < s.Size(); ++j, ++n)
+            {
+                m_Packets[n] = s[j];
+                m_Low[n] = s[j].m_KeyLow;
+                m_High[n] = s[j].m_KeyHigh;
+            }
+        }
+        m_Order = m_Sorter.Sort(m_Low.Begin(), m_High.Begin(), count);
+        return count;
+    }
+
+    int GetPacketCount() const { return m_Packets.Size(); }
+
+    // Packets in their sorted order (after Merge).
+    const CKDrawPacket &GetPacket(int i) const { return m_Packets[m_Order ? m_Order[i] : i]; }
+
+    // Draws the sorted packets.
+    void Submit(CKRenderContext *dev) const
+    {
+        for (int i = 0; i < m_Packets.Size(); ++i)
+        {
+            const CKDrawPacket &p = GetPacket(i);
+            dev->SetWorldTransformationMatrix(p.m_Entity->GetWorldMatrix());
+            p.m_Mesh->Render(dev, p.m_Entity);
+        }
+    }
+
+protected:
+    void SetStreamCount(int count)
+    {
+        int i;
+        for (i = count; i < m_Streams.Size(); ++i)
+            delete m_Streams[i];
+        int old = m_Streams.Size();
+        m_Streams.Resize(count);
+        for (i = old; i < count; ++i)
+            m_Streams[i] = new XArray<CKDrawPacket>;
+    }
+
+    XArray<XArray<CKDrawPacket> *> m_Streams;
+    XArray<CKDrawPacket> m_Packets;
+    XArray<XDWORD> m_Low;
+    XArray<XDWORD> m_High;
+    XRadixSorter m_Sorter;
+    const int *m_Order;
+
+private:
+    CKRenderCommandBuffer(const CKRenderCommandBuffer &);
+    CKRenderCommandBuffer &operator=(const CKRenderCommandBuffer &);
+};
+
+/****************************************************************
+Summary: Culls and records opaque entities on worker threads.
+
+Remarks:
+    o The render function of the entities added to the renderer is
+    replaced by an empty one. Before the scene is drawn, the world boxes,
+    positions and sort identifiers of these entities are gathered on the
+    main thread, then the frustum culling and the packet recording (sort
+    keys by material, texture, mesh and front to back depth) run on the
+    threads of a VxParallelPool into a CKRenderCommandBuffer.
+    o After the other opaque objects the sorted packets are submitted by
+    the main thread, which is the only one calling the render context.
+    o The pool is shared with the other users of the application, it must
+    have been created by the thread which renders.
+
+    VxParallelPool pool(3);
+    CKParallelRenderer renderer(dev, &pool);
+    renderer.Add(ent);
+
+See Also: CKRenderCommandBuffer,VxParallelPool,CKRenderQueue
+****************************************************************/
+class CKParallelRenderer
+{
+public:
+    enum
+    {
+        Grain = 256 // entities culled by each job
+    };
+
+    CKParallelRenderer(CKRenderContext *dev, VxParallelPool *pool) : m_Dev(dev), m_Pool(pool), m_Registered(FALSE) {}
+
+    ~CKParallelRenderer() { Clear(); }
+
+    // Draws an opaque entity through the renderer.
+    CKBOOL Add(CK3dEntity *ent)
+    {
+        if (!ent || m_Entities.FindPtr(ent->GetID()))
+            return FALSE;
+        m_Entities.Insert(ent->GetID(), ent);
+        ent->SetRenderCallBack(SkipEntity, this);
+        if (!m_Registered && m_Dev)
+        {
+            m_Dev->AddPreRenderCallBack(RecordFrame, this);
+            m_Dev->AddPostRenderCallBack(SubmitFrame, this, FALSE, TRUE);
+            m_Registered = TRUE;
+        }
+        return TRUE;
+    }
+
+    // Restores the render function of an entity.
+    void Remove(CK3dEntity *ent)
+    {
+        if (!ent || !m_Entities.FindPtr(ent->GetID()))
+            return;
+        m_Entities.Remove(ent->GetID());
+        ent->RemoveRenderCallBack();
+    }
+
+    // Restores the render function of all the entities.
+    void Clear()
+    {
+        CKContext *ctx = m_Dev ? m_Dev->GetCKContext() : NULL;
+        for (XHashTable<CK3dEntity *, CK_ID>::Iterator it = m_Entities.Begin(); it != m_Entities.End(); ++it)
+        {
+            CK3dEntity *ent = ctx ? (CK3dEntity *)ctx->GetObject(it.GetKey()) : NULL;
+            if (ent && !ent->IsToBeDeleted())
+                ent->RemoveRenderCallBack();
+        }
+        if (m_Registered)
+        {
+            m_Dev->RemovePreRenderCallBack(RecordFrame, this);
+            m_Dev->RemovePostRenderCallBack(SubmitFrame, this);
+        }
+        m_Registered = FALSE;
+        m_Entities.Clear();
+        m_SortIds.Clear();
+        m_Snapshot.Clear();
+    }
+
+    // Commands recorded for the current frame.
+    const CKRenderCommandBuffer &GetCommands() const { return m_Commands; }
+
+protected:
+    // State of an entity read on the main thread.
+    struct Snapshot
+    {
+        CK3dEntity *m_Entity;
+        CKMesh *m_Mesh;
+        VxBbox m_Box;
+        VxVector m_Position;
+        XDWORD m_States; // material and texture sort identifiers
+        XDWORD m_MeshId;
+    };
+
+    XDWORD GetSortId(CKObject *obj)
+    {
+        if (!obj)
+            return 0;
+        int *id = m_SortIds.FindPtr(obj->GetID());
+        if (id)
+            return (XDWORD)*id;
+        int n = m_SortIds.Size() + 1;
+        m_SortIds.Insert(obj->GetID(), n);
+        return (XDWORD)n;
+    }
+
+    static CKBOOL SkipEntity(CKRenderContext *dev, CKRenderObject *ent, void *arg)
+    {
+        return TRUE;
+    }
+
+    static void RecordFrame(CKRenderContext *dev, void *arg)
+    {
+        ((CKParallelRenderer *)arg)->Record(dev);
+    }
+
+    static void SubmitFrame(CKRenderContext *dev, void *arg)
+    {
+        ((CKParallelRenderer *)arg)->m_Commands.Submit(dev);
+    }
+
+    void Record(CKRenderContext *dev)
+    {
+        m_Snapshot.Resize(0);
+        CKRenderCuller view;
+        if (!view.SetView(dev))
+        {
+            m_Commands.Reset(0);
+            return;
+        }
+        m_Culler = view.GetCuller();
+        m_View = dev->GetViewTransformationMatrix();
+
+        CKContext *ctx = dev->GetCKContext();
+        for (XHashTable<CK3dEntity *, CK_ID>::Iterator it = m_Entities.Begin(); it != m_Entities.End(); ++it)
+        {
+            // the entity may have been deleted since it was added
+            CK3dEntity *ent = (CK3dEntity *)ctx->GetObject(it.GetKey());
+            CKMesh *mesh = ent ? ent->GetCurrentMesh() : NULL;
+            if (!mesh || !ent->IsVisible())
+                continue;
+            Snapshot s;
+            s.m_Entity = ent;
+            s.m_Mesh = mesh;
+            s.m_Box = ent->GetBoundingBox(FALSE);
+            s.m_Position = *(const VxVector *)&ent->GetWorldMatrix()[3][0];
+            CKMaterial *mat = mesh->GetMaterialCount() ? mesh->GetMaterial(0) : NULL;
+            s.m_States = ((GetSortId(mat) & 0xFFFF) << 16) | (GetSortId(mat ? mat->GetTexture() : NULL) & 0xFFFF);
+            s.m_MeshId = GetSortId(mesh) & 0xFFFF;
+            m_Snapshot.PushBack(s);
+        }
+
+        const int count = m_Snapshot.Size();
+        m_Commands.Reset((count + Grain - 1) / Grain);
+        if (m_Pool)
+            m_Pool->For(count, Grain, RecordRange, this);
+        else
+            RecordRange(this, 0, count);
+        m_Commands.Merge();
+    }
+
+    // Culls a range of entities and records the visible ones, runs on the workers.
+    static void RecordRange(void *arg, int begin, int end)
+    {
+        CKParallelRenderer &r = *(CKParallelRenderer *)arg;
+        const int stream = begin / Grain;
+        const VxMatrix &view = r.m_View;
+        for (int i = begin; i < end; ++i)
+        {
+            const Snapshot &s = r.m_Snapshot[i];
+            if (r.m_Culler.CullBox(s.m_Box) == VxFrustumCuller::OUTSIDE)
+                continue;
+            float z = view[0][2] * s.m_Position.x + view[1][2] * s.m_Position.y + view[2][2] * s.m_Position.z + view[3][2];
+            XDWORD depth = (z > 0.0f) ? *(XDWORD *)&z : 0;
+            CKDrawPacket p;
+            p.m_Entity = s.m_Entity;
+            p.m_Mesh = s.m_Mesh;
+            p.m_KeyHigh = s.m_States;
+            p.m_KeyLow = (s.m_MeshId << 16) | (depth >> 16);
+            r.m_Commands.Record(stream, p);
+        }
+    }
+
+    CKRenderContext *m_Dev;
+    VxParallelPool *m_Pool;
+    CKBOOL m_Registered;
+    XHashTable<CK3dEntity *, CK_ID> m_Entities;
+    XHashTable<int, CK_ID> m_SortIds;
+    XArray<Snapshot> m_Snapshot;
+    VxFrustumCuller m_Culler;
+    VxMatrix m_View;
+    CKRenderCommandBuffer m_Commands;
+
+private:
+    CKParallelRenderer(const CKParallelRenderer &);
+    CKParallelRenderer &operator=(const CKParallelRenderer &);
+};
+
+#endif // CKRENDERCOMMANDBUFFER_H
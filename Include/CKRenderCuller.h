@@ -0,0 +1,127 @@
+#ifndef CKRENDERCULLER_H
+#define CKRENDERCULLER_H
+
+#include "CKRenderContext.h"
+#include "CKCamera.h"
+#include "CK3dEntity.h"
+#include "XObjectArray.h"
+#include "VxFrustumCuller.h"
+
+/****************************************************************
+Summary: Frustum culling of arrays of 3D entities.
+
+Remarks:
+    o The world bounding boxes of the entities are gathered in a
+    VxBboxSoA and tested 4 at a time with VxFrustumCuller.
+    o The plane cache is kept between calls as long as the same number of
+    entities is given, so an array culled every frame in the same order
+    benefits from the temporal coherency of the view.
+    o This is meant to reduce large sets of objects (vegetation, crowds,
+    props) before handing them to the render context; the render
+    context still performs its own culling in DrawScene.
+
+    CKRenderCuller culler;
+    if (culler.SetView(dev))
+        culler.Cull(entities, count, visible);
+
+See Also: VxFrustumCuller,CK3dEntity::IsInViewFrustrum
+****************************************************************/
+class CKRenderCuller
+{
+public:
+    CKRenderCuller() {}
+
+    // Sets the frustum to use.
+    void SetFrustum(const VxFrustum &frustum) { m_Culler.SetFrustum(frustum); }
+
+    /************************************************
+    Summary: Sets the frustum from the camera attached to a render context.
+
+    Return Value:
+        FALSE if no camera is attached to the render context.
+    ************************************************/
+    CKBOOL SetView(CKRenderContext *dev)
+    {
+        CKCamera *cam = dev ? dev->GetAttachedCamera() : NULL;
+        if (!cam)
+            return FALSE;
+        const VxMatrix &mat = cam->GetWorldMatrix();
+        VxVector right = Normalize(*(VxVector *)&mat[0][0]);
+        VxVector up = Normalize(*(VxVector *)&mat[1][0]);
+        VxVector dir = Normalize(*(VxVector *)&mat[2][0]);
+        int width = 4, height = 3;
+        cam->GetAspectRatio(width, height);
+        float aspect = width ? (float)height / (float)width : 1.0f;
+        m_Culler.SetFrustum(VxFrustum(*(VxVector *)&mat[3][0], right, up, dir,
+                                      cam->GetFrontPlane(), cam->GetBackPlane(), cam->GetFov(), aspect));
+        return TRUE;
+    }
+
+    /************************************************
+    Summary: Gets the entities inside the frustum.
+
+    Arguments:
+        entities: Entities to test.
+        count: Number of entities.
+        visible: The visible entities are added to this array.
+        inside: If not NULL, the entities completely inside the frustum are
+        added to this array (their children are inside too when the
+        hierarchical boxes are used).
+        hierarchical: TRUE to use the hierarchical boxes instead of the
+        bounding boxes of the entities.
+    Return Value:
+        Number of visible entities.
+    ************************************************/
+    int Cull(CK3dEntity **entities, int count, XArray<CK3dEntity *> &visible, XArray<CK3dEntity *> *inside = NULL, CKBOOL hierarchical = FALSE)
+    {
+        m_Boxes.Clear();
+        m_Boxes.Reserve(count);
+        int i;
+        for (i = 0; i < count; ++i)
+            m_Boxes.Add(hierarchical ? entities[i]->GetHierarchicalBox(FALSE) : entities[i]->GetBoundingBox(FALSE));
+
+        const int groups = m_Boxes.PaddedSize() >> 2;
+        if (m_PlaneCache.Size() != groups)
+        {
+            m_PlaneCache.Resize(groups);
+            if (groups)
+                memset(m_PlaneCache.Begin(), 0, groups);
+        }
+        const int words = (count + 31) >> 5;
+        m_Visible.Resize(words);
+        m_Inside.Resize(words);
+        if (!count)
+            return 0;
+
+        int res = m_Culler.Cull(m_Boxes, m_Visible.Begin(), inside ? m_Inside.Begin() : NULL, m_PlaneCache.Begin());
+        for (i = 0; i < count; ++i)
+        {
+            if (!(m_Visible[i >> 5] & (1 << (i & 31))))
+                continue;
+            visible.PushBack(entities[i]);
+            if (inside && (m_Inside[i >> 5] & (1 << (i & 31))))
+                inside->PushBack(entities[i]);
+        }
+        return res;
+    }
+
+    int Cull(const XObjectPointerArray &entities, XArray<CK3dEntity *> &visible, XArray<CK3dEntity *> *inside = NULL, CKBOOL hierarchical = FALSE)
+    {
+        return Cull((CK3dEntity **)entities.Begin(), entities.Size(), visible, inside, hierarchical);
+    }
+
+    const VxFrustumCuller &GetCuller() const { return m_Culler; }
+
+protected:
+    VxFrustumCuller m_Culler;
+    VxBboxSoA m_Boxes;
+    XArray<XBYTE> m_PlaneCache;
+    XArray<XDWORD> m_Visible;
+    XArray<XDWORD> m_Inside;
+
+private:
+    CKRenderCuller(const CKRenderCuller &);
+    CKRenderCuller &operator=(const CKRenderCuller &);
+};
+
+#endif // CKRENDERCULLER_H
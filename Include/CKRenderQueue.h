@@ -0,0 +1,329 @@
+#ifndef CKRENDERQUEUE_H
+#define CKRENDERQUEUE_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "XHashTable.h"
+#include "XRadixSort.h"
+
+/****************************************************************
+Summary: Shadow copy of the render states of a render context.
+
+Remarks:
+    o The states, texture stage states, textures and material set through
+    the cache are remembered and the calls which would not change anything
+    are not sent to the render context.
+    o Code which changes the states without the cache (CKMesh::Render,
+    materials, other callbacks) must be followed by Invalidate.
+
+See Also: CKRenderQueue,CKRenderContext::SetState
+****************************************************************/
+class CKRenderStateCache
+{
+public:
+    explicit CKRenderStateCache(CKRenderContext *dev) : m_Dev(dev), m_Skipped(0) { Invalidate(); }
+
+    // Forgets all the states (to call after the states were changed without the cache).
+    void Invalidate()
+    {
+        memset(m_StateValid, 0, sizeof(m_StateValid));
+        memset(m_StageStateValid, 0, sizeof(m_StageStateValid));
+        for (int i = 0; i < CKRST_MAX_STAGES; ++i)
+            m_TextureValid[i] = FALSE;
+        m_MaterialValid = FALSE;
+    }
+
+    void SetState(VXRENDERSTATETYPE state, CKDWORD value)
+    {
+        if ((unsigned int)state >= VXRENDERSTATE_MAXSTATE)
+            return;
+        if (m_StateValid[state] && m_States[state] == value)
+        {
+            ++m_Skipped;
+            return;
+        }
+        m_StateValid[state] = TRUE;
+        m_States[state] = value;
+        m_Dev->SetState(state, value);
+    }
+
+    CKBOOL SetTexture(CKTexture *tex, CKBOOL clamped = FALSE, int stage = 0)
+    {
+        if (stage < 0 || stage >= CKRST_MAX_STAGES)
+            return FALSE;
+        if (m_TextureValid[stage] && m_Textures[stage] == tex && m_Clamped[stage] == clamped)
+        {
+            ++m_Skipped;
+            return TRUE;
+        }
+        m_TextureValid[stage] = TRUE;
+        m_Textures[stage] = tex;
+        m_Clamped[stage] = clamped;
+        return m_Dev->SetTexture(tex, clamped, stage);
+    }
+
+    CKBOOL SetTextureStageState(CKRST_TEXTURESTAGESTATETYPE state, CKDWORD value, int stage = 0)
+    {
+        if ((unsigned int)state >= CKRST_TSS_MAXSTATE || stage < 0 || stage >= CKRST_MAX_STAGES)
+            return FALSE;
+        if (m_StageStateValid[stage][state] && m_StageStates[stage][state] == value)
+        {
+            ++m_Skipped;
+            return TRUE;
+        }
+        m_StageStateValid[stage][state] = TRUE;
+        m_StageStates[stage][state] = value;
+        return m_Dev->SetTextureStageState(state, value, stage);
+    }
+
+    /************************************************
+    Summary: Sets the current material.
+
+    Remarks:
+        A material sets many states and textures, they are all forgotten
+        when a different material is set.
+    ************************************************/
+    void SetCurrentMaterial(CKMaterial *mat, CKBOOL lit = TRUE)
+    {
+        if (m_MaterialValid && m_Material == mat && m_Lit == lit)
+        {
+            ++m_Skipped;
+            return;
+        }
+        Invalidate();
+        m_MaterialValid = TRUE;
+        m_Material = mat;
+        m_Lit = lit;
+        m_Dev->SetCurrentMaterial(mat, lit);
+    }
+
+    // Number of calls which were not sent to the render context.
+    int GetSkippedCount() const { return m_Skipped; }
+    void ResetSkippedCount() { m_Skipped = 0; }
+
+protected:
+    CKRenderContext *m_Dev;
+    int m_Skipped;
+    CKDWORD m_States[VXRENDERSTATE_MAXSTATE];
+    CKBYTE m_StateValid[VXRENDERSTATE_MAXSTATE];
+    CKDWORD m_StageStates[CKRST_MAX_STAGES][CKRST_TSS_MAXSTATE];
+    CKBYTE m_StageStateValid[CKRST_MAX_STAGES][CKRST_TSS_MAXSTATE];
+    CKTexture *m_Textures[CKRST_MAX_STAGES];
+    CKBOOL m_Clamped[CKRST_MAX_STAGES];
+    CKBOOL m_TextureValid[CKRST_MAX_STAGES];
+    CKMaterial *m_Material;
+    CKBOOL m_Lit;
+    CKBOOL m_MaterialValid;
+};
+
+/****************************************************************
+Summary: Draws entities sorted by render state instead of scene order.
+
+Remarks:
+    o The render function of the entities added to the queue is replaced:
+    when the render context draws one of them (it passed the visibility and
+    frustum tests) an item is recorded with a 64 bits sort key.
+    o Opaque items are drawn after the other opaque objects, sorted by
+    layer, material, texture, mesh and then front to back, so that
+    consecutive items share their states. Transparent items are drawn
+    after the transparent objects of the scene, back to front.
+    o The keys are sorted with a radix sort (XRadixSorter), the materials,
+    textures and meshes get small sort identifiers the first time they
+    are seen.
+    o CKMesh::Render sets the states of the materials, the sorted order
+    lets consecutive items share them. Custom drawing code can use a
+    CKRenderStateCache to drop its own redundant state changes.
+
+    CKRenderQueue queue(dev);
+    for (i = 0; i < props.Size(); ++i)
+        queue.Add(props[i]);
+
+See Also: CKRenderStateCache,XRadixSorter,CKMeshInstancer
+****************************************************************/
+class CKRenderQueue
+{
+public:
+    explicit CKRenderQueue(CKRenderContext *dev) : m_Dev(dev), m_Registered(FALSE) {}
+
+    ~CKRenderQueue() { Clear(); }
+
+    /************************************************
+    Summary: Draws an entity through the queue.
+
+    Arguments:
+        ent: Entity to add.
+        layer: Items of a lower layer (0..7) are drawn first.
+    ************************************************/
+    CKBOOL Add(CK3dEntity *ent, int layer = 0)
+    {
+        if (!ent || m_Layers.FindPtr(ent->GetID()))
+            return FALSE;
+        m_Layers.Insert(ent->GetID(), layer & 7);
+        ent->SetRenderCallBack(RecordEntity, this);
+        if (!m_Registered && m_Dev)
+        {
+            m_Dev->AddPostRenderCallBack(DrawOpaque, this, FALSE, TRUE);
+            m_Dev->AddPostRenderCallBack(DrawTransparent, this, FALSE, FALSE);
+            m_Registered = TRUE;
+        }
+        return TRUE;
+    }
+
+    // Restores the render function of an entity.
+    void Remove(CK3dEntity *ent)
+    {
+        if (!ent || !m_Layers.FindPtr(ent->GetID()))
+            return;
+        m_Layers.Remove(ent->GetID());
+        ent->RemoveRenderCallBack();
+    }
+
+    // Restores the render function of all the entities.
+    void Clear()
+    {
+        CKContext *ctx = m_Dev ? m_Dev->GetCKContext() : NULL;
+        for (XHashTable<int, CK_ID>::Iterator it = m_Layers.Begin(); it != m_Layers.End(); ++it)
+        {
+            CK3dEntity *ent = ctx ? (CK3dEntity *)ctx->GetObject(it.GetKey()) : NULL;
+            if (ent && !ent->IsToBeDeleted())
+                ent->RemoveRenderCallBack();
+        }
+        if (m_Registered)
+        {
+            m_Dev->RemovePostRenderCallBack(DrawOpaque, this);
+            m_Dev->RemovePostRenderCallBack(DrawTransparent, this);
+        }
+        m_Registered = FALSE;
+        m_Layers.Clear();
+        m_SortIds.Clear();
+        m_Opaque.Clear();
+        m_Transparent.Clear();
+    }
+
+protected:
+    struct Item
+    {
+        CK3dEntity *m_Entity;
+        CKMesh *m_Mesh;
+    };
+
+    struct Queue
+    {
+        void Clear()
+        {
+            m_Items.Resize(0);
+            m_Low.Resize(0);
+            m_High.Resize(0);
+        }
+
+        XArray<Item> m_Items;
+        XArray<XDWORD> m_Low;
+        XArray<XDWORD> m_High;
+        XRadixSorter m_Sorter;
+    };
+
+    // Small identifier of an object for the sort keys.
+    XDWORD GetSortId(CKObject *obj)
+    {
+        if (!obj)
+            return 0;
+        int *id = m_SortIds.FindPtr(obj->GetID());
+        if (id)
+            return (XDWORD)*id;
+        int n = m_SortIds.Size() + 1;
+        m_SortIds.Insert(obj->GetID(), n);
+        return (XDWORD)n;
+    }
+
+    // Bits of a positive float, in the same order as the float.
+    static XDWORD DepthBits(float z)
+    {
+        if (!(z > 0.0f))
+            return 0;
+        return *(XDWORD *)&z;
+    }
+
+    static CKBOOL RecordEntity(CKRenderContext *dev, CKRenderObject *obj, void *arg)
+    {
+        CKRenderQueue *queue = (CKRenderQueue *)arg;
+        CK3dEntity *ent = (CK3dEntity *)obj;
+        int *layer = queue->m_Layers.FindPtr(ent->GetID());
+        CKMesh *mesh = ent->GetCurrentMesh();
+        if (!layer || !mesh)
+            return TRUE;
+
+        Item item;
+        item.m_Entity = ent;
+        item.m_Mesh = mesh;
+        CKMaterial *mat = mesh->GetMaterialCount() ? mesh->GetMaterial(0) : NULL;
+        const VxMatrix &view = dev->GetViewTransformationMatrix();
+        const VxVector &pos = *(const VxVector *)&ent->GetWorldMatrix()[3][0];
+        XDWORD depth = DepthBits(view[0][2] * pos.x + view[1][2] * pos.y + view[2][2] * pos.z + view[3][2]);
+
+        XDWORD high, low;
+        Queue *q;
+        if (mesh->IsTransparent())
+        {
+            // layer, back to front, then states
+            high = ((XDWORD)*layer << 28) | (~(depth >> 3) & 0x0FFFFFFF);
+            low = (queue->GetSortId(mat) << 16) | (queue->GetSortId(mesh) & 0xFFFF);
+            q = &queue->m_Transparent;
+        }
+        else
+        {
+            // layer, material, texture, then mesh and front to back
+            CKTexture *tex = mat ? mat->GetTexture() : NULL;
+            high = ((XDWORD)*layer << 28) | ((queue->GetSortId(mat) & 0x3FFF) << 14) | (queue->GetSortId(tex) & 0x3FFF);
+            low = (queue->GetSortId(mesh) << 16) | (depth >> 16);
+            q = &queue->m_Opaque;
+        }
+        q->m_Items.PushBack(item);
+        q->m_High.PushBack(high);
+        q->m_Low.PushBack(low);
+        return TRUE;
+    }
+
+    static void DrawOpaque(CKRenderContext *dev, void *arg)
+    {
+        CKRenderQueue *queue = (CKRenderQueue *)arg;
+        queue->Draw(queue->m_Opaque);
+    }
+
+    static void DrawTransparent(CKRenderContext *dev, void *arg)
+    {
+        CKRenderQueue *queue = (CKRenderQueue *)arg;
+        queue->Draw(queue->m_Transparent);
+    }
+
+    void Draw(Queue &q)
+    {
+        const int count = q.m_Items.Size();
+        if (!count)
+            return;
+        const int *order = q.m_Sorter.Sort(q.m_Low.Begin(), q.m_High.Begin(), count);
+        for (int i = 0; i < count; ++i)
+        {
+            const Item &item = q.m_Items[order[i]];
+            m_Dev->SetWorldTransformationMatrix(item.m_Entity->GetWorldMatrix());
+            item.m_Mesh->Render(m_Dev, item.m_Entity);
+        }
+        q.Clear();
+    }
+
+    CKRenderContext *m_Dev;
+    CKBOOL m_Registered;
+    XHashTable<int, CK_ID> m_Layers;  // layer of each entity of the queue
+    XHashTable<int, CK_ID> m_SortIds; // sort identifiers of the materials, textures and meshes
+    Queue m_Opaque;
+    Queue m_Transparent;
+
+private:
+    CKRenderQueue(const CKRenderQueue &);
+    CKRenderQueue &operator=(const CKRenderQueue &);
+};
+
+#endif // CKRENDERQUEUE_H
@@ -0,0 +1,234 @@
+#ifndef CKRENDERTARGETPOOL_H
+#define CKRENDERTARGETPOOL_H
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKTexture.h"
+#include "XArray.h"
+
+#define RENDER_TARGET_POOL_GUID CKGUID(0x7d2a4e91, 0x3bc05f16)
+
+/****************************************************************
+Summary: Pool of textures used as transient render targets, shared by size, format and usage.
+
+Remarks:
+    o Acquire returns a free target of the given size, format and usage
+    (creating a dynamic texture when there is none) and Release gives it
+    back. Effects take their temporary targets just before their pass and
+    release them right after it: a pass run later in the frame gets the same
+    texture, so the passes which do not overlap share their video memory
+    instead of each keeping a texture of its own.
+    o The usage is a value of the caller which separates the targets that
+    must not be shared even if they have the same size and format (a
+    target read by the next frame, a target with mipmaps...). RT_MIPMAP
+    also makes the texture generate its mipmap levels.
+    o A target can stay acquired across frames (a reflection updated every
+    other frame, for example). The free targets not acquired during the last
+    SetMaxIdleFrames frames are destroyed at the end of the rendering
+    (OnPostRender), so the pool follows the current needs of the effects.
+    o The textures are created with CK_OBJECTCREATION_DYNAMIC and are not
+    saved with the composition. Destroying one of them (or a ClearAll)
+    removes it from the pool.
+
+    CKRenderTargetPool *pool = CKRenderTargetPool::Get(context);
+    CKTexture *blur = pool->Acquire(dev, 512, 256, _32_ARGB8888);
+    dev->SetRenderTarget(blur);
+    ... // render the pass
+    dev->SetRenderTarget(NULL);
+    ... // use blur
+    pool->Release(blur);
+
+See Also: CKRenderContext::SetRenderTarget,CKTexture::SetDesiredVideoFormat
+****************************************************************/
+class CKRenderTargetPool : public CKBaseManager
+{
+public:
+    enum
+    {
+        RT_DEFAULT = 0,
+        RT_MIPMAP  = 1 // the texture generates its mipmap levels
+    };
+
+    // The pool of the context, created on the first call.
+    static CKRenderTargetPool *Get(CKContext *context)
+    {
+        CKRenderTargetPool *pool = (CKRenderTargetPool *)context->GetManagerByGuid(RENDER_TARGET_POOL_GUID);
+        if (!pool)
+            pool = new CKRenderTargetPool(context);
+        return pool;
+    }
+
+    ~CKRenderTargetPool() {}
+
+    /*************************************************
+    Summary: Returns a render target texture which is not used by someone else.
+
+    Arguments:
+        dev: Render context the texture is put in video memory for, NULL to leave it in system memory.
+        width: Width in pixels.
+        height: Height in pixels.
+        format: Pixel format of the texture in video memory.
+        usage: RT_MIPMAP or a value of the caller separating targets which cannot be shared.
+    Return Value:
+        The texture, or NULL if it could not be created.
+    *************************************************/
+    CKTexture *Acquire(CKRenderContext *dev, int width, int height, VX_PIXELFORMAT format, CKDWORD usage = RT_DEFAULT)
+    {
+        for (int i = 0; i < m_Targets.Size(); ++i)
+        {
+            Target &t = m_Targets[i];
+            if (t.m_Acquired || t.m_Width != width || t.m_Height != height || t.m_Format != format || t.m_Usage != usage)
+                continue;
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(t.m_Texture);
+            if (!tex)
+                continue;
+            t.m_Acquired = TRUE;
+            t.m_LastFrame = m_Frame;
+            if (dev && !tex->IsInVideoMemory())
+                tex->SystemToVideoMemory(dev);
+            return tex;
+        }
+
+        CKTexture *tex = (CKTexture *)m_Context->CreateObject(CKCID_TEXTURE, "Render Target Pool", CK_OBJECTCREATION_DYNAMIC);
+        if (!tex)
+            return NULL;
+        if (!tex->Create(width, height, 32))
+        {
+            m_Context->DestroyObject(tex);
+            return NULL;
+        }
+        tex->SetDesiredVideoFormat(format);
+        if (usage & RT_MIPMAP)
+            tex->UseMipmap(TRUE);
+        if (dev)
+            tex->SystemToVideoMemory(dev);
+
+        Target t;
+        t.m_Texture = tex->GetID();
+        t.m_Width = width;
+        t.m_Height = height;
+        t.m_Format = format;
+        t.m_Usage = usage;
+        t.m_Acquired = TRUE;
+        t.m_LastFrame = m_Frame;
+        m_Targets.PushBack(t);
+        return tex;
+    }
+
+    // Gives a target back to the pool. It can be acquired again in the same frame.
+    void Release(CKTexture *tex)
+    {
+        if (!tex)
+            return;
+        const CK_ID id = tex->GetID();
+        for (int i = 0; i < m_Targets.Size(); ++i)
+        {
+            if (m_Targets[i].m_Texture == id)
+            {
+                m_Targets[i].m_Acquired = FALSE;
+                return;
+            }
+        }
+    }
+
+    // Number of frames a free target is kept without being acquired.
+    void SetMaxIdleFrames(int frames) { m_MaxIdleFrames = XMax(frames, 0); }
+    int GetMaxIdleFrames() const { return m_MaxIdleFrames; }
+
+    // Destroys the targets which are not acquired.
+    void Trim()
+    {
+        Trim(0);
+    }
+
+    int GetTargetCount() const { return m_Targets.Size(); }
+
+    // Bytes of the targets of the pool, at 32 bits per pixel.
+    int GetMemorySize() const
+    {
+        int size = 0;
+        for (int i = 0; i < m_Targets.Size(); ++i)
+            size += m_Targets[i].m_Width * m_Targets[i].m_Height * 4;
+        return size;
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR OnPostRender(CKRenderContext *dev)
+    {
+        ++m_Frame;
+        Trim(m_MaxIdleFrames);
+        return CK_OK;
+    }
+
+    virtual CKERROR SequenceToBeDeleted(CK_ID *objids, int count)
+    {
+        // forget the textures destroyed by someone else
+        int kept = 0;
+        for (int i = 0; i < m_Targets.Size(); ++i)
+        {
+            CKObject *obj = m_Context->GetObject(m_Targets[i].m_Texture);
+            if (obj && !obj->IsToBeDeleted())
+                m_Targets[kept++] = m_Targets[i];
+        }
+        m_Targets.Resize(kept);
+        return CK_OK;
+    }
+
+    virtual CKERROR PreClearAll()
+    {
+        m_Targets.Resize(0);
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_OnPostRender |
+               CKMANAGER_FUNC_OnSequenceToBeDeleted |
+               CKMANAGER_FUNC_PreClearAll;
+    }
+
+protected:
+    struct Target
+    {
+        CK_ID m_Texture;
+        int m_Width;
+        int m_Height;
+        VX_PIXELFORMAT m_Format;
+        CKDWORD m_Usage;
+        CKBOOL m_Acquired;
+        int m_LastFrame; // last frame it was acquired
+    };
+
+    CKRenderTargetPool(CKContext *context) : CKBaseManager(context, RENDER_TARGET_POOL_GUID, "Render Target Pool"),
+                                             m_Frame(0), m_MaxIdleFrames(60)
+    {
+        context->RegisterNewManager(this);
+    }
+
+    void Trim(int maxIdleFrames)
+    {
+        // removed from the pool before they are destroyed, in one sequence
+        XArray<CK_ID> idle;
+        int kept = 0;
+        for (int i = 0; i < m_Targets.Size(); ++i)
+        {
+            const Target &t = m_Targets[i];
+            if (!t.m_Acquired && m_Frame - t.m_LastFrame > maxIdleFrames)
+                idle.PushBack(t.m_Texture);
+            else
+                m_Targets[kept++] = t;
+        }
+        m_Targets.Resize(kept);
+        if (idle.Size())
+            m_Context->DestroyObjects(idle.Begin(), idle.Size());
+    }
+
+    XArray<Target> m_Targets;
+    int m_Frame;
+    int m_MaxIdleFrames;
+};
+
+#endif // CKRENDERTARGETPOOL_H
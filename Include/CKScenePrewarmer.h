@@ -0,0 +1,305 @@
+#ifndef CKSCENEPREWARMER_H
+#define CKSCENEPREWARMER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKTimeManager.h"
+#include "CKScene.h"
+#include "CK3dEntity.h"
+#include "CK2dEntity.h"
+#include "CKSprite.h"
+#include "CKSprite3D.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "CKVertexBuffer.h"
+#include "VxTimeProfiler.h"
+#include "XArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Sends the textures, sprites, meshes and vertex buffers of a scene to the video card before they are first drawn.
+
+Remarks:
+    o The render engine puts a texture in video memory, creates the vertex
+    buffer of a mesh and sets up its materials the first time they are
+    drawn, which makes the first frames of a scene hitch. Prepare lists
+    what the objects of a scene use (the textures of the materials of
+    their meshes, of 2D entities and 3D sprites, the sprites, the meshes)
+    and Start warms them up in the pre-render callback of the render
+    context, spending at most a time budget per frame: textures and sprites
+    are sent with SystemToVideoMemory, meshes are drawn once (with
+    CKMesh::Render, in a one pixel viewport cleared afterwards) which
+    creates their vertex buffers and sets their materials. The vertex
+    buffers of the application are checked (CKVertexBuffer::Check).
+    o The default budget is a quarter of the frame time of the frame rate
+    limit of the time manager (CKTimeManager::GetFrameRateLimit), or 4 ms
+    when the frame rate is not limited. A loading screen can give a larger
+    budget and render until IsDone.
+    o Prepare can be called before CKLevel::LaunchScene: the inactive
+    objects of the scene are warmed up as well.
+
+    CKScenePrewarmer prewarm(context, dev);
+    prewarm.Prepare(scene);
+    prewarm.Start();
+    level->LaunchScene(scene);
+    ...
+    // in the loading screen
+    while (!prewarm.IsDone())
+    {
+        DrawProgressBar(prewarm.GetProgress());
+        dev->Render();
+    }
+
+See Also: CKTexture::SystemToVideoMemory,CKSprite::SystemToVideoMemory,CKVertexBuffer::Check,CKTimeManager::GetFrameRateLimit
+****************************************************************/
+class CKScenePrewarmer
+{
+public:
+    CKScenePrewarmer(CKContext *context, CKRenderContext *dev)
+        : m_Context(context), m_Dev(dev), m_Next(0), m_Budget(-1.0f), m_Started(FALSE) {}
+
+    ~CKScenePrewarmer() { Stop(); }
+
+    /*************************************************
+    Summary: Lists the resources used by the objects of a scene.
+
+    Return Value:
+        Number of resources left to warm up.
+    Remarks:
+        Several scenes can be prepared, the resources used by more than one are warmed up once.
+    *************************************************/
+    int Prepare(CKScene *scene)
+    {
+        if (!scene)
+            return GetRemainingCount();
+        int i;
+        const XObjectPointerArray &entities = scene->ComputeObjectList(CKCID_3DENTITY, TRUE);
+        for (i = 0; i < entities.Size(); ++i)
+        {
+            CK3dEntity *ent = (CK3dEntity *)entities[i];
+            for (int m = 0; m < ent->GetMeshCount(); ++m)
+                AddMesh(ent, ent->GetMesh(m));
+            if (CKIsChildClassOf(ent, CKCID_SPRITE3D))
+                AddMaterial(((CKSprite3D *)ent)->GetMaterial());
+        }
+        const XObjectPointerArray &entities2d = scene->ComputeObjectList(CKCID_2DENTITY, TRUE);
+        for (i = 0; i < entities2d.Size(); ++i)
+        {
+            CK2dEntity *ent = (CK2dEntity *)entities2d[i];
+            if (CKIsChildClassOf(ent, CKCID_SPRITE))
+                AddItem(ITEM_SPRITE, ent->GetID(), 0, FALSE);
+            else
+                AddMaterial(ent->GetMaterial());
+        }
+        return GetRemainingCount();
+    }
+
+    // Adds a texture to send to video memory.
+    void AddTexture(CKTexture *tex, CKBOOL clamped = FALSE)
+    {
+        if (tex)
+            AddItem(ITEM_TEXTURE, tex->GetID(), 0, clamped);
+    }
+
+    // Adds a vertex buffer of the application to check with these arguments.
+    void AddVertexBuffer(CKVertexBuffer *vb, CKDWORD maxVertexCount, CKRST_DPFLAGS format, CKBOOL dynamic = FALSE)
+    {
+        if (!vb)
+            return;
+        VertexBufferItem item;
+        item.m_Buffer = vb;
+        item.m_MaxVertexCount = maxVertexCount;
+        item.m_Format = format;
+        item.m_Dynamic = dynamic;
+        m_Buffers.PushBack(item);
+        AddItem(ITEM_VERTEXBUFFER, 0, m_Buffers.Size() - 1, FALSE);
+    }
+
+    /*************************************************
+    Summary: Starts warming up the resources at each rendering.
+
+    Arguments:
+        budget: Time in milliseconds spent per rendering, -1 for the default budget.
+    *************************************************/
+    void Start(float budget = -1.0f)
+    {
+        m_Budget = budget;
+        if (!m_Started)
+        {
+            m_Dev->AddPreRenderCallBack(WarmCallback, this);
+            m_Started = TRUE;
+        }
+    }
+
+    void Stop()
+    {
+        if (m_Started)
+        {
+            m_Dev->RemovePreRenderCallBack(WarmCallback, this);
+            m_Started = FALSE;
+        }
+    }
+
+    // Removes the resources, warmed up or not.
+    void Clear()
+    {
+        m_Items.Resize(0);
+        m_Buffers.Resize(0);
+        m_Seen.Clear();
+        m_Next = 0;
+    }
+
+    CKBOOL IsDone() const { return m_Next >= m_Items.Size(); }
+
+    // Part of the resources warmed up (0..1).
+    float GetProgress() const { return m_Items.Size() ? (float)m_Next / (float)m_Items.Size() : 1.0f; }
+
+    int GetRemainingCount() const { return m_Items.Size() - m_Next; }
+
+protected:
+    enum ItemType
+    {
+        ITEM_TEXTURE,
+        ITEM_SPRITE,
+        ITEM_MESH,
+        ITEM_VERTEXBUFFER
+    };
+
+    struct Item
+    {
+        int m_Type;
+        CK_ID m_Object; // texture, sprite or mesh
+        CK_ID m_Entity; // entity drawing the mesh, vertex buffer index
+        CKBOOL m_Clamped;
+    };
+
+    struct VertexBufferItem
+    {
+        CKVertexBuffer *m_Buffer;
+        CKDWORD m_MaxVertexCount;
+        CKRST_DPFLAGS m_Format;
+        CKBOOL m_Dynamic;
+    };
+
+    void AddItem(int type, CK_ID object, CK_ID entity, CKBOOL clamped)
+    {
+        if (object && !m_Seen.Insert(object, TRUE, FALSE))
+            return;
+        Item item;
+        item.m_Type = type;
+        item.m_Object = object;
+        item.m_Entity = entity;
+        item.m_Clamped = clamped;
+        m_Items.PushBack(item);
+    }
+
+    void AddMaterial(CKMaterial *mat)
+    {
+        if (!mat)
+            return;
+        const CKBOOL clamped = mat->GetTextureAddressMode() == VXTEXTURE_ADDRESSCLAMP;
+        for (int i = 0; i < 4; ++i)
+            AddTexture(mat->GetTexture(i), clamped);
+    }
+
+    void AddMesh(CK3dEntity *ent, CKMesh *mesh)
+    {
+        if (!mesh)
+            return;
+        for (int i = 0; i < mesh->GetMaterialCount(); ++i)
+            AddMaterial(mesh->GetMaterial(i));
+        AddItem(ITEM_MESH, mesh->GetID(), ent->GetID(), FALSE);
+    }
+
+    float GetBudget()
+    {
+        if (m_Budget >= 0.0f)
+            return m_Budget;
+        CKTimeManager *tm = m_Context->GetTimeManager();
+        if ((tm->GetLimitOptions() & CK_FRAMERATE_LIMIT) && tm->GetFrameRateLimit() > 0.0f)
+            return 250.0f / tm->GetFrameRateLimit();
+        return 4.0f;
+    }
+
+    static void WarmCallback(CKRenderContext *dev, void *arg)
+    {
+        ((CKScenePrewarmer *)arg)->Warm(dev);
+    }
+
+    void Warm(CKRenderContext *dev)
+    {
+        if (IsDone())
+            return;
+        const float budget = GetBudget();
+        VxTimeProfiler timer;
+        VxRect view;
+        CKBOOL drawn = FALSE;
+        do
+        {
+            const Item &item = m_Items[m_Next++];
+            switch (item.m_Type)
+            {
+            case ITEM_TEXTURE:
+            {
+                CKTexture *tex = (CKTexture *)m_Context->GetObject(item.m_Object);
+                if (tex && !tex->IsInVideoMemory())
+                    tex->SystemToVideoMemory(dev, item.m_Clamped);
+                break;
+            }
+            case ITEM_SPRITE:
+            {
+                CKSprite *sprite = (CKSprite *)m_Context->GetObject(item.m_Object);
+                if (sprite && !sprite->IsInVideoMemory())
+                    sprite->SystemToVideoMemory(dev);
+                break;
+            }
+            case ITEM_MESH:
+            {
+                CKMesh *mesh = (CKMesh *)m_Context->GetObject(item.m_Object);
+                CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(item.m_Entity);
+                if (!mesh || !ent)
+                    break;
+                if (!drawn)
+                {
+                    // the meshes are drawn in one pixel, cleared afterwards
+                    dev->GetViewRect(view);
+                    VxRect pixel(view.left, view.top, view.left + 1.0f, view.top + 1.0f);
+                    dev->SetViewRect(pixel);
+                    drawn = TRUE;
+                }
+                dev->SetWorldTransformationMatrix(ent->GetWorldMatrix());
+                mesh->Render(dev, ent);
+                break;
+            }
+            case ITEM_VERTEXBUFFER:
+            {
+                VertexBufferItem &vb = m_Buffers[item.m_Entity];
+                vb.m_Buffer->Check(dev, vb.m_MaxVertexCount, vb.m_Format, vb.m_Dynamic);
+                break;
+            }
+            }
+        } while (!IsDone() && timer.Current() < budget);
+
+        if (drawn)
+        {
+            dev->Clear((CK_RENDER_FLAGS)(CK_RENDER_CLEARBACK | CK_RENDER_CLEARZ | CK_RENDER_CLEARVIEWPORT));
+            dev->SetViewRect(view);
+        }
+    }
+
+    CKContext *m_Context;
+    CKRenderContext *m_Dev;
+    XArray<Item> m_Items;
+    XArray<VertexBufferItem> m_Buffers;
+    XHashTable<CKBOOL, CK_ID> m_Seen; // resources already listed
+    int m_Next;                       // first item not warmed up
+    float m_Budget;
+    CKBOOL m_Started;
+
+private:
+    CKScenePrewarmer(const CKScenePrewarmer &);
+    CKScenePrewarmer &operator=(const CKScenePrewarmer &);
+};
+
+#endif // CKSCENEPREWARMER_H
@@ -0,0 +1,257 @@
+#ifndef CKSCENESWITCHER_H
+#define CKSCENESWITCHER_H
+
+#include "CKContext.h"
+#include "CKLevel.h"
+#include "CKScene.h"
+#include "CKSceneObject.h"
+#include "XBitArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Scene launches applying only the activity changes, computed on bit arrays.
+
+Remarks:
+    o Launching a scene activates or deactivates each of its objects and
+    scripts according to their scene flags. The switcher reads the flags of
+    a scene once (Prepare) into bit arrays indexed by object slot: the
+    members, the objects to activate and to deactivate at start, and the
+    objects currently active in the scene.
+    o LaunchScene computes with bit operations the objects whose activity
+    changes (to activate at start and not active, to deactivate at start
+    and active, the CK_SCENEOBJECT_START_LEAVE objects being untouched),
+    launches the scene with CK_SCENEOBJECTACTIVITY_DONOTHING and only
+    calls CKScene::Activate or DeActivate on these objects. The resets are
+    still done by the level, according to the reset flags given.
+    o The active bits of a scene are kept up to date by the switcher. If
+    the activity of its objects is changed by other means (scripts
+    activating objects...), Prepare must be called again.
+    o AddObjectsToScene and RemoveObjectsFromScene change the members of a
+    scene in one add (or remove) sequence, so the managers receive a
+    single SequenceAddedToScene (SequenceRemovedFromScene) for the batch.
+
+    CKSceneSwitcher switcher(ctx);
+    for (int i = 0; i < level->GetSceneCount(); ++i)
+        switcher.Prepare(level->GetScene(i));
+    ...
+    switcher.LaunchScene(level, nextScene);
+
+See Also: CKLevel::LaunchScene,CKScene,CK_SCENEOBJECT_FLAGS
+****************************************************************/
+class CKSceneSwitcher
+{
+public:
+    CKSceneSwitcher(CKContext *ctx) : m_Context(ctx) {}
+
+    // Reads the members and the flags of a scene.
+    void Prepare(CKScene *scene)
+    {
+        if (!scene)
+            return;
+        SceneBits *bits = Find(scene);
+        if (!bits)
+        {
+            m_Scenes.Expand(1);
+            bits = &m_Scenes.Back();
+            bits->m_Scene = scene->GetID();
+        }
+        bits->m_Members.Clear();
+        bits->m_StartActive.Clear();
+        bits->m_StartDeactive.Clear();
+        bits->m_Active.Clear();
+        for (CKSceneObjectIterator it = scene->GetObjectIterator(); !it.End(); it++)
+        {
+            const CKDWORD flags = it.GetObjectDesc()->m_Flags;
+            const int slot = GetSlot(it.GetObjectID());
+            bits->m_Members.Set(slot);
+            if (flags & CK_SCENEOBJECT_START_ACTIVATE)
+                bits->m_StartActive.Set(slot);
+            else if (flags & CK_SCENEOBJECT_START_DEACTIVATE)
+                bits->m_StartDeactive.Set(slot);
+            if (flags & CK_SCENEOBJECT_ACTIVE)
+                bits->m_Active.Set(slot);
+        }
+    }
+
+    // Forgets a scene, Prepare must be called before launching it again.
+    void Remove(CKScene *scene)
+    {
+        for (int i = 0; i < m_Scenes.Size(); ++i)
+        {
+            if (scene && m_Scenes[i].m_Scene == scene->GetID())
+            {
+                m_Scenes.RemoveAt(i);
+                return;
+            }
+        }
+    }
+
+    /************************************************
+    Summary: Launches a scene, changing the activity of the objects that need it only.
+
+    Arguments:
+        level: Level the scene belongs to.
+        scene: Scene to launch, prepared if it was not.
+        reset: Reset flags given to CKLevel::LaunchScene.
+    Return Value:
+        Number of objects activated or deactivated, or a negative CKERROR.
+    ************************************************/
+    int LaunchScene(CKLevel *level, CKScene *scene, CK_SCENEOBJECTRESET_FLAGS reset = CK_SCENEOBJECTRESET_RESET)
+    {
+        if (!level || !scene)
+            return CKERR_INVALIDPARAMETER;
+        SceneBits *bits = Find(scene);
+        if (!bits)
+        {
+            Prepare(scene);
+            bits = Find(scene);
+        }
+        const CKERROR err = level->LaunchScene(scene, CK_SCENEOBJECTACTIVITY_DONOTHING, reset);
+        if (err != CK_OK)
+            return err;
+
+        XBitArray activate(bits->m_StartActive);
+        activate -= bits->m_Active;
+        XBitArray deactivate(bits->m_StartDeactive);
+        deactivate.And(bits->m_Active);
+
+        int changed = 0;
+        int slot;
+        for (slot = activate.GetNextSetBit(0); slot >= 0; slot = activate.GetNextSetBit(slot + 1))
+        {
+            CKSceneObject *obj = (CKSceneObject *)m_Context->GetObject(m_SlotObjects[slot]);
+            if (!obj)
+                continue;
+            // already reset by the level
+            scene->Activate(obj, FALSE);
+            bits->m_Active.Set(slot);
+            ++changed;
+        }
+        for (slot = deactivate.GetNextSetBit(0); slot >= 0; slot = deactivate.GetNextSetBit(slot + 1))
+        {
+            CKSceneObject *obj = (CKSceneObject *)m_Context->GetObject(m_SlotObjects[slot]);
+            if (!obj)
+                continue;
+            scene->DeActivate(obj);
+            bits->m_Active.Unset(slot);
+            ++changed;
+        }
+        return changed;
+    }
+
+    //---------------------------------------------
+    // Batched membership changes
+
+    void AddObjectsToScene(CKScene *scene, CKSceneObject **objects, int count, CKBOOL dependencies = TRUE)
+    {
+        if (!scene || count <= 0)
+            return;
+        scene->BeginAddSequence(TRUE);
+        for (int i = 0; i < count; ++i)
+        {
+            if (objects[i])
+                scene->AddObjectToScene(objects[i], dependencies);
+        }
+        scene->BeginAddSequence(FALSE);
+        // the dependencies were added too: the flags are read again
+        if (Find(scene))
+            Prepare(scene);
+    }
+
+    void RemoveObjectsFromScene(CKScene *scene, CKSceneObject **objects, int count, CKBOOL dependencies = TRUE)
+    {
+        if (!scene || count <= 0)
+            return;
+        scene->BeginRemoveSequence(TRUE);
+        for (int i = 0; i < count; ++i)
+        {
+            if (objects[i])
+                scene->RemoveObjectFromScene(objects[i], dependencies);
+        }
+        scene->BeginRemoveSequence(FALSE);
+        if (Find(scene))
+            Prepare(scene);
+    }
+
+    //---------------------------------------------
+    // Queries on the prepared scenes
+
+    CKBOOL IsInScene(CKScene *scene, CKObject *obj)
+    {
+        SceneBits *bits = Find(scene);
+        const int *slot = obj ? m_Slots.FindPtr(obj->GetID()) : NULL;
+        return bits && slot && bits->m_Members.IsSet(*slot);
+    }
+
+    // Objects present in both scenes (common) or in the first one only.
+    int GetSceneDifference(CKScene *a, CKScene *b, XObjectPointerArray &onlyInA, XObjectPointerArray *common = NULL)
+    {
+        onlyInA.Resize(0);
+        if (common)
+            common->Resize(0);
+        SceneBits *ba = Find(a);
+        SceneBits *bb = Find(b);
+        if (!ba || !bb)
+            return 0;
+        XBitArray diff(ba->m_Members);
+        diff -= bb->m_Members;
+        Collect(diff, onlyInA);
+        if (common)
+        {
+            XBitArray both(ba->m_Members);
+            both.And(bb->m_Members);
+            Collect(both, *common);
+        }
+        return onlyInA.Size();
+    }
+
+protected:
+    struct SceneBits
+    {
+        CK_ID m_Scene;
+        XBitArray m_Members;
+        XBitArray m_StartActive;
+        XBitArray m_StartDeactive;
+        XBitArray m_Active;
+    };
+
+    SceneBits *Find(CKScene *scene)
+    {
+        if (!scene)
+            return NULL;
+        for (int i = 0; i < m_Scenes.Size(); ++i)
+        {
+            if (m_Scenes[i].m_Scene == scene->GetID())
+                return &m_Scenes[i];
+        }
+        return NULL;
+    }
+
+    int GetSlot(CK_ID id)
+    {
+        const int *slot = m_Slots.FindPtr(id);
+        if (slot)
+            return *slot;
+        const int s = m_SlotObjects.Size();
+        m_SlotObjects.PushBack(id);
+        m_Slots.Insert(id, s);
+        return s;
+    }
+
+    void Collect(const XBitArray &bits, XObjectPointerArray &objects)
+    {
+        for (int slot = bits.GetNextSetBit(0); slot >= 0; slot = bits.GetNextSetBit(slot + 1))
+        {
+            CKObject *obj = m_Context->GetObject(m_SlotObjects[slot]);
+            if (obj)
+                objects.PushBack(obj);
+        }
+    }
+
+    CKContext *m_Context;
+    XClassArray<SceneBits> m_Scenes;
+    XHashTable<int, CK_ID> m_Slots; // slot of each object seen in a scene
+    XArray<CK_ID> m_SlotObjects;
+};
+
+#endif // CKSCENESWITCHER_H
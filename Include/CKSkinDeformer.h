@@ -0,0 +1,564 @@
+#ifndef CKSKINDEFORMER_H
+#define CKSKINDEFORMER_H
+
+#include <string.h>
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKSkin.h"
+#include "VxSkinning.h"
+#include "VxParallel.h"
+
+/****************************************************************
+Summary: Compiled skin data shared by the deformers of identical skins.
+
+Remarks:
+    o The compiled weights, the vertices and normals of the initial pose
+    (in the referential of the entity) and the initial pose of each bone
+    relative to the entity do not depend on where a character is: the
+    deformers of characters made from the same model share one
+    CKSkinBindData (see CKSkinDeformer::Share) instead of a copy each.
+    o The data is reference counted, it is deleted with the last deformer
+    using it.
+    o It also lists the meshes skinned by its deformers: two deformers
+    sharing the data can not skin the same mesh.
+
+See Also: CKSkinDeformer,VxSkinWeights
+****************************************************************/
+class CKSkinBindData
+{
+    friend class CKSkinDeformer;
+
+public:
+    CKSkinBindData() : m_HasNormals(FALSE), m_RefCount(1) {}
+
+    void AddRef() { ++m_RefCount; }
+    void Release()
+    {
+        if (--m_RefCount == 0)
+            delete this;
+    }
+    int GetRefCount() const { return m_RefCount; }
+
+    int GetBoneCount() const { return m_BoneBind.Size(); }
+    int GetVertexCount() const { return m_Weights.GetVertexCount(); }
+    CKBOOL HasNormals() const { return m_HasNormals; }
+
+    const VxSkinWeights &GetWeights() const { return m_Weights; }
+
+    // TRUE if a deformer using the data skins the mesh.
+    CKBOOL IsMeshUsed(CK_ID mesh) const { return m_Meshes.IsHere(mesh); }
+
+    // Transforms the initial referential of the entity into the initial referential of a bone.
+    const VxMatrix &GetBoneBindMatrix(int bone) const { return m_BoneBind[bone]; }
+
+protected:
+    ~CKSkinBindData() {}
+
+    VxSkinWeights m_Weights; // positions and normals in the initial referential of the entity
+    XArray<VxMatrix> m_BoneBind;
+    XArray<CK_ID> m_Meshes; // skinned by the deformers using the data
+    CKBOOL m_HasNormals;
+    int m_RefCount;
+
+private:
+    CKSkinBindData(const CKSkinBindData &);
+    CKSkinBindData &operator=(const CKSkinBindData &);
+};
+
+/****************************************************************
+Summary: CPU skinning of an entity with compiled weights.
+
+Remarks:
+    o Build reads the CKSkin of an entity once and compiles it into a
+    CKSkinBindData (a VxSkinWeights with 4 bones per vertex and contiguous
+    weights, and the initial pose of the bones). Update then computes the
+    vertices and normals of the current mesh from the bone matrices with
+    the SSE kernel of VxSkinWeights.
+    o Share gives a deformer the compiled data of another one instead of
+    compiling the skin again: a crowd of characters made from the same
+    model keeps the weights and the initial pose once, each deformer only
+    keeps its bones and their matrices.
+    o The skinned vertices are written in the mesh of the entity: each
+    entity needs its own mesh, the vertices are not shared. A deformer
+    skins the mesh which was current when Build or Share was called, and
+    Share fails if a deformer of the same data already skins it (give
+    each copy of a character a copy of the mesh with CKContext::CopyObject
+    before calling Share).
+    o The entity skin is destroyed by Build and Share (unless keepSkin is
+    TRUE) so that the vertices are not computed a second time; Restore
+    creates it again from the compiled data.
+    o The initial inverse matrices of the bones cannot be read back from a
+    CKSkin. They can be given to Build, otherwise the bones and the entity
+    must be in their initial pose when Build is called.
+    o Update does nothing when the entity was outside of the view frustum
+    during the last rendering, or when it is farther than the distance given
+    to SetMaxDistance from the viewpoint. Its bounding box then keeps the
+    last skinned pose.
+    o The world matrices of the bones and of the entity used by the last
+    skinning are kept: only the matrices of the bones which moved are
+    computed again, and the vertices are not computed at all when nothing
+    moved (a character standing still). Invalidate forces the next Update
+    when the vertices of the mesh were changed elsewhere.
+    o CKSkinDeformerGroup updates several deformers on the threads of a
+    VxParallelPool.
+
+    CKSkinDeformer deformer;
+    deformer.Build(character->GetBodyPart(0));
+    CKSkinDeformer copy;
+    CK3dEntity *body = otherCharacter->GetBodyPart(0);
+    body->SetCurrentMesh((CKMesh *)context->CopyObject(body->GetCurrentMesh()));
+    copy.Share(body, deformer);
+    ...
+    deformer.Update(dev); // each frame, before rendering
+
+See Also: VxSkinWeights,CKSkinBindData,CKSkinDeformerGroup,CK3dEntity::CreateSkin
+****************************************************************/
+class CKSkinDeformer
+{
+public:
+    CKSkinDeformer() : m_Context(NULL), m_Entity(0), m_Mesh(0), m_MaxDistance(0.0f), m_Data(NULL), m_Posed(FALSE),
+                       m_Positions(NULL), m_Normals(NULL), m_PositionStride(0), m_NormalStride(0), m_VertexCount(0) {}
+
+    ~CKSkinDeformer()
+    {
+        SetData(NULL);
+    }
+
+    /************************************************
+    Summary: Compiles the skin of an entity.
+
+    Arguments:
+        ent: Entity with a skin.
+        bindInverse: Initial inverse world matrix of each bone of the skin,
+        NULL to use the current inverse world matrices of the bones.
+        objectInit: Initial world matrix of the entity, NULL to use its
+        current world matrix.
+        keepSkin: TRUE to keep the CKSkin of the entity.
+    Return Value:
+        FALSE if the entity has no skin or no mesh.
+    ************************************************/
+    CKBOOL Build(CK3dEntity *ent, const VxMatrix *bindInverse = NULL, const VxMatrix *objectInit = NULL, CKBOOL keepSkin = FALSE)
+    {
+        CKSkin *skin = ent ? ent->GetSkin() : NULL;
+        if (!skin || !ent->GetCurrentMesh())
+            return FALSE;
+        SetData(NULL);
+        SetEntity(ent, skin, objectInit);
+
+        CKSkinBindData *data = new CKSkinBindData;
+        const int boneCount = skin->GetBoneCount();
+        data->m_BoneBind.Resize(boneCount);
+        int i;
+        for (i = 0; i < boneCount; ++i)
+        {
+            CK3dEntity *bone = skin->GetBoneData(i)->GetBone();
+            VxMatrix inverse;
+            if (bindInverse)
+                inverse = bindInverse[i];
+            else if (bone)
+                inverse = bone->GetInverseWorldMatrix();
+            else
+                inverse.SetIdentity();
+            Vx3DMultiplyMatrix(data->m_BoneBind[i], inverse, m_ObjectInit);
+        }
+
+        const int vertexCount = skin->GetVertexCount();
+        const CKBOOL hasNormals = skin->GetNormalCount() == vertexCount;
+        const VxVector zero(0.0f, 0.0f, 0.0f);
+        data->m_Weights.SetVertexCount(vertexCount);
+        XArray<int> bones;
+        XArray<float> weights;
+        for (i = 0; i < vertexCount; ++i)
+        {
+            CKSkinVertexData *vd = skin->GetVertexData(i);
+            const int n = vd->GetBoneCount();
+            bones.Resize(n);
+            weights.Resize(n);
+            for (int k = 0; k < n; ++k)
+            {
+                bones[k] = vd->GetBone(k);
+                weights[k] = vd->GetWeight(k);
+            }
+            data->m_Weights.SetVertex(i, bones.Begin(), weights.Begin(), n, vd->GetInitialPos(), hasNormals ? skin->GetNormal(i) : zero);
+        }
+        data->m_HasNormals = hasNormals;
+        SetData(data);
+        data->Release();
+
+        if (!keepSkin)
+            ent->DestroySkin();
+        return TRUE;
+    }
+
+    /************************************************
+    Summary: Uses the compiled data of another deformer for the skin of an entity.
+
+    Arguments:
+        ent: Entity with a skin made from the same model as the one of source.
+        source: Deformer built from the model.
+        objectInit: Initial world matrix of the entity, NULL to use its current world matrix.
+        keepSkin: TRUE to keep the CKSkin of the entity.
+    Return Value:
+        FALSE if the entity has no skin, if its skin does not have the
+        bone and vertex counts of the source, or if its current mesh is
+        already skinned by a deformer of the same data.
+    Remarks:
+        Only the bones are read from the skin of the entity: the weights,
+        the initial vertices and the initial pose of the bones relative to
+        the entity are the ones of the source.
+    ************************************************/
+    CKBOOL Share(CK3dEntity *ent, const CKSkinDeformer &source, const VxMatrix *objectInit = NULL, CKBOOL keepSkin = FALSE)
+    {
+        CKSkin *skin = ent ? ent->GetSkin() : NULL;
+        CKMesh *mesh = ent ? ent->GetCurrentMesh() : NULL;
+        CKSkinBindData *data = source.m_Data;
+        if (!skin || !mesh || !data || skin->GetBoneCount() != data->GetBoneCount() || skin->GetVertexCount() != data->GetVertexCount())
+            return FALSE;
+        if (data->IsMeshUsed(mesh->GetID()) && !(data == m_Data && mesh->GetID() == m_Mesh))
+            return FALSE;
+        SetData(NULL);
+        SetEntity(ent, skin, objectInit);
+        SetData(data);
+        if (!keepSkin)
+            ent->DestroySkin();
+        return TRUE;
+    }
+
+    // Compiled data of the skin, NULL before Build or Share.
+    CKSkinBindData *GetBindData() const { return m_Data; }
+
+    /************************************************
+    Summary: Gives its skin back to the entity.
+
+    Remarks:
+        The skin is created from the compiled data, vertices which had more
+        than 4 bones keep their 4 most important ones.
+    ************************************************/
+    CKBOOL Restore()
+    {
+        CK3dEntity *ent = GetEntity();
+        if (!ent || !m_Data)
+            return FALSE;
+        CKSkin *skin = ent->GetSkin();
+        if (!skin)
+            skin = ent->CreateSkin();
+        if (!skin)
+            return FALSE;
+        VxMatrix invInit;
+        Vx3DInverseMatrix(invInit, m_ObjectInit);
+        skin->SetObjectInitMatrix(m_ObjectInit);
+        const int boneCount = m_Bones.Size();
+        skin->SetBoneCount(boneCount);
+        int i;
+        for (i = 0; i < boneCount; ++i)
+        {
+            CKSkinBoneData *bd = skin->GetBoneData(i);
+            bd->SetBone((CK3dEntity *)m_Context->GetObject(m_Bones[i]));
+            VxMatrix inverse;
+            Vx3DMultiplyMatrix(inverse, m_Data->m_BoneBind[i], invInit);
+            bd->SetBoneInitialInverseMatrix(inverse);
+        }
+        const VxSkinWeights &w = m_Data->m_Weights;
+        const int vertexCount = w.GetVertexCount();
+        skin->SetVertexCount(vertexCount);
+        if (m_Data->m_HasNormals)
+            skin->SetNormalCount(vertexCount);
+        for (i = 0; i < vertexCount; ++i)
+        {
+            CKSkinVertexData *vd = skin->GetVertexData(i);
+            const int *bones = w.GetBones(i);
+            const float *weights = w.GetWeights(i);
+            int n = 0;
+            while (n < VxSkinWeights::MaxInfluences && weights[n] > 0.0f)
+                ++n;
+            vd->SetBoneCount(n);
+            for (int k = 0; k < n; ++k)
+            {
+                vd->SetBone(k, bones[k]);
+                vd->SetWeight(k, weights[k]);
+            }
+            VxVector pos = w.GetPosition(i);
+            vd->SetInitialPos(pos);
+            if (m_Data->m_HasNormals)
+                skin->SetNormal(i, w.GetNormal(i));
+        }
+        ent->UpdateSkin();
+        return TRUE;
+    }
+
+    // Entity skinned by the deformer, NULL if it was deleted.
+    CK3dEntity *GetEntity() const { return m_Context ? (CK3dEntity *)m_Context->GetObject(m_Entity) : NULL; }
+
+    // Mesh the vertices are written in.
+    CK_ID GetMesh() const { return m_Mesh; }
+
+    // Entities farther than this distance from the viewpoint are not skinned (0 for no limit).
+    void SetMaxDistance(float distance) { m_MaxDistance = distance; }
+    float GetMaxDistance() const { return m_MaxDistance; }
+
+    // Forces the next Update to compute all the bone matrices and the vertices.
+    void Invalidate() { m_Posed = FALSE; }
+
+    // Skins the current mesh of the entity, FALSE if it was not needed.
+    CKBOOL Update(CKRenderContext *dev)
+    {
+        if (!Prepare(dev))
+            return FALSE;
+        SkinRange(0, m_VertexCount);
+        Finish();
+        return TRUE;
+    }
+
+    /************************************************
+    Summary: Computes the bone matrices of the frame.
+
+    Return Value:
+        FALSE if the entity does not need to be skinned this frame.
+    Remarks:
+        Prepare, SkinRange and Finish split Update so that the vertices can
+        be computed by other threads. Prepare and Finish must be called from
+        the main thread.
+        Nothing is done while the current mesh of the entity is not the
+        one given to Build or Share.
+    ************************************************/
+    CKBOOL Prepare(CKRenderContext *dev)
+    {
+        m_VertexCount = 0;
+        CK3dEntity *ent = GetEntity();
+        CKMesh *mesh = ent ? ent->GetCurrentMesh() : NULL;
+        if (!mesh || mesh->GetID() != m_Mesh || !m_Data || mesh->GetVertexCount() != m_Data->GetVertexCount())
+            return FALSE;
+        if (dev && IsSkipped(dev, ent))
+            return FALSE;
+
+        // only the bones which moved since the last skinning are computed
+        const VxMatrix &invWorld = ent->GetInverseWorldMatrix();
+        const CKBOOL entityMoved = !m_Posed || memcmp(&invWorld, &m_InverseWorld, sizeof(VxMatrix));
+        CKBOOL moved = entityMoved;
+        for (int i = 0; i < m_Bones.Size(); ++i)
+        {
+            CK3dEntity *bone = (CK3dEntity *)m_Context->GetObject(m_Bones[i]);
+            const VxMatrix &world = bone ? bone->GetWorldMatrix() : m_ObjectInit;
+            if (!entityMoved && !memcmp(&world, &m_BoneWorlds[i], sizeof(VxMatrix)))
+                continue;
+            m_BoneWorlds[i] = world;
+            VxMatrix m;
+            if (bone)
+                Vx3DMultiplyMatrix(m, world, m_Data->m_BoneBind[i]);
+            else
+                m = m_ObjectInit;
+            Vx3DMultiplyMatrix(m_Matrices[i], invWorld, m);
+            moved = TRUE;
+        }
+        m_InverseWorld = invWorld;
+        if (!moved)
+            return FALSE;
+
+        m_Posed = TRUE;
+        m_Positions = (CKBYTE *)mesh->GetPositionsPtr(&m_PositionStride);
+        m_Normals = m_Data->m_HasNormals ? (CKBYTE *)mesh->GetNormalsPtr(&m_NormalStride) : NULL;
+        m_VertexCount = m_Data->GetVertexCount();
+        return m_Positions != NULL;
+    }
+
+    // Skins a range of vertices, can run on any thread between Prepare and Finish.
+    void SkinRange(int begin, int end) const
+    {
+        m_Data->m_Weights.Skin(m_Matrices.Begin(), begin, end, VxStridedData(m_Positions, m_PositionStride),
+                               VxStridedData(m_Normals, m_NormalStride));
+    }
+
+    // Tells the mesh its vertices moved.
+    void Finish()
+    {
+        CKMesh *mesh = m_VertexCount ? (CKMesh *)m_Context->GetObject(m_Mesh) : NULL;
+        if (!mesh)
+            return;
+        mesh->VertexMove();
+        if (m_Normals)
+            mesh->NormalChanged();
+    }
+
+    // Number of vertices to skin after a successful Prepare.
+    int GetPreparedVertexCount() const { return m_VertexCount; }
+
+protected:
+    void SetEntity(CK3dEntity *ent, CKSkin *skin, const VxMatrix *objectInit)
+    {
+        m_Context = ent->GetCKContext();
+        m_Entity = ent->GetID();
+        m_Mesh = ent->GetCurrentMesh()->GetID();
+        m_ObjectInit = objectInit ? *objectInit : ent->GetWorldMatrix();
+        const int boneCount = skin->GetBoneCount();
+        m_Bones.Resize(boneCount);
+        m_Matrices.Resize(boneCount);
+        m_BoneWorlds.Resize(boneCount);
+        for (int i = 0; i < boneCount; ++i)
+        {
+            CK3dEntity *bone = skin->GetBoneData(i)->GetBone();
+            m_Bones[i] = bone ? bone->GetID() : 0;
+        }
+        m_Posed = FALSE;
+    }
+
+    // Uses the data for m_Mesh (NULL to release the current data).
+    void SetData(CKSkinBindData *data)
+    {
+        if (data)
+        {
+            data->AddRef();
+            data->m_Meshes.PushBack(m_Mesh);
+        }
+        if (m_Data)
+        {
+            m_Data->m_Meshes.Remove(m_Mesh);
+            m_Data->Release();
+        }
+        m_Data = data;
+    }
+
+    CKBOOL IsSkipped(CKRenderContext *dev, CK3dEntity *ent) const
+    {
+        // visibility of the last frame, the bones may not be up to date yet
+        if (ent->IsAllOutsideFrustrum())
+            return TRUE;
+        CK3dEntity *viewpoint = m_MaxDistance > 0.0f ? dev->GetViewpoint() : NULL;
+        if (viewpoint)
+        {
+            VxVector d = *(const VxVector *)&ent->GetWorldMatrix()[3][0] - *(const VxVector *)&viewpoint->GetWorldMatrix()[3][0];
+            if (SquareMagnitude(d) > m_MaxDistance * m_MaxDistance)
+                return TRUE;
+        }
+        return FALSE;
+    }
+
+    CKContext *m_Context;
+    CK_ID m_Entity;
+    CK_ID m_Mesh;
+    float m_MaxDistance;
+    CKSkinBindData *m_Data; // shared with the deformers of the same model
+    VxMatrix m_ObjectInit;
+    XArray<CK_ID> m_Bones;
+    XArray<VxMatrix> m_Matrices;   // initial referential of the entity to entity space, per bone
+    XArray<VxMatrix> m_BoneWorlds; // world matrices of the bones at the last skinning
+    VxMatrix m_InverseWorld;       // inverse world matrix of the entity at the last skinning
+    CKBOOL m_Posed;                // m_Matrices, m_BoneWorlds and m_InverseWorld are valid
+    CKBYTE *m_Positions;
+    CKBYTE *m_Normals;
+    CKDWORD m_PositionStride;
+    CKDWORD m_NormalStride;
+    int m_VertexCount;
+
+private:
+    CKSkinDeformer(const CKSkinDeformer &);
+    CKSkinDeformer &operator=(const CKSkinDeformer &);
+};
+
+/****************************************************************
+Summary: Skins several entities on the threads of a VxParallelPool.
+
+Remarks:
+    o The bone matrices of each deformer are computed on the main thread,
+    then the vertices of all the deformers are cut into jobs of Grain
+    vertices spread over the pool. The meshes are notified on the main
+    thread once all the jobs are done.
+    o A mesh is only skinned by the first deformer of the group writing
+    in it, the jobs of two deformers never write the same vertices.
+
+    VxParallelPool pool(3);
+    CKSkinDeformerGroup group(&pool);
+    group.Add(&deformer1);
+    group.Add(&deformer2);
+    group.Update(dev); // each frame
+
+See Also: CKSkinDeformer,VxParallelPool
+****************************************************************/
+class CKSkinDeformerGroup
+{
+public:
+    enum
+    {
+        Grain = 512 // vertices skinned by a job
+    };
+
+    explicit CKSkinDeformerGroup(VxParallelPool *pool = NULL) : m_Pool(pool) {}
+
+    void Add(CKSkinDeformer *deformer)
+    {
+        if (deformer && !m_Deformers.IsHere(deformer))
+            m_Deformers.PushBack(deformer);
+    }
+
+    void Remove(CKSkinDeformer *deformer) { m_Deformers.Remove(deformer); }
+
+    void Clear() { m_Deformers.Clear(); }
+
+    int GetDeformerCount() const { return m_Deformers.Size(); }
+
+    // Skins all the deformers, returns the number of skinned entities.
+    int Update(CKRenderContext *dev)
+    {
+        m_Jobs.Resize(0);
+        m_Meshes.Resize(0);
+        int skinned = 0;
+        int i;
+        for (i = 0; i < m_Deformers.Size(); ++i)
+        {
+            CKSkinDeformer *d = m_Deformers[i];
+            if (m_Meshes.IsHere(d->GetMesh()))
+                continue;
+            m_Meshes.PushBack(d->GetMesh());
+            if (!d->Prepare(dev))
+                continue;
+            ++skinned;
+            const int count = d->GetPreparedVertexCount();
+            for (int begin = 0; begin < count; begin += Grain)
+            {
+                Job job;
+                job.m_Deformer = d;
+                job.m_Begin = begin;
+                job.m_End = XMin(begin + (int)Grain, count);
+                m_Jobs.PushBack(job);
+            }
+        }
+        if (m_Pool)
+            m_Pool->For(m_Jobs.Size(), 1, RunJobs, this);
+        else
+            RunJobs(this, 0, m_Jobs.Size());
+        for (i = 0; i < m_Deformers.Size(); ++i)
+            m_Deformers[i]->Finish();
+        return skinned;
+    }
+
+protected:
+    struct Job
+    {
+        CKSkinDeformer *m_Deformer;
+        int m_Begin;
+        int m_End;
+    };
+
+    static void RunJobs(void *arg, int begin, int end)
+    {
+        const CKSkinDeformerGroup &g = *(const CKSkinDeformerGroup *)arg;
+        for (int i = begin; i < end; ++i)
+        {
+            const Job &job = g.m_Jobs[i];
+            job.m_Deformer->SkinRange(job.m_Begin, job.m_End);
+        }
+    }
+
+    VxParallelPool *m_Pool;
+    XArray<CKSkinDeformer *> m_Deformers;
+    XArray<Job> m_Jobs;
+    XArray<CK_ID> m_Meshes; // meshes of the deformers of the current update
+
+private:
+    CKSkinDeformerGroup(const CKSkinDeformerGroup &);
+    CKSkinDeformerGroup &operator=(const CKSkinDeformerGroup &);
+};
+
+#endif // CKSKINDEFORMER_H
@@ -0,0 +1,519 @@
+#ifndef CKSOUNDSTREAMER_H
+#define CKSOUNDSTREAMER_H
+
+#include <windows.h>
+
+#include "CKContext.h"
+#include "CKWaveSound.h"
+#include "CKSoundReader.h"
+#include "CKPluginManager.h"
+#include "CKPathManager.h"
+#include "VxSPSCQueue.h"
+#include "VxThread.h"
+#include "VxMutex.h"
+#include "VxAtomic.h"
+
+/****************************************************************
+Summary: Streams wave sounds from their readers on worker threads.
+
+Remarks:
+    o A streamed CKWaveSound is refilled from its reader by the sound
+    manager update, on the main thread: a long frame empties the buffer.
+    The streamer gives each sound a looping buffer of its own and two
+    threads feed it: a decoding thread keeps the output of the reader
+    (CKSoundReader::Decode) ahead in a lock-free ring, and a refill thread
+    copies the ring into the sound buffer behind the play cursor every few
+    milliseconds. The main thread only starts and stops the sounds.
+    o The decoded data kept ahead (the prefetch) starts at the size of the
+    sound buffer and doubles each time the refill thread finds the ring short
+    (an underrun, filled with silence), up to four times the buffer.
+    o Play starts the sound once its buffer is filled, from the next
+    Update; Update also stops the sounds whose data was entirely played.
+    o The sound manager Lock, Unlock and GetPlayPosition are called from
+    the refill thread, which the DirectSound manager supports. A sound
+    must be removed (RemoveStream) before being deleted or used otherwise:
+    RemoveStream waits for the current passes of the threads (a few
+    milliseconds).
+
+    CKSoundStreamer streamer(ctx);
+    streamer.AddStream(music, "music.ogg", TRUE);
+    streamer.Play(music);
+    ...
+    // each frame
+    streamer.Update();
+
+See Also: CKWaveSound,CKSoundReader,VxSPSCQueue
+****************************************************************/
+class CKSoundStreamer
+{
+public:
+    /************************************************
+    Summary: Creates the streamer and its threads.
+
+    Arguments:
+        ctx: Context of the sounds.
+        bufferMs: Duration of the buffer of each sound, in milliseconds.
+        periodMs: Period of the refill thread, it must be well below bufferMs.
+    ************************************************/
+    CKSoundStreamer(CKContext *ctx, int bufferMs = 500, int periodMs = 10)
+        : m_Context(ctx), m_BufferMs(bufferMs), m_Period(periodMs), m_Stop(0), m_DecodePasses(0), m_RefillPasses(0)
+    {
+        m_Manager = (CKSoundManager *)ctx->GetManagerByGuid(SOUND_MANAGER_GUID);
+        m_Decoder = new Worker(this, FALSE);
+        m_Refiller = new Worker(this, TRUE);
+        m_Running = m_Decoder->CreateThread() && m_Refiller->CreateThread();
+        if (m_Running)
+            m_Refiller->SetPriority(VXTP_HIGHLEVEL);
+    }
+
+    ~CKSoundStreamer()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        m_Decoder->Wait();
+        m_Refiller->Wait();
+        delete m_Decoder;
+        delete m_Refiller;
+        for (int i = 0; i < m_Streams.Size(); ++i)
+            delete m_Streams[i];
+    }
+
+    /************************************************
+    Summary: Streams a sound file.
+
+    Arguments:
+        sound: Sound to stream, its buffer is created again.
+        file: File to read, resolved with the sound paths.
+        loop: TRUE to restart the file at its end.
+        type: Type of the sound buffer.
+    Return Value:
+        CK_OK if successful, an error if the file has no reader or can not be opened.
+    ************************************************/
+    CKERROR AddStream(CKWaveSound *sound, CKSTRING file, CKBOOL loop = FALSE, CK_WAVESOUND_TYPE type = CK_WAVESOUND_BACKGROUND)
+    {
+        if (!sound || !file)
+            return CKERR_INVALIDPARAMETER;
+        XString path = file;
+        m_Context->GetPathManager()->ResolveFileName(path, SOUND_PATH_IDX);
+        CKPathSplitter splitter(path.Str());
+        CKFileExtension ext(splitter.GetExtension());
+        CKSoundReader *reader = CKGetPluginManager()->GetSoundReader(ext);
+        if (!reader)
+            return CKERR_NOTFOUND;
+        if (reader->OpenFile(path.Str()) != CK_OK)
+        {
+            reader->Release();
+            return CKERR_INVALIDFILE;
+        }
+        return AddStream(sound, reader, loop, type);
+    }
+
+    // Streams the output of an opened reader, which is released with the stream.
+    CKERROR AddStream(CKWaveSound *sound, CKSoundReader *reader, CKBOOL loop = FALSE, CK_WAVESOUND_TYPE type = CK_WAVESOUND_BACKGROUND)
+    {
+        if (!sound || !reader)
+            return CKERR_INVALIDPARAMETER;
+        if (!m_Running || !m_Manager)
+        {
+            reader->Release();
+            return CKERR_INVALIDOPERATION;
+        }
+        RemoveStream(sound);
+
+        CKWaveFormat wf;
+        memset(&wf, 0, sizeof(wf));
+        if (reader->GetWaveFormat(&wf) != CK_OK || !wf.nBlockAlign || !wf.nAvgBytesPerSec)
+        {
+            reader->Release();
+            return CKERR_INVALIDFILE;
+        }
+        int size = (int)((float)wf.nAvgBytesPerSec * m_BufferMs * 0.001f);
+        size -= size % wf.nBlockAlign;
+        if (size < 4 * wf.nBlockAlign)
+            size = 4 * wf.nBlockAlign;
+        CKERROR err = sound->Create(type, &wf, size);
+        if (err != CK_OK)
+        {
+            reader->Release();
+            return err;
+        }
+        sound->SetLoopMode(TRUE);
+        reader->Play();
+
+        Stream *s = new Stream(4 * size);
+        s->m_Sound = sound->GetID();
+        s->m_Source = sound->GetSource();
+        s->m_Reader = reader;
+        s->m_Loop = loop;
+        s->m_BufferSize = size;
+        s->m_Align = wf.nBlockAlign;
+        s->m_Silence = (CKBYTE)(wf.wBitsPerSample == 8 ? 0x80 : 0);
+        s->m_Target = size;
+
+        VxMutexLock lock(m_Lock);
+        m_Streams.PushBack(s);
+        return CK_OK;
+    }
+
+    // Stops streaming a sound, waiting for the threads to leave it.
+    void RemoveStream(CKWaveSound *sound)
+    {
+        Stream *s = NULL;
+        {
+            VxMutexLock lock(m_Lock);
+            const int i = FindIndex(sound);
+            if (i < 0)
+                return;
+            s = m_Streams[i];
+            m_Streams.RemoveAt(i);
+        }
+        // a pass started before the removal is over when the counter moves
+        const long decode = VxAtomicLoad(&m_DecodePasses);
+        const long refill = VxAtomicLoad(&m_RefillPasses);
+        while (VxAtomicLoad(&m_DecodePasses) == decode || VxAtomicLoad(&m_RefillPasses) == refill)
+            Sleep(1);
+        sound->Stop();
+        delete s;
+    }
+
+    //---------------------------------------------
+    // Main thread
+
+    // Starts the sound as soon as its buffer is filled, or resumes it.
+    void Play(CKWaveSound *sound)
+    {
+        Stream *s = Find(sound);
+        if (!s)
+            return;
+        if (VxAtomicCompareExchange(&s->m_State, Starting, Idle) == Idle)
+            return;
+        if (VxAtomicCompareExchange(&s->m_State, Playing, Paused) == Paused)
+            sound->Resume();
+    }
+
+    void Pause(CKWaveSound *sound)
+    {
+        Stream *s = Find(sound);
+        if (s && VxAtomicCompareExchange(&s->m_State, Paused, Playing) == Playing)
+            sound->Pause();
+    }
+
+    /************************************************
+    Summary: Starts the filled sounds and stops the ended ones.
+
+    Return Value:
+        Number of sounds playing.
+    ************************************************/
+    int Update()
+    {
+        int playing = 0;
+        for (int i = 0; i < m_Streams.Size(); ++i)
+        {
+            Stream *s = m_Streams[i];
+            CKWaveSound *sound = (CKWaveSound *)m_Context->GetObject(s->m_Sound);
+            if (!sound)
+                continue;
+            const long state = VxAtomicLoad(&s->m_State);
+            if (state == Ready)
+            {
+                VxAtomicStore(&s->m_State, Playing);
+                sound->Play(0.0f, sound->GetGain());
+                ++playing;
+            }
+            else if (state == Playing)
+            {
+                if (VxAtomicLoad(&s->m_Ended))
+                {
+                    sound->Stop();
+                    VxAtomicStore(&s->m_State, Finished);
+                }
+                else
+                    ++playing;
+            }
+        }
+        return playing;
+    }
+
+    CKBOOL IsFinished(CKWaveSound *sound)
+    {
+        Stream *s = Find(sound);
+        return s && VxAtomicLoad(&s->m_State) == Finished;
+    }
+
+    // Number of refills short of decoded data.
+    int GetUnderrunCount(CKWaveSound *sound)
+    {
+        Stream *s = Find(sound);
+        return s ? (int)VxAtomicLoad(&s->m_Underruns) : 0;
+    }
+
+    // Size in bytes of the decoded data kept ahead of the sound buffer.
+    int GetPrefetchSize(CKWaveSound *sound)
+    {
+        Stream *s = Find(sound);
+        return s ? (int)VxAtomicLoad(&s->m_Target) : 0;
+    }
+
+protected:
+    enum
+    {
+        Idle = 0,     // not asked to play yet
+        Starting = 1, // waiting for the refill thread to fill the buffer
+        Ready = 2,    // buffer filled, to be played by Update
+        Playing = 3,
+        Paused = 4,
+        Finished = 5
+    };
+
+    struct Stream
+    {
+        Stream(int ringSize)
+            : m_Reader(NULL), m_Ring(ringSize), m_State(Idle), m_Target(0), m_Underruns(0), m_DecodeEnded(0), m_Ended(0),
+              m_Chunk(NULL), m_ChunkSize(0), m_WriteOffset(0), m_LastPlay(0), m_DataLeft(0) {}
+        ~Stream()
+        {
+            if (m_Reader)
+                m_Reader->Release();
+        }
+
+        CK_ID m_Sound;
+        void *m_Source;
+        CKSoundReader *m_Reader;
+        CKBOOL m_Loop;
+        int m_BufferSize;
+        int m_Align;
+        CKBYTE m_Silence;
+        VxSPSCQueue<CKBYTE> m_Ring; // decoded data, decoding thread to refill thread
+
+        volatile long m_State;
+        volatile long m_Target; // bytes to keep decoded ahead
+        volatile long m_Underruns;
+        volatile long m_DecodeEnded; // the reader has no more data
+        volatile long m_Ended;       // and all of it was played
+
+        // decoding thread
+        CKBYTE *m_Chunk; // part of the last decoded buffer not in the ring yet
+        int m_ChunkSize;
+
+        // refill thread
+        int m_WriteOffset; // next byte of the sound buffer to write
+        int m_LastPlay;
+        int m_DataLeft; // bytes of data written and not played
+    };
+
+    class Worker : public VxThread
+    {
+    public:
+        Worker(CKSoundStreamer *streamer, CKBOOL refill) : m_Streamer(streamer), m_Refill(refill) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            if (m_Refill)
+                m_Streamer->RefillLoop();
+            else
+                m_Streamer->DecodeLoop();
+            return VXT_OK;
+        }
+
+        CKSoundStreamer *m_Streamer;
+        CKBOOL m_Refill;
+    };
+    friend class Worker;
+
+    int FindIndex(CKWaveSound *sound)
+    {
+        if (!sound)
+            return -1;
+        for (int i = 0; i < m_Streams.Size(); ++i)
+        {
+            if (m_Streams[i]->m_Sound == sound->GetID())
+                return i;
+        }
+        return -1;
+    }
+
+    Stream *Find(CKWaveSound *sound)
+    {
+        const int i = FindIndex(sound);
+        return i >= 0 ? m_Streams[i] : NULL;
+    }
+
+    void Snapshot(XArray<Stream *> &streams)
+    {
+        VxMutexLock lock(m_Lock);
+        streams = m_Streams;
+    }
+
+    //---------------------------------------------
+    // Decoding thread
+
+    void DecodeLoop()
+    {
+        XArray<Stream *> streams;
+        while (!VxAtomicLoad(&m_Stop))
+        {
+            Snapshot(streams);
+            CKBOOL busy = FALSE;
+            for (int i = 0; i < streams.Size(); ++i)
+                busy |= Decode(streams[i]);
+            VxAtomicIncrement(&m_DecodePasses);
+            if (!busy)
+                Sleep(m_Period);
+        }
+    }
+
+    // Decodes until the prefetch is reached, returns TRUE if the ring was fed.
+    CKBOOL Decode(Stream *s)
+    {
+        CKBOOL fed = FALSE;
+        CKBOOL rewound = FALSE;
+        while (s->m_Ring.GetCount() < VxAtomicLoad(&s->m_Target))
+        {
+            if (s->m_ChunkSize > 0)
+            {
+                const int n = s->m_Ring.Write(s->m_Chunk, s->m_ChunkSize);
+                s->m_Chunk += n;
+                s->m_ChunkSize -= n;
+                fed |= n > 0;
+                if (s->m_ChunkSize > 0)
+                    break;
+                continue;
+            }
+            if (VxAtomicLoad(&s->m_DecodeEnded))
+                break;
+            const CKERROR err = s->m_Reader->Decode();
+            if (err == CKSOUND_READER_EOF)
+            {
+                // a loop giving no data would rewind forever
+                if (s->m_Loop && !rewound && s->m_Reader->Seek(0) == CK_OK)
+                {
+                    rewound = TRUE;
+                    continue;
+                }
+                VxAtomicStore(&s->m_DecodeEnded, 1);
+                break;
+            }
+            if (err != CK_OK)
+                break;
+            CKBYTE *buffer = NULL;
+            int size = 0;
+            if (s->m_Reader->GetDataBuffer(&buffer, &size) != CK_OK || !buffer || size <= 0)
+                break;
+            s->m_Chunk = buffer;
+            s->m_ChunkSize = size;
+            rewound = FALSE;
+        }
+        return fed;
+    }
+
+    //---------------------------------------------
+    // Refill thread
+
+    void RefillLoop()
+    {
+        XArray<Stream *> streams;
+        while (!VxAtomicLoad(&m_Stop))
+        {
+            Snapshot(streams);
+            for (int i = 0; i < streams.Size(); ++i)
+            {
+                Stream *s = streams[i];
+                const long state = VxAtomicLoad(&s->m_State);
+                if (state == Starting)
+                    Prime(s);
+                else if (state == Playing)
+                    Refill(s);
+            }
+            VxAtomicIncrement(&m_RefillPasses);
+            Sleep(m_Period);
+        }
+    }
+
+    // Fills the buffer before the sound starts, a block being left free behind the data.
+    void Prime(Stream *s)
+    {
+        const int bytes = s->m_BufferSize - s->m_Align;
+        if (s->m_Ring.GetCount() < bytes && !VxAtomicLoad(&s->m_DecodeEnded))
+            return;
+        s->m_WriteOffset = 0;
+        s->m_LastPlay = 0;
+        s->m_DataLeft = 0;
+        if (Write(s, bytes, FALSE))
+            VxAtomicStore(&s->m_State, Ready);
+    }
+
+    void Refill(Stream *s)
+    {
+        const int size = s->m_BufferSize;
+        const int play = m_Manager->GetPlayPosition(s->m_Source);
+        if (play < 0 || play >= size)
+            return;
+        const int played = (play - s->m_LastPlay + size) % size;
+        s->m_LastPlay = play;
+        s->m_DataLeft = XMax(s->m_DataLeft - played, 0);
+
+        // the free block behind the data is kept, unless the play cursor caught up with it
+        const int behind = (play - s->m_WriteOffset + size) % size;
+        int bytes = behind ? behind - s->m_Align : size - s->m_Align;
+        bytes -= bytes % s->m_Align;
+        if (bytes > 0)
+            Write(s, bytes, TRUE);
+
+        if (VxAtomicLoad(&s->m_DecodeEnded) && s->m_DataLeft <= 0 && s->m_Ring.GetCount() < s->m_Align)
+            VxAtomicStore(&s->m_Ended, 1);
+    }
+
+    // Copies decoded data (or silence past it) into the sound buffer at the write offset.
+    CKBOOL Write(Stream *s, int bytes, CKBOOL playing)
+    {
+        void *ptr1 = NULL, *ptr2 = NULL;
+        CKDWORD bytes1 = 0, bytes2 = 0;
+        if (m_Manager->Lock(s->m_Source, s->m_WriteOffset, bytes, &ptr1, &bytes1, &ptr2, &bytes2, (CK_WAVESOUND_LOCKMODE)0) != CK_OK)
+            return FALSE;
+        int data = Copy(s, (CKBYTE *)ptr1, bytes1);
+        if (ptr2 && bytes2)
+            data += Copy(s, (CKBYTE *)ptr2, bytes2);
+        m_Manager->Unlock(s->m_Source, ptr1, bytes1, ptr2, bytes2);
+
+        s->m_WriteOffset = (s->m_WriteOffset + bytes) % s->m_BufferSize;
+        s->m_DataLeft += data;
+        if (playing && data < bytes && !VxAtomicLoad(&s->m_DecodeEnded))
+        {
+            // the decoding fell behind: more data is kept ahead from now on
+            VxAtomicIncrement(&s->m_Underruns);
+            VxAtomicStore(&s->m_Target, XMin((int)VxAtomicLoad(&s->m_Target) * 2, s->m_Ring.GetCapacity()));
+        }
+        return TRUE;
+    }
+
+    int Copy(Stream *s, CKBYTE *dst, int bytes)
+    {
+        int available = s->m_Ring.GetCount();
+        available -= available % s->m_Align;
+        const int data = s->m_Ring.Read(dst, XMin(bytes, available));
+        if (data < bytes)
+            memset(dst + data, s->m_Silence, bytes - data);
+        return data;
+    }
+
+    CKContext *m_Context;
+    CKSoundManager *m_Manager;
+    int m_BufferMs;
+    int m_Period;
+    CKBOOL m_Running;
+
+    // shared with the threads
+    VxMutex m_Lock; // the list of streams, changed by the main thread only
+    XArray<Stream *> m_Streams;
+    volatile long m_Stop;
+    volatile long m_DecodePasses;
+    volatile long m_RefillPasses;
+    Worker *m_Decoder;
+    Worker *m_Refiller;
+
+private:
+    CKSoundStreamer(const CKSoundStreamer &);
+    CKSoundStreamer &operator=(const CKSoundStreamer &);
+};
+
+#endif // CKSOUNDSTREAMER_H
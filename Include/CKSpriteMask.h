@@ -0,0 +1,281 @@
+#ifndef CKSPRITEMASK_H
+#define CKSPRITEMASK_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK2dEntity.h"
+#include "CKSprite.h"
+#include "XArray.h"
+#include "XBitArray.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: One bit per pixel telling where a bitmap can be picked.
+
+Remarks:
+    o A bit is set when the alpha of the pixel is greater or equal to the
+    pick threshold (see CKBitmapData::SetPickThreshold).
+    o The mask of a 256x256 bitmap takes 8 KB instead of the 256 KB of
+    its 32 bits system copy, and testing a pixel is a bit lookup instead
+    of a call to GetPixel.
+
+See Also: CKSpriteMask,CKBitmapData::GetPickThreshold
+****************************************************************/
+class CKAlphaMask
+{
+public:
+    CKAlphaMask() : m_Width(0), m_Height(0) {}
+
+    /*************************************************
+    Summary: Builds the mask from a 32 bits ARGB image.
+
+    Arguments:
+        image: Pixels, BytesPerLine bytes per line.
+        width: Width of the image.
+        height: Height of the image.
+        bytesPerLine: Size of a line in bytes.
+        threshold: Minimum alpha of a pickable pixel.
+    *************************************************/
+    void Build(const CKBYTE *image, int width, int height, int bytesPerLine, int threshold)
+    {
+        m_Width = width;
+        m_Height = height;
+        m_Bits = XBitArray(((width * height) >> 5) + 1); // in double words, cleared
+        const CKDWORD t = (CKDWORD)XMax(threshold, 0);
+        for (int y = 0; y < height; ++y)
+        {
+            const CKDWORD *line = (const CKDWORD *)(image + y * bytesPerLine);
+            for (int x = 0; x < width; ++x)
+            {
+                if ((line[x] >> 24) >= t)
+                    m_Bits.Set(y * width + x);
+            }
+        }
+    }
+
+    // Pixels outside of the mask are not pickable.
+    CKBOOL IsSet(int x, int y)
+    {
+        if (x < 0 || y < 0 || x >= m_Width || y >= m_Height)
+            return FALSE;
+        return m_Bits.IsSet(y * m_Width + x) != 0;
+    }
+
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+
+    // Bytes used by the bits.
+    int GetMemorySize() const { return m_Bits.Size() >> 3; }
+
+protected:
+    int m_Width;
+    int m_Height;
+    XBitArray m_Bits;
+};
+
+/****************************************************************
+Summary: Alpha masks of sprites for pixel accurate picking without reading their pixels.
+
+Remarks:
+    o When a sprite has a pick threshold, CKRenderContext::Pick2D reads
+    its pixels with GetPixel. Add builds an alpha mask for each slot of a
+    sprite once (CKAlphaMask, one bit per pixel) and Pick uses it: the
+    hit test of a sprite is a rectangle test and a bit lookup.
+    o Pick tests the visible and pickable 2D entities of the foreground,
+    then of the background, and returns the one with the highest Z order
+    under the point. Entities clipped to their parent are only tested
+    inside their parent. Sprites with a pick threshold but without a mask
+    are tested with GetPixel, other entities with their rectangle.
+    o The masks are built again when the size of a sprite changes. Call
+    Add again after the pixels or the pick threshold of a sprite changed.
+
+    CKSpriteMask masks;
+    masks.Add(button); // after the sprite is loaded
+    ...
+    CK2dEntity *hit = masks.Pick(dev, mousePos);
+
+See Also: CKAlphaMask,CKRenderContext::Pick2D,CKBitmapData::SetPickThreshold
+****************************************************************/
+class CKSpriteMask
+{
+public:
+    CKSpriteMask() {}
+
+    ~CKSpriteMask() { Clear(); }
+
+    /*************************************************
+    Summary: Builds the masks of the slots of a sprite.
+
+    Arguments:
+        sprite: Sprite whose slots are 32 bits images in system memory.
+        threshold: Minimum alpha of a pickable pixel, -1 for the pick threshold of the sprite.
+    Return Value:
+        FALSE if a slot could not be read.
+    *************************************************/
+    CKBOOL Add(CKSprite *sprite, int threshold = -1)
+    {
+        if (!sprite)
+            return FALSE;
+        if (threshold < 0)
+            threshold = sprite->GetPickThreshold();
+        Remove(sprite);
+        Entry *e = new Entry;
+        e->m_Threshold = threshold;
+        m_Entries.Insert(sprite->GetID(), e);
+        return Build(sprite, e);
+    }
+
+    void Remove(CKSprite *sprite)
+    {
+        Entry **e = sprite ? m_Entries.FindPtr(sprite->GetID()) : NULL;
+        if (!e)
+            return;
+        delete *e;
+        m_Entries.Remove(sprite->GetID());
+    }
+
+    void Clear()
+    {
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+            delete *it;
+        m_Entries.Clear();
+    }
+
+    /*************************************************
+    Summary: Tests whether a point of the render context is on a pickable pixel of a 2D entity.
+
+    Arguments:
+        ent: 2D entity.
+        pt: Position in the render context.
+    *************************************************/
+    CKBOOL IsInside(CK2dEntity *ent, const Vx2DVector &pt)
+    {
+        VxRect rect;
+        ent->GetRect(rect);
+        if (!rect.IsInside(pt) || rect.GetWidth() <= 0.0f || rect.GetHeight() <= 0.0f)
+            return FALSE;
+        if (!CKIsChildClassOf(ent, CKCID_SPRITE))
+            return TRUE;
+
+        CKSprite *sprite = (CKSprite *)ent;
+        Entry **e = m_Entries.FindPtr(sprite->GetID());
+        const int threshold = e ? (*e)->m_Threshold : sprite->GetPickThreshold();
+        if (threshold <= 0)
+            return TRUE;
+
+        // point to pixel of the displayed part of the bitmap
+        VxRect src(0.0f, 0.0f, (float)sprite->GetWidth(), (float)sprite->GetHeight());
+        if (sprite->IsUsingSourceRect())
+            sprite->GetSourceRect(src);
+        const int x = (int)(src.left + (pt.x - rect.left) * src.GetWidth() / rect.GetWidth());
+        const int y = (int)(src.top + (pt.y - rect.top) * src.GetHeight() / rect.GetHeight());
+        if (!e)
+            return x >= 0 && y >= 0 && x < sprite->GetWidth() && y < sprite->GetHeight() &&
+                   (int)(sprite->GetPixel(x, y) >> 24) >= threshold;
+
+        if ((*e)->m_Width != sprite->GetWidth() || (*e)->m_Height != sprite->GetHeight())
+            Build(sprite, *e);
+        const int slot = sprite->GetCurrentSlot();
+        if (slot < 0 || slot >= (*e)->m_Masks.Size())
+            return FALSE;
+        return (*e)->m_Masks[slot].IsSet(x, y);
+    }
+
+    /*************************************************
+    Summary: Returns the 2D entity under a point of the render context.
+
+    Arguments:
+        dev: Render context.
+        pt: Position in the render context.
+    Return Value:
+        The pickable 2D entity with the highest Z order under the point, NULL if there is none.
+    *************************************************/
+    CK2dEntity *Pick(CKRenderContext *dev, const Vx2DVector &pt)
+    {
+        CK2dEntity *best = NULL;
+        int bestZ = 0;
+        PickHierarchy(dev->Get2dRoot(FALSE), pt, best, bestZ);
+        if (!best)
+            PickHierarchy(dev->Get2dRoot(TRUE), pt, best, bestZ);
+        return best;
+    }
+
+    // Bytes used by the masks.
+    int GetMemorySize()
+    {
+        int size = 0;
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+        {
+            for (int i = 0; i < (*it)->m_Masks.Size(); ++i)
+                size += (*it)->m_Masks[i].GetMemorySize();
+        }
+        return size;
+    }
+
+protected:
+    struct Entry
+    {
+        int m_Threshold;
+        int m_Width;
+        int m_Height;
+        XClassArray<CKAlphaMask> m_Masks; // one per slot
+    };
+
+    static CKBOOL Build(CKSprite *sprite, Entry *e)
+    {
+        e->m_Width = sprite->GetWidth();
+        e->m_Height = sprite->GetHeight();
+        const int slots = sprite->GetSlotCount();
+        e->m_Masks.Resize(slots);
+        CKBOOL ok = TRUE;
+        for (int i = 0; i < slots; ++i)
+        {
+            // reading the surface does not modify it: no ReleaseSurfacePtr
+            const CKBYTE *pixels = sprite->LockSurfacePtr(i);
+            if (!pixels)
+            {
+                e->m_Masks[i] = CKAlphaMask();
+                ok = FALSE;
+                continue;
+            }
+            e->m_Masks[i].Build(pixels, e->m_Width, e->m_Height, sprite->GetBytesPerLine(), e->m_Threshold);
+        }
+        return ok;
+    }
+
+    // Tests an entity and its children, the entity with the highest Z order wins.
+    void PickHierarchy(CK2dEntity *ent, const Vx2DVector &pt, CK2dEntity *&best, int &bestZ)
+    {
+        if (!ent)
+            return;
+        for (int i = 0; i < ent->GetChildrenCount(); ++i)
+        {
+            CK2dEntity *child = ent->GetChild(i);
+            if (!child || !child->IsVisible())
+                continue;
+            if (child->IsClipToParent() && ent->GetParent())
+            {
+                VxRect parent;
+                ent->GetRect(parent);
+                if (!parent.IsInside(pt))
+                    continue;
+            }
+            const int z = child->GetZOrder();
+            if (child->IsPickable() && (!best || z >= bestZ) && IsInside(child, pt))
+            {
+                best = child;
+                bestZ = z;
+            }
+            PickHierarchy(child, pt, best, bestZ);
+        }
+    }
+
+    XHashTable<Entry *, CK_ID> m_Entries; // masks of each sprite
+
+private:
+    CKSpriteMask(const CKSpriteMask &);
+    CKSpriteMask &operator=(const CKSpriteMask &);
+};
+
+#endif // CKSPRITEMASK_H
@@ -0,0 +1,435 @@
+#ifndef CKSTARTUPPROFILER_H
+#define CKSTARTUPPROFILER_H
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "CKGlobals.h"
+#include "CKPluginManager.h"
+#include "CKDirectoryParser.h"
+#include "CKPathSplitter.h"
+#include "XClassArray.h"
+#include "XString.h"
+
+/****************************************************************
+Summary: A phase timed by CKStartupProfiler.
+
+Remarks:
+    o m_Start and m_Duration are in milliseconds from the creation of the
+    profiler, m_Depth is the number of phases the phase is nested in.
+
+See Also: CKStartupProfiler
+****************************************************************/
+struct CKStartupPhase
+{
+    XString m_Name;
+    const char *m_Category; // "startup", "plugin", "init" or "app"
+    double m_Start;
+    double m_Duration;
+    int m_Depth;
+};
+
+class CKStartupProfiler;
+
+template <int N>
+struct CKStartupInitHooks;
+
+/****************************************************************
+Summary: Times the phases of the start of an application: CKStartUp, the plugin loading and CKCreateContext.
+
+Remarks:
+    o StartUp, ParsePlugins, RegisterPlugin and CreateContext are called
+    instead of CKStartUp, CKPluginManager::ParsePlugins,
+    CKPluginManager::RegisterPlugin and CKCreateContext, and time them.
+    ParsePlugins registers the DLLs of the directory one by one to time
+    each of them (the DLL loading, its static initializations and the
+    declaration of its behaviors).
+    o During CreateContext, the initialization function of each plugin is
+    replaced by one timing it (CKPluginManager::InitializePlugins calls
+    them from CKCreateContext): the creation of the managers, the
+    registration of the parameter types and operations of the plugins and
+    the driver enumeration of the render engine are reported per plugin.
+    The OnCKInit of the managers and the registration of the built-in types
+    are called by the context in the same function and appear as the time
+    of CKCreateContext not spent in the plugins.
+    o Any other phase (loading the first composition, creating the render
+    context) is timed with BeginPhase/EndPhase or a CKStartupScope.
+    o WriteReport gives the phases sorted by duration with the total
+    against the budget given to SetBudget, ExportChromeTrace writes them
+    in the Chrome trace event format (chrome://tracing, Perfetto).
+    o Only one profiler can run CreateContext at a time.
+
+    CKStartupProfiler startup;
+    startup.SetBudget(2000.0f);
+    startup.StartUp();
+    startup.ParsePlugins(CKGetPluginsPath());
+    startup.CreateContext(&context, window, 0, 0);
+    {
+        CKStartupScope scope(startup, "Load level");
+        context->Load("Level.cmo", list);
+    }
+    startup.WriteReport("startup.txt");
+    startup.ExportChromeTrace("startup.json");
+
+See Also: CKStartupScope,VxFrameProfiler
+****************************************************************/
+class CKStartupProfiler
+{
+public:
+    enum
+    {
+        MaxHooks = 128,
+        MaxDepth = 32
+    };
+
+    CKStartupProfiler() : m_Depth(0), m_Budget(0.0f)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        m_MsPerTick = 1000.0 / (double)frequency.QuadPart;
+        QueryPerformanceCounter(&m_Origin);
+    }
+
+    ~CKStartupProfiler() { Unhook(); }
+
+    // Milliseconds since the creation of the profiler.
+    double Now() const
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (double)(now.QuadPart - m_Origin.QuadPart) * m_MsPerTick;
+    }
+
+    //---------------------------------------------
+    // Phases
+
+    void BeginPhase(const char *name, const char *category = "app")
+    {
+        CKStartupPhase phase;
+        phase.m_Name = name;
+        phase.m_Category = category;
+        phase.m_Depth = m_Depth;
+        phase.m_Duration = 0.0;
+        if (m_Depth < MaxDepth)
+            m_Open[m_Depth] = m_Phases.Size();
+        ++m_Depth;
+        phase.m_Start = Now();
+        m_Phases.PushBack(phase);
+    }
+
+    void EndPhase()
+    {
+        const double end = Now();
+        if (m_Depth == 0)
+            return;
+        --m_Depth;
+        if (m_Depth < MaxDepth)
+        {
+            CKStartupPhase &phase = m_Phases[m_Open[m_Depth]];
+            phase.m_Duration = end - phase.m_Start;
+        }
+    }
+
+    //---------------------------------------------
+    // Timed startup functions
+
+    CKERROR StartUp()
+    {
+        BeginPhase("CKStartUp", "startup");
+        CKERROR err = CKStartUp();
+        EndPhase();
+        return err;
+    }
+
+    CKERROR RegisterPlugin(CKSTRING fileName)
+    {
+        CKPathSplitter splitter(fileName);
+        XString name = splitter.GetName();
+        name << splitter.GetExtension();
+        BeginPhase(name.CStr(), "plugin");
+        CKERROR err = CKGetPluginManager()->RegisterPlugin(fileName);
+        EndPhase();
+        return err;
+    }
+
+    // Registers the DLLs of a directory and its sub-directories one by one, returns the number of plugins registered.
+    int ParsePlugins(CKSTRING directory)
+    {
+        XString name("ParsePlugins ");
+        name << directory;
+        BeginPhase(name.CStr(), "startup");
+        CKPluginManager *pm = CKGetPluginManager();
+        int count = 0;
+        for (int c = 0; c < pm->GetCategoryCount(); ++c)
+            count -= pm->GetPluginCount(c);
+        CKDirectoryParser parser(directory, "*.dll", TRUE);
+        while (char *fileName = parser.GetNextFile())
+            RegisterPlugin(fileName);
+        for (int c = 0; c < pm->GetCategoryCount(); ++c)
+            count += pm->GetPluginCount(c);
+        EndPhase();
+        return count;
+    }
+
+    // CKCreateContext with the initialization of each plugin timed.
+    CKERROR CreateContext(CKContext **context, WIN_HANDLE window, int renderEngine, CKDWORD flags)
+    {
+        Hook();
+        BeginPhase("CKCreateContext", "startup");
+        CKERROR err = CKCreateContext(context, window, renderEngine, flags);
+        EndPhase();
+        Unhook();
+        return err;
+    }
+
+    //---------------------------------------------
+    // Results
+
+    int GetPhaseCount() const { return m_Phases.Size(); }
+    const CKStartupPhase &GetPhase(int index) const { return m_Phases[index]; }
+
+    // Time from the creation of the profiler to the end of the last phase, in milliseconds.
+    float GetTotalTime() const
+    {
+        double end = 0.0;
+        for (int i = 0; i < m_Phases.Size(); ++i)
+            end = XMax(end, m_Phases[i].m_Start + m_Phases[i].m_Duration);
+        return (float)end;
+    }
+
+    // Time the report compares the total to, 0 for none.
+    void SetBudget(float ms) { m_Budget = ms; }
+    float GetBudget() const { return m_Budget; }
+
+    /*************************************************
+    Summary: Writes the phases as text, longest first.
+
+    Remarks:
+        o Each phase is given with its own time (the time not spent in the
+        phases nested in it) and its total time.
+    *************************************************/
+    CKBOOL WriteReport(const char *fileName) const
+    {
+        FILE *file = fopen(fileName, "wt");
+        if (!file)
+            return FALSE;
+        WriteReport(file);
+        const CKBOOL ok = !ferror(file);
+        fclose(file);
+        return ok;
+    }
+
+    void WriteReport(FILE *file) const
+    {
+        const float total = GetTotalTime();
+        fprintf(file, "Startup: %.1f ms", total);
+        if (m_Budget > 0.0f)
+            fprintf(file, " (budget %.1f ms, %s by %.1f ms)", m_Budget, total > m_Budget ? "over" : "under", XAbs(total - m_Budget));
+        fputs("\n\n     Self    Total  Phase\n", file);
+
+        XArray<int> order;
+        XArray<double> self;
+        for (int i = 0; i < m_Phases.Size(); ++i)
+        {
+            order.PushBack(i);
+            self.PushBack(SelfTime(i));
+        }
+        // insertion sort by self time, a startup has a few hundred phases at most
+        for (int i = 1; i < order.Size(); ++i)
+        {
+            const int index = order[i];
+            int j = i;
+            for (; j > 0 && self[order[j - 1]] < self[index]; --j)
+                order[j] = order[j - 1];
+            order[j] = index;
+        }
+        for (int i = 0; i < order.Size(); ++i)
+        {
+            const CKStartupPhase &phase = m_Phases[order[i]];
+            fprintf(file, "%9.2f %8.2f  %s [%s]\n", self[order[i]], phase.m_Duration, phase.m_Name.CStr(), phase.m_Category);
+        }
+    }
+
+    /*************************************************
+    Summary: Writes the phases to a Chrome trace event file.
+
+    Remarks:
+        o The phases are complete events ("ph":"X") with their category,
+        the times are in microseconds from the creation of the profiler.
+    *************************************************/
+    CKBOOL ExportChromeTrace(const char *fileName) const
+    {
+        FILE *file = fopen(fileName, "wt");
+        if (!file)
+            return FALSE;
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"Startup\"}}", file);
+        for (int i = 0; i < m_Phases.Size(); ++i)
+        {
+            const CKStartupPhase &phase = m_Phases[i];
+            fputs(",\n{\"name\":", file);
+            WriteString(file, phase.m_Name.CStr());
+            fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+                    phase.m_Category, phase.m_Start * 1000.0, phase.m_Duration * 1000.0);
+        }
+        fputs("\n]}\n", file);
+        const CKBOOL ok = !ferror(file);
+        fclose(file);
+        return ok;
+    }
+
+    void Clear()
+    {
+        m_Phases.Resize(0);
+        m_Depth = 0;
+    }
+
+protected:
+    template <int N>
+    friend struct CKStartupInitHooks;
+
+    struct InitHook
+    {
+        CKPluginEntry *m_Entry;
+        CK_INITINSTANCEFCT m_Function;
+    };
+
+    static CKStartupProfiler *&HookedProfiler()
+    {
+        static CKStartupProfiler *profiler = NULL;
+        return profiler;
+    }
+
+    // Called by the replacement of the index-th initialization function.
+    CKERROR CallInit(int index, CKContext *context)
+    {
+        const InitHook &hook = m_Hooks[index];
+        XString name("InitInstance ");
+        name << hook.m_Entry->m_PluginInfo.m_Description;
+        BeginPhase(name.CStr(), "init");
+        CKERROR err = hook.m_Function(context);
+        EndPhase();
+        return err;
+    }
+
+    void Hook();
+
+    void Unhook()
+    {
+        for (int i = 0; i < m_Hooks.Size(); ++i)
+            m_Hooks[i].m_Entry->m_PluginInfo.m_InitInstanceFct = m_Hooks[i].m_Function;
+        m_Hooks.Resize(0);
+        if (HookedProfiler() == this)
+            HookedProfiler() = NULL;
+    }
+
+    // Time of a phase not spent in the phases nested in it.
+    double SelfTime(int index) const
+    {
+        const CKStartupPhase &phase = m_Phases[index];
+        double self = phase.m_Duration;
+        for (int i = index + 1; i < m_Phases.Size() && m_Phases[i].m_Depth > phase.m_Depth; ++i)
+            if (m_Phases[i].m_Depth == phase.m_Depth + 1)
+                self -= m_Phases[i].m_Duration;
+        return self;
+    }
+
+    static void WriteString(FILE *file, const char *s)
+    {
+        fputc('"', file);
+        for (; s && *s; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+                fputc('\\', file);
+            if ((unsigned char)*s < 0x20)
+                fprintf(file, "\\u%04x", (unsigned char)*s);
+            else
+                fputc(*s, file);
+        }
+        fputc('"', file);
+    }
+
+    LARGE_INTEGER m_Origin;
+    double m_MsPerTick;
+    XClassArray<CKStartupPhase> m_Phases;
+    int m_Open[MaxDepth]; // index of the open phase at each depth
+    int m_Depth;
+    float m_Budget;
+    XArray<InitHook> m_Hooks;
+};
+
+/*************************************************
+Summary: Replacements of the plugin initialization functions, one per hook index. {secret}
+*************************************************/
+template <int N>
+struct CKStartupInitHooks
+{
+    static CKERROR Init(CKContext *context)
+    {
+        CKStartupProfiler *profiler = CKStartupProfiler::HookedProfiler();
+        return profiler->CallInit(N - 1, context);
+    }
+
+    // Fills table[0..N-1].
+    static void Fill(CK_INITINSTANCEFCT *table)
+    {
+        CKStartupInitHooks<N - 1>::Fill(table);
+        table[N - 1] = Init;
+    }
+};
+
+template <>
+struct CKStartupInitHooks<0>
+{
+    static void Fill(CK_INITINSTANCEFCT *table) {}
+};
+
+// Replaces the initialization functions of the registered plugins (up to MaxHooks).
+inline void CKStartupProfiler::Hook()
+{
+    Unhook();
+    if (HookedProfiler())
+        return;
+    static CK_INITINSTANCEFCT table[MaxHooks];
+    CKStartupInitHooks<MaxHooks>::Fill(table);
+    HookedProfiler() = this;
+    CKPluginManager *pm = CKGetPluginManager();
+    for (int c = 0; c < pm->GetCategoryCount(); ++c)
+    {
+        for (int i = 0; i < pm->GetPluginCount(c) && m_Hooks.Size() < MaxHooks; ++i)
+        {
+            CKPluginEntry *entry = pm->GetPluginInfo(c, i);
+            if (!entry || !entry->m_PluginInfo.m_InitInstanceFct)
+                continue;
+            InitHook hook;
+            hook.m_Entry = entry;
+            hook.m_Function = entry->m_PluginInfo.m_InitInstanceFct;
+            entry->m_PluginInfo.m_InitInstanceFct = table[m_Hooks.Size()];
+            m_Hooks.PushBack(hook);
+        }
+    }
+}
+
+/*************************************************
+Summary: Times a phase of CKStartupProfiler until the end of the scope.
+
+See also: CKStartupProfiler::BeginPhase
+*************************************************/
+class CKStartupScope
+{
+public:
+    CKStartupScope(CKStartupProfiler &profiler, const char *name, const char *category = "app") : m_Profiler(profiler)
+    {
+        m_Profiler.BeginPhase(name, category);
+    }
+    ~CKStartupScope() { m_Profiler.EndPhase(); }
+
+protected:
+    CKStartupProfiler &m_Profiler;
+
+private:
+    CKStartupScope(const CKStartupScope &);
+    CKStartupScope &operator=(const CKStartupScope &);
+};
+
+#endif // CKSTARTUPPROFILER_H
@@ -4,8 +4,10 @@
 #include "CKDefines.h"
 #include "CKObject.h"
 #include "CKDependencies.h"
+#include "CKGlobals.h"
 #include "VxDefines.h"
 #include "VxVector.h"
+#include "XArray.h"
 
 struct ChunkIteratorData
 {
@@ -324,6 +326,178 @@ public:
     int ReadBuffer(void **buffer); // returns the size in bytes of the allocated buffer (// Use CKDeletePointer to delete allocated pointer)
     int ReadString(CKSTRING *str); // returns the length of the string including the terminating null character (// Use CKDeletePointer to delete allocated string)
 
+    //----------------------------------------------------------
+    // Bulk typed functions
+    // Elements are stored contiguously without any size information
+    // (write the count with WriteInt beforehand if the reader does not know it).
+    // The whole array is reserved and bounds checked once instead of once per element.
+
+    void WriteIntArray(int count, const int *values)
+    {
+        if (count > 0)
+            WriteBufferNoSize_LEndian(count * sizeof(int), (void *)values);
+    }
+    void WriteDwordArray(int count, const CKDWORD *values)
+    {
+        if (count > 0)
+            WriteBufferNoSize_LEndian(count * sizeof(CKDWORD), (void *)values);
+    }
+    void WriteFloatArray(int count, const float *values)
+    {
+        if (count > 0)
+            WriteBufferNoSize_LEndian(count * sizeof(float), (void *)values);
+    }
+    void WriteWordArray(int count, const CKWORD *values)
+    {
+        if (count > 0)
+            WriteBufferNoSize_LEndian16(count * sizeof(CKWORD), (void *)values);
+    }
+    // Stride is the distance in bytes between two vectors in the source array
+    void WriteVectorArray(int count, const VxVector *v, int stride = sizeof(VxVector))
+    {
+        if (count <= 0)
+            return;
+        if (stride == sizeof(VxVector))
+        {
+            WriteBufferNoSize_LEndian(count * sizeof(VxVector), (void *)v);
+            return;
+        }
+        const int dwordCount = count * (sizeof(VxVector) / sizeof(int));
+        VxVector *dst = (VxVector *)LockWriteBuffer(dwordCount);
+        if (!dst)
+            return;
+        const CKBYTE *src = (const CKBYTE *)v;
+        for (int i = 0; i < count; ++i, src += stride)
+            dst[i] = *(const VxVector *)src;
+        Skip(dwordCount);
+    }
+
+    void ReadIntArray(int count, int *values)
+    {
+        if (count > 0)
+            ReadAndFillBuffer_LEndian(count * sizeof(int), values);
+    }
+    void ReadDwordArray(int count, CKDWORD *values)
+    {
+        if (count > 0)
+            ReadAndFillBuffer_LEndian(count * sizeof(CKDWORD), values);
+    }
+    void ReadFloatArray(int count, float *values)
+    {
+        if (count > 0)
+            ReadAndFillBuffer_LEndian(count * sizeof(float), values);
+    }
+    void ReadWordArray(int count, CKWORD *values)
+    {
+        if (count > 0)
+            ReadAndFillBuffer_LEndian16(count * sizeof(CKWORD), values);
+    }
+    // Stride is the distance in bytes between two vectors in the destination array
+    // Returns FALSE if the chunk does not contain enough data
+    CKBOOL ReadVectorArray(int count, VxVector *v, int stride = sizeof(VxVector))
+    {
+        if (count <= 0)
+            return TRUE;
+        const int dwordCount = count * (sizeof(VxVector) / sizeof(int));
+        if (!m_ChunkParser || m_ChunkParser->CurrentPos + dwordCount > m_ChunkSize)
+            return FALSE;
+        if (stride == sizeof(VxVector))
+        {
+            ReadAndFillBuffer_LEndian(count * sizeof(VxVector), v);
+            return TRUE;
+        }
+        const VxVector *src = (const VxVector *)LockReadBuffer();
+        CKBYTE *dst = (CKBYTE *)v;
+        for (int i = 0; i < count; ++i, dst += stride)
+            *(VxVector *)dst = src[i];
+        Skip(dwordCount);
+        return TRUE;
+    }
+
+    //----------------------------------------------------------
+    // Fixed layout functions
+    // T must be a plain struct (no pointers, no virtual functions) made of
+    // 32 bit fields (float, int, CKDWORD, VxVector, VxColor, VxMatrix...):
+    // its memory image is stored as is, padded to a whole number of dwords.
+    // Its size is known at compile time so the copy is a single reserve and memcpy
+    // instead of one checked write per field, and the read is checked once.
+    // Fields must not be reordered once data has been saved: add new
+    // fields at the end and change the data version of the chunk.
+    //
+    //  struct MyManagerSettings { float m_Range; VxVector m_Origin; CKDWORD m_Flags; };
+    //  chunk->WriteIdentifier(MYMANAGER_SETTINGS);
+    //  chunk->WriteStruct(m_Settings);
+    //  ...
+    //  if (chunk->SeekIdentifier(MYMANAGER_SETTINGS))
+    //      chunk->ReadStruct(m_Settings);
+
+    template <class T>
+    void WriteStruct(const T &data)
+    {
+        const int dwordCount = (sizeof(T) + sizeof(CKDWORD) - 1) / sizeof(CKDWORD);
+        CKDWORD *dst = (CKDWORD *)LockWriteBuffer(dwordCount);
+        if (!dst)
+            return;
+        if (sizeof(T) % sizeof(CKDWORD))
+            dst[dwordCount - 1] = 0;
+        memcpy(dst, &data, sizeof(T));
+        Skip(dwordCount);
+    }
+
+    template <class T>
+    void WriteStructArray(int count, const T *data)
+    {
+        if (count <= 0)
+            return;
+        if (sizeof(T) % sizeof(CKDWORD))
+        {
+            for (int i = 0; i < count; ++i)
+                WriteStruct(data[i]);
+            return;
+        }
+        const int dwordCount = count * (int)(sizeof(T) / sizeof(CKDWORD));
+        void *dst = LockWriteBuffer(dwordCount);
+        if (!dst)
+            return;
+        memcpy(dst, data, count * sizeof(T));
+        Skip(dwordCount);
+    }
+
+    // Returns FALSE (leaving data unchanged) if the chunk does not contain enough data
+    template <class T>
+    CKBOOL ReadStruct(T &data)
+    {
+        const int dwordCount = (sizeof(T) + sizeof(CKDWORD) - 1) / sizeof(CKDWORD);
+        if (!m_ChunkParser || m_ChunkParser->CurrentPos + dwordCount > m_ChunkSize)
+            return FALSE;
+        memcpy(&data, LockReadBuffer(), sizeof(T));
+        Skip(dwordCount);
+        return TRUE;
+    }
+
+    template <class T>
+    CKBOOL ReadStructArray(int count, T *data)
+    {
+        if (count <= 0)
+            return TRUE;
+        const int stride = (sizeof(T) + sizeof(CKDWORD) - 1) / sizeof(CKDWORD);
+        const int dwordCount = count * stride;
+        if (!m_ChunkParser || m_ChunkParser->CurrentPos + dwordCount > m_ChunkSize)
+            return FALSE;
+        const CKDWORD *src = (const CKDWORD *)LockReadBuffer();
+        if (sizeof(T) % sizeof(CKDWORD))
+        {
+            for (int i = 0; i < count; ++i, src += stride)
+                memcpy(&data[i], src, sizeof(T));
+        }
+        else
+        {
+            memcpy(data, src, count * sizeof(T));
+        }
+        Skip(dwordCount);
+        return TRUE;
+    }
+
     //----------------------------------------------------------
     // Bitmaps functions
     BITMAP_HANDLE ReadBitmap();
@@ -347,6 +521,210 @@ public:
     int ConvertToBuffer(void *buffer);
     CKBOOL ConvertFromBuffer(void *buffer);
 
+    //----------------------------------------------------------
+    // Delta functions
+    // ComputeDelta compares the buffers of this chunk and of a base chunk
+    // (ConvertToBuffer) dword per dword and keeps only the runs of changed
+    // dwords, each preceded by the number of unchanged dwords to skip.
+    // Sections (identifiers) which did not change cost nothing, object
+    // state sent each frame usually shrinks to a few dwords. The delta can
+    // be compressed with CKPackData. ApplyDelta rebuilds the chunk from the
+    // same base: the delta keeps a CRC of the base buffer and is refused
+    // when applied on another base.
+    //
+    //  // server, base is the last state acknowledged by the client
+    //  XArray<CKBYTE> delta;
+    //  current->ComputeDelta(base, delta);
+    //  Send(delta.Begin(), delta.Size());
+    //  ...
+    //  // client
+    //  CKStateChunk *state = CreateCKStateChunk((CK_CLASSID)0);
+    //  if (state->ApplyDelta(base, data, size))
+    //      CKReadObjectState(obj, state);
+
+    /*************************************************
+    Summary: Computes what changed in this chunk since a base chunk.
+
+    Arguments:
+        base: Chunk the delta is applied to, NULL to send the whole chunk.
+        delta: Receives the delta.
+        packLevel: Compression level (1 to 9) of the delta, 0 to not compress it.
+    Return Value:
+        Size of the delta in bytes.
+    *************************************************/
+    int ComputeDelta(CKStateChunk *base, XArray<CKBYTE> &delta, int packLevel = 0)
+    {
+        int baseSize, currentSize;
+        CKDWORD baseCRC, currentCRC;
+        CKDWORD *baseData = ConvertToDwords(base, baseSize, baseCRC);
+        CKDWORD *current = ConvertToDwords(this, currentSize, currentCRC);
+        const int baseCount = (baseSize + 3) >> 2;
+        const int currentCount = (currentSize + 3) >> 2;
+
+        // skip count, changed count, changed dwords...
+        XArray<CKDWORD> runs;
+        int i = 0;
+        while (i < currentCount)
+        {
+            const int start = i;
+            while (i < currentCount && i < baseCount && current[i] == baseData[i])
+                ++i;
+            if (i == currentCount)
+                break; // the end of the chunk is unchanged
+            const int changed = i;
+            while (i < currentCount)
+            {
+                // short unchanged runs cost less than a new run
+                int same = i;
+                while (same < currentCount && same < baseCount && current[same] == baseData[same] && same - i < 3)
+                    ++same;
+                if (same - i >= 3 || (same == currentCount && same > i))
+                    break;
+                i = (same > i) ? same : i + 1;
+            }
+            runs.PushBack(changed - start);
+            runs.PushBack(i - changed);
+            for (int j = changed; j < i; ++j)
+                runs.PushBack(current[j]);
+        }
+        delete[] baseData;
+        delete[] current;
+
+        const int runsSize = runs.Size() * sizeof(CKDWORD);
+        char *packed = NULL;
+        int packedSize = 0;
+        if (packLevel > 0 && runsSize > 0)
+        {
+            packed = CKPackData((char *)runs.Begin(), runsSize, packedSize, packLevel);
+            if (packed && packedSize >= runsSize)
+            {
+                CKDeletePointer(packed);
+                packed = NULL;
+            }
+        }
+
+        // packed flag, base CRC, chunk size, runs size, runs
+        const int headerSize = 4 * sizeof(CKDWORD);
+        delta.Resize(headerSize + (packed ? packedSize : runsSize));
+        CKDWORD *header = (CKDWORD *)delta.Begin();
+        header[0] = packed ? 1 : 0;
+        header[1] = baseCRC;
+        header[2] = currentSize;
+        header[3] = runsSize;
+        if (packed)
+        {
+            memcpy(delta.Begin() + headerSize, packed, packedSize);
+            CKDeletePointer(packed);
+        }
+        else if (runsSize)
+        {
+            memcpy(delta.Begin() + headerSize, runs.Begin(), runsSize);
+        }
+        return delta.Size();
+    }
+
+    /*************************************************
+    Summary: Rebuilds this chunk from a base chunk and a delta computed by ComputeDelta.
+
+    Arguments:
+        base: Chunk the delta was computed from, NULL if it was computed without base.
+        delta: Delta.
+        size: Size of the delta in bytes.
+    Return Value:
+        FALSE if the delta is invalid or was not computed from this base, the chunk is then unchanged.
+    *************************************************/
+    CKBOOL ApplyDelta(CKStateChunk *base, const void *delta, int size)
+    {
+        const int headerSize = 4 * sizeof(CKDWORD);
+        if (!delta || size < headerSize)
+            return FALSE;
+        const CKDWORD *header = (const CKDWORD *)delta;
+        int baseSize;
+        CKDWORD baseCRC;
+        CKDWORD *baseData = ConvertToDwords(base, baseSize, baseCRC);
+        const int baseCount = (baseSize + 3) >> 2;
+        const int currentSize = (int)header[2];
+        const int runsSize = (int)header[3];
+        if (header[1] != baseCRC || currentSize <= 0 || runsSize < 0 || (runsSize & 3))
+        {
+            delete[] baseData;
+            return FALSE;
+        }
+
+        const CKDWORD *runs = (const CKDWORD *)((const CKBYTE *)delta + headerSize);
+        char *unpacked = NULL;
+        if (header[0] & 1)
+        {
+            unpacked = CKUnPackData(runsSize, (char *)runs, size - headerSize);
+            if (!unpacked)
+            {
+                delete[] baseData;
+                return FALSE;
+            }
+            runs = (const CKDWORD *)unpacked;
+        }
+        else if (size - headerSize < runsSize)
+        {
+            delete[] baseData;
+            return FALSE;
+        }
+
+        // unchanged dwords come from the base
+        const int currentCount = (currentSize + 3) >> 2;
+        CKDWORD *current = new CKDWORD[currentCount];
+        memset(current, 0, currentCount * sizeof(CKDWORD));
+        if (baseData)
+            memcpy(current, baseData, XMin(baseCount, currentCount) * sizeof(CKDWORD));
+        delete[] baseData;
+
+        const int runsCount = runsSize >> 2;
+        int pos = 0;
+        CKBOOL ok = TRUE;
+        for (int r = 0; r < runsCount;)
+        {
+            if (r + 2 > runsCount)
+            {
+                ok = FALSE;
+                break;
+            }
+            pos += (int)runs[r];
+            const int changed = (int)runs[r + 1];
+            r += 2;
+            if (changed < 0 || pos < 0 || pos + changed > currentCount || r + changed > runsCount)
+            {
+                ok = FALSE;
+                break;
+            }
+            memcpy(current + pos, runs + r, changed * sizeof(CKDWORD));
+            pos += changed;
+            r += changed;
+        }
+        if (unpacked)
+            CKDeletePointer(unpacked);
+        if (ok)
+            ok = ConvertFromBuffer(current);
+        delete[] current;
+        return ok;
+    }
+
+    // Buffer of a chunk padded to whole dwords (NULL for a NULL chunk), its size in bytes and CRC.
+    static CKDWORD *ConvertToDwords(CKStateChunk *chunk, int &size, CKDWORD &crc)
+    {
+        size = chunk ? chunk->ConvertToBuffer(NULL) : 0;
+        crc = 0;
+        if (size <= 0)
+        {
+            size = 0;
+            return NULL;
+        }
+        const int count = (size + 3) >> 2;
+        CKDWORD *data = new CKDWORD[count];
+        data[count - 1] = 0;
+        chunk->ConvertToBuffer(data);
+        crc = CKComputeDataCRC((char *)data, size);
+        return data;
+    }
+
     void *LockWriteBuffer(int DwordCount);
     void *LockReadBuffer();
 
@@ -0,0 +1,385 @@
+#ifndef CKSTATICBATCHER_H
+#define CKSTATICBATCHER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CKRenderManager.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "CKVertexBuffer.h"
+#include "XObjectArray.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Merges static entities sharing materials into large vertex buffers.
+
+Remarks:
+    o Build transforms the meshes of the given entities to world space and
+    merges their faces per material in vertex buffers of up to 65535
+    vertices, so that hundreds of small props are drawn with one
+    DrawPrimitive per material instead of one per entity and material.
+    o The render function of the batched entities is replaced: when the
+    render context draws one of them (it passed the visibility and frustum
+    tests), only its index ranges are recorded. The batches are drawn after
+    the opaque objects with the index ranges of the visible entities, so
+    the visibility of each entity is kept.
+    o Only lit, single channel meshes whose materials are all opaque can be
+    batched, the other entities are left untouched. The entities must not
+    move (or Build must be called again), the render function of an
+    entity can not be changed while it is batched.
+    o Build is meant to be called when a scene is activated, Clear restores
+    the entities.
+
+    CKStaticBatcher batcher(dev);
+    batcher.Build(context->GetObjectListByType(CKCID_3DOBJECT, TRUE));
+
+See Also: CKVertexBuffer,CKRenderObject::SetRenderCallBack
+****************************************************************/
+class CKStaticBatcher
+{
+public:
+    enum
+    {
+        MaxBatchVertices = 0xFFFF
+    };
+
+    explicit CKStaticBatcher(CKRenderContext *dev) : m_Dev(dev), m_Registered(FALSE), m_BatchIndex(0) {}
+
+    ~CKStaticBatcher() { Clear(); }
+
+    /************************************************
+    Summary: Batches an array of static entities.
+
+    Arguments:
+        entities: Candidate entities, the ones which can not be batched
+        are ignored.
+        count: Number of entities.
+    Return Value:
+        Number of batched entities.
+    Remarks:
+        The previous batches are cleared first.
+    ************************************************/
+    int Build(CK3dEntity **entities, int count)
+    {
+        Clear();
+        for (int i = 0; i < count; ++i)
+        {
+            if (CanBatch(entities[i]))
+                AddEntity(entities[i]);
+        }
+        if (m_Entities.Size() && m_Dev)
+        {
+            m_Dev->AddPostRenderCallBack(DrawBatches, this, FALSE, TRUE);
+            m_Registered = TRUE;
+        }
+        return m_Entities.Size();
+    }
+
+    int Build(const XObjectPointerArray &entities)
+    {
+        return Build((CK3dEntity **)entities.Begin(), entities.Size());
+    }
+
+    /************************************************
+    Summary: Destroys the batches and restores the render function of
+    the batched entities.
+    ************************************************/
+    void Clear()
+    {
+        CKContext *ctx = m_Dev ? m_Dev->GetCKContext() : NULL;
+        int i;
+        for (i = 0; i < m_Entities.Size(); ++i)
+        {
+            CK3dEntity *ent = ctx ? (CK3dEntity *)ctx->GetObject(m_Entities[i].m_Entity) : NULL;
+            if (ent && !ent->IsToBeDeleted())
+                ent->RemoveRenderCallBack();
+        }
+        CKRenderManager *rm = ctx ? ctx->GetRenderManager() : NULL;
+        for (i = 0; i < m_Batches.Size(); ++i)
+        {
+            if (m_Batches[i]->m_VB && rm)
+                rm->DestroyVertexBuffer(m_Batches[i]->m_VB);
+            delete m_Batches[i];
+        }
+        if (m_Registered)
+            m_Dev->RemovePostRenderCallBack(DrawBatches, this);
+        m_Registered = FALSE;
+        m_Batches.Clear();
+        m_Entities.Clear();
+        m_Ranges.Clear();
+        m_EntityIndex.Clear();
+        m_VisibleEntities.Clear();
+    }
+
+    // Number of batches (vertex buffers).
+    int GetBatchCount() const { return m_Batches.Size(); }
+
+    // Number of entities drawn through the batches.
+    int GetBatchedEntityCount() const { return m_Entities.Size(); }
+
+    // Returns whether an entity is drawn through the batches.
+    CKBOOL IsBatched(CK3dEntity *ent) const
+    {
+        return ent && m_EntityIndex.FindPtr(ent->GetID()) != NULL;
+    }
+
+protected:
+    struct Vertex
+    {
+        VxVector m_Position;
+        VxVector m_Normal;
+        VxUV m_UV;
+    };
+
+    struct Batch
+    {
+        Batch() : m_Material(NULL), m_VB(NULL) {}
+
+        CKMaterial *m_Material;
+        CKVertexBuffer *m_VB;
+        XArray<Vertex> m_Vertices;
+        XArray<CKWORD> m_Indices;     // indices of all the batched faces
+        XArray<CKWORD> m_DrawIndices; // indices of the visible entities for the current frame
+    };
+
+    // Faces of an entity in a batch.
+    struct Range
+    {
+        int m_Batch;
+        int m_First;
+        int m_Count;
+    };
+
+    struct EntityInfo
+    {
+        CK_ID m_Entity;
+        int m_FirstRange;
+        int m_RangeCount;
+    };
+
+    static CKBOOL CanBatch(CK3dEntity *ent)
+    {
+        if (!ent || !ent->IsVisible())
+            return FALSE;
+        CKMesh *mesh = ent->GetCurrentMesh();
+        if (!mesh || !mesh->GetFaceCount() || mesh->GetChannelCount() || mesh->GetLitMode() != VX_LITMESH || mesh->IsPM())
+            return FALSE;
+        if (mesh->GetVertexCount() > MaxBatchVertices)
+            return FALSE;
+        for (int i = 0; i < mesh->GetMaterialCount(); ++i)
+        {
+            CKMaterial *mat = mesh->GetMaterial(i);
+            if (!mat || mat->IsAlphaTransparent())
+                return FALSE;
+        }
+        // faces without material use the default material of the render context
+        for (int f = 0; f < mesh->GetFaceCount(); ++f)
+        {
+            if (!mesh->GetFaceMaterial(f))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    void AddEntity(CK3dEntity *ent)
+    {
+        CKMesh *mesh = ent->GetCurrentMesh();
+        const VxMatrix &world = ent->GetWorldMatrix();
+        const int vertexCount = mesh->GetVertexCount();
+        const int faceCount = mesh->GetFaceCount();
+        const CKWORD *indices = mesh->GetFacesIndices();
+        CKDWORD pStride = 0, nStride = 0, uvStride = 0;
+        const CKBYTE *positions = (const CKBYTE *)mesh->GetPositionsPtr(&pStride);
+        const CKBYTE *normals = (const CKBYTE *)mesh->GetNormalsPtr(&nStride);
+        const CKBYTE *uvs = (const CKBYTE *)mesh->GetTextureCoordinatesPtr(&uvStride);
+        // normals go through the inverse transpose (scaled entities), a mirroring matrix reverses the faces
+        VxMatrix inverse, normalMatrix;
+        Vx3DInverseMatrix(inverse, world);
+        Vx3DTransposeMatrix(normalMatrix, inverse);
+        const CKBOOL mirrored = Vx3DMatrixDeterminant(world) < 0.0f;
+
+        EntityInfo info;
+        info.m_Entity = ent->GetID();
+        info.m_FirstRange = m_Ranges.Size();
+        info.m_RangeCount = 0;
+
+        m_Remap.Resize(vertexCount);
+        for (int m = 0; m < mesh->GetMaterialCount(); ++m)
+        {
+            CKMaterial *mat = mesh->GetMaterial(m);
+            // vertices used by the faces of this material
+            int used = 0;
+            int f;
+            for (int v = 0; v < vertexCount; ++v)
+                m_Remap[v] = -1;
+            for (f = 0; f < faceCount; ++f)
+            {
+                if (mesh->GetFaceMaterial(f) != mat)
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    int &r = m_Remap[indices[3 * f + k]];
+                    if (r < 0)
+                        r = used++;
+                }
+            }
+            if (!used)
+                continue;
+
+            Batch *batch = GetBatch(mat, used);
+            const int base = batch->m_Vertices.Size();
+            batch->m_Vertices.Resize(base + used);
+            for (int v = 0; v < vertexCount; ++v)
+            {
+                if (m_Remap[v] < 0)
+                    continue;
+                Vertex &dst = batch->m_Vertices[base + m_Remap[v]];
+                Vx3DMultiplyMatrixVector(&dst.m_Position, world, (const VxVector *)(positions + v * pStride));
+                Vx3DRotateVector(&dst.m_Normal, normalMatrix, (const VxVector *)(normals + v * nStride));
+                dst.m_Normal.Normalize();
+                dst.m_UV = *(const VxUV *)(uvs + v * uvStride);
+                m_Remap[v] += base;
+            }
+
+            Range range;
+            range.m_Batch = m_BatchIndex;
+            range.m_First = batch->m_Indices.Size();
+            for (f = 0; f < faceCount; ++f)
+            {
+                if (mesh->GetFaceMaterial(f) != mat)
+                    continue;
+                const CKWORD *face = indices + 3 * f;
+                batch->m_Indices.PushBack((CKWORD)m_Remap[face[0]]);
+                batch->m_Indices.PushBack((CKWORD)m_Remap[face[mirrored ? 2 : 1]]);
+                batch->m_Indices.PushBack((CKWORD)m_Remap[face[mirrored ? 1 : 2]]);
+            }
+            range.m_Count = batch->m_Indices.Size() - range.m_First;
+            m_Ranges.PushBack(range);
+            ++info.m_RangeCount;
+        }
+
+        m_EntityIndex.Insert(info.m_Entity, m_Entities.Size());
+        m_Entities.PushBack(info);
+        ent->SetRenderCallBack(RecordEntity, this);
+    }
+
+    // Last batch of a material if the vertices fit, otherwise a new one.
+    Batch *GetBatch(CKMaterial *mat, int vertexCount)
+    {
+        for (int i = m_Batches.Size() - 1; i >= 0; --i)
+        {
+            if (m_Batches[i]->m_Material != mat)
+                continue;
+            if (m_Batches[i]->m_Vertices.Size() + vertexCount <= MaxBatchVertices)
+            {
+                m_BatchIndex = i;
+                return m_Batches[i];
+            }
+            break;
+        }
+        Batch *batch = new Batch;
+        batch->m_Material = mat;
+        m_BatchIndex = m_Batches.Size();
+        m_Batches.PushBack(batch);
+        return batch;
+    }
+
+    // Render function of the batched entities: the entity is visible for this frame.
+    static CKBOOL RecordEntity(CKRenderContext *dev, CKRenderObject *ent, void *arg)
+    {
+        CKStaticBatcher *batcher = (CKStaticBatcher *)arg;
+        int *index = batcher->m_EntityIndex.FindPtr(ent->GetID());
+        if (index)
+            batcher->m_VisibleEntities.PushBack(*index);
+        return TRUE;
+    }
+
+    static void DrawBatches(CKRenderContext *dev, void *arg)
+    {
+        ((CKStaticBatcher *)arg)->Draw(dev);
+    }
+
+    void Draw(CKRenderContext *dev)
+    {
+        if (!m_VisibleEntities.Size())
+            return;
+        int i;
+        for (i = 0; i < m_VisibleEntities.Size(); ++i)
+        {
+            const EntityInfo &info = m_Entities[m_VisibleEntities[i]];
+            for (int r = 0; r < info.m_RangeCount; ++r)
+            {
+                const Range &range = m_Ranges[info.m_FirstRange + r];
+                Batch *batch = m_Batches[range.m_Batch];
+                int size = batch->m_DrawIndices.Size();
+                batch->m_DrawIndices.Resize(size + range.m_Count);
+                memcpy(batch->m_DrawIndices.Begin() + size, batch->m_Indices.Begin() + range.m_First, range.m_Count * sizeof(CKWORD));
+            }
+        }
+        m_VisibleEntities.Resize(0);
+
+        VxMatrix identity;
+        identity.SetIdentity();
+        dev->SetWorldTransformationMatrix(identity);
+        CKRenderManager *rm = dev->GetCKContext()->GetRenderManager();
+        for (i = 0; i < m_Batches.Size(); ++i)
+        {
+            Batch *batch = m_Batches[i];
+            if (!batch->m_DrawIndices.Size())
+                continue;
+            if (!batch->m_VB)
+                batch->m_VB = rm->CreateVertexBuffer();
+            if (batch->m_VB && Upload(dev, batch))
+            {
+                dev->SetCurrentMaterial(batch->m_Material);
+                batch->m_VB->Draw(dev, VX_TRIANGLELIST, batch->m_DrawIndices.Begin(), batch->m_DrawIndices.Size(), 0, batch->m_Vertices.Size());
+            }
+            batch->m_DrawIndices.Resize(0);
+        }
+    }
+
+    // Fills the vertex buffer when it was just created or lost.
+    static CKBOOL Upload(CKRenderContext *dev, Batch *batch)
+    {
+        const int count = batch->m_Vertices.Size();
+        CKVB_STATE state = batch->m_VB->Check(dev, count, (CKRST_DPFLAGS)(CKRST_DP_TR_CL_VNT));
+        if (state == CK_VB_FAILED)
+            return FALSE;
+        if (state == CK_VB_OK)
+            return TRUE;
+        VxDrawPrimitiveData *data = batch->m_VB->Lock(dev, 0, count);
+        if (!data)
+            return FALSE;
+        CKBYTE *pos = (CKBYTE *)data->PositionPtr;
+        CKBYTE *nrm = (CKBYTE *)data->NormalPtr;
+        CKBYTE *uv = (CKBYTE *)data->TexCoordPtr;
+        for (int v = 0; v < count; ++v)
+        {
+            const Vertex &src = batch->m_Vertices[v];
+            *(VxVector *)(pos + v * data->PositionStride) = src.m_Position;
+            if (nrm)
+                *(VxVector *)(nrm + v * data->NormalStride) = src.m_Normal;
+            if (uv)
+                *(VxUV *)(uv + v * data->TexCoordStride) = src.m_UV;
+        }
+        batch->m_VB->Unlock(dev);
+        return TRUE;
+    }
+
+    CKRenderContext *m_Dev;
+    CKBOOL m_Registered;
+    XArray<Batch *> m_Batches;
+    XArray<EntityInfo> m_Entities;
+    XArray<Range> m_Ranges;
+    XHashTable<int, CK_ID> m_EntityIndex; // index in m_Entities
+    XArray<int> m_VisibleEntities;        // entities recorded during the current frame
+    XArray<int> m_Remap;
+    int m_BatchIndex;
+
+private:
+    CKStaticBatcher(const CKStaticBatcher &);
+    CKStaticBatcher &operator=(const CKStaticBatcher &);
+};
+
+#endif // CKSTATICBATCHER_H
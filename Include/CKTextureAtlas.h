@@ -0,0 +1,631 @@
+#ifndef CKTEXTUREATLAS_H
+#define CKTEXTUREATLAS_H
+
+#include "CKContext.h"
+#include "CKTexture.h"
+#include "CKMaterial.h"
+#include "CK2dEntity.h"
+#include "CKSprite.h"
+#include "CKSprite3D.h"
+#include "VxRectPacker.h"
+
+/****************************************************************
+Summary: Packs the images of sprites and textures in shared atlas textures.
+
+Remarks:
+    o Each CKSprite, and each 2D entity or Sprite3D with its own material,
+    uses its own texture: a screen made of hundreds of small elements
+    changes the texture (and breaks the batches) for each of them. The
+    atlas copies the images added to it in a few large textures (pages)
+    placed with a VxSkylinePacker, and binds the 2D entities and Sprite3D
+    to the material of the page with the rectangle of their image:
+    CK2dEntity::SetSourceRect (in pixels) or CKSprite3D::SetUVMapping
+    (homogeneous coordinates).
+    o The images are copied with a border of padding pixels repeating
+    their edges, so the bilinear filtering does not bleed the neighbour
+    images.
+    o Update places and copies the images added or invalidated since the
+    last call. An image which still fits its rectangle is copied in place,
+    the others are placed again. When an image does not fit a page any
+    longer, the page whose lost area (the rectangles of the removed or
+    moved images) is the largest is repacked; a page is created when
+    nothing fits. The bound objects are mapped again to the new
+    rectangles of their image.
+    o The system memory image of the sources must be 32 bits. The pixels
+    of a transparent CKSprite which are of its transparent color are
+    copied with a null alpha. A CKSprite always draws its own image: the
+    sprite is added as a source and a CK2dEntity of the same rectangle is
+    bound to draw it from the atlas.
+    o The page textures and materials are dynamic objects (they are not
+    saved) created by the atlas and destroyed by Clear.
+
+    CKTextureAtlas atlas(context, 1024);
+    for (i = 0; i < icons.Size(); ++i)
+        atlas.Bind(frames[i], atlas.Add(icons[i]));
+    atlas.Update();
+    ...
+    // an icon was changed
+    atlas.Invalidate(icon);
+    atlas.Update();
+
+See Also: VxSkylinePacker,CK2dEntity::SetSourceRect,CKSprite3D::SetUVMapping
+****************************************************************/
+class CKTextureAtlas
+{
+public:
+    explicit CKTextureAtlas(CKContext *context, int pageSize = 1024, int padding = 1)
+        : m_Context(context), m_PageSize(pageSize), m_Padding(padding) {}
+
+    ~CKTextureAtlas() { Clear(); }
+
+    // Destroys the pages and forgets the images and the bound objects.
+    void Clear()
+    {
+        for (int i = 0; i < m_Pages.Size(); ++i)
+        {
+            Page *p = m_Pages[i];
+            if (m_Context->GetObject(p->m_Material))
+                m_Context->DestroyObject(p->m_Material);
+            if (m_Context->GetObject(p->m_Texture))
+                m_Context->DestroyObject(p->m_Texture);
+            delete p;
+        }
+        m_Pages.Resize(0);
+        m_Entries.Resize(0);
+        m_Bindings.Resize(0);
+    }
+
+    /************************************************
+    Summary: Adds the image of a sprite or a texture to the atlas.
+
+    Arguments:
+        source: Sprite or texture whose image is copied.
+        slot: Slot of the image, -1 for the current slot.
+    Return Value:
+        Handle of the image, -1 if the object can not be added. The image
+        is copied by the next Update.
+    ************************************************/
+    int Add(CKSprite *source, int slot = -1) { return source ? AddSource(source, TRUE, slot < 0 ? source->GetCurrentSlot() : slot) : -1; }
+    int Add(CKTexture *source, int slot = -1) { return source ? AddSource(source, FALSE, slot < 0 ? source->GetCurrentSlot() : slot) : -1; }
+
+    // Removes an image, its rectangle is reused when its page is repacked.
+    void Remove(int handle)
+    {
+        if (!IsValid(handle))
+            return;
+        Free(m_Entries[handle]);
+        m_Entries[handle].m_Source = 0;
+        for (int i = m_Bindings.Size() - 1; i >= 0; --i)
+        {
+            if (m_Bindings[i].m_Entry == handle)
+                m_Bindings.RemoveAt(i);
+        }
+    }
+
+    // Returns the handle of the image of an object slot, -1 if it was not added.
+    int Find(CKObject *source, int slot = 0) const
+    {
+        for (int i = 0; source && i < m_Entries.Size(); ++i)
+        {
+            if (m_Entries[i].m_Source == source->GetID() && m_Entries[i].m_Slot == slot)
+                return i;
+        }
+        return -1;
+    }
+
+    // The image (or its size) changed, it is copied again by the next Update.
+    void Invalidate(int handle)
+    {
+        if (IsValid(handle))
+            m_Entries[handle].m_Dirty = TRUE;
+    }
+
+    // Invalidates all the images of an object.
+    void Invalidate(CKObject *source)
+    {
+        for (int i = 0; source && i < m_Entries.Size(); ++i)
+        {
+            if (m_Entries[i].m_Source == source->GetID())
+                m_Entries[i].m_Dirty = TRUE;
+        }
+    }
+
+    /************************************************
+    Summary: Maps a 2D entity or a Sprite3D to an image of the atlas.
+
+    Remarks:
+        The material of the object is set to the one of the page of the
+        image by Update (and each time the image moves), until Unbind.
+    ************************************************/
+    void Bind(CK2dEntity *ent, int handle) { AddBinding(ent, handle); }
+    void Bind(CKSprite3D *sprite, int handle) { AddBinding(sprite, handle); }
+
+    void Unbind(CKObject *obj)
+    {
+        for (int i = m_Bindings.Size() - 1; obj && i >= 0; --i)
+        {
+            if (m_Bindings[i].m_Object == obj->GetID())
+                m_Bindings.RemoveAt(i);
+        }
+    }
+
+    /************************************************
+    Summary: Places and copies the images added or invalidated.
+
+    Return Value:
+        Number of images copied.
+    Remarks:
+        The images whose source object was deleted are removed.
+    ************************************************/
+    int Update()
+    {
+        XArray<int> pending;
+        int i;
+        for (i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = m_Entries[i];
+            if (!e.m_Source || !e.m_Dirty)
+                continue;
+            int width, height;
+            if (!GetSourceSize(e, width, height))
+            {
+                Remove(i);
+                continue;
+            }
+            e.m_Width = width;
+            e.m_Height = height;
+            // copied in place if it still fits
+            if (e.m_Page >= 0 && width + 2 * m_Padding <= e.m_AllocWidth && height + 2 * m_Padding <= e.m_AllocHeight)
+                continue;
+            Free(e);
+            pending.PushBack(i);
+        }
+        Place(pending);
+
+        // copies the images page by page
+        int count = 0;
+        for (int p = 0; p < m_Pages.Size(); ++p)
+        {
+            Page *page = m_Pages[p];
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(page->m_Texture);
+            CKBYTE *dst = tex ? tex->LockSurfacePtr(0) : NULL;
+            if (!dst)
+                continue;
+            const int pitch = tex->GetWidth() * 4;
+            if (page->m_Cleared)
+                memset(dst, 0, pitch * tex->GetHeight());
+            CKBOOL modified = page->m_Cleared;
+            page->m_Cleared = FALSE;
+            for (i = 0; i < m_Entries.Size(); ++i)
+            {
+                Entry &e = m_Entries[i];
+                if (e.m_Source && e.m_Dirty && e.m_Page == p)
+                {
+                    count += Copy(e, dst, pitch) ? 1 : 0;
+                    modified = TRUE;
+                }
+            }
+            if (modified)
+                tex->ReleaseSurfacePtr(0);
+        }
+
+        // maps the objects of the images copied again
+        for (i = m_Bindings.Size() - 1; i >= 0; --i)
+        {
+            const Entry &e = m_Entries[m_Bindings[i].m_Entry];
+            if (e.m_Dirty && !Apply(m_Bindings[i]))
+                m_Bindings.RemoveAt(i);
+        }
+        for (i = 0; i < m_Entries.Size(); ++i)
+            m_Entries[i].m_Dirty = FALSE;
+        return count;
+    }
+
+    // Places all the images again (by decreasing height), for the best occupancy.
+    int Repack()
+    {
+        for (int p = 0; p < m_Pages.Size(); ++p)
+            ResetPage(p);
+        XArray<int> pending;
+        for (int i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = m_Entries[i];
+            if (!e.m_Source)
+                continue;
+            e.m_Page = -1;
+            e.m_Dirty = TRUE;
+            pending.PushBack(i);
+        }
+        Place(pending);
+        return Update();
+    }
+
+    int GetPageCount() const { return m_Pages.Size(); }
+    CKTexture *GetPage(int page) const { return (CKTexture *)m_Context->GetObject(m_Pages[page]->m_Texture); }
+    CKMaterial *GetMaterial(int page) const { return (CKMaterial *)m_Context->GetObject(m_Pages[page]->m_Material); }
+
+    // Ratio of the area of a page used by the images (with their padding).
+    float GetOccupancy(int page) const
+    {
+        const VxSkylinePacker &packer = m_Pages[page]->m_Packer;
+        return (float)m_Pages[page]->m_LiveArea / ((float)packer.GetWidth() * packer.GetHeight());
+    }
+
+    // Page of an image, -1 if it was not placed yet.
+    int GetPageIndex(int handle) const { return IsValid(handle) ? m_Entries[handle].m_Page : -1; }
+
+    // Rectangle of an image in its page, in pixels.
+    CKBOOL GetPixelRect(int handle, VxRect &rect) const
+    {
+        if (GetPageIndex(handle) < 0)
+            return FALSE;
+        const Entry &e = m_Entries[handle];
+        rect.SetCorners((float)e.m_X, (float)e.m_Y, (float)(e.m_X + e.m_Width), (float)(e.m_Y + e.m_Height));
+        return TRUE;
+    }
+
+    // Rectangle of an image in its page, in homogeneous texture coordinates.
+    CKBOOL GetUVRect(int handle, VxRect &rect) const
+    {
+        if (!GetPixelRect(handle, rect))
+            return FALSE;
+        const VxSkylinePacker &packer = m_Pages[m_Entries[handle].m_Page]->m_Packer;
+        const float iw = 1.0f / packer.GetWidth();
+        const float ih = 1.0f / packer.GetHeight();
+        rect.SetCorners(rect.left * iw, rect.top * ih, rect.right * iw, rect.bottom * ih);
+        return TRUE;
+    }
+
+protected:
+    struct Entry
+    {
+        CK_ID m_Source; // 0 for a removed image
+        CKBOOL m_Sprite;
+        int m_Slot;
+        int m_Width;
+        int m_Height;
+        int m_Page;
+        int m_X; // position of the image, inside the padding
+        int m_Y;
+        int m_AllocWidth; // rectangle reserved in the page, padding included
+        int m_AllocHeight;
+        CKBOOL m_Dirty;
+    };
+
+    struct Page
+    {
+        CK_ID m_Texture;
+        CK_ID m_Material;
+        VxSkylinePacker m_Packer;
+        int m_LiveArea; // area of the rectangles of the images in the page
+        CKBOOL m_Cleared;
+    };
+
+    struct Binding
+    {
+        CK_ID m_Object;
+        int m_Entry;
+    };
+
+    CKBOOL IsValid(int handle) const { return handle >= 0 && handle < m_Entries.Size() && m_Entries[handle].m_Source; }
+
+    int AddSource(CKObject *source, CKBOOL sprite, int slot)
+    {
+        int handle = Find(source, slot);
+        if (handle >= 0)
+            return handle;
+        Entry e;
+        memset(&e, 0, sizeof(e));
+        e.m_Source = source->GetID();
+        e.m_Sprite = sprite;
+        e.m_Slot = slot;
+        e.m_Page = -1;
+        e.m_Dirty = TRUE;
+        int w, h;
+        if (!GetSourceSize(e, w, h))
+            return -1;
+        for (handle = 0; handle < m_Entries.Size(); ++handle)
+        {
+            if (!m_Entries[handle].m_Source)
+            {
+                m_Entries[handle] = e;
+                return handle;
+            }
+        }
+        m_Entries.PushBack(e);
+        return m_Entries.Size() - 1;
+    }
+
+    void AddBinding(CKObject *obj, int handle)
+    {
+        if (!obj || !IsValid(handle))
+            return;
+        Unbind(obj);
+        Binding b = {obj->GetID(), handle};
+        m_Bindings.PushBack(b);
+        // already placed: mapped now
+        if (m_Entries[handle].m_Page >= 0 && !m_Entries[handle].m_Dirty)
+            Apply(b);
+    }
+
+    CKBOOL Apply(const Binding &b)
+    {
+        CKObject *obj = m_Context->GetObject(b.m_Object);
+        const Entry &e = m_Entries[b.m_Entry];
+        if (!obj || obj->IsToBeDeleted() || !e.m_Source || e.m_Page < 0)
+            return FALSE;
+        CKMaterial *mat = GetMaterial(e.m_Page);
+        VxRect rect;
+        if (CKIsChildClassOf(obj, CKCID_SPRITE3D))
+        {
+            CKSprite3D *sprite = (CKSprite3D *)obj;
+            GetUVRect(b.m_Entry, rect);
+            sprite->SetMaterial(mat);
+            sprite->SetUVMapping(rect);
+        }
+        else
+        {
+            CK2dEntity *ent = (CK2dEntity *)obj;
+            GetPixelRect(b.m_Entry, rect);
+            ent->SetMaterial(mat);
+            ent->SetSourceRect(rect);
+            ent->UseSourceRect(TRUE);
+        }
+        return TRUE;
+    }
+
+    CKBOOL GetSourceSize(const Entry &e, int &width, int &height) const
+    {
+        CKObject *obj = m_Context->GetObject(e.m_Source);
+        if (!obj || obj->IsToBeDeleted())
+            return FALSE;
+        if (e.m_Sprite)
+        {
+            CKSprite *s = (CKSprite *)obj;
+            width = s->GetWidth();
+            height = s->GetHeight();
+            return e.m_Slot < s->GetSlotCount() && s->GetBitsPerPixel() == 32 && width > 0 && height > 0;
+        }
+        CKTexture *t = (CKTexture *)obj;
+        width = t->GetWidth();
+        height = t->GetHeight();
+        return e.m_Slot < t->GetSlotCount() && width > 0 && height > 0;
+    }
+
+    // Frees the rectangle of an image, it is lost until its page is repacked.
+    void Free(Entry &e)
+    {
+        if (e.m_Page >= 0)
+            m_Pages[e.m_Page]->m_LiveArea -= e.m_AllocWidth * e.m_AllocHeight;
+        e.m_Page = -1;
+    }
+
+    void Place(XArray<int> &pending)
+    {
+        XArray<int> widths, heights, order;
+        widths.Resize(pending.Size());
+        heights.Resize(pending.Size());
+        int i;
+        for (i = 0; i < pending.Size(); ++i)
+        {
+            widths[i] = m_Entries[pending[i]].m_Width;
+            heights[i] = m_Entries[pending[i]].m_Height;
+        }
+        VxSortRectsByHeight(widths.Begin(), heights.Begin(), pending.Size(), order);
+        XArray<int> sorted;
+        for (i = 0; i < order.Size(); ++i)
+            sorted.PushBack(pending[order[i]]);
+
+        // the images moved out by a repack are appended to the list
+        for (i = 0; i < sorted.Size(); ++i)
+        {
+            Entry &e = m_Entries[sorted[i]];
+            if (e.m_Page >= 0)
+                continue;
+            const int w = e.m_Width + 2 * m_Padding;
+            const int h = e.m_Height + 2 * m_Padding;
+            if (Insert(e, w, h))
+                continue;
+            const int p = FindRepackPage(w * h);
+            if (p >= 0)
+            {
+                RepackPage(p, sorted);
+                if (Insert(e, w, h))
+                    continue;
+            }
+            int size = m_PageSize;
+            while (size < w || size < h)
+                size *= 2;
+            if (!CreatePage(size))
+                break;
+            Insert(e, w, h);
+        }
+    }
+
+    CKBOOL Insert(Entry &e, int w, int h)
+    {
+        for (int p = 0; p < m_Pages.Size(); ++p)
+        {
+            int x, y;
+            if (m_Pages[p]->m_Packer.Insert(w, h, x, y))
+            {
+                e.m_Page = p;
+                e.m_X = x + m_Padding;
+                e.m_Y = y + m_Padding;
+                e.m_AllocWidth = w;
+                e.m_AllocHeight = h;
+                e.m_Dirty = TRUE;
+                m_Pages[p]->m_LiveArea += w * h;
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    // Page with the largest lost area, if it can receive an image of the given area.
+    int FindRepackPage(int area) const
+    {
+        int best = -1;
+        int bestLost = 0;
+        for (int p = 0; p < m_Pages.Size(); ++p)
+        {
+            const VxSkylinePacker &packer = m_Pages[p]->m_Packer;
+            const int lost = packer.GetUsedArea() - m_Pages[p]->m_LiveArea;
+            const int room = packer.GetWidth() * packer.GetHeight() - m_Pages[p]->m_LiveArea;
+            if (lost > bestLost && room >= area)
+            {
+                best = p;
+                bestLost = lost;
+            }
+        }
+        return best;
+    }
+
+    void ResetPage(int p)
+    {
+        Page *page = m_Pages[p];
+        page->m_Packer.Reset();
+        page->m_LiveArea = 0;
+        page->m_Cleared = TRUE;
+    }
+
+    // Empties a page and places its images again, those that do not fit are added to pending.
+    void RepackPage(int p, XArray<int> &pending)
+    {
+        XArray<int> images, widths, heights, order;
+        int i;
+        for (i = 0; i < m_Entries.Size(); ++i)
+        {
+            Entry &e = m_Entries[i];
+            if (e.m_Source && e.m_Page == p)
+            {
+                images.PushBack(i);
+                widths.PushBack(e.m_Width);
+                heights.PushBack(e.m_Height);
+            }
+        }
+        ResetPage(p);
+        VxSortRectsByHeight(widths.Begin(), heights.Begin(), images.Size(), order);
+        VxSkylinePacker &packer = m_Pages[p]->m_Packer;
+        for (i = 0; i < order.Size(); ++i)
+        {
+            Entry &e = m_Entries[images[order[i]]];
+            const int w = e.m_Width + 2 * m_Padding;
+            const int h = e.m_Height + 2 * m_Padding;
+            int x, y;
+            e.m_Dirty = TRUE;
+            if (packer.Insert(w, h, x, y))
+            {
+                e.m_X = x + m_Padding;
+                e.m_Y = y + m_Padding;
+                e.m_AllocWidth = w;
+                e.m_AllocHeight = h;
+                m_Pages[p]->m_LiveArea += w * h;
+            }
+            else
+            {
+                e.m_Page = -1;
+                pending.PushBack(images[order[i]]);
+            }
+        }
+    }
+
+    CKBOOL CreatePage(int size)
+    {
+        XString name;
+        name.Format("Atlas Page %d", m_Pages.Size());
+        CKTexture *tex = (CKTexture *)m_Context->CreateObject(CKCID_TEXTURE, name.Str(), CK_OBJECTCREATION_DYNAMIC);
+        if (!tex)
+            return FALSE;
+        if (!tex->Create(size, size, 32))
+        {
+            m_Context->DestroyObject(tex);
+            return FALSE;
+        }
+        CKMaterial *mat = (CKMaterial *)m_Context->CreateObject(CKCID_MATERIAL, name.Str(), CK_OBJECTCREATION_DYNAMIC);
+        if (!mat)
+        {
+            m_Context->DestroyObject(tex);
+            return FALSE;
+        }
+        mat->SetTexture0(tex);
+        mat->SetTextureBlendMode(VXTEXTUREBLEND_MODULATEALPHA);
+        mat->SetTextureAddressMode(VXTEXTURE_ADDRESSCLAMP);
+        mat->SetTextureMinMode(VXTEXTUREFILTER_LINEAR);
+        mat->SetTextureMagMode(VXTEXTUREFILTER_LINEAR);
+        mat->EnableAlphaBlend(TRUE);
+        mat->SetSourceBlend(VXBLEND_SRCALPHA);
+        mat->SetDestBlend(VXBLEND_INVSRCALPHA);
+
+        Page *page = new Page;
+        page->m_Texture = tex->GetID();
+        page->m_Material = mat->GetID();
+        page->m_Packer.Reset(size, size);
+        page->m_LiveArea = 0;
+        page->m_Cleared = TRUE;
+        m_Pages.PushBack(page);
+        return TRUE;
+    }
+
+    // Copies an image and repeats its edges in the padding.
+    CKBOOL Copy(const Entry &e, CKBYTE *page, int pitch) const
+    {
+        CKObject *obj = m_Context->GetObject(e.m_Source);
+        const CKDWORD *src = NULL;
+        CKDWORD key = 0;
+        CKBOOL keyed = FALSE;
+        if (!obj)
+            return FALSE;
+        if (e.m_Sprite)
+        {
+            CKSprite *s = (CKSprite *)obj;
+            src = (const CKDWORD *)s->LockSurfacePtr(e.m_Slot);
+            keyed = s->IsTransparent();
+            key = s->GetTransparentColor() & 0x00FFFFFF;
+        }
+        else
+        {
+            src = (const CKDWORD *)((CKTexture *)obj)->LockSurfacePtr(e.m_Slot);
+        }
+        if (!src)
+            return FALSE;
+
+        const int w = e.m_Width;
+        const int h = e.m_Height;
+        const int pad = m_Padding;
+        for (int y = -pad; y < h + pad; ++y)
+        {
+            const int sy = y < 0 ? 0 : (y >= h ? h - 1 : y);
+            const CKDWORD *s = src + sy * w;
+            CKDWORD *d = (CKDWORD *)(page + (e.m_Y + y) * pitch) + e.m_X;
+            if (keyed)
+            {
+                for (int x = 0; x < w; ++x)
+                    d[x] = ((s[x] & 0x00FFFFFF) == key) ? 0 : s[x];
+            }
+            else
+            {
+                memcpy(d, s, w * 4);
+            }
+            for (int x = 1; x <= pad; ++x)
+            {
+                d[-x] = d[0];
+                d[w - 1 + x] = d[w - 1];
+            }
+        }
+        return TRUE;
+    }
+
+    CKContext *m_Context;
+    int m_PageSize;
+    int m_Padding;
+    XArray<Page *> m_Pages;
+    XArray<Entry> m_Entries; // indexed by handle
+    XArray<Binding> m_Bindings;
+
+private:
+    CKTextureAtlas(const CKTextureAtlas &);
+    CKTextureAtlas &operator=(const CKTextureAtlas &);
+};
+
+#endif // CKTEXTUREATLAS_H
@@ -0,0 +1,288 @@
+#ifndef CKTEXTURERESIDENCY_H
+#define CKTEXTURERESIDENCY_H
+
+#include <string.h>
+
+#include "CKBaseManager.h"
+#include "CKContext.h"
+#include "CKGlobals.h"
+#include "CKPathManager.h"
+#include "CKTexture.h"
+#include "XArray.h"
+#include "XHashTable.h"
+
+#define TEXTURE_RESIDENCY_GUID CKGUID(0x2f8d4b17, 0x5ac3e960)
+
+/****************************************************************
+Summary: Releases the system memory copy of textures once they are in video memory.
+
+Remarks:
+    o A texture keeps the 32 bits image of its slots in system memory
+    after it was sent to video memory, so it can be restored when the
+    video memory is lost (device lost, resolution change). The textures
+    added to the residency manager only keep it while they are not in
+    video memory: before each rendering (OnPreRender), the system copy of
+    a texture which is in video memory is released, and the system copy of
+    a texture which is not (any more) is reloaded, so the render engine
+    finds it when it sends the texture to video memory again.
+    o The image is reloaded from the file of the slot (found with the
+    bitmap paths of the path manager) or, for the textures without a file
+    (saved in the composition), from a copy compressed with CKPackData
+    when the texture was added.
+    o Only textures with a single slot, which are not cube maps, movies or
+    dynamic textures can be added. Their pixels must not be read or written
+    (GetPixel, LockSurfacePtr...) without calling MakeResident first, which
+    reloads the system copy and keeps it until Release.
+    o Before a composition is saved (PreSave) the system copies are
+    reloaded so the saved textures keep their images.
+
+    CKTextureResidency *residency = CKTextureResidency::Get(context);
+    for (i = 0; i < textures.Size(); ++i)
+        residency->Add(textures[i]);
+    ...
+    residency->MakeResident(texture);
+    CKBYTE *pixels = texture->LockSurfacePtr();
+    ...
+    residency->Release(texture);
+
+See Also: CKTexture::SystemToVideoMemory,CKTexture::Restore,CKTextureStreamer
+****************************************************************/
+class CKTextureResidency : public CKBaseManager
+{
+public:
+    // The residency manager of the context, created on the first call.
+    static CKTextureResidency *Get(CKContext *context)
+    {
+        CKTextureResidency *residency = (CKTextureResidency *)context->GetManagerByGuid(TEXTURE_RESIDENCY_GUID);
+        if (!residency)
+            residency = new CKTextureResidency(context);
+        return residency;
+    }
+
+    ~CKTextureResidency() { Clear(); }
+
+    /*************************************************
+    Summary: Adds a texture whose system copy is released once in video memory.
+
+    Arguments:
+        tex: Texture to add.
+        packLevel: Compression level (1 to 9) of the copy kept for textures without a file, 0 to not add them.
+    Return Value:
+        FALSE if the texture can not be added.
+    *************************************************/
+    CKBOOL Add(CKTexture *tex, int packLevel = 6)
+    {
+        if (!tex || m_Entries.FindPtr(tex->GetID()))
+            return FALSE;
+        if (tex->GetSlotCount() != 1 || tex->IsCubeMap() || tex->GetDynamicHint() || tex->GetMovieReader())
+            return FALSE;
+        CKBitmapSlot *slot = tex->m_Slots[0];
+        if (!slot || !slot->m_DataBuffer)
+            return FALSE;
+
+        Entry *e = new Entry;
+        e->m_Width = tex->GetWidth();
+        e->m_Height = tex->GetHeight();
+        e->m_Pinned = 0;
+        e->m_Resident = TRUE;
+        XString file(tex->GetSlotFileName(0));
+        if (file.Length() && m_Context->GetPathManager()->ResolveFileName(file, BITMAP_PATH_IDX) == CK_OK)
+        {
+            e->m_File = file;
+        }
+        else if (packLevel > 0)
+        {
+            int packedSize = 0;
+            char *packed = CKPackData((char *)slot->m_DataBuffer, e->m_Width * e->m_Height * 4, packedSize, packLevel);
+            if (packed)
+            {
+                e->m_Packed.Resize(packedSize);
+                memcpy(e->m_Packed.Begin(), packed, packedSize);
+                CKDeletePointer(packed);
+            }
+        }
+        if (!e->m_File.Length() && !e->m_Packed.Size())
+        {
+            delete e;
+            return FALSE;
+        }
+        m_Entries.Insert(tex->GetID(), e);
+        return TRUE;
+    }
+
+    // Reloads the system copy of a texture and stops managing it.
+    void Remove(CKTexture *tex)
+    {
+        Entry **e = tex ? m_Entries.FindPtr(tex->GetID()) : NULL;
+        if (!e)
+            return;
+        Reload(tex, *e);
+        delete *e;
+        m_Entries.Remove(tex->GetID());
+    }
+
+    // Forgets all the textures, their system copies are not reloaded.
+    void Clear()
+    {
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+            delete *it;
+        m_Entries.Clear();
+    }
+
+    /*************************************************
+    Summary: Reloads the system copy of a texture and keeps it until Release.
+
+    Return Value:
+        FALSE if the system copy could not be reloaded.
+    *************************************************/
+    CKBOOL MakeResident(CKTexture *tex)
+    {
+        Entry **e = tex ? m_Entries.FindPtr(tex->GetID()) : NULL;
+        if (!e)
+            return tex != NULL;
+        ++(*e)->m_Pinned;
+        return Reload(tex, *e);
+    }
+
+    // Lets the system copy of a texture be released again.
+    void Release(CKTexture *tex)
+    {
+        Entry **e = tex ? m_Entries.FindPtr(tex->GetID()) : NULL;
+        if (e && (*e)->m_Pinned > 0)
+            --(*e)->m_Pinned;
+    }
+
+    // Bytes of system memory currently released.
+    int GetReleasedSize()
+    {
+        int size = 0;
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+        {
+            if (!(*it)->m_Resident)
+                size += (*it)->m_Width * (*it)->m_Height * 4;
+        }
+        return size;
+    }
+
+    // Bytes of the compressed copies.
+    int GetPackedSize()
+    {
+        int size = 0;
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+            size += (*it)->m_Packed.Size();
+        return size;
+    }
+
+    //---------------------------------------------
+    // CKBaseManager
+
+    virtual CKERROR OnPreRender(CKRenderContext *dev)
+    {
+        XArray<CK_ID> removed;
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+        {
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(it.GetKey());
+            if (!tex)
+            {
+                removed.PushBack(it.GetKey());
+                continue;
+            }
+            Entry *e = *it;
+            if (!tex->IsInVideoMemory())
+            {
+                // lost or freed: the engine needs the image to restore it
+                if (!e->m_Resident)
+                    Reload(tex, e);
+            }
+            else if (e->m_Resident && !e->m_Pinned && !tex->ToRestore())
+            {
+                Discard(tex, e);
+            }
+        }
+        for (int i = 0; i < removed.Size(); ++i)
+        {
+            delete *m_Entries.FindPtr(removed[i]);
+            m_Entries.Remove(removed[i]);
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR PreSave()
+    {
+        for (XHashTable<Entry *, CK_ID>::Iterator it = m_Entries.Begin(); it != m_Entries.End(); ++it)
+        {
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(it.GetKey());
+            if (tex)
+                Reload(tex, *it);
+        }
+        return CK_OK;
+    }
+
+    virtual CKERROR PreClearAll()
+    {
+        Clear();
+        return CK_OK;
+    }
+
+    virtual CKDWORD GetValidFunctionsMask()
+    {
+        return CKMANAGER_FUNC_OnPreRender |
+               CKMANAGER_FUNC_PreSave |
+               CKMANAGER_FUNC_PreClearAll;
+    }
+
+protected:
+    struct Entry
+    {
+        XString m_File;          // resolved file of the slot
+        XArray<CKBYTE> m_Packed; // compressed image when there is no file
+        int m_Width;
+        int m_Height;
+        int m_Pinned;
+        CKBOOL m_Resident; // the system copy is present
+    };
+
+    CKTextureResidency(CKContext *context) : CKBaseManager(context, TEXTURE_RESIDENCY_GUID, "Texture Residency")
+    {
+        context->RegisterNewManager(this);
+    }
+
+    static void Discard(CKTexture *tex, Entry *e)
+    {
+        CKBitmapSlot *slot = tex->m_Slots.Size() ? tex->m_Slots[0] : NULL;
+        if (!slot)
+            return;
+        slot->Flush();
+        e->m_Resident = FALSE;
+    }
+
+    static CKBOOL Reload(CKTexture *tex, Entry *e)
+    {
+        if (e->m_Resident)
+            return TRUE;
+        CKBitmapSlot *slot = tex->m_Slots.Size() ? tex->m_Slots[0] : NULL;
+        if (!slot)
+            return FALSE;
+        if (e->m_File.Length())
+        {
+            if (!tex->LoadImage(e->m_File.Str(), 0))
+                return FALSE;
+        }
+        else
+        {
+            const int size = e->m_Width * e->m_Height * 4;
+            char *image = CKUnPackData(size, (char *)e->m_Packed.Begin(), e->m_Packed.Size());
+            if (!image)
+                return FALSE;
+            slot->Allocate(e->m_Width, e->m_Height, 32);
+            memcpy(slot->m_DataBuffer, image, size);
+            CKDeletePointer(image);
+        }
+        e->m_Resident = slot->m_DataBuffer != NULL;
+        return e->m_Resident;
+    }
+
+    XHashTable<Entry *, CK_ID> m_Entries; // texture entries
+};
+
+#endif // CKTEXTURERESIDENCY_H
@@ -0,0 +1,597 @@
+#ifndef CKTEXTURESTREAMER_H
+#define CKTEXTURESTREAMER_H
+
+#include "CKContext.h"
+#include "CKRenderContext.h"
+#include "CK3dEntity.h"
+#include "CKMesh.h"
+#include "CKMaterial.h"
+#include "CKTexture.h"
+#include "CKBitmapReader.h"
+#include "CKPluginManager.h"
+#include "CKPathManager.h"
+#include "CKRenderCuller.h"
+#include "XClassArray.h"
+#include "VxThread.h"
+#include "VxMutex.h"
+#include "VxAtomic.h"
+#include "VxSync.h"
+
+/****************************************************************
+Summary: Loads textures at the resolution their objects need, within a video memory budget.
+
+Remarks:
+    o The textures added to the streamer are first reduced to a coarse
+    resolution (1 / 2^CoarseLevel of their size) and released from video
+    memory, which makes them cheap to load at scene start. Each Update
+    then computes for each texture the screen size of the objects using
+    it, which gives the resolution level it needs (level 0 being the
+    size of its files) and its priority (the largest screen size).
+    o Finer levels are loaded from the slot files of the texture by a
+    loader thread: the images are read with a CKBitmapReader, converted
+    to 32 bit and reduced to the needed level on that thread, then copied
+    to the texture and put in video memory by Update (from the main
+    thread). The textures with the highest priority are loaded first.
+    o The video memory used by the streamed textures is kept under the
+    budget: when a texture needs more memory, the textures which have not
+    been used for the longest time (then the lowest priority ones) are
+    released with CKTexture::FreeVideoMemory and brought back to their
+    coarse level in system memory. A texture used again goes back to
+    video memory from its coarse copy at once, and is refined later.
+    o Only the textures whose slots have a file name can be streamed. The
+    textures are managed per texture level, not per mipmap: CKTexture
+    does not give access to the mipmaps in video memory, reducing the
+    texture gives the same memory saving as dropping its finest mipmaps.
+
+    CKTextureStreamer streamer(context, dev, 64 * 1024 * 1024);
+    for (i = 0; i < entities.Size(); ++i)
+        streamer.AddEntity(entities[i]);
+    ...
+    // each frame, before rendering
+    streamer.Update();
+
+See Also: CKTexture::SystemToVideoMemory,CKTexture::FreeVideoMemory,CKBitmapReader
+****************************************************************/
+class CKTextureStreamer
+{
+public:
+    enum
+    {
+        MaxLoads = 4 // loads queued at the same time
+    };
+
+    CKTextureStreamer(CKContext *context, CKRenderContext *dev, int budget, int coarseLevel = 3)
+        : m_Context(context), m_Dev(dev), m_Budget(budget), m_CoarseLevel(coarseLevel), m_Frame(0), m_Used(0), m_Loads(0), m_Stop(0), m_Loader(this)
+    {
+        m_Loader.CreateThread();
+    }
+
+    ~CKTextureStreamer()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        m_Work.NotifyAll();
+        m_Loader.Wait();
+        int i;
+        for (i = 0; i < m_Pending.Size(); ++i)
+            delete m_Pending[i];
+        for (i = 0; i < m_Done.Size(); ++i)
+            delete m_Done[i];
+        for (i = 0; i < m_Textures.Size(); ++i)
+            delete m_Textures[i];
+        for (i = 0; i < m_Readers.Size(); ++i)
+            m_Readers[i].m_Reader->Release();
+    }
+
+    void SetBudget(int bytes) { m_Budget = bytes; }
+    int GetBudget() const { return m_Budget; }
+
+    // Video memory used by the streamed textures (including the loads in progress), in bytes.
+    int GetVideoMemoryUsed() const { return m_Used; }
+
+    int GetTextureCount() const { return m_Textures.Size(); }
+
+    /************************************************
+    Summary: Streams the textures of the materials of an entity.
+
+    Return Value:
+        Number of textures of the entity streamed.
+    Remarks:
+        The entity gives the screen size of its textures, the textures used
+        by several entities take the largest one.
+    ************************************************/
+    int AddEntity(CK3dEntity *ent)
+    {
+        CKMesh *mesh = ent ? ent->GetCurrentMesh() : NULL;
+        if (!mesh)
+            return 0;
+        User u;
+        u.m_Entity = ent->GetID();
+        for (int m = 0; m < mesh->GetMaterialCount(); ++m)
+        {
+            CKMaterial *mat = mesh->GetMaterial(m);
+            CKTexture *tex = mat ? mat->GetTexture() : NULL;
+            int t = AddTexture(tex);
+            if (t >= 0 && !u.m_Textures.IsHere(t))
+                u.m_Textures.PushBack(t);
+        }
+        if (u.m_Textures.Size())
+            m_Users.PushBack(u);
+        return u.m_Textures.Size();
+    }
+
+    /************************************************
+    Summary: Streams a texture.
+
+    Return Value:
+        Index of the texture in the streamer, -1 if it can not be streamed.
+    ************************************************/
+    int AddTexture(CKTexture *tex)
+    {
+        if (!tex)
+            return -1;
+        int i;
+        for (i = 0; i < m_Textures.Size(); ++i)
+        {
+            if (m_Textures[i]->m_Texture == tex->GetID())
+                return i;
+        }
+        const int slots = tex->GetSlotCount();
+        if (slots < 1 || tex->GetWidth() <= 0 || tex->GetHeight() <= 0)
+            return -1;
+        Texture *t = new Texture;
+        for (i = 0; i < slots; ++i)
+        {
+            CKSTRING file = tex->GetSlotFileName(i);
+            CKBitmapReader *reader = file ? GetReader(file) : NULL;
+            if (!reader)
+            {
+                delete t;
+                return -1;
+            }
+            // the loader thread can not use the path manager
+            XString path(file);
+            m_Context->GetPathManager()->ResolveFileName(path, BITMAP_PATH_IDX);
+            t->m_Files.PushBack(path);
+            t->m_Readers.PushBack(reader);
+        }
+        t->m_Texture = tex->GetID();
+        t->m_Width = tex->GetWidth();
+        t->m_Height = tex->GetHeight();
+        t->m_MaxLevel = 0;
+        while (t->m_MaxLevel < m_CoarseLevel && (t->m_Width >> (t->m_MaxLevel + 1)) >= 4 && (t->m_Height >> (t->m_MaxLevel + 1)) >= 4)
+            ++t->m_MaxLevel;
+        t->m_Mipmaps = tex->GetMipmapCount() > 0;
+        Reduce(t, tex);
+        m_Textures.PushBack(t);
+        return m_Textures.Size() - 1;
+    }
+
+    // Resolution level of a texture (0 for the size of its files), -1 if it is not streamed.
+    int GetLevel(CKTexture *tex) const
+    {
+        for (int i = 0; i < m_Textures.Size(); ++i)
+        {
+            if (tex && m_Textures[i]->m_Texture == tex->GetID())
+                return m_Textures[i]->m_Level;
+        }
+        return -1;
+    }
+
+    // Updates the priorities, the video memory and the loads, from the main thread.
+    void Update()
+    {
+        ++m_Frame;
+        int i;
+
+        // loads done by the loader thread
+        m_Lock.EnterMutex();
+        m_Finished.Resize(0);
+        for (i = 0; i < m_Done.Size(); ++i)
+            m_Finished.PushBack(m_Done[i]);
+        m_Done.Resize(0);
+        m_Lock.LeaveMutex();
+        for (i = 0; i < m_Finished.Size(); ++i)
+            Apply(m_Finished[i]);
+
+        ComputePriorities();
+
+        // the textures used now, highest priority first
+        m_Order.Resize(0);
+        for (i = 0; i < m_Textures.Size(); ++i)
+        {
+            Texture *t = m_Textures[i];
+            if (t->m_LastUsed == m_Frame && !t->m_Loading && (!t->m_InVideo || t->m_Wanted < t->m_Level))
+                m_Order.PushBack(t);
+        }
+        m_Order.Sort(ComparePriority);
+        for (i = 0; i < m_Order.Size(); ++i)
+        {
+            Texture *t = m_Order[i];
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(t->m_Texture);
+            if (!tex)
+                continue;
+            if (!t->m_InVideo)
+            {
+                // back from the copy in system memory
+                if (!MakeRoom(Bytes(t, t->m_Level), t))
+                    continue;
+                if (tex->SystemToVideoMemory(m_Dev))
+                {
+                    t->m_InVideo = TRUE;
+                    m_Used += Bytes(t, t->m_Level);
+                }
+            }
+            if (t->m_InVideo && t->m_Wanted < t->m_Level && m_Loads < MaxLoads)
+            {
+                const int extra = Bytes(t, t->m_Wanted) - Bytes(t, t->m_Level);
+                if (MakeRoom(extra, t))
+                {
+                    m_Used += extra;
+                    Load(t, t->m_Wanted);
+                }
+            }
+        }
+    }
+
+protected:
+    struct Texture
+    {
+        Texture() : m_Texture(0), m_Width(0), m_Height(0), m_MaxLevel(0), m_Level(0), m_Target(0), m_Wanted(0),
+                    m_LastUsed(0), m_Priority(0.0f), m_InVideo(FALSE), m_Loading(FALSE), m_Mipmaps(FALSE) {}
+
+        CK_ID m_Texture;
+        XClassArray<XString> m_Files; // file of each slot
+        XArray<CKBitmapReader *> m_Readers;
+        int m_Width; // size of the files
+        int m_Height;
+        int m_MaxLevel; // coarse level
+        int m_Level;    // level in system (and video) memory
+        int m_Target;   // level being loaded
+        int m_Wanted;
+        int m_LastUsed; // frame
+        float m_Priority;
+        CKBOOL m_InVideo;
+        CKBOOL m_Loading;
+        CKBOOL m_Mipmaps;
+    };
+
+    struct User
+    {
+        CK_ID m_Entity;
+        XArray<int> m_Textures;
+    };
+
+    struct Reader
+    {
+        CKFileExtension m_Ext;
+        CKBitmapReader *m_Reader;
+    };
+
+    struct Request
+    {
+        Request() : m_Texture(NULL), m_Level(0), m_Width(0), m_Height(0), m_Ok(FALSE) {}
+        ~Request()
+        {
+            for (int i = 0; i < m_Images.Size(); ++i)
+                VxDeleteAligned(m_Images[i]);
+        }
+
+        Texture *m_Texture;
+        XClassArray<XString> m_Files;
+        XArray<CKBitmapReader *> m_Readers;
+        int m_Level;
+        int m_Width; // size of the images loaded
+        int m_Height;
+        XArray<CKDWORD *> m_Images; // 32 bit ARGB image of each slot
+        CKBOOL m_Ok;
+    };
+
+    class Loader : public VxThread
+    {
+    public:
+        explicit Loader(CKTextureStreamer *streamer) : m_Streamer(streamer) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_Streamer->LoaderLoop();
+            return VXT_OK;
+        }
+
+        CKTextureStreamer *m_Streamer;
+    };
+    friend class Loader;
+
+    static int ComparePriority(const void *a, const void *b)
+    {
+        const float pa = (*(Texture **)a)->m_Priority;
+        const float pb = (*(Texture **)b)->m_Priority;
+        return (pa > pb) ? -1 : (pa < pb) ? 1 : 0;
+    }
+
+    // Readers are created once per extension, they are only used by the loader thread.
+    CKBitmapReader *GetReader(CKSTRING file)
+    {
+        CKPathSplitter splitter(file);
+        CKFileExtension ext(splitter.GetExtension());
+        for (int i = 0; i < m_Readers.Size(); ++i)
+        {
+            if (m_Readers[i].m_Ext == ext)
+                return m_Readers[i].m_Reader;
+        }
+        Reader r;
+        r.m_Ext = ext;
+        r.m_Reader = CKGetPluginManager()->GetBitmapReader(ext);
+        if (!r.m_Reader)
+            return NULL;
+        m_Readers.PushBack(r);
+        return r.m_Reader;
+    }
+
+    int Bytes(const Texture *t, int level) const
+    {
+        const int size = (t->m_Width >> level) * (t->m_Height >> level) * 4 * t->m_Files.Size();
+        return t->m_Mipmaps ? size + size / 3 : size;
+    }
+
+    // Back to the coarse level, out of video memory.
+    void Reduce(Texture *t, CKTexture *tex)
+    {
+        tex->FreeVideoMemory();
+        if (t->m_InVideo)
+            m_Used -= Bytes(t, t->m_Level);
+        t->m_InVideo = FALSE;
+        if (t->m_Level < t->m_MaxLevel)
+        {
+            tex->ResizeImages(t->m_Width >> t->m_MaxLevel, t->m_Height >> t->m_MaxLevel);
+            t->m_Level = t->m_MaxLevel;
+        }
+    }
+
+    // Releases the least recently used textures until size bytes fit in the budget.
+    CKBOOL MakeRoom(int size, Texture *forTexture)
+    {
+        while (m_Used + size > m_Budget)
+        {
+            Texture *victim = NULL;
+            for (int i = 0; i < m_Textures.Size(); ++i)
+            {
+                Texture *t = m_Textures[i];
+                if (t == forTexture || !t->m_InVideo || t->m_Loading)
+                    continue;
+                // only the textures not used now or less important
+                if (t->m_LastUsed == m_Frame && t->m_Priority >= forTexture->m_Priority)
+                    continue;
+                if (!victim || t->m_LastUsed < victim->m_LastUsed ||
+                    (t->m_LastUsed == victim->m_LastUsed && t->m_Priority < victim->m_Priority))
+                    victim = t;
+            }
+            if (!victim)
+                return FALSE;
+            CKTexture *tex = (CKTexture *)m_Context->GetObject(victim->m_Texture);
+            if (tex)
+                Reduce(victim, tex);
+            else
+            {
+                m_Used -= Bytes(victim, victim->m_Level);
+                victim->m_InVideo = FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    void ComputePriorities()
+    {
+        int i;
+        for (i = 0; i < m_Textures.Size(); ++i)
+            m_Textures[i]->m_Priority = 0.0f;
+
+        CKRenderCuller view;
+        CKCamera *cam = m_Dev ? m_Dev->GetAttachedCamera() : NULL;
+        if (!cam || !view.SetView(m_Dev))
+            return;
+        const VxVector eye = *(const VxVector *)&cam->GetWorldMatrix()[3][0];
+        const float tanHalfFov = tanf(cam->GetFov() * 0.5f);
+        const float screenHeight = (float)m_Dev->GetHeight();
+
+        for (i = 0; i < m_Users.Size(); ++i)
+        {
+            User &u = m_Users[i];
+            CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(u.m_Entity);
+            if (!ent || ent->IsToBeDeleted() || !ent->IsVisible())
+                continue;
+            const VxBbox &box = ent->GetBoundingBox();
+            if (view.GetCuller().CullBox(box) == VxFrustumCuller::OUTSIDE)
+                continue;
+            const VxVector center = (box.Min + box.Max) * 0.5f;
+            const float radius = Magnitude(box.Max - box.Min) * 0.5f;
+            const float distance = Magnitude(center - eye);
+            const float size = (distance > radius) ? radius / (distance * tanHalfFov) : 1.0f;
+            for (int k = 0; k < u.m_Textures.Size(); ++k)
+            {
+                Texture *t = m_Textures[u.m_Textures[k]];
+                if (size > t->m_Priority)
+                    t->m_Priority = size;
+                t->m_LastUsed = m_Frame;
+            }
+        }
+
+        for (i = 0; i < m_Textures.Size(); ++i)
+        {
+            Texture *t = m_Textures[i];
+            if (t->m_LastUsed != m_Frame)
+                continue;
+            // the coarsest level still having a texel per pixel covered
+            const float pixels = t->m_Priority * screenHeight;
+            int level = 0;
+            while (level < t->m_MaxLevel && (float)(t->m_Height >> (level + 1)) >= pixels)
+                ++level;
+            t->m_Wanted = level;
+        }
+    }
+
+    void Load(Texture *t, int level)
+    {
+        Request *r = new Request;
+        r->m_Texture = t;
+        r->m_Files = t->m_Files;
+        r->m_Readers = t->m_Readers;
+        r->m_Level = level;
+        t->m_Loading = TRUE;
+        t->m_Target = level;
+        ++m_Loads;
+        m_Lock.EnterMutex();
+        m_Pending.PushBack(r);
+        m_Lock.LeaveMutex();
+        m_Work.NotifyOne();
+    }
+
+    // Copies a loaded level to its texture (main thread).
+    void Apply(Request *r)
+    {
+        Texture *t = r->m_Texture;
+        --m_Loads;
+        t->m_Loading = FALSE;
+        // the memory was reserved for the target level
+        m_Used -= Bytes(t, t->m_Target) - Bytes(t, t->m_Level);
+        CKTexture *tex = (CKTexture *)m_Context->GetObject(t->m_Texture);
+        if (r->m_Ok && tex && !tex->IsToBeDeleted())
+        {
+            for (int s = 0; s < r->m_Images.Size(); ++s)
+            {
+                tex->CreateImage(r->m_Width, r->m_Height, 32, s);
+                CKBYTE *dst = tex->LockSurfacePtr(s);
+                if (dst)
+                    memcpy(dst, r->m_Images[s], r->m_Width * r->m_Height * 4);
+                tex->ReleaseSurfacePtr(s);
+            }
+            if (t->m_InVideo)
+                m_Used -= Bytes(t, t->m_Level);
+            t->m_Level = r->m_Level;
+            tex->FreeVideoMemory();
+            t->m_InVideo = tex->SystemToVideoMemory(m_Dev);
+            if (t->m_InVideo)
+                m_Used += Bytes(t, t->m_Level);
+        }
+        delete r;
+    }
+
+    // Reads and reduces the images of a request (loader thread).
+    static void Decode(Request *r)
+    {
+        r->m_Ok = TRUE;
+        for (int s = 0; s < r->m_Files.Size() && r->m_Ok; ++s)
+        {
+            CKBitmapProperties *bp = NULL;
+            CKBitmapReader *reader = r->m_Readers[s];
+            if (reader->ReadFile(r->m_Files[s].Str(), &bp) != 0 || !bp)
+            {
+                r->m_Ok = FALSE;
+                break;
+            }
+            VxImageDescEx src = bp->m_Format;
+            if (!src.Image)
+                src.Image = (XBYTE *)bp->m_Data;
+            const int width = XMax(src.Width >> r->m_Level, 1);
+            const int height = XMax(src.Height >> r->m_Level, 1);
+            if (s == 0)
+            {
+                r->m_Width = width;
+                r->m_Height = height;
+            }
+            if (!src.Image || width != r->m_Width || height != r->m_Height)
+            {
+                r->m_Ok = FALSE;
+            }
+            else
+            {
+                VxImageDescEx full;
+                Set32Bits(full, src.Width, src.Height, (XBYTE *)VxNewAligned(src.Width * src.Height * 4, 16));
+                VxDoBlit(src, full);
+                if (r->m_Level == 0)
+                {
+                    r->m_Images.PushBack((CKDWORD *)full.Image);
+                }
+                else
+                {
+                    VxImageDescEx reduced;
+                    Set32Bits(reduced, width, height, (XBYTE *)VxNewAligned(width * height * 4, 16));
+                    VxResizeImage32(full, reduced);
+                    VxDeleteAligned(full.Image);
+                    r->m_Images.PushBack((CKDWORD *)reduced.Image);
+                }
+            }
+            reader->ReleaseMemory(bp->m_Data);
+            bp->m_Data = NULL;
+        }
+    }
+
+    static void Set32Bits(VxImageDescEx &desc, int width, int height, XBYTE *image)
+    {
+        desc.Width = width;
+        desc.Height = height;
+        desc.BitsPerPixel = 32;
+        desc.BytesPerLine = width * 4;
+        desc.AlphaMask = 0xFF000000;
+        desc.RedMask = 0x00FF0000;
+        desc.GreenMask = 0x0000FF00;
+        desc.BlueMask = 0x000000FF;
+        desc.Image = image;
+    }
+
+    void LoaderLoop()
+    {
+        for (;;)
+        {
+            // read before looking at the queue: a load queued after the look changes it
+            const long seen = m_Work.GetSequence();
+            if (VxAtomicLoad(&m_Stop))
+                return;
+            Request *r = NULL;
+            m_Lock.EnterMutex();
+            if (m_Pending.Size())
+            {
+                r = m_Pending[0];
+                m_Pending.RemoveAt(0);
+            }
+            m_Lock.LeaveMutex();
+            if (!r)
+            {
+                // blocked until Update queues a load or the streamer is destroyed
+                m_Work.WaitForChange(seen);
+                continue;
+            }
+            Decode(r);
+            m_Lock.EnterMutex();
+            m_Done.PushBack(r);
+            m_Lock.LeaveMutex();
+        }
+    }
+
+    CKContext *m_Context;
+    CKRenderContext *m_Dev;
+    int m_Budget;
+    int m_CoarseLevel;
+    int m_Frame;
+    int m_Used;
+    int m_Loads;
+    XArray<Texture *> m_Textures;
+    XClassArray<User> m_Users;
+    XArray<Reader> m_Readers;
+    XArray<Texture *> m_Order;
+    XArray<Request *> m_Finished;
+
+    // shared with the loader thread
+    VxMutex m_Lock;
+    XArray<Request *> m_Pending;
+    XArray<Request *> m_Done;
+    volatile long m_Stop;
+    VxCondition m_Work; // notified when a load is queued
+    Loader m_Loader;
+
+private:
+    CKTextureStreamer(const CKTextureStreamer &);
+    CKTextureStreamer &operator=(const CKTextureStreamer &);
+};
+
+#endif // CKTEXTURESTREAMER_H
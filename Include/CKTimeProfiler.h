@@ -4,6 +4,7 @@
 #include "CKContext.h"
 #include "XArray.h"
 #include "VxTimeProfiler.h"
+#include "VxPerfCounters.h"
 
 #include <stdio.h>
 
@@ -11,7 +12,11 @@
 Name: CKTimeProfiler
 Summary: Class for profiling purposes
 
-See also:
+Remarks:
+    o With SetCounters, the counters of a VxPerfCounterSource are read with
+    each split time and their differences are written next to the times.
+
+See also: VxPerfCounterSource
 *************************************************/
 class CKTimeProfiler
 {
@@ -20,11 +25,11 @@ public:
     Name: VxMultiTimeProfiler
     Summary: Starts profiling
     *************************************************/
-    CKTimeProfiler(const char *iTitle, CKContext *iContext, int iStartingCount = 4) : m_Title(iTitle), m_Context(iContext), m_Marks(iStartingCount) {}
+    CKTimeProfiler(const char *iTitle, CKContext *iContext, int iStartingCount = 4) : m_Title(iTitle), m_Context(iContext), m_Marks(iStartingCount), m_Counters(NULL) {}
 
     ~CKTimeProfiler()
     {
-        char buffer[512];
+        char buffer[2048];
         Dump(buffer);
         if (strlen(buffer))
             m_Context->OutputToConsoleEx("[%s] : %s", m_Title, buffer);
@@ -39,6 +44,18 @@ public:
     {
         m_Profiler.Reset();
         m_Marks.Resize(0);
+        if (m_Counters)
+            m_Counters->Read(m_Start);
+    }
+
+    /*************************************************
+    Summary: Reads counters with each split time (NULL for times only)
+    *************************************************/
+    void SetCounters(VxPerfCounterSource *iCounters)
+    {
+        m_Counters = iCounters;
+        if (m_Counters)
+            m_Counters->Read(m_Start);
     }
 
     /*************************************************
@@ -49,6 +66,16 @@ public:
         Mark m;
         m.name = iString;
         m.time = m_Profiler.Current();
+        if (m_Counters)
+        {
+            VxPerfCounterValue now[VxPerfCounterSource::MaxCounters];
+            m_Counters->Read(now);
+            for (int i = 0; i < m_Counters->GetCounterCount(); ++i)
+            {
+                m.counters[i] = now[i] - m_Start[i];
+                m_Start[i] = now[i];
+            }
+        }
         m_Marks.PushBack(m);
         m_Profiler.Reset();
     }
@@ -71,6 +98,16 @@ public:
             sprintf(buffer, "%s = %.3g", (*it).name, (*it).time);
             strcat(oBuffer, buffer);
 
+            if (m_Counters)
+            {
+                for (int i = 0; i < m_Counters->GetCounterCount(); ++i)
+                {
+                    sprintf(buffer, "%s%s %.4g", i ? ", " : " (", m_Counters->GetCounterName(i), (double)(__int64)(*it).counters[i]);
+                    strcat(oBuffer, buffer);
+                }
+                strcat(oBuffer, ")");
+            }
+
             if (it != (m_Marks.End() - 1)) // we don't add the separator for the last mark
                 strcat(oBuffer, iSeparator);
         }
@@ -88,12 +125,15 @@ protected:
     {
         const char *name;
         float time;
+        VxPerfCounterValue counters[VxPerfCounterSource::MaxCounters];
     };
 
     VxTimeProfiler m_Profiler;
     const char *m_Title;
     CKContext *m_Context;
     XArray<Mark> m_Marks;
+    VxPerfCounterSource *m_Counters;
+    VxPerfCounterValue m_Start[VxPerfCounterSource::MaxCounters];
 };
 
 #endif // CKTIMEPROFILER_H
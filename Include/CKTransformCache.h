@@ -0,0 +1,199 @@
+#ifndef CKTRANSFORMCACHE_H
+#define CKTRANSFORMCACHE_H
+
+#include "CKContext.h"
+#include "CK3dEntity.h"
+#include "VxTransformHierarchy.h"
+#include "XHashTable.h"
+
+/****************************************************************
+Summary: Defers the matrix changes of 3D entity hierarchies to one pass per frame.
+
+Remarks:
+    o CK3dEntity::SetLocalMatrix and SetWorldMatrix recompute the world
+    matrices of all the descendants immediately. Code moving many nodes of
+    deep hierarchies (procedural animation, physics, editors) can set the
+    matrices through the cache instead: they are kept in a
+    VxTransformHierarchy where a change only marks the descendants dirty,
+    and world matrices are computed when read or by Update.
+    o GetWorldMatrix and GetInverseWorldMatrix return what the entities
+    will have after Flush, with the same meaning as the CK3dEntity methods.
+    o Flush gives the changed local matrices to the entities, parents
+    first, so each entity is set once per frame whatever the number of
+    changes. It must be called before rendering or before code reading
+    the entities directly.
+    o The parents of the hierarchies added are kept as fixed nodes (their
+    world matrix is read by Add and Resync). Resync reads the matrices of
+    the entities again, after the engine moved them (animations, behaviors);
+    the changes of parents in the scene are not followed.
+
+    CKTransformCache cache(context);
+    cache.Add(crane);
+    ...
+    cache.SetLocalMatrix(arm, m);
+    cache.SetLocalMatrix(hook, m2);
+    const VxMatrix &w = cache.GetWorldMatrix(hook);
+    ...
+    cache.Flush();
+
+See Also: VxTransformHierarchy
+****************************************************************/
+class CKTransformCache
+{
+public:
+    explicit CKTransformCache(CKContext *context) : m_Context(context) {}
+
+    /************************************************
+    Summary: Adds an entity and all its descendants.
+
+    Return Value:
+        Number of entities added.
+    ************************************************/
+    int Add(CK3dEntity *root)
+    {
+        if (!root || m_Nodes.FindPtr(root->GetID()))
+            return 0;
+        int parent = -1;
+        CK3dEntity *p = root->GetParent();
+        if (p)
+        {
+            int *node = m_Nodes.FindPtr(p->GetID());
+            parent = node ? *node : AddNode(p, -1, TRUE);
+        }
+        const int first = m_Entities.Size();
+        AddTree(root, parent);
+        return m_Entities.Size() - first;
+    }
+
+    void Clear()
+    {
+        m_Hierarchy.Clear();
+        m_Nodes.Clear();
+        m_Entities.Resize(0);
+        m_Flags.Resize(0);
+    }
+
+    CKBOOL Contains(CK3dEntity *ent) const { return ent && m_Nodes.FindPtr(ent->GetID()) != NULL; }
+
+    // Sets the local matrix of an entity, applied to the entity by Flush (immediately if it is not in the cache).
+    void SetLocalMatrix(CK3dEntity *ent, const VxMatrix &mat)
+    {
+        int *node = m_Nodes.FindPtr(ent->GetID());
+        if (!node || (m_Flags[*node] & FIXED))
+        {
+            ent->SetLocalMatrix(mat);
+            return;
+        }
+        m_Hierarchy.SetLocalMatrix(*node, mat);
+        m_Flags[*node] |= CHANGED;
+    }
+
+    // Sets the world matrix of an entity, applied to the entity by Flush (immediately if it is not in the cache).
+    void SetWorldMatrix(CK3dEntity *ent, const VxMatrix &mat)
+    {
+        int *node = m_Nodes.FindPtr(ent->GetID());
+        if (!node || (m_Flags[*node] & FIXED))
+        {
+            ent->SetWorldMatrix(mat);
+            return;
+        }
+        m_Hierarchy.SetWorldMatrix(*node, mat);
+        m_Flags[*node] |= CHANGED;
+    }
+
+    const VxMatrix &GetLocalMatrix(CK3dEntity *ent)
+    {
+        int *node = m_Nodes.FindPtr(ent->GetID());
+        return (node && !(m_Flags[*node] & FIXED)) ? m_Hierarchy.GetLocalMatrix(*node) : ent->GetLocalMatrix();
+    }
+
+    const VxMatrix &GetWorldMatrix(CK3dEntity *ent)
+    {
+        int *node = m_Nodes.FindPtr(ent->GetID());
+        return node ? m_Hierarchy.GetWorldMatrix(*node) : ent->GetWorldMatrix();
+    }
+
+    const VxMatrix &GetInverseWorldMatrix(CK3dEntity *ent)
+    {
+        int *node = m_Nodes.FindPtr(ent->GetID());
+        return node ? m_Hierarchy.GetInverseWorldMatrix(*node) : ent->GetInverseWorldMatrix();
+    }
+
+    // Computes all the dirty world matrices.
+    void Update() { m_Hierarchy.Update(); }
+
+    // Gives the changed matrices to the entities.
+    void Flush()
+    {
+        const int *order = m_Hierarchy.GetOrder();
+        for (int k = 0; k < m_Entities.Size(); ++k)
+        {
+            const int i = order[k];
+            if (!(m_Flags[i] & CHANGED))
+                continue;
+            m_Flags[i] &= ~CHANGED;
+            CK3dEntity *ent = GetEntity(i);
+            if (ent)
+                ent->SetLocalMatrix(m_Hierarchy.GetLocalMatrix(i));
+        }
+    }
+
+    // Reads the matrices of the entities again, the changes not flushed are lost.
+    void Resync()
+    {
+        for (int i = 0; i < m_Entities.Size(); ++i)
+        {
+            CK3dEntity *ent = GetEntity(i);
+            m_Flags[i] &= ~CHANGED;
+            if (ent)
+                m_Hierarchy.SetLocalMatrix(i, (m_Flags[i] & FIXED) ? ent->GetWorldMatrix() : ent->GetLocalMatrix());
+        }
+    }
+
+    VxTransformHierarchy &GetHierarchy() { return m_Hierarchy; }
+
+protected:
+    enum
+    {
+        CHANGED = 1, // local matrix to give to the entity
+        FIXED = 2    // parent of an added hierarchy, only its world matrix is used
+    };
+
+    CK3dEntity *GetEntity(int i)
+    {
+        CK3dEntity *ent = (CK3dEntity *)m_Context->GetObject(m_Entities[i]);
+        return (ent && !ent->IsToBeDeleted()) ? ent : NULL;
+    }
+
+    int AddNode(CK3dEntity *ent, int parent, CKBOOL fixed)
+    {
+        const int i = m_Hierarchy.AddNode(parent, fixed ? ent->GetWorldMatrix() : ent->GetLocalMatrix());
+        m_Nodes.Insert(ent->GetID(), i);
+        m_Entities.PushBack(ent->GetID());
+        m_Flags.PushBack(fixed ? FIXED : 0);
+        return i;
+    }
+
+    void AddTree(CK3dEntity *ent, int parent)
+    {
+        const int i = AddNode(ent, parent, FALSE);
+        for (int c = 0; c < ent->GetChildrenCount(); ++c)
+        {
+            CK3dEntity *child = ent->GetChild(c);
+            if (child && !m_Nodes.FindPtr(child->GetID()))
+                AddTree(child, i);
+        }
+    }
+
+    CKContext *m_Context;
+    VxTransformHierarchy m_Hierarchy;
+    XHashTable<int, CK_ID> m_Nodes; // node of each entity
+    XArray<CK_ID> m_Entities;       // entity of each node
+    XArray<XBYTE> m_Flags;
+
+private:
+    CKTransformCache(const CKTransformCache &);
+    CKTransformCache &operator=(const CKTransformCache &);
+};
+
+#endif // CKTRANSFORMCACHE_H
@@ -0,0 +1,191 @@
+#ifndef CKVERTEXRINGBUFFER_H
+#define CKVERTEXRINGBUFFER_H
+
+#include "CKRenderContext.h"
+#include "CKRenderManager.h"
+#include "CKVertexBuffer.h"
+
+/****************************************************************
+Summary: Large dynamic vertex buffer sub-allocated as a ring.
+
+Remarks:
+    o Instead of locking a vertex buffer for each dynamic draw (sprites,
+    particles, user geometry), the vertices of successive draws are
+    written one after the other in a single large vertex buffer, locked
+    with CK_LOCK_NOOVERWRITE so that the driver does not wait for the
+    draws still using the previous parts of the buffer.
+    o The parts of the buffer written during the last FrameLatency frames
+    may still be read by the graphic card. When the ring wraps onto one of
+    them the buffer is locked with CK_LOCK_DISCARD instead, which lets the
+    driver give a new buffer rather than stall.
+    o NewFrame must be called once per frame (before the first lock of
+    the frame).
+
+    ring.NewFrame();
+    CKDWORD start;
+    VxDrawPrimitiveData *data = ring.Lock(dev, 4, start);
+    // ... fill 4 vertices
+    ring.Unlock(dev);
+    ring.Draw(dev, VX_TRIANGLEFAN, NULL, 0, start, 4);
+
+See Also: CKVertexBuffer,CKRenderContext::GetDrawPrimitiveStructure
+****************************************************************/
+class CKVertexRingBuffer
+{
+public:
+    enum
+    {
+        FrameLatency = 3 // frames after which the graphic card is done with a part of the buffer
+    };
+
+    /************************************************
+    Summary: Creates a ring buffer.
+
+    Arguments:
+        rm: Render manager used to create the vertex buffer.
+        capacity: Number of vertices of the buffer.
+        format: Vertex format (CKRST_DPFLAGS) of the buffer.
+    ************************************************/
+    CKVertexRingBuffer(CKRenderManager *rm, CKDWORD capacity, CKRST_DPFLAGS format)
+        : m_RenderManager(rm), m_VB(rm ? rm->CreateVertexBuffer() : NULL), m_Capacity(capacity),
+          m_Format(format), m_Position(0), m_Frame(0), m_Discards(0)
+    {
+        ClearHistory();
+    }
+
+    ~CKVertexRingBuffer()
+    {
+        if (m_VB && m_RenderManager)
+            m_RenderManager->DestroyVertexBuffer(m_VB);
+    }
+
+    // Starts a new frame, the parts written FrameLatency frames ago can be reused.
+    void NewFrame()
+    {
+        m_Frame = (m_Frame + 1) % FrameLatency;
+        m_Uses[m_Frame].m_Count = 0;
+    }
+
+    /************************************************
+    Summary: Locks space for vertices.
+
+    Arguments:
+        dev: Render context the buffer is drawn on.
+        count: Number of vertices to write.
+        startVertex: Index of the first locked vertex in the buffer, to give
+        to Draw.
+    Return Value:
+        Structure pointing to the locked vertices, NULL if the buffer could
+        not be created or is too small.
+    ************************************************/
+    VxDrawPrimitiveData *Lock(CKRenderContext *dev, CKDWORD count, CKDWORD &startVertex)
+    {
+        if (!m_VB || !count || count > m_Capacity)
+            return NULL;
+        CKLOCKFLAGS flags = CK_LOCK_NOOVERWRITE;
+        CKVB_STATE state = m_VB->Check(dev, m_Capacity, m_Format, TRUE);
+        if (state == CK_VB_FAILED)
+            return NULL;
+        if (state == CK_VB_LOST)
+        {
+            m_Position = 0;
+            flags = CK_LOCK_DISCARD;
+        }
+        if (m_Position + count > m_Capacity)
+            m_Position = 0;
+        if (flags != CK_LOCK_DISCARD && IsInUse(m_Position, m_Position + count))
+            flags = CK_LOCK_DISCARD;
+        if (flags == CK_LOCK_DISCARD)
+        {
+            // the previous content is in a buffer the driver no longer gives us
+            ClearHistory();
+            ++m_Discards;
+        }
+
+        VxDrawPrimitiveData *data = m_VB->Lock(dev, m_Position, count, flags);
+        if (!data)
+            return NULL;
+        startVertex = m_Position;
+        AddUse(m_Position, m_Position + count);
+        m_Position += count;
+        return data;
+    }
+
+    void Unlock(CKRenderContext *dev) { m_VB->Unlock(dev); }
+
+    // Draws vertices written in the buffer, indices are relative to startVertex.
+    CKBOOL Draw(CKRenderContext *dev, VXPRIMITIVETYPE type, CKWORD *indices, int indexCount, CKDWORD startVertex, CKDWORD vertexCount)
+    {
+        return m_VB ? m_VB->Draw(dev, type, indices, indexCount, startVertex, vertexCount) : FALSE;
+    }
+
+    CKDWORD GetCapacity() const { return m_Capacity; }
+
+    // Number of discarding locks (the ring wrapped too fast or the buffer was lost).
+    int GetDiscardCount() const { return m_Discards; }
+
+protected:
+    // Parts of the buffer written during a frame.
+    struct FrameUse
+    {
+        CKDWORD m_Begin[2];
+        CKDWORD m_End[2];
+        int m_Count;
+    };
+
+    void ClearHistory()
+    {
+        for (int i = 0; i < FrameLatency; ++i)
+            m_Uses[i].m_Count = 0;
+    }
+
+    CKBOOL IsInUse(CKDWORD begin, CKDWORD end) const
+    {
+        for (int i = 0; i < FrameLatency; ++i)
+        {
+            const FrameUse &u = m_Uses[i];
+            for (int j = 0; j < u.m_Count; ++j)
+            {
+                if (begin < u.m_End[j] && u.m_Begin[j] < end)
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    void AddUse(CKDWORD begin, CKDWORD end)
+    {
+        FrameUse &u = m_Uses[m_Frame];
+        if (u.m_Count && u.m_End[u.m_Count - 1] == begin)
+        {
+            u.m_End[u.m_Count - 1] = end;
+            return;
+        }
+        if (u.m_Count == 2)
+        {
+            // merge into a single conservative range
+            u.m_Begin[0] = XMin(u.m_Begin[0], XMin(u.m_Begin[1], begin));
+            u.m_End[0] = XMax(u.m_End[0], XMax(u.m_End[1], end));
+            u.m_Count = 1;
+            return;
+        }
+        u.m_Begin[u.m_Count] = begin;
+        u.m_End[u.m_Count] = end;
+        ++u.m_Count;
+    }
+
+    CKRenderManager *m_RenderManager;
+    CKVertexBuffer *m_VB;
+    CKDWORD m_Capacity;
+    CKRST_DPFLAGS m_Format;
+    CKDWORD m_Position; // next vertex to write
+    int m_Frame;        // slot of the current frame in m_Uses
+    int m_Discards;
+    FrameUse m_Uses[FrameLatency];
+
+private:
+    CKVertexRingBuffer(const CKVertexRingBuffer &);
+    CKVertexRingBuffer &operator=(const CKVertexRingBuffer &);
+};
+
+#endif // CKVERTEXRINGBUFFER_H
@@ -0,0 +1,384 @@
+#ifndef CKVOICEVIRTUALIZER_H
+#define CKVOICEVIRTUALIZER_H
+
+#include "CKContext.h"
+#include "CKWaveSound.h"
+#include "CKSoundManager.h"
+
+/****************************************************************
+Summary: Plays the most audible wave sounds within a budget of voices, the others virtually.
+
+Remarks:
+    o Each playing CKWaveSound uses a source of the sound manager, even
+    when it can not be heard. The sounds played through the virtualizer
+    are ranked each Update by their priority times their gain at the
+    listener (the gain of the sound and, for 3D sounds, the distance
+    attenuation computed from the min and max distances and the roll off
+    of the listener). Only the first ones, within the voice budget and
+    above the audible gain, are really played.
+    o The other sounds are virtual: they are paused and their sources
+    released (CKWaveSound::Release), and their play position advances
+    with the time given to Update. When a virtual sound becomes audible
+    again its source is created again (Recreate) and positioned where it
+    would be, then resumed. A sound streamed from a file keeps its source
+    and restarts where it was paused.
+    o A virtual sound which is not looping ends when its length is
+    reached, without ever using a source. Sounds played with autoRemove
+    (one-shots) are forgotten when they end.
+    o A real voice keeps its place unless another sound is 10% above it,
+    so two sounds of close scores do not swap each frame.
+
+    CKVoiceVirtualizer voices(ctx, 24);
+    voices.Play(explosion, 0.9f, TRUE);
+    ...
+    // each frame
+    voices.Update(deltaTime);
+
+See Also: CKWaveSound,CKSoundManager,CKWaveSound3DSettings
+****************************************************************/
+class CKVoiceVirtualizer
+{
+public:
+    CKVoiceVirtualizer(CKContext *ctx, int maxVoices = 32, float audibleGain = 0.01f)
+        : m_Context(ctx), m_MaxVoices(maxVoices), m_AudibleGain(audibleGain), m_ReleaseSources(TRUE)
+    {
+        m_Manager = (CKSoundManager *)ctx->GetManagerByGuid(SOUND_MANAGER_GUID);
+    }
+
+    ~CKVoiceVirtualizer() { Clear(); }
+
+    void SetMaxVoices(int count) { m_MaxVoices = count; }
+    int GetMaxVoices() const { return m_MaxVoices; }
+    // Gain at the listener under which a sound is virtual.
+    void SetAudibleGain(float gain) { m_AudibleGain = gain; }
+    // FALSE to only pause the virtual sounds, keeping their sources.
+    void SetReleaseSources(CKBOOL release) { m_ReleaseSources = release; }
+
+    //---------------------------------------------
+    // Sounds
+
+    /************************************************
+    Summary: Plays a sound, really if it is among the most audible.
+
+    Arguments:
+        sound: Sound to play from its start.
+        priority: Between 0 and 1, negative to use CKWaveSound::GetPriority.
+        autoRemove: TRUE to forget the sound when it ends.
+    ************************************************/
+    void Play(CKWaveSound *sound, float priority = -1.0f, CKBOOL autoRemove = FALSE)
+    {
+        if (!sound)
+            return;
+        Voice *v = Find(sound);
+        if (!v)
+        {
+            m_Voices.Expand(1);
+            v = &m_Voices.Back();
+            v->m_Sound = sound->GetID();
+            v->m_Real = FALSE;
+            v->m_Released = FALSE;
+        }
+        else if (v->m_Real)
+            sound->Stop();
+        v->m_Priority = priority < 0.0f ? sound->GetPriority() : priority;
+        v->m_AutoRemove = autoRemove;
+        v->m_Playing = TRUE;
+        v->m_Started = FALSE;
+        v->m_Real = FALSE;
+        v->m_Position = 0.0f;
+        v->m_Gain = GetListenerGain(sound);
+        // a free voice is taken at once
+        if (GetRealCount() < m_MaxVoices && v->m_Gain >= m_AudibleGain)
+            Promote(sound, v);
+    }
+
+    void Stop(CKWaveSound *sound)
+    {
+        Voice *v = Find(sound);
+        if (!v)
+            return;
+        if (v->m_Real)
+            sound->Stop();
+        v->m_Real = FALSE;
+        v->m_Playing = FALSE;
+        v->m_Position = 0.0f;
+    }
+
+    // Forgets a sound, leaving it with a source.
+    void Remove(CKWaveSound *sound)
+    {
+        for (int i = 0; i < m_Voices.Size(); ++i)
+        {
+            if (sound && m_Voices[i].m_Sound == sound->GetID())
+            {
+                Restore(sound, m_Voices[i]);
+                m_Voices.RemoveAt(i);
+                return;
+            }
+        }
+    }
+
+    void Clear()
+    {
+        for (int i = 0; i < m_Voices.Size(); ++i)
+        {
+            CKWaveSound *sound = (CKWaveSound *)m_Context->GetObject(m_Voices[i].m_Sound);
+            if (sound)
+                Restore(sound, m_Voices[i]);
+        }
+        m_Voices.Resize(0);
+    }
+
+    /************************************************
+    Summary: Advances the virtual sounds and chooses the real ones.
+
+    Arguments:
+        deltaMs: Time elapsed since the previous update, in milliseconds.
+    Return Value:
+        Number of sounds really playing.
+    ************************************************/
+    int Update(float deltaMs)
+    {
+        int i;
+        m_Ranks.Resize(0);
+        for (i = m_Voices.Size() - 1; i >= 0; --i)
+        {
+            Voice &v = m_Voices[i];
+            CKWaveSound *sound = (CKWaveSound *)m_Context->GetObject(v.m_Sound);
+            if (!sound)
+            {
+                m_Voices.RemoveAt(i);
+                continue;
+            }
+            if (!v.m_Playing)
+                continue;
+            if (!Advance(sound, v, deltaMs))
+            {
+                v.m_Playing = FALSE;
+                v.m_Real = FALSE;
+                if (v.m_AutoRemove)
+                {
+                    Restore(sound, v);
+                    m_Voices.RemoveAt(i);
+                }
+                continue;
+            }
+            v.m_Gain = GetListenerGain(sound);
+        }
+
+        for (i = 0; i < m_Voices.Size(); ++i)
+        {
+            const Voice &v = m_Voices[i];
+            if (!v.m_Playing || v.m_Gain < m_AudibleGain)
+                continue;
+            Rank r;
+            r.m_Score = v.m_Gain * v.m_Priority;
+            if (v.m_Real)
+                r.m_Score *= 1.1f;
+            r.m_Index = i;
+            m_Ranks.PushBack(r);
+        }
+        m_Ranks.Sort(CompareRanks);
+
+        // the voices to free first, then the ones to take
+        for (i = 0; i < m_Voices.Size(); ++i)
+            m_Voices[i].m_Wanted = FALSE;
+        const int count = XMin(m_Ranks.Size(), m_MaxVoices);
+        for (i = 0; i < count; ++i)
+            m_Voices[m_Ranks[i].m_Index].m_Wanted = TRUE;
+        int real = 0;
+        for (i = 0; i < m_Voices.Size(); ++i)
+        {
+            Voice &v = m_Voices[i];
+            if (v.m_Real && !v.m_Wanted)
+                Demote((CKWaveSound *)m_Context->GetObject(v.m_Sound), &v);
+        }
+        for (i = 0; i < m_Voices.Size(); ++i)
+        {
+            Voice &v = m_Voices[i];
+            if (!v.m_Real && v.m_Wanted)
+                Promote((CKWaveSound *)m_Context->GetObject(v.m_Sound), &v);
+            if (v.m_Real)
+                ++real;
+        }
+        return real;
+    }
+
+    //---------------------------------------------
+    // Queries
+
+    CKBOOL IsPlaying(CKWaveSound *sound)
+    {
+        Voice *v = Find(sound);
+        return v && v->m_Playing;
+    }
+    CKBOOL IsVirtual(CKWaveSound *sound)
+    {
+        Voice *v = Find(sound);
+        return v && v->m_Playing && !v->m_Real;
+    }
+    int GetRealCount() const
+    {
+        int count = 0;
+        for (int i = 0; i < m_Voices.Size(); ++i)
+            count += m_Voices[i].m_Real ? 1 : 0;
+        return count;
+    }
+    int GetVoiceCount() const { return m_Voices.Size(); }
+
+protected:
+    struct Voice
+    {
+        CK_ID m_Sound;
+        float m_Priority;
+        float m_Gain;     // at the listener
+        float m_Position; // of a virtual sound, in milliseconds
+        CKBOOL m_Playing; // really or virtually
+        CKBOOL m_Real;
+        CKBOOL m_Started;  // was played by the sound manager
+        CKBOOL m_Released; // its source was released
+        CKBOOL m_AutoRemove;
+        CKBOOL m_Wanted;
+    };
+
+    struct Rank
+    {
+        float m_Score;
+        int m_Index;
+    };
+
+    static int CompareRanks(const void *a, const void *b)
+    {
+        const float sa = ((const Rank *)a)->m_Score;
+        const float sb = ((const Rank *)b)->m_Score;
+        if (sa != sb)
+            return sa > sb ? -1 : 1;
+        return ((const Rank *)a)->m_Index - ((const Rank *)b)->m_Index;
+    }
+
+    Voice *Find(CKWaveSound *sound)
+    {
+        if (!sound)
+            return NULL;
+        for (int i = 0; i < m_Voices.Size(); ++i)
+        {
+            if (m_Voices[i].m_Sound == sound->GetID())
+                return &m_Voices[i];
+        }
+        return NULL;
+    }
+
+    // Gain of the sound, attenuated by the distance to the listener for a 3D sound.
+    float GetListenerGain(CKWaveSound *sound)
+    {
+        float gain = sound->GetGain();
+        const CK_WAVESOUND_TYPE type = sound->GetType();
+        if (type == CK_WAVESOUND_POINT || type == CK_WAVESOUND_CONE)
+        {
+            VxVector pos, dir;
+            float distance = 0.0f, minDistance = 0.0f, maxDistance = 0.0f;
+            CKDWORD mute = 0;
+            sound->GetSound3DInformation(pos, dir, distance);
+            sound->GetMinMaxDistance(&minDistance, &maxDistance, &mute);
+            if (mute && distance >= maxDistance)
+                return 0.0f;
+            const float d = XMin(distance, maxDistance);
+            if (d > minDistance && minDistance > 0.0f)
+                gain *= minDistance / (minDistance + GetRollOff() * (d - minDistance));
+        }
+        return gain;
+    }
+
+    float GetRollOff()
+    {
+        if (!m_Manager)
+            return 1.0f;
+        CKListenerSettings settings;
+        m_Manager->UpdateListenerSettings(CK_LISTENERSETTINGS_ROLLOFF, settings, FALSE);
+        return settings.m_RollOff;
+    }
+
+    // Follows the position of a sound, FALSE when it ended.
+    CKBOOL Advance(CKWaveSound *sound, Voice &v, float deltaMs)
+    {
+        if (v.m_Real)
+            return sound->IsPlaying() || sound->IsPaused();
+        v.m_Position += deltaMs * sound->GetPitch();
+        const float length = (float)sound->GetSoundLength();
+        if (length <= 0.0f || v.m_Position < length)
+            return TRUE;
+        if (!sound->GetLoopMode())
+            return FALSE;
+        v.m_Position = fmodf(v.m_Position, length);
+        return TRUE;
+    }
+
+    void Demote(CKWaveSound *sound, Voice *v)
+    {
+        v->m_Real = FALSE;
+        if (!sound)
+            return;
+        const float length = (float)sound->GetSoundLength();
+        v->m_Position = (float)sound->GetPlayedMs();
+        if (length > 0.0f && v->m_Position >= length)
+            v->m_Position = fmodf(v->m_Position, length);
+        sound->Pause();
+        if (m_ReleaseSources && !sound->GetFileStreaming() && !v->m_Released)
+        {
+            sound->Release();
+            v->m_Released = TRUE;
+        }
+    }
+
+    void Promote(CKWaveSound *sound, Voice *v)
+    {
+        if (!sound)
+            return;
+        if (v->m_Released)
+        {
+            if (sound->Recreate() != CK_OK)
+                return;
+            v->m_Released = FALSE;
+        }
+        if (!v->m_Started)
+        {
+            sound->Play();
+            v->m_Started = TRUE;
+        }
+        else
+        {
+            if (!sound->GetFileStreaming())
+                SetPosition(sound, v->m_Position);
+            sound->Resume();
+        }
+        v->m_Real = TRUE;
+    }
+
+    void SetPosition(CKWaveSound *sound, float ms)
+    {
+        CKWaveFormat format;
+        if (!m_Manager || sound->GetSoundFormat(format) != CK_OK || !format.nBlockAlign)
+            return;
+        int bytes = (int)(ms * 0.001f * format.nAvgBytesPerSec);
+        bytes -= bytes % format.nBlockAlign;
+        m_Manager->SetPlayPosition(sound->GetSource(), bytes);
+    }
+
+    // Leaves a forgotten sound with its source.
+    void Restore(CKWaveSound *sound, Voice &v)
+    {
+        if (v.m_Released)
+            sound->Recreate();
+        v.m_Released = FALSE;
+    }
+
+    CKContext *m_Context;
+    CKSoundManager *m_Manager;
+    int m_MaxVoices;
+    float m_AudibleGain;
+    CKBOOL m_ReleaseSources;
+    XArray<Voice> m_Voices;
+    XArray<Rank> m_Ranks;
+};
+
+#endif // CKVOICEVIRTUALIZER_H
@@ -23,8 +23,22 @@ class XFixedSizeAllocator
 public:
 	enum { DEFAULT_CHUNK_SIZE = 4096 };
 
-	VX_EXPORT XFixedSizeAllocator(const int iBlockSize, const int iPageSize = DEFAULT_CHUNK_SIZE);
-	VX_EXPORT ~XFixedSizeAllocator();
+	XFixedSizeAllocator(const int iBlockSize, const int iPageSize = DEFAULT_CHUNK_SIZE)
+	{
+		// a free block holds the index of the next free one
+		m_BlockSize = (iBlockSize < (int)sizeof(int)) ? sizeof(int) : iBlockSize;
+		m_PageSize = iPageSize;
+		m_BlockCount = (unsigned int)(m_PageSize / m_BlockSize);
+		if (m_BlockCount < 1)
+			m_BlockCount = 1;
+		m_AChunk = NULL;
+		m_DChunk = NULL;
+	}
+
+	~XFixedSizeAllocator()
+	{
+		Clear();
+	}
 
 	// return the number of allocated chunks
 	int GetChunksCount()
@@ -32,11 +46,20 @@ public:
 		return m_Chunks.Size();
 	}
 
-	// return the number of allocated chunks
-	VX_EXPORT int GetChunksTotalSize();
+	// return the number of bytes reserved by the chunks
+	int GetChunksTotalSize()
+	{
+		return m_Chunks.Size() * (int)(m_BlockCount * m_BlockSize);
+	}
 
-	// return the number of allocated chunks
-	VX_EXPORT int GetChunksOccupation();
+	// return the number of bytes used by the allocated blocks
+	int GetChunksOccupation()
+	{
+		int used = 0;
+		for (Chunks::Iterator it = m_Chunks.Begin(); it != m_Chunks.End(); ++it)
+			used += (int)(m_BlockCount - it->m_BlockAvailable);
+		return used * (int)m_BlockSize;
+	}
 
 	template <class T>
 	void CallDtor(T *iDummy)
@@ -48,11 +71,59 @@ public:
 		}
 	}
 
-	VX_EXPORT void Clear();
+	// release all the chunks at once (no destructor called, see CallDtor)
+	void Clear()
+	{
+		for (Chunks::Iterator it = m_Chunks.Begin(); it != m_Chunks.End(); ++it)
+		{
+			it->Destroy();
+		}
+		m_Chunks.Clear();
+		m_AChunk = NULL;
+		m_DChunk = NULL;
+	}
+
+	void *Allocate()
+	{
+		if (!m_AChunk || !m_AChunk->m_BlockAvailable)
+		{
+			// we look for a chunk with a free block
+			m_AChunk = NULL;
+			for (Chunks::Iterator it = m_Chunks.Begin(); it != m_Chunks.End(); ++it)
+			{
+				if (it->m_BlockAvailable)
+				{
+					m_AChunk = it;
+					break;
+				}
+			}
+
+			if (!m_AChunk)
+			{
+				// no more room : we create a new chunk
+				Chunk c;
+				c.Init(m_BlockSize, m_BlockCount);
+				m_Chunks.PushBack(c);
+				// the array may have moved
+				m_AChunk = m_Chunks.End() - 1;
+				m_DChunk = m_Chunks.Begin();
+			}
+		}
+
+		return m_AChunk->Allocate(m_BlockSize);
+	}
+
+	void Free(void *iP)
+	{
+		if (!iP)
+			return;
 
-	VX_EXPORT void *Allocate();
+		if (!m_DChunk || !m_DChunk->Contains(iP, m_BlockSize, m_BlockCount))
+			m_DChunk = FindChunk(iP);
+		XASSERT(m_DChunk);
 
-	VX_EXPORT void Free(void *iP);
+		m_DChunk->Deallocate(iP, m_BlockSize);
+	}
 
 private:
 	class Chunk
@@ -60,7 +131,18 @@ private:
 	public:
 		Chunk() {}
 
-		void Init(size_t iBlockSize, unsigned int iBlockCount);
+		void Init(size_t iBlockSize, unsigned int iBlockCount)
+		{
+			m_Data = (unsigned char *)VxMalloc(iBlockSize * iBlockCount);
+			m_FirstAvailableBlock = 0;
+			m_BlockAvailable = iBlockCount;
+			m_BlockCount = iBlockCount;
+
+			// we chain the free blocks
+			unsigned char *p = m_Data;
+			for (unsigned int i = 0; i < iBlockCount; p += iBlockSize)
+				*(int *)p = ++i;
+		}
 
 		template <class T>
 		void CallDtor(T *iDummy, size_t iBlockSize, unsigned int iBlockCount)
@@ -114,11 +196,36 @@ private:
 			}
 		}
 
-		void Destroy();
+		void Destroy()
+		{
+			VxFree(m_Data);
+			m_Data = NULL;
+		}
+
+		void *Allocate(size_t iBlockSize)
+		{
+			if (!m_BlockAvailable)
+				return NULL;
 
-		void *Allocate(size_t iBlockSize);
+			unsigned char *p = m_Data + m_FirstAvailableBlock * iBlockSize;
+			m_FirstAvailableBlock = *(int *)p;
+			--m_BlockAvailable;
+			return p;
+		}
 
-		void Deallocate(void *iP, size_t iBlockSize);
+		void Deallocate(void *iP, size_t iBlockSize)
+		{
+			unsigned char *p = (unsigned char *)iP;
+			*(int *)p = m_FirstAvailableBlock;
+			m_FirstAvailableBlock = (unsigned int)((p - m_Data) / iBlockSize);
+			++m_BlockAvailable;
+		}
+
+		XBOOL Contains(void *iP, size_t iBlockSize, unsigned int iBlockCount) const
+		{
+			unsigned char *p = (unsigned char *)iP;
+			return (p >= m_Data) && (p < m_Data + iBlockSize * iBlockCount);
+		}
 
 		unsigned char *m_Data;
 		unsigned int m_FirstAvailableBlock;
@@ -130,7 +237,15 @@ private:
 	typedef XArray<Chunk> Chunks;
 
 	// function to find the chunk containing the ptr
-	Chunk *FindChunk(void *iP);
+	Chunk *FindChunk(void *iP)
+	{
+		for (Chunks::Iterator it = m_Chunks.Begin(); it != m_Chunks.End(); ++it)
+		{
+			if (it->Contains(iP, m_BlockSize, m_BlockCount))
+				return it;
+		}
+		return NULL;
+	}
 
 	// members
 	size_t m_PageSize;
@@ -0,0 +1,404 @@
+#ifndef VXAABBTREE_H
+#define VXAABBTREE_H
+
+#include "VxVector.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Dynamic bounding box tree.
+
+Remarks:
+    o Each proxy stores a user value (an object ID for example) and a box
+    enlarged by a margin, so that an object moving a little does not need
+    to update the tree. MoveProxy only reinserts the proxy when the new box
+    gets out of the enlarged one.
+    o Proxies are inserted next to the sibling minimizing the surface of the
+    tree and the tree is kept balanced with rotations, so queries only visit
+    the nodes near the queried box.
+    o Proxy identifiers are indices into the node pool, they are recycled
+    when a proxy is destroyed.
+
+    VxAABBTree tree(0.1f);
+    int proxy = tree.CreateProxy(ent->GetBoundingBox(), ent->GetID());
+    ...
+    tree.MoveProxy(proxy, ent->GetBoundingBox());
+    tree.Query(box, proxies);
+
+See Also : VxBbox,CKCollisionBroadphase
+*********************************************************/
+class VxAABBTree
+{
+public:
+    struct Node
+    {
+        VxBbox m_Box;       // enlarged box of a proxy, merged box of an inner node
+        XDWORD m_UserData;
+        int m_Parent;       // next free node when the node is not used
+        int m_Child1;       // -1 for a leaf
+        int m_Child2;
+        int m_Height;       // 0 for a leaf, -1 for a free node
+
+        XBOOL IsLeaf() const { return m_Child1 == -1; }
+    };
+
+    explicit VxAABBTree(float margin = 0.0f) : m_Root(-1), m_FreeList(-1), m_ProxyCount(0), m_Margin(margin) {}
+
+    void Clear()
+    {
+        m_Nodes.Clear();
+        m_Root = -1;
+        m_FreeList = -1;
+        m_ProxyCount = 0;
+    }
+
+    // Margin added on each side of the proxies boxes.
+    void SetMargin(float margin) { m_Margin = margin; }
+    float GetMargin() const { return m_Margin; }
+
+    int GetProxyCount() const { return m_ProxyCount; }
+    int GetHeight() const { return (m_Root == -1) ? 0 : m_Nodes[m_Root].m_Height; }
+
+    XDWORD GetUserData(int proxy) const { return m_Nodes[proxy].m_UserData; }
+    const VxBbox &GetFatBox(int proxy) const { return m_Nodes[proxy].m_Box; }
+
+    /**********************************************************
+    Summary: Adds a box to the tree.
+
+    Return Value:
+        Identifier of the proxy.
+    *********************************************************/
+    int CreateProxy(const VxBbox &box, XDWORD userData)
+    {
+        int proxy = AllocateNode();
+        Node &node = m_Nodes[proxy];
+        Fatten(node.m_Box, box);
+        node.m_UserData = userData;
+        node.m_Height = 0;
+        InsertLeaf(proxy);
+        ++m_ProxyCount;
+        return proxy;
+    }
+
+    void DestroyProxy(int proxy)
+    {
+        RemoveLeaf(proxy);
+        FreeNode(proxy);
+        --m_ProxyCount;
+    }
+
+    /**********************************************************
+    Summary: Updates the box of a proxy.
+
+    Return Value:
+        TRUE if the proxy was reinserted, FALSE if the box is still inside
+        the enlarged box of the proxy.
+    *********************************************************/
+    XBOOL MoveProxy(int proxy, const VxBbox &box)
+    {
+        if (Contains(m_Nodes[proxy].m_Box, box))
+            return FALSE;
+        RemoveLeaf(proxy);
+        Fatten(m_Nodes[proxy].m_Box, box);
+        InsertLeaf(proxy);
+        return TRUE;
+    }
+
+    /**********************************************************
+    Summary: Gets the proxies whose enlarged box overlaps a box.
+
+    Arguments:
+        box: Box to test.
+        proxies: The overlapping proxies are added to this array.
+    Return Value:
+        Number of proxies added.
+    *********************************************************/
+    int Query(const VxBbox &box, XArray<int> &proxies) const
+    {
+        if (m_Root == -1)
+            return 0;
+        int added = 0;
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = m_Root;
+        while (top)
+        {
+            const Node &node = m_Nodes[stack[--top]];
+            if (!Overlap(node.m_Box, box))
+                continue;
+            if (node.IsLeaf())
+            {
+                proxies.PushBack((int)(&node - m_Nodes.Begin()));
+                ++added;
+            }
+            else
+            {
+                stack[top++] = node.m_Child1;
+                stack[top++] = node.m_Child2;
+            }
+        }
+        return added;
+    }
+
+    static XBOOL Overlap(const VxBbox &a, const VxBbox &b)
+    {
+        return a.Min.x <= b.Max.x && a.Max.x >= b.Min.x &&
+               a.Min.y <= b.Max.y && a.Max.y >= b.Min.y &&
+               a.Min.z <= b.Max.z && a.Max.z >= b.Min.z;
+    }
+
+protected:
+    // The tree is balanced, its height stays far below this.
+    enum { StackSize = 256 };
+
+    static XBOOL Contains(const VxBbox &outer, const VxBbox &inner)
+    {
+        return outer.Min.x <= inner.Min.x && outer.Min.y <= inner.Min.y && outer.Min.z <= inner.Min.z &&
+               outer.Max.x >= inner.Max.x && outer.Max.y >= inner.Max.y && outer.Max.z >= inner.Max.z;
+    }
+
+    static void Merge(VxBbox &res, const VxBbox &a, const VxBbox &b)
+    {
+        res.Min.x = XMin(a.Min.x, b.Min.x);
+        res.Min.y = XMin(a.Min.y, b.Min.y);
+        res.Min.z = XMin(a.Min.z, b.Min.z);
+        res.Max.x = XMax(a.Max.x, b.Max.x);
+        res.Max.y = XMax(a.Max.y, b.Max.y);
+        res.Max.z = XMax(a.Max.z, b.Max.z);
+    }
+
+    static float HalfArea(const VxBbox &b)
+    {
+        float dx = b.Max.x - b.Min.x, dy = b.Max.y - b.Min.y, dz = b.Max.z - b.Min.z;
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    static float MergedHalfArea(const VxBbox &a, const VxBbox &b)
+    {
+        VxBbox m;
+        Merge(m, a, b);
+        return HalfArea(m);
+    }
+
+    void Fatten(VxBbox &res, const VxBbox &box) const
+    {
+        res.Min.x = box.Min.x - m_Margin;
+        res.Min.y = box.Min.y - m_Margin;
+        res.Min.z = box.Min.z - m_Margin;
+        res.Max.x = box.Max.x + m_Margin;
+        res.Max.y = box.Max.y + m_Margin;
+        res.Max.z = box.Max.z + m_Margin;
+    }
+
+    int AllocateNode()
+    {
+        int n;
+        if (m_FreeList != -1)
+        {
+            n = m_FreeList;
+            m_FreeList = m_Nodes[n].m_Parent;
+        }
+        else
+        {
+            n = m_Nodes.Size();
+            m_Nodes.Resize(n + 1);
+        }
+        Node &node = m_Nodes[n];
+        node.m_UserData = 0;
+        node.m_Parent = -1;
+        node.m_Child1 = -1;
+        node.m_Child2 = -1;
+        node.m_Height = 0;
+        return n;
+    }
+
+    void FreeNode(int n)
+    {
+        m_Nodes[n].m_Parent = m_FreeList;
+        m_Nodes[n].m_Height = -1;
+        m_FreeList = n;
+    }
+
+    void InsertLeaf(int leaf)
+    {
+        if (m_Root == -1)
+        {
+            m_Root = leaf;
+            m_Nodes[leaf].m_Parent = -1;
+            return;
+        }
+
+        // find the best sibling
+        const VxBbox leafBox = m_Nodes[leaf].m_Box;
+        int index = m_Root;
+        while (!m_Nodes[index].IsLeaf())
+        {
+            const Node &node = m_Nodes[index];
+            float area = HalfArea(node.m_Box);
+            float combined = MergedHalfArea(node.m_Box, leafBox);
+
+            // cost of creating a parent for this node and the leaf
+            float cost = 2.0f * combined;
+            // cost of pushing the leaf further down
+            float inheritance = 2.0f * (combined - area);
+
+            const Node &c1 = m_Nodes[node.m_Child1];
+            const Node &c2 = m_Nodes[node.m_Child2];
+            float cost1 = MergedHalfArea(c1.m_Box, leafBox) + inheritance;
+            if (!c1.IsLeaf())
+                cost1 -= HalfArea(c1.m_Box);
+            float cost2 = MergedHalfArea(c2.m_Box, leafBox) + inheritance;
+            if (!c2.IsLeaf())
+                cost2 -= HalfArea(c2.m_Box);
+
+            if (cost < cost1 && cost < cost2)
+                break;
+            index = (cost1 < cost2) ? node.m_Child1 : node.m_Child2;
+        }
+        int sibling = index;
+
+        // new parent
+        int oldParent = m_Nodes[sibling].m_Parent;
+        int newParent = AllocateNode();
+        Node &parent = m_Nodes[newParent];
+        parent.m_Parent = oldParent;
+        Merge(parent.m_Box, leafBox, m_Nodes[sibling].m_Box);
+        parent.m_Height = m_Nodes[sibling].m_Height + 1;
+        parent.m_Child1 = sibling;
+        parent.m_Child2 = leaf;
+        if (oldParent != -1)
+        {
+            if (m_Nodes[oldParent].m_Child1 == sibling)
+                m_Nodes[oldParent].m_Child1 = newParent;
+            else
+                m_Nodes[oldParent].m_Child2 = newParent;
+        }
+        else
+        {
+            m_Root = newParent;
+        }
+        m_Nodes[sibling].m_Parent = newParent;
+        m_Nodes[leaf].m_Parent = newParent;
+
+        FixUpwards(newParent);
+    }
+
+    void RemoveLeaf(int leaf)
+    {
+        if (leaf == m_Root)
+        {
+            m_Root = -1;
+            return;
+        }
+
+        int parent = m_Nodes[leaf].m_Parent;
+        int grandParent = m_Nodes[parent].m_Parent;
+        int sibling = (m_Nodes[parent].m_Child1 == leaf) ? m_Nodes[parent].m_Child2 : m_Nodes[parent].m_Child1;
+
+        if (grandParent != -1)
+        {
+            if (m_Nodes[grandParent].m_Child1 == parent)
+                m_Nodes[grandParent].m_Child1 = sibling;
+            else
+                m_Nodes[grandParent].m_Child2 = sibling;
+            m_Nodes[sibling].m_Parent = grandParent;
+            FreeNode(parent);
+            FixUpwards(grandParent);
+        }
+        else
+        {
+            m_Root = sibling;
+            m_Nodes[sibling].m_Parent = -1;
+            FreeNode(parent);
+        }
+    }
+
+    // Balances and refits the ancestors of a node.
+    void FixUpwards(int index)
+    {
+        while (index != -1)
+        {
+            index = Balance(index);
+            Node &node = m_Nodes[index];
+            const Node &c1 = m_Nodes[node.m_Child1];
+            const Node &c2 = m_Nodes[node.m_Child2];
+            node.m_Height = 1 + XMax(c1.m_Height, c2.m_Height);
+            Merge(node.m_Box, c1.m_Box, c2.m_Box);
+            index = node.m_Parent;
+        }
+    }
+
+    // Rotates the subtree of iA if it is unbalanced, returns its new root.
+    int Balance(int iA)
+    {
+        Node *A = &m_Nodes[iA];
+        if (A->IsLeaf() || A->m_Height < 2)
+            return iA;
+
+        int iB = A->m_Child1;
+        int iC = A->m_Child2;
+        int balance = m_Nodes[iC].m_Height - m_Nodes[iB].m_Height;
+        if (balance > 1)
+            return Rotate(iA, iC, iB);
+        if (balance < -1)
+            return Rotate(iA, iB, iC);
+        return iA;
+    }
+
+    // Moves the high child iUp of iA above it, iOther is the other child of iA.
+    int Rotate(int iA, int iUp, int iOther)
+    {
+        Node &A = m_Nodes[iA];
+        Node &U = m_Nodes[iUp];
+        int iF = U.m_Child1;
+        int iG = U.m_Child2;
+        Node &F = m_Nodes[iF];
+        Node &G = m_Nodes[iG];
+
+        // U takes the place of A
+        U.m_Child1 = iA;
+        U.m_Parent = A.m_Parent;
+        A.m_Parent = iUp;
+        if (U.m_Parent != -1)
+        {
+            if (m_Nodes[U.m_Parent].m_Child1 == iA)
+                m_Nodes[U.m_Parent].m_Child1 = iUp;
+            else
+                m_Nodes[U.m_Parent].m_Child2 = iUp;
+        }
+        else
+        {
+            m_Root = iUp;
+        }
+
+        // the highest grand child stays under U, the other one goes under A
+        int iKeep = iF, iMove = iG;
+        if (F.m_Height < G.m_Height)
+        {
+            iKeep = iG;
+            iMove = iF;
+        }
+        Node &K = m_Nodes[iKeep];
+        Node &M = m_Nodes[iMove];
+        const Node &O = m_Nodes[iOther];
+        U.m_Child2 = iKeep;
+        if (A.m_Child1 == iUp)
+            A.m_Child1 = iMove;
+        else
+            A.m_Child2 = iMove;
+        M.m_Parent = iA;
+
+        Merge(A.m_Box, O.m_Box, M.m_Box);
+        A.m_Height = 1 + XMax(O.m_Height, M.m_Height);
+        Merge(U.m_Box, A.m_Box, K.m_Box);
+        U.m_Height = 1 + XMax(A.m_Height, K.m_Height);
+        return iUp;
+    }
+
+    XArray<Node> m_Nodes;
+    int m_Root;
+    int m_FreeList;
+    int m_ProxyCount;
+    float m_Margin;
+};
+
+#endif // VXAABBTREE_H
@@ -0,0 +1,310 @@
+#ifndef VXALIGNEDTYPES_H
+#define VXALIGNEDTYPES_H
+
+#include "VxMatrix.h"
+#include "VxQuaternion.h"
+#include "VxSIMD.h"
+
+/*************************************************
+{filename:VxAlignedTypes}
+Summary: 16 bytes aligned companions of VxVector4, VxMatrix and VxQuaternion.
+
+Remarks:
+    o VxVector4A, VxMatrixA and VxQuaternionA keep their data in SSE
+    registers sized storage so temporary math code can stay in registers.
+    They are converted from and to the ABI types (which have no alignment
+    guarantee) with unaligned loads and stores.
+    o When VX_SIMD_SSE is 0 they fall back to plain float operations.
+    o Unlike the other VxMath code, these types do not check VxHasSSE
+    at run time: with Visual C++ on x86 only use them in code compiled
+    with /arch:SSE or higher.
+    o Arrays of these types must be allocated with VxNewAligned (or on
+    the stack); XArray and XClassArray do not align their storage.
+
+See also: VxSIMD,VxBatchMath
+*************************************************/
+
+/*************************************************
+Summary: 4 floats vector aligned on 16 bytes.
+
+See also: VxVector4,VxMatrixA
+*************************************************/
+class VX_ALIGN(16) VxVector4A
+{
+public:
+#if VX_SIMD_SSE
+    union
+    {
+        __m128 m;
+        struct
+        {
+            float x, y, z, w;
+        };
+        float v[4];
+    };
+
+    VxVector4A() { m = _mm_setzero_ps(); }
+    VxVector4A(__m128 iM) { m = iM; }
+    VxVector4A(float iX, float iY, float iZ, float iW) { m = _mm_setr_ps(iX, iY, iZ, iW); }
+    explicit VxVector4A(const VxVector &iV, float iW = 0.0f) { m = _mm_setr_ps(iV.x, iV.y, iV.z, iW); }
+    explicit VxVector4A(const VxVector4 &iV) { m = _mm_loadu_ps(&iV.x); }
+    explicit VxVector4A(const float *iV) { m = _mm_loadu_ps(iV); }
+
+    static VxVector4A Splat(float f) { return VxVector4A(_mm_set1_ps(f)); }
+
+    void Store(float *oV) const { _mm_storeu_ps(oV, m); }
+
+    VxVector4A operator+(const VxVector4A &iV) const { return VxVector4A(_mm_add_ps(m, iV.m)); }
+    VxVector4A operator-(const VxVector4A &iV) const { return VxVector4A(_mm_sub_ps(m, iV.m)); }
+    VxVector4A operator*(const VxVector4A &iV) const { return VxVector4A(_mm_mul_ps(m, iV.m)); }
+    VxVector4A operator*(float f) const { return VxVector4A(_mm_mul_ps(m, _mm_set1_ps(f))); }
+    VxVector4A operator-() const { return VxVector4A(_mm_sub_ps(_mm_setzero_ps(), m)); }
+#else
+    union
+    {
+        struct
+        {
+            float x, y, z, w;
+        };
+        float v[4];
+    };
+
+    VxVector4A() { x = y = z = w = 0.0f; }
+    VxVector4A(float iX, float iY, float iZ, float iW) { x = iX; y = iY; z = iZ; w = iW; }
+    explicit VxVector4A(const VxVector &iV, float iW = 0.0f) { x = iV.x; y = iV.y; z = iV.z; w = iW; }
+    explicit VxVector4A(const VxVector4 &iV) { x = iV.x; y = iV.y; z = iV.z; w = iV.w; }
+    explicit VxVector4A(const float *iV) { x = iV[0]; y = iV[1]; z = iV[2]; w = iV[3]; }
+
+    static VxVector4A Splat(float f) { return VxVector4A(f, f, f, f); }
+
+    void Store(float *oV) const { oV[0] = x; oV[1] = y; oV[2] = z; oV[3] = w; }
+
+    VxVector4A operator+(const VxVector4A &iV) const { return VxVector4A(x + iV.x, y + iV.y, z + iV.z, w + iV.w); }
+    VxVector4A operator-(const VxVector4A &iV) const { return VxVector4A(x - iV.x, y - iV.y, z - iV.z, w - iV.w); }
+    VxVector4A operator*(const VxVector4A &iV) const { return VxVector4A(x * iV.x, y * iV.y, z * iV.z, w * iV.w); }
+    VxVector4A operator*(float f) const { return VxVector4A(x * f, y * f, z * f, w * f); }
+    VxVector4A operator-() const { return VxVector4A(-x, -y, -z, -w); }
+#endif
+
+    VxVector4A &operator+=(const VxVector4A &iV) { return *this = *this + iV; }
+    VxVector4A &operator-=(const VxVector4A &iV) { return *this = *this - iV; }
+    VxVector4A &operator*=(float f) { return *this = *this * f; }
+
+    float &operator[](int i) { return v[i]; }
+    const float &operator[](int i) const { return v[i]; }
+
+    VxVector ToVector() const { return VxVector(x, y, z); }
+    VxVector4 ToVector4() const { return VxVector4(x, y, z, w); }
+};
+
+inline VxVector4A operator*(float f, const VxVector4A &iV) { return iV * f; }
+
+// Dot product of the x,y,z components.
+inline float Dot3(const VxVector4A &a, const VxVector4A &b)
+{
+#if VX_SIMD_SSE
+    __m128 p = _mm_mul_ps(a.m, b.m);
+    float r;
+    _mm_store_ss(&r, _mm_add_ss(_mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(p, p)));
+    return r;
+#else
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+#endif
+}
+
+// Dot product of the 4 components.
+inline float Dot4(const VxVector4A &a, const VxVector4A &b)
+{
+#if VX_SIMD_SSE
+    __m128 p = _mm_mul_ps(a.m, b.m);
+    p = _mm_add_ps(p, _mm_movehl_ps(p, p));
+    float r;
+    _mm_store_ss(&r, _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))));
+    return r;
+#else
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+#endif
+}
+
+// Cross product of the x,y,z components (w is set to 0).
+inline VxVector4A Cross3(const VxVector4A &a, const VxVector4A &b)
+{
+#if VX_SIMD_SSE
+    __m128 r = _mm_sub_ps(_mm_mul_ps(a.m, _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 0, 2, 1))),
+                          _mm_mul_ps(b.m, _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 0, 2, 1))));
+    return VxVector4A(_mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+    return VxVector4A(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x, 0.0f);
+#endif
+}
+
+/*************************************************
+Summary: 4x4 matrix aligned on 16 bytes.
+
+Remarks:
+    The layout is the one of VxMatrix: m_Col[3] holds the translation
+and a vector is transformed by m_Col[0]*x + m_Col[1]*y + m_Col[2]*z + m_Col[3].
+See also: VxMatrix,VxVector4A
+*************************************************/
+class VX_ALIGN(16) VxMatrixA
+{
+public:
+    VxMatrixA() {}
+    explicit VxMatrixA(const VxMatrix &iMat) { FromMatrix(iMat); }
+
+    void FromMatrix(const VxMatrix &iMat)
+    {
+        const float *m = &iMat[0][0];
+        for (int i = 0; i < 4; ++i)
+            m_Col[i] = VxVector4A(m + 4 * i);
+    }
+
+    void ToMatrix(VxMatrix &oMat) const
+    {
+        float *m = &oMat[0][0];
+        for (int i = 0; i < 4; ++i)
+            m_Col[i].Store(m + 4 * i);
+    }
+
+    void SetIdentity()
+    {
+        m_Col[0] = VxVector4A(1.0f, 0.0f, 0.0f, 0.0f);
+        m_Col[1] = VxVector4A(0.0f, 1.0f, 0.0f, 0.0f);
+        m_Col[2] = VxVector4A(0.0f, 0.0f, 1.0f, 0.0f);
+        m_Col[3] = VxVector4A(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    VxVector4A &operator[](int i) { return m_Col[i]; }
+    const VxVector4A &operator[](int i) const { return m_Col[i]; }
+
+    // Transforms a point (w is considered to be 1).
+    VxVector4A TransformPoint(const VxVector4A &iV) const
+    {
+        return m_Col[0] * iV.x + m_Col[1] * iV.y + m_Col[2] * iV.z + m_Col[3];
+    }
+
+    // Rotates a vector (w and the translation are ignored).
+    VxVector4A RotateVector(const VxVector4A &iV) const
+    {
+        return m_Col[0] * iV.x + m_Col[1] * iV.y + m_Col[2] * iV.z;
+    }
+
+    // Full 4x4 product, same as Vx3DMultiplyMatrix4.
+    VxVector4A operator*(const VxVector4A &iV) const
+    {
+        return m_Col[0] * iV.x + m_Col[1] * iV.y + m_Col[2] * iV.z + m_Col[3] * iV.w;
+    }
+
+    // Product considering the last column to be (0,0,0,1), same as Vx3DMultiplyMatrix.
+    VxMatrixA operator*(const VxMatrixA &iMat) const
+    {
+        VxMatrixA r;
+        for (int i = 0; i < 3; ++i)
+            r.m_Col[i] = RotateVector(iMat.m_Col[i]);
+        r.m_Col[3] = TransformPoint(iMat.m_Col[3]);
+        r.m_Col[0].w = r.m_Col[1].w = r.m_Col[2].w = 0.0f;
+        r.m_Col[3].w = 1.0f;
+        return r;
+    }
+
+    VxMatrixA &operator*=(const VxMatrixA &iMat) { return *this = *this * iMat; }
+
+    // Full 4x4 product, same as Vx3DMultiplyMatrix4.
+    friend VxMatrixA Multiply4(const VxMatrixA &a, const VxMatrixA &b)
+    {
+        VxMatrixA r;
+        for (int i = 0; i < 4; ++i)
+            r.m_Col[i] = a * b.m_Col[i];
+        return r;
+    }
+
+protected:
+    VxVector4A m_Col[4];
+};
+
+/*************************************************
+Summary: Quaternion aligned on 16 bytes.
+
+Remarks:
+    The product follows the convention of Vx3DQuaternionMultiply.
+See also: VxQuaternion,Slerp
+*************************************************/
+class VX_ALIGN(16) VxQuaternionA
+{
+public:
+    VxQuaternionA() : m_V(0.0f, 0.0f, 0.0f, 1.0f) {}
+    VxQuaternionA(const VxVector4A &iV) : m_V(iV) {}
+    VxQuaternionA(float iX, float iY, float iZ, float iW) : m_V(iX, iY, iZ, iW) {}
+    explicit VxQuaternionA(const VxQuaternion &iQuat) : m_V(iQuat.x, iQuat.y, iQuat.z, iQuat.w) {}
+
+    VxQuaternion ToQuaternion() const { return VxQuaternion(m_V.x, m_V.y, m_V.z, m_V.w); }
+
+    const VxVector4A &Vector() const { return m_V; }
+
+    VxQuaternionA operator*(const VxQuaternionA &q) const
+    {
+#if VX_SIMD_SSE
+        const __m128 p = m_V.m;
+        const __m128 r = q.m_V.m;
+        __m128 res = _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), r);
+        res = _mm_add_ps(res, _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(r, r, _MM_SHUFFLE(0, 1, 2, 3))), _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f)));
+        res = _mm_add_ps(res, _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 0, 3, 2))), _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f)));
+        res = _mm_add_ps(res, _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 3, 0, 1))), _mm_setr_ps(-1.0f, 1.0f, 1.0f, -1.0f)));
+        return VxQuaternionA(VxVector4A(res));
+#else
+        const VxVector4A &p = m_V;
+        const VxVector4A &r = q.m_V;
+        return VxQuaternionA(p.w * r.x + p.x * r.w + p.y * r.z - p.z * r.y,
+                             p.w * r.y - p.x * r.z + p.y * r.w + p.z * r.x,
+                             p.w * r.z + p.x * r.y - p.y * r.x + p.z * r.w,
+                             p.w * r.w - p.x * r.x - p.y * r.y - p.z * r.z);
+#endif
+    }
+
+    VxQuaternionA &operator*=(const VxQuaternionA &q) { return *this = *this * q; }
+
+    void Normalize()
+    {
+        float l = Dot4(m_V, m_V);
+        if (l > EPSILON)
+            m_V *= 1.0f / sqrtf(l);
+    }
+
+    /*************************************************
+    Summary: Spherical interpolation between two quaternions.
+
+    Remarks:
+        Takes the shortest path and switches to a linear
+    interpolation when the quaternions are very close.
+    *************************************************/
+    friend VxQuaternionA Slerp(float Theta, const VxQuaternionA &Quat1, const VxQuaternionA &Quat2)
+    {
+        float cosOmega = Dot4(Quat1.m_V, Quat2.m_V);
+        VxVector4A q2 = Quat2.m_V;
+        if (cosOmega < 0.0f)
+        {
+            cosOmega = -cosOmega;
+            q2 = -q2;
+        }
+
+        float k1, k2;
+        if (1.0f - cosOmega > 0.001f)
+        {
+            float omega = acosf(cosOmega);
+            float invSin = 1.0f / sinf(omega);
+            k1 = sinf((1.0f - Theta) * omega) * invSin;
+            k2 = sinf(Theta * omega) * invSin;
+        }
+        else
+        {
+            k1 = 1.0f - Theta;
+            k2 = Theta;
+        }
+        return VxQuaternionA(Quat1.m_V * k1 + q2 * k2);
+    }
+
+protected:
+    VxVector4A m_V;
+};
+
+#endif // VXALIGNEDTYPES_H
@@ -0,0 +1,498 @@
+#ifndef VXASYNCIO_H
+#define VXASYNCIO_H
+
+#include <string.h>
+#include <windows.h>
+
+#include "VxMathDefines.h"
+#include "VxThread.h"
+#include "VxSync.h"
+#include "VxAtomic.h"
+#include "XArray.h"
+#include "XString.h"
+
+/*************************************************
+Summary: State of a VxIORequest.
+
+See also: VxIORequest::GetState
+*************************************************/
+typedef enum VX_IO_STATE
+{
+    VX_IO_PENDING   = 0, // Waiting for its turn
+    VX_IO_READING   = 1, // A read is in progress
+    VX_IO_DONE      = 2, // All the data was read
+    VX_IO_FAILED    = 3, // The file could not be opened or read
+    VX_IO_CANCELLED = 4, // Cancelled before the end
+} VX_IO_STATE;
+
+/*************************************************
+Summary: Options of VxAsyncIO::Read.
+
+See also: VxAsyncIO::Read
+*************************************************/
+typedef enum VX_IO_FLAGS
+{
+    VX_IO_DEFAULT         = 0x00000000, // The callback is called by VxAsyncIO::Poll
+    VX_IO_CALLBACK_THREAD = 0x00000001, // The callback is called on the I/O thread, as soon as the read ends
+} VX_IO_FLAGS;
+
+class VxIORequest;
+
+/*************************************************
+Summary: Function called when a read ends (done, failed or cancelled).
+
+See also: VxAsyncIO::Read
+*************************************************/
+typedef void VxIOCallback(VxIORequest *request, void *arg);
+
+/*************************************************
+Summary: A read of VxAsyncIO.
+
+Remarks:
+    o The buffer (GetData) is valid until the request is released
+    (VxAsyncIO::Release), and is only complete in the VX_IO_DONE state.
+
+See also: VxAsyncIO
+*************************************************/
+class VxIORequest
+{
+public:
+    VX_IO_STATE GetState() const { return (VX_IO_STATE)VxAtomicLoad(&m_State); }
+    XBOOL IsFinished() const { return GetState() >= VX_IO_DONE; }
+
+    const char *GetPath() const { return m_Path.CStr(); }
+    XBYTE *GetData() const { return m_Buffer; }
+    // Bytes read, the size of the data once done.
+    XULONG GetSize() const { return m_Read; }
+    void *GetArg() const { return m_Arg; }
+    float GetPriority() const { return m_Priority; }
+
+protected:
+    friend class VxAsyncIO;
+
+    VxIORequest() : m_File(INVALID_HANDLE_VALUE), m_Offset(0), m_Size(0), m_Read(0), m_Buffer(NULL), m_OwnBuffer(FALSE),
+                    m_Priority(0.0f), m_Flags(0), m_Callback(NULL), m_Arg(NULL), m_State(VX_IO_PENDING), m_Cancel(0), m_Released(0)
+    {
+        memset(&m_Overlapped, 0, sizeof(m_Overlapped));
+    }
+
+    OVERLAPPED m_Overlapped; // first, the completions give its address
+    XString m_Path;
+    HANDLE m_File;
+    XULONG m_Offset; // in the file
+    XULONG m_Size;   // to read, 0 until the file is opened for a read to the end
+    XULONG m_Read;
+    XBYTE *m_Buffer;
+    XBOOL m_OwnBuffer;
+    float m_Priority;
+    XDWORD m_Flags;
+    VxIOCallback *m_Callback;
+    void *m_Arg;
+    volatile long m_State;
+    volatile long m_Cancel;
+    volatile long m_Released; // released while its callback waited for Poll
+};
+
+/****************************************************************
+Summary: Reads files asynchronously with an I/O completion port.
+
+Remarks:
+    o Read queues the read of a file (or a part of it) and returns at
+    once. The I/O threads open the files and read them with overlapped
+    reads in chunks of ChunkSize bytes: at most maxInFlight chunks are
+    read at the same time and the next chunk is always taken from the
+    request with the highest priority, so a large file does not hold back
+    a more urgent small one. SetPriority changes the priority of a request
+    which is not finished.
+    o When a read ends, its callback is called by the next Poll (on the
+    thread calling it, typically the main thread, which can then give the
+    data to CKContext::Load or a reader's ReadMemory) or, with
+    VX_IO_CALLBACK_THREAD, on the I/O thread at once (to start the
+    decoding on a job system, for example: it must not block the thread).
+    o A finished request must be released with Release, once its callback
+    has been called. A request with a VX_IO_CALLBACK_THREAD callback must
+    not be waited (Wait, IsFinished): the callback is its completion.
+    o The data is read into a buffer allocated by the request (aligned on
+    16 bytes) or into the buffer given to Read.
+    o Poll, and Release for the requests with a callback called by Poll,
+    must be called from the same thread. The requests still queued when
+    the VxAsyncIO is destroyed are cancelled, and the ones waiting for
+    Poll are freed.
+
+    VxAsyncIO io(1, 4);
+    VxIORequest *r = io.Read("Level.nmo", 10.0f, OnLevelRead, context);
+    ...
+    // each frame
+    io.Poll();
+
+    static void OnLevelRead(VxIORequest *r, void *arg)
+    {
+        if (r->GetState() == VX_IO_DONE)
+            ((CKContext *)arg)->Load(r->GetSize(), r->GetData(), list);
+        io.Release(r);
+    }
+
+See also: VxIORequest,VxMemoryMappedFile
+****************************************************************/
+class VxAsyncIO
+{
+public:
+    enum
+    {
+        ChunkSize = 1024 * 1024
+    };
+
+    VxAsyncIO(int threadCount = 1, int maxInFlight = 4) : m_MaxInFlight(XMax(maxInFlight, 1)), m_InFlight(0)
+    {
+        m_Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+        for (int i = 0; i < XMax(threadCount, 1); ++i)
+        {
+            Thread *t = new Thread(this);
+            t->SetName("Async I/O");
+            if (!t->CreateThread())
+            {
+                delete t;
+                break;
+            }
+            m_Threads.PushBack(t);
+        }
+    }
+
+    ~VxAsyncIO()
+    {
+        // pending requests are cancelled, reads in progress end
+        {
+            VxSpinLockScope lock(m_Lock);
+            for (int i = 0; i < m_Pending.Size(); ++i)
+                VxAtomicStore(&m_Pending[i]->m_Cancel, 1);
+        }
+        while (VxAtomicLoad(&m_InFlight) > 0)
+        {
+            Kick();
+            Sleep(1);
+        }
+        for (int i = 0; i < m_Threads.Size(); ++i)
+            PostQueuedCompletionStatus(m_Port, 0, KeyStop, NULL);
+        for (int i = 0; i < m_Threads.Size(); ++i)
+        {
+            m_Threads[i]->Wait();
+            delete m_Threads[i];
+        }
+        for (int i = 0; i < m_Pending.Size(); ++i)
+            Finish(m_Pending[i], VX_IO_CANCELLED);
+        for (int i = 0; i < m_Completed.Size(); ++i)
+            Free(m_Completed[i]);
+        CloseHandle(m_Port);
+    }
+
+    //---------------------------------------------
+    // Requests
+
+    /*************************************************
+    Summary: Queues the read of a file.
+
+    Arguments:
+        path: File to read.
+        priority: Requests with the highest priority are read first.
+        callback: Function called when the read ends, NULL for none.
+        arg: Argument given to the callback.
+        flags: VX_IO_FLAGS.
+        offset: Position of the first byte to read.
+        size: Number of bytes to read, 0 to read to the end of the file.
+        buffer: Buffer of size bytes receiving the data, NULL to allocate it.
+    Return Value:
+        The request, to give to Release.
+    *************************************************/
+    VxIORequest *Read(const char *path, float priority = 0.0f, VxIOCallback *callback = NULL, void *arg = NULL,
+                      XDWORD flags = VX_IO_DEFAULT, XULONG offset = 0, XULONG size = 0, void *buffer = NULL)
+    {
+        VxIORequest *r = new VxIORequest;
+        r->m_Path = path;
+        r->m_Priority = priority;
+        r->m_Callback = callback;
+        r->m_Arg = arg;
+        r->m_Flags = flags;
+        r->m_Offset = offset;
+        r->m_Size = size;
+        r->m_Buffer = (XBYTE *)buffer; // NULL: allocated once the file is open
+        {
+            VxSpinLockScope lock(m_Lock);
+            m_Pending.PushBack(r);
+        }
+        Kick();
+        return r;
+    }
+
+    void SetPriority(VxIORequest *r, float priority)
+    {
+        VxSpinLockScope lock(m_Lock);
+        r->m_Priority = priority;
+    }
+
+    // Cancels a request which is not finished, the current chunk of a request being read ends first.
+    void Cancel(VxIORequest *r)
+    {
+        VxAtomicStore(&r->m_Cancel, 1);
+        Kick();
+    }
+
+    // Waits for a request without a VX_IO_CALLBACK_THREAD callback, FALSE on time out.
+    XBOOL Wait(VxIORequest *r, XULONG timeout = INFINITE)
+    {
+        const XULONG start = GetTickCount();
+        VxSpinWait wait;
+        while (!r->IsFinished())
+        {
+            if (timeout != INFINITE && GetTickCount() - start >= timeout)
+                return FALSE;
+            wait.Spin();
+        }
+        return TRUE;
+    }
+
+    // Frees a finished request and its buffer (if allocated by the request).
+    void Release(VxIORequest *r)
+    {
+        if (!r)
+            return;
+        {
+            VxSpinLockScope lock(m_Lock);
+            for (int i = 0; i < m_Completed.Size(); ++i)
+            {
+                if (m_Completed[i] == r)
+                {
+                    // the callback is still to be called by Poll, which frees it
+                    VxAtomicStore(&r->m_Released, 1);
+                    return;
+                }
+            }
+        }
+        Free(r);
+    }
+
+    /*************************************************
+    Summary: Calls the callbacks of the requests ended since the last call.
+
+    Return Value:
+        Number of callbacks called.
+    *************************************************/
+    int Poll()
+    {
+        {
+            VxSpinLockScope lock(m_Lock);
+            m_Polled.Swap(m_Completed);
+        }
+        int count = 0;
+        for (int i = 0; i < m_Polled.Size(); ++i)
+        {
+            VxIORequest *r = m_Polled[i];
+            if (VxAtomicLoad(&r->m_Released))
+            {
+                Free(r);
+                continue;
+            }
+            r->m_Callback(r, r->m_Arg);
+            ++count;
+        }
+        m_Polled.Resize(0);
+        return count;
+    }
+
+    // Requests waiting for a read.
+    int GetPendingCount()
+    {
+        VxSpinLockScope lock(m_Lock);
+        return m_Pending.Size();
+    }
+
+    int GetInFlightCount() const { return VxAtomicLoad(&m_InFlight); }
+
+protected:
+    enum
+    {
+        KeyRead = 0,
+        KeyKick = 1,
+        KeyStop = 2
+    };
+
+    class Thread : public VxThread
+    {
+    public:
+        explicit Thread(VxAsyncIO *io) : m_IO(io) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_IO->ThreadLoop();
+            return VXT_OK;
+        }
+
+        VxAsyncIO *m_IO;
+    };
+    friend class Thread;
+
+    void Kick() { PostQueuedCompletionStatus(m_Port, 0, KeyKick, NULL); }
+
+    void ThreadLoop()
+    {
+        for (;;)
+        {
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            OVERLAPPED *overlapped = NULL;
+            const BOOL ok = GetQueuedCompletionStatus(m_Port, &bytes, &key, &overlapped, INFINITE);
+            if (key == KeyStop)
+                return;
+            if (overlapped)
+                Completed((VxIORequest *)overlapped, ok ? bytes : 0, ok || GetLastError() == ERROR_HANDLE_EOF);
+            Issue();
+        }
+    }
+
+    // Starts chunk reads while there is room, highest priority first.
+    void Issue()
+    {
+        for (;;)
+        {
+            VxIORequest *r = NULL;
+            {
+                VxSpinLockScope lock(m_Lock);
+                if (VxAtomicLoad(&m_InFlight) >= m_MaxInFlight || !m_Pending.Size())
+                    return;
+                int best = 0;
+                for (int i = 0; i < m_Pending.Size(); ++i)
+                {
+                    if (m_Pending[i]->m_Cancel)
+                    {
+                        best = i;
+                        break;
+                    }
+                    if (m_Pending[i]->m_Priority > m_Pending[best]->m_Priority)
+                        best = i;
+                }
+                r = m_Pending[best];
+                m_Pending.RemoveAt(best);
+                VxAtomicIncrement(&m_InFlight);
+            }
+            if (VxAtomicLoad(&r->m_Cancel))
+            {
+                VxAtomicDecrement(&m_InFlight);
+                Finish(r, VX_IO_CANCELLED);
+            }
+            else if (!Start(r))
+            {
+                VxAtomicDecrement(&m_InFlight);
+                Finish(r, VX_IO_FAILED);
+            }
+        }
+    }
+
+    // Reads the next chunk of a request, opening its file the first time.
+    XBOOL Start(VxIORequest *r)
+    {
+        if (r->m_File == INVALID_HANDLE_VALUE)
+        {
+            r->m_File = CreateFileA(r->m_Path.CStr(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (r->m_File == INVALID_HANDLE_VALUE)
+                return FALSE;
+            if (!CreateIoCompletionPort(r->m_File, m_Port, KeyRead, 0))
+                return FALSE;
+            if (!r->m_Buffer)
+            {
+                LARGE_INTEGER fileSize;
+                if (!GetFileSizeEx(r->m_File, &fileSize) || fileSize.QuadPart < (LONGLONG)r->m_Offset)
+                    return FALSE;
+                const XULONG left = (XULONG)(fileSize.QuadPart - r->m_Offset);
+                r->m_Size = r->m_Size ? XMin(r->m_Size, left) : left;
+                r->m_Buffer = (XBYTE *)VxNewAligned(XMax(r->m_Size, (XULONG)1), 16);
+                r->m_OwnBuffer = TRUE;
+            }
+        }
+        if (r->m_Read >= r->m_Size)
+        {
+            // nothing (left) to read, complete it through the port
+            VxAtomicStore(&r->m_State, VX_IO_READING);
+            return PostQueuedCompletionStatus(m_Port, 0, KeyRead, &r->m_Overlapped) != 0;
+        }
+        const XULONG position = r->m_Offset + r->m_Read;
+        memset(&r->m_Overlapped, 0, sizeof(r->m_Overlapped));
+        r->m_Overlapped.Offset = position;
+        VxAtomicStore(&r->m_State, VX_IO_READING);
+        const DWORD chunk = XMin(r->m_Size - r->m_Read, (XULONG)ChunkSize);
+        if (!ReadFile(r->m_File, r->m_Buffer + r->m_Read, chunk, NULL, &r->m_Overlapped) && GetLastError() != ERROR_IO_PENDING)
+            return FALSE;
+        return TRUE;
+    }
+
+    // A chunk ended (I/O thread).
+    void Completed(VxIORequest *r, XULONG bytes, XBOOL ok)
+    {
+        VxAtomicDecrement(&m_InFlight);
+        if (!ok)
+        {
+            Finish(r, VX_IO_FAILED);
+            return;
+        }
+        r->m_Read += bytes;
+        if (r->m_Read >= r->m_Size || bytes == 0)
+        {
+            r->m_Size = r->m_Read; // shorter if the end of the file was reached
+            Finish(r, VX_IO_DONE);
+            return;
+        }
+        if (VxAtomicLoad(&r->m_Cancel))
+        {
+            Finish(r, VX_IO_CANCELLED);
+            return;
+        }
+        VxAtomicStore(&r->m_State, VX_IO_PENDING);
+        VxSpinLockScope lock(m_Lock);
+        m_Pending.PushBack(r);
+    }
+
+    void Finish(VxIORequest *r, VX_IO_STATE state)
+    {
+        if (r->m_File != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(r->m_File);
+            r->m_File = INVALID_HANDLE_VALUE;
+        }
+        if (r->m_Callback && (r->m_Flags & VX_IO_CALLBACK_THREAD))
+        {
+            VxAtomicStore(&r->m_State, state);
+            r->m_Callback(r, r->m_Arg);
+            return;
+        }
+        if (r->m_Callback)
+        {
+            // Poll can run the callback and free r as soon as it is pushed
+            VxSpinLockScope lock(m_Lock);
+            VxAtomicStore(&r->m_State, state);
+            m_Completed.PushBack(r);
+            return;
+        }
+        VxAtomicStore(&r->m_State, state);
+    }
+
+    static void Free(VxIORequest *r)
+    {
+        if (r->m_OwnBuffer)
+            VxDeleteAligned(r->m_Buffer);
+        delete r;
+    }
+
+    HANDLE m_Port;
+    int m_MaxInFlight;
+    volatile long m_InFlight;
+    VxSpinLock m_Lock;
+    XArray<VxIORequest *> m_Pending;
+    XArray<VxIORequest *> m_Completed; // waiting for Poll
+    XArray<VxIORequest *> m_Polled;
+    XArray<Thread *> m_Threads;
+
+private:
+    VxAsyncIO(const VxAsyncIO &);
+    VxAsyncIO &operator=(const VxAsyncIO &);
+};
+
+#endif // VXASYNCIO_H
@@ -0,0 +1,371 @@
+#ifndef VXATOMIC_H
+#define VXATOMIC_H
+
+#include "VxMathDefines.h"
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+#include <intrin.h>
+#pragma intrinsic(_InterlockedCompareExchange, _InterlockedExchange, _InterlockedExchangeAdd, _ReadWriteBarrier)
+#endif
+
+/*************************************************
+{filename:VxAtomic}
+Summary: Atomic operations on 32 bits integers and pointers.
+
+Remarks:
+    o All the operations are full memory barriers.
+    o The values must be naturally aligned.
+    o On Visual C++ 6 (without intrinsics) the operations are
+    implemented with lock prefixed instructions.
+    o VxAtomicLong and VxAtomicPointer wrap them with an ordering
+    parameter on the loads and stores.
+
+See also: VxMutex,VxThread,VxSpinLock,VxAtomicLong
+*************************************************/
+
+/*************************************************
+Summary: Atomically compares *dest with comparand and replaces it by exchange if they are equal.
+
+Return Value:
+    The initial value of *dest.
+*************************************************/
+inline long VxAtomicCompareExchange(volatile long *dest, long exchange, long comparand)
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    return _InterlockedCompareExchange(dest, exchange, comparand);
+#elif defined(__GNUC__)
+    return __sync_val_compare_and_swap(dest, comparand, exchange);
+#else
+    long result;
+    __asm
+    {
+        mov ecx, dest
+        mov edx, exchange
+        mov eax, comparand
+        lock cmpxchg [ecx], edx
+        mov result, eax
+    }
+    return result;
+#endif
+}
+
+/*************************************************
+Summary: Atomically adds value to *dest.
+
+Return Value:
+    The initial value of *dest.
+*************************************************/
+inline long VxAtomicExchangeAdd(volatile long *dest, long value)
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    return _InterlockedExchangeAdd(dest, value);
+#elif defined(__GNUC__)
+    return __sync_fetch_and_add(dest, value);
+#else
+    long result;
+    __asm
+    {
+        mov ecx, dest
+        mov eax, value
+        lock xadd [ecx], eax
+        mov result, eax
+    }
+    return result;
+#endif
+}
+
+/*************************************************
+Summary: Atomically replaces *dest by value.
+
+Return Value:
+    The initial value of *dest.
+*************************************************/
+inline long VxAtomicExchange(volatile long *dest, long value)
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    return _InterlockedExchange(dest, value);
+#elif defined(__GNUC__)
+    __sync_synchronize();
+    return __sync_lock_test_and_set(dest, value);
+#else
+    long result;
+    __asm
+    {
+        mov ecx, dest
+        mov eax, value
+        xchg [ecx], eax
+        mov result, eax
+    }
+    return result;
+#endif
+}
+
+// Atomically increments *dest and returns the new value.
+inline long VxAtomicIncrement(volatile long *dest)
+{
+    return VxAtomicExchangeAdd(dest, 1) + 1;
+}
+
+// Atomically decrements *dest and returns the new value.
+inline long VxAtomicDecrement(volatile long *dest)
+{
+    return VxAtomicExchangeAdd(dest, -1) - 1;
+}
+
+// Prevents the compiler and the processor from reordering memory accesses across the call.
+inline void VxMemoryBarrier()
+{
+    long dummy = 0;
+    VxAtomicExchange(&dummy, 0);
+}
+
+// Reads *src with acquire semantic.
+inline long VxAtomicLoad(const volatile long *src)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+#else
+    long value = *src;
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    _ReadWriteBarrier();
+#endif
+    return value;
+#endif
+}
+
+// Writes value to *dest with release semantic.
+inline void VxAtomicStore(volatile long *dest, long value)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(dest, value, __ATOMIC_RELEASE);
+#else
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    _ReadWriteBarrier();
+#endif
+    *dest = value;
+#endif
+}
+
+// Reads *src with acquire semantic.
+inline void *VxAtomicLoadPointer(void *const volatile *src)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+#else
+    void *value = *src;
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    _ReadWriteBarrier();
+#endif
+    return value;
+#endif
+}
+
+/*************************************************
+Summary: Atomically compares *dest with comparand and replaces it by exchange if they are equal.
+
+Return Value:
+    The initial value of *dest.
+*************************************************/
+inline void *VxAtomicCompareExchangePointer(void *volatile *dest, void *exchange, void *comparand)
+{
+#if defined(__GNUC__)
+    return __sync_val_compare_and_swap(dest, comparand, exchange);
+#elif defined(_M_X64)
+    return _InterlockedCompareExchangePointer(dest, exchange, comparand);
+#else
+    return (void *)VxAtomicCompareExchange((volatile long *)dest, (long)exchange, (long)comparand);
+#endif
+}
+
+/*************************************************
+Summary: Atomically replaces *dest by value.
+
+Return Value:
+    The initial value of *dest.
+*************************************************/
+inline void *VxAtomicExchangePointer(void *volatile *dest, void *value)
+{
+#if defined(__GNUC__)
+    __sync_synchronize();
+    return __sync_lock_test_and_set(dest, value);
+#elif defined(_M_X64)
+    return _InterlockedExchangePointer(dest, value);
+#else
+    return (void *)VxAtomicExchange((volatile long *)dest, (long)value);
+#endif
+}
+
+// Hints the processor that the thread is spinning in a wait loop.
+inline void VxSpinPause()
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    _mm_pause();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    __builtin_ia32_pause();
+#elif defined(_MSC_VER) && defined(_M_IX86)
+    __asm { rep nop }
+#endif
+}
+
+/*************************************************
+Summary: Ordering constraint of an operation of VxAtomicLong and VxAtomicPointer.
+
+Remarks:
+    o The read-modify-write operations are always full barriers (lock
+    prefixed on x86), the order only changes the loads and the stores.
+    o VX_ORDER_RELAXED loads and stores are plain volatile accesses,
+    acquire loads and release stores only prevent the compiler from moving
+    accesses across them, VX_ORDER_SEQ_CST stores are exchanges.
+
+See also: VxAtomicLong,VxAtomicPointer
+*************************************************/
+typedef enum VX_MEMORY_ORDER
+{
+    VX_ORDER_RELAXED = 0,
+    VX_ORDER_ACQUIRE = 1,
+    VX_ORDER_RELEASE = 2,
+    VX_ORDER_ACQ_REL = 3,
+    VX_ORDER_SEQ_CST = 4
+} VX_MEMORY_ORDER;
+
+/*************************************************
+Summary: 32 bits integer with atomic operations.
+
+See also: VX_MEMORY_ORDER,VxAtomicPointer
+*************************************************/
+class VxAtomicLong
+{
+public:
+    explicit VxAtomicLong(long value = 0) : m_Value(value) {}
+
+    long Load(VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST) const
+    {
+        if (order == VX_ORDER_RELAXED)
+            return m_Value;
+        return VxAtomicLoad(&m_Value);
+    }
+
+    void Store(long value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST)
+    {
+        if (order == VX_ORDER_RELAXED)
+            m_Value = value;
+        else if (order == VX_ORDER_SEQ_CST)
+            VxAtomicExchange(&m_Value, value);
+        else
+            VxAtomicStore(&m_Value, value);
+    }
+
+    // The following operations return the previous value.
+    long Exchange(long value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST) { return VxAtomicExchange(&m_Value, value); }
+    long FetchAdd(long value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST) { return VxAtomicExchangeAdd(&m_Value, value); }
+    long FetchSub(long value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST) { return VxAtomicExchangeAdd(&m_Value, -value); }
+
+    long FetchOr(long value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST)
+    {
+        long old = m_Value;
+        for (;;)
+        {
+            long seen = VxAtomicCompareExchange(&m_Value, old | value, old);
+            if (seen == old)
+                return old;
+            old = seen;
+        }
+    }
+
+    long FetchAnd(long value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST)
+    {
+        long old = m_Value;
+        for (;;)
+        {
+            long seen = VxAtomicCompareExchange(&m_Value, old & value, old);
+            if (seen == old)
+                return old;
+            old = seen;
+        }
+    }
+
+    // Replaces the value by desired if it is expected, otherwise returns FALSE and sets expected to the current value.
+    XBOOL CompareExchange(long &expected, long desired, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST)
+    {
+        long seen = VxAtomicCompareExchange(&m_Value, desired, expected);
+        if (seen == expected)
+            return TRUE;
+        expected = seen;
+        return FALSE;
+    }
+
+    // Returns the new value.
+    long operator++() { return VxAtomicIncrement(&m_Value); }
+    long operator--() { return VxAtomicDecrement(&m_Value); }
+
+    operator long() const { return Load(); }
+
+protected:
+    volatile long m_Value;
+
+private:
+    VxAtomicLong(const VxAtomicLong &);
+    VxAtomicLong &operator=(const VxAtomicLong &);
+};
+
+/*************************************************
+Summary: Pointer with atomic operations.
+
+See also: VX_MEMORY_ORDER,VxAtomicLong
+*************************************************/
+template <class T>
+class VxAtomicPointer
+{
+public:
+    explicit VxAtomicPointer(T *value = NULL) : m_Value(value) {}
+
+    T *Load(VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST) const
+    {
+        if (order == VX_ORDER_RELAXED)
+            return (T *)m_Value;
+        return (T *)VxAtomicLoadPointer(&m_Value);
+    }
+
+    void Store(T *value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST)
+    {
+        if (order == VX_ORDER_RELAXED)
+        {
+            m_Value = value;
+        }
+        else if (order == VX_ORDER_SEQ_CST)
+        {
+            VxAtomicExchangePointer(&m_Value, value);
+        }
+        else
+        {
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+            _ReadWriteBarrier();
+#elif defined(__GNUC__)
+            __asm__ __volatile__("" ::: "memory");
+#endif
+            m_Value = value;
+        }
+    }
+
+    // Returns the previous value.
+    T *Exchange(T *value, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST) { return (T *)VxAtomicExchangePointer(&m_Value, value); }
+
+    // Replaces the value by desired if it is expected, otherwise returns FALSE and sets expected to the current value.
+    XBOOL CompareExchange(T *&expected, T *desired, VX_MEMORY_ORDER order = VX_ORDER_SEQ_CST)
+    {
+        T *seen = (T *)VxAtomicCompareExchangePointer(&m_Value, desired, expected);
+        if (seen == expected)
+            return TRUE;
+        expected = seen;
+        return FALSE;
+    }
+
+protected:
+    void *volatile m_Value;
+
+private:
+    VxAtomicPointer(const VxAtomicPointer &);
+    VxAtomicPointer &operator=(const VxAtomicPointer &);
+};
+
+#endif // VXATOMIC_H
@@ -0,0 +1,515 @@
+#ifndef VXBATCHMATH_H
+#define VXBATCHMATH_H
+
+#include "VxMatrix.h"
+#include "VxSIMD.h"
+
+/*************************************************
+{filename:VxBatchMath}
+Summary: Inline kernels working on arrays of vectors.
+
+Remarks:
+    o The SoA versions take the x, y and z components in separate arrays,
+    the layout used by skinning and particles systems.
+    o The AoS versions take packed VxVector arrays (stride of sizeof(VxVector)).
+    Use Vx3DMultiplyMatrixVectorMany or the Strided versions for other strides.
+    o The kernels process 4 vectors at a time with SSE when VxHasSSE
+    returns TRUE and fall back to scalar code otherwise.
+    o Results can be written over the source arrays.
+
+See also: Vx3DMultiplyMatrixVectorMany,Vx3DRotateVectorMany,VxSIMD
+*************************************************/
+
+#if VX_SIMD_SSE
+// {secret}
+inline void VxSSETransform3(__m128 &x, __m128 &y, __m128 &z, const VxMatrix &Mat, XBOOL iTranslate)
+{
+    __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(Mat[0][0])), _mm_mul_ps(y, _mm_set1_ps(Mat[1][0]))), _mm_mul_ps(z, _mm_set1_ps(Mat[2][0])));
+    __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(Mat[0][1])), _mm_mul_ps(y, _mm_set1_ps(Mat[1][1]))), _mm_mul_ps(z, _mm_set1_ps(Mat[2][1])));
+    __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(Mat[0][2])), _mm_mul_ps(y, _mm_set1_ps(Mat[1][2]))), _mm_mul_ps(z, _mm_set1_ps(Mat[2][2])));
+    if (iTranslate)
+    {
+        rx = _mm_add_ps(rx, _mm_set1_ps(Mat[3][0]));
+        ry = _mm_add_ps(ry, _mm_set1_ps(Mat[3][1]));
+        rz = _mm_add_ps(rz, _mm_set1_ps(Mat[3][2]));
+    }
+    x = rx;
+    y = ry;
+    z = rz;
+}
+#endif
+
+// {secret}
+inline void VxTransform3SoA(float *rx, float *ry, float *rz, const VxMatrix &Mat, const float *x, const float *y, const float *z, int count, XBOOL iTranslate)
+{
+    int i = 0;
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 vx = _mm_loadu_ps(x + i);
+            __m128 vy = _mm_loadu_ps(y + i);
+            __m128 vz = _mm_loadu_ps(z + i);
+            VxSSETransform3(vx, vy, vz, Mat, iTranslate);
+            _mm_storeu_ps(rx + i, vx);
+            _mm_storeu_ps(ry + i, vy);
+            _mm_storeu_ps(rz + i, vz);
+        }
+    }
+#endif
+    const float tx = iTranslate ? Mat[3][0] : 0.0f;
+    const float ty = iTranslate ? Mat[3][1] : 0.0f;
+    const float tz = iTranslate ? Mat[3][2] : 0.0f;
+    for (; i < count; ++i)
+    {
+        const float vx = x[i], vy = y[i], vz = z[i];
+        rx[i] = Mat[0][0] * vx + Mat[1][0] * vy + Mat[2][0] * vz + tx;
+        ry[i] = Mat[0][1] * vx + Mat[1][1] * vy + Mat[2][1] * vz + ty;
+        rz[i] = Mat[0][2] * vx + Mat[1][2] * vy + Mat[2][2] * vz + tz;
+    }
+}
+
+/*************************************************
+Summary: Multiplies count points given as separate x,y,z arrays by a matrix.
+
+Remarks:
+    The result arrays can be the source arrays.
+See also: Vx3DRotateVectorSoA,Vx3DMultiplyMatrixVectorBatch
+*************************************************/
+inline void Vx3DMultiplyMatrixVectorSoA(float *ResX, float *ResY, float *ResZ, const VxMatrix &Mat, const float *X, const float *Y, const float *Z, int count)
+{
+    VxTransform3SoA(ResX, ResY, ResZ, Mat, X, Y, Z, count, TRUE);
+}
+
+/*************************************************
+Summary: Rotates count vectors given as separate x,y,z arrays by a matrix (translation is ignored).
+
+See also: Vx3DMultiplyMatrixVectorSoA,Vx3DRotateVectorBatch
+*************************************************/
+inline void Vx3DRotateVectorSoA(float *ResX, float *ResY, float *ResZ, const VxMatrix &Mat, const float *X, const float *Y, const float *Z, int count)
+{
+    VxTransform3SoA(ResX, ResY, ResZ, Mat, X, Y, Z, count, FALSE);
+}
+
+/*************************************************
+Summary: Multiplies count packed vectors by a matrix.
+
+Remarks:
+    Same result as Vx3DMultiplyMatrixVectorMany with a stride of sizeof(VxVector).
+See also: Vx3DMultiplyMatrixVectorMany,Vx3DMultiplyMatrixVectorSoA
+*************************************************/
+inline void Vx3DMultiplyMatrixVectorBatch(VxVector *ResultVectors, const VxMatrix &Mat, const VxVector *Vectors, int count)
+{
+    int i = 0;
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 x, y, z;
+            VxSSELoadVector3x4(&Vectors[i].x, x, y, z);
+            VxSSETransform3(x, y, z, Mat, TRUE);
+            VxSSEStoreVector3x4(&ResultVectors[i].x, x, y, z);
+        }
+    }
+#endif
+    if (i < count)
+        Vx3DMultiplyMatrixVectorMany(ResultVectors + i, Mat, Vectors + i, count - i, sizeof(VxVector));
+}
+
+/*************************************************
+Summary: Rotates count packed vectors by a matrix (translation is ignored).
+
+Remarks:
+    Same result as Vx3DRotateVectorMany with a stride of sizeof(VxVector).
+See also: Vx3DRotateVectorMany,Vx3DRotateVectorSoA
+*************************************************/
+inline void Vx3DRotateVectorBatch(VxVector *ResultVectors, const VxMatrix &Mat, const VxVector *Vectors, int count)
+{
+    int i = 0;
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 x, y, z;
+            VxSSELoadVector3x4(&Vectors[i].x, x, y, z);
+            VxSSETransform3(x, y, z, Mat, FALSE);
+            VxSSEStoreVector3x4(&ResultVectors[i].x, x, y, z);
+        }
+    }
+#endif
+    if (i < count)
+        Vx3DRotateVectorMany(ResultVectors + i, Mat, Vectors + i, count - i, sizeof(VxVector));
+}
+
+#if VX_SIMD_SSE
+// {secret}
+inline __m128 VxSSECross3(__m128 a, __m128 b)
+{
+    __m128 r = _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))),
+                          _mm_mul_ps(b, _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1))));
+    return _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// {secret}
+inline __m128 VxSSEDot3(__m128 a, __m128 b)
+{
+    __m128 m = _mm_mul_ps(a, b);
+    return _mm_add_ss(_mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(m, m));
+}
+
+// {secret}
+// Writes the inverse of the affine matrix whose 3x3 inverse has the rows r0,r1,r2.
+inline void VxSSEStoreAffineInverse(float *oMat, __m128 r0, __m128 r1, __m128 r2, const float *translation)
+{
+    __m128 r3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, _mm_set1_ps(translation[0])),
+                                     _mm_mul_ps(r1, _mm_set1_ps(translation[1]))),
+                          _mm_mul_ps(r2, _mm_set1_ps(translation[2])));
+    t = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), t);
+    _mm_storeu_ps(oMat, r0);
+    _mm_storeu_ps(oMat + 4, r1);
+    _mm_storeu_ps(oMat + 8, r2);
+    _mm_storeu_ps(oMat + 12, t);
+}
+#endif
+
+/*************************************************
+Summary: Multiplies count pairs of matrices.
+
+Remarks:
+    ResultMat[i] = MatA[i] * MatB[i], same as Vx3DMultiplyMatrix: the
+last column of the matrices is considered to be (0,0,0,1).
+    A result matrix can be one of its source matrices.
+See also: Vx3DMultiplyMatrix,Vx3DMultiplyMatrix4Batch
+*************************************************/
+inline void Vx3DMultiplyMatrixBatch(VxMatrix *ResultMat, const VxMatrix *MatA, const VxMatrix *MatB, int count)
+{
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const float *a = &MatA[i][0][0];
+            const float *b = &MatB[i][0][0];
+            __m128 a0 = _mm_loadu_ps(a);
+            __m128 a1 = _mm_loadu_ps(a + 4);
+            __m128 a2 = _mm_loadu_ps(a + 8);
+            __m128 a3 = _mm_loadu_ps(a + 12);
+            __m128 r[4];
+            for (int c = 0; c < 4; ++c)
+            {
+                const float *bc = b + 4 * c;
+                r[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bc[0])), _mm_mul_ps(a1, _mm_set1_ps(bc[1]))),
+                                  _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+            }
+            r[3] = _mm_add_ps(r[3], a3);
+            float *res = &ResultMat[i][0][0];
+            for (int k = 0; k < 4; ++k)
+                _mm_storeu_ps(res + 4 * k, r[k]);
+            res[3] = res[7] = res[11] = 0.0f;
+            res[15] = 1.0f;
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+        Vx3DMultiplyMatrix(ResultMat[i], MatA[i], MatB[i]);
+}
+
+/*************************************************
+Summary: Multiplies count pairs of 4x4 matrices.
+
+Remarks:
+    ResultMat[i] = MatA[i] * MatB[i], same as Vx3DMultiplyMatrix4.
+    A result matrix can be one of its source matrices.
+See also: Vx3DMultiplyMatrix4,Vx3DMultiplyMatrixBatch
+*************************************************/
+inline void Vx3DMultiplyMatrix4Batch(VxMatrix *ResultMat, const VxMatrix *MatA, const VxMatrix *MatB, int count)
+{
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const float *a = &MatA[i][0][0];
+            const float *b = &MatB[i][0][0];
+            __m128 a0 = _mm_loadu_ps(a);
+            __m128 a1 = _mm_loadu_ps(a + 4);
+            __m128 a2 = _mm_loadu_ps(a + 8);
+            __m128 a3 = _mm_loadu_ps(a + 12);
+            __m128 r[4];
+            for (int c = 0; c < 4; ++c)
+            {
+                const float *bc = b + 4 * c;
+                r[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bc[0])), _mm_mul_ps(a1, _mm_set1_ps(bc[1]))),
+                                  _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(bc[2])), _mm_mul_ps(a3, _mm_set1_ps(bc[3]))));
+            }
+            float *res = &ResultMat[i][0][0];
+            for (int k = 0; k < 4; ++k)
+                _mm_storeu_ps(res + 4 * k, r[k]);
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+        Vx3DMultiplyMatrix4(ResultMat[i], MatA[i], MatB[i]);
+}
+
+/*************************************************
+Summary: Inverts count affine matrices.
+
+Remarks:
+    The matrices must have a last column of (0,0,0,1), as the world
+matrices of the 3D entities. Singular matrices are given to
+Vx3DInverseMatrix.
+    InverseMat can be Mat.
+See also: Vx3DInverseMatrix,Vx3DInverseMatrixRigidBatch
+*************************************************/
+inline void Vx3DInverseMatrixBatch(VxMatrix *InverseMat, const VxMatrix *Mat, int count)
+{
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const float *m = &Mat[i][0][0];
+            __m128 c0 = _mm_loadu_ps(m);
+            __m128 c1 = _mm_loadu_ps(m + 4);
+            __m128 c2 = _mm_loadu_ps(m + 8);
+
+            // the rows of the inverse are the cross products of the columns divided by the determinant
+            __m128 r0 = VxSSECross3(c1, c2);
+            float det;
+            _mm_store_ss(&det, VxSSEDot3(c0, r0));
+            if (XFabs(det) < EPSILON)
+            {
+                Vx3DInverseMatrix(InverseMat[i], Mat[i]);
+                continue;
+            }
+            __m128 invDet = _mm_set1_ps(1.0f / det);
+            r0 = _mm_mul_ps(r0, invDet);
+            __m128 r1 = _mm_mul_ps(VxSSECross3(c2, c0), invDet);
+            __m128 r2 = _mm_mul_ps(VxSSECross3(c0, c1), invDet);
+
+            float t[3] = {m[12], m[13], m[14]};
+            VxSSEStoreAffineInverse(&InverseMat[i][0][0], r0, r1, r2, t);
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+        Vx3DInverseMatrix(InverseMat[i], Mat[i]);
+}
+
+/*************************************************
+Summary: Inverts count rigid transformation matrices.
+
+Remarks:
+    The matrices must only contain a rotation and a translation
+(orthonormal axes, no scale): the inverse is then the transposed
+rotation with the translation rotated back, which is much cheaper
+than a full inversion.
+    InverseMat can be Mat.
+See also: Vx3DInverseMatrixBatch,Vx3DInverseMatrix
+*************************************************/
+inline void Vx3DInverseMatrixRigidBatch(VxMatrix *InverseMat, const VxMatrix *Mat, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const float *m = &Mat[i][0][0];
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            float t[3] = {m[12], m[13], m[14]};
+            VxSSEStoreAffineInverse(&InverseMat[i][0][0], _mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), t);
+            continue;
+        }
+#endif
+        VxMatrix inv;
+        for (int r = 0; r < 3; ++r)
+        {
+            inv[r][0] = m[r];
+            inv[r][1] = m[4 + r];
+            inv[r][2] = m[8 + r];
+            inv[r][3] = 0.0f;
+        }
+        for (int c = 0; c < 3; ++c)
+            inv[3][c] = -(m[12] * inv[0][c] + m[13] * inv[1][c] + m[14] * inv[2][c]);
+        inv[3][3] = 1.0f;
+        InverseMat[i] = inv;
+    }
+}
+
+#if VX_SIMD_SSE
+// {secret}
+// Replaces the x,y,z components at dst by v, keeping the float which follows them.
+// 16 bytes are read and written: dst must not be the last vector of its buffer.
+inline void VxSSEStoreVector3(float *dst, __m128 v)
+{
+    __m128 t = _mm_shuffle_ps(v, _mm_loadu_ps(dst), _MM_SHUFFLE(3, 3, 2, 2)); // z z w w
+    _mm_storeu_ps(dst, _mm_shuffle_ps(v, t, _MM_SHUFFLE(2, 0, 1, 0)));
+}
+#endif
+
+/*************************************************
+Summary: Linear interpolation of two float arrays.
+
+Remarks:
+    Res[i] = A[i] + (B[i] - A[i]) * factor
+    Res can be A or B.
+See also: InterpolateFloatArray,VxInterpolateVectorArray
+*************************************************/
+inline void VxInterpolateFloatArray(float *Res, const float *A, const float *B, float factor, int count)
+{
+    int i = 0;
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        const __m128 f = _mm_set1_ps(factor);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 a = _mm_loadu_ps(A + i);
+            _mm_storeu_ps(Res + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(B + i), a), f)));
+        }
+    }
+#endif
+    for (; i < count; ++i)
+        Res[i] = A[i] + (B[i] - A[i]) * factor;
+}
+
+/*************************************************
+Summary: Linear interpolation of two vector arrays.
+
+Remarks:
+    Res[i] = A[i] + (B[i] - A[i]) * factor
+    A and B share the StrideIn stride. Vectors are processed with SSE
+when they are packed or when the strides leave room for 4 floats
+per element (vertex formats with normals or texture coordinates).
+    Res can be A or B.
+See also: InterpolateVectorArray,VxInterpolateFloatArray
+*************************************************/
+inline void VxInterpolateVectorArray(void *Res, const void *A, const void *B, float factor, int count, XULONG StrideRes, XULONG StrideIn)
+{
+    if (StrideRes == sizeof(VxVector) && StrideIn == sizeof(VxVector))
+    {
+        VxInterpolateFloatArray((float *)Res, (const float *)A, (const float *)B, factor, count * 3);
+        return;
+    }
+
+    XBYTE *res = (XBYTE *)Res;
+    const XBYTE *a = (const XBYTE *)A;
+    const XBYTE *b = (const XBYTE *)B;
+    int i = 0;
+#if VX_SIMD_SSE
+    if (VxHasSSE() && StrideRes >= 4 * sizeof(float) && StrideIn >= 4 * sizeof(float))
+    {
+        // the last vector can end its buffer: it is left to the scalar loop
+        const __m128 f = _mm_set1_ps(factor);
+        for (; i + 1 < count; ++i, res += StrideRes, a += StrideIn, b += StrideIn)
+        {
+            __m128 va = _mm_loadu_ps((const float *)a);
+            VxSSEStoreVector3((float *)res, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps((const float *)b), va), f)));
+        }
+    }
+#endif
+    for (; i < count; ++i, res += StrideRes, a += StrideIn, b += StrideIn)
+    {
+        const VxVector &va = *(const VxVector *)a;
+        const VxVector &vb = *(const VxVector *)b;
+        VxVector &r = *(VxVector *)res;
+        r.x = va.x + (vb.x - va.x) * factor;
+        r.y = va.y + (vb.y - va.y) * factor;
+        r.z = va.z + (vb.z - va.z) * factor;
+    }
+}
+
+/*************************************************
+Summary: Weighted sum of several vector arrays in one pass.
+
+Arguments:
+    Res: Result vectors.
+    Targets: Array of targetCount source vector arrays.
+    Weights: Weight of each target.
+    targetCount: Number of targets.
+    count: Number of vectors in each array.
+Remarks:
+    Res[i] = Sum(Weights[k] * Targets[k][i])
+    o For relative morph targets (Res = Base + Sum(w * (T - Base)))
+    give the base as an additional target weighted by 1 - Sum(w).
+    o Targets with a weight of 0 are skipped.
+    o Res can be one of the targets.
+See also: VxInterpolateVectorArray
+*************************************************/
+inline void VxBlendVectorArrays(const VxStridedData &Res, const VxStridedData *Targets, const float *Weights, int targetCount, int count)
+{
+    int i = 0;
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        XBOOL packed = (Res.Stride == sizeof(VxVector));
+        XBOOL wide = (Res.Stride >= 4 * sizeof(float));
+        int k;
+        for (k = 0; k < targetCount; ++k)
+        {
+            packed = packed && (Targets[k].Stride == sizeof(VxVector));
+            wide = wide && (Targets[k].Stride >= 4 * sizeof(float));
+        }
+
+        if (packed)
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_setzero_ps(), y = _mm_setzero_ps(), z = _mm_setzero_ps();
+                for (k = 0; k < targetCount; ++k)
+                {
+                    if (Weights[k] == 0.0f)
+                        continue;
+                    __m128 tx, ty, tz;
+                    VxSSELoadVector3x4((const float *)Targets[k].Ptr + 3 * i, tx, ty, tz);
+                    const __m128 w = _mm_set1_ps(Weights[k]);
+                    x = _mm_add_ps(x, _mm_mul_ps(tx, w));
+                    y = _mm_add_ps(y, _mm_mul_ps(ty, w));
+                    z = _mm_add_ps(z, _mm_mul_ps(tz, w));
+                }
+                VxSSEStoreVector3x4((float *)Res.Ptr + 3 * i, x, y, z);
+            }
+        }
+        else if (wide)
+        {
+            // the last vector can end its buffer: it is left to the scalar loop
+            for (; i + 1 < count; ++i)
+            {
+                __m128 acc = _mm_setzero_ps();
+                for (k = 0; k < targetCount; ++k)
+                {
+                    if (Weights[k] == 0.0f)
+                        continue;
+                    const float *t = (const float *)(Targets[k].CPtr + i * Targets[k].Stride);
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(t), _mm_set1_ps(Weights[k])));
+                }
+                VxSSEStoreVector3((float *)(Res.CPtr + i * Res.Stride), acc);
+            }
+        }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        VxVector acc(0.0f, 0.0f, 0.0f);
+        for (int k = 0; k < targetCount; ++k)
+        {
+            if (Weights[k] == 0.0f)
+                continue;
+            const VxVector &t = *(const VxVector *)(Targets[k].CPtr + i * Targets[k].Stride);
+            acc.x += t.x * Weights[k];
+            acc.y += t.y * Weights[k];
+            acc.z += t.z * Weights[k];
+        }
+        *(VxVector *)(Res.CPtr + i * Res.Stride) = acc;
+    }
+}
+
+#endif // VXBATCHMATH_H
@@ -0,0 +1,503 @@
+#ifndef VXBLOCKCOMPRESSION_H
+#define VXBLOCKCOMPRESSION_H
+
+#include "VxMathDefines.h"
+#include "VxSIMD.h"
+#include "XArray.h"
+
+/*************************************************
+{filename:VxBlockCompression}
+Summary: DXT1, DXT3 and DXT5 (BC1 to BC3) encoding and decoding of 32 bits images.
+
+Remarks:
+    o The images are 32 bits ARGB (_32_ARGB8888, the format of the system
+    memory copies of the textures). The compressed data is the one of the
+    DirectX surfaces: 4x4 pixels blocks, left to right then top to bottom,
+    8 bytes per block for DXT1 and 16 bytes for DXT3 and DXT5.
+    o The encoder is a range fit: the two colors of a block are the minimum
+    and the maximum of its pixels (inset by 1/16 of the range) and each
+    pixel takes the nearest color along that axis. It is made to compress
+    the textures created at run time (render targets copies, procedural or
+    downloaded images), the quality is close to the one of the offline
+    tools for most images. With SSE2 the bounds and the pixel indices of a
+    block are computed 4 pixels at a time.
+    o A DXT1 block with pixels whose alpha is under 128 is stored in the
+    3 colors mode with these pixels transparent when alpha1Bit is TRUE.
+    o The blocks of the last row and column of images whose size is not a
+    multiple of 4 repeat the border pixels.
+    o VxEncodeMipChain compresses an image and its mipmap levels (2x2 box
+    filter) into a single buffer, the largest level first.
+
+See also: VxBlockCompressedSize,CKCompressedTexture
+*************************************************/
+
+// Returns TRUE for the pixel formats handled by VxEncodeBlocks and VxDecodeBlocks.
+inline XBOOL VxIsBlockCompressed(VX_PIXELFORMAT format)
+{
+    return format == _DXT1 || format == _DXT3 || format == _DXT5;
+}
+
+// Size in bytes of an image of the given size compressed in a DXT format.
+inline int VxBlockCompressedSize(int width, int height, VX_PIXELFORMAT format)
+{
+    const int blocks = ((width + 3) >> 2) * ((height + 3) >> 2);
+    return blocks * ((format == _DXT1) ? 8 : 16);
+}
+
+// {secret}
+inline XWORD VxTo565(int r, int g, int b)
+{
+    return (XWORD)((((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+}
+
+// {secret}
+inline void VxFrom565(XWORD c, int rgb[3])
+{
+    const int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// {secret}
+// Reads a 4x4 block, the pixels out of the image repeat the borders.
+inline void VxLoadBlock(const XBYTE *src, int width, int height, int pitch, int x, int y, XDWORD block[16])
+{
+    for (int j = 0; j < 4; ++j)
+    {
+        const int sy = (y + j < height) ? y + j : height - 1;
+        const XDWORD *line = (const XDWORD *)(src + sy * pitch);
+        if (x + 4 <= width)
+        {
+            block[j * 4 + 0] = line[x + 0];
+            block[j * 4 + 1] = line[x + 1];
+            block[j * 4 + 2] = line[x + 2];
+            block[j * 4 + 3] = line[x + 3];
+        }
+        else
+        {
+            for (int i = 0; i < 4; ++i)
+                block[j * 4 + i] = line[(x + i < width) ? x + i : width - 1];
+        }
+    }
+}
+
+// {secret}
+// Step of each pixel along the axis from c1 to c0: s = (p - c1).(c0 - c1) * scale + 0.5, 0 <= s <= maxStep.
+inline void VxProjectBlock(const XDWORD block[16], const int c0[3], const int c1[3], int maxStep, int steps[16])
+{
+    const int dr = c0[0] - c1[0], dg = c0[1] - c1[1], db = c0[2] - c1[2];
+    const int dd = dr * dr + dg * dg + db * db;
+    const float scale = dd ? (float)maxStep / (float)dd : 0.0f;
+    int i;
+#if VX_SIMD_SSE2
+    {
+        const __m128i zero = _mm_setzero_si128();
+        // B,G,R,A words of one pixel, twice
+        const __m128i base = _mm_set_epi16(0, (short)c1[0], (short)c1[1], (short)c1[2], 0, (short)c1[0], (short)c1[1], (short)c1[2]);
+        const __m128i axis = _mm_set_epi16(0, (short)dr, (short)dg, (short)db, 0, (short)dr, (short)dg, (short)db);
+        const __m128 vscale = _mm_set1_ps(scale);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128i vmax = _mm_set1_epi32(maxStep);
+        for (i = 0; i < 16; i += 4)
+        {
+            const __m128i p = _mm_loadu_si128((const __m128i *)(block + i));
+            const __m128i lo = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(p, zero), base), axis);
+            const __m128i hi = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(p, zero), base), axis);
+            // (b*db + g*dg, r*dr) pairs of the 4 pixels added
+            const __m128 a = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 b = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+            const __m128i dot = _mm_add_epi32(_mm_castps_si128(a), _mm_castps_si128(b));
+            __m128i s = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(dot), vscale), half));
+            // clamp to [0, maxStep]
+            s = _mm_and_si128(s, _mm_cmpgt_epi32(s, zero));
+            const __m128i over = _mm_cmpgt_epi32(s, vmax);
+            s = _mm_or_si128(_mm_and_si128(over, vmax), _mm_andnot_si128(over, s));
+            _mm_storeu_si128((__m128i *)(steps + i), s);
+        }
+        return;
+    }
+#endif
+    for (i = 0; i < 16; ++i)
+    {
+        const XDWORD p = block[i];
+        const int dot = ((int)((p >> 16) & 0xFF) - c1[0]) * dr + ((int)((p >> 8) & 0xFF) - c1[1]) * dg + ((int)(p & 0xFF) - c1[2]) * db;
+        int s = (int)((float)dot * scale + 0.5f);
+        steps[i] = (s < 0) ? 0 : (s > maxStep) ? maxStep : s;
+    }
+}
+
+// {secret}
+// Bounds of the colors of a block, only the pixels with alpha >= 128 if opaqueOnly.
+inline XBOOL VxBlockBounds(const XDWORD block[16], XBOOL opaqueOnly, int mn[3], int mx[3])
+{
+#if VX_SIMD_SSE2
+    if (!opaqueOnly)
+    {
+        const __m128i p0 = _mm_loadu_si128((const __m128i *)block);
+        const __m128i p1 = _mm_loadu_si128((const __m128i *)(block + 4));
+        const __m128i p2 = _mm_loadu_si128((const __m128i *)(block + 8));
+        const __m128i p3 = _mm_loadu_si128((const __m128i *)(block + 12));
+        __m128i vmin = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+        __m128i vmax = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+        vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(1, 0, 3, 2)));
+        vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+        vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(2, 3, 0, 1)));
+        vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+        const XDWORD a = (XDWORD)_mm_cvtsi128_si32(vmin);
+        const XDWORD b = (XDWORD)_mm_cvtsi128_si32(vmax);
+        mn[0] = (a >> 16) & 0xFF, mn[1] = (a >> 8) & 0xFF, mn[2] = a & 0xFF;
+        mx[0] = (b >> 16) & 0xFF, mx[1] = (b >> 8) & 0xFF, mx[2] = b & 0xFF;
+        return TRUE;
+    }
+#endif
+    mn[0] = mn[1] = mn[2] = 255;
+    mx[0] = mx[1] = mx[2] = 0;
+    XBOOL found = FALSE;
+    for (int i = 0; i < 16; ++i)
+    {
+        const XDWORD p = block[i];
+        if (opaqueOnly && (p >> 24) < 128)
+            continue;
+        const int c[3] = {(int)((p >> 16) & 0xFF), (int)((p >> 8) & 0xFF), (int)(p & 0xFF)};
+        for (int k = 0; k < 3; ++k)
+        {
+            if (c[k] < mn[k])
+                mn[k] = c[k];
+            if (c[k] > mx[k])
+                mx[k] = c[k];
+        }
+        found = TRUE;
+    }
+    return found;
+}
+
+// {secret}
+// Writes the 8 bytes color part of a block.
+inline void VxEncodeColorBlock(const XDWORD block[16], XBOOL alpha1Bit, XBYTE *dst)
+{
+    XBOOL transparent = FALSE;
+    int i;
+    if (alpha1Bit)
+    {
+        for (i = 0; i < 16; ++i)
+        {
+            if ((block[i] >> 24) < 128)
+                transparent = TRUE;
+        }
+    }
+    int mn[3], mx[3];
+    if (!VxBlockBounds(block, transparent, mn, mx))
+    {
+        // fully transparent block
+        dst[0] = dst[1] = dst[2] = dst[3] = 0;
+        dst[4] = dst[5] = dst[6] = dst[7] = 0xFF;
+        return;
+    }
+    for (i = 0; i < 3; ++i)
+    {
+        const int inset = (mx[i] - mn[i]) >> 4;
+        mn[i] += inset;
+        mx[i] -= inset;
+    }
+    XWORD c0 = VxTo565(mx[0], mx[1], mx[2]);
+    XWORD c1 = VxTo565(mn[0], mn[1], mn[2]);
+    XDWORD indices = 0;
+    if (!transparent)
+    {
+        // 4 colors mode: c0 > c1, index 0 is c0, 1 is c1, 2 and 3 are at 1/3 and 2/3 from c0
+        if (c0 < c1)
+        {
+            const XWORD t = c0;
+            c0 = c1;
+            c1 = t;
+        }
+        if (c0 != c1)
+        {
+            static const XDWORD map[4] = {1, 3, 2, 0};
+            int p0[3], p1[3], steps[16];
+            VxFrom565(c0, p0);
+            VxFrom565(c1, p1);
+            VxProjectBlock(block, p0, p1, 3, steps);
+            for (i = 0; i < 16; ++i)
+                indices |= map[steps[i]] << (i * 2);
+        }
+    }
+    else
+    {
+        // 3 colors mode: c0 <= c1, index 0 is c0, 1 is c1, 2 is the middle and 3 transparent
+        if (c0 > c1)
+        {
+            const XWORD t = c0;
+            c0 = c1;
+            c1 = t;
+        }
+        static const XDWORD map[3] = {0, 2, 1};
+        int p0[3], p1[3], steps[16];
+        VxFrom565(c0, p0);
+        VxFrom565(c1, p1);
+        VxProjectBlock(block, p1, p0, 2, steps);
+        for (i = 0; i < 16; ++i)
+            indices |= (((block[i] >> 24) < 128) ? 3 : map[steps[i]]) << (i * 2);
+    }
+    dst[0] = (XBYTE)c0;
+    dst[1] = (XBYTE)(c0 >> 8);
+    dst[2] = (XBYTE)c1;
+    dst[3] = (XBYTE)(c1 >> 8);
+    dst[4] = (XBYTE)indices;
+    dst[5] = (XBYTE)(indices >> 8);
+    dst[6] = (XBYTE)(indices >> 16);
+    dst[7] = (XBYTE)(indices >> 24);
+}
+
+// {secret}
+// Writes the 8 bytes explicit alpha part of a DXT3 block.
+inline void VxEncodeAlphaBlock4(const XDWORD block[16], XBYTE *dst)
+{
+    for (int i = 0; i < 16; i += 2)
+    {
+        const int a0 = ((int)(block[i] >> 24) * 15 + 127) / 255;
+        const int a1 = ((int)(block[i + 1] >> 24) * 15 + 127) / 255;
+        dst[i >> 1] = (XBYTE)(a0 | (a1 << 4));
+    }
+}
+
+// {secret}
+// Writes the 8 bytes interpolated alpha part of a DXT5 block (8 values mode).
+inline void VxEncodeAlphaBlock8(const XDWORD block[16], XBYTE *dst)
+{
+    int amin = 255, amax = 0, i;
+    for (i = 0; i < 16; ++i)
+    {
+        const int a = (int)(block[i] >> 24);
+        if (a < amin)
+            amin = a;
+        if (a > amax)
+            amax = a;
+    }
+    dst[0] = (XBYTE)amax;
+    dst[1] = (XBYTE)amin;
+    // index 0 is a0, 1 is a1, 2 to 7 from a0 to a1
+    XDWORD lo = 0, hi = 0;
+    if (amax > amin)
+    {
+        const int range = amax - amin;
+        for (i = 0; i < 16; ++i)
+        {
+            const int s = (((int)(block[i] >> 24) - amin) * 14 + range) / (2 * range);
+            const XDWORD index = (s == 7) ? 0 : (s == 0) ? 1 : (XDWORD)(8 - s);
+            const int bit = i * 3;
+            if (bit < 24)
+                lo |= index << bit;
+            else
+                hi |= index << (bit - 24);
+        }
+    }
+    dst[2] = (XBYTE)lo;
+    dst[3] = (XBYTE)(lo >> 8);
+    dst[4] = (XBYTE)(lo >> 16);
+    dst[5] = (XBYTE)hi;
+    dst[6] = (XBYTE)(hi >> 8);
+    dst[7] = (XBYTE)(hi >> 16);
+}
+
+/*************************************************
+Summary: Compresses a 32 bits ARGB image.
+
+Arguments:
+    src: First line of the image.
+    width, height: Size of the image in pixels.
+    pitch: Bytes per line of the image.
+    format: _DXT1, _DXT3 or _DXT5.
+    dst: Compressed data, VxBlockCompressedSize bytes.
+    alpha1Bit: For DXT1, stores the pixels with alpha < 128 as transparent.
+Return Value:
+    Number of bytes written, 0 if the format is not a DXT format.
+See Also: VxDecodeBlocks,VxBlockCompressedSize
+*************************************************/
+inline int VxEncodeBlocks(const XBYTE *src, int width, int height, int pitch, VX_PIXELFORMAT format, XBYTE *dst, XBOOL alpha1Bit = FALSE)
+{
+    if (!VxIsBlockCompressed(format) || width <= 0 || height <= 0)
+        return 0;
+    XBYTE *out = dst;
+    XDWORD block[16];
+    for (int y = 0; y < height; y += 4)
+    {
+        for (int x = 0; x < width; x += 4)
+        {
+            VxLoadBlock(src, width, height, pitch, x, y, block);
+            if (format == _DXT1)
+            {
+                VxEncodeColorBlock(block, alpha1Bit, out);
+                out += 8;
+                continue;
+            }
+            if (format == _DXT3)
+                VxEncodeAlphaBlock4(block, out);
+            else
+                VxEncodeAlphaBlock8(block, out);
+            VxEncodeColorBlock(block, FALSE, out + 8);
+            out += 16;
+        }
+    }
+    return (int)(out - dst);
+}
+
+/*************************************************
+Summary: Decompresses DXT data to a 32 bits ARGB image.
+
+Arguments:
+    src: Compressed data.
+    width, height: Size of the image in pixels.
+    format: _DXT1, _DXT3 or _DXT5.
+    dst: First line of the image.
+    pitch: Bytes per line of the image.
+Return Value:
+    Number of bytes read, 0 if the format is not a DXT format.
+See Also: VxEncodeBlocks
+*************************************************/
+inline int VxDecodeBlocks(const XBYTE *src, int width, int height, VX_PIXELFORMAT format, XBYTE *dst, int pitch)
+{
+    if (!VxIsBlockCompressed(format) || width <= 0 || height <= 0)
+        return 0;
+    const XBYTE *in = src;
+    for (int y = 0; y < height; y += 4)
+    {
+        for (int x = 0; x < width; x += 4)
+        {
+            XDWORD alpha[16];
+            int i;
+            const XBYTE *color = in;
+            if (format == _DXT3)
+            {
+                for (i = 0; i < 16; ++i)
+                    alpha[i] = (XDWORD)((in[i >> 1] >> ((i & 1) * 4)) & 15) * 17;
+                color += 8;
+            }
+            else if (format == _DXT5)
+            {
+                const int a0 = in[0], a1 = in[1];
+                int values[8];
+                values[0] = a0;
+                values[1] = a1;
+                for (i = 1; i < 7; ++i)
+                    values[i + 1] = (a0 > a1) ? ((7 - i) * a0 + i * a1 + 3) / 7 : (i < 5) ? ((5 - i) * a0 + i * a1 + 2) / 5 : (i == 5) ? 0 : 255;
+                const XDWORD lo = in[2] | (in[3] << 8) | (in[4] << 16);
+                const XDWORD hi = in[5] | (in[6] << 8) | (in[7] << 16);
+                for (i = 0; i < 16; ++i)
+                    alpha[i] = (XDWORD)values[((i < 8) ? (lo >> (i * 3)) : (hi >> (i * 3 - 24))) & 7];
+                color += 8;
+            }
+            const XWORD c0 = (XWORD)(color[0] | (color[1] << 8));
+            const XWORD c1 = (XWORD)(color[2] | (color[3] << 8));
+            int p[4][3];
+            VxFrom565(c0, p[0]);
+            VxFrom565(c1, p[1]);
+            XDWORD palette[4];
+            const XBOOL fourColors = (c0 > c1) || (format != _DXT1);
+            for (i = 0; i < 3; ++i)
+            {
+                if (fourColors)
+                {
+                    p[2][i] = (2 * p[0][i] + p[1][i] + 1) / 3;
+                    p[3][i] = (p[0][i] + 2 * p[1][i] + 1) / 3;
+                }
+                else
+                {
+                    p[2][i] = (p[0][i] + p[1][i]) / 2;
+                    p[3][i] = 0;
+                }
+            }
+            for (i = 0; i < 4; ++i)
+                palette[i] = 0xFF000000 | (p[i][0] << 16) | (p[i][1] << 8) | p[i][2];
+            if (!fourColors)
+                palette[3] = 0;
+            const XDWORD indices = color[4] | (color[5] << 8) | (color[6] << 16) | ((XDWORD)color[7] << 24);
+            for (int j = 0; j < 4 && y + j < height; ++j)
+            {
+                XDWORD *line = (XDWORD *)(dst + (y + j) * pitch);
+                for (i = 0; i < 4 && x + i < width; ++i)
+                {
+                    const int k = j * 4 + i;
+                    XDWORD c = palette[(indices >> (k * 2)) & 3];
+                    if (format != _DXT1)
+                        c = (c & 0x00FFFFFF) | (alpha[k] << 24);
+                    line[x + i] = c;
+                }
+            }
+            in += (format == _DXT1) ? 8 : 16;
+        }
+    }
+    return (int)(in - src);
+}
+
+/*************************************************
+Summary: Halves a 32 bits image with a 2x2 box filter.
+
+Remarks:
+    The size of the result is max(width/2, 1) x max(height/2, 1), its pitch
+is 4 bytes per pixel. The last column or line of an odd size is dropped.
+*************************************************/
+inline void VxHalveImage32(const XBYTE *src, int width, int height, int pitch, XBYTE *dst)
+{
+    const int w = (width > 1) ? width >> 1 : 1;
+    const int h = (height > 1) ? height >> 1 : 1;
+    const int dx = (width > 1) ? 4 : 0;
+    const int dy = (height > 1) ? pitch : 0;
+    for (int y = 0; y < h; ++y)
+    {
+        const XBYTE *s0 = src + (y * 2) * pitch;
+        const XBYTE *s1 = s0 + dy;
+        XBYTE *d = dst + y * w * 4;
+        for (int x = 0; x < w; ++x, s0 += dx * 2, s1 += dx * 2, d += 4)
+        {
+            for (int c = 0; c < 4; ++c)
+                d[c] = (XBYTE)((s0[c] + s0[dx + c] + s1[c] + s1[dx + c] + 2) >> 2);
+        }
+    }
+}
+
+/*************************************************
+Summary: Compresses an image and its mipmap levels.
+
+Arguments:
+    src: First line of the 32 bits ARGB image.
+    width, height: Size of the image in pixels.
+    pitch: Bytes per line of the image.
+    format: _DXT1, _DXT3 or _DXT5.
+    data: Compressed levels, the largest first.
+    levels: Number of levels to build, -1 for the full chain down to 1x1.
+    alpha1Bit: See VxEncodeBlocks.
+Return Value:
+    Number of levels written in data.
+See Also: VxEncodeBlocks,VxBlockCompressedSize
+*************************************************/
+inline int VxEncodeMipChain(const XBYTE *src, int width, int height, int pitch, VX_PIXELFORMAT format, XArray<XBYTE> &data, int levels = -1, XBOOL alpha1Bit = FALSE)
+{
+    data.Resize(0);
+    if (!VxIsBlockCompressed(format) || width <= 0 || height <= 0)
+        return 0;
+    XArray<XBYTE> mip[2];
+    int count = 0;
+    for (;;)
+    {
+        const int offset = data.Size();
+        data.Resize(offset + VxBlockCompressedSize(width, height, format));
+        VxEncodeBlocks(src, width, height, pitch, format, data.Begin() + offset, alpha1Bit);
+        ++count;
+        if (count == levels || (width == 1 && height == 1))
+            break;
+        XArray<XBYTE> &next = mip[count & 1];
+        const int w = (width > 1) ? width >> 1 : 1;
+        const int h = (height > 1) ? height >> 1 : 1;
+        next.Resize(w * h * 4);
+        VxHalveImage32(src, width, height, pitch, next.Begin());
+        src = next.Begin();
+        width = w;
+        height = h;
+        pitch = w * 4;
+    }
+    return count;
+}
+
+#endif // VXBLOCKCOMPRESSION_H
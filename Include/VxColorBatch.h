@@ -0,0 +1,316 @@
+#ifndef VXCOLORBATCH_H
+#define VXCOLORBATCH_H
+
+#include <math.h>
+
+#include "VxColor.h"
+#include "VxVector.h"
+#include "VxSIMD.h"
+
+/*************************************************
+{filename:VxColorBatch}
+Summary: Inline kernels converting and computing arrays of colors.
+
+Remarks:
+    o VxColorsToARGB and VxARGBToColors convert arrays of VxColor to and
+    from packed 32 bits ARGB colors (the vertex color format) instead of
+    calling VxColor::GetRGBA and VxColor::Set for each color. The floats
+    are saturated to [0,1] and rounded to the nearest value.
+    o VxLightVertices computes the diffuse color of vertices lit by a set
+    of lights, for meshes lit on the CPU (VXMESH_LITMODE prelit meshes
+    whose colors follow dynamic lights).
+    o The packed colors take a stride so that they can be written directly
+    in a VxDrawPrimitiveData or a locked vertex buffer.
+    o The kernels process 4 colors or vertices at a time with SSE2 when
+    VxHasSSE returns TRUE and fall back to scalar code otherwise.
+
+See also: VxColor,VxVertexLight,VxBatchMath
+*************************************************/
+
+// {secret}
+inline XDWORD VxColorToARGB(float r, float g, float b, float a)
+{
+    const int ir = (int)(XMax(0.0f, XMin(r, 1.0f)) * 255.0f + 0.5f);
+    const int ig = (int)(XMax(0.0f, XMin(g, 1.0f)) * 255.0f + 0.5f);
+    const int ib = (int)(XMax(0.0f, XMin(b, 1.0f)) * 255.0f + 0.5f);
+    const int ia = (int)(XMax(0.0f, XMin(a, 1.0f)) * 255.0f + 0.5f);
+    return ((XDWORD)ia << 24) | ((XDWORD)ir << 16) | ((XDWORD)ig << 8) | (XDWORD)ib;
+}
+
+/*************************************************
+Summary: Converts colors to packed ARGB colors.
+
+Arguments:
+    dst: Packed colors.
+    dstStride: Amount of bytes between two packed colors.
+    src: Colors to convert.
+    count: Number of colors.
+*************************************************/
+inline void VxColorsToARGB(XDWORD *dst, XULONG dstStride, const VxColor *src, int count)
+{
+    XBYTE *d = (XBYTE *)dst;
+    int i = 0;
+#if VX_SIMD_SSE2
+    if (VxHasSSE())
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i c[4];
+            for (int k = 0; k < 4; ++k)
+            {
+                const __m128 v = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(&src[i + k].r), zero), one), scale);
+                // r,g,b,a to the b,g,r,a byte order of an ARGB double word
+                c[k] = _mm_shuffle_epi32(_mm_cvttps_epi32(_mm_add_ps(v, half)), _MM_SHUFFLE(3, 0, 1, 2));
+            }
+            const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+            if (dstStride == sizeof(XDWORD))
+            {
+                _mm_storeu_si128((__m128i *)(d + i * dstStride), packed);
+                continue;
+            }
+            XDWORD colors[4];
+            _mm_storeu_si128((__m128i *)colors, packed);
+            for (int k = 0; k < 4; ++k)
+                *(XDWORD *)(d + (i + k) * dstStride) = colors[k];
+        }
+    }
+#endif
+    for (; i < count; ++i)
+        *(XDWORD *)(d + i * dstStride) = VxColorToARGB(src[i].r, src[i].g, src[i].b, src[i].a);
+}
+
+/*************************************************
+Summary: Converts packed ARGB colors to colors.
+
+Arguments:
+    dst: Converted colors.
+    src: Packed colors.
+    srcStride: Amount of bytes between two packed colors.
+    count: Number of colors.
+*************************************************/
+inline void VxARGBToColors(VxColor *dst, const XDWORD *src, XULONG srcStride, int count)
+{
+    const XBYTE *s = (const XBYTE *)src;
+    const float inv = 1.0f / 255.0f;
+    int i = 0;
+#if VX_SIMD_SSE2
+    if (VxHasSSE())
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(inv);
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i p = _mm_set_epi32(*(const int *)(s + (i + 3) * srcStride), *(const int *)(s + (i + 2) * srcStride),
+                                            *(const int *)(s + (i + 1) * srcStride), *(const int *)(s + i * srcStride));
+            const __m128i lo = _mm_unpacklo_epi8(p, zero);
+            const __m128i hi = _mm_unpackhi_epi8(p, zero);
+            const __m128i c[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                                  _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+            for (int k = 0; k < 4; ++k)
+            {
+                // b,g,r,a bytes back to r,g,b,a
+                const __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(c[k]), scale);
+                _mm_storeu_ps(&dst[i + k].r, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2)));
+            }
+        }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const XDWORD c = *(const XDWORD *)(s + i * srcStride);
+        dst[i].r = ((c >> 16) & 0xFF) * inv;
+        dst[i].g = ((c >> 8) & 0xFF) * inv;
+        dst[i].b = (c & 0xFF) * inv;
+        dst[i].a = (c >> 24) * inv;
+    }
+}
+
+/*************************************************
+Summary: Light description used by VxLightVertices.
+
+Remarks:
+    o Position and Direction must be in the space of the vertices (the
+    local space of the lit entity), Direction is normalized and gives
+    where the light points.
+    o Point and spot lights do not light vertices farther than Range, and
+    are attenuated by 1 / (Attenuation0 + Attenuation1 * d + Attenuation2 * d * d).
+    o The spot factor goes linearly from 1 at CosHotSpot to 0 at CosFallOff
+    (the cosines of the half angles of the cones).
+    o Color is the color of the light multiplied by its power.
+
+See also: VxLightVertices
+*************************************************/
+struct VxVertexLight
+{
+    enum
+    {
+        POINT       = 1,
+        SPOT        = 2,
+        DIRECTIONAL = 3
+    };
+
+    int Type;
+    VxVector Position;
+    VxVector Direction;
+    VxColor Color;
+    float Range;
+    float Attenuation0;
+    float Attenuation1;
+    float Attenuation2;
+    float CosHotSpot;
+    float CosFallOff;
+};
+
+// {secret}
+// Diffuse intensity of a light at a vertex.
+inline float VxVertexLightFactor(const VxVertexLight &light, const VxVector &p, const VxVector &n)
+{
+    if (light.Type == VxVertexLight::DIRECTIONAL)
+        return XMax(0.0f, -DotProduct(n, light.Direction));
+    VxVector l = light.Position - p;
+    const float d2 = SquareMagnitude(l);
+    if (d2 > light.Range * light.Range || d2 <= 0.0f)
+        return 0.0f;
+    const float d = sqrtf(d2);
+    l *= 1.0f / d;
+    float f = XMax(0.0f, DotProduct(n, l)) / (light.Attenuation0 + light.Attenuation1 * d + light.Attenuation2 * d2);
+    if (light.Type == VxVertexLight::SPOT)
+    {
+        const float c = -DotProduct(l, light.Direction);
+        const float range = light.CosHotSpot - light.CosFallOff;
+        f *= (range > 0.0f) ? XMax(0.0f, XMin((c - light.CosFallOff) / range, 1.0f)) : (c >= light.CosFallOff ? 1.0f : 0.0f);
+    }
+    return f;
+}
+
+/*************************************************
+Summary: Computes the diffuse colors of lit vertices.
+
+Arguments:
+    colors: Receives the packed ARGB color of each vertex.
+    colorStride: Amount of bytes between two colors.
+    positions: Position of the first vertex.
+    positionStride: Amount of bytes between two positions.
+    normals: Normalized normal of the first vertex.
+    normalStride: Amount of bytes between two normals.
+    count: Number of vertices.
+    lights: Lights in the space of the vertices.
+    lightCount: Number of lights.
+    ambient: Ambient light.
+    diffuse: Diffuse color of the material, its alpha is the alpha of the vertices.
+    ambientMaterial: Ambient color of the material.
+    emissive: Emissive color of the material.
+Remarks:
+    The color of a vertex is emissive + ambient * ambientMaterial + sum(light
+factor * light color) * diffuse, saturated. Specular lighting is not computed.
+*************************************************/
+inline void VxLightVertices(XDWORD *colors, XULONG colorStride,
+                            const VxVector *positions, XULONG positionStride,
+                            const VxVector *normals, XULONG normalStride, int count,
+                            const VxVertexLight *lights, int lightCount,
+                            const VxColor &ambient, const VxColor &diffuse, const VxColor &ambientMaterial, const VxColor &emissive)
+{
+    const XBYTE *p = (const XBYTE *)positions;
+    const XBYTE *n = (const XBYTE *)normals;
+    XBYTE *dst = (XBYTE *)colors;
+    const float baseR = emissive.r + ambient.r * ambientMaterial.r;
+    const float baseG = emissive.g + ambient.g * ambientMaterial.g;
+    const float baseB = emissive.b + ambient.b * ambientMaterial.b;
+    int i = 0;
+#if VX_SIMD_SSE2
+    if (VxHasSSE())
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128i alpha = _mm_slli_epi32(_mm_set1_epi32((int)(XMax(0.0f, XMin(diffuse.a, 1.0f)) * 255.0f + 0.5f)), 24);
+        for (; i + 4 <= count; i += 4)
+        {
+            // 4 vertices as x,y,z registers
+            const VxVector &p0 = *(const VxVector *)(p + i * positionStride), &p1 = *(const VxVector *)(p + (i + 1) * positionStride);
+            const VxVector &p2 = *(const VxVector *)(p + (i + 2) * positionStride), &p3 = *(const VxVector *)(p + (i + 3) * positionStride);
+            const VxVector &n0 = *(const VxVector *)(n + i * normalStride), &n1 = *(const VxVector *)(n + (i + 1) * normalStride);
+            const VxVector &n2 = *(const VxVector *)(n + (i + 2) * normalStride), &n3 = *(const VxVector *)(n + (i + 3) * normalStride);
+            const __m128 px = _mm_set_ps(p3.x, p2.x, p1.x, p0.x), py = _mm_set_ps(p3.y, p2.y, p1.y, p0.y), pz = _mm_set_ps(p3.z, p2.z, p1.z, p0.z);
+            const __m128 nx = _mm_set_ps(n3.x, n2.x, n1.x, n0.x), ny = _mm_set_ps(n3.y, n2.y, n1.y, n0.y), nz = _mm_set_ps(n3.z, n2.z, n1.z, n0.z);
+
+            __m128 r = zero, g = zero, b = zero;
+            for (int k = 0; k < lightCount; ++k)
+            {
+                const VxVertexLight &light = lights[k];
+                __m128 f;
+                if (light.Type == VxVertexLight::DIRECTIONAL)
+                {
+                    const __m128 ndl = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(light.Direction.x)), _mm_mul_ps(ny, _mm_set1_ps(light.Direction.y))),
+                                                  _mm_mul_ps(nz, _mm_set1_ps(light.Direction.z)));
+                    f = _mm_max_ps(_mm_sub_ps(zero, ndl), zero);
+                }
+                else
+                {
+                    __m128 lx = _mm_sub_ps(_mm_set1_ps(light.Position.x), px);
+                    __m128 ly = _mm_sub_ps(_mm_set1_ps(light.Position.y), py);
+                    __m128 lz = _mm_sub_ps(_mm_set1_ps(light.Position.z), pz);
+                    const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+                    const __m128 inRange = _mm_and_ps(_mm_cmple_ps(d2, _mm_set1_ps(light.Range * light.Range)), _mm_cmpgt_ps(d2, zero));
+                    const __m128 d = _mm_sqrt_ps(d2);
+                    const __m128 invD = _mm_div_ps(one, _mm_max_ps(d, _mm_set1_ps(1e-30f)));
+                    lx = _mm_mul_ps(lx, invD);
+                    ly = _mm_mul_ps(ly, invD);
+                    lz = _mm_mul_ps(lz, invD);
+                    const __m128 ndl = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz)), zero);
+                    const __m128 att = _mm_add_ps(_mm_add_ps(_mm_set1_ps(light.Attenuation0), _mm_mul_ps(_mm_set1_ps(light.Attenuation1), d)),
+                                                  _mm_mul_ps(_mm_set1_ps(light.Attenuation2), d2));
+                    f = _mm_and_ps(_mm_div_ps(ndl, att), inRange);
+                    if (light.Type == VxVertexLight::SPOT)
+                    {
+                        const __m128 c = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(light.Direction.x)), _mm_mul_ps(ly, _mm_set1_ps(light.Direction.y))),
+                                                                     _mm_mul_ps(lz, _mm_set1_ps(light.Direction.z))));
+                        const float range = light.CosHotSpot - light.CosFallOff;
+                        __m128 spot;
+                        if (range > 0.0f)
+                            spot = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(c, _mm_set1_ps(light.CosFallOff)), _mm_set1_ps(1.0f / range)), zero), one);
+                        else
+                            spot = _mm_and_ps(_mm_cmpge_ps(c, _mm_set1_ps(light.CosFallOff)), one);
+                        f = _mm_mul_ps(f, spot);
+                    }
+                }
+                r = _mm_add_ps(r, _mm_mul_ps(f, _mm_set1_ps(light.Color.r)));
+                g = _mm_add_ps(g, _mm_mul_ps(f, _mm_set1_ps(light.Color.g)));
+                b = _mm_add_ps(b, _mm_mul_ps(f, _mm_set1_ps(light.Color.b)));
+            }
+            r = _mm_add_ps(_mm_set1_ps(baseR), _mm_mul_ps(r, _mm_set1_ps(diffuse.r)));
+            g = _mm_add_ps(_mm_set1_ps(baseG), _mm_mul_ps(g, _mm_set1_ps(diffuse.g)));
+            b = _mm_add_ps(_mm_set1_ps(baseB), _mm_mul_ps(b, _mm_set1_ps(diffuse.b)));
+            const __m128i ir = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(r, zero), one), scale), half));
+            const __m128i ig = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(g, zero), one), scale), half));
+            const __m128i ib = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b, zero), one), scale), half));
+            const __m128i argb = _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(ir, 16)), _mm_or_si128(_mm_slli_epi32(ig, 8), ib));
+            XDWORD out[4];
+            _mm_storeu_si128((__m128i *)out, argb);
+            for (int k = 0; k < 4; ++k)
+                *(XDWORD *)(dst + (i + k) * colorStride) = out[k];
+        }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const VxVector &pos = *(const VxVector *)(p + i * positionStride);
+        const VxVector &nrm = *(const VxVector *)(n + i * normalStride);
+        float r = 0.0f, g = 0.0f, b = 0.0f;
+        for (int k = 0; k < lightCount; ++k)
+        {
+            const float f = VxVertexLightFactor(lights[k], pos, nrm);
+            r += f * lights[k].Color.r;
+            g += f * lights[k].Color.g;
+            b += f * lights[k].Color.b;
+        }
+        *(XDWORD *)(dst + i * colorStride) = VxColorToARGB(baseR + r * diffuse.r, baseG + g * diffuse.g, baseB + b * diffuse.b, diffuse.a);
+    }
+}
+
+#endif // VXCOLORBATCH_H
@@ -0,0 +1,389 @@
+#ifndef VXCOMPRESSEDTRACK_H
+#define VXCOMPRESSEDTRACK_H
+
+#include "VxKeyTrack.h"
+#include "VxSIMD.h"
+
+/**********************************************************
+Summary: Keyframe track with quantized keys.
+
+Remarks:
+    o Each key takes 8 bytes: 3 components on 16 bits and the time on 16
+    bits (relative to the range of the track).
+    o Vector keys are quantized in the range of values of the track.
+    o Quaternion keys use the smallest three encoding: the largest
+    component is dropped (it is recomputed from the 3 others, which are
+    in [-1/sqrt(2),1/sqrt(2)]), the others take 15 bits and the index of
+    the dropped one is stored in the 2 remaining bits.
+    o Compress also removes the keys which can be interpolated from their
+    neighbours within a tolerance (a distance for vectors, an angle in
+    radians for quaternions). The error checked includes the shift of the
+    key times by their quantization.
+    o The 65536 time steps cover the whole track: Compress fails on a track
+    whose kept keys are too close for these steps (a long track with dense
+    keys), which must then stay a VxKeyTrack or be split.
+    o The keys around the sampled time are decoded together with SSE2
+    when available. The sampling cursor works as with VxKeyTrack.
+
+    VxCompressedTrack track;
+    track.Compress(compiledTrack, 0.001f);
+    int cursor = 0;
+    VxVector pos;
+    track.Sample(frame, cursor, &pos.x);
+
+See Also: VxKeyTrack,CKCompressedAnimation
+*********************************************************/
+class VxCompressedTrack
+{
+public:
+    VxCompressedTrack() : m_Quaternion(FALSE), m_Count(0)
+    {
+        for (int i = 0; i < 4; ++i)
+            m_Offset[i] = m_Scale[i] = 0.0f;
+    }
+
+    /************************************************
+    Summary: Compresses a track.
+
+    Arguments:
+        src: Track with 3 (vector) or 4 (quaternion) components.
+        tolerance: Maximum error of the keys removed from the track.
+    Return Value:
+        FALSE if the track is empty, or if two of its kept keys have the
+        same quantized time. The track is then left empty.
+    ************************************************/
+    XBOOL Compress(const VxKeyTrack &src, float tolerance)
+    {
+        const int count = src.GetKeyCount();
+        const int comps = src.GetComponentCount();
+        m_Quaternion = comps == 4;
+        m_Keys.Resize(0);
+        m_Count = 0;
+        if (!count || (comps != 3 && comps != 4))
+            return FALSE;
+
+        // the time quantization is needed to measure the error of the reduction
+        const float start = src.GetKeyTime(0);
+        const float end = src.GetKeyTime(count - 1);
+        m_Offset[3] = start;
+        m_Scale[3] = (end - start) / 65535.0f;
+
+        XArray<int> kept;
+        ReduceKeys(src, tolerance, kept);
+        int i;
+        for (i = 1; i < kept.Size(); ++i)
+        {
+            // a null time delta between two keys can not be interpolated
+            if (Quantize(src.GetKeyTime(kept[i]), 3, 65535) <= Quantize(src.GetKeyTime(kept[i - 1]), 3, 65535))
+                return FALSE;
+        }
+
+        if (m_Quaternion)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                m_Offset[c] = -0.70710678f;
+                m_Scale[c] = 1.41421356f / 32767.0f;
+            }
+        }
+        else
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                float lo = src.GetKeyValue(0)[c], hi = lo;
+                for (int k = 1; k < count; ++k)
+                {
+                    lo = XMin(lo, src.GetKeyValue(k)[c]);
+                    hi = XMax(hi, src.GetKeyValue(k)[c]);
+                }
+                m_Offset[c] = lo;
+                m_Scale[c] = (hi - lo) / 65535.0f;
+            }
+        }
+
+        m_Count = kept.Size();
+        // one more key so that a pair of keys can always be loaded at once
+        m_Keys.Resize(m_Count * 4 + 4);
+        memset(m_Keys.Begin(), 0, m_Keys.Size() * sizeof(XWORD));
+        for (i = 0; i < m_Count; ++i)
+        {
+            const int k = kept[i];
+            XWORD *key = &m_Keys[i * 4];
+            if (m_Quaternion)
+                EncodeQuaternion(src.GetKeyValue(k), key);
+            else
+            {
+                for (int c = 0; c < 3; ++c)
+                    key[c] = Quantize(src.GetKeyValue(k)[c], c, 65535);
+            }
+            key[3] = Quantize(src.GetKeyTime(k), 3, 65535);
+        }
+        return TRUE;
+    }
+
+    int GetKeyCount() const { return m_Count; }
+    XBOOL IsQuaternion() const { return m_Quaternion; }
+
+    // Memory used by the keys, in bytes.
+    int GetMemoryUsed() const { return m_Keys.Size() * (int)sizeof(XWORD); }
+
+    float GetKeyTime(int k) const { return m_Offset[3] + m_Keys[k * 4 + 3] * m_Scale[3]; }
+
+    // Decodes a key (3 floats for a vector, 4 for a quaternion).
+    void DecodeKey(int k, float *res) const
+    {
+        float v[4];
+        Dequantize(&m_Keys[k * 4], v);
+        if (m_Quaternion)
+            Reconstruct(&m_Keys[k * 4], v, res);
+        else
+        {
+            res[0] = v[0];
+            res[1] = v[1];
+            res[2] = v[2];
+        }
+    }
+
+    // Finds the keys surrounding a time (see VxKeyTrack::Locate).
+    int Locate(float t, int &cursor, float &alpha) const
+    {
+        alpha = 0.0f;
+        if (m_Count < 2)
+            return 0;
+        const int last = m_Count - 2;
+        const XWORD *keys = m_Keys.Begin();
+        // times are compared in quantized units
+        const float q = (m_Scale[3] > 0.0f) ? (t - m_Offset[3]) / m_Scale[3] : 0.0f;
+        if (q <= (float)keys[3])
+            return cursor = 0;
+        if (q >= (float)keys[(m_Count - 1) * 4 + 3])
+        {
+            alpha = 1.0f;
+            return cursor = last;
+        }
+        int k = cursor;
+        if (k < 0 || k > last || (float)keys[k * 4 + 3] > q)
+        {
+            k = Search(q);
+        }
+        else
+        {
+            int steps = 0;
+            while ((float)keys[k * 4 + 7] <= q && ++steps <= 4)
+                ++k;
+            if ((float)keys[k * 4 + 7] <= q)
+                k = Search(q);
+        }
+        const float t0 = (float)keys[k * 4 + 3];
+        alpha = (q - t0) / ((float)keys[k * 4 + 7] - t0);
+        return cursor = k;
+    }
+
+    // Samples a vector track.
+    void Sample(float t, int &cursor, float *res) const
+    {
+        if (!m_Count || m_Quaternion)
+            return;
+        float alpha;
+        const int k = Locate(t, cursor, alpha);
+        if (m_Count < 2)
+        {
+            DecodeKey(0, res);
+            return;
+        }
+        const XWORD *keys = &m_Keys[k * 4];
+#if VX_SIMD_SSE2
+        // both keys are decoded and interpolated in one register each
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i packed = _mm_loadu_si128((const __m128i *)keys);
+        const __m128 scale = _mm_loadu_ps(m_Scale);
+        const __m128 offset = _mm_loadu_ps(m_Offset);
+        const __m128 a = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, zero)), scale), offset);
+        const __m128 b = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(packed, zero)), scale), offset);
+        const __m128 r = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(alpha), _mm_sub_ps(b, a)));
+        _mm_storel_pi((__m64 *)res, r);
+        _mm_store_ss(res + 2, _mm_movehl_ps(r, r));
+#else
+        float a[4], b[4];
+        Dequantize(keys, a);
+        Dequantize(keys + 4, b);
+        for (int c = 0; c < 3; ++c)
+            res[c] = a[c] + alpha * (b[c] - a[c]);
+#endif
+    }
+
+    // Samples a quaternion track.
+    void SampleRotation(float t, int &cursor, VxQuaternion &res) const
+    {
+        if (!m_Count || !m_Quaternion)
+            return;
+        float alpha;
+        const int k = Locate(t, cursor, alpha);
+        const XWORD *keys = &m_Keys[k * 4];
+        float a[4], b[4], qa[4], qb[4];
+#if VX_SIMD_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i mask = _mm_set_epi16(-1, 0x7FFF, 0x7FFF, 0x7FFF, -1, 0x7FFF, 0x7FFF, 0x7FFF);
+        const __m128i packed = _mm_and_si128(_mm_loadu_si128((const __m128i *)keys), mask);
+        const __m128 scale = _mm_loadu_ps(m_Scale);
+        const __m128 offset = _mm_loadu_ps(m_Offset);
+        _mm_storeu_ps(a, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, zero)), scale), offset));
+        _mm_storeu_ps(b, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(packed, zero)), scale), offset));
+#else
+        Dequantize(keys, a);
+        if (m_Count >= 2)
+            Dequantize(keys + 4, b);
+#endif
+        Reconstruct(keys, a, qa);
+        if (m_Count < 2 || alpha <= 0.0f)
+        {
+            res = *(VxQuaternion *)qa;
+            return;
+        }
+        Reconstruct(keys + 4, b, qb);
+        res = VxFastSlerp(alpha, *(VxQuaternion *)qa, *(VxQuaternion *)qb);
+    }
+
+protected:
+    static float Sqrt1(float x) { return (x > 0.0f) ? sqrtf(x) : 0.0f; }
+
+    XWORD Quantize(float v, int c, int maxValue) const
+    {
+        if (m_Scale[c] <= 0.0f)
+            return 0;
+        float q = (v - m_Offset[c]) / m_Scale[c] + 0.5f;
+        if (q <= 0.0f)
+            return 0;
+        return (XWORD)XMin((int)q, maxValue);
+    }
+
+    void EncodeQuaternion(const float *q, XWORD *key) const
+    {
+        int largest = 0;
+        for (int c = 1; c < 4; ++c)
+        {
+            if (XFabs(q[c]) > XFabs(q[largest]))
+                largest = c;
+        }
+        // q and -q are the same rotation, the dropped component is made positive
+        float l = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+        const float scale = ((q[largest] < 0.0f) ? -1.0f : 1.0f) / ((l > 0.0f) ? sqrtf(l) : 1.0f);
+        int n = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            if (c == largest)
+                continue;
+            key[n] = Quantize(q[c] * scale, n, 32767);
+            ++n;
+        }
+        key[0] |= (XWORD)((largest >> 1) << 15);
+        key[1] |= (XWORD)((largest & 1) << 15);
+    }
+
+    void Dequantize(const XWORD *key, float *v) const
+    {
+        const XWORD m = m_Quaternion ? 0x7FFF : 0xFFFF;
+        v[0] = m_Offset[0] + (key[0] & m) * m_Scale[0];
+        v[1] = m_Offset[1] + (key[1] & m) * m_Scale[1];
+        v[2] = m_Offset[2] + (key[2] & m) * m_Scale[2];
+        v[3] = m_Offset[3] + key[3] * m_Scale[3];
+    }
+
+    // Rebuilds the quaternion from the 3 smallest components.
+    static void Reconstruct(const XWORD *key, const float *v, float *q)
+    {
+        const int largest = ((key[0] >> 15) << 1) | (key[1] >> 15);
+        int n = 0;
+        float sum = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            if (c == largest)
+                continue;
+            q[c] = v[n++];
+            sum += q[c] * q[c];
+        }
+        q[largest] = Sqrt1(1.0f - sum);
+    }
+
+    int Search(float q) const
+    {
+        const XWORD *keys = m_Keys.Begin();
+        int lo = 0, hi = m_Count - 1;
+        while (hi - lo > 1)
+        {
+            int mid = (lo + hi) >> 1;
+            if ((float)keys[mid * 4 + 3] <= q)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Greedy removal of the keys interpolated within the tolerance.
+    void ReduceKeys(const VxKeyTrack &src, float tolerance, XArray<int> &kept) const
+    {
+        const int count = src.GetKeyCount();
+        kept.Resize(0);
+        kept.PushBack(0);
+        int from = 0;
+        while (from < count - 1)
+        {
+            int to = from + 1;
+            // the span is bounded so that long static parts do not cost a quadratic time
+            while (to + 1 < count && to + 1 - from <= 512 && IsInterpolated(src, from, to + 1, tolerance))
+                ++to;
+            kept.PushBack(to);
+            from = to;
+        }
+    }
+
+    // Time of a key once quantized.
+    float QuantizedTime(float t) const { return m_Offset[3] + Quantize(t, 3, 65535) * m_Scale[3]; }
+
+    XBOOL IsInterpolated(const VxKeyTrack &src, int from, int to, float tolerance) const
+    {
+        // the kept keys move to their quantized times: all the keys of the span are checked
+        const float t0 = QuantizedTime(src.GetKeyTime(from));
+        const float dt = QuantizedTime(src.GetKeyTime(to)) - t0;
+        const float *a = src.GetKeyValue(from);
+        const float *b = src.GetKeyValue(to);
+        for (int k = from; k <= to; ++k)
+        {
+            const float alpha = (dt > 0.0f) ? XMax(0.0f, XMin((src.GetKeyTime(k) - t0) / dt, 1.0f)) : 0.0f;
+            const float *v = src.GetKeyValue(k);
+            if (m_Quaternion)
+            {
+                // the angle is computed from the chord, acos is too imprecise near 1
+                VxQuaternion q = VxFastSlerp(alpha, *(const VxQuaternion *)a, *(const VxQuaternion *)b);
+                const float *r = &q.x;
+                const float sign = (r[0] * v[0] + r[1] * v[1] + r[2] * v[2] + r[3] * v[3] < 0.0f) ? -1.0f : 1.0f;
+                float chord = 0.0f;
+                for (int c = 0; c < 4; ++c)
+                    chord += (r[c] - sign * v[c]) * (r[c] - sign * v[c]);
+                if (4.0f * asinf(XMin(0.5f * sqrtf(chord), 1.0f)) > tolerance)
+                    return FALSE;
+            }
+            else
+            {
+                float e = 0.0f;
+                for (int c = 0; c < 3; ++c)
+                {
+                    float d = a[c] + alpha * (b[c] - a[c]) - v[c];
+                    e += d * d;
+                }
+                if (e > tolerance * tolerance)
+                    return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    XBOOL m_Quaternion;
+    int m_Count;
+    float m_Offset[4]; // dequantization of the 3 components and of the time
+    float m_Scale[4];
+    XArray<XWORD> m_Keys; // 4 words per key
+};
+
+#endif // VXCOMPRESSEDTRACK_H
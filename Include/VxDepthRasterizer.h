@@ -0,0 +1,343 @@
+#ifndef VXDEPTHRASTERIZER_H
+#define VXDEPTHRASTERIZER_H
+
+#include "VxMathDefines.h"
+#include "VxVector.h"
+#include "VxMatrix.h"
+#include "VxSIMD.h"
+#include "XArray.h"
+
+/*************************************************
+{filename:VxDepthRasterizer}
+Summary: Low resolution software depth buffer for occlusion tests.
+
+Remarks:
+    o The triangles of the occluders (walls, large buildings, terrain) are
+    transformed by the world to clip matrix (projection x view x world),
+    clipped to the near plane and rasterized in a small depth buffer
+    (256x128 by default), keeping the nearest depth (z/w, 0 at the near
+    plane and 1 at the far plane).
+    o IsVisible projects the corners of a box and compares its nearest
+    depth with the depth buffer over its screen rectangle: the box is
+    hidden when all these pixels hold a nearer occluder.
+    o The tests are conservative: a box crossing the near plane is
+    visible and a pixel is covered by a triangle only when its center is
+    inside it (the centers on an edge shared by two triangles belong to
+    one of them, top-left rule), so an occluder never hides more than
+    itself.
+    o With SSE the spans are rasterized and tested 4 pixels at a time, the
+    results are the same as the scalar code.
+
+    VxDepthRasterizer raster(256, 128);
+    raster.Clear();
+    raster.SetViewProjection(viewProj);
+    raster.DrawTriangles(world, positions, stride, vertexCount, indices, faceCount);
+    if (raster.IsVisible(box, boxWorld))
+        ...
+
+See also: CKOcclusionCuller,VxTransformBox2D
+*************************************************/
+class VxDepthRasterizer
+{
+public:
+    VxDepthRasterizer(int width = 256, int height = 128) : m_Triangles(0) { Resize(width, height); }
+
+    // Changes the resolution, the width is rounded up to a multiple of 4 in the buffer.
+    void Resize(int width, int height)
+    {
+        m_Width = width < 4 ? 4 : width;
+        m_Height = height < 1 ? 1 : height;
+        m_Pitch = (m_Width + 3) & ~3;
+        m_Depth.Resize(m_Pitch * m_Height);
+        m_ViewProj.SetIdentity();
+        Clear();
+    }
+
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+
+    // Sets the depth of all the pixels to the far plane.
+    void Clear()
+    {
+        float *d = m_Depth.Begin();
+        for (int i = 0; i < m_Depth.Size(); ++i)
+            d[i] = 1.0f;
+        m_Triangles = 0;
+    }
+
+    // Sets the world to clip matrix (projection x view), the matrix of the render context camera.
+    void SetViewProjection(const VxMatrix &viewProj) { m_ViewProj = viewProj; }
+    const VxMatrix &GetViewProjection() const { return m_ViewProj; }
+
+    /************************************************
+    Summary: Rasterizes indexed triangles.
+
+    Arguments:
+        world: World matrix of the vertices.
+        positions: First vertex position.
+        stride: Amount in bytes between two positions.
+        vertexCount: Number of vertices.
+        indices: 3 indices per triangle.
+        triangleCount: Number of triangles.
+    Remarks:
+        The triangles are drawn whatever their orientation.
+    ************************************************/
+    void DrawTriangles(const VxMatrix &world, const void *positions, int stride, int vertexCount, const XWORD *indices, int triangleCount)
+    {
+        VxMatrix m;
+        Vx3DMultiplyMatrix4(m, m_ViewProj, world);
+        m_Clip.Resize(vertexCount);
+        const XBYTE *p = (const XBYTE *)positions;
+        int i;
+        for (i = 0; i < vertexCount; ++i, p += stride)
+            Transform(m, *(const VxVector *)p, m_Clip[i]);
+        for (i = 0; i < triangleCount; ++i, indices += 3)
+        {
+            if (indices[0] < vertexCount && indices[1] < vertexCount && indices[2] < vertexCount)
+                ClipTriangle(m_Clip[indices[0]], m_Clip[indices[1]], m_Clip[indices[2]]);
+        }
+    }
+
+    // Number of triangles drawn (after clipping) since the last Clear.
+    int GetTriangleCount() const { return m_Triangles; }
+
+    /************************************************
+    Summary: Tests whether a box may be visible.
+
+    Arguments:
+        box: Box in its local space.
+        world: World matrix of the box.
+    Return Value:
+        FALSE if the box is out of the screen or hidden by the occluders.
+    ************************************************/
+    XBOOL IsVisible(const VxBbox &box, const VxMatrix &world) const
+    {
+        VxMatrix m;
+        Vx3DMultiplyMatrix4(m, m_ViewProj, world);
+        return IsVisibleClip(m, box);
+    }
+
+    // Tests a box given in world coordinates.
+    XBOOL IsVisible(const VxBbox &worldBox) const { return IsVisibleClip(m_ViewProj, worldBox); }
+
+    // Nearest depth at a pixel.
+    float GetDepth(int x, int y) const { return m_Depth[y * m_Pitch + x]; }
+
+protected:
+    struct ScreenVertex
+    {
+        float x, y, z;
+    };
+
+    static void Transform(const VxMatrix &m, const VxVector &v, VxVector4 &r)
+    {
+        r.x = v.x * m[0][0] + v.y * m[1][0] + v.z * m[2][0] + m[3][0];
+        r.y = v.x * m[0][1] + v.y * m[1][1] + v.z * m[2][1] + m[3][1];
+        r.z = v.x * m[0][2] + v.y * m[1][2] + v.z * m[2][2] + m[3][2];
+        r.w = v.x * m[0][3] + v.y * m[1][3] + v.z * m[2][3] + m[3][3];
+    }
+
+    ScreenVertex ToScreen(const VxVector4 &c) const
+    {
+        const float iw = 1.0f / c.w;
+        ScreenVertex s;
+        s.x = (c.x * iw * 0.5f + 0.5f) * m_Width;
+        s.y = (0.5f - c.y * iw * 0.5f) * m_Height;
+        s.z = c.z * iw;
+        return s;
+    }
+
+    // Clips a triangle to the near plane (z >= 0) and draws it.
+    void ClipTriangle(const VxVector4 &a, const VxVector4 &b, const VxVector4 &c)
+    {
+        const VxVector4 *v[3] = {&a, &b, &c};
+        int inside = 0;
+        int k;
+        for (k = 0; k < 3; ++k)
+            inside += v[k]->z >= 0.0f ? 1 : 0;
+        if (!inside)
+            return;
+        if (inside == 3)
+        {
+            DrawTriangle(ToScreen(a), ToScreen(b), ToScreen(c));
+            return;
+        }
+        VxVector4 poly[4];
+        int count = 0;
+        for (k = 0; k < 3; ++k)
+        {
+            const VxVector4 &p = *v[k];
+            const VxVector4 &q = *v[(k + 1) % 3];
+            if (p.z >= 0.0f)
+                poly[count++] = p;
+            if ((p.z >= 0.0f) != (q.z >= 0.0f))
+            {
+                const float t = p.z / (p.z - q.z);
+                poly[count].x = p.x + (q.x - p.x) * t;
+                poly[count].y = p.y + (q.y - p.y) * t;
+                poly[count].z = 0.0f;
+                poly[count].w = p.w + (q.w - p.w) * t;
+                ++count;
+            }
+        }
+        const ScreenVertex s0 = ToScreen(poly[0]);
+        for (k = 1; k + 1 < count; ++k)
+            DrawTriangle(s0, ToScreen(poly[k]), ToScreen(poly[k + 1]));
+    }
+
+    void DrawTriangle(const ScreenVertex &v0, ScreenVertex v1, ScreenVertex v2)
+    {
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (area < 0.0f)
+        {
+            const ScreenVertex t = v1;
+            v1 = v2;
+            v2 = t;
+            area = -area;
+        }
+        if (area < 1e-6f)
+            return;
+
+        int minX = (int)XMax(0.0f, XMin(v0.x, XMin(v1.x, v2.x)));
+        int minY = (int)XMax(0.0f, XMin(v0.y, XMin(v1.y, v2.y)));
+        int maxX = (int)XMin((float)(m_Width - 1), XMax(v0.x, XMax(v1.x, v2.x)));
+        int maxY = (int)XMin((float)(m_Height - 1), XMax(v0.y, XMax(v1.y, v2.y)));
+        if (minX > maxX || minY > maxY)
+            return;
+        ++m_Triangles;
+        minX &= ~3;
+
+        // edge functions E(p) = (b - a) x (p - a), positive inside
+        const ScreenVertex *a[3] = {&v1, &v2, &v0};
+        const ScreenVertex *b[3] = {&v2, &v0, &v1};
+        float dx[3], dy[3], e0[3];
+        XBOOL topLeft[3];
+        const float px = minX + 0.5f;
+        const float py = minY + 0.5f;
+        int k;
+        for (k = 0; k < 3; ++k)
+        {
+            dx[k] = -(b[k]->y - a[k]->y);
+            dy[k] = b[k]->x - a[k]->x;
+            e0[k] = (b[k]->x - a[k]->x) * (py - a[k]->y) - (b[k]->y - a[k]->y) * (px - a[k]->x);
+            // the interior is on the right of a left edge or under a top edge
+            topLeft[k] = dx[k] > 0.0f || (dx[k] == 0.0f && dy[k] > 0.0f);
+        }
+        // the depth is linear in screen space: the barycentric weights are E / area
+        const float ia = 1.0f / area;
+        const float zdx = (dx[0] * v0.z + dx[1] * v1.z + dx[2] * v2.z) * ia;
+        const float zdy = (dy[0] * v0.z + dy[1] * v1.z + dy[2] * v2.z) * ia;
+        const float z0 = (e0[0] * v0.z + e0[1] * v1.z + e0[2] * v2.z) * ia;
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            const float fy = (float)(y - minY);
+            float er[3];
+            for (k = 0; k < 3; ++k)
+                er[k] = e0[k] + dy[k] * fy;
+            const float zr = z0 + zdy * fy;
+            float *row = m_Depth.Begin() + y * m_Pitch;
+            int x = minX;
+#if VX_SIMD_SSE
+            if (VxHasSSE())
+            {
+                const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 ones = _mm_cmpeq_ps(zero, zero);
+                const __m128 tl0 = topLeft[0] ? ones : zero;
+                const __m128 tl1 = topLeft[1] ? ones : zero;
+                const __m128 tl2 = topLeft[2] ? ones : zero;
+                for (; x <= maxX; x += 4)
+                {
+                    const __m128 off = _mm_add_ps(_mm_set1_ps((float)(x - minX)), lanes);
+                    const __m128 a0 = _mm_add_ps(_mm_set1_ps(er[0]), _mm_mul_ps(_mm_set1_ps(dx[0]), off));
+                    const __m128 a1 = _mm_add_ps(_mm_set1_ps(er[1]), _mm_mul_ps(_mm_set1_ps(dx[1]), off));
+                    const __m128 a2 = _mm_add_ps(_mm_set1_ps(er[2]), _mm_mul_ps(_mm_set1_ps(dx[2]), off));
+                    const __m128 in0 = _mm_or_ps(_mm_cmpgt_ps(a0, zero), _mm_and_ps(tl0, _mm_cmpeq_ps(a0, zero)));
+                    const __m128 in1 = _mm_or_ps(_mm_cmpgt_ps(a1, zero), _mm_and_ps(tl1, _mm_cmpeq_ps(a1, zero)));
+                    const __m128 in2 = _mm_or_ps(_mm_cmpgt_ps(a2, zero), _mm_and_ps(tl2, _mm_cmpeq_ps(a2, zero)));
+                    const __m128 in = _mm_and_ps(in0, _mm_and_ps(in1, in2));
+                    if (!_mm_movemask_ps(in))
+                        continue;
+                    const __m128 z = _mm_add_ps(_mm_set1_ps(zr), _mm_mul_ps(_mm_set1_ps(zdx), off));
+                    const __m128 d = _mm_loadu_ps(row + x);
+                    const __m128 nd = _mm_min_ps(d, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(in, nd), _mm_andnot_ps(in, d)));
+                }
+                continue;
+            }
+#endif
+            for (; x <= maxX; ++x)
+            {
+                const float off = (float)(x - minX);
+                if (Inside(er[0] + dx[0] * off, topLeft[0]) && Inside(er[1] + dx[1] * off, topLeft[1]) &&
+                    Inside(er[2] + dx[2] * off, topLeft[2]))
+                {
+                    const float z = zr + zdx * off;
+                    if (z < row[x])
+                        row[x] = z;
+                }
+            }
+        }
+    }
+
+    static XBOOL Inside(float e, XBOOL topLeft) { return e > 0.0f || (topLeft && e == 0.0f); }
+
+    XBOOL IsVisibleClip(const VxMatrix &m, const VxBbox &box) const
+    {
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+        for (int c = 0; c < 8; ++c)
+        {
+            const VxVector corner((c & 1) ? box.Max.x : box.Min.x, (c & 2) ? box.Max.y : box.Min.y, (c & 4) ? box.Max.z : box.Min.z);
+            VxVector4 h;
+            Transform(m, corner, h);
+            // crosses the near plane
+            if (h.z < 0.0f || h.w <= 0.0f)
+                return TRUE;
+            const ScreenVertex s = ToScreen(h);
+            minX = XMin(minX, s.x);
+            maxX = XMax(maxX, s.x);
+            minY = XMin(minY, s.y);
+            maxY = XMax(maxY, s.y);
+            minZ = XMin(minZ, s.z);
+        }
+        if (maxX < 0.0f || maxY < 0.0f || minX >= (float)m_Width || minY >= (float)m_Height || minZ > 1.0f)
+            return FALSE;
+        const int x0 = (int)XMax(0.0f, minX);
+        const int y0 = (int)XMax(0.0f, minY);
+        const int x1 = (int)XMin((float)(m_Width - 1), maxX);
+        const int y1 = (int)XMin((float)(m_Height - 1), maxY);
+        for (int y = y0; y <= y1; ++y)
+        {
+            const float *row = m_Depth.Begin() + y * m_Pitch;
+            int x = x0;
+#if VX_SIMD_SSE
+            if (VxHasSSE())
+            {
+                const __m128 z = _mm_set1_ps(minZ);
+                for (; x + 3 <= x1; x += 4)
+                {
+                    if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), z)))
+                        return TRUE;
+                }
+            }
+#endif
+            for (; x <= x1; ++x)
+            {
+                if (row[x] >= minZ)
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    int m_Width;
+    int m_Height;
+    int m_Pitch; // floats per row
+    XArray<float> m_Depth;
+    VxMatrix m_ViewProj;
+    XArray<VxVector4> m_Clip; // transformed vertices of the last mesh
+    int m_Triangles;
+};
+
+#endif // VXDEPTHRASTERIZER_H
@@ -0,0 +1,280 @@
+#ifndef VXFABRIK_H
+#define VXFABRIK_H
+
+#include "VxVector.h"
+#include "VxSIMD.h"
+#include "VxFastMath.h"
+
+/**********************************************************
+Summary: Joint chain solved by VxFabrikSolver.
+
+Remarks:
+    The joints are both the starting configuration and the result: giving
+    the solution of the previous frame starts the solver close to the new
+    one (warm start), it then often converges in one or two iterations.
+
+See Also: VxFabrikSolver
+*********************************************************/
+struct VxFabrikChain
+{
+    VxVector *m_Joints;     // m_JointCount positions, the first one does not move
+    const float *m_Lengths; // m_JointCount - 1 bone lengths
+    int m_JointCount;
+    VxVector m_Target;      // position to reach with the last joint
+    int m_Iterations;       // iterations done by the last solve
+    float m_Error;          // distance between the last joint and the target after the solve
+};
+
+/**********************************************************
+Summary: Iterative inverse kinematics solver (FABRIK).
+
+Remarks:
+    o Forward And Backward Reaching Inverse Kinematics: each iteration
+    moves the last joint on the target and the others toward it keeping
+    the bone lengths, then moves the first joint back to its place.
+    o The iterations stop when the last joint is within the tolerance of
+    the target, or after the maximum number of iterations. An
+    unreachable target stretches the chain toward it.
+    o SolveBatch solves the chains with the same number of joints 4 at a
+    time with SSE (one chain per lane, the converged chains are masked
+    out), the others one by one.
+    o Joint limits are not handled.
+
+    VxFabrikSolver solver(0.001f, 10);
+    solver.SolveBatch(chains, chainCount);
+
+See Also: VxFabrikChain,CKIKSolver
+*********************************************************/
+class VxFabrikSolver
+{
+public:
+    enum
+    {
+        MaxBatchJoints = 16 // longer chains are solved without SSE
+    };
+
+    VxFabrikSolver(float tolerance = 0.001f, int maxIterations = 10) : m_Tolerance(tolerance), m_MaxIterations(maxIterations) {}
+
+    void SetTolerance(float tolerance) { m_Tolerance = tolerance; }
+    void SetMaxIterations(int count) { m_MaxIterations = count; }
+
+    // Solves a chain, returns the number of iterations.
+    int Solve(VxFabrikChain &chain) const
+    {
+        const int n = chain.m_JointCount - 1;
+        chain.m_Iterations = 0;
+        if (n < 1)
+        {
+            chain.m_Error = 0.0f;
+            return 0;
+        }
+        VxVector *p = chain.m_Joints;
+        const float *d = chain.m_Lengths;
+        const VxVector &target = chain.m_Target;
+        if (Stretch(chain))
+            return 0;
+
+        const VxVector root = p[0];
+        const float tol2 = m_Tolerance * m_Tolerance;
+        int it = 0;
+        while (it < m_MaxIterations && SquareMagnitude(p[n] - target) > tol2)
+        {
+            int i;
+            p[n] = target;
+            for (i = n - 1; i >= 0; --i)
+                p[i] = p[i + 1] + Direction(p[i] - p[i + 1]) * d[i];
+            p[0] = root;
+            for (i = 0; i < n; ++i)
+                p[i + 1] = p[i] + Direction(p[i + 1] - p[i]) * d[i];
+            ++it;
+        }
+        chain.m_Iterations = it;
+        chain.m_Error = Magnitude(p[n] - target);
+        return it;
+    }
+
+    // Solves several chains.
+    void SolveBatch(VxFabrikChain *chains, int count) const
+    {
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            // chains of the same size, 4 at a time
+            VxFabrikChain *group[4];
+            XBYTE done[256];
+            int i;
+            for (i = 0; i < count; ++i)
+            {
+                if (i < 256)
+                    done[i] = 0;
+            }
+            for (i = 0; i < count && i < 256; ++i)
+            {
+                if (done[i])
+                    continue;
+                const int joints = chains[i].m_JointCount;
+                if (joints < 2 || joints > MaxBatchJoints)
+                {
+                    Solve(chains[i]);
+                    done[i] = 1;
+                    continue;
+                }
+                int n = 0;
+                for (int j = i; j < count && j < 256 && n < 4; ++j)
+                {
+                    if (done[j] || chains[j].m_JointCount != joints)
+                        continue;
+                    done[j] = 1;
+                    // unreachable targets are solved directly
+                    if (!Stretch(chains[j]))
+                        group[n++] = &chains[j];
+                }
+                if (n == 1)
+                    Solve(*group[0]);
+                else if (n > 1)
+                    Solve4(group, n, joints);
+            }
+            for (; i < count; ++i)
+                Solve(chains[i]);
+            return;
+        }
+#endif
+        for (int i = 0; i < count; ++i)
+            Solve(chains[i]);
+    }
+
+protected:
+    static VxVector Direction(const VxVector &v)
+    {
+        const float l = SquareMagnitude(v);
+        return (l > 0.0f) ? v * VxFastRsqrt(l) : VxVector(0.0f, 0.0f, 0.0f);
+    }
+
+    // Straight chain toward an unreachable target, returns FALSE if the target is reachable.
+    XBOOL Stretch(VxFabrikChain &chain) const
+    {
+        const int n = chain.m_JointCount - 1;
+        VxVector *p = chain.m_Joints;
+        float total = 0.0f;
+        for (int i = 0; i < n; ++i)
+            total += chain.m_Lengths[i];
+        if (SquareMagnitude(chain.m_Target - p[0]) < total * total)
+            return FALSE;
+        const VxVector dir = Direction(chain.m_Target - p[0]);
+        for (int i = 0; i < n; ++i)
+            p[i + 1] = p[i] + dir * chain.m_Lengths[i];
+        chain.m_Iterations = 0;
+        chain.m_Error = Magnitude(p[n] - chain.m_Target);
+        return TRUE;
+    }
+
+#if VX_SIMD_SSE
+    // Normalizes 4 vectors and scales them by the lengths.
+    static void ScaleDirection4(__m128 &x, __m128 &y, __m128 &z, __m128 length)
+    {
+        const __m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 r = _mm_rsqrt_ps(l2);
+        r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), l2), _mm_mul_ps(r, r))));
+        // null vectors stay null
+        r = _mm_and_ps(r, _mm_cmpgt_ps(l2, _mm_setzero_ps()));
+        r = _mm_mul_ps(r, length);
+        x = _mm_mul_ps(x, r);
+        y = _mm_mul_ps(y, r);
+        z = _mm_mul_ps(z, r);
+    }
+
+    static __m128 Select(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+    void Solve4(VxFabrikChain **group, int count, int joints) const
+    {
+        __m128 px[MaxBatchJoints], py[MaxBatchJoints], pz[MaxBatchJoints], len[MaxBatchJoints];
+        float tmp[4][4];
+        int i, k;
+        // load the joints, one chain per lane (missing lanes copy the first chain)
+        for (i = 0; i < joints; ++i)
+        {
+            for (k = 0; k < 4; ++k)
+            {
+                const VxFabrikChain &c = *group[k < count ? k : 0];
+                tmp[0][k] = c.m_Joints[i].x;
+                tmp[1][k] = c.m_Joints[i].y;
+                tmp[2][k] = c.m_Joints[i].z;
+                tmp[3][k] = (i < joints - 1) ? c.m_Lengths[i] : 0.0f;
+            }
+            px[i] = _mm_loadu_ps(tmp[0]);
+            py[i] = _mm_loadu_ps(tmp[1]);
+            pz[i] = _mm_loadu_ps(tmp[2]);
+            len[i] = _mm_loadu_ps(tmp[3]);
+        }
+        for (k = 0; k < 4; ++k)
+        {
+            const VxFabrikChain &c = *group[k < count ? k : 0];
+            tmp[0][k] = c.m_Target.x;
+            tmp[1][k] = c.m_Target.y;
+            tmp[2][k] = c.m_Target.z;
+        }
+        const __m128 tx = _mm_loadu_ps(tmp[0]), ty = _mm_loadu_ps(tmp[1]), tz = _mm_loadu_ps(tmp[2]);
+        const __m128 rx = px[0], ry = py[0], rz = pz[0];
+        const __m128 tol2 = _mm_set1_ps(m_Tolerance * m_Tolerance);
+        const int n = joints - 1;
+        int iterations[4] = {0, 0, 0, 0};
+
+        for (int it = 0; it < m_MaxIterations; ++it)
+        {
+            __m128 dx = _mm_sub_ps(px[n], tx), dy = _mm_sub_ps(py[n], ty), dz = _mm_sub_ps(pz[n], tz);
+            const __m128 active = _mm_cmpgt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)), tol2);
+            const int mask = _mm_movemask_ps(active);
+            if (!mask)
+                break;
+            for (k = 0; k < 4; ++k)
+            {
+                if (mask & (1 << k))
+                    ++iterations[k];
+            }
+            // backward: last joint on the target
+            px[n] = Select(active, tx, px[n]);
+            py[n] = Select(active, ty, py[n]);
+            pz[n] = Select(active, tz, pz[n]);
+            for (i = n - 1; i >= 0; --i)
+            {
+                __m128 x = _mm_sub_ps(px[i], px[i + 1]), y = _mm_sub_ps(py[i], py[i + 1]), z = _mm_sub_ps(pz[i], pz[i + 1]);
+                ScaleDirection4(x, y, z, len[i]);
+                px[i] = Select(active, _mm_add_ps(px[i + 1], x), px[i]);
+                py[i] = Select(active, _mm_add_ps(py[i + 1], y), py[i]);
+                pz[i] = Select(active, _mm_add_ps(pz[i + 1], z), pz[i]);
+            }
+            // forward: first joint back to the root
+            px[0] = rx;
+            py[0] = ry;
+            pz[0] = rz;
+            for (i = 0; i < n; ++i)
+            {
+                __m128 x = _mm_sub_ps(px[i + 1], px[i]), y = _mm_sub_ps(py[i + 1], py[i]), z = _mm_sub_ps(pz[i + 1], pz[i]);
+                ScaleDirection4(x, y, z, len[i]);
+                px[i + 1] = Select(active, _mm_add_ps(px[i], x), px[i + 1]);
+                py[i + 1] = Select(active, _mm_add_ps(py[i], y), py[i + 1]);
+                pz[i + 1] = Select(active, _mm_add_ps(pz[i], z), pz[i + 1]);
+            }
+        }
+
+        for (i = 0; i < joints; ++i)
+        {
+            _mm_storeu_ps(tmp[0], px[i]);
+            _mm_storeu_ps(tmp[1], py[i]);
+            _mm_storeu_ps(tmp[2], pz[i]);
+            for (k = 0; k < count; ++k)
+                group[k]->m_Joints[i] = VxVector(tmp[0][k], tmp[1][k], tmp[2][k]);
+        }
+        for (k = 0; k < count; ++k)
+        {
+            group[k]->m_Iterations = iterations[k];
+            group[k]->m_Error = Magnitude(group[k]->m_Joints[n] - group[k]->m_Target);
+        }
+    }
+#endif
+
+    float m_Tolerance;
+    int m_MaxIterations;
+};
+
+#endif // VXFABRIK_H
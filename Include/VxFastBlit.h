@@ -0,0 +1,462 @@
+#ifndef VXFASTBLIT_H
+#define VXFASTBLIT_H
+
+#include "VxMath.h"
+#include "VxSIMD.h"
+
+/*************************************************
+{filename:VxFastBlit}
+Summary: Specialized conversions for the common pairs of pixel formats.
+
+Remarks:
+    o VxDoBlit and VxDoBlitUpsideDown convert any pair of formats from
+    their masks, pixel by pixel. VxFastBlit and VxFastBlitUpsideDown take
+    the same arguments and use a line conversion function when the two
+    formats are in the table of VxGetBlitLineFunction, VxDoBlit otherwise:
+        o _32_ARGB8888 to and from _16_RGB565, _16_RGB555, _16_ARGB1555 and
+        _16_ARGB4444.
+        o _24_RGB888 and _32_RGB888 to and from _32_ARGB8888.
+        o _32_ARGB8888 to and from _32_ABGR8888, _32_RGBA8888 and _32_BGRA8888.
+        o Copies between images of the same format.
+    o The functions convert 4 or 8 pixels at a time with SSE2. The colors
+    are reduced by truncation and expanded by replicating their high bits
+    (a 5 bits 31 gives 255), the alpha of a format without alpha is 255.
+    o Dynamic textures converted every frame (video, copies of render
+    targets) should use these functions or VxGetBlitLineFunction directly.
+    o VxFastAlphaBlit is VxDoAlphaBlit for 32 bits images with an 8 bits alpha.
+
+See also: VxDoBlit,VxDoBlitUpsideDown,VxDoAlphaBlit
+*************************************************/
+
+// Converts count pixels of a line.
+typedef void (*VxBlitLineFunction)(const XBYTE *src, XBYTE *dst, int count);
+
+// {secret}
+// 32 to 16 bits conversions, Pixels gives the 16 bits values in 32 bits lanes.
+struct VxConvertARGB8888ToRGB565
+{
+    static XDWORD Pixel(XDWORD p) { return ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p)
+    {
+        return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800)),
+                                         _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0))),
+                            _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F)));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertARGB8888ToRGB555
+{
+    static XDWORD Pixel(XDWORD p) { return ((p >> 9) & 0x7C00) | ((p >> 6) & 0x03E0) | ((p >> 3) & 0x001F); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p)
+    {
+        return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 9), _mm_set1_epi32(0x7C00)),
+                                         _mm_and_si128(_mm_srli_epi32(p, 6), _mm_set1_epi32(0x03E0))),
+                            _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F)));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertARGB8888ToARGB1555
+{
+    static XDWORD Pixel(XDWORD p) { return ((p >> 16) & 0x8000) | VxConvertARGB8888ToRGB555::Pixel(p); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p)
+    {
+        return _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0x8000)), VxConvertARGB8888ToRGB555::Pixels(p));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertARGB8888ToARGB4444
+{
+    static XDWORD Pixel(XDWORD p) { return ((p >> 16) & 0xF000) | ((p >> 12) & 0x0F00) | ((p >> 8) & 0x00F0) | ((p >> 4) & 0x000F); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p)
+    {
+        return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xF000)),
+                                         _mm_and_si128(_mm_srli_epi32(p, 12), _mm_set1_epi32(0x0F00))),
+                            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0x00F0)),
+                                         _mm_and_si128(_mm_srli_epi32(p, 4), _mm_set1_epi32(0x000F))));
+    }
+#endif
+};
+
+// {secret}
+// 16 to 32 bits conversions, the 16 bits values are given in 32 bits lanes.
+struct VxConvertRGB565ToARGB8888
+{
+    static XDWORD Pixel(XDWORD v)
+    {
+        return 0xFF000000 | ((v << 8) & 0xF80000) | ((v << 3) & 0x070000) | ((v << 5) & 0xFC00) | ((v >> 1) & 0x0300) | ((v << 3) & 0xF8) | ((v >> 2) & 0x07);
+    }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        const __m128i r = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), _mm_set1_epi32(0xF80000)), _mm_and_si128(_mm_slli_epi32(v, 3), _mm_set1_epi32(0x070000)));
+        const __m128i g = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 5), _mm_set1_epi32(0xFC00)), _mm_and_si128(_mm_srli_epi32(v, 1), _mm_set1_epi32(0x0300)));
+        const __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 3), _mm_set1_epi32(0xF8)), _mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0x07)));
+        return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, _mm_set1_epi32((int)0xFF000000)));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertRGB555ToARGB8888
+{
+    static XDWORD Pixel(XDWORD v)
+    {
+        return 0xFF000000 | ((v << 9) & 0xF80000) | ((v << 4) & 0x070000) | ((v << 6) & 0xF800) | ((v << 1) & 0x0700) | ((v << 3) & 0xF8) | ((v >> 2) & 0x07);
+    }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        const __m128i r = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 9), _mm_set1_epi32(0xF80000)), _mm_and_si128(_mm_slli_epi32(v, 4), _mm_set1_epi32(0x070000)));
+        const __m128i g = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 6), _mm_set1_epi32(0xF800)), _mm_and_si128(_mm_slli_epi32(v, 1), _mm_set1_epi32(0x0700)));
+        const __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 3), _mm_set1_epi32(0xF8)), _mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0x07)));
+        return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, _mm_set1_epi32((int)0xFF000000)));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertARGB1555ToARGB8888
+{
+    static XDWORD Pixel(XDWORD v) { return (VxConvertRGB555ToARGB8888::Pixel(v) & 0x00FFFFFF) | ((v & 0x8000) ? 0xFF000000 : 0); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        const __m128i a = _mm_and_si128(_mm_srai_epi32(_mm_slli_epi32(v, 16), 31), _mm_set1_epi32((int)0xFF000000));
+        return _mm_or_si128(_mm_and_si128(VxConvertRGB555ToARGB8888::Pixels(v), _mm_set1_epi32(0x00FFFFFF)), a);
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertARGB4444ToARGB8888
+{
+    static XDWORD Pixel(XDWORD v)
+    {
+        return ((v << 16) & 0xF0000000) | ((v << 12) & 0x0F000000) | ((v << 12) & 0xF00000) | ((v << 8) & 0x0F0000) | ((v << 8) & 0xF000) | ((v << 4) & 0x0F00) | ((v << 4) & 0xF0) | (v & 0x0F);
+    }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        // each nibble at the high and low half of its byte
+        const __m128i hi = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 16), _mm_set1_epi32((int)0xF0000000)), _mm_and_si128(_mm_slli_epi32(v, 12), _mm_set1_epi32(0xF00000))),
+                                        _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), _mm_set1_epi32(0xF000)), _mm_and_si128(_mm_slli_epi32(v, 4), _mm_set1_epi32(0xF0))));
+        return _mm_or_si128(hi, _mm_srli_epi32(_mm_and_si128(hi, _mm_set1_epi32((int)0xF0F0F0F0)), 4));
+    }
+#endif
+};
+
+// {secret}
+// 32 to 32 bits conversions.
+struct VxConvertSwapRB
+{
+    // ARGB8888 <-> ABGR8888
+    static XDWORD Pixel(XDWORD p) { return (p & 0xFF00FF00) | ((p >> 16) & 0xFF) | ((p & 0xFF) << 16); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p)
+    {
+        return _mm_or_si128(_mm_and_si128(p, _mm_set1_epi32((int)0xFF00FF00)),
+                            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xFF)), _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFF)), 16)));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertARGB8888ToRGBA8888
+{
+    static XDWORD Pixel(XDWORD p) { return (p << 8) | (p >> 24); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p) { return _mm_or_si128(_mm_slli_epi32(p, 8), _mm_srli_epi32(p, 24)); }
+#endif
+};
+
+// {secret}
+struct VxConvertRGBA8888ToARGB8888
+{
+    static XDWORD Pixel(XDWORD p) { return (p >> 8) | (p << 24); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p) { return _mm_or_si128(_mm_srli_epi32(p, 8), _mm_slli_epi32(p, 24)); }
+#endif
+};
+
+// {secret}
+struct VxConvertSwapBytes
+{
+    // ARGB8888 <-> BGRA8888
+    static XDWORD Pixel(XDWORD p) { return (p >> 24) | ((p >> 8) & 0xFF00) | ((p << 8) & 0xFF0000) | (p << 24); }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p)
+    {
+        // bytes of the words swapped, then the words
+        p = _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8));
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+    }
+#endif
+};
+
+// {secret}
+struct VxConvertSetAlpha
+{
+    // RGB888 (32 bits) -> ARGB8888
+    static XDWORD Pixel(XDWORD p) { return p | 0xFF000000; }
+#if VX_SIMD_SSE2
+    static __m128i Pixels(__m128i p) { return _mm_or_si128(p, _mm_set1_epi32((int)0xFF000000)); }
+#endif
+};
+
+// {secret}
+template <class Conversion>
+inline void VxBlitLine32To16(const XBYTE *src, XBYTE *dst, int count)
+{
+    const XDWORD *s = (const XDWORD *)src;
+    XWORD *d = (XWORD *)dst;
+    int i = 0;
+#if VX_SIMD_SSE2
+    // the 32 bits lanes are packed as signed values
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i a = _mm_sub_epi32(Conversion::Pixels(_mm_loadu_si128((const __m128i *)(s + i))), bias32);
+        const __m128i b = _mm_sub_epi32(Conversion::Pixels(_mm_loadu_si128((const __m128i *)(s + i + 4))), bias32);
+        _mm_storeu_si128((__m128i *)(d + i), _mm_add_epi16(_mm_packs_epi32(a, b), bias16));
+    }
+#endif
+    for (; i < count; ++i)
+        d[i] = (XWORD)Conversion::Pixel(s[i]);
+}
+
+// {secret}
+template <class Conversion>
+inline void VxBlitLine16To32(const XBYTE *src, XBYTE *dst, int count)
+{
+    const XWORD *s = (const XWORD *)src;
+    XDWORD *d = (XDWORD *)dst;
+    int i = 0;
+#if VX_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i), Conversion::Pixels(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128((__m128i *)(d + i + 4), Conversion::Pixels(_mm_unpackhi_epi16(v, zero)));
+    }
+#endif
+    for (; i < count; ++i)
+        d[i] = Conversion::Pixel(s[i]);
+}
+
+// {secret}
+template <class Conversion>
+inline void VxBlitLine32To32(const XBYTE *src, XBYTE *dst, int count)
+{
+    const XDWORD *s = (const XDWORD *)src;
+    XDWORD *d = (XDWORD *)dst;
+    int i = 0;
+#if VX_SIMD_SSE2
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i *)(d + i), Conversion::Pixels(_mm_loadu_si128((const __m128i *)(s + i))));
+#endif
+    for (; i < count; ++i)
+        d[i] = Conversion::Pixel(s[i]);
+}
+
+// {secret}
+// 4 pixels read as 3 double words.
+inline void VxBlitLineRGB888ToARGB8888(const XBYTE *src, XBYTE *dst, int count)
+{
+    XDWORD *d = (XDWORD *)dst;
+    int i = 0;
+    for (; i + 4 <= count; i += 4, src += 12)
+    {
+        const XDWORD *s = (const XDWORD *)src;
+        const XDWORD w0 = s[0], w1 = s[1], w2 = s[2];
+        d[i + 0] = 0xFF000000 | w0;
+        d[i + 1] = 0xFF000000 | (w0 >> 24) | (w1 << 8);
+        d[i + 2] = 0xFF000000 | (w1 >> 16) | (w2 << 16);
+        d[i + 3] = 0xFF000000 | (w2 >> 8);
+    }
+    for (; i < count; ++i, src += 3)
+        d[i] = 0xFF000000 | (src[2] << 16) | (src[1] << 8) | src[0];
+}
+
+// {secret}
+inline void VxBlitLineARGB8888ToRGB888(const XBYTE *src, XBYTE *dst, int count)
+{
+    const XDWORD *s = (const XDWORD *)src;
+    int i = 0;
+    for (; i + 4 <= count; i += 4, dst += 12)
+    {
+        XDWORD *d = (XDWORD *)dst;
+        const XDWORD p0 = s[i], p1 = s[i + 1], p2 = s[i + 2], p3 = s[i + 3];
+        d[0] = (p0 & 0xFFFFFF) | (p1 << 24);
+        d[1] = ((p1 >> 8) & 0xFFFF) | (p2 << 16);
+        d[2] = ((p2 >> 16) & 0xFF) | (p3 << 8);
+    }
+    for (; i < count; ++i, dst += 3)
+    {
+        dst[0] = (XBYTE)s[i];
+        dst[1] = (XBYTE)(s[i] >> 8);
+        dst[2] = (XBYTE)(s[i] >> 16);
+    }
+}
+
+/*************************************************
+Summary: Returns the function converting lines between two pixel formats.
+
+Return Value:
+    The conversion function, NULL if the pair of formats is not specialized
+(use VxDoBlit) or one of the formats is the same as the other (use memcpy).
+*************************************************/
+inline VxBlitLineFunction VxGetBlitLineFunction(VX_PIXELFORMAT src, VX_PIXELFORMAT dst)
+{
+    struct Entry
+    {
+        VX_PIXELFORMAT m_Src;
+        VX_PIXELFORMAT m_Dst;
+        VxBlitLineFunction m_Function;
+    };
+    static const Entry table[] = {
+        {_32_ARGB8888, _16_RGB565, VxBlitLine32To16<VxConvertARGB8888ToRGB565>},
+        {_32_ARGB8888, _16_RGB555, VxBlitLine32To16<VxConvertARGB8888ToRGB555>},
+        {_32_ARGB8888, _16_ARGB1555, VxBlitLine32To16<VxConvertARGB8888ToARGB1555>},
+        {_32_ARGB8888, _16_ARGB4444, VxBlitLine32To16<VxConvertARGB8888ToARGB4444>},
+        {_32_RGB888, _16_RGB565, VxBlitLine32To16<VxConvertARGB8888ToRGB565>},
+        {_32_RGB888, _16_RGB555, VxBlitLine32To16<VxConvertARGB8888ToRGB555>},
+        {_16_RGB565, _32_ARGB8888, VxBlitLine16To32<VxConvertRGB565ToARGB8888>},
+        {_16_RGB555, _32_ARGB8888, VxBlitLine16To32<VxConvertRGB555ToARGB8888>},
+        {_16_ARGB1555, _32_ARGB8888, VxBlitLine16To32<VxConvertARGB1555ToARGB8888>},
+        {_16_ARGB4444, _32_ARGB8888, VxBlitLine16To32<VxConvertARGB4444ToARGB8888>},
+        {_16_RGB565, _32_RGB888, VxBlitLine16To32<VxConvertRGB565ToARGB8888>},
+        {_16_RGB555, _32_RGB888, VxBlitLine16To32<VxConvertRGB555ToARGB8888>},
+        {_24_RGB888, _32_ARGB8888, VxBlitLineRGB888ToARGB8888},
+        {_24_RGB888, _32_RGB888, VxBlitLineRGB888ToARGB8888},
+        {_32_ARGB8888, _24_RGB888, VxBlitLineARGB8888ToRGB888},
+        {_32_RGB888, _24_RGB888, VxBlitLineARGB8888ToRGB888},
+        {_32_RGB888, _32_ARGB8888, VxBlitLine32To32<VxConvertSetAlpha>},
+        {_32_ARGB8888, _32_ABGR8888, VxBlitLine32To32<VxConvertSwapRB>},
+        {_32_ABGR8888, _32_ARGB8888, VxBlitLine32To32<VxConvertSwapRB>},
+        {_32_ARGB8888, _32_RGBA8888, VxBlitLine32To32<VxConvertARGB8888ToRGBA8888>},
+        {_32_RGBA8888, _32_ARGB8888, VxBlitLine32To32<VxConvertRGBA8888ToARGB8888>},
+        {_32_ARGB8888, _32_BGRA8888, VxBlitLine32To32<VxConvertSwapBytes>},
+        {_32_BGRA8888, _32_ARGB8888, VxBlitLine32To32<VxConvertSwapBytes>}};
+    for (int i = 0; i < (int)(sizeof(table) / sizeof(table[0])); ++i)
+    {
+        if (table[i].m_Src == src && table[i].m_Dst == dst)
+            return table[i].m_Function;
+    }
+    return NULL;
+}
+
+// {secret}
+// FALSE if the images cannot be converted by lines (VxDoBlit must be used).
+inline XBOOL VxBlitLines(const VxImageDescEx &src_desc, const VxImageDescEx &dst_desc, XBOOL upsideDown)
+{
+    if (src_desc.Width != dst_desc.Width || src_desc.Height != dst_desc.Height || !src_desc.Image || !dst_desc.Image ||
+        src_desc.ColorMapEntries || dst_desc.ColorMapEntries)
+        return FALSE;
+    const VX_PIXELFORMAT src = VxImageDesc2PixelFormat(src_desc);
+    const VX_PIXELFORMAT dst = VxImageDesc2PixelFormat(dst_desc);
+    if (src == UNKNOWN_PF || dst == UNKNOWN_PF || src >= _DXT1 || dst >= _DXT1)
+        return FALSE;
+    VxBlitLineFunction function = NULL;
+    if (src != dst)
+    {
+        function = VxGetBlitLineFunction(src, dst);
+        if (!function)
+            return FALSE;
+    }
+    const int lineSize = src_desc.Width * (src_desc.BitsPerPixel >> 3);
+    for (int y = 0; y < src_desc.Height; ++y)
+    {
+        const XBYTE *s = src_desc.Image + (upsideDown ? src_desc.Height - 1 - y : y) * src_desc.BytesPerLine;
+        XBYTE *d = dst_desc.Image + y * dst_desc.BytesPerLine;
+        if (function)
+            function(s, d, src_desc.Width);
+        else
+            memcpy(d, s, lineSize);
+    }
+    return TRUE;
+}
+
+// Same as VxDoBlit, with the specialized conversions of VxGetBlitLineFunction.
+inline void VxFastBlit(const VxImageDescEx &src_desc, const VxImageDescEx &dst_desc)
+{
+    if (!VxBlitLines(src_desc, dst_desc, FALSE))
+        VxDoBlit(src_desc, dst_desc);
+}
+
+// Same as VxDoBlitUpsideDown, with the specialized conversions of VxGetBlitLineFunction.
+inline void VxFastBlitUpsideDown(const VxImageDescEx &src_desc, const VxImageDescEx &dst_desc)
+{
+    if (!VxBlitLines(src_desc, dst_desc, TRUE))
+        VxDoBlitUpsideDown(src_desc, dst_desc);
+}
+
+// Same as VxDoAlphaBlit, sets the alpha of all the pixels.
+inline void VxFastAlphaBlit(const VxImageDescEx &dst_desc, XBYTE AlphaValue)
+{
+    if (dst_desc.BitsPerPixel != 32 || dst_desc.AlphaMask != 0xFF000000 || !dst_desc.Image)
+    {
+        VxDoAlphaBlit(dst_desc, AlphaValue);
+        return;
+    }
+    const XDWORD alpha = (XDWORD)AlphaValue << 24;
+    for (int y = 0; y < dst_desc.Height; ++y)
+    {
+        XDWORD *d = (XDWORD *)(dst_desc.Image + y * dst_desc.BytesPerLine);
+        int i = 0;
+#if VX_SIMD_SSE2
+        const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i a = _mm_set1_epi32((int)alpha);
+        for (; i + 4 <= dst_desc.Width; i += 4)
+        {
+            const __m128i p = _mm_loadu_si128((const __m128i *)(d + i));
+            _mm_storeu_si128((__m128i *)(d + i), _mm_or_si128(_mm_and_si128(p, mask), a));
+        }
+#endif
+        for (; i < dst_desc.Width; ++i)
+            d[i] = (d[i] & 0x00FFFFFF) | alpha;
+    }
+}
+
+// Same as VxDoAlphaBlit, sets the alpha of each pixel from an array of Width*Height values.
+inline void VxFastAlphaBlit(const VxImageDescEx &dst_desc, XBYTE *AlphaValues)
+{
+    if (dst_desc.BitsPerPixel != 32 || dst_desc.AlphaMask != 0xFF000000 || !dst_desc.Image)
+    {
+        VxDoAlphaBlit(dst_desc, AlphaValues);
+        return;
+    }
+    for (int y = 0; y < dst_desc.Height; ++y)
+    {
+        XDWORD *d = (XDWORD *)(dst_desc.Image + y * dst_desc.BytesPerLine);
+        const XBYTE *alpha = AlphaValues + y * dst_desc.Width;
+        int i = 0;
+#if VX_SIMD_SSE2
+        const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= dst_desc.Width; i += 4)
+        {
+            // the 4 alpha bytes moved to the high byte of each lane
+            __m128i a = _mm_cvtsi32_si128(alpha[i] | (alpha[i + 1] << 8) | (alpha[i + 2] << 16) | (alpha[i + 3] << 24));
+            a = _mm_slli_epi32(_mm_unpacklo_epi16(_mm_unpacklo_epi8(a, zero), zero), 24);
+            const __m128i p = _mm_loadu_si128((const __m128i *)(d + i));
+            _mm_storeu_si128((__m128i *)(d + i), _mm_or_si128(_mm_and_si128(p, mask), a));
+        }
+#endif
+        for (; i < dst_desc.Width; ++i)
+            d[i] = (d[i] & 0x00FFFFFF) | ((XDWORD)alpha[i] << 24);
+    }
+}
+
+#endif // VXFASTBLIT_H
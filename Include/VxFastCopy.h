@@ -0,0 +1,202 @@
+#ifndef VXFASTCOPY_H
+#define VXFASTCOPY_H
+
+#include <string.h>
+
+#include "VxMath.h"
+#include "VxSIMD.h"
+
+/*************************************************
+{filename:VxFastCopy}
+Summary: Specialized versions of the strided structure copies.
+
+Remarks:
+    o VxFillStructure, VxCopyStructure and VxIndexedCopy copy any element
+    size byte per byte. VxFastFillStructure, VxFastCopyStructure and
+    VxFastIndexedCopy take the same arguments and copy the elements of 4,
+    8, 12 and 16 bytes (colors, UVs, positions and normals, 4 floats) as
+    whole double words or SSE registers; other sizes use the VxMath
+    versions.
+    o Contiguous copies (both strides equal to the element size) are
+    copied as one block.
+    o Copies writing at least VX_STREAM_COPY_SIZE bytes use non-temporal
+    stores (SSE2): the destination (a locked vertex buffer, which the CPU
+    does not read back) is not loaded into the cache and does not evict
+    the source data. The stores are fenced before the function returns.
+    o Dynamic vertex data written every frame (sprites, particles,
+    CKRenderContext::GetDrawPrimitiveStructure) should use these
+    functions.
+
+See also: VxFillStructure,VxCopyStructure,VxIndexedCopy
+*************************************************/
+#define VX_STREAM_COPY_SIZE (64 * 1024)
+
+// {secret}
+struct VxCopyElement12
+{
+    XDWORD v[3];
+};
+
+// {secret}
+struct VxCopyElement16
+{
+    XDWORD v[4];
+};
+
+// {secret}
+// Copies count elements of Dwords double words, non-temporal when stream is TRUE.
+template <int Dwords>
+inline void VxCopyDwords(XBYTE *dst, XULONG dstStride, const XBYTE *src, XULONG srcStride, const int *indices, int count, XBOOL stream)
+{
+#if VX_SIMD_SSE2
+    if (stream)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const int *s = (const int *)(src + (indices ? indices[i] : i) * srcStride);
+            int *d = (int *)(dst + i * dstStride);
+            for (int k = 0; k < Dwords; ++k)
+                _mm_stream_si32(d + k, s[k]);
+        }
+        _mm_sfence();
+        return;
+    }
+#endif
+#if VX_SIMD_SSE
+    if (Dwords == 4 && VxHasSSE())
+    {
+        for (int i = 0; i < count; ++i)
+            _mm_storeu_ps((float *)(dst + i * dstStride), _mm_loadu_ps((const float *)(src + (indices ? indices[i] : i) * srcStride)));
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+    {
+        const XDWORD *s = (const XDWORD *)(src + (indices ? indices[i] : i) * srcStride);
+        XDWORD *d = (XDWORD *)(dst + i * dstStride);
+        switch (Dwords)
+        {
+        case 1: *d = *s; break;
+        case 2: d[0] = s[0]; d[1] = s[1]; break;
+        case 3: *(VxCopyElement12 *)d = *(const VxCopyElement12 *)s; break;
+        default: *(VxCopyElement16 *)d = *(const VxCopyElement16 *)s; break;
+        }
+    }
+}
+
+// {secret}
+// Copies a contiguous block, non-temporal when stream is TRUE.
+inline void VxCopyBlock(XBYTE *dst, const XBYTE *src, XULONG size, XBOOL stream)
+{
+#if VX_SIMD_SSE2
+    if (stream)
+    {
+        // up to the first 16 bytes boundary of the destination
+        XULONG head = (XULONG)((16 - ((XULONG)(size_t)dst & 15)) & 15);
+        head = XMin(head, size);
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        size -= head;
+        for (; size >= 16; size -= 16, dst += 16, src += 16)
+            _mm_stream_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+        memcpy(dst, src, size);
+        _mm_sfence();
+        return;
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+// {secret}
+inline XBOOL VxCopyElements(XBYTE *dst, XULONG dstStride, const XBYTE *src, XULONG srcStride, XULONG size, const int *indices, int count)
+{
+    const XBOOL stream = (XULONG)count * size >= VX_STREAM_COPY_SIZE && VxHasSSE();
+    if (!indices && dstStride == size && srcStride == size)
+    {
+        VxCopyBlock(dst, src, count * size, stream);
+        return TRUE;
+    }
+    switch (size)
+    {
+    case 4: VxCopyDwords<1>(dst, dstStride, src, srcStride, indices, count, stream); return TRUE;
+    case 8: VxCopyDwords<2>(dst, dstStride, src, srcStride, indices, count, stream); return TRUE;
+    case 12: VxCopyDwords<3>(dst, dstStride, src, srcStride, indices, count, stream); return TRUE;
+    case 16: VxCopyDwords<4>(dst, dstStride, src, srcStride, indices, count, stream); return TRUE;
+    default: return FALSE;
+    }
+}
+
+// Same as VxCopyStructure.
+inline XBOOL VxFastCopyStructure(int Count, void *Dst, XULONG OutStride, XULONG SizeSrc, void *Src, XULONG InStride)
+{
+    if (!Dst || !Src || Count <= 0)
+        return VxCopyStructure(Count, Dst, OutStride, SizeSrc, Src, InStride);
+    if (VxCopyElements((XBYTE *)Dst, OutStride, (const XBYTE *)Src, InStride, SizeSrc, NULL, Count))
+        return TRUE;
+    return VxCopyStructure(Count, Dst, OutStride, SizeSrc, Src, InStride);
+}
+
+// Same as VxIndexedCopy: Dst element i is the element Indices[i] of Src.
+inline XBOOL VxFastIndexedCopy(const VxStridedData &Dst, const VxStridedData &Src, XULONG SizeSrc, int *Indices, int IndexCount)
+{
+    if (!Dst.Ptr || !Src.Ptr || !Indices || IndexCount <= 0)
+        return VxIndexedCopy(Dst, Src, SizeSrc, Indices, IndexCount);
+    if (VxCopyElements(Dst.CPtr, Dst.Stride, Src.CPtr, Src.Stride, SizeSrc, Indices, IndexCount))
+        return TRUE;
+    return VxIndexedCopy(Dst, Src, SizeSrc, Indices, IndexCount);
+}
+
+// Same as VxFillStructure: writes the element Src Count times.
+inline XBOOL VxFastFillStructure(int Count, void *Dst, XULONG Stride, XULONG SizeSrc, void *Src)
+{
+    if (!Dst || !Src || Count <= 0 || (SizeSrc != 4 && SizeSrc != 8 && SizeSrc != 12 && SizeSrc != 16))
+        return VxFillStructure(Count, Dst, Stride, SizeSrc, Src);
+    XBYTE *d = (XBYTE *)Dst;
+    const XDWORD *s = (const XDWORD *)Src;
+    const int dwords = (int)(SizeSrc >> 2);
+#if VX_SIMD_SSE2
+    if ((XULONG)Count * SizeSrc >= VX_STREAM_COPY_SIZE && VxHasSSE())
+    {
+        for (int i = 0; i < Count; ++i, d += Stride)
+            for (int k = 0; k < dwords; ++k)
+                _mm_stream_si32((int *)d + k, (int)s[k]);
+        _mm_sfence();
+        return TRUE;
+    }
+#endif
+#if VX_SIMD_SSE
+    if (dwords == 4 && VxHasSSE())
+    {
+        const __m128 v = _mm_loadu_ps((const float *)Src);
+        for (int i = 0; i < Count; ++i, d += Stride)
+            _mm_storeu_ps((float *)d, v);
+        return TRUE;
+    }
+#endif
+    switch (dwords)
+    {
+    case 1:
+        for (int i = 0; i < Count; ++i, d += Stride)
+            *(XDWORD *)d = s[0];
+        break;
+    case 2:
+        for (int i = 0; i < Count; ++i, d += Stride)
+        {
+            ((XDWORD *)d)[0] = s[0];
+            ((XDWORD *)d)[1] = s[1];
+        }
+        break;
+    case 3:
+        for (int i = 0; i < Count; ++i, d += Stride)
+            *(VxCopyElement12 *)d = *(const VxCopyElement12 *)s;
+        break;
+    default:
+        for (int i = 0; i < Count; ++i, d += Stride)
+            *(VxCopyElement16 *)d = *(const VxCopyElement16 *)s;
+        break;
+    }
+    return TRUE;
+}
+
+#endif // VXFASTCOPY_H
@@ -0,0 +1,208 @@
+#ifndef VXFASTMATH_H
+#define VXFASTMATH_H
+
+#include "VxVector.h"
+#include "VxQuaternion.h"
+#include "VxSIMD.h"
+
+/**********************************************************
+Summary: Approximate versions of some common math functions.
+
+Remarks:
+    These functions trade a little precision for speed, the bounds
+    given for each one are the maximum errors over their whole input
+    range. Use the regular functions (sqrtf, sinf, Normalize, Slerp...)
+    when exact results matter.
+
+See Also : Normalize,Slerp,VxBatchMath
+*********************************************************/
+
+/*************************************************
+Summary: Approximate reciprocal square root.
+
+Remarks:
+    Uses the SSE estimate refined by one Newton-Raphson step, or an
+    integer estimate refined by two steps without SSE. The relative error
+    is below 3e-7 with SSE and below 5e-6 without, for positive normalized
+    inputs.
+*************************************************/
+inline float VxFastRsqrt(float x)
+{
+#if VX_SIMD_SSE
+    if (VxHasSSE())
+    {
+        __m128 v = _mm_set_ss(x);
+        __m128 r = _mm_rsqrt_ss(v);
+        // r * (1.5 - 0.5 * x * r * r)
+        r = _mm_mul_ss(r, _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), v), _mm_mul_ss(r, r))));
+        float res;
+        _mm_store_ss(&res, r);
+        return res;
+    }
+#endif
+    union
+    {
+        float f;
+        XDWORD i;
+    } u;
+    u.f = x;
+    u.i = 0x5F3759DF - (u.i >> 1);
+    float r = u.f;
+    const float half = 0.5f * x;
+    r = r * (1.5f - half * r * r);
+    r = r * (1.5f - half * r * r);
+    return r;
+}
+
+/*************************************************
+Summary: Approximate normalization of a vector.
+
+Remarks:
+    The length of the result is 1 within the precision of VxFastRsqrt.
+    A null vector stays null.
+*************************************************/
+inline void VxFastNormalize(VxVector &v)
+{
+    float l = SquareMagnitude(v);
+    if (l > 0.0f)
+        v *= VxFastRsqrt(l);
+}
+
+/*************************************************
+Summary: Approximate sine.
+
+Remarks:
+    The angle is reduced to [-PI/2,PI/2] and the sine is computed with an
+    odd polynomial of degree 11. The absolute error is below 5e-7 for
+    angles in [-2PI,2PI] and below 5e-6 in [-100,100], the reduction
+    loses precision beyond.
+*************************************************/
+inline float VxFastSin(float x)
+{
+    // x in [-PI,PI]
+    float k = x * (1.0f / (2.0f * PI));
+    k = (float)(int)(k + ((k >= 0.0f) ? 0.5f : -0.5f));
+    // 2 PI split in two parts to keep the precision of the reduction
+    x -= k * 6.28125f;
+    x -= k * 1.9353071795864769e-3f;
+    // sin(x) = sin(PI - x)
+    if (x > HALFPI)
+        x = PI - x;
+    else if (x < -HALFPI)
+        x = -PI - x;
+    const float x2 = x * x;
+    return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f + x2 * (-1.0f / 39916800.0f))))));
+}
+
+/*************************************************
+Summary: Approximate cosine.
+
+Remarks:
+    Same precision than VxFastSin.
+*************************************************/
+inline float VxFastCos(float x)
+{
+    return VxFastSin(x + HALFPI);
+}
+
+// Approximate sine and cosine of an angle, see VxFastSin.
+inline void VxFastSinCos(float x, float &s, float &c)
+{
+    s = VxFastSin(x);
+    c = VxFastSin(x + HALFPI);
+}
+
+/*************************************************
+Summary: Normalizes an array of vectors.
+
+Arguments:
+    vectors: Vectors to normalize.
+    count: Number of vectors.
+    stride: Amount of bytes between two vectors.
+Remarks:
+    Packed arrays (stride == sizeof(VxVector)) are processed 4 vectors at a
+    time with SSE. Same precision than VxFastNormalize.
+*************************************************/
+inline void VxNormalizeMany(void *vectors, int count, int stride = sizeof(VxVector))
+{
+    XBYTE *ptr = (XBYTE *)vectors;
+    int i = 0;
+#if VX_SIMD_SSE
+    if (stride == sizeof(VxVector) && VxHasSSE())
+    {
+        const __m128 tiny = _mm_set1_ps(1e-30f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 three = _mm_set1_ps(3.0f);
+        float *v = (float *)ptr;
+        for (; i + 4 <= count; i += 4, v += 12)
+        {
+            __m128 x, y, z;
+            VxSSELoadVector3x4(v, x, y, z);
+            __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+            // null vectors get a huge scale which leaves them null
+            l = _mm_max_ps(l, tiny);
+            __m128 r = _mm_rsqrt_ps(l);
+            r = _mm_mul_ps(_mm_mul_ps(half, r), _mm_sub_ps(three, _mm_mul_ps(_mm_mul_ps(l, r), r)));
+            VxSSEStoreVector3x4(v, _mm_mul_ps(x, r), _mm_mul_ps(y, r), _mm_mul_ps(z, r));
+        }
+        ptr = (XBYTE *)v;
+    }
+#endif
+    for (; i < count; ++i, ptr += stride)
+        VxFastNormalize(*(VxVector *)ptr);
+}
+
+/*************************************************
+Summary: Normalized linear interpolation of two quaternions.
+
+Remarks:
+    Interpolates along the shortest path and normalizes the result. The
+    rotation speed is not constant (the angle error compared to Slerp is
+    up to 0.016 radian between orientations 90 degrees apart), use
+    VxFastSlerp for a constant speed.
+See Also: VxFastSlerp,Slerp
+*************************************************/
+inline VxQuaternion VxFastNlerp(float t, const VxQuaternion &a, const VxQuaternion &b)
+{
+    float d = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    float tb = (d < 0.0f) ? -t : t;
+    float ta = 1.0f - t;
+    VxQuaternion q;
+    q.x = a.x * ta + b.x * tb;
+    q.y = a.y * ta + b.y * tb;
+    q.z = a.z * ta + b.z * tb;
+    q.w = a.w * ta + b.w * tb;
+    float l = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
+    if (l > 0.0f)
+    {
+        l = VxFastRsqrt(l);
+        q.x *= l;
+        q.y *= l;
+        q.z *= l;
+        q.w *= l;
+    }
+    return q;
+}
+
+/*************************************************
+Summary: Approximate spherical interpolation of two quaternions.
+
+Remarks:
+    The interpolation factor is corrected with a polynomial of the angle
+    between the quaternions before a normalized linear interpolation,
+    which gives an almost constant rotation speed: the angle error compared
+    to Slerp is below 1e-3 radian, without any trigonometric function.
+    Both quaternions must be normalized.
+See Also: VxFastNlerp,Slerp
+*************************************************/
+inline VxQuaternion VxFastSlerp(float t, const VxQuaternion &a, const VxQuaternion &b)
+{
+    float d = XFabs(a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w);
+    float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float k = A * (t - 0.5f) * (t - 0.5f) + B;
+    float ot = t + t * (t - 0.5f) * (t - 1.0f) * k;
+    return VxFastNlerp(ot, a, b);
+}
+
+#endif // VXFASTMATH_H
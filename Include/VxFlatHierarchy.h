@@ -0,0 +1,346 @@
+#ifndef VXFLATHIERARCHY_H
+#define VXFLATHIERARCHY_H
+
+#include "VxBatchMath.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Transformation hierarchy stored in depth first order.
+
+Remarks:
+    o The nodes are kept in contiguous arrays (parent index, local matrix,
+    world matrix, boxes) sorted depth first: a parent is always before its
+    children and the descendants of a node are the nodes from its index to
+    GetSubtreeEnd. Updating all the world matrices is then a single forward
+    sweep, and the hierarchical boxes a single backward sweep merging each
+    node into its parent, without following any pointer.
+    o The nodes are given by handle (the index given to Build), the index
+    of a node changes when the hierarchy is rebuilt or a node changes of
+    parent: GetIndex gives the current one.
+    o World = ParentWorld * Local, as for the 3D entities. The local box
+    of a node (in its own referential) is optional: a node without box
+    only contributes the boxes of its children to its hierarchical box.
+    o SetLocalMatrix and SetLocalBox mark what they invalidate: the world
+    matrices and boxes of the subtree or the world box of the node, and
+    the hierarchical boxes of the node and its ancestors. Refit then only
+    computes the dirty nodes, the hierarchical boxes being refitted bottom
+    up along the dirty paths; the boxes of the nodes which did not change
+    are kept from the previous frame. UpdateWorldMatrices and UpdateBoxes
+    compute everything.
+
+    VxFlatHierarchy h;
+    h.Build(parents, locals, count);
+    ...
+    h.SetLocalMatrix(h.GetIndex(arm), m);
+    h.Refit();
+
+See Also: CKFlatSceneHierarchy,VxTransformHierarchy
+*********************************************************/
+class VxFlatHierarchy
+{
+public:
+    VxFlatHierarchy() : m_Dirty(FALSE) {}
+
+    int GetCount() const { return m_Parent.Size(); }
+
+    /************************************************
+    Summary: Builds the hierarchy.
+
+    Arguments:
+        parents: Parent of each node (index in the same arrays), -1 for a root.
+        locals: Local matrix of each node.
+        count: Number of nodes, their handles are their index in the arrays.
+    ************************************************/
+    void Build(const int *parents, const VxMatrix *locals, int count)
+    {
+        m_Handle.Resize(count);
+        m_Index.Resize(count);
+        m_Parent.Resize(count);
+        m_End.Resize(count);
+        m_Local.Resize(count);
+        m_World.Resize(count);
+        m_LocalBox.Resize(count);
+        m_WorldBox.Resize(count);
+        m_HierarchicalBox.Resize(count);
+        m_HandleParent.Resize(count);
+        m_Flags.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            m_HandleParent[i] = parents[i];
+            m_Local[i] = locals[i];
+            m_LocalBox[i].Reset();
+        }
+        Sort(TRUE);
+    }
+
+    int GetIndex(int handle) const { return m_Index[handle]; }
+    int GetHandle(int index) const { return m_Handle[index]; }
+
+    int GetParent(int index) const { return m_Parent[index]; }
+    // Index after the last descendant of a node.
+    int GetSubtreeEnd(int index) const { return m_End[index]; }
+
+    /************************************************
+    Summary: Changes the parent of a node.
+
+    Remarks:
+        The local matrix is kept. The nodes are sorted again, their indexes change.
+    ************************************************/
+    void SetParent(int index, int parent)
+    {
+        const int h = m_Handle[index];
+        const int ph = (parent >= 0) ? m_Handle[parent] : -1;
+        if (m_HandleParent[h] == ph)
+            return;
+        m_HandleParent[h] = ph;
+        Sort(FALSE);
+    }
+
+    // Changes the parents of all the nodes, given by handle (parents[handle] is the parent handle or -1).
+    void SetParents(const int *parents)
+    {
+        const int count = m_HandleParent.Size();
+        for (int h = 0; h < count; ++h)
+            m_HandleParent[h] = parents[h];
+        Sort(FALSE);
+    }
+
+    const VxMatrix &GetLocalMatrix(int index) const { return m_Local[index]; }
+    void SetLocalMatrix(int index, const VxMatrix &mat)
+    {
+        m_Local[index] = mat;
+        InvalidateTransform(index);
+    }
+    // World matrix computed by the last UpdateWorldMatrices or Refit.
+    const VxMatrix &GetWorldMatrix(int index) const { return m_World[index]; }
+
+    // Box of the node in its referential, an invalid box (VxBbox::Reset) for a node without box.
+    void SetLocalBox(int index, const VxBbox &box)
+    {
+        m_LocalBox[index] = box;
+        InvalidateBox(index);
+    }
+    const VxBbox &GetLocalBox(int index) const { return m_LocalBox[index]; }
+    // Boxes computed by the last UpdateBoxes or Refit.
+    const VxBbox &GetWorldBox(int index) const { return m_WorldBox[index]; }
+    const VxBbox &GetHierarchicalBox(int index) const { return m_HierarchicalBox[index]; }
+
+    const int *GetParents() const { return m_Parent.Begin(); }
+    // The changes made through this pointer must be followed by InvalidateTransform or UpdateWorldMatrices.
+    VxMatrix *GetLocalMatrices() { return m_Local.Begin(); }
+    const VxMatrix *GetWorldMatrices() const { return m_World.Begin(); }
+
+    // Marks the world matrices and boxes of a subtree dirty.
+    void InvalidateTransform(int index)
+    {
+        if (m_Flags[index] & DIRTY_WORLD)
+            return;
+        // a dirty node only has dirty descendants
+        const int end = m_End[index];
+        XBYTE *flags = m_Flags.Begin();
+        for (int i = index; i < end; ++i)
+            flags[i] |= DIRTY_WORLD | DIRTY_BOX | DIRTY_HIERARCHY;
+        InvalidateAncestors(m_Parent[index]);
+        m_Dirty = TRUE;
+    }
+
+    // Marks the world box of a node dirty.
+    void InvalidateBox(int index)
+    {
+        m_Flags[index] |= DIRTY_BOX | DIRTY_HIERARCHY;
+        InvalidateAncestors(m_Parent[index]);
+        m_Dirty = TRUE;
+    }
+
+    XBOOL IsDirty() const { return m_Dirty; }
+
+    // Computes the dirty world matrices and boxes.
+    void Refit()
+    {
+        if (!m_Dirty)
+            return;
+        const int count = m_Parent.Size();
+        const int *parent = m_Parent.Begin();
+        XBYTE *flags = m_Flags.Begin();
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            const XBYTE f = flags[i];
+            if (f & DIRTY_WORLD)
+            {
+                if (parent[i] < 0)
+                    m_World[i] = m_Local[i];
+                else
+                    Vx3DMultiplyMatrixBatch(&m_World[i], &m_World[parent[i]], &m_Local[i], 1);
+            }
+            if (f & DIRTY_BOX)
+            {
+                if (m_LocalBox[i].IsValid())
+                    m_WorldBox[i].TransformFrom(m_LocalBox[i], m_World[i]);
+                else
+                    m_WorldBox[i].Reset();
+            }
+        }
+        // children first, from the boxes of the children (kept or refitted)
+        for (i = count - 1; i >= 0; --i)
+        {
+            if (!(flags[i] & DIRTY_HIERARCHY))
+                continue;
+            VxBbox &hbox = m_HierarchicalBox[i];
+            hbox = m_WorldBox[i];
+            for (int c = i + 1; c < m_End[i]; c = m_End[c])
+            {
+                if (m_HierarchicalBox[c].IsValid())
+                    hbox.Merge(m_HierarchicalBox[c]);
+            }
+            flags[i] = 0;
+        }
+        m_Dirty = FALSE;
+    }
+
+    /************************************************
+    Summary: Computes the world matrices.
+
+    Arguments:
+        begin: First node to compute.
+        end: Last node + 1, -1 for all the nodes.
+    Remarks:
+        The world matrices of the parents of the range must be up to date:
+        computing a subtree is UpdateWorldMatrices(i, GetSubtreeEnd(i)).
+    ************************************************/
+    void UpdateWorldMatrices(int begin = 0, int end = -1)
+    {
+        if (end < 0)
+            end = m_Parent.Size();
+        const int *parent = m_Parent.Begin();
+        VxMatrix *world = m_World.Begin();
+        const VxMatrix *local = m_Local.Begin();
+        for (int i = begin; i < end; ++i)
+        {
+            if (parent[i] < 0)
+                world[i] = local[i];
+            else
+                Vx3DMultiplyMatrixBatch(&world[i], &world[parent[i]], &local[i], 1);
+            m_Flags[i] &= ~DIRTY_WORLD;
+        }
+    }
+
+    // Computes the world boxes then the hierarchical boxes (and the dirty world matrices).
+    void UpdateBoxes()
+    {
+        const int count = m_Parent.Size();
+        const int *parent = m_Parent.Begin();
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            if (m_Flags[i] & DIRTY_WORLD)
+                UpdateWorldMatrices(i, i + 1);
+            if (m_LocalBox[i].IsValid())
+                m_WorldBox[i].TransformFrom(m_LocalBox[i], m_World[i]);
+            else
+                m_WorldBox[i].Reset();
+            m_HierarchicalBox[i] = m_WorldBox[i];
+        }
+        // the children are after their parent
+        VxBbox *hbox = m_HierarchicalBox.Begin();
+        for (i = count - 1; i > 0; --i)
+        {
+            if (parent[i] >= 0 && hbox[i].IsValid())
+                hbox[parent[i]].Merge(hbox[i]);
+        }
+        for (i = 0; i < count; ++i)
+            m_Flags[i] = 0;
+        m_Dirty = FALSE;
+    }
+
+protected:
+    enum
+    {
+        DIRTY_WORLD = 1,
+        DIRTY_BOX = 2,
+        DIRTY_HIERARCHY = 4
+    };
+
+    void InvalidateAncestors(int index)
+    {
+        for (; index >= 0 && !(m_Flags[index] & DIRTY_HIERARCHY); index = m_Parent[index])
+            m_Flags[index] |= DIRTY_HIERARCHY;
+    }
+
+    // Sorts the nodes depth first from their handle parents (byHandle: the local data is stored by handle).
+    void Sort(XBOOL byHandle)
+    {
+        const int count = m_HandleParent.Size();
+        int h;
+        // children lists by handle
+        m_FirstChild.Resize(count);
+        m_NextSibling.Resize(count);
+        for (h = 0; h < count; ++h)
+            m_FirstChild[h] = m_NextSibling[h] = -1;
+        for (h = count - 1; h >= 0; --h)
+        {
+            const int p = m_HandleParent[h];
+            if (p >= 0)
+            {
+                m_NextSibling[h] = m_FirstChild[p];
+                m_FirstChild[p] = h;
+            }
+        }
+
+        XArray<VxMatrix> local(m_Local);
+        XArray<VxBbox> box(m_LocalBox);
+        const XArray<int> oldIndex(m_Index);
+
+        int next = 0;
+        for (h = 0; h < count; ++h)
+        {
+            if (m_HandleParent[h] >= 0)
+                continue;
+            m_Stack.Resize(0);
+            m_Stack.PushBack(h);
+            while (m_Stack.Size())
+            {
+                const int n = m_Stack.PopBack();
+                if (n < 0)
+                {
+                    // end of the subtree of ~n
+                    m_End[m_Index[~n]] = next;
+                    continue;
+                }
+                const int i = next++;
+                m_Index[n] = i;
+                m_Handle[i] = n;
+                const int p = m_HandleParent[n];
+                m_Parent[i] = (p >= 0) ? m_Index[p] : -1;
+                const int src = byHandle ? n : oldIndex[n];
+                m_Local[i] = local[src];
+                m_LocalBox[i] = box[src];
+                m_Stack.PushBack(~n);
+                for (int c = m_FirstChild[n]; c >= 0; c = m_NextSibling[c])
+                    m_Stack.PushBack(c);
+            }
+        }
+        // everything is computed again after a sort
+        for (h = 0; h < count; ++h)
+            m_Flags[h] = DIRTY_WORLD | DIRTY_BOX | DIRTY_HIERARCHY;
+        m_Dirty = TRUE;
+    }
+
+    XArray<int> m_Parent;   // parent index of each node
+    XArray<int> m_End;      // end of the subtree of each node
+    XArray<VxMatrix> m_Local;
+    XArray<VxMatrix> m_World;
+    XArray<VxBbox> m_LocalBox;
+    XArray<VxBbox> m_WorldBox;
+    XArray<VxBbox> m_HierarchicalBox;
+    XArray<int> m_Handle;       // handle of each node
+    XArray<int> m_Index;        // node of each handle
+    XArray<int> m_HandleParent; // parent handle of each handle
+    XArray<int> m_FirstChild;
+    XArray<int> m_NextSibling;
+    XArray<int> m_Stack;
+    XArray<XBYTE> m_Flags; // dirty flags of each node
+    XBOOL m_Dirty;
+};
+
+#endif // VXFLATHIERARCHY_H
@@ -0,0 +1,380 @@
+#ifndef VXFLOWFIELD_H
+#define VXFLOWFIELD_H
+
+#include "VxMathDefines.h"
+#include "XArray.h"
+
+/*************************************************
+{filename:VxFlowField}
+Summary: Distance to a set of goals and direction to follow for every cell of a grid.
+
+Remarks:
+    o The integration field holds for each cell the cost of the shortest
+    path to the nearest goal, moving to the 8 neighbours of a cell (the
+    diagonal moves do not cut the corners of blocked cells). A move costs
+    the sum of the costs of both cells, times 5 along the axes and 7 along
+    the diagonals. The direction field gives for each cell the neighbour
+    lowering this cost the most.
+    o All the agents going to the same goals read the same field, so a
+    crowd costs one lookup per agent.
+    o A cell has a cost from 1 to 255, 0 being blocked.
+    o Adding a goal or lowering the cost of cells only propagates the
+    improvement from these cells. Removing or moving a goal, or raising a
+    cost, computes the field again.
+    o Update can limit the number of cells processed per call: the field
+    given by GetDistance and GetDirection stays the previous one until
+    the computation ends.
+
+    VxFlowField field;
+    field.SetSize(width, length);
+    field.SetCosts(costs);
+    field.AddGoal(gx, gy);
+    field.Update();
+    float dx, dy;
+    if (field.GetDirection(x, y, dx, dy))
+        ...
+
+See also: CKFlowField,VxHierarchicalPathfinder
+*************************************************/
+class VxFlowField
+{
+public:
+    enum
+    {
+        Unreached = 0x7FFFFFFF,
+        AT_GOAL = 8,       // direction of a goal cell
+        NO_DIRECTION = 255 // blocked or not connected to a goal
+    };
+
+    VxFlowField() : m_Width(0), m_Length(0), m_Running(FALSE), m_Restart(FALSE), m_Version(0) {}
+
+    // Resizes the grid, all the cells get the cost 1.
+    void SetSize(int width, int length)
+    {
+        m_Width = width > 0 ? width : 0;
+        m_Length = length > 0 ? length : 0;
+        const int count = m_Width * m_Length;
+        m_Costs.Resize(count);
+        if (count)
+            memset(m_Costs.Begin(), 1, count);
+        m_Goals.Resize(0);
+        m_Work.Resize(count);
+        m_Field.Resize(count);
+        m_Directions.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            m_Work[i] = Unreached;
+            m_Field[i] = Unreached;
+        }
+        if (count)
+            memset(m_Directions.Begin(), NO_DIRECTION, count);
+        m_Heap.Resize(0);
+        m_Running = FALSE;
+        m_Restart = FALSE;
+    }
+
+    int GetWidth() const { return m_Width; }
+    int GetLength() const { return m_Length; }
+
+    void SetCost(int x, int y, XBYTE cost) { ChangeCost(y * m_Width + x, cost); }
+    XBYTE GetCost(int x, int y) const { return m_Costs[y * m_Width + x]; }
+
+    // Sets the costs of all the cells (width x length, row by row).
+    void SetCosts(const XBYTE *costs)
+    {
+        const int count = m_Costs.Size();
+        if (!count || !memcmp(m_Costs.Begin(), costs, count))
+            return;
+        for (int i = 0; i < count; ++i)
+            ChangeCost(i, costs[i]);
+    }
+
+    void AddGoal(int x, int y)
+    {
+        if (x < 0 || y < 0 || x >= m_Width || y >= m_Length)
+            return;
+        const int cell = y * m_Width + x;
+        if (m_Goals.IsHere(cell))
+            return;
+        m_Goals.PushBack(cell);
+        Seed(cell);
+    }
+
+    void RemoveGoal(int x, int y)
+    {
+        if (m_Goals.Remove(y * m_Width + x))
+            m_Restart = TRUE;
+    }
+
+    void ClearGoals()
+    {
+        if (m_Goals.Size())
+            m_Restart = TRUE;
+        m_Goals.Resize(0);
+    }
+
+    // Replaces the goals by a single one.
+    void SetGoal(int x, int y)
+    {
+        if (m_Goals.Size() == 1 && m_Goals[0] == y * m_Width + x)
+            return;
+        ClearGoals();
+        AddGoal(x, y);
+    }
+
+    int GetGoalCount() const { return m_Goals.Size(); }
+
+    /************************************************
+    Summary: Computes the changes of the field.
+
+    Arguments:
+        maxCells: Number of cells to process in this call, 0 for no limit.
+    Return Value:
+        TRUE if the field is up to date, FALSE if the computation continues with the next call.
+    ************************************************/
+    XBOOL Update(int maxCells = 0)
+    {
+        if (m_Restart)
+            Restart();
+        if (!m_Running)
+            return TRUE;
+        for (int processed = 0; m_Heap.Size(); ++processed)
+        {
+            if (maxCells > 0 && processed >= maxCells)
+                return FALSE;
+            const HeapItem top = PopHeap();
+            if (top.m_Value > m_Work[top.m_Cell])
+                continue;
+            Relax(top.m_Cell);
+        }
+        m_Field = m_Work;
+        BuildDirections();
+        m_Running = FALSE;
+        ++m_Version;
+        return TRUE;
+    }
+
+    XBOOL IsComputing() const { return m_Running || m_Restart; }
+
+    // Incremented each time a new field is available.
+    int GetVersion() const { return m_Version; }
+
+    // Cost to the nearest goal, Unreached if no goal can be reached.
+    int GetDistance(int x, int y) const { return m_Field[y * m_Width + x]; }
+
+    // Index of the neighbour to go to (see GetOffset), AT_GOAL or NO_DIRECTION.
+    XBYTE GetDirectionCode(int x, int y) const { return m_Directions[y * m_Width + x]; }
+
+    // Unit direction to follow in grid coordinates, FALSE on a goal or a cell that can not reach a goal.
+    XBOOL GetDirection(int x, int y, float &dx, float &dy) const
+    {
+        dx = dy = 0.0f;
+        if (x < 0 || y < 0 || x >= m_Width || y >= m_Length)
+            return FALSE;
+        const int code = m_Directions[y * m_Width + x];
+        if (code >= AT_GOAL)
+            return FALSE;
+        static const float d = 0.70710678f;
+        static const float ux[8] = {1.0f, -1.0f, 0.0f, 0.0f, d, -d, d, -d};
+        static const float uy[8] = {0.0f, 0.0f, 1.0f, -1.0f, d, d, -d, -d};
+        dx = ux[code];
+        dy = uy[code];
+        return TRUE;
+    }
+
+    // Cell offset of a direction code.
+    static void GetOffset(int code, int &dx, int &dy)
+    {
+        static const int ox[8] = {1, -1, 0, 0, 1, -1, 1, -1};
+        static const int oy[8] = {0, 0, 1, -1, 1, 1, -1, -1};
+        dx = ox[code];
+        dy = oy[code];
+    }
+
+protected:
+    struct HeapItem
+    {
+        int m_Value;
+        int m_Cell;
+    };
+
+    void ChangeCost(int cell, XBYTE cost)
+    {
+        const XBYTE old = m_Costs[cell];
+        if (old == cost)
+            return;
+        m_Costs[cell] = cost;
+        if (m_Restart)
+            return;
+        if (!cost || (old && cost > old))
+        {
+            m_Restart = TRUE;
+            return;
+        }
+        // lower cost: the cell and the paths through it can only improve
+        const int x = cell % m_Width, y = cell / m_Width;
+        int best = m_Goals.IsHere(cell) ? 0 : m_Work[cell];
+        for (int k = 0; k < 8; ++k)
+        {
+            int ox, oy;
+            GetOffset(k, ox, oy);
+            const int next = Neighbour(x, y, ox, oy);
+            if (next < 0 || m_Work[next] == Unreached)
+                continue;
+            const int v = m_Work[next] + StepCost(cell, next, k);
+            if (v < best)
+                best = v;
+            // an opened cell also opens diagonal moves between its neighbours
+            if (!old)
+                PushHeap(m_Work[next], next);
+        }
+        m_Running = TRUE;
+        if (best == Unreached)
+            return;
+        m_Work[cell] = best;
+        PushHeap(best, cell);
+    }
+
+    void Seed(int cell)
+    {
+        if (m_Restart || !m_Costs[cell])
+            return;
+        m_Work[cell] = 0;
+        PushHeap(0, cell);
+        m_Running = TRUE;
+    }
+
+    void Restart()
+    {
+        m_Restart = FALSE;
+        m_Running = FALSE;
+        m_Heap.Resize(0);
+        for (int i = 0; i < m_Work.Size(); ++i)
+            m_Work[i] = Unreached;
+        for (int g = 0; g < m_Goals.Size(); ++g)
+            Seed(m_Goals[g]);
+        // no goal left: the empty field is published
+        m_Running = TRUE;
+    }
+
+    int StepCost(int a, int b, int code) const { return (m_Costs[a] + m_Costs[b]) * (code < 4 ? 5 : 7); }
+
+    // Neighbour cell in a direction, -1 if blocked, outside or cutting a blocked corner.
+    int Neighbour(int x, int y, int ox, int oy) const
+    {
+        const int nx = x + ox, ny = y + oy;
+        if (nx < 0 || ny < 0 || nx >= m_Width || ny >= m_Length)
+            return -1;
+        const int next = ny * m_Width + nx;
+        if (!m_Costs[next])
+            return -1;
+        if (ox && oy && (!m_Costs[y * m_Width + nx] || !m_Costs[ny * m_Width + x]))
+            return -1;
+        return next;
+    }
+
+    void Relax(int cell)
+    {
+        const int x = cell % m_Width, y = cell / m_Width;
+        const int value = m_Work[cell];
+        for (int k = 0; k < 8; ++k)
+        {
+            int ox, oy;
+            GetOffset(k, ox, oy);
+            const int next = Neighbour(x, y, ox, oy);
+            if (next < 0)
+                continue;
+            const int v = value + StepCost(cell, next, k);
+            if (v < m_Work[next])
+            {
+                m_Work[next] = v;
+                PushHeap(v, next);
+            }
+        }
+    }
+
+    void BuildDirections()
+    {
+        for (int cell = 0; cell < m_Field.Size(); ++cell)
+        {
+            const int value = m_Field[cell];
+            XBYTE code = NO_DIRECTION;
+            if (value == 0)
+            {
+                code = AT_GOAL;
+            }
+            else if (value != Unreached && m_Costs[cell])
+            {
+                const int x = cell % m_Width, y = cell / m_Width;
+                int best = value;
+                code = AT_GOAL;
+                for (int k = 0; k < 8; ++k)
+                {
+                    int ox, oy;
+                    GetOffset(k, ox, oy);
+                    const int next = Neighbour(x, y, ox, oy);
+                    if (next >= 0 && m_Field[next] < best)
+                    {
+                        best = m_Field[next];
+                        code = (XBYTE)k;
+                    }
+                }
+            }
+            m_Directions[cell] = code;
+        }
+    }
+
+    void PushHeap(int value, int cell)
+    {
+        HeapItem item = {value, cell};
+        m_Heap.PushBack(item);
+        int i = m_Heap.Size() - 1;
+        while (i > 0)
+        {
+            const int parent = (i - 1) >> 1;
+            if (m_Heap[parent].m_Value <= value)
+                break;
+            m_Heap[i] = m_Heap[parent];
+            i = parent;
+        }
+        m_Heap[i] = item;
+    }
+
+    HeapItem PopHeap()
+    {
+        const HeapItem top = m_Heap[0];
+        const HeapItem last = m_Heap[m_Heap.Size() - 1];
+        m_Heap.Resize(m_Heap.Size() - 1);
+        const int n = m_Heap.Size();
+        int i = 0;
+        for (;;)
+        {
+            int child = 2 * i + 1;
+            if (child >= n)
+                break;
+            if (child + 1 < n && m_Heap[child + 1].m_Value < m_Heap[child].m_Value)
+                ++child;
+            if (m_Heap[child].m_Value >= last.m_Value)
+                break;
+            m_Heap[i] = m_Heap[child];
+            i = child;
+        }
+        if (n)
+            m_Heap[i] = last;
+        return top;
+    }
+
+    int m_Width;
+    int m_Length;
+    XArray<XBYTE> m_Costs;
+    XArray<int> m_Goals;
+    XArray<int> m_Work;  // field being computed
+    XArray<int> m_Field; // last complete field
+    XArray<XBYTE> m_Directions;
+    XArray<HeapItem> m_Heap;
+    XBOOL m_Running;
+    XBOOL m_Restart;
+    int m_Version;
+};
+
+#endif // VXFLOWFIELD_H
@@ -0,0 +1,552 @@
+#ifndef VXFRAMEPROFILER_H
+#define VXFRAMEPROFILER_H
+
+#include <windows.h>
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+#include <intrin.h>
+#endif
+
+#include "VxSPSCQueue.h"
+#include "VxMutex.h"
+#include "VxThread.h"
+#include "XClassArray.h"
+#include "XString.h"
+
+#include <stdio.h>
+
+typedef unsigned __int64 VxProfileTick;
+
+/*************************************************
+Summary: Reads the timestamp counter used by VxFrameProfiler.
+
+Remarks:
+    o With compilers providing the intrinsic it is the processor timestamp
+    counter (rdtsc), which is constant rate on the processors supported by
+    Windows since Vista. Older compilers fall back on QueryPerformanceCounter.
+    o The ticks are converted to time by VxFrameProfiler::ToMicroseconds.
+
+See also: VxFrameProfiler
+*************************************************/
+inline VxProfileTick VxReadProfileTick()
+{
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+    return __rdtsc();
+#else
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (VxProfileTick)counter.QuadPart;
+#endif
+}
+
+/*************************************************
+Summary: A zone recorded by VxFrameProfiler.
+
+Remarks:
+    o m_Name is the pointer given to BeginZone, m_Thread is the index of
+    the thread (VxFrameProfiler::GetThreadName) and m_Depth the number of
+    zones of the same thread the zone is nested in.
+
+See also: VxFrameProfiler,VxProfileFrame
+*************************************************/
+struct VxProfileZone
+{
+    const char *m_Name;
+    VxProfileTick m_Start;
+    VxProfileTick m_End;
+    int m_Thread;
+    int m_Depth;
+};
+
+// A value given to VxFrameProfiler::AddCounter.
+struct VxProfileCounter
+{
+    const char *m_Name;
+    float m_Value;
+};
+
+// The zones ended during one frame, by all the threads.
+struct VxProfileFrame
+{
+    VxProfileTick m_Start;
+    VxProfileTick m_End;
+    int m_Thread;
+    XArray<VxProfileZone> m_Zones;
+    XArray<VxProfileCounter> m_Counters;
+};
+
+/*************************************************
+{filename:VxFrameProfiler}
+Summary: Hierarchical profiler recording named zones per frame on any thread.
+
+Remarks:
+    o A zone is the time between BeginZone and EndZone on one thread, zones
+    nest. VX_PROFILE_ZONE opens a zone until the end of the enclosing scope
+    and compiles to nothing when VX_PROFILER_DISABLED is defined.
+    o Each thread writes its zones in its own lock-free queue (found through
+    a TLS slot, created under a lock the first time the thread records a
+    zone): recording costs two timestamp reads and a push. EndFrame, called
+    by the thread driving the frames, moves the zones ended so far by all
+    the threads into the current frame. The zones are lost when a queue
+    fills up (GetDroppedCount), EndFrame must be called at least once every
+    few thousand zones per thread. The queue of a thread is kept until the
+    profiler is destroyed: it is meant for long-lived threads (the workers
+    of a pool, the streaming threads) rather than one thread per task.
+    o The last GetMaxFrameCount frames are kept in a ring (GetFrame(0) is
+    the last ended frame) and can be written in the Chrome trace event format
+    (ExportChromeTrace) to be opened in chrome://tracing or Perfetto.
+    o The names must stay valid as long as the profiler (string literals):
+    only their pointer is recorded.
+    o The macros use the instance set by SetInstance. Each module (executable
+    or DLL) has its own instance pointer: a plugin wanting to record in the
+    profile of the application must be given its profiler.
+    o Nothing is recorded until Enable(TRUE). Disabled, a zone costs a test.
+    o With SetSpikeCapture, a frame longer than the threshold writes the
+    ring (the frames leading to the spike and the spike itself) to a new
+    trace file. The next spike is only written once the ring has been
+    renewed, so a burst of slow frames gives one file.
+
+    VxFrameProfiler profiler(300);
+    VxFrameProfiler::SetInstance(&profiler);
+    profiler.Enable(TRUE);
+    // each frame
+    profiler.BeginFrame();
+    {
+        VX_PROFILE_ZONE("Physics");
+        ...
+    }
+    profiler.EndFrame();
+    ...
+    profiler.ExportChromeTrace("frames.json");
+
+See also: VxProfileScope,VxTimeProfiler,CKFrameProfiler
+*************************************************/
+class VxFrameProfiler
+{
+public:
+    enum
+    {
+        MaxDepth = 64
+    };
+
+    VxFrameProfiler(int maxFrames = 120, int zonesPerThread = 4096) : m_ZonesPerThread(zonesPerThread), m_Enabled(FALSE), m_InFrame(FALSE), m_FrameIndex(0), m_FrameCount(0),
+                                                                  m_SpikeThreshold(0.0f), m_SpikeCount(0), m_SpikeCooldown(0)
+    {
+        m_Tls = TlsAlloc();
+        m_Frames.Resize(XMax(maxFrames, 1));
+        m_OriginTick = VxReadProfileTick();
+        QueryPerformanceCounter(&m_OriginCounter);
+    }
+
+    ~VxFrameProfiler()
+    {
+        if (GetInstance() == this)
+            SetInstance(NULL);
+        TlsFree(m_Tls);
+        for (int i = 0; i < m_Threads.Size(); ++i)
+            delete m_Threads[i];
+    }
+
+    // The profiler used by the macros of this module.
+    static VxFrameProfiler *GetInstance() { return InstancePointer(); }
+    static void SetInstance(VxFrameProfiler *profiler) { InstancePointer() = profiler; }
+
+    void Enable(XBOOL enable) { VxAtomicStore(&m_Enabled, enable ? 1 : 0); }
+    XBOOL IsEnabled() const { return VxAtomicLoad(&m_Enabled) != 0; }
+
+    //---------------------------------------------
+    // Any thread
+
+    // Opens a zone on the calling thread, FALSE if nothing was recorded (disabled or too deep).
+    XBOOL BeginZone(const char *name)
+    {
+        if (!m_Enabled)
+            return FALSE;
+        Thread *thread = GetThread();
+        if (!thread || thread->m_Depth >= MaxDepth)
+            return FALSE;
+        thread->m_Names[thread->m_Depth] = name;
+        thread->m_Starts[thread->m_Depth] = VxReadProfileTick();
+        ++thread->m_Depth;
+        return TRUE;
+    }
+
+    // Closes the last zone opened by a successful BeginZone on the calling thread.
+    void EndZone()
+    {
+        const VxProfileTick end = VxReadProfileTick();
+        Thread *thread = (Thread *)TlsGetValue(m_Tls);
+        if (!thread || thread->m_Depth == 0)
+            return;
+        --thread->m_Depth;
+        VxProfileZone zone;
+        zone.m_Name = thread->m_Names[thread->m_Depth];
+        zone.m_Start = thread->m_Starts[thread->m_Depth];
+        zone.m_End = end;
+        zone.m_Thread = thread->m_Index;
+        zone.m_Depth = thread->m_Depth;
+        thread->m_Zones.Push(zone);
+    }
+
+    //---------------------------------------------
+    // Thread driving the frames
+
+    void BeginFrame()
+    {
+        if (m_InFrame)
+            EndFrame();
+        Thread *thread = GetThread();
+        VxProfileFrame &frame = m_Frames[m_FrameIndex];
+        frame.m_Zones.Resize(0);
+        frame.m_Counters.Resize(0);
+        frame.m_Thread = thread ? thread->m_Index : 0;
+        frame.m_Start = VxReadProfileTick();
+        frame.m_End = frame.m_Start;
+        m_InFrame = TRUE;
+    }
+
+    // Collects the zones of all the threads into the frame and moves to the next one.
+    void EndFrame()
+    {
+        if (!m_InFrame)
+            return;
+        VxProfileFrame &frame = m_Frames[m_FrameIndex];
+        {
+            VxMutexLock lock(m_Lock);
+            for (int i = 0; i < m_Threads.Size(); ++i)
+            {
+                VxProfileZone zone;
+                while (m_Threads[i]->m_Zones.Pop(zone))
+                    if (IsEnabled())
+                        frame.m_Zones.PushBack(zone);
+            }
+        }
+        frame.m_End = VxReadProfileTick();
+        m_InFrame = FALSE;
+        // disabled, the frames do not push the recorded ones out of the ring
+        if (!IsEnabled())
+            return;
+        m_FrameIndex = (m_FrameIndex + 1) % m_Frames.Size();
+        if (m_FrameCount < m_Frames.Size())
+            ++m_FrameCount;
+        if (m_SpikeCooldown > 0)
+            --m_SpikeCooldown;
+        if (m_SpikeThreshold > 0.0f && ToMicroseconds(frame.m_End - frame.m_Start) > m_SpikeThreshold * 1000.0)
+        {
+            ++m_SpikeCount;
+            if (m_SpikeCooldown == 0)
+            {
+                m_LastSpikeFile.Format("%s%04d.json", m_SpikePrefix.CStr(), m_SpikeCount);
+                ExportChromeTrace(m_LastSpikeFile.CStr());
+                m_SpikeCooldown = m_Frames.Size();
+            }
+        }
+    }
+
+    /*************************************************
+    Summary: Writes the ring to a trace file when a frame is too long.
+
+    Arguments:
+        thresholdMs: Frame time (BeginFrame to EndFrame) above which the
+        frames are written, 0 to disable the capture.
+        filePrefix: Path and start of the file names, the spike number and
+        ".json" are appended ("Spikes/spike" gives Spikes/spike0001.json...).
+    *************************************************/
+    void SetSpikeCapture(float thresholdMs, const char *filePrefix = "spike")
+    {
+        m_SpikeThreshold = thresholdMs;
+        m_SpikePrefix = filePrefix;
+        m_SpikeCooldown = 0;
+    }
+    void SetSpikeThreshold(float thresholdMs) { m_SpikeThreshold = thresholdMs; }
+    float GetSpikeThreshold() const { return m_SpikeThreshold; }
+
+    // Number of frames above the threshold, including the ones not written.
+    int GetSpikeCount() const { return m_SpikeCount; }
+    // Name of the last written trace, empty if none.
+    const char *GetLastSpikeFile() const { return m_LastSpikeFile.CStr(); }
+
+    // Attaches a value to the current frame (an object count, a memory size...).
+    void AddCounter(const char *name, float value)
+    {
+        if (!m_InFrame || !IsEnabled())
+            return;
+        VxProfileCounter counter;
+        counter.m_Name = name;
+        counter.m_Value = value;
+        m_Frames[m_FrameIndex].m_Counters.PushBack(counter);
+    }
+
+    int GetMaxFrameCount() const { return m_Frames.Size(); }
+    void SetMaxFrameCount(int count)
+    {
+        m_Frames.Resize(0);
+        m_Frames.Resize(XMax(count, 1));
+        m_FrameIndex = 0;
+        m_FrameCount = 0;
+        m_InFrame = FALSE;
+    }
+
+    // Number of ended frames in the ring.
+    int GetFrameCount() const { return m_FrameCount; }
+
+    // 0 is the last ended frame, GetFrameCount()-1 the oldest.
+    const VxProfileFrame &GetFrame(int age) const
+    {
+        const int count = m_Frames.Size();
+        return m_Frames[(m_FrameIndex + count - 1 - age % count) % count];
+    }
+
+    // Total time of the zones with the given name in a frame (names compared by content), in milliseconds.
+    float GetZoneTime(const char *name, int age = 0) const
+    {
+        if (age >= m_FrameCount)
+            return 0.0f;
+        const VxProfileFrame &frame = GetFrame(age);
+        VxProfileTick total = 0;
+        for (int i = 0; i < frame.m_Zones.Size(); ++i)
+        {
+            const VxProfileZone &zone = frame.m_Zones[i];
+            if (zone.m_Name == name || !strcmp(zone.m_Name, name))
+                total += zone.m_End - zone.m_Start;
+        }
+        return (float)(ToMicroseconds(total) * 0.001);
+    }
+
+    void Clear()
+    {
+        m_FrameIndex = 0;
+        m_FrameCount = 0;
+        m_InFrame = FALSE;
+    }
+
+    // Zones lost because a thread queue was full, since the last call.
+    int GetDroppedCount()
+    {
+        VxMutexLock lock(m_Lock);
+        int dropped = 0;
+        for (int i = 0; i < m_Threads.Size(); ++i)
+            dropped += m_Threads[i]->m_Zones.GetDroppedCount();
+        return dropped;
+    }
+
+    int GetThreadCount() const
+    {
+        VxMutexLock lock(m_Lock);
+        return m_Threads.Size();
+    }
+
+    // The threads are never removed: the name stays valid while the profiler lives.
+    const char *GetThreadName(int thread) const
+    {
+        VxMutexLock lock(m_Lock);
+        return m_Threads[thread]->m_Name.CStr();
+    }
+
+    // Converts a tick count (the difference of two timestamps) to microseconds.
+    double ToMicroseconds(VxProfileTick ticks) const { return (double)(__int64)ticks / GetTicksPerMicrosecond(); }
+
+    // Timestamp counter rate, measured against the performance counter since the profiler was created.
+    double GetTicksPerMicrosecond() const
+    {
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+        const double elapsed = (double)(counter.QuadPart - m_OriginCounter.QuadPart) * 1000000.0 / (double)frequency.QuadPart;
+        const VxProfileTick ticks = VxReadProfileTick() - m_OriginTick;
+        if (elapsed < 1000.0)
+            return 3000.0; // not measurable yet, any order of magnitude will do
+        return (double)(__int64)ticks / elapsed;
+#else
+        return (double)frequency.QuadPart / 1000000.0;
+#endif
+    }
+
+    /*************************************************
+    Summary: Writes the frames of the ring to a Chrome trace event file.
+
+    Remarks:
+        o The zones are complete events ("ph":"X") on the thread that
+        recorded them, each frame is also a zone named "Frame" on the thread
+        driving the frames, and the counters are counter events ("ph":"C").
+        o The times are in microseconds from the creation of the profiler.
+        o extraZones are written as well, as zones of the thread m_Thread:
+        zones recorded elsewhere with VxReadProfileTick (behavior traces...)
+        are shown on the same timeline. Their names only need to be valid
+        during the call.
+    *************************************************/
+    XBOOL ExportChromeTrace(const char *fileName, const XArray<VxProfileZone> *extraZones = NULL) const
+    {
+        FILE *file = fopen(fileName, "wt");
+        if (!file)
+            return FALSE;
+        const double rate = GetTicksPerMicrosecond();
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        XBOOL first = TRUE;
+        {
+            VxMutexLock lock(m_Lock);
+            for (int t = 0; t < m_Threads.Size(); ++t)
+            {
+                fputs(first ? "" : ",\n", file);
+                first = FALSE;
+                fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":", t);
+                WriteString(file, m_Threads[t]->m_Name.CStr());
+                fputs("}}", file);
+            }
+        }
+        for (int age = m_FrameCount - 1; age >= 0; --age)
+        {
+            const VxProfileFrame &frame = GetFrame(age);
+            fputs(first ? "" : ",\n", file);
+            first = FALSE;
+            WriteZone(file, "Frame", frame.m_Start, frame.m_End, frame.m_Thread, rate);
+            for (int i = 0; i < frame.m_Zones.Size(); ++i)
+            {
+                const VxProfileZone &zone = frame.m_Zones[i];
+                fputs(",\n", file);
+                WriteZone(file, zone.m_Name, zone.m_Start, zone.m_End, zone.m_Thread, rate);
+            }
+            for (int c = 0; c < frame.m_Counters.Size(); ++c)
+            {
+                fputs(",\n{\"name\":", file);
+                WriteString(file, frame.m_Counters[c].m_Name);
+                fprintf(file, ",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"args\":{\"value\":%g}}", (double)(__int64)(frame.m_End - m_OriginTick) / rate, frame.m_Counters[c].m_Value);
+            }
+        }
+        if (extraZones)
+        {
+            for (int i = 0; i < extraZones->Size(); ++i)
+            {
+                const VxProfileZone &zone = (*extraZones)[i];
+                fputs(first ? "" : ",\n", file);
+                first = FALSE;
+                WriteZone(file, zone.m_Name, zone.m_Start, zone.m_End, zone.m_Thread, rate);
+            }
+        }
+        fputs("\n]}\n", file);
+        const XBOOL ok = !ferror(file);
+        fclose(file);
+        return ok;
+    }
+
+protected:
+    struct Thread
+    {
+        Thread(int index, int capacity) : m_Index(index), m_Depth(0), m_Zones(capacity) {}
+
+        int m_Index;
+        XString m_Name;
+        // owned by the thread
+        int m_Depth;
+        const char *m_Names[MaxDepth];
+        VxProfileTick m_Starts[MaxDepth];
+        // pushed by the thread, popped by EndFrame
+        VxSPSCQueue<VxProfileZone> m_Zones;
+    };
+
+    static VxFrameProfiler *&InstancePointer()
+    {
+        static VxFrameProfiler *instance = NULL;
+        return instance;
+    }
+
+    Thread *GetThread()
+    {
+        Thread *thread = (Thread *)TlsGetValue(m_Tls);
+        if (thread)
+            return thread;
+        VxMutexLock lock(m_Lock);
+        thread = new Thread(m_Threads.Size(), m_ZonesPerThread);
+        VxThread *vxThread = VxThread::GetCurrentVxThread();
+        if (vxThread && vxThread->GetName().Length())
+            thread->m_Name = vxThread->GetName();
+        else
+            thread->m_Name.Format("Thread %d", (int)VxThread::GetCurrentVxThreadId());
+        m_Threads.PushBack(thread);
+        TlsSetValue(m_Tls, thread);
+        return thread;
+    }
+
+    void WriteZone(FILE *file, const char *name, VxProfileTick start, VxProfileTick end, int thread, double rate) const
+    {
+        fputs("{\"name\":", file);
+        WriteString(file, name);
+        fprintf(file, ",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", thread,
+                (double)(__int64)(start - m_OriginTick) / rate, (double)(__int64)(end - start) / rate);
+    }
+
+    static void WriteString(FILE *file, const char *s)
+    {
+        fputc('"', file);
+        for (; s && *s; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+                fputc('\\', file);
+            if ((unsigned char)*s < 0x20)
+                fprintf(file, "\\u%04x", (unsigned char)*s);
+            else
+                fputc(*s, file);
+        }
+        fputc('"', file);
+    }
+
+    DWORD m_Tls;
+    int m_ZonesPerThread;
+    volatile long m_Enabled;
+    mutable VxMutex m_Lock; // guards m_Threads, which GetThread grows from any thread
+    XArray<Thread *> m_Threads;
+    VxProfileTick m_OriginTick;
+    LARGE_INTEGER m_OriginCounter;
+    // owned by the thread driving the frames
+    XBOOL m_InFrame;
+    XClassArray<VxProfileFrame> m_Frames;
+    int m_FrameIndex; // frame being recorded
+    int m_FrameCount;
+    float m_SpikeThreshold;
+    XString m_SpikePrefix;
+    XString m_LastSpikeFile;
+    int m_SpikeCount;
+    int m_SpikeCooldown; // frames before another spike can be written
+
+private:
+    VxFrameProfiler(const VxFrameProfiler &);
+    VxFrameProfiler &operator=(const VxFrameProfiler &);
+};
+
+/*************************************************
+Summary: Records a zone of VxFrameProfiler::GetInstance until the end of the scope.
+
+See also: VxFrameProfiler,VX_PROFILE_ZONE
+*************************************************/
+class VxProfileScope
+{
+public:
+    VxProfileScope(const char *name) : m_Profiler(VxFrameProfiler::GetInstance())
+    {
+        if (m_Profiler && !m_Profiler->BeginZone(name))
+            m_Profiler = NULL;
+    }
+    ~VxProfileScope()
+    {
+        if (m_Profiler)
+            m_Profiler->EndZone();
+    }
+
+protected:
+    VxFrameProfiler *m_Profiler;
+
+private:
+    VxProfileScope(const VxProfileScope &);
+    VxProfileScope &operator=(const VxProfileScope &);
+};
+
+#define VX_PROFILE_CONCAT2(a, b) a##b
+#define VX_PROFILE_CONCAT(a, b) VX_PROFILE_CONCAT2(a, b)
+
+#ifndef VX_PROFILER_DISABLED
+#define VX_PROFILE_ZONE(name) VxProfileScope VX_PROFILE_CONCAT(vxProfileZone, __LINE__)(name)
+#else
+#define VX_PROFILE_ZONE(name)
+#endif
+
+#endif // VXFRAMEPROFILER_H
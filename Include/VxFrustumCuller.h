@@ -0,0 +1,207 @@
+#ifndef VXFRUSTUMCULLER_H
+#define VXFRUSTUMCULLER_H
+
+#include "VxFrustum.h"
+#include "VxIntersectBatch.h"
+
+/**********************************************************
+Summary: Frustum culling of arrays of axis aligned boxes.
+
+Remarks:
+    o The six planes of a VxFrustum are tested against 4 boxes at a
+    time (VxBboxSoA), using the center/half size form of the boxes.
+    o An optional plane cache (one byte per group of 4 boxes) remembers
+    the plane which rejected each group the last time. It is tested
+    first on the next call, so as long as the view moves smoothly most
+    invisible groups are rejected with a single plane test. The cache
+    must be kept with the box array between frames.
+    o The optional inside mask tells which boxes are completely inside
+    the frustum, their children do not need to be tested in a hierarchy.
+
+    VxFrustumCuller culler(frustum);
+    culler.Cull(boxes, visibleMask, NULL, planeCache);
+
+See Also : VxFrustum,VxBboxSoA,VxIntersect::FrustumAABB
+*********************************************************/
+class VxFrustumCuller
+{
+public:
+    enum
+    {
+        PlaneCount = 6
+    };
+
+    // Classification returned by CullBox.
+    enum
+    {
+        OUTSIDE = 0,
+        INTERSECT = 1,
+        INSIDE = 2
+    };
+
+    VxFrustumCuller() { memset(m_Planes, 0, sizeof(m_Planes)); }
+    explicit VxFrustumCuller(const VxFrustum &frustum) { SetFrustum(frustum); }
+
+    void SetFrustum(const VxFrustum &frustum)
+    {
+        SetPlane(0, frustum.GetNearPlane());
+        SetPlane(1, frustum.GetFarPlane());
+        SetPlane(2, frustum.GetLeftPlane());
+        SetPlane(3, frustum.GetRightPlane());
+        SetPlane(4, frustum.GetUpPlane());
+        SetPlane(5, frustum.GetBottomPlane());
+    }
+
+    /**********************************************************
+    Summary: Culls an array of boxes.
+
+    Arguments:
+        boxes: World boxes to test.
+        visibleMask: Filled with the boxes which are at least partly inside
+        the frustum (bit i of visibleMask[i/32] for box i).
+        insideMask: If not NULL, filled with the boxes which are completely
+        inside the frustum.
+        planeCache: If not NULL, one byte per group of 4 boxes
+        (boxes.PaddedSize() / 4) used to remember the rejecting planes
+        between calls. Its content must be initialized to 0 the first time.
+    Return Value:
+        Number of visible boxes.
+    *********************************************************/
+    int Cull(const VxBboxSoA &boxes, XDWORD *visibleMask, XDWORD *insideMask = NULL, XBYTE *planeCache = NULL) const
+    {
+        const int count = boxes.Size();
+        const int maskSize = ((count + 31) >> 5) * sizeof(XDWORD);
+        memset(visibleMask, 0, maskSize);
+        if (insideMask)
+            memset(insideMask, 0, maskSize);
+        int visible = 0;
+        int i = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; i < count; i += 4)
+            {
+                const __m128 minx = _mm_loadu_ps(boxes.Min(0) + i), maxx = _mm_loadu_ps(boxes.Max(0) + i);
+                const __m128 miny = _mm_loadu_ps(boxes.Min(1) + i), maxy = _mm_loadu_ps(boxes.Max(1) + i);
+                const __m128 minz = _mm_loadu_ps(boxes.Min(2) + i), maxz = _mm_loadu_ps(boxes.Max(2) + i);
+                const __m128 cx = _mm_mul_ps(_mm_add_ps(minx, maxx), half);
+                const __m128 cy = _mm_mul_ps(_mm_add_ps(miny, maxy), half);
+                const __m128 cz = _mm_mul_ps(_mm_add_ps(minz, maxz), half);
+                const __m128 ex = _mm_mul_ps(_mm_sub_ps(maxx, minx), half);
+                const __m128 ey = _mm_mul_ps(_mm_sub_ps(maxy, miny), half);
+                const __m128 ez = _mm_mul_ps(_mm_sub_ps(maxz, minz), half);
+
+                int first = planeCache ? planeCache[i >> 2] : 0;
+                int outside = 0;
+                __m128 in = _mm_cmpeq_ps(half, half);
+                for (int k = 0; k < PlaneCount && outside != 15; ++k)
+                {
+                    const int p = (first + k) % PlaneCount;
+                    const float *pl = m_Planes[p];
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(pl[0])), _mm_mul_ps(cy, _mm_set1_ps(pl[1]))),
+                                          _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(pl[2])), _mm_set1_ps(pl[3])));
+                    __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(pl[4])), _mm_mul_ps(ey, _mm_set1_ps(pl[5]))),
+                                          _mm_mul_ps(ez, _mm_set1_ps(pl[6])));
+                    outside |= _mm_movemask_ps(_mm_cmpgt_ps(_mm_sub_ps(d, r), _mm_setzero_ps()));
+                    in = _mm_and_ps(in, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+                    if (planeCache && outside == 15)
+                        planeCache[i >> 2] = (XBYTE)p;
+                }
+
+                int mask = ~outside & 15;
+                if (i + 4 > count)
+                    mask &= (1 << (count - i)) - 1;
+                if (mask)
+                {
+                    visibleMask[i >> 5] |= (XDWORD)mask << (i & 31);
+                    visible += BitCount((XDWORD)mask);
+                    if (insideMask)
+                        insideMask[i >> 5] |= (XDWORD)(_mm_movemask_ps(in) & mask) << (i & 31);
+                }
+            }
+            return visible;
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            VxBbox box;
+            for (int c = 0; c < 3; ++c)
+            {
+                box.Min[c] = boxes.Min(c)[i];
+                box.Max[c] = boxes.Max(c)[i];
+            }
+            // the cache is shared by the 4 boxes of a group
+            XBYTE plane = planeCache ? planeCache[i >> 2] : (XBYTE)0;
+            int res = CullBox(box, &plane);
+            if (res == OUTSIDE)
+            {
+                if (planeCache)
+                    planeCache[i >> 2] = plane;
+                continue;
+            }
+            visibleMask[i >> 5] |= 1 << (i & 31);
+            ++visible;
+            if (insideMask && res == INSIDE)
+                insideMask[i >> 5] |= 1 << (i & 31);
+        }
+        return visible;
+    }
+
+    /**********************************************************
+    Summary: Classifies a single box.
+
+    Arguments:
+        box: World box to test.
+        plane: If not NULL, index of the plane to test first, updated
+        with the rejecting plane when the box is outside.
+    Return Value:
+        OUTSIDE, INTERSECT or INSIDE.
+    *********************************************************/
+    int CullBox(const VxBbox &box, XBYTE *plane = NULL) const
+    {
+        float c[3], e[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            c[a] = (box.Min[a] + box.Max[a]) * 0.5f;
+            e[a] = (box.Max[a] - box.Min[a]) * 0.5f;
+        }
+        int first = plane ? *plane : 0;
+        XBOOL inside = TRUE;
+        for (int k = 0; k < PlaneCount; ++k)
+        {
+            const int p = (first + k) % PlaneCount;
+            const float *pl = m_Planes[p];
+            float d = c[0] * pl[0] + c[1] * pl[1] + c[2] * pl[2] + pl[3];
+            float r = e[0] * pl[4] + e[1] * pl[5] + e[2] * pl[6];
+            if (d - r > 0.0f)
+            {
+                if (plane)
+                    *plane = (XBYTE)p;
+                return OUTSIDE;
+            }
+            if (d + r >= 0.0f)
+                inside = FALSE;
+        }
+        return inside ? INSIDE : INTERSECT;
+    }
+
+protected:
+    void SetPlane(int i, const VxPlane &plane)
+    {
+        const VxVector &n = plane.GetNormal();
+        m_Planes[i][0] = n.x;
+        m_Planes[i][1] = n.y;
+        m_Planes[i][2] = n.z;
+        m_Planes[i][3] = plane.m_D;
+        m_Planes[i][4] = XFabs(n.x);
+        m_Planes[i][5] = XFabs(n.y);
+        m_Planes[i][6] = XFabs(n.z);
+        m_Planes[i][7] = 0.0f;
+    }
+
+    // normal, D and absolute value of the normal of each plane (planes face outside)
+    float m_Planes[PlaneCount][8];
+};
+
+#endif // VXFRUSTUMCULLER_H
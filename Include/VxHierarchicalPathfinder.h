@@ -0,0 +1,665 @@
+#ifndef VXHIERARCHICALPATHFINDER_H
+#define VXHIERARCHICALPATHFINDER_H
+
+#include "VxMathDefines.h"
+#include "XArray.h"
+#include "XClassArray.h"
+#include "XHashTable.h"
+
+/*************************************************
+{filename:VxHierarchicalPathfinder}
+Summary: Path searches on a grid of costs through an abstract graph of clusters.
+
+Remarks:
+    o The grid is cut in square clusters (16x16 cells by default). Each run
+    of walkable cells along the border of two clusters gives one entrance
+    (two for the long runs), and the entrances of a cluster are linked by
+    the cost of the shortest path between them inside the cluster. A
+    search goes through this abstract graph, with the start and the goal
+    linked to the entrances of their cluster, then each step of the
+    abstract path is refined by a search limited to one cluster.
+    (Hierarchical A*, the paths are close to the shortest ones.)
+    o A cell has a cost from 1 to 255, 0 being blocked. The moves go to the
+    4 neighbours of a cell and cost the sum of the costs of both cells.
+    o Changing the cost of a cell only marks its cluster: the entrances and
+    the distances of the marked clusters and of their neighbours are
+    computed again by the next search (or Update).
+    o The last paths found are cached by start and goal cell. A cached path
+    is dropped when the cost of a cell in one of the clusters it crosses
+    changes.
+
+    VxHierarchicalPathfinder finder(16);
+    finder.SetSize(width, length);
+    finder.SetCost(x, y, 0); // a wall
+    XArray<int> path;
+    if (finder.FindPath(sx, sy, gx, gy, path))
+        ...
+
+See also: CKGridPathfinder
+*************************************************/
+class VxHierarchicalPathfinder
+{
+public:
+    enum
+    {
+        LongEntrance = 6 // runs of border cells at least that long give two entrances
+    };
+
+    explicit VxHierarchicalPathfinder(int clusterSize = 16)
+        : m_Width(0), m_Length(0), m_ClusterSize(clusterSize < 2 ? 2 : clusterSize), m_ClustersX(0), m_ClustersY(0),
+          m_Dirty(FALSE), m_CacheSize(64), m_Used(0), m_CacheHits(0), m_Stamp(0) {}
+
+    // Resizes the grid, all the cells get the cost 1.
+    void SetSize(int width, int length)
+    {
+        m_Width = width > 0 ? width : 0;
+        m_Length = length > 0 ? length : 0;
+        m_Costs.Resize(m_Width * m_Length);
+        if (m_Costs.Size())
+            memset(m_Costs.Begin(), 1, m_Costs.Size());
+        m_ClustersX = (m_Width + m_ClusterSize - 1) / m_ClusterSize;
+        m_ClustersY = (m_Length + m_ClusterSize - 1) / m_ClusterSize;
+        m_Clusters.Resize(m_ClustersX * m_ClustersY);
+        for (int c = 0; c < m_Clusters.Size(); ++c)
+        {
+            Cluster &cl = m_Clusters[c];
+            cl.m_X0 = (c % m_ClustersX) * m_ClusterSize;
+            cl.m_Y0 = (c / m_ClustersX) * m_ClusterSize;
+            cl.m_X1 = XMin(cl.m_X0 + m_ClusterSize, m_Width);
+            cl.m_Y1 = XMin(cl.m_Y0 + m_ClusterSize, m_Length);
+            cl.m_Changed = TRUE;
+            cl.m_Dirty = TRUE;
+        }
+        m_Dirty = TRUE;
+        m_Cache.Resize(0);
+    }
+
+    int GetWidth() const { return m_Width; }
+    int GetLength() const { return m_Length; }
+
+    // Cost of a cell, 0 for a blocked cell.
+    void SetCost(int x, int y, XBYTE cost)
+    {
+        XBYTE &c = m_Costs[y * m_Width + x];
+        if (c == cost)
+            return;
+        c = cost;
+        MarkChanged(ClusterOf(x, y));
+    }
+    XBYTE GetCost(int x, int y) const { return m_Costs[y * m_Width + x]; }
+
+    // Sets the costs of all the cells (width x length, row by row), only the changed clusters are rebuilt.
+    void SetCosts(const XBYTE *costs)
+    {
+        for (int c = 0; c < m_Clusters.Size(); ++c)
+        {
+            const Cluster &cl = m_Clusters[c];
+            for (int y = cl.m_Y0; y < cl.m_Y1; ++y)
+            {
+                const int offset = y * m_Width + cl.m_X0;
+                if (memcmp(m_Costs.Begin() + offset, costs + offset, cl.m_X1 - cl.m_X0))
+                {
+                    memcpy(m_Costs.Begin() + offset, costs + offset, cl.m_X1 - cl.m_X0);
+                    MarkChanged(c);
+                }
+            }
+        }
+    }
+
+    // Number of paths kept, 0 to disable the cache.
+    void SetCacheSize(int size)
+    {
+        m_CacheSize = size > 0 ? size : 0;
+        if (m_Cache.Size() > m_CacheSize)
+            m_Cache.Resize(m_CacheSize);
+    }
+    int GetCacheHits() const { return m_CacheHits; }
+
+    // Rebuilds the entrances of the changed clusters.
+    void Update()
+    {
+        if (!m_Dirty)
+            return;
+        int c;
+        // the cached paths crossing a changed cluster
+        for (int i = m_Cache.Size() - 1; i >= 0; --i)
+        {
+            const XArray<int> &clusters = m_Cache[i].m_Clusters;
+            for (int k = 0; k < clusters.Size(); ++k)
+            {
+                if (m_Clusters[clusters[k]].m_Changed)
+                {
+                    m_Cache.RemoveAt(i);
+                    break;
+                }
+            }
+        }
+        for (c = 0; c < m_Clusters.Size(); ++c)
+            m_Clusters[c].m_Changed = FALSE;
+        for (c = 0; c < m_Clusters.Size(); ++c)
+        {
+            if (m_Clusters[c].m_Dirty)
+                BuildCluster(c);
+        }
+        m_Dirty = FALSE;
+    }
+
+    // Number of entrances of the abstract graph.
+    int GetNodeCount() const
+    {
+        int count = 0;
+        for (int c = 0; c < m_Clusters.Size(); ++c)
+            count += m_Clusters[c].m_Nodes.Size();
+        return count;
+    }
+
+    /************************************************
+    Summary: Finds a path between two cells.
+
+    Arguments:
+        sx, sy: Start cell.
+        gx, gy: Goal cell.
+        path: Receives the cells of the path (y * width + x), start and goal included.
+    Return Value:
+        FALSE if the goal can not be reached.
+    ************************************************/
+    XBOOL FindPath(int sx, int sy, int gx, int gy, XArray<int> &path)
+    {
+        path.Resize(0);
+        if (!Inside(sx, sy) || !Inside(gx, gy))
+            return FALSE;
+        const int start = sy * m_Width + sx;
+        const int goal = gy * m_Width + gx;
+        if (!m_Costs[start] || !m_Costs[goal])
+            return FALSE;
+        Update();
+        ++m_Used;
+        for (int i = 0; i < m_Cache.Size(); ++i)
+        {
+            if (m_Cache[i].m_Start == start && m_Cache[i].m_Goal == goal)
+            {
+                m_Cache[i].m_Used = m_Used;
+                path = m_Cache[i].m_Cells;
+                ++m_CacheHits;
+                return TRUE;
+            }
+        }
+
+        const int cs = ClusterOf(sx, sy);
+        const int cg = ClusterOf(gx, gy);
+        XBOOL found = FALSE;
+        if (cs == cg)
+            found = SearchCluster(cs, start, goal, path);
+        if (!found)
+            found = SearchAbstract(cs, cg, start, goal, path);
+        if (found)
+            AddToCache(start, goal, path);
+        return found;
+    }
+
+protected:
+    struct Node
+    {
+        int m_Cell;
+        int m_Partners[2]; // cells of the neighbour clusters next to the entrance
+        int m_PartnerCount;
+    };
+
+    struct Cluster
+    {
+        int m_X0, m_Y0, m_X1, m_Y1; // cells [X0,X1[ x [Y0,Y1[
+        XArray<Node> m_Nodes;
+        XArray<int> m_Distances; // between the nodes, -1 if not connected in the cluster
+        XBOOL m_Changed;          // costs changed since the last Update
+        XBOOL m_Dirty;            // entrances to rebuild
+    };
+
+    struct CachedPath
+    {
+        int m_Start;
+        int m_Goal;
+        int m_Used;
+        XArray<int> m_Cells;
+        XArray<int> m_Clusters;
+    };
+
+    struct HeapItem
+    {
+        int m_F;
+        int m_Key;
+    };
+
+    struct SearchNode
+    {
+        int m_G;
+        int m_Parent;
+        XBOOL m_Closed;
+    };
+
+    XBOOL Inside(int x, int y) const { return x >= 0 && y >= 0 && x < m_Width && y < m_Length; }
+    int ClusterOf(int x, int y) const { return (y / m_ClusterSize) * m_ClustersX + x / m_ClusterSize; }
+    int ClusterOfCell(int cell) const { return ClusterOf(cell % m_Width, cell / m_Width); }
+    int StepCost(int a, int b) const { return m_Costs[a] + m_Costs[b]; }
+
+    // A changed cluster changes the entrances on its borders, so its neighbours are rebuilt too.
+    void MarkChanged(int c)
+    {
+        m_Clusters[c].m_Changed = TRUE;
+        m_Clusters[c].m_Dirty = TRUE;
+        const int cx = c % m_ClustersX, cy = c / m_ClustersX;
+        if (cx > 0)
+            m_Clusters[c - 1].m_Dirty = TRUE;
+        if (cx + 1 < m_ClustersX)
+            m_Clusters[c + 1].m_Dirty = TRUE;
+        if (cy > 0)
+            m_Clusters[c - m_ClustersX].m_Dirty = TRUE;
+        if (cy + 1 < m_ClustersY)
+            m_Clusters[c + m_ClustersX].m_Dirty = TRUE;
+        m_Dirty = TRUE;
+    }
+
+    static void PushHeap(XArray<HeapItem> &heap, int f, int key)
+    {
+        HeapItem item = {f, key};
+        heap.PushBack(item);
+        int i = heap.Size() - 1;
+        while (i > 0)
+        {
+            const int parent = (i - 1) >> 1;
+            if (heap[parent].m_F <= item.m_F)
+                break;
+            heap[i] = heap[parent];
+            i = parent;
+        }
+        heap[i] = item;
+    }
+
+    static HeapItem PopHeap(XArray<HeapItem> &heap)
+    {
+        const HeapItem top = heap[0];
+        const HeapItem last = heap[heap.Size() - 1];
+        heap.Resize(heap.Size() - 1);
+        const int n = heap.Size();
+        int i = 0;
+        for (;;)
+        {
+            int child = 2 * i + 1;
+            if (child >= n)
+                break;
+            if (child + 1 < n && heap[child + 1].m_F < heap[child].m_F)
+                ++child;
+            if (heap[child].m_F >= last.m_F)
+                break;
+            heap[i] = heap[child];
+            i = child;
+        }
+        if (n)
+            heap[i] = last;
+        return top;
+    }
+
+    // Adds the entrances on the border shared with a neighbour cluster, cells a are in the cluster.
+    void AddBorder(Cluster &cl, int first, int step, int count, int across)
+    {
+        int run = -1;
+        for (int i = 0; i <= count; ++i)
+        {
+            const int a = first + i * step;
+            const XBOOL open = i < count && m_Costs[a] && m_Costs[a + across];
+            if (open && run < 0)
+                run = i;
+            if (open || run < 0)
+                continue;
+            const int length = i - run;
+            if (length >= LongEntrance)
+            {
+                AddNode(cl, first + run * step, first + run * step + across);
+                AddNode(cl, first + (i - 1) * step, first + (i - 1) * step + across);
+            }
+            else
+            {
+                const int mid = run + length / 2;
+                AddNode(cl, first + mid * step, first + mid * step + across);
+            }
+            run = -1;
+        }
+    }
+
+    static void AddNode(Cluster &cl, int cell, int partner)
+    {
+        for (int i = 0; i < cl.m_Nodes.Size(); ++i)
+        {
+            Node &n = cl.m_Nodes[i];
+            if (n.m_Cell == cell)
+            {
+                if (n.m_PartnerCount < 2)
+                    n.m_Partners[n.m_PartnerCount++] = partner;
+                return;
+            }
+        }
+        Node n;
+        n.m_Cell = cell;
+        n.m_Partners[0] = partner;
+        n.m_PartnerCount = 1;
+        cl.m_Nodes.PushBack(n);
+    }
+
+    // Both clusters of a border find the same entrances from the costs.
+    void BuildCluster(int c)
+    {
+        Cluster &cl = m_Clusters[c];
+        cl.m_Nodes.Resize(0);
+        const int w = cl.m_X1 - cl.m_X0;
+        const int h = cl.m_Y1 - cl.m_Y0;
+        if (cl.m_X0 > 0)
+            AddBorder(cl, cl.m_Y0 * m_Width + cl.m_X0, m_Width, h, -1);
+        if (cl.m_X1 < m_Width)
+            AddBorder(cl, cl.m_Y0 * m_Width + cl.m_X1 - 1, m_Width, h, 1);
+        if (cl.m_Y0 > 0)
+            AddBorder(cl, cl.m_Y0 * m_Width + cl.m_X0, 1, w, -m_Width);
+        if (cl.m_Y1 < m_Length)
+            AddBorder(cl, (cl.m_Y1 - 1) * m_Width + cl.m_X0, 1, w, m_Width);
+
+        const int n = cl.m_Nodes.Size();
+        cl.m_Distances.Resize(n * n);
+        for (int i = 0; i < n; ++i)
+        {
+            Flood(c, cl.m_Nodes[i].m_Cell);
+            for (int j = 0; j < n; ++j)
+                cl.m_Distances[i * n + j] = LocalDistance(cl, cl.m_Nodes[j].m_Cell);
+        }
+        cl.m_Dirty = FALSE;
+    }
+
+    int LocalIndex(const Cluster &cl, int cell) const { return (cell / m_Width - cl.m_Y0) * (cl.m_X1 - cl.m_X0) + cell % m_Width - cl.m_X0; }
+
+    int LocalDistance(const Cluster &cl, int cell) const
+    {
+        const int i = LocalIndex(cl, cell);
+        return m_LocalStamp[i] == m_Stamp ? m_LocalG[i] : -1;
+    }
+
+    /************************************************
+    Summary: A* (Dijkstra without goal) limited to a cluster.
+
+    Remarks:
+        Fills m_LocalG and m_LocalParent for the cells reached, returns TRUE if the goal was reached.
+    ************************************************/
+    XBOOL Flood(int c, int start, int goal = -1)
+    {
+        const Cluster &cl = m_Clusters[c];
+        const int w = cl.m_X1 - cl.m_X0;
+        const int area = w * (cl.m_Y1 - cl.m_Y0);
+        if (m_LocalG.Size() < area)
+        {
+            m_LocalG.Resize(area);
+            m_LocalParent.Resize(area);
+            m_LocalStamp.Resize(area);
+            memset(m_LocalStamp.Begin(), 0, area * sizeof(int));
+            m_Stamp = 0;
+        }
+        ++m_Stamp;
+        const int gx = goal % m_Width, gy = goal / m_Width;
+        m_Heap.Resize(0);
+        int li = LocalIndex(cl, start);
+        m_LocalStamp[li] = m_Stamp;
+        m_LocalG[li] = 0;
+        m_LocalParent[li] = -1;
+        PushHeap(m_Heap, 0, start);
+        static const int dx[4] = {1, -1, 0, 0};
+        static const int dy[4] = {0, 0, 1, -1};
+        while (m_Heap.Size())
+        {
+            const HeapItem top = PopHeap(m_Heap);
+            const int cell = top.m_Key;
+            if (cell == goal)
+                return TRUE;
+            const int x = cell % m_Width, y = cell / m_Width;
+            const int g = m_LocalG[LocalIndex(cl, cell)];
+            if (goal >= 0 && top.m_F > g + 2 * (XAbs(x - gx) + XAbs(y - gy)))
+                continue;
+            if (goal < 0 && top.m_F > g)
+                continue;
+            for (int k = 0; k < 4; ++k)
+            {
+                const int nx = x + dx[k], ny = y + dy[k];
+                if (nx < cl.m_X0 || ny < cl.m_Y0 || nx >= cl.m_X1 || ny >= cl.m_Y1)
+                    continue;
+                const int next = ny * m_Width + nx;
+                if (!m_Costs[next])
+                    continue;
+                const int ng = g + StepCost(cell, next);
+                li = LocalIndex(cl, next);
+                if (m_LocalStamp[li] == m_Stamp && m_LocalG[li] <= ng)
+                    continue;
+                m_LocalStamp[li] = m_Stamp;
+                m_LocalG[li] = ng;
+                m_LocalParent[li] = cell;
+                // the heuristic: 2 per cell to go, the lowest cost of a move
+                const int f = goal >= 0 ? ng + 2 * (XAbs(nx - gx) + XAbs(ny - gy)) : ng;
+                PushHeap(m_Heap, f, next);
+            }
+        }
+        return FALSE;
+    }
+
+    // Appends the cells of the path found by Flood, without its first cell.
+    void AppendLocal(int c, int start, int goal, XArray<int> &path) const
+    {
+        const Cluster &cl = m_Clusters[c];
+        const int first = path.Size();
+        for (int cell = goal; cell != start; cell = m_LocalParent[LocalIndex(cl, cell)])
+            path.PushBack(cell);
+        // reversed
+        for (int i = first, j = path.Size() - 1; i < j; ++i, --j)
+        {
+            const int t = path[i];
+            path[i] = path[j];
+            path[j] = t;
+        }
+    }
+
+    XBOOL SearchCluster(int c, int start, int goal, XArray<int> &path)
+    {
+        if (!Flood(c, start, goal))
+            return FALSE;
+        path.Resize(0);
+        path.PushBack(start);
+        AppendLocal(c, start, goal, path);
+        return TRUE;
+    }
+
+    int NodeIndex(const Cluster &cl, int cell) const
+    {
+        for (int i = 0; i < cl.m_Nodes.Size(); ++i)
+        {
+            if (cl.m_Nodes[i].m_Cell == cell)
+                return i;
+        }
+        return -1;
+    }
+
+    int Heuristic(int cell, int goal) const
+    {
+        return 2 * (XAbs(cell % m_Width - goal % m_Width) + XAbs(cell / m_Width - goal / m_Width));
+    }
+
+    // A* on the entrances, then refinement of each step inside its cluster.
+    XBOOL SearchAbstract(int cs, int cg, int start, int goal, XArray<int> &path)
+    {
+        enum
+        {
+            StartKey = -1,
+            GoalKey = -2
+        };
+        const Cluster &startCluster = m_Clusters[cs];
+        const Cluster &goalCluster = m_Clusters[cg];
+        XArray<int> startDistances, goalDistances;
+        int i;
+        Flood(cs, start);
+        for (i = 0; i < startCluster.m_Nodes.Size(); ++i)
+            startDistances.PushBack(LocalDistance(startCluster, startCluster.m_Nodes[i].m_Cell));
+        Flood(cg, goal);
+        for (i = 0; i < goalCluster.m_Nodes.Size(); ++i)
+            goalDistances.PushBack(LocalDistance(goalCluster, goalCluster.m_Nodes[i].m_Cell));
+
+        XHashTable<SearchNode, int> nodes;
+        m_Heap.Resize(0);
+        SearchNode init = {0, StartKey, FALSE};
+        nodes.Insert(StartKey, init, TRUE);
+        PushHeap(m_Heap, Heuristic(start, goal), StartKey);
+        XBOOL found = FALSE;
+        while (m_Heap.Size())
+        {
+            const HeapItem top = PopHeap(m_Heap);
+            if (top.m_Key == GoalKey)
+            {
+                found = TRUE;
+                break;
+            }
+            SearchNode *current = nodes.FindPtr(top.m_Key);
+            if (current->m_Closed)
+                continue;
+            current->m_Closed = TRUE;
+            const int g = current->m_G;
+
+            // the neighbours of the node: (key, cost) pairs
+            XArray<int> next;
+            if (top.m_Key == StartKey)
+            {
+                for (i = 0; i < startDistances.Size(); ++i)
+                {
+                    if (startDistances[i] >= 0)
+                    {
+                        next.PushBack(startCluster.m_Nodes[i].m_Cell);
+                        next.PushBack(startDistances[i]);
+                    }
+                }
+            }
+            else
+            {
+                const int c = ClusterOfCell(top.m_Key);
+                const Cluster &cl = m_Clusters[c];
+                const int index = NodeIndex(cl, top.m_Key);
+                const int n = cl.m_Nodes.Size();
+                for (i = 0; i < n; ++i)
+                {
+                    const int d = cl.m_Distances[index * n + i];
+                    if (i != index && d >= 0)
+                    {
+                        next.PushBack(cl.m_Nodes[i].m_Cell);
+                        next.PushBack(d);
+                    }
+                }
+                const Node &node = cl.m_Nodes[index];
+                for (i = 0; i < node.m_PartnerCount; ++i)
+                {
+                    next.PushBack(node.m_Partners[i]);
+                    next.PushBack(StepCost(node.m_Cell, node.m_Partners[i]));
+                }
+                if (c == cg && goalDistances[index] >= 0)
+                {
+                    next.PushBack(GoalKey);
+                    next.PushBack(goalDistances[index]);
+                }
+            }
+            for (i = 0; i < next.Size(); i += 2)
+            {
+                const int key = next[i];
+                const int ng = g + next[i + 1];
+                SearchNode *s = nodes.FindPtr(key);
+                if (s && (s->m_Closed || s->m_G <= ng))
+                    continue;
+                SearchNode sn = {ng, top.m_Key, FALSE};
+                nodes.Insert(key, sn, TRUE);
+                PushHeap(m_Heap, ng + (key == GoalKey ? 0 : Heuristic(key, goal)), key);
+            }
+        }
+        if (!found)
+            return FALSE;
+
+        // the entrances from the start to the goal
+        XArray<int> steps;
+        for (int key = nodes.FindPtr(GoalKey)->m_Parent; key != StartKey; key = nodes.FindPtr(key)->m_Parent)
+            steps.PushBack(key);
+        path.Resize(0);
+        path.PushBack(start);
+        int from = start;
+        for (i = steps.Size() - 1; i >= -1; --i)
+        {
+            const int to = i >= 0 ? steps[i] : goal;
+            if (to == from)
+                continue;
+            const int c = ClusterOfCell(from);
+            if (c != ClusterOfCell(to))
+            {
+                path.PushBack(to); // through an entrance
+            }
+            else
+            {
+                if (!Flood(c, from, to))
+                    return FALSE;
+                AppendLocal(c, from, to, path);
+            }
+            from = to;
+        }
+        return TRUE;
+    }
+
+    void AddToCache(int start, int goal, const XArray<int> &path)
+    {
+        if (!m_CacheSize)
+            return;
+        int slot = m_Cache.Size();
+        if (slot >= m_CacheSize)
+        {
+            // the least recently used
+            slot = 0;
+            for (int i = 1; i < m_Cache.Size(); ++i)
+            {
+                if (m_Cache[i].m_Used < m_Cache[slot].m_Used)
+                    slot = i;
+            }
+        }
+        else
+        {
+            m_Cache.Expand(1);
+        }
+        CachedPath &entry = m_Cache[slot];
+        entry.m_Start = start;
+        entry.m_Goal = goal;
+        entry.m_Used = m_Used;
+        entry.m_Cells = path;
+        entry.m_Clusters.Resize(0);
+        int last = -1;
+        for (int i = 0; i < path.Size(); ++i)
+        {
+            const int c = ClusterOfCell(path[i]);
+            if (c != last && entry.m_Clusters.Find(c) == entry.m_Clusters.End())
+                entry.m_Clusters.PushBack(c);
+            last = c;
+        }
+    }
+
+    int m_Width;
+    int m_Length;
+    int m_ClusterSize;
+    int m_ClustersX;
+    int m_ClustersY;
+    XBOOL m_Dirty;
+    XArray<XBYTE> m_Costs;
+    XClassArray<Cluster> m_Clusters;
+    XClassArray<CachedPath> m_Cache;
+    int m_CacheSize;
+    int m_Used;
+    int m_CacheHits;
+
+    // search state inside a cluster
+    XArray<int> m_LocalG;
+    XArray<int> m_LocalParent;
+    XArray<int> m_LocalStamp;
+    int m_Stamp;
+    XArray<HeapItem> m_Heap;
+};
+
+#endif // VXHIERARCHICALPATHFINDER_H
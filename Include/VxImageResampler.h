@@ -0,0 +1,504 @@
+#ifndef VXIMAGERESAMPLER_H
+#define VXIMAGERESAMPLER_H
+
+#include "VxImageDescEx.h"
+#include "VxParallel.h"
+#include "VxSIMD.h"
+#include "XArray.h"
+
+#include <math.h>
+
+/******************************************************************
+Summary: Filters used by VxImageResampler.
+
+See also: VxImageResampler::SetFilter
+******************************************************************/
+typedef enum VX_RESAMPLE_FILTER
+{
+    VX_RESAMPLE_BOX      = 0, // Average of the covered pixels (2x2 for mipmaps)
+    VX_RESAMPLE_TRIANGLE = 1, // Bilinear when enlarging, tent filter when reducing
+    VX_RESAMPLE_KAISER   = 2  // Kaiser windowed sinc, sharpest mipmaps
+} VX_RESAMPLE_FILTER;
+
+/*************************************************
+Summary: Separable resampler and mipmap generator for 32 bits images.
+
+Remarks:
+    o Resize does the work of VxResizeImage32 and GenerateMipMaps the work
+    of VxGenerateMipMap for all the levels in one call, with a choice of
+    filter: the box filter is the one of VxGenerateMipMap, the Kaiser
+    filter keeps the details of the small levels sharper.
+    o The filters are separable: the lines are filtered horizontally then
+    vertically, using weights computed once per column and per line. The
+    pixels are filtered as 4 floats with SSE2, the 2x2 box mipmap case
+    (no gamma correction, even sizes) uses 16 bits integers, 4 pixels at a
+    time.
+    o With SetGammaCorrect(TRUE) the color channels are converted from sRGB
+    to linear before filtering and back after, so the small levels do not
+    get darker than the image. The alpha channel is always linear.
+    o With a VxParallelPool, the destination lines are cut in bands of about
+    16K pixels filtered by the workers.
+    o The images must be 32 bits (any order of the channels since all of
+    them are filtered the same way, except the alpha in gamma mode which
+    must be the high byte).
+
+    VxImageResampler resampler(&pool, VX_RESAMPLE_KAISER);
+    resampler.SetGammaCorrect(TRUE);
+    XArray<XBYTE> mips;
+    mips.Resize(VxImageResampler::GetMipMapSize(desc.Width, desc.Height));
+    int levels = resampler.GenerateMipMaps(desc, mips.Begin());
+
+See also: VxGenerateMipMap,VxResizeImage32,VxParallelPool
+*************************************************/
+class VxImageResampler
+{
+public:
+    explicit VxImageResampler(VxParallelPool *pool = NULL, VX_RESAMPLE_FILTER filter = VX_RESAMPLE_BOX)
+        : m_Pool(pool), m_Filter(filter), m_GammaCorrect(FALSE) {}
+
+    void SetPool(VxParallelPool *pool) { m_Pool = pool; }
+
+    void SetFilter(VX_RESAMPLE_FILTER filter) { m_Filter = filter; }
+    VX_RESAMPLE_FILTER GetFilter() const { return m_Filter; }
+
+    void SetGammaCorrect(XBOOL gamma)
+    {
+        m_GammaCorrect = gamma;
+        if (gamma && !m_ToLinear.Size())
+            BuildGammaTables();
+    }
+    XBOOL IsGammaCorrect() const { return m_GammaCorrect; }
+
+    /************************************************
+    Summary: Resizes an image.
+
+    Arguments:
+        src: 32 bits image to resize.
+        dst: 32 bits image receiving the result, of any size.
+    Return Value:
+        FALSE if the images are not 32 bits images.
+    ************************************************/
+    XBOOL Resize(const VxImageDescEx &src, const VxImageDescEx &dst)
+    {
+        if (!IsValid(src) || !IsValid(dst))
+            return FALSE;
+        Job job;
+        job.m_Resampler = this;
+        job.m_Src = &src;
+        job.m_Dst = &dst;
+        BuildAxis(job.m_X, src.Width, dst.Width);
+        BuildAxis(job.m_Y, src.Height, dst.Height);
+        Run(job, ResizeRows);
+        return TRUE;
+    }
+
+    // Size in bytes of the mipmap levels of an image (without the image), levels < 0 for all the levels.
+    static int GetMipMapSize(int width, int height, int levels = -1)
+    {
+        int size = 0;
+        for (int i = 0; (levels < 0 || i < levels) && (width > 1 || height > 1); ++i)
+        {
+            width = (width > 1) ? width >> 1 : 1;
+            height = (height > 1) ? height >> 1 : 1;
+            size += width * height * 4;
+        }
+        return size;
+    }
+
+    /************************************************
+    Summary: Builds the mipmap levels of an image.
+
+    Arguments:
+        src: 32 bits image.
+        dest: Buffer of GetMipMapSize bytes receiving the levels, largest
+        first, each level being max(width/2,1) x max(height/2,1) pixels of
+        the previous one with 4 bytes per pixel.
+        levels: Maximum number of levels, -1 for all the levels down to 1x1.
+    Return Value:
+        Number of levels written.
+    ************************************************/
+    int GenerateMipMaps(const VxImageDescEx &src, XBYTE *dest, int levels = -1)
+    {
+        if (!IsValid(src) || !dest)
+            return 0;
+        VxImageDescEx level = src;
+        int count = 0;
+        while ((levels < 0 || count < levels) && (level.Width > 1 || level.Height > 1))
+        {
+            VxImageDescEx next = level;
+            next.Width = (level.Width > 1) ? level.Width >> 1 : 1;
+            next.Height = (level.Height > 1) ? level.Height >> 1 : 1;
+            next.BytesPerLine = next.Width * 4;
+            next.Image = dest;
+            const XBOOL even = (level.Width == 1 || !(level.Width & 1)) && (level.Height == 1 || !(level.Height & 1));
+            if (m_Filter == VX_RESAMPLE_BOX && !m_GammaCorrect && even)
+            {
+                Job job;
+                job.m_Resampler = this;
+                job.m_Src = &level;
+                job.m_Dst = &next;
+                Run(job, HalveRows);
+            }
+            else
+            {
+                Resize(level, next);
+            }
+            dest += next.BytesPerLine * next.Height;
+            level = next;
+            ++count;
+        }
+        return count;
+    }
+
+protected:
+    // Contributions of the source pixels to each destination pixel of a line or column.
+    struct Axis
+    {
+        XArray<int> m_First;     // first source pixel
+        XArray<int> m_Count;     // number of source pixels
+        XArray<int> m_Offset;    // first weight in m_Weights
+        XArray<float> m_Weights; // normalized weights
+    };
+
+    struct Job
+    {
+        VxImageResampler *m_Resampler;
+        const VxImageDescEx *m_Src;
+        const VxImageDescEx *m_Dst;
+        Axis m_X;
+        Axis m_Y;
+    };
+
+    static XBOOL IsValid(const VxImageDescEx &desc)
+    {
+        return desc.BitsPerPixel == 32 && desc.Image && desc.Width > 0 && desc.Height > 0;
+    }
+
+    void Run(Job &job, VxRangeFunction *func)
+    {
+        const int lines = job.m_Dst->Height;
+        int grain = 16384 / job.m_Dst->Width;
+        if (grain < 1)
+            grain = 1;
+        if (m_Pool)
+            m_Pool->For(lines, grain, func, &job);
+        else
+            func(&job, 0, lines);
+    }
+
+    float Support() const
+    {
+        return (m_Filter == VX_RESAMPLE_BOX) ? 0.5f : (m_Filter == VX_RESAMPLE_TRIANGLE) ? 1.0f : 1.5f;
+    }
+
+    float Kernel(float t) const
+    {
+        if (t < 0.0f)
+            t = -t;
+        switch (m_Filter)
+        {
+        case VX_RESAMPLE_BOX:
+            return (t <= 0.5f) ? 1.0f : 0.0f;
+        case VX_RESAMPLE_TRIANGLE:
+            return (t < 1.0f) ? 1.0f - t : 0.0f;
+        default:
+        {
+            const float support = 1.5f;
+            if (t >= support)
+                return 0.0f;
+            const float x = 3.14159265f * t;
+            const float sinc = (t > 1e-5f) ? sinf(x) / x : 1.0f;
+            const float r = t / support;
+            return sinc * BesselI0(4.0f * sqrtf(1.0f - r * r)) / BesselI0(4.0f);
+        }
+        }
+    }
+
+    static float BesselI0(float x)
+    {
+        float sum = 1.0f, term = 1.0f;
+        const float q = x * x * 0.25f;
+        for (int k = 1; k < 20; ++k)
+        {
+            term *= q / (float)(k * k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    void BuildAxis(Axis &axis, int srcSize, int dstSize) const
+    {
+        const float scale = (float)srcSize / (float)dstSize;
+        const float filterScale = (scale > 1.0f) ? scale : 1.0f;
+        const float support = Support() * filterScale;
+        axis.m_First.Resize(dstSize);
+        axis.m_Count.Resize(dstSize);
+        axis.m_Offset.Resize(dstSize);
+        axis.m_Weights.Resize(0);
+        for (int x = 0; x < dstSize; ++x)
+        {
+            const float center = ((float)x + 0.5f) * scale - 0.5f;
+            const int first = (int)ceilf(center - support);
+            const int last = (int)floorf(center + support);
+            // the pixels out of the image are the border ones
+            const int lo = (first < 0) ? 0 : (first >= srcSize) ? srcSize - 1 : first;
+            const int hi = (last >= srcSize) ? srcSize - 1 : (last < 0) ? 0 : last;
+            const int offset = axis.m_Weights.Size();
+            axis.m_Weights.Resize(offset + hi - lo + 1);
+            float *w = axis.m_Weights.Begin() + offset;
+            int i;
+            for (i = lo; i <= hi; ++i)
+                w[i - lo] = 0.0f;
+            float total = 0.0f;
+            for (i = first; i <= last; ++i)
+            {
+                const float k = Kernel(((float)i - center) / filterScale);
+                const int s = (i < lo) ? lo : (i > hi) ? hi : i;
+                w[s - lo] += k;
+                total += k;
+            }
+            if (total <= 0.0f)
+            {
+                // nearest pixel
+                const int nearest = (int)floorf(center + 0.5f);
+                for (i = lo; i <= hi; ++i)
+                    w[i - lo] = (i == nearest) ? 1.0f : 0.0f;
+                total = 1.0f;
+            }
+            for (i = lo; i <= hi; ++i)
+                w[i - lo] /= total;
+            axis.m_First[x] = lo;
+            axis.m_Count[x] = hi - lo + 1;
+            axis.m_Offset[x] = offset;
+        }
+    }
+
+    void BuildGammaTables()
+    {
+        m_ToLinear.Resize(256);
+        m_ToSRGB.Resize(4096);
+        int i;
+        for (i = 0; i < 256; ++i)
+        {
+            const float c = (float)i / 255.0f;
+            m_ToLinear[i] = 255.0f * ((c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f));
+        }
+        for (i = 0; i < 4096; ++i)
+        {
+            const float l = (float)i / 4095.0f;
+            const float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+            m_ToSRGB[i] = (XBYTE)(c * 255.0f + 0.5f);
+        }
+    }
+
+    // Converts a line of pixels to 4 floats per pixel.
+    void LoadLine(const XBYTE *src, int count, float *dst) const
+    {
+        int i;
+        if (m_GammaCorrect)
+        {
+            const float *lin = m_ToLinear.Begin();
+            for (i = 0; i < count; ++i, src += 4, dst += 4)
+            {
+                dst[0] = lin[src[0]];
+                dst[1] = lin[src[1]];
+                dst[2] = lin[src[2]];
+                dst[3] = (float)src[3];
+            }
+            return;
+        }
+        i = 0;
+#if VX_SIMD_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4, src += 16, dst += 16)
+        {
+            const __m128i p = _mm_loadu_si128((const __m128i *)src);
+            const __m128i lo = _mm_unpacklo_epi8(p, zero);
+            const __m128i hi = _mm_unpackhi_epi8(p, zero);
+            _mm_storeu_ps(dst, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+            _mm_storeu_ps(dst + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+            _mm_storeu_ps(dst + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+            _mm_storeu_ps(dst + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+        }
+#endif
+        for (; i < count; ++i, src += 4, dst += 4)
+        {
+            dst[0] = (float)src[0];
+            dst[1] = (float)src[1];
+            dst[2] = (float)src[2];
+            dst[3] = (float)src[3];
+        }
+    }
+
+    // Converts 4 floats per pixel back to a line of pixels.
+    void StoreLine(const float *src, int count, XBYTE *dst) const
+    {
+        int i;
+        if (m_GammaCorrect)
+        {
+            const XBYTE *srgb = m_ToSRGB.Begin();
+            for (i = 0; i < count; ++i, src += 4, dst += 4)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    const float v = src[c] * (4095.0f / 255.0f) + 0.5f;
+                    dst[c] = srgb[(v <= 0.0f) ? 0 : (v >= 4095.0f) ? 4095 : (int)v];
+                }
+                const float a = src[3] + 0.5f;
+                dst[3] = (XBYTE)((a <= 0.0f) ? 0 : (a >= 255.0f) ? 255 : (int)a);
+            }
+            return;
+        }
+        i = 0;
+#if VX_SIMD_SSE2
+        for (; i + 2 <= count; i += 2, src += 8, dst += 8)
+        {
+            // saturated by the packs
+            const __m128i a = _mm_cvtps_epi32(_mm_loadu_ps(src));
+            const __m128i b = _mm_cvtps_epi32(_mm_loadu_ps(src + 4));
+            const __m128i p = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_setzero_si128());
+            _mm_storel_epi64((__m128i *)dst, p);
+        }
+#endif
+        for (; i < count; ++i, src += 4, dst += 4)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                const float v = src[c];
+                dst[c] = (XBYTE)((v <= 0.0f) ? 0 : (v >= 255.0f) ? 255 : (int)(v + 0.5f));
+            }
+        }
+    }
+
+    // Filters the destination lines [begin,end[ of a Resize.
+    static void ResizeRows(void *arg, int begin, int end)
+    {
+        const Job &job = *(const Job *)arg;
+        const VxImageResampler &r = *job.m_Resampler;
+        const int srcWidth = job.m_Src->Width;
+        const int dstWidth = job.m_Dst->Width;
+        const int srcBegin = job.m_Y.m_First[begin];
+        const int srcEnd = job.m_Y.m_First[end - 1] + job.m_Y.m_Count[end - 1];
+
+        // the source lines of the band, filtered horizontally
+        XArray<float> line, rows, acc;
+        line.Resize(srcWidth * 4);
+        rows.Resize((srcEnd - srcBegin) * dstWidth * 4);
+        acc.Resize(dstWidth * 4);
+        const int *first = job.m_X.m_First.Begin();
+        const int *count = job.m_X.m_Count.Begin();
+        const int *offset = job.m_X.m_Offset.Begin();
+        const float *weights = job.m_X.m_Weights.Begin();
+        int x, y, k;
+        for (y = srcBegin; y < srcEnd; ++y)
+        {
+            r.LoadLine(job.m_Src->Image + y * job.m_Src->BytesPerLine, srcWidth, line.Begin());
+            float *out = rows.Begin() + (y - srcBegin) * dstWidth * 4;
+            for (x = 0; x < dstWidth; ++x, out += 4)
+            {
+                const float *p = line.Begin() + first[x] * 4;
+                const float *w = weights + offset[x];
+                const int n = count[x];
+#if VX_SIMD_SSE2
+                __m128 sum = _mm_setzero_ps();
+                for (k = 0; k < n; ++k, p += 4)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(p)));
+                _mm_storeu_ps(out, sum);
+#else
+                out[0] = out[1] = out[2] = out[3] = 0.0f;
+                for (k = 0; k < n; ++k, p += 4)
+                {
+                    out[0] += w[k] * p[0];
+                    out[1] += w[k] * p[1];
+                    out[2] += w[k] * p[2];
+                    out[3] += w[k] * p[3];
+                }
+#endif
+            }
+        }
+
+        // vertically, a whole line at a time
+        const int floats = dstWidth * 4;
+        for (y = begin; y < end; ++y)
+        {
+            const float *w = job.m_Y.m_Weights.Begin() + job.m_Y.m_Offset[y];
+            const int n = job.m_Y.m_Count[y];
+            const float *src = rows.Begin() + (job.m_Y.m_First[y] - srcBegin) * floats;
+            float *a = acc.Begin();
+            for (x = 0; x < floats; ++x)
+                a[x] = 0.0f;
+            for (k = 0; k < n; ++k, src += floats)
+            {
+                x = 0;
+#if VX_SIMD_SSE2
+                const __m128 wk = _mm_set1_ps(w[k]);
+                for (; x + 4 <= floats; x += 4)
+                    _mm_storeu_ps(a + x, _mm_add_ps(_mm_loadu_ps(a + x), _mm_mul_ps(wk, _mm_loadu_ps(src + x))));
+#endif
+                for (; x < floats; ++x)
+                    a[x] += w[k] * src[x];
+            }
+            r.StoreLine(a, dstWidth, job.m_Dst->Image + y * job.m_Dst->BytesPerLine);
+        }
+    }
+
+    // 2x2 box filter of the destination lines [begin,end[ of a mipmap level.
+    static void HalveRows(void *arg, int begin, int end)
+    {
+        const Job &job = *(const Job *)arg;
+        const VxImageDescEx &src = *job.m_Src;
+        const VxImageDescEx &dst = *job.m_Dst;
+        const int dx = (src.Width > 1) ? 4 : 0;
+        const int dy = (src.Height > 1) ? src.BytesPerLine : 0;
+        for (int y = begin; y < end; ++y)
+        {
+            const XBYTE *s0 = src.Image + (y * 2) * src.BytesPerLine;
+            const XBYTE *s1 = s0 + dy;
+            XBYTE *d = dst.Image + y * dst.BytesPerLine;
+            int x = 0;
+#if VX_SIMD_SSE2
+            if (dx)
+            {
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i two = _mm_set1_epi16(2);
+                for (; x + 4 <= dst.Width; x += 4)
+                {
+                    const __m128i a0 = _mm_loadu_si128((const __m128i *)(s0 + x * 8));
+                    const __m128i a1 = _mm_loadu_si128((const __m128i *)(s0 + x * 8 + 16));
+                    const __m128i b0 = _mm_loadu_si128((const __m128i *)(s1 + x * 8));
+                    const __m128i b1 = _mm_loadu_si128((const __m128i *)(s1 + x * 8 + 16));
+                    // sums of the 2 lines, then of the 2 columns
+                    __m128i p = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+                    __m128i q = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+                    const __m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(p, q), _mm_unpackhi_epi64(p, q));
+                    p = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+                    q = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+                    const __m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(p, q), _mm_unpackhi_epi64(p, q));
+                    const __m128i r0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+                    const __m128i r1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+                    _mm_storeu_si128((__m128i *)(d + x * 4), _mm_packus_epi16(r0, r1));
+                }
+            }
+#endif
+            for (; x < dst.Width; ++x)
+            {
+                const XBYTE *p0 = s0 + x * dx * 2;
+                const XBYTE *p1 = s1 + x * dx * 2;
+                for (int c = 0; c < 4; ++c)
+                    d[x * 4 + c] = (XBYTE)((p0[c] + p0[dx + c] + p1[c] + p1[dx + c] + 2) >> 2);
+            }
+        }
+    }
+
+    VxParallelPool *m_Pool;
+    VX_RESAMPLE_FILTER m_Filter;
+    XBOOL m_GammaCorrect;
+    XArray<float> m_ToLinear; // sRGB byte to linear (0-255)
+    XArray<XBYTE> m_ToSRGB;   // linear (4096 steps) to sRGB byte
+
+private:
+    VxImageResampler(const VxImageResampler &);
+    VxImageResampler &operator=(const VxImageResampler &);
+};
+
+#endif // VXIMAGERESAMPLER_H
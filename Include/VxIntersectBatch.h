@@ -0,0 +1,1026 @@
+#ifndef VXINTERSECTBATCH_H
+#define VXINTERSECTBATCH_H
+
+#include "VxVector.h"
+#include "VxRay.h"
+#include "VxOBB.h"
+#include "XArray.h"
+#include "VxSIMD.h"
+
+/**********************************************************
+Summary: Array of axis aligned boxes stored as separate component arrays.
+
+Remarks:
+    o The boxes are stored as 6 float arrays (min x,y,z and max x,y,z)
+    padded to a multiple of 4 with empty boxes, so that
+    VxIntersectBatch can test 4 boxes at a time.
+    o Build it once for a set of static boxes and reuse it for
+    several queries.
+See Also : VxIntersectBatch,VxFaceSoA,VxBbox
+*********************************************************/
+class VxBboxSoA
+{
+public:
+    VxBboxSoA() : m_Count(0) {}
+
+    void Clear()
+    {
+        m_Count = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+            m_Min[c].Resize(0);
+            m_Max[c].Resize(0);
+        }
+    }
+
+    void Reserve(int count)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            m_Min[c].Reserve(Padded(count));
+            m_Max[c].Reserve(Padded(count));
+        }
+    }
+
+    void Add(const VxBbox &box)
+    {
+        Resize(m_Count + 1);
+        for (int c = 0; c < 3; ++c)
+        {
+            m_Min[c][m_Count - 1] = box.Min[c];
+            m_Max[c][m_Count - 1] = box.Max[c];
+        }
+    }
+
+    void Build(const VxBbox *boxes, int count)
+    {
+        Clear();
+        Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                m_Min[c][i] = boxes[i].Min[c];
+                m_Max[c][i] = boxes[i].Max[c];
+            }
+        }
+    }
+
+    // Returns the number of boxes.
+    int Size() const { return m_Count; }
+
+    // Returns the size of the component arrays (a multiple of 4).
+    int PaddedSize() const { return m_Min[0].Size(); }
+
+    const float *Min(int axis) const { return m_Min[axis].Begin(); }
+    const float *Max(int axis) const { return m_Max[axis].Begin(); }
+
+protected:
+    static int Padded(int count) { return (count + 3) & ~3; }
+
+    void Resize(int count)
+    {
+        int padded = Padded(count);
+        for (int c = 0; c < 3; ++c)
+        {
+            int old = m_Min[c].Size();
+            m_Min[c].Resize(padded);
+            m_Max[c].Resize(padded);
+            // padding boxes are empty
+            for (int i = XMin(old, m_Count); i < padded; ++i)
+            {
+                m_Min[c][i] = 1e30f;
+                m_Max[c][i] = -1e30f;
+            }
+        }
+        m_Count = count;
+    }
+
+    XArray<float> m_Min[3];
+    XArray<float> m_Max[3];
+    int m_Count;
+};
+
+/**********************************************************
+Summary: Array of triangles prepared for ray intersections.
+
+Remarks:
+    o Each face is stored as its first vertex and its two edges
+    (pt1 - pt0 and pt2 - pt0), each component in a separate
+    array, padded to a multiple of 4 with degenerated faces.
+    o The face normal used for culling is (pt1 - pt0) ^ (pt2 - pt0).
+    o The faces are also grouped by clusters of ClusterSize consecutive
+    faces, each with its bounding box, used by the ray packets queries
+    to skip whole clusters.
+See Also : VxIntersectBatch,VxBboxSoA
+*********************************************************/
+class VxFaceSoA
+{
+public:
+    enum
+    {
+        ClusterSize = 64
+    };
+
+    VxFaceSoA() : m_Count(0) {}
+
+    void Clear()
+    {
+        m_Count = 0;
+        for (int c = 0; c < 9; ++c)
+            m_Data[c].Resize(0);
+        for (int b = 0; b < 6; ++b)
+            m_Clusters[b].Resize(0);
+    }
+
+    void Reserve(int count)
+    {
+        for (int c = 0; c < 9; ++c)
+            m_Data[c].Reserve(Padded(count));
+    }
+
+    void Add(const VxVector &pt0, const VxVector &pt1, const VxVector &pt2)
+    {
+        Resize(m_Count + 1);
+        Set(m_Count - 1, pt0, pt1, pt2);
+    }
+
+    /**********************************************************
+    Summary: Builds the array from indexed faces.
+
+    Arguments:
+        positions: Vertex positions.
+        indices: 3 indices per face (as returned by CKMesh::GetFacesIndices).
+        faceCount: Number of faces.
+    *********************************************************/
+    void Build(const VxStridedData &positions, const XWORD *indices, int faceCount)
+    {
+        Clear();
+        Resize(faceCount);
+        for (int i = 0; i < faceCount; ++i, indices += 3)
+        {
+            Set(i, *(const VxVector *)(positions.CPtr + indices[0] * positions.Stride),
+                *(const VxVector *)(positions.CPtr + indices[1] * positions.Stride),
+                *(const VxVector *)(positions.CPtr + indices[2] * positions.Stride));
+        }
+    }
+
+    // Returns the number of faces.
+    int Size() const { return m_Count; }
+
+    // Returns the size of the component arrays (a multiple of 4).
+    int PaddedSize() const { return m_Data[0].Size(); }
+
+    const float *Origin(int axis) const { return m_Data[axis].Begin(); }
+    const float *Edge1(int axis) const { return m_Data[3 + axis].Begin(); }
+    const float *Edge2(int axis) const { return m_Data[6 + axis].Begin(); }
+
+    // Returns the number of face clusters.
+    int ClusterCount() const { return m_Clusters[0].Size(); }
+
+    // Bounding box of the faces of a cluster.
+    const float *ClusterMin(int axis) const { return m_Clusters[axis].Begin(); }
+    const float *ClusterMax(int axis) const { return m_Clusters[3 + axis].Begin(); }
+
+protected:
+    static int Padded(int count) { return (count + 3) & ~3; }
+
+    void Set(int i, const VxVector &pt0, const VxVector &pt1, const VxVector &pt2)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            m_Data[c][i] = pt0[c];
+            m_Data[3 + c][i] = pt1[c] - pt0[c];
+            m_Data[6 + c][i] = pt2[c] - pt0[c];
+
+            float &cmin = m_Clusters[c][i / ClusterSize];
+            float &cmax = m_Clusters[3 + c][i / ClusterSize];
+            cmin = XMin(cmin, XMin(pt0[c], pt1[c], pt2[c]));
+            cmax = XMax(cmax, XMax(pt0[c], pt1[c], pt2[c]));
+        }
+    }
+
+    void Resize(int count)
+    {
+        int padded = Padded(count);
+        for (int c = 0; c < 9; ++c)
+        {
+            int old = m_Data[c].Size();
+            m_Data[c].Resize(padded);
+            for (int i = XMin(old, m_Count); i < padded; ++i)
+                m_Data[c][i] = 0.0f;
+        }
+        int clusters = (count + ClusterSize - 1) / ClusterSize;
+        for (int b = 0; b < 6; ++b)
+        {
+            int old = m_Clusters[b].Size();
+            m_Clusters[b].Resize(clusters);
+            for (int i = old; i < clusters; ++i)
+                m_Clusters[b][i] = (b < 3) ? 1e30f : -1e30f;
+        }
+        m_Count = count;
+    }
+
+    XArray<float> m_Data[9];
+    XArray<float> m_Clusters[6];
+    int m_Count;
+};
+
+/**********************************************************
+Summary: Array of oriented boxes stored as separate component arrays.
+
+Remarks:
+    o Each box is stored as 15 float arrays (center, 3 unit axes and
+    the 3 half sizes) padded to a multiple of 4 with far away empty boxes,
+    so that VxIntersectBatch can test 4 boxes at a time.
+See Also : VxIntersectBatch,VxOBB,VxBboxSoA
+*********************************************************/
+class VxOBBSoA
+{
+public:
+    enum
+    {
+        ComponentCount = 15
+    };
+
+    VxOBBSoA() : m_Count(0) {}
+
+    void Clear()
+    {
+        m_Count = 0;
+        for (int c = 0; c < ComponentCount; ++c)
+            m_Data[c].Resize(0);
+    }
+
+    void Reserve(int count)
+    {
+        for (int c = 0; c < ComponentCount; ++c)
+            m_Data[c].Reserve(Padded(count));
+    }
+
+    void Add(const VxOBB &box)
+    {
+        Resize(m_Count + 1);
+        Set(m_Count - 1, box);
+    }
+
+    void Build(const VxOBB *boxes, int count)
+    {
+        Clear();
+        Resize(count);
+        for (int i = 0; i < count; ++i)
+            Set(i, boxes[i]);
+    }
+
+    // Returns the number of boxes.
+    int Size() const { return m_Count; }
+
+    // Returns the size of the component arrays (a multiple of 4).
+    int PaddedSize() const { return m_Data[0].Size(); }
+
+    const float *Center(int axis) const { return m_Data[axis].Begin(); }
+    const float *Axis(int i, int axis) const { return m_Data[3 + 3 * i + axis].Begin(); }
+    const float *Extent(int i) const { return m_Data[12 + i].Begin(); }
+
+    // {secret}
+    const float *Component(int c) const { return m_Data[c].Begin(); }
+
+protected:
+    static int Padded(int count) { return (count + 3) & ~3; }
+
+    void Set(int i, const VxOBB &box)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            m_Data[c][i] = box.m_Center[c];
+            m_Data[3 + c][i] = box.m_Axis[0][c];
+            m_Data[6 + c][i] = box.m_Axis[1][c];
+            m_Data[9 + c][i] = box.m_Axis[2][c];
+            m_Data[12 + c][i] = box.m_Extents[c];
+        }
+    }
+
+    void Resize(int count)
+    {
+        int padded = Padded(count);
+        for (int c = 0; c < ComponentCount; ++c)
+        {
+            int old = m_Data[c].Size();
+            m_Data[c].Resize(padded);
+            // padding boxes are points far away
+            for (int i = XMin(old, m_Count); i < padded; ++i)
+                m_Data[c][i] = (c < 3) ? 1e30f : 0.0f;
+        }
+        m_Count = count;
+    }
+
+    XArray<float> m_Data[ComponentCount];
+    int m_Count;
+};
+
+/**********************************************************
+Summary: Intersection tests of one ray or box against many primitives.
+
+Remarks:
+    o The results are given as a bit mask (bit i of hitMask[i/32] is
+    set when the primitive i is hit), hitMask must have room for
+    (count+31)/32 values. The distances are expressed in units of the
+    ray direction (the hit point is m_Origin + dist * m_Direction).
+    o When iSegment is TRUE only the hits between m_Origin and
+    m_Origin + m_Direction are kept, as VxIntersect::SegmentFace.
+    o The tests use SSE when VxHasSSE returns TRUE.
+See Also : VxIntersect,VxBboxSoA,VxFaceSoA
+*********************************************************/
+class VxIntersectBatch
+{
+public:
+    /**********************************************************
+    Summary: Intersects a ray with an array of boxes.
+
+    Arguments:
+        ray: Ray to test.
+        boxes: Boxes to test.
+        hitMask: Filled with the boxes which are hit.
+        dist: If not NULL, filled with the entry distance of each box
+        that is hit (0 if the origin is inside).
+        iSegment: TRUE to limit the test to the ray segment.
+    Return Value:
+        Number of boxes hit.
+    *********************************************************/
+    static int RayBoxes(const VxRay &ray, const VxBboxSoA &boxes, XDWORD *hitMask, float *dist = NULL, XBOOL iSegment = FALSE)
+    {
+        float inv[3];
+        for (int c = 0; c < 3; ++c)
+            inv[c] = (XFabs(ray.m_Direction[c]) > EPSILON) ? 1.0f / ray.m_Direction[c] : ((ray.m_Direction[c] < 0.0f) ? -1e30f : 1e30f);
+        const float tLimit = iSegment ? 1.0f : 1e30f;
+
+        const int count = boxes.Size();
+        memset(hitMask, 0, ((count + 31) >> 5) * sizeof(XDWORD));
+        int hits = 0;
+        int i = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            const __m128 ox = _mm_set1_ps(ray.m_Origin.x), oy = _mm_set1_ps(ray.m_Origin.y), oz = _mm_set1_ps(ray.m_Origin.z);
+            const __m128 ix = _mm_set1_ps(inv[0]), iy = _mm_set1_ps(inv[1]), iz = _mm_set1_ps(inv[2]);
+            const __m128 limit = _mm_set1_ps(tLimit);
+            for (; i < count; i += 4)
+            {
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boxes.Min(0) + i), ox), ix);
+                __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boxes.Max(0) + i), ox), ix);
+                __m128 tmin = _mm_min_ps(t1, t2);
+                __m128 tmax = _mm_max_ps(t1, t2);
+                t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boxes.Min(1) + i), oy), iy);
+                t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boxes.Max(1) + i), oy), iy);
+                tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+                tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+                t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boxes.Min(2) + i), oz), iz);
+                t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boxes.Max(2) + i), oz), iz);
+                tmin = _mm_max_ps(_mm_max_ps(tmin, _mm_min_ps(t1, t2)), _mm_setzero_ps());
+                tmax = _mm_min_ps(_mm_min_ps(tmax, _mm_max_ps(t1, t2)), limit);
+
+                int mask = _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+                if (i + 4 > count)
+                    mask &= (1 << (count - i)) - 1;
+                if (mask)
+                {
+                    hitMask[i >> 5] |= (XDWORD)mask << (i & 31);
+                    hits += BitCount((XDWORD)mask);
+                    if (dist)
+                    {
+                        float d[4];
+                        _mm_storeu_ps(d, tmin);
+                        for (int k = 0; k < 4; ++k)
+                            if (mask & (1 << k))
+                                dist[i + k] = d[k];
+                    }
+                }
+            }
+            return hits;
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            float tmin = 0.0f, tmax = tLimit;
+            for (int c = 0; c < 3; ++c)
+            {
+                float t1 = (boxes.Min(c)[i] - ray.m_Origin[c]) * inv[c];
+                float t2 = (boxes.Max(c)[i] - ray.m_Origin[c]) * inv[c];
+                tmin = XMax(tmin, XMin(t1, t2));
+                tmax = XMin(tmax, XMax(t1, t2));
+            }
+            if (tmin <= tmax)
+            {
+                hitMask[i >> 5] |= 1 << (i & 31);
+                ++hits;
+                if (dist)
+                    dist[i] = tmin;
+            }
+        }
+        return hits;
+    }
+
+    /**********************************************************
+    Summary: Intersects a ray with an array of faces.
+
+    Arguments:
+        ray: Ray to test.
+        faces: Faces to test.
+        hitMask: Filled with the faces which are hit.
+        dist: If not NULL, filled with the hit distance of each face that is hit.
+        iSegment: TRUE to limit the test to the ray segment.
+        iCulled: TRUE to ignore the faces seen from the back.
+    Return Value:
+        Number of faces hit.
+    Remarks:
+        Uses the Moller-Trumbore test.
+    *********************************************************/
+    static int RayFaces(const VxRay &ray, const VxFaceSoA &faces, XDWORD *hitMask, float *dist = NULL, XBOOL iSegment = FALSE, XBOOL iCulled = FALSE)
+    {
+        const int count = faces.Size();
+        memset(hitMask, 0, ((count + 31) >> 5) * sizeof(XDWORD));
+        int hits = 0;
+        for (int i = 0; i < count; i += 4)
+        {
+            float t[4];
+            int mask = RayFaces4(ray, faces, i, t, iSegment, iCulled);
+            if (i + 4 > count)
+                mask &= (1 << (count - i)) - 1;
+            if (mask)
+            {
+                hitMask[i >> 5] |= (XDWORD)mask << (i & 31);
+                hits += BitCount((XDWORD)mask);
+                if (dist)
+                {
+                    for (int k = 0; k < 4; ++k)
+                        if (mask & (1 << k))
+                            dist[i + k] = t[k];
+                }
+            }
+        }
+        return hits;
+    }
+
+    /**********************************************************
+    Summary: Finds the nearest face hit by a ray.
+
+    Arguments:
+        ray: Ray to test.
+        faces: Faces to test.
+        dist: Filled with the distance of the nearest hit.
+        iSegment: TRUE to limit the test to the ray segment.
+        iCulled: TRUE to ignore the faces seen from the back.
+    Return Value:
+        Index of the nearest face hit, -1 if no face is hit.
+    *********************************************************/
+    static int RayFacesNearest(const VxRay &ray, const VxFaceSoA &faces, float &dist, XBOOL iSegment = FALSE, XBOOL iCulled = FALSE)
+    {
+        const int count = faces.Size();
+        int nearest = -1;
+        for (int i = 0; i < count; i += 4)
+        {
+            float t[4];
+            int mask = RayFaces4(ray, faces, i, t, iSegment, iCulled);
+            if (i + 4 > count)
+                mask &= (1 << (count - i)) - 1;
+            for (int k = 0; mask; ++k, mask >>= 1)
+            {
+                if ((mask & 1) && (nearest < 0 || t[k] < dist))
+                {
+                    nearest = i + k;
+                    dist = t[k];
+                }
+            }
+        }
+        return nearest;
+    }
+
+    /**********************************************************
+    Summary: Finds the nearest face hit by each ray of an array.
+
+    Arguments:
+        rays: Rays to test.
+        rayCount: Number of rays.
+        faces: Faces to test.
+        faceIndex: Filled with the index of the nearest face hit by each ray, -1 if none.
+        dist: Filled with the distance of each hit.
+        u,v: If not NULL, filled with the barycentric coordinates of each hit
+        (the hit point is pt0 + u * (pt1 - pt0) + v * (pt2 - pt0)).
+        iSegment: TRUE to limit the tests to the ray segments.
+        iCulled: TRUE to ignore the faces seen from the back.
+    Return Value:
+        Number of rays hitting a face.
+    Remarks:
+        The rays are tested by packets of 4, each face cluster is skipped
+    at once when its bounding box is missed by the 4 rays and each face is
+    loaded once for the 4 rays. Packets of rays with close origins and
+    directions (line of sight, occlusion...) benefit the most from it.
+    *********************************************************/
+    static int RayPacketFaces(const VxRay *rays, int rayCount, const VxFaceSoA &faces, int *faceIndex, float *dist, float *u = NULL, float *v = NULL, XBOOL iSegment = FALSE, XBOOL iCulled = FALSE)
+    {
+        const float tLimit = iSegment ? 1.0f : 1e30f;
+        int hits = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            for (int r = 0; r < rayCount; r += 4)
+            {
+                const int n = XMin(rayCount - r, 4);
+                hits += RayPacket4(rays + r, n, faces, faceIndex + r, dist + r, u ? u + r : NULL, v ? v + r : NULL, tLimit, iCulled);
+            }
+            return hits;
+        }
+#endif
+        for (int r = 0; r < rayCount; ++r)
+        {
+            faceIndex[r] = -1;
+            float best = tLimit;
+            for (int f = 0; f < faces.Size(); ++f)
+            {
+                float t, fu, fv;
+                if (RayFace1(rays[r], faces, f, t, fu, fv, best, iCulled))
+                {
+                    best = t;
+                    faceIndex[r] = f;
+                    dist[r] = t;
+                    if (u)
+                        u[r] = fu;
+                    if (v)
+                        v[r] = fv;
+                }
+            }
+            if (faceIndex[r] >= 0)
+                ++hits;
+        }
+        return hits;
+    }
+
+    //----------- Oriented boxes
+
+    /**********************************************************
+    Summary: Tests an oriented box against an array of oriented boxes.
+
+    Arguments:
+        box: Box to test.
+        boxes: Boxes to test against.
+        hitMask: Filled with the boxes which overlap box.
+    Return Value:
+        Number of boxes overlapping box.
+    Remarks:
+        The boxes are tested 4 at a time with the 15 separating axes,
+        the tests of 4 boxes stop as soon as all of them are separated.
+    See Also: VxIntersect::OBBOBB
+    *********************************************************/
+    static int OBBOBBs(const VxOBB &box, const VxOBBSoA &boxes, XDWORD *hitMask)
+    {
+        float a[VxOBBSoA::ComponentCount];
+        PackOBB(box, a);
+        return OBBBoxes(a, boxes, hitMask);
+    }
+
+    /**********************************************************
+    Summary: Tests an axis aligned box against an array of oriented boxes.
+
+    See Also: OBBOBBs,VxIntersect::AABBOBB
+    *********************************************************/
+    static int AABBOBBs(const VxBbox &box, const VxOBBSoA &boxes, XDWORD *hitMask)
+    {
+        float a[VxOBBSoA::ComponentCount];
+        PackAABB(box, a);
+        return OBBBoxes(a, boxes, hitMask);
+    }
+
+    /**********************************************************
+    Summary: Tests a list of pairs of oriented boxes.
+
+    Arguments:
+        boxes: Boxes.
+        pairs: 2 indices in boxes per pair.
+        pairCount: Number of pairs.
+        results: Filled with TRUE for the pairs which overlap.
+    Return Value:
+        Number of pairs overlapping.
+    Remarks:
+        The pairs are tested 4 at a time, this is meant to be fed with the
+        pairs given by a broadphase (see CKCollisionBroadphase).
+    *********************************************************/
+    static int OBBPairs(const VxOBB *boxes, const int *pairs, int pairCount, XBOOL *results)
+    {
+        float a[4][VxOBBSoA::ComponentCount];
+        float b[4][VxOBBSoA::ComponentCount];
+        int hits = 0;
+        int p = 0;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            for (; p + 4 <= pairCount; p += 4)
+            {
+                int k;
+                for (k = 0; k < 4; ++k)
+                {
+                    PackOBB(boxes[pairs[2 * (p + k)]], a[k]);
+                    PackOBB(boxes[pairs[2 * (p + k) + 1]], b[k]);
+                }
+                __m128 A[VxOBBSoA::ComponentCount], B[VxOBBSoA::ComponentCount];
+                for (k = 0; k < VxOBBSoA::ComponentCount; ++k)
+                {
+                    A[k] = _mm_set_ps(a[3][k], a[2][k], a[1][k], a[0][k]);
+                    B[k] = _mm_set_ps(b[3][k], b[2][k], b[1][k], b[0][k]);
+                }
+                int mask = OBBOBB4(A, B);
+                for (k = 0; k < 4; ++k)
+                    results[p + k] = (mask >> k) & 1;
+                hits += BitCount((XDWORD)mask);
+            }
+        }
+#endif
+        for (; p < pairCount; ++p)
+        {
+            PackOBB(boxes[pairs[2 * p]], a[0]);
+            PackOBB(boxes[pairs[2 * p + 1]], b[0]);
+            results[p] = OBBOBB1(a[0], b[0]);
+            if (results[p])
+                ++hits;
+        }
+        return hits;
+    }
+
+#if VX_SIMD_SSE
+    // {secret}
+    // Nearest hits of up to 4 rays.
+    static int RayPacket4(const VxRay *rays, int n, const VxFaceSoA &faces, int *faceIndex, float *dist, float *u, float *v, float tLimit, XBOOL iCulled)
+    {
+        float o[3][4], d[3][4], inv[3][4];
+        for (int k = 0; k < 4; ++k)
+        {
+            // missing rays are copies of the last one
+            const VxRay &ray = rays[XMin(k, n - 1)];
+            for (int c = 0; c < 3; ++c)
+            {
+                o[c][k] = ray.m_Origin[c];
+                d[c][k] = ray.m_Direction[c];
+                inv[c][k] = (XFabs(d[c][k]) > EPSILON) ? 1.0f / d[c][k] : ((d[c][k] < 0.0f) ? -1e30f : 1e30f);
+            }
+        }
+        const __m128 ox = _mm_loadu_ps(o[0]), oy = _mm_loadu_ps(o[1]), oz = _mm_loadu_ps(o[2]);
+        const __m128 dx = _mm_loadu_ps(d[0]), dy = _mm_loadu_ps(d[1]), dz = _mm_loadu_ps(d[2]);
+        const __m128 ix = _mm_loadu_ps(inv[0]), iy = _mm_loadu_ps(inv[1]), iz = _mm_loadu_ps(inv[2]);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 eps = _mm_set1_ps(EPSILON);
+
+        __m128 bestT = _mm_set1_ps(tLimit);
+        __m128 bestU = zero, bestV = zero;
+        __m128 bestF = _mm_set1_ps(-1.0f);
+
+        const int clusters = faces.ClusterCount();
+        for (int cl = 0; cl < clusters; ++cl)
+        {
+            // 4 rays against the cluster box
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(faces.ClusterMin(0)[cl]), ox), ix);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(faces.ClusterMax(0)[cl]), ox), ix);
+            __m128 tmin = _mm_min_ps(t1, t2);
+            __m128 tmax = _mm_max_ps(t1, t2);
+            t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(faces.ClusterMin(1)[cl]), oy), iy);
+            t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(faces.ClusterMax(1)[cl]), oy), iy);
+            tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+            tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+            t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(faces.ClusterMin(2)[cl]), oz), iz);
+            t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(faces.ClusterMax(2)[cl]), oz), iz);
+            tmin = _mm_max_ps(_mm_max_ps(tmin, _mm_min_ps(t1, t2)), zero);
+            tmax = _mm_min_ps(_mm_min_ps(tmax, _mm_max_ps(t1, t2)), bestT);
+            if (!_mm_movemask_ps(_mm_cmple_ps(tmin, tmax)))
+                continue;
+
+            const int end = XMin((cl + 1) * (int)VxFaceSoA::ClusterSize, faces.Size());
+            for (int f = cl * VxFaceSoA::ClusterSize; f < end; ++f)
+            {
+                const __m128 e1x = _mm_set1_ps(faces.Edge1(0)[f]), e1y = _mm_set1_ps(faces.Edge1(1)[f]), e1z = _mm_set1_ps(faces.Edge1(2)[f]);
+                const __m128 e2x = _mm_set1_ps(faces.Edge2(0)[f]), e2y = _mm_set1_ps(faces.Edge2(1)[f]), e2z = _mm_set1_ps(faces.Edge2(2)[f]);
+
+                const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+                const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+                const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+                const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+                __m128 valid = iCulled ? _mm_cmpgt_ps(det, eps)
+                                       : _mm_cmpgt_ps(_mm_max_ps(det, _mm_sub_ps(zero, det)), eps);
+                if (!_mm_movemask_ps(valid))
+                    continue;
+                const __m128 invDet = _mm_div_ps(one, det);
+
+                const __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(faces.Origin(0)[f]));
+                const __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(faces.Origin(1)[f]));
+                const __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(faces.Origin(2)[f]));
+                const __m128 fu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+                const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+                const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+                const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+                const __m128 fv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+                const __m128 ft = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+                valid = _mm_and_ps(valid, _mm_cmpge_ps(fu, zero));
+                valid = _mm_and_ps(valid, _mm_cmpge_ps(fv, zero));
+                valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(fu, fv), one));
+                valid = _mm_and_ps(valid, _mm_cmpge_ps(ft, zero));
+                valid = _mm_and_ps(valid, _mm_cmplt_ps(ft, bestT));
+                if (!_mm_movemask_ps(valid))
+                    continue;
+
+                bestT = _mm_or_ps(_mm_and_ps(valid, ft), _mm_andnot_ps(valid, bestT));
+                bestU = _mm_or_ps(_mm_and_ps(valid, fu), _mm_andnot_ps(valid, bestU));
+                bestV = _mm_or_ps(_mm_and_ps(valid, fv), _mm_andnot_ps(valid, bestV));
+                bestF = _mm_or_ps(_mm_and_ps(valid, _mm_set1_ps((float)f)), _mm_andnot_ps(valid, bestF));
+            }
+        }
+
+        float t[4], fu[4], fv[4], fi[4];
+        _mm_storeu_ps(t, bestT);
+        _mm_storeu_ps(fu, bestU);
+        _mm_storeu_ps(fv, bestV);
+        _mm_storeu_ps(fi, bestF);
+        int hits = 0;
+        for (int k = 0; k < n; ++k)
+        {
+            faceIndex[k] = (int)fi[k];
+            if (faceIndex[k] < 0)
+                continue;
+            ++hits;
+            dist[k] = t[k];
+            if (u)
+                u[k] = fu[k];
+            if (v)
+                v[k] = fv[k];
+        }
+        return hits;
+    }
+#endif
+
+    // {secret}
+    // Tests the 4 faces starting at index i, returns the mask of the hit faces.
+    static int RayFaces4(const VxRay &ray, const VxFaceSoA &faces, int i, float *t, XBOOL iSegment, XBOOL iCulled)
+    {
+        const float tLimit = iSegment ? 1.0f : 1e30f;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            const __m128 dx = _mm_set1_ps(ray.m_Direction.x), dy = _mm_set1_ps(ray.m_Direction.y), dz = _mm_set1_ps(ray.m_Direction.z);
+            const __m128 e1x = _mm_loadu_ps(faces.Edge1(0) + i), e1y = _mm_loadu_ps(faces.Edge1(1) + i), e1z = _mm_loadu_ps(faces.Edge1(2) + i);
+            const __m128 e2x = _mm_loadu_ps(faces.Edge2(0) + i), e2y = _mm_loadu_ps(faces.Edge2(1) + i), e2z = _mm_loadu_ps(faces.Edge2(2) + i);
+
+            // p = dir ^ e2
+            const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+            const __m128 eps = _mm_set1_ps(EPSILON);
+            __m128 valid = iCulled ? _mm_cmpgt_ps(det, eps)
+                                   : _mm_cmpgt_ps(_mm_max_ps(det, _mm_sub_ps(_mm_setzero_ps(), det)), eps);
+            if (!_mm_movemask_ps(valid))
+                return 0;
+            const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+            // s = origin - pt0
+            const __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.m_Origin.x), _mm_loadu_ps(faces.Origin(0) + i));
+            const __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.m_Origin.y), _mm_loadu_ps(faces.Origin(1) + i));
+            const __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.m_Origin.z), _mm_loadu_ps(faces.Origin(2) + i));
+            const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+            // q = s ^ e1
+            const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+            const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+            const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+            const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+            const __m128 dt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+            const __m128 zero = _mm_setzero_ps();
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(dt, zero));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(dt, _mm_set1_ps(tLimit)));
+            _mm_storeu_ps(t, dt);
+            return _mm_movemask_ps(valid);
+        }
+#endif
+        int mask = 0;
+        for (int k = 0; k < 4; ++k)
+        {
+            float u, v;
+            if (RayFace1(ray, faces, i + k, t[k], u, v, tLimit, iCulled))
+                mask |= 1 << k;
+        }
+        return mask;
+    }
+
+    // {secret}
+    // Scalar test of one face.
+    static XBOOL RayFace1(const VxRay &ray, const VxFaceSoA &faces, int f, float &t, float &u, float &v, float tLimit, XBOOL iCulled)
+    {
+        VxVector e1(faces.Edge1(0)[f], faces.Edge1(1)[f], faces.Edge1(2)[f]);
+        VxVector e2(faces.Edge2(0)[f], faces.Edge2(1)[f], faces.Edge2(2)[f]);
+        VxVector p = CrossProduct(ray.m_Direction, e2);
+        float det = DotProduct(e1, p);
+        if (iCulled ? (det <= EPSILON) : (XFabs(det) <= EPSILON))
+            return FALSE;
+        float invDet = 1.0f / det;
+        VxVector s = ray.m_Origin - VxVector(faces.Origin(0)[f], faces.Origin(1)[f], faces.Origin(2)[f]);
+        u = DotProduct(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return FALSE;
+        VxVector q = CrossProduct(s, e1);
+        v = DotProduct(ray.m_Direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return FALSE;
+        t = DotProduct(e2, q) * invDet;
+        return (t >= 0.0f && t <= tLimit);
+    }
+
+    // {secret}
+    static void PackOBB(const VxOBB &box, float *f)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            f[c] = box.m_Center[c];
+            f[3 + c] = box.m_Axis[0][c];
+            f[6 + c] = box.m_Axis[1][c];
+            f[9 + c] = box.m_Axis[2][c];
+            f[12 + c] = box.m_Extents[c];
+        }
+    }
+
+    // {secret}
+    static void PackAABB(const VxBbox &box, float *f)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            f[c] = (box.Min[c] + box.Max[c]) * 0.5f;
+            f[3 + c] = (c == 0) ? 1.0f : 0.0f;
+            f[6 + c] = (c == 1) ? 1.0f : 0.0f;
+            f[9 + c] = (c == 2) ? 1.0f : 0.0f;
+            f[12 + c] = (box.Max[c] - box.Min[c]) * 0.5f;
+        }
+    }
+
+    // {secret}
+    // Tests a packed box against all the boxes of a VxOBBSoA.
+    static int OBBBoxes(const float *a, const VxOBBSoA &boxes, XDWORD *hitMask)
+    {
+        const int count = boxes.Size();
+        memset(hitMask, 0, ((count + 31) >> 5) * sizeof(XDWORD));
+        int hits = 0;
+        int i = 0;
+        int k;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            __m128 A[VxOBBSoA::ComponentCount], B[VxOBBSoA::ComponentCount];
+            for (k = 0; k < VxOBBSoA::ComponentCount; ++k)
+                A[k] = _mm_set1_ps(a[k]);
+            for (; i < count; i += 4)
+            {
+                for (k = 0; k < VxOBBSoA::ComponentCount; ++k)
+                    B[k] = _mm_loadu_ps(boxes.Component(k) + i);
+                int mask = OBBOBB4(A, B);
+                if (i + 4 > count)
+                    mask &= (1 << (count - i)) - 1;
+                if (mask)
+                {
+                    hitMask[i >> 5] |= (XDWORD)mask << (i & 31);
+                    hits += BitCount((XDWORD)mask);
+                }
+            }
+            return hits;
+        }
+#endif
+        float b[VxOBBSoA::ComponentCount];
+        for (; i < count; ++i)
+        {
+            for (k = 0; k < VxOBBSoA::ComponentCount; ++k)
+                b[k] = boxes.Component(k)[i];
+            if (OBBOBB1(a, b))
+            {
+                hitMask[i >> 5] |= 1 << (i & 31);
+                ++hits;
+            }
+        }
+        return hits;
+    }
+
+#if VX_SIMD_SSE
+    // {secret}
+    // Separating axis tests of 4 pairs of packed boxes, returns the mask of the overlapping pairs.
+    static int OBBOBB4(const __m128 *A, const __m128 *B)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 eps = _mm_set1_ps(1e-6f);
+        __m128 T[3], t[3], R[3][3], AR[3][3];
+        int i, j;
+        for (i = 0; i < 3; ++i)
+            T[i] = _mm_sub_ps(B[i], A[i]);
+        for (i = 0; i < 3; ++i)
+        {
+            const __m128 *ai = A + 3 + 3 * i;
+            t[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(T[0], ai[0]), _mm_mul_ps(T[1], ai[1])), _mm_mul_ps(T[2], ai[2]));
+            for (j = 0; j < 3; ++j)
+            {
+                const __m128 *bj = B + 3 + 3 * j;
+                R[i][j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ai[0], bj[0]), _mm_mul_ps(ai[1], bj[1])), _mm_mul_ps(ai[2], bj[2]));
+                AR[i][j] = _mm_add_ps(_mm_max_ps(R[i][j], _mm_sub_ps(zero, R[i][j])), eps);
+            }
+        }
+        const __m128 *a = A + 12;
+        const __m128 *b = B + 12;
+        __m128 sep = zero;
+
+        // axes of A
+        for (i = 0; i < 3; ++i)
+        {
+            __m128 rb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[0], AR[i][0]), _mm_mul_ps(b[1], AR[i][1])), _mm_mul_ps(b[2], AR[i][2]));
+            __m128 d = _mm_max_ps(t[i], _mm_sub_ps(zero, t[i]));
+            sep = _mm_or_ps(sep, _mm_cmpgt_ps(d, _mm_add_ps(a[i], rb)));
+        }
+        if (_mm_movemask_ps(sep) == 15)
+            return 0;
+
+        // axes of B
+        for (j = 0; j < 3; ++j)
+        {
+            __m128 ra = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], AR[0][j]), _mm_mul_ps(a[1], AR[1][j])), _mm_mul_ps(a[2], AR[2][j]));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(t[0], R[0][j]), _mm_mul_ps(t[1], R[1][j])), _mm_mul_ps(t[2], R[2][j]));
+            d = _mm_max_ps(d, _mm_sub_ps(zero, d));
+            sep = _mm_or_ps(sep, _mm_cmpgt_ps(d, _mm_add_ps(ra, b[j])));
+        }
+        if (_mm_movemask_ps(sep) == 15)
+            return 0;
+
+        // cross products of the axes
+        for (i = 0; i < 3; ++i)
+        {
+            const int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            for (j = 0; j < 3; ++j)
+            {
+                const int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+                __m128 ra = _mm_add_ps(_mm_mul_ps(a[i1], AR[i2][j]), _mm_mul_ps(a[i2], AR[i1][j]));
+                __m128 rb = _mm_add_ps(_mm_mul_ps(b[j1], AR[i][j2]), _mm_mul_ps(b[j2], AR[i][j1]));
+                __m128 d = _mm_sub_ps(_mm_mul_ps(t[i2], R[i1][j]), _mm_mul_ps(t[i1], R[i2][j]));
+                d = _mm_max_ps(d, _mm_sub_ps(zero, d));
+                sep = _mm_or_ps(sep, _mm_cmpgt_ps(d, _mm_add_ps(ra, rb)));
+            }
+            if (_mm_movemask_ps(sep) == 15)
+                return 0;
+        }
+        return ~_mm_movemask_ps(sep) & 15;
+    }
+#endif
+
+    // {secret}
+    // Scalar separating axis test of two packed boxes.
+    static XBOOL OBBOBB1(const float *A, const float *B)
+    {
+        float T[3], t[3], R[3][3], AR[3][3];
+        int i, j;
+        for (i = 0; i < 3; ++i)
+            T[i] = B[i] - A[i];
+        for (i = 0; i < 3; ++i)
+        {
+            const float *ai = A + 3 + 3 * i;
+            t[i] = T[0] * ai[0] + T[1] * ai[1] + T[2] * ai[2];
+            for (j = 0; j < 3; ++j)
+            {
+                const float *bj = B + 3 + 3 * j;
+                R[i][j] = ai[0] * bj[0] + ai[1] * bj[1] + ai[2] * bj[2];
+                AR[i][j] = XFabs(R[i][j]) + 1e-6f;
+            }
+        }
+        const float *a = A + 12;
+        const float *b = B + 12;
+
+        for (i = 0; i < 3; ++i)
+        {
+            if (XFabs(t[i]) > a[i] + b[0] * AR[i][0] + b[1] * AR[i][1] + b[2] * AR[i][2])
+                return FALSE;
+        }
+        for (j = 0; j < 3; ++j)
+        {
+            if (XFabs(t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j]) > a[0] * AR[0][j] + a[1] * AR[1][j] + a[2] * AR[2][j] + b[j])
+                return FALSE;
+        }
+        for (i = 0; i < 3; ++i)
+        {
+            const int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            for (j = 0; j < 3; ++j)
+            {
+                const int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+                float ra = a[i1] * AR[i2][j] + a[i2] * AR[i1][j];
+                float rb = b[j1] * AR[i][j2] + b[j2] * AR[i][j1];
+                if (XFabs(t[i2] * R[i1][j] - t[i1] * R[i2][j]) > ra + rb)
+                    return FALSE;
+            }
+        }
+        return TRUE;
+    }
+};
+
+#endif // VXINTERSECTBATCH_H
@@ -0,0 +1,565 @@
+#ifndef VXJOBSYSTEM_H
+#define VXJOBSYSTEM_H
+
+#include <windows.h>
+
+#include "VxParallel.h"
+#include "VxSync.h"
+
+/*************************************************
+Summary: Prototype of a function executed by a VxJob.
+
+See also: VxJob,VxJobSystem::Run
+*************************************************/
+typedef void VxJobFunction(void *arg);
+
+/*************************************************
+Summary: Number of jobs not yet finished in a group of jobs.
+
+Remarks:
+    o VxJobSystem::Run adds the jobs it is given to their counter and each
+    job decrements it when it is done: a counter at 0 means every job
+    counting on it is finished.
+    o A counter can be waited on (VxJobSystem::WaitForCounter) or be the
+    dependency of other jobs, which are only started once it is 0.
+
+See also: VxJobSystem,VxJob
+*************************************************/
+class VxJobCounter
+{
+public:
+    VxJobCounter() : m_Count(0) {}
+
+    XBOOL IsDone() const { return VxAtomicLoad(&m_Count) == 0; }
+    int GetValue() const { return (int)VxAtomicLoad(&m_Count); }
+
+protected:
+    friend class VxJobSystem;
+
+    volatile long m_Count;
+
+private:
+    VxJobCounter(const VxJobCounter &);
+    VxJobCounter &operator=(const VxJobCounter &);
+};
+
+/*************************************************
+Summary: A function and its argument run by a VxJobSystem.
+
+Remarks:
+    The job system does not copy the jobs: they must stay valid until their
+    counter is 0, which is what happens for jobs declared on the stack
+    before a WaitForCounter.
+
+See also: VxJobSystem::Run,VxJobFunction
+*************************************************/
+struct VxJob
+{
+    VxJobFunction *m_Function;
+    void *m_Arg;
+    VxJobCounter *m_Counter;    // Set by VxJobSystem::Run
+    VxJobCounter *m_Dependency; // Set by VxJobSystem::Run
+
+    VxJob() : m_Function(NULL), m_Arg(NULL), m_Counter(NULL), m_Dependency(NULL) {}
+    VxJob(VxJobFunction *function, void *arg) : m_Function(function), m_Arg(arg), m_Counter(NULL), m_Dependency(NULL) {}
+};
+
+/*************************************************
+Summary: Work-stealing deque of jobs (Chase-Lev).
+
+Remarks:
+    o The owner thread pushes and pops at the bottom, the other threads
+    steal from the top; only a pop racing a steal for the last job costs an
+    atomic compare and exchange.
+    o The capacity is fixed (a power of two): Push fails when the deque is
+    full and the job system then runs the job directly.
+
+See also: VxJobSystem
+*************************************************/
+class VxJobDeque
+{
+public:
+    explicit VxJobDeque(int capacity = 1024) : m_Top(0), m_Bottom(0)
+    {
+        int size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_Jobs.Resize(size);
+        m_Mask = size - 1;
+    }
+
+    int GetCapacity() const { return m_Jobs.Size(); }
+
+    // Owner thread only.
+    XBOOL Push(VxJob *job)
+    {
+        const long b = m_Bottom;
+        const long t = VxAtomicLoad(&m_Top);
+        if (Distance(t, b) >= m_Jobs.Size())
+            return FALSE;
+        m_Jobs[b & m_Mask] = job;
+        VxAtomicStore(&m_Bottom, b + 1);
+        return TRUE;
+    }
+
+    // Owner thread only.
+    VxJob *Pop()
+    {
+        const long b = m_Bottom - 1;
+        VxAtomicExchange(&m_Bottom, b);
+        const long t = VxAtomicLoad(&m_Top);
+        if (Distance(t, b) < 0)
+        {
+            VxAtomicStore(&m_Bottom, b + 1);
+            return NULL;
+        }
+        VxJob *job = m_Jobs[b & m_Mask];
+        if (t == b)
+        {
+            // last job: a thief may take it at the same time
+            if (VxAtomicCompareExchange(&m_Top, t + 1, t) != t)
+                job = NULL;
+            VxAtomicStore(&m_Bottom, b + 1);
+        }
+        return job;
+    }
+
+    // Any thread.
+    VxJob *Steal()
+    {
+        const long t = VxAtomicLoad(&m_Top);
+        VxMemoryBarrier();
+        const long b = VxAtomicLoad(&m_Bottom);
+        if (Distance(t, b) <= 0)
+            return NULL;
+        VxJob *job = (VxJob *)VxAtomicLoadPointer((void *const volatile *)&m_Jobs[t & m_Mask]);
+        if (VxAtomicCompareExchange(&m_Top, t + 1, t) != t)
+            return NULL;
+        return job;
+    }
+
+    XBOOL IsEmpty() const { return Distance(VxAtomicLoad(&m_Top), VxAtomicLoad(&m_Bottom)) <= 0; }
+
+protected:
+    // b - t, correct when the indices wrap around.
+    static int Distance(long t, long b) { return (int)(long)((unsigned long)b - (unsigned long)t); }
+
+    volatile long m_Top;
+    char m_Padding[60]; // keeps the thieves and the owner on different cache lines
+    volatile long m_Bottom;
+    XArray<VxJob *> m_Jobs;
+    int m_Mask;
+
+private:
+    VxJobDeque(const VxJobDeque &);
+    VxJobDeque &operator=(const VxJobDeque &);
+};
+
+/*************************************************
+Summary: Job system with work-stealing worker threads.
+
+Remarks:
+    o The workers are VxThread created once. Each one, and the thread which
+    created the system, owns a VxJobDeque: the jobs run by a thread go to
+    its own deque and idle threads steal from the others. Jobs run from
+    any other thread go through a shared queue.
+    o Run adds the jobs to a VxJobCounter; WaitForCounter executes jobs
+    (of any group) on the calling thread until the counter is 0, so the
+    main thread works instead of blocking and a job can wait for the jobs
+    it started.
+    o A job given a dependency counter is kept aside until that counter is
+    0. The jobs of the dependency must have been run before.
+    o Idle workers spin a little and then sleep on a semaphore, released
+    when jobs are run.
+    o The worker threads are pinned to a processor each when pinWorkers is
+    TRUE (worker i on processor i + 1, the creating thread being expected
+    on processor 0), SetWorkerAffinity changes the mask of one worker.
+    o Every counter must be done before the system is deleted.
+
+    VxJobSystem jobs;
+    VxJob decode[16];
+    VxJobCounter decoded, uploaded;
+    for (int i = 0; i < 16; ++i)
+        decode[i] = VxJob(DecodeTile, &tiles[i]);
+    jobs.Run(decode, 16, &decoded);
+    VxJob upload(UploadTiles, tiles);
+    jobs.Run(&upload, 1, &uploaded, &decoded);
+    jobs.WaitForCounter(&uploaded);
+
+See also: VxJob,VxJobCounter,VxJobDeque,VxParallelPool
+*************************************************/
+class VxJobSystem
+{
+public:
+    enum
+    {
+        MaxWorkers = 32
+    };
+
+    // A negative workerCount creates one worker per processor but one.
+    explicit VxJobSystem(int workerCount = -1, XBOOL pinWorkers = FALSE, int dequeCapacity = 1024)
+        : m_Stop(0), m_Sleeping(0), m_Pending(0), m_Injected(0)
+    {
+        if (workerCount < 0)
+        {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            workerCount = (int)info.dwNumberOfProcessors - 1;
+        }
+        workerCount = XMin(workerCount, (int)MaxWorkers);
+
+        m_Tls = TlsAlloc();
+        // Wake can release more than the sleeping workers take before they look again
+        m_Semaphore = CreateSemaphoreA(NULL, 0, 0x7FFFFFFF, NULL);
+
+        // deque 0 belongs to the creating thread. All the deques are created
+        // before the workers start: they walk m_Deques, which must not grow under them.
+        int i;
+        for (i = 0; i <= workerCount; ++i)
+            m_Deques.PushBack(new VxJobDeque(dequeCapacity));
+        TlsSetValue(m_Tls, (LPVOID)(INT_PTR)1);
+
+        for (i = 0; i < workerCount; ++i)
+        {
+            Worker *w = new Worker(this, i + 1);
+            if (!w->CreateThread())
+            {
+                // the deques of the missing workers stay empty
+                delete w;
+                break;
+            }
+            m_Workers.PushBack(w);
+            if (pinWorkers)
+                SetWorkerAffinity(i, (DWORD_PTR)1 << ((i + 1) % (8 * sizeof(DWORD_PTR))));
+        }
+    }
+
+    ~VxJobSystem()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        ReleaseSemaphore(m_Semaphore, m_Workers.Size(), NULL);
+        for (int i = 0; i < m_Workers.Size(); ++i)
+        {
+            m_Workers[i]->Wait();
+            delete m_Workers[i];
+        }
+        for (int j = 0; j < m_Deques.Size(); ++j)
+            delete m_Deques[j];
+        CloseHandle(m_Semaphore);
+        TlsFree(m_Tls);
+    }
+
+    int GetWorkerCount() const { return m_Workers.Size(); }
+
+    // Restricts a worker (0 to GetWorkerCount() - 1) to a set of processors.
+    XBOOL SetWorkerAffinity(int worker, DWORD_PTR mask)
+    {
+        if (worker < 0 || worker >= m_Workers.Size())
+            return FALSE;
+        return SetThreadAffinityMask((HANDLE)m_Workers[worker]->GetHandle(), mask) != 0;
+    }
+
+    /*************************************************
+    Summary: Starts jobs.
+
+    Arguments:
+        jobs: Jobs to run, which must stay valid until counter is 0.
+        count: Number of jobs.
+        counter: Counter the jobs are added to (can be NULL).
+        dependency: Counter which must be 0 before the jobs start (can be NULL).
+    *************************************************/
+    void Run(VxJob *jobs, int count, VxJobCounter *counter = NULL, VxJobCounter *dependency = NULL)
+    {
+        if (count <= 0)
+            return;
+        if (counter)
+            VxAtomicExchangeAdd(&counter->m_Count, count);
+        for (int i = 0; i < count; ++i)
+        {
+            jobs[i].m_Counter = counter;
+            jobs[i].m_Dependency = dependency;
+            if (!dependency || dependency->IsDone() || !Defer(&jobs[i]))
+                Schedule(&jobs[i]);
+        }
+        Wake(count);
+    }
+
+    // Executes jobs on the calling thread until counter is 0.
+    void WaitForCounter(VxJobCounter *counter)
+    {
+        int idle = 0;
+        while (!counter->IsDone())
+        {
+            VxJob *job = FindJob();
+            if (job)
+            {
+                Execute(job);
+                idle = 0;
+            }
+            else if (++idle < 64)
+                VxSpinPause();
+            else
+                SwitchToThread();
+        }
+    }
+
+    // Runs one job and waits for it.
+    void RunAndWait(VxJobFunction *function, void *arg)
+    {
+        VxJob job(function, arg);
+        VxJobCounter counter;
+        Run(&job, 1, &counter);
+        WaitForCounter(&counter);
+    }
+
+    /*************************************************
+    Summary: Runs a function on a range of items in parallel.
+
+    Arguments:
+        count: Number of items.
+        grain: Number of items processed by each call of func.
+        func: Function processing a range of items.
+        arg: Argument given to func.
+    Remarks:
+        The chunks are taken with an atomic counter by one job per worker
+        and by the calling thread, which returns when all the items are
+        processed. It can be called from a job.
+    *************************************************/
+    void ParallelFor(int count, int grain, VxRangeFunction *func, void *arg)
+    {
+        if (count <= 0)
+            return;
+        if (grain < 1)
+            grain = 1;
+        const int chunks = (count + grain - 1) / grain;
+        const int helpers = XMin(chunks - 1, m_Workers.Size());
+        if (helpers <= 0)
+        {
+            func(arg, 0, count);
+            return;
+        }
+
+        ForLoop loop;
+        loop.m_Func = func;
+        loop.m_Arg = arg;
+        loop.m_Count = count;
+        loop.m_Grain = grain;
+        loop.m_Next = 0;
+
+        VxJob jobs[MaxWorkers];
+        for (int i = 0; i < helpers; ++i)
+            jobs[i] = VxJob(RunForChunks, &loop);
+        VxJobCounter counter;
+        Run(jobs, helpers, &counter);
+        RunForChunks(&loop);
+        WaitForCounter(&counter);
+    }
+
+protected:
+    class Worker : public VxThread
+    {
+    public:
+        Worker(VxJobSystem *system, int index) : m_System(system), m_Index(index) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_System->WorkerLoop(m_Index);
+            return VXT_OK;
+        }
+
+        VxJobSystem *m_System;
+        int m_Index;
+    };
+    friend class Worker;
+
+    struct ForLoop
+    {
+        VxRangeFunction *m_Func;
+        void *m_Arg;
+        int m_Count;
+        int m_Grain;
+        volatile long m_Next;
+    };
+
+    static void RunForChunks(void *arg)
+    {
+        ForLoop *loop = (ForLoop *)arg;
+        for (;;)
+        {
+            int begin = (int)VxAtomicExchangeAdd(&loop->m_Next, loop->m_Grain);
+            if (begin >= loop->m_Count)
+                return;
+            loop->m_Func(loop->m_Arg, begin, XMin(begin + loop->m_Grain, loop->m_Count));
+        }
+    }
+
+    void WorkerLoop(int index)
+    {
+        TlsSetValue(m_Tls, (LPVOID)(INT_PTR)(index + 1));
+        int idle = 0;
+        while (!VxAtomicLoad(&m_Stop))
+        {
+            VxJob *job = FindJob();
+            if (job)
+            {
+                Execute(job);
+                idle = 0;
+                continue;
+            }
+            if (++idle < 256)
+            {
+                VxSpinPause();
+                continue;
+            }
+            // announce the sleep before the last look, Wake reads m_Sleeping after pushing
+            VxAtomicIncrement(&m_Sleeping);
+            if (!HasJobs() && !VxAtomicLoad(&m_Stop))
+                WaitForSingleObject(m_Semaphore, INFINITE);
+            VxAtomicDecrement(&m_Sleeping);
+            idle = 0;
+        }
+    }
+
+    // Deque of the calling thread, NULL for the threads which are not part of the system.
+    VxJobDeque *GetLocalDeque()
+    {
+        int index = (int)(INT_PTR)TlsGetValue(m_Tls);
+        return index > 0 ? m_Deques[index - 1] : NULL;
+    }
+
+    void Schedule(VxJob *job)
+    {
+        VxJobDeque *deque = GetLocalDeque();
+        if (deque)
+        {
+            if (!deque->Push(job))
+                Execute(job); // full
+            return;
+        }
+        VxSpinLockScope lock(m_InjectedLock);
+        m_InjectedJobs.PushBack(job);
+        VxAtomicIncrement(&m_Injected);
+    }
+
+    void Wake(int count)
+    {
+        VxMemoryBarrier();
+        int sleeping = (int)VxAtomicLoad(&m_Sleeping);
+        if (sleeping > 0)
+            ReleaseSemaphore(m_Semaphore, XMin(count, sleeping), NULL);
+    }
+
+    XBOOL HasJobs()
+    {
+        if (VxAtomicLoad(&m_Injected))
+            return TRUE;
+        for (int i = 0; i < m_Deques.Size(); ++i)
+            if (!m_Deques[i]->IsEmpty())
+                return TRUE;
+        return FALSE;
+    }
+
+    VxJob *FindJob()
+    {
+        VxJobDeque *local = GetLocalDeque();
+        VxJob *job = local ? local->Pop() : NULL;
+        if (job)
+            return job;
+
+        if (VxAtomicLoad(&m_Injected))
+        {
+            VxSpinLockScope lock(m_InjectedLock);
+            if (m_InjectedJobs.Size())
+            {
+                VxAtomicDecrement(&m_Injected);
+                return m_InjectedJobs.PopBack();
+            }
+        }
+
+        // steal, starting after the local deque so the thieves spread out
+        const int n = m_Deques.Size();
+        int start = 0;
+        for (int i = 0; i < n; ++i)
+            if (m_Deques[i] == local)
+                start = i + 1;
+        for (int j = 0; j < n; ++j)
+        {
+            VxJobDeque *victim = m_Deques[(start + j) % n];
+            if (victim != local && (job = victim->Steal()) != NULL)
+                return job;
+        }
+        return NULL;
+    }
+
+    void Execute(VxJob *job)
+    {
+        VxJobCounter *counter = job->m_Counter;
+        job->m_Function(job->m_Arg);
+        if (counter && VxAtomicDecrement(&counter->m_Count) == 0 && VxAtomicLoad(&m_Pending))
+            ReleasePending();
+    }
+
+    // Keeps a job until its dependency is done, FALSE if it is already done.
+    XBOOL Defer(VxJob *job)
+    {
+        VxSpinLockScope lock(m_PendingLock);
+        // m_Pending is raised before looking at the dependency, Execute reads it after decrementing
+        VxAtomicIncrement(&m_Pending);
+        if (job->m_Dependency->IsDone())
+        {
+            VxAtomicDecrement(&m_Pending);
+            return FALSE;
+        }
+        m_PendingJobs.PushBack(job);
+        return TRUE;
+    }
+
+    void ReleasePending()
+    {
+        // scheduled once the lock is released, as a full deque executes the job right away
+        XArray<VxJob *> released;
+        {
+            VxSpinLockScope lock(m_PendingLock);
+            for (int i = 0; i < m_PendingJobs.Size();)
+            {
+                VxJob *job = m_PendingJobs[i];
+                if (job->m_Dependency->IsDone())
+                {
+                    m_PendingJobs.RemoveAt(i);
+                    VxAtomicDecrement(&m_Pending);
+                    released.PushBack(job);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+        for (int j = 0; j < released.Size(); ++j)
+            Schedule(released[j]);
+        if (released.Size())
+            Wake(released.Size());
+    }
+
+    XArray<Worker *> m_Workers;
+    XArray<VxJobDeque *> m_Deques;
+    DWORD m_Tls;       // index of the deque of the thread + 1
+    HANDLE m_Semaphore; // idle workers sleep on it
+    volatile long m_Stop;
+    volatile long m_Sleeping;
+
+    VxSpinLock m_PendingLock;
+    XArray<VxJob *> m_PendingJobs; // jobs waiting for their dependency
+    volatile long m_Pending;
+
+    VxSpinLock m_InjectedLock;
+    XArray<VxJob *> m_InjectedJobs; // jobs run by threads without a deque
+    volatile long m_Injected;
+
+private:
+    VxJobSystem(const VxJobSystem &);
+    VxJobSystem &operator=(const VxJobSystem &);
+};
+
+#endif // VXJOBSYSTEM_H
@@ -0,0 +1,215 @@
+#ifndef VXKEYTRACK_H
+#define VXKEYTRACK_H
+
+#include "VxQuaternion.h"
+#include "VxFastMath.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Linear keyframe track with a sampling cursor.
+
+Remarks:
+    o The key times are stored in their own array and the values of the
+    keys (3 or 4 floats each) one after the other in another, so finding
+    the keys around a time only reads the times.
+    o Locate takes a cursor (the index of the key found by the previous
+    call, one per playback instance): when the time moves forward the
+    search starts from it, which costs O(1) for an animation played
+    normally. A binary search is only done when the time jumps backward
+    or far ahead.
+    o A uniform track (SetUniformKeys) has a key every Step and no times,
+    the keys are found with a multiplication.
+
+    VxKeyTrack track;
+    track.SetKeys(times, positions, count, 3);
+    int cursor = 0;
+    VxVector pos;
+    track.Sample(frame, cursor, &pos.x);
+
+See Also: CKCompiledObjectAnimation
+*********************************************************/
+class VxKeyTrack
+{
+public:
+    VxKeyTrack() : m_Components(3), m_Count(0), m_Start(0.0f), m_Step(0.0f), m_InvStep(0.0f) {}
+
+    /************************************************
+    Summary: Sets keys at arbitrary times.
+
+    Arguments:
+        times: Time of each key, in increasing order.
+        values: Values of the keys, components floats per key.
+        count: Number of keys.
+        components: Number of floats per key (3 for a vector, 4 for a quaternion).
+    Remarks:
+        A key whose time is not after the time of the previous key is
+    dropped: two keys can not be interpolated over a null time.
+    ************************************************/
+    void SetKeys(const float *times, const float *values, int count, int components)
+    {
+        m_Components = components;
+        m_Step = m_InvStep = 0.0f;
+        m_Start = count ? times[0] : 0.0f;
+        m_Times.Resize(count);
+        m_Values.Resize(count * components);
+        m_Count = 0;
+        for (int k = 0; k < count; ++k)
+        {
+            if (m_Count && times[k] <= m_Times[m_Count - 1])
+                continue;
+            m_Times[m_Count] = times[k];
+            memcpy(m_Values.Begin() + m_Count * components, values + k * components, components * sizeof(float));
+            ++m_Count;
+        }
+        m_Times.Resize(m_Count);
+        m_Values.Resize(m_Count * components);
+    }
+
+    // Sets keys every step from start.
+    void SetUniformKeys(float start, float step, const float *values, int count, int components)
+    {
+        m_Components = components;
+        m_Count = count;
+        m_Start = start;
+        m_Step = step;
+        m_InvStep = (step > 0.0f) ? 1.0f / step : 0.0f;
+        m_Times.Resize(0);
+        m_Values.Resize(count * components);
+        if (count)
+            memcpy(m_Values.Begin(), values, count * components * sizeof(float));
+    }
+
+    void Clear()
+    {
+        m_Count = 0;
+        m_Times.Resize(0);
+        m_Values.Resize(0);
+    }
+
+    int GetKeyCount() const { return m_Count; }
+    int GetComponentCount() const { return m_Components; }
+    XBOOL IsUniform() const { return m_Step > 0.0f; }
+
+    float GetKeyTime(int k) const { return IsUniform() ? m_Start + k * m_Step : m_Times[k]; }
+    const float *GetKeyValue(int k) const { return m_Values.Begin() + k * m_Components; }
+
+    // Memory used by the keys, in bytes.
+    int GetMemoryUsed() const { return (m_Times.Size() + m_Values.Size()) * (int)sizeof(float); }
+
+    /************************************************
+    Summary: Finds the keys surrounding a time.
+
+    Arguments:
+        t: Time to sample.
+        cursor: Key found by the previous call, updated.
+        alpha: Receives the position of t between the returned key and the next one (0..1).
+    Return Value:
+        Index of the key before t (the last key is never returned when
+        there are two keys or more).
+    ************************************************/
+    int Locate(float t, int &cursor, float &alpha) const
+    {
+        alpha = 0.0f;
+        if (m_Count < 2)
+            return 0;
+        const int last = m_Count - 2;
+        if (IsUniform())
+        {
+            float f = (t - m_Start) * m_InvStep;
+            if (f <= 0.0f)
+                return cursor = 0;
+            int k = (int)f;
+            if (k > last)
+            {
+                alpha = 1.0f;
+                return cursor = last;
+            }
+            alpha = f - (float)k;
+            return cursor = k;
+        }
+
+        const float *times = m_Times.Begin();
+        if (t <= times[0])
+            return cursor = 0;
+        if (t >= times[m_Count - 1])
+        {
+            alpha = 1.0f;
+            return cursor = last;
+        }
+        int k = cursor;
+        if (k < 0 || k > last || times[k] > t)
+        {
+            k = Search(t);
+        }
+        else
+        {
+            // forward from the cursor, few keys at a time
+            int steps = 0;
+            while (times[k + 1] <= t && ++steps <= 4)
+                ++k;
+            if (times[k + 1] <= t)
+                k = Search(t);
+        }
+        alpha = (t - times[k]) / (times[k + 1] - times[k]);
+        return cursor = k;
+    }
+
+    // Samples a vector track (or any track with linear interpolation of its components).
+    void Sample(float t, int &cursor, float *res) const
+    {
+        if (!m_Count)
+            return;
+        float alpha;
+        int k = Locate(t, cursor, alpha);
+        const float *a = GetKeyValue(k);
+        if (m_Count < 2)
+        {
+            for (int c = 0; c < m_Components; ++c)
+                res[c] = a[c];
+            return;
+        }
+        const float *b = a + m_Components;
+        for (int c = 0; c < m_Components; ++c)
+            res[c] = a[c] + alpha * (b[c] - a[c]);
+    }
+
+    // Samples a quaternion track.
+    void SampleRotation(float t, int &cursor, VxQuaternion &res) const
+    {
+        if (!m_Count)
+            return;
+        float alpha;
+        int k = Locate(t, cursor, alpha);
+        const VxQuaternion &a = *(const VxQuaternion *)GetKeyValue(k);
+        if (m_Count < 2 || alpha <= 0.0f)
+            res = a;
+        else
+            res = VxFastSlerp(alpha, a, *(const VxQuaternion *)GetKeyValue(k + 1));
+    }
+
+protected:
+    int Search(float t) const
+    {
+        const float *times = m_Times.Begin();
+        int lo = 0, hi = m_Count - 1;
+        while (hi - lo > 1)
+        {
+            int mid = (lo + hi) >> 1;
+            if (times[mid] <= t)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    int m_Components;
+    int m_Count;
+    float m_Start;
+    float m_Step; // not null for a uniform track
+    float m_InvStep;
+    XArray<float> m_Times;
+    XArray<float> m_Values;
+};
+
+#endif // VXKEYTRACK_H
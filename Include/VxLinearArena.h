@@ -0,0 +1,230 @@
+#ifndef VXLINEARARENA_H
+#define VXLINEARARENA_H
+
+#include "XUtil.h"
+
+/****************************************************************
+Summary: Linear (bump) allocator for short lived scratch memory.
+
+Remarks:
+    o Allocations are carved sequentially from large aligned blocks,
+    there is no per allocation free. The whole arena is released at once
+    with Reset() or rolled back to a previous point with Rewind().
+    o A typical use is a per frame arena owned by a manager which calls
+    Reset() in its PostProcess callback, once CKContext::Process has run all
+    behaviors. Building blocks then take their temporary arrays from it
+    instead of new/delete.
+    o When a frame needs more than one block, Reset() replaces the blocks
+    by a single one as large as the high water mark so following frames
+    do not chain blocks again.
+    o The arena is not thread safe: use one arena per thread.
+    o No constructor or destructor is called on the returned memory.
+See Also: VxMemoryPool,VxArenaScope
+****************************************************************/
+class VxLinearArena
+{
+public:
+    // Position in the arena returned by GetMarker.
+    struct Marker
+    {
+        void *m_Block;
+        int m_Offset;
+        int m_Used;
+    };
+
+    // Constructs an arena which allocates blocks of blockSize bytes.
+    explicit VxLinearArena(int blockSize = 64 * 1024)
+        : m_First(NULL), m_Current(NULL), m_Offset(0), m_BlockSize(blockSize),
+          m_Used(0), m_HighWater(0), m_Reserved(0) {}
+
+    ~VxLinearArena()
+    {
+        FreeBlocks();
+    }
+
+    /************************************************
+    Summary: Allocates size bytes aligned on align bytes.
+
+    Remarks:
+        align must be a power of 2. The memory stays valid
+    until the next Reset() or a Rewind() to an older marker.
+    ************************************************/
+    void *Allocate(int size, int align = 16)
+    {
+        XASSERT(Is2Power(align));
+        if (m_Current)
+        {
+            XBYTE *ptr = AlignPtr(m_Current->Data() + m_Offset, align);
+            if (ptr + size <= m_Current->Data() + m_Current->m_Size)
+                return Commit(ptr, size);
+        }
+
+        // Try the blocks kept from a previous frame, then a new one
+        Block *block = m_Current ? m_Current->m_Next : m_First;
+        while (block && AlignPtr(block->Data(), align) + size > block->Data() + block->m_Size)
+            block = block->m_Next;
+        if (!block)
+            block = AddBlock(XMax(m_BlockSize, size + align));
+
+        // The end of the current block is lost
+        if (m_Current)
+            m_Used += m_Current->m_Size - m_Offset;
+        m_Current = block;
+        m_Offset = 0;
+        return Commit(AlignPtr(block->Data(), align), size);
+    }
+
+    // Allocates an array of count elements of type T (no constructor called).
+    template <class T>
+    T *AllocateArray(int count)
+    {
+        return (T *)Allocate(count * sizeof(T), (sizeof(T) >= 16) ? 16 : 4);
+    }
+
+    /************************************************
+    Summary: Releases all the allocations at once.
+
+    Remarks:
+        If several blocks were needed since the last Reset(),
+    they are replaced by a single block large enough for the
+    high water mark.
+    ************************************************/
+    void Reset()
+    {
+        if (m_First && m_First->m_Next)
+        {
+            FreeBlocks();
+            AddBlock(XMax(m_BlockSize, m_HighWater));
+        }
+        m_Current = m_First;
+        m_Offset = 0;
+        m_Used = 0;
+    }
+
+    // Returns the current position, to be given to Rewind.
+    Marker GetMarker() const
+    {
+        Marker m;
+        m.m_Block = m_Current;
+        m.m_Offset = m_Offset;
+        m.m_Used = m_Used;
+        return m;
+    }
+
+    // Releases all the allocations made since the marker was taken.
+    void Rewind(const Marker &m)
+    {
+        m_Current = (Block *)m.m_Block;
+        m_Offset = m.m_Offset;
+        m_Used = m.m_Used;
+    }
+
+    // Returns the number of bytes allocated since the last Reset.
+    int GetUsedSize() const { return m_Used; }
+
+    // Returns the largest number of bytes used between two Reset.
+    int GetHighWaterMark() const { return m_HighWater; }
+
+    // Returns the number of bytes reserved by the blocks.
+    int GetReservedSize() const { return m_Reserved; }
+
+protected:
+    struct Block
+    {
+        Block *m_Next;
+        int m_Size;
+
+        XBYTE *Data() { return (XBYTE *)this + HeaderSize(); }
+    };
+
+    static int HeaderSize() { return (sizeof(Block) + 15) & ~15; }
+
+    static XBYTE *AlignPtr(XBYTE *ptr, int align)
+    {
+        return (XBYTE *)(((size_t)ptr + (align - 1)) & ~(size_t)(align - 1));
+    }
+
+    void *Commit(XBYTE *ptr, int size)
+    {
+        int end = (int)(ptr + size - m_Current->Data());
+        m_Used += end - m_Offset;
+        m_Offset = end;
+        if (m_Used > m_HighWater)
+            m_HighWater = m_Used;
+        return ptr;
+    }
+
+    // Allocates a block and links it after the current one.
+    Block *AddBlock(int size)
+    {
+        Block *block = (Block *)VxNewAligned(HeaderSize() + size, 16);
+        block->m_Size = size;
+        if (m_Current)
+        {
+            block->m_Next = m_Current->m_Next;
+            m_Current->m_Next = block;
+        }
+        else
+        {
+            block->m_Next = m_First;
+            m_First = block;
+        }
+        m_Reserved += size;
+        return block;
+    }
+
+    void FreeBlocks()
+    {
+        while (m_First)
+        {
+            Block *next = m_First->m_Next;
+            VxDeleteAligned(m_First);
+            m_First = next;
+        }
+        m_Current = NULL;
+        m_Offset = 0;
+        m_Reserved = 0;
+    }
+
+    Block *m_First;
+    Block *m_Current;
+    int m_Offset;
+    int m_BlockSize;
+    int m_Used;
+    int m_HighWater;
+    int m_Reserved;
+
+private:
+    VxLinearArena(const VxLinearArena &);
+    VxLinearArena &operator=(const VxLinearArena &);
+};
+
+/****************************************************************
+Summary: Rewinds a VxLinearArena when going out of scope.
+
+Remarks:
+    Every allocation made from the arena during the lifetime of
+    the scope object is released by its destructor.
+See Also: VxLinearArena
+****************************************************************/
+class VxArenaScope
+{
+public:
+    explicit VxArenaScope(VxLinearArena &arena)
+        : m_Arena(arena), m_Marker(arena.GetMarker()) {}
+
+    ~VxArenaScope()
+    {
+        m_Arena.Rewind(m_Marker);
+    }
+
+protected:
+    VxLinearArena &m_Arena;
+    VxLinearArena::Marker m_Marker;
+
+private:
+    VxArenaScope(const VxArenaScope &);
+    VxArenaScope &operator=(const VxArenaScope &);
+};
+
+#endif // VXLINEARARENA_H
@@ -0,0 +1,235 @@
+#ifndef VXMPSCQUEUE_H
+#define VXMPSCQUEUE_H
+
+#include "VxAtomic.h"
+#include "XArray.h"
+
+/*************************************************
+{filename:VxMPSCQueue}
+Summary: Lock-free bounded queue between any number of producer threads and one consumer thread.
+
+Remarks:
+    o The queue is a ring of a power of two number of cells allocated once
+    (SetCapacity). Each cell has a sequence number telling whether it is
+    free for the push of a given turn or holds the element of that turn,
+    so a producer reserves a cell with one compare and exchange of the
+    write index and publishes it with a release store of its sequence.
+    o The consumer takes the elements in the order the cells were reserved:
+    an element reserved but not yet published stops Pop until the
+    producer is done with it.
+    o When the queue is full Push fails and the element is counted as
+    dropped (GetDroppedCount), the producers never wait for the consumer.
+    o T must be a POD type.
+
+    VxMPSCQueue<NetResult> results(1024);
+    // any network thread
+    results.Push(r);
+    // main thread
+    while (results.Pop(r))
+        ...
+
+See also: VxSPSCQueue,VxMPSCIntrusiveQueue,CKQueueDrainManager
+*************************************************/
+template <class T>
+class VxMPSCQueue
+{
+public:
+    VxMPSCQueue(int capacity = 256) : m_Write(0), m_Read(0), m_Dropped(0) { SetCapacity(capacity); }
+
+    // Rounded up to a power of two, must not be called while the threads use the queue.
+    void SetCapacity(int capacity)
+    {
+        int size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_Cells.Resize(size);
+        for (int i = 0; i < size; ++i)
+            m_Cells[i].m_Sequence = i;
+        m_Mask = size - 1;
+        m_Write = 0;
+        m_Read = 0;
+        m_Dropped = 0;
+    }
+    int GetCapacity() const { return m_Mask + 1; }
+
+    //---------------------------------------------
+    // Any thread
+
+    XBOOL Push(const T &value)
+    {
+        long write = VxAtomicLoad(&m_Write);
+        Cell *cell;
+        for (;;)
+        {
+            cell = &m_Cells[write & m_Mask];
+            const long diff = (long)((unsigned long)VxAtomicLoad(&cell->m_Sequence) - (unsigned long)write);
+            if (diff == 0)
+            {
+                // the cell is free for this turn, reserve it
+                const long seen = VxAtomicCompareExchange(&m_Write, (long)((unsigned long)write + 1), write);
+                if (seen == write)
+                    break;
+                write = seen;
+            }
+            else if (diff < 0)
+            {
+                // still holds the element of the previous turn
+                VxAtomicIncrement(&m_Dropped);
+                return FALSE;
+            }
+            else
+            {
+                write = VxAtomicLoad(&m_Write);
+            }
+        }
+        cell->m_Value = value;
+        VxAtomicStore(&cell->m_Sequence, (long)((unsigned long)write + 1));
+        return TRUE;
+    }
+
+    // Elements lost because the queue was full, since the last call.
+    int GetDroppedCount() { return (int)VxAtomicExchange(&m_Dropped, 0); }
+
+    // Approximate while the producers are pushing.
+    int GetCount() const { return (int)((unsigned long)VxAtomicLoad(&m_Write) - (unsigned long)VxAtomicLoad(&m_Read)); }
+    XBOOL IsEmpty() const { return GetCount() <= 0; }
+
+    //---------------------------------------------
+    // Consumer thread
+
+    XBOOL Pop(T &value)
+    {
+        const long read = m_Read;
+        Cell &cell = m_Cells[read & m_Mask];
+        if (VxAtomicLoad(&cell.m_Sequence) != (long)((unsigned long)read + 1))
+            return FALSE;
+        value = cell.m_Value;
+        // free the cell for the next turn
+        VxAtomicStore(&cell.m_Sequence, (long)((unsigned long)read + m_Mask + 1));
+        VxAtomicStore(&m_Read, (long)((unsigned long)read + 1));
+        return TRUE;
+    }
+
+protected:
+    struct Cell
+    {
+        volatile long m_Sequence;
+        T m_Value;
+    };
+
+    // indices only grow, wrapping around with the long range
+    volatile long m_Write;
+    char m_Padding[60]; // keeps the producers and the consumer on different cache lines
+    volatile long m_Read;
+    volatile long m_Dropped;
+    long m_Mask;
+    XArray<Cell> m_Cells;
+
+private:
+    VxMPSCQueue(const VxMPSCQueue &);
+    VxMPSCQueue &operator=(const VxMPSCQueue &);
+};
+
+/*************************************************
+Summary: Link of an element of a VxMPSCIntrusiveQueue.
+
+See also: VxMPSCIntrusiveQueue
+*************************************************/
+struct VxMPSCNode
+{
+    VxMPSCNode *volatile m_Next;
+
+    VxMPSCNode() : m_Next(NULL) {}
+};
+
+/*************************************************
+Summary: Lock-free unbounded queue of nodes between any number of producer threads and one consumer thread.
+
+Remarks:
+    o The elements derive from VxMPSCNode and are linked through it, so
+    the queue never allocates: a push is one atomic exchange whatever the
+    number of producers.
+    o A node belongs to the queue from Push until Pop returns it, and can
+    only be in one queue at a time. The queue does not delete the nodes.
+    o As with VxMPSCQueue, a producer interrupted in the middle of a push
+    stops Pop (which returns NULL) until it resumes.
+
+    struct Packet : public VxMPSCNode { ... };
+    VxMPSCIntrusiveQueue<Packet> packets;
+    // any thread
+    packets.Push(new Packet(...));
+    // main thread
+    while (Packet *p = packets.Pop())
+        ...
+
+See also: VxMPSCNode,VxMPSCQueue
+*************************************************/
+template <class T>
+class VxMPSCIntrusiveQueue
+{
+public:
+    VxMPSCIntrusiveQueue() : m_Head(&m_Stub), m_Tail(&m_Stub) {}
+
+    //---------------------------------------------
+    // Any thread
+
+    void Push(T *element) { PushNode(static_cast<VxMPSCNode *>(element)); }
+
+    //---------------------------------------------
+    // Consumer thread
+
+    // The oldest element, NULL if the queue is empty.
+    T *Pop()
+    {
+        VxMPSCNode *tail = m_Tail;
+        VxMPSCNode *next = Next(tail);
+        if (tail == &m_Stub)
+        {
+            if (!next)
+                return NULL;
+            m_Tail = next;
+            tail = next;
+            next = Next(next);
+        }
+        if (next)
+        {
+            m_Tail = next;
+            return static_cast<T *>(tail);
+        }
+        if (tail != VxAtomicLoadPointer((void *const volatile *)&m_Head))
+            return NULL; // a producer is linking a node
+        // tail is the last node: put the stub behind it to be able to take it
+        PushNode(&m_Stub);
+        next = Next(tail);
+        if (next)
+        {
+            m_Tail = next;
+            return static_cast<T *>(tail);
+        }
+        return NULL;
+    }
+
+    XBOOL IsEmpty() const { return m_Tail == &m_Stub && !m_Stub.m_Next; }
+
+protected:
+    static VxMPSCNode *Next(VxMPSCNode *node) { return (VxMPSCNode *)VxAtomicLoadPointer((void *const volatile *)&node->m_Next); }
+
+    void PushNode(VxMPSCNode *node)
+    {
+        node->m_Next = NULL;
+        VxMPSCNode *prev = (VxMPSCNode *)VxAtomicExchangePointer((void *volatile *)&m_Head, node);
+        // between the exchange and this store the consumer cannot reach the node yet
+        VxAtomicExchangePointer((void *volatile *)&prev->m_Next, node);
+    }
+
+    VxMPSCNode *volatile m_Head; // last pushed node (producers)
+    char m_Padding[60];          // keeps the producers and the consumer on different cache lines
+    VxMPSCNode *m_Tail;          // next node to pop (consumer)
+    VxMPSCNode m_Stub;
+
+private:
+    VxMPSCIntrusiveQueue(const VxMPSCIntrusiveQueue &);
+    VxMPSCIntrusiveQueue &operator=(const VxMPSCIntrusiveQueue &);
+};
+
+#endif // VXMPSCQUEUE_H
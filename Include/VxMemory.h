@@ -5,6 +5,10 @@
 
 #include "VxMathDefines.h"
 
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+#include <xmmintrin.h>
+#endif
+
 //------ Memory Management
 
 VX_EXPORT void *mynew(unsigned int n);
@@ -17,6 +21,25 @@ VX_EXPORT void mydeletearray(void *a);
 VX_EXPORT void *VxNewAligned(int size, int align);
 VX_EXPORT void VxDeleteAligned(void *ptr);
 
+#ifdef VX_MEMORY_TRACKING
+// Allocations are accounted by VxMemoryTracker
+inline void *VxTrackedMalloc(unsigned int n);
+inline void VxTrackedFree(void *a);
+inline void *VxTrackedNewAligned(int size, int align);
+inline void VxTrackedDeleteAligned(void *ptr);
+
+#ifndef VxMalloc
+#define VxMalloc(n) VxTrackedMalloc(n)
+#endif
+
+#ifndef VxFree
+#define VxFree(a) VxTrackedFree(a)
+#endif
+
+#define VxNewAligned(size, align) VxTrackedNewAligned(size, align)
+#define VxDeleteAligned(ptr) VxTrackedDeleteAligned(ptr)
+#endif
+
 #ifndef VxMalloc
 #define VxMalloc(n) mynew(n)
 #endif
@@ -64,4 +87,26 @@ void VxDeallocate(T *ptr, unsigned int cnt)
     }
 }
 
+/*************************************************
+Summary: Hints the processor to bring the cache line holding ptr into the cache.
+
+Remarks:
+    This is only a hint: ptr does not have to be a valid address
+and nothing is done on compilers without a prefetch intrinsic.
+*************************************************/
+inline void VxPrefetch(const void *ptr)
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    _mm_prefetch((const char *)ptr, _MM_HINT_T0);
+#elif defined(__GNUC__)
+    __builtin_prefetch(ptr);
+#else
+    (void)ptr;
+#endif
+}
+
+#ifdef VX_MEMORY_TRACKING
+#include "VxMemoryTracker.h"
+#endif
+
 #endif // VXMEMORY_H
\ No newline at end of file
@@ -0,0 +1,403 @@
+#ifndef VXMEMORYTRACKER_H
+#define VXMEMORYTRACKER_H
+
+#include <windows.h>
+
+#include "VxMemory.h"
+#include "VxAtomic.h"
+
+/*************************************************
+Summary: Subsystems the tracked allocations are grouped by.
+
+Remarks:
+    o The tag of an allocation is the current tag of the thread doing it
+    (see VxMemoryTag). Values from VX_MEMORY_USER to VX_MEMORY_TAGCOUNT-1
+    are free for the application, named with VxMemoryTracker::SetTagName.
+
+See also: VxMemoryTracker,VxMemoryTag
+*************************************************/
+typedef enum VX_MEMORY_TAG
+{
+    VX_MEMORY_GENERAL = 0,
+    VX_MEMORY_RENDER = 1,
+    VX_MEMORY_BEHAVIORS = 2,
+    VX_MEMORY_FILE = 3,
+    VX_MEMORY_SOUND = 4,
+    VX_MEMORY_ANIMATION = 5,
+    VX_MEMORY_PHYSICS = 6,
+    VX_MEMORY_INTERFACE = 7,
+    VX_MEMORY_USER = 8,
+    VX_MEMORY_TAGCOUNT = 16
+} VX_MEMORY_TAG;
+
+// Allocations of one tag.
+struct VxMemoryTagStats
+{
+    long m_Bytes;       // Live bytes
+    long m_Count;       // Live allocations
+    long m_PeakBytes;   // Largest m_Bytes reached
+    long m_Allocations; // Total number of allocations
+};
+
+/*************************************************
+Summary: Tracked allocations of all the tags at a given time.
+
+Remarks:
+    Diff gives the growth between two snapshots: a tag whose live bytes keep
+growing between snapshots taken at the same point of a loop is leaking.
+
+See also: VxMemoryTracker::TakeSnapshot
+*************************************************/
+struct VxMemorySnapshot
+{
+    VxMemoryTagStats m_Tags[VX_MEMORY_TAGCOUNT];
+
+    // this - before, m_PeakBytes being the peak of this snapshot.
+    void Diff(const VxMemorySnapshot &before, VxMemorySnapshot &diff) const
+    {
+        for (int i = 0; i < VX_MEMORY_TAGCOUNT; ++i)
+        {
+            diff.m_Tags[i].m_Bytes = m_Tags[i].m_Bytes - before.m_Tags[i].m_Bytes;
+            diff.m_Tags[i].m_Count = m_Tags[i].m_Count - before.m_Tags[i].m_Count;
+            diff.m_Tags[i].m_PeakBytes = m_Tags[i].m_PeakBytes;
+            diff.m_Tags[i].m_Allocations = m_Tags[i].m_Allocations - before.m_Tags[i].m_Allocations;
+        }
+    }
+
+    long GetTotalBytes() const
+    {
+        long total = 0;
+        for (int i = 0; i < VX_MEMORY_TAGCOUNT; ++i)
+            total += m_Tags[i].m_Bytes;
+        return total;
+    }
+};
+
+/*************************************************
+{filename:VxMemoryTracker}
+Summary: Accounting of the allocations done through VxMalloc, by subsystem.
+
+Remarks:
+    o Defining VX_MEMORY_TRACKING for a module (before any include of the SDK
+    headers) routes VxMalloc/VxFree, and so VxNew, VxAllocate and the X
+    containers, and VxNewAligned/VxDeleteAligned through the tracker. The
+    memory still comes from the VxMath allocator.
+    o The size and tag of each live block are held in a table beside the
+    blocks, split in independently locked shards, so the blocks and the
+    layout of the containers are unchanged: a block allocated by VxMath or
+    by an untracked module can be freed by a tracked one (it is ignored,
+    see GetUnknownFreeCount), containers can be exchanged with the DLLs.
+    A tracked block freed by an untracked module stays counted as live.
+    o The counters are per module: only the allocations done by the code of
+    the modules compiled with VX_MEMORY_TRACKING are seen.
+
+    {
+        VxMemoryTag tag(VX_MEMORY_SOUND);
+        buffer = VxNew(MyBuffer);
+    }
+    ...
+    VxMemorySnapshot before, after, diff;
+    VxMemoryTracker::TakeSnapshot(before);
+    ...
+    VxMemoryTracker::TakeSnapshot(after);
+    after.Diff(before, diff);
+
+See also: VxMemoryTag,VxMemorySnapshot,CKMemoryReport
+*************************************************/
+class VxMemoryTracker
+{
+public:
+    static void *Allocate(unsigned int size, int align = 0)
+    {
+        void *ptr = align ? (VxNewAligned)((int)size, align) : mynew(size);
+        if (ptr)
+            Insert(ptr, size, GetCurrentTag());
+        return ptr;
+    }
+
+    static void Free(void *ptr, XBOOL aligned = FALSE)
+    {
+        if (!ptr)
+            return;
+        Remove(ptr);
+        if (aligned)
+            (VxDeleteAligned)(ptr);
+        else
+            mydelete(ptr);
+    }
+
+    // Tag given to the allocations of the calling thread.
+    static int GetCurrentTag()
+    {
+        const DWORD slot = GetTlsSlot();
+        return slot == TLS_OUT_OF_INDEXES ? VX_MEMORY_GENERAL : (int)(INT_PTR)TlsGetValue(slot);
+    }
+
+    // Returns the previous tag.
+    static int SetCurrentTag(int tag)
+    {
+        const int previous = GetCurrentTag();
+        const DWORD slot = GetTlsSlot();
+        if (slot != TLS_OUT_OF_INDEXES && tag >= 0 && tag < VX_MEMORY_TAGCOUNT)
+            TlsSetValue(slot, (void *)(INT_PTR)tag);
+        return previous;
+    }
+
+    static void SetTagName(int tag, const char *name)
+    {
+        if (tag >= 0 && tag < VX_MEMORY_TAGCOUNT)
+            GetState().m_Names[tag] = name;
+    }
+
+    static const char *GetTagName(int tag)
+    {
+        static const char *names[VX_MEMORY_USER] = {"General", "Render", "Behaviors", "File", "Sound", "Animation", "Physics", "Interface"};
+        if (tag < 0 || tag >= VX_MEMORY_TAGCOUNT)
+            return "";
+        if (GetState().m_Names[tag])
+            return GetState().m_Names[tag];
+        return tag < VX_MEMORY_USER ? names[tag] : "User";
+    }
+
+    static void GetStats(int tag, VxMemoryTagStats &stats)
+    {
+        State &s = GetState();
+        stats.m_Bytes = VxAtomicLoad(&s.m_Tags[tag].m_Bytes);
+        stats.m_Count = VxAtomicLoad(&s.m_Tags[tag].m_Count);
+        stats.m_PeakBytes = VxAtomicLoad(&s.m_Tags[tag].m_PeakBytes);
+        stats.m_Allocations = VxAtomicLoad(&s.m_Tags[tag].m_Allocations);
+    }
+
+    static void TakeSnapshot(VxMemorySnapshot &snapshot)
+    {
+        for (int i = 0; i < VX_MEMORY_TAGCOUNT; ++i)
+            GetStats(i, snapshot.m_Tags[i]);
+    }
+
+    // Frees of blocks the tracker did not allocate (allocated by VxMath or another module).
+    static long GetUnknownFreeCount() { return VxAtomicLoad(&GetState().m_UnknownFrees); }
+
+protected:
+    enum
+    {
+        ShardCount = 16,
+        MinCapacity = 256
+    };
+
+    struct Entry
+    {
+        void *m_Ptr; // NULL free, Removed() erased
+        unsigned int m_Size;
+        int m_Tag;
+    };
+
+    struct Shard
+    {
+        volatile long m_Lock;
+        Entry *m_Entries;
+        int m_Capacity; // power of two
+        int m_Used;     // live and erased entries
+    };
+
+    struct TagCounters
+    {
+        volatile long m_Bytes;
+        volatile long m_Count;
+        volatile long m_PeakBytes;
+        volatile long m_Allocations;
+    };
+
+    // Only zero-initialized members: usable before the static constructors run.
+    struct State
+    {
+        Shard m_Shards[ShardCount];
+        TagCounters m_Tags[VX_MEMORY_TAGCOUNT];
+        const char *m_Names[VX_MEMORY_TAGCOUNT];
+        volatile long m_TlsSlot; // slot + 1, 0 not allocated yet
+        volatile long m_UnknownFrees;
+    };
+
+    static State &GetState()
+    {
+        static State state;
+        return state;
+    }
+
+    static void *Removed() { return (void *)1; }
+
+    static DWORD GetTlsSlot()
+    {
+        State &s = GetState();
+        long slot = VxAtomicLoad(&s.m_TlsSlot);
+        if (slot)
+            return (DWORD)(slot - 1);
+        const DWORD allocated = TlsAlloc();
+        if (allocated == TLS_OUT_OF_INDEXES)
+            return TLS_OUT_OF_INDEXES;
+        slot = VxAtomicCompareExchange(&s.m_TlsSlot, (long)allocated + 1, 0);
+        if (slot == 0)
+            return allocated;
+        TlsFree(allocated); // another thread was first
+        return (DWORD)(slot - 1);
+    }
+
+    static unsigned int Hash(void *ptr)
+    {
+        unsigned int h = (unsigned int)(INT_PTR)ptr >> 4;
+        h ^= h >> 15;
+        h *= 0x2c1b3c6d;
+        h ^= h >> 12;
+        return h;
+    }
+
+    static void Lock(Shard &shard)
+    {
+        while (VxAtomicCompareExchange(&shard.m_Lock, 1, 0) != 0)
+            VxSpinPause();
+    }
+
+    static void Unlock(Shard &shard) { VxAtomicStore(&shard.m_Lock, 0); }
+
+    // Doubles the table if needed, dropping the erased entries. The shard is locked.
+    static void Reserve(Shard &shard)
+    {
+        if ((shard.m_Used + 1) * 4 <= shard.m_Capacity * 3)
+            return;
+        int live = 0;
+        for (int i = 0; i < shard.m_Capacity; ++i)
+            if (shard.m_Entries[i].m_Ptr > Removed())
+                ++live;
+        int capacity = MinCapacity;
+        while (capacity * 3 <= (live + 1) * 8)
+            capacity <<= 1;
+        Entry *entries = (Entry *)mynew(capacity * sizeof(Entry));
+        memset(entries, 0, capacity * sizeof(Entry));
+        for (int j = 0; j < shard.m_Capacity; ++j)
+        {
+            const Entry &e = shard.m_Entries[j];
+            if (e.m_Ptr <= Removed())
+                continue;
+            unsigned int k = (Hash(e.m_Ptr) / ShardCount) & (capacity - 1);
+            while (entries[k].m_Ptr)
+                k = (k + 1) & (capacity - 1);
+            entries[k] = e;
+        }
+        if (shard.m_Entries)
+            mydelete(shard.m_Entries);
+        shard.m_Entries = entries;
+        shard.m_Capacity = capacity;
+        shard.m_Used = live;
+    }
+
+    static void Insert(void *ptr, unsigned int size, int tag)
+    {
+        State &s = GetState();
+        const unsigned int h = Hash(ptr);
+        Shard &shard = s.m_Shards[h % ShardCount];
+        Lock(shard);
+        Reserve(shard);
+        // a block freed by an untracked module may still be there with the same address
+        Entry *slot = NULL;
+        Entry stale;
+        stale.m_Ptr = NULL;
+        unsigned int k = (h / ShardCount) & (shard.m_Capacity - 1);
+        for (; shard.m_Entries[k].m_Ptr; k = (k + 1) & (shard.m_Capacity - 1))
+        {
+            Entry &e = shard.m_Entries[k];
+            if (e.m_Ptr == ptr)
+            {
+                stale = e;
+                slot = &e;
+                break;
+            }
+            if (!slot && e.m_Ptr == Removed())
+                slot = &e;
+        }
+        if (!slot)
+        {
+            slot = &shard.m_Entries[k];
+            ++shard.m_Used;
+        }
+        slot->m_Ptr = ptr;
+        slot->m_Size = size;
+        slot->m_Tag = tag;
+        Unlock(shard);
+
+        if (stale.m_Ptr)
+        {
+            VxAtomicExchangeAdd(&s.m_Tags[stale.m_Tag].m_Bytes, -(long)stale.m_Size);
+            VxAtomicDecrement(&s.m_Tags[stale.m_Tag].m_Count);
+        }
+        TagCounters &t = s.m_Tags[tag];
+        const long bytes = VxAtomicExchangeAdd(&t.m_Bytes, (long)size) + (long)size;
+        VxAtomicIncrement(&t.m_Count);
+        VxAtomicIncrement(&t.m_Allocations);
+        long peak = VxAtomicLoad(&t.m_PeakBytes);
+        while (bytes > peak)
+        {
+            const long previous = VxAtomicCompareExchange(&t.m_PeakBytes, bytes, peak);
+            if (previous == peak)
+                break;
+            peak = previous;
+        }
+    }
+
+    static void Remove(void *ptr)
+    {
+        State &s = GetState();
+        const unsigned int h = Hash(ptr);
+        Shard &shard = s.m_Shards[h % ShardCount];
+        unsigned int size = 0;
+        int tag = -1;
+        Lock(shard);
+        if (shard.m_Capacity)
+        {
+            unsigned int k = (h / ShardCount) & (shard.m_Capacity - 1);
+            while (shard.m_Entries[k].m_Ptr)
+            {
+                Entry &e = shard.m_Entries[k];
+                if (e.m_Ptr == ptr)
+                {
+                    size = e.m_Size;
+                    tag = e.m_Tag;
+                    e.m_Ptr = Removed();
+                    break;
+                }
+                k = (k + 1) & (shard.m_Capacity - 1);
+            }
+        }
+        Unlock(shard);
+
+        if (tag < 0)
+        {
+            VxAtomicIncrement(&s.m_UnknownFrees);
+            return;
+        }
+        VxAtomicExchangeAdd(&s.m_Tags[tag].m_Bytes, -(long)size);
+        VxAtomicDecrement(&s.m_Tags[tag].m_Count);
+    }
+};
+
+/*************************************************
+Summary: Sets the memory tag of the calling thread until the end of the scope.
+
+See also: VxMemoryTracker,VX_MEMORY_TAG
+*************************************************/
+class VxMemoryTag
+{
+public:
+    VxMemoryTag(int tag) : m_Previous(VxMemoryTracker::SetCurrentTag(tag)) {}
+    ~VxMemoryTag() { VxMemoryTracker::SetCurrentTag(m_Previous); }
+
+protected:
+    int m_Previous;
+};
+
+#ifdef VX_MEMORY_TRACKING
+inline void *VxTrackedMalloc(unsigned int n) { return VxMemoryTracker::Allocate(n); }
+inline void VxTrackedFree(void *a) { VxMemoryTracker::Free(a); }
+inline void *VxTrackedNewAligned(int size, int align) { return VxMemoryTracker::Allocate(size, align); }
+inline void VxTrackedDeleteAligned(void *ptr) { VxMemoryTracker::Free(ptr, TRUE); }
+#endif
+
+#endif // VXMEMORYTRACKER_H
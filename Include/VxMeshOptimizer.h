@@ -0,0 +1,439 @@
+#ifndef VXMESHOPTIMIZER_H
+#define VXMESHOPTIMIZER_H
+
+#include "VxVector.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Reordering of indexed triangle lists for faster rendering.
+
+Remarks:
+    o OptimizeVertexCache reorders the faces so that consecutive faces
+    share their vertices, which makes the post transform vertex cache of
+    the graphic card hit more often (Forsyth's linear speed algorithm).
+    The result does not depend much on the actual cache size of the card.
+    o OptimizeOverdraw then splits the face list in clusters at the points
+    where the vertex cache is flushed anyway, and sorts these clusters so
+    that the ones facing outward are drawn first and hide the others.
+    o OptimizeVertexFetch finally renumbers the vertices in the order the
+    faces use them, so that the vertex data is read sequentially.
+    o All the functions work in place on the face indices and give the
+    permutation they applied, so that the per face and per vertex data
+    (materials, normals, texture coordinates...) can be reordered the same
+    way.
+
+    VxMeshOptimizer::OptimizeVertexCache(indices, faceCount, vertexCount, faceRemap);
+    VxMeshOptimizer::OptimizeVertexFetch(indices, faceCount, vertexCount, vertexRemap);
+
+See Also : CKMeshOptimizer
+*********************************************************/
+class VxMeshOptimizer
+{
+public:
+    enum
+    {
+        DefaultCacheSize = 32,
+        MaxCacheSize = 64
+    };
+
+    /**********************************************************
+    Summary: Reorders faces for the post transform vertex cache.
+
+    Arguments:
+        indices: 3 vertex indices per face, reordered in place.
+        faceCount: Number of faces.
+        vertexCount: Number of vertices.
+        faceRemap: If not NULL, filled with faceCount indices: the old index
+        of each new face.
+        cacheSize: Size of the cache the scores are computed for.
+    *********************************************************/
+    static void OptimizeVertexCache(XWORD *indices, int faceCount, int vertexCount, int *faceRemap = NULL, int cacheSize = DefaultCacheSize)
+    {
+        if (faceCount <= 0 || vertexCount <= 0)
+            return;
+        cacheSize = XMax(4, XMin(cacheSize, (int)MaxCacheSize));
+        float scoreTable[MaxCacheSize + 3];
+        ComputeCacheScores(scoreTable, cacheSize);
+
+        // vertex to face adjacency, the live faces are kept first in each list
+        XArray<int> start(vertexCount + 1);
+        XArray<int> live(vertexCount);
+        start.Resize(vertexCount + 1);
+        live.Resize(vertexCount);
+        memset(start.Begin(), 0, (vertexCount + 1) * sizeof(int));
+        memset(live.Begin(), 0, vertexCount * sizeof(int));
+        int i;
+        for (i = 0; i < 3 * faceCount; ++i)
+            ++live[indices[i]];
+        for (i = 0; i < vertexCount; ++i)
+            start[i + 1] = start[i] + live[i];
+        XArray<int> adjacency(3 * faceCount);
+        adjacency.Resize(3 * faceCount);
+        memset(live.Begin(), 0, vertexCount * sizeof(int));
+        for (i = 0; i < 3 * faceCount; ++i)
+        {
+            int v = indices[i];
+            adjacency[start[v] + live[v]++] = i / 3;
+        }
+
+        XArray<int> cachePos(vertexCount);
+        XArray<float> vertexScore(vertexCount);
+        cachePos.Resize(vertexCount);
+        vertexScore.Resize(vertexCount);
+        for (i = 0; i < vertexCount; ++i)
+        {
+            cachePos[i] = -1;
+            vertexScore[i] = VertexScore(scoreTable, -1, live[i]);
+        }
+        XArray<XBYTE> emitted(faceCount);
+        emitted.Resize(faceCount);
+        memset(emitted.Begin(), 0, faceCount);
+
+        XArray<XWORD> result(3 * faceCount);
+        result.Resize(3 * faceCount);
+        XArray<int> order;
+        if (faceRemap)
+            order.Resize(faceCount);
+
+        int cache[MaxCacheSize + 3];
+        int newCache[MaxCacheSize + 3];
+        int cacheCount = 0;
+        int cursor = 0;
+        int best = -1;
+        for (int f = 0; f < faceCount; ++f)
+        {
+            if (best < 0)
+            {
+                // no candidate in the cache: take the next face in the input order
+                while (emitted[cursor])
+                    ++cursor;
+                best = cursor;
+            }
+            const XWORD *tri = indices + 3 * best;
+            emitted[best] = 1;
+            result[3 * f] = tri[0];
+            result[3 * f + 1] = tri[1];
+            result[3 * f + 2] = tri[2];
+            if (faceRemap)
+                order[f] = best;
+
+            // remove the face from the lists of its vertices
+            int k;
+            for (k = 0; k < 3; ++k)
+            {
+                int v = tri[k];
+                int *list = adjacency.Begin() + start[v];
+                for (int j = 0; j < live[v]; ++j)
+                {
+                    if (list[j] == best)
+                    {
+                        list[j] = list[--live[v]];
+                        list[live[v]] = best;
+                        break;
+                    }
+                }
+            }
+
+            // the vertices of the face move to the front of the cache
+            int newCount = 0;
+            for (k = 0; k < 3; ++k)
+                newCache[newCount++] = tri[k];
+            for (k = 0; k < cacheCount; ++k)
+            {
+                int v = cache[k];
+                if (v != tri[0] && v != tri[1] && v != tri[2])
+                    newCache[newCount++] = v;
+            }
+
+            best = -1;
+            float bestScore = -1.0f;
+            for (k = 0; k < newCount; ++k)
+            {
+                int v = newCache[k];
+                cachePos[v] = (k < cacheSize) ? k : -1;
+                vertexScore[v] = VertexScore(scoreTable, cachePos[v], live[v]);
+            }
+            for (k = 0; k < newCount; ++k)
+            {
+                int v = newCache[k];
+                const int *list = adjacency.Begin() + start[v];
+                for (int j = 0; j < live[v]; ++j)
+                {
+                    int t = list[j];
+                    const XWORD *o = indices + 3 * t;
+                    float s = vertexScore[o[0]] + vertexScore[o[1]] + vertexScore[o[2]];
+                    if (s > bestScore)
+                    {
+                        bestScore = s;
+                        best = t;
+                    }
+                }
+            }
+            cacheCount = XMin(newCount, cacheSize);
+            memcpy(cache, newCache, cacheCount * sizeof(int));
+        }
+
+        memcpy(indices, result.Begin(), 3 * faceCount * sizeof(XWORD));
+        if (faceRemap)
+            memcpy(faceRemap, order.Begin(), faceCount * sizeof(int));
+    }
+
+    /**********************************************************
+    Summary: Reorders clusters of faces to reduce the overdraw.
+
+    Arguments:
+        indices: 3 vertex indices per face, already optimized with
+        OptimizeVertexCache, reordered in place.
+        faceCount: Number of faces.
+        positions: Vertex positions.
+        vertexCount: Number of vertices.
+        faceRemap: If not NULL, filled with faceCount indices: the old index
+        of each new face.
+        threshold: How much the vertex cache efficiency may be degraded to
+        get smaller clusters (1.05 allows 5% more cache misses).
+        cacheSize: Size of the simulated vertex cache.
+    Remarks:
+        The faces of a cluster keep their order, the clusters facing away
+        from the center of the mesh are drawn first.
+    *********************************************************/
+    static void OptimizeOverdraw(XWORD *indices, int faceCount, const VxStridedData &positions, int vertexCount,
+                                 int *faceRemap = NULL, float threshold = 1.05f, int cacheSize = DefaultCacheSize)
+    {
+        if (faceCount <= 0 || vertexCount <= 0)
+            return;
+        XArray<int> clusters;
+        FindClusters(indices, faceCount, vertexCount, cacheSize, threshold, clusters);
+        const int clusterCount = clusters.Size();
+        clusters.PushBack(faceCount);
+
+        // mesh centroid weighted by the face areas
+        VxVector center(0.0f, 0.0f, 0.0f);
+        float area = 0.0f;
+        int f;
+        for (f = 0; f < faceCount; ++f)
+        {
+            VxVector c, n;
+            FaceData(indices + 3 * f, positions, c, n);
+            float a = Magnitude(n);
+            center += c * a;
+            area += a;
+        }
+        if (area > 0.0f)
+            center /= area;
+
+        XArray<ClusterKey> keys(clusterCount);
+        for (int c = 0; c < clusterCount; ++c)
+        {
+            VxVector cc(0.0f, 0.0f, 0.0f), cn(0.0f, 0.0f, 0.0f);
+            float ca = 0.0f;
+            for (f = clusters[c]; f < clusters[c + 1]; ++f)
+            {
+                VxVector fc, fn;
+                FaceData(indices + 3 * f, positions, fc, fn);
+                float a = Magnitude(fn);
+                cc += fc * a;
+                cn += fn;
+                ca += a;
+            }
+            if (ca > 0.0f)
+                cc /= ca;
+            float l = Magnitude(cn);
+            ClusterKey key;
+            key.m_Key = (l > 0.0f) ? DotProduct(cc - center, cn) / l : 0.0f;
+            key.m_Cluster = c;
+            keys.PushBack(key);
+        }
+        keys.Sort(CompareClusters);
+
+        XArray<XWORD> result(3 * faceCount);
+        result.Resize(3 * faceCount);
+        XWORD *dst = result.Begin();
+        int n = 0;
+        for (int k = 0; k < clusterCount; ++k)
+        {
+            int c = keys[k].m_Cluster;
+            for (f = clusters[c]; f < clusters[c + 1]; ++f, ++n, dst += 3)
+            {
+                dst[0] = indices[3 * f];
+                dst[1] = indices[3 * f + 1];
+                dst[2] = indices[3 * f + 2];
+                if (faceRemap)
+                    faceRemap[n] = f;
+            }
+        }
+        memcpy(indices, result.Begin(), 3 * faceCount * sizeof(XWORD));
+    }
+
+    /**********************************************************
+    Summary: Renumbers the vertices in the order the faces use them.
+
+    Arguments:
+        indices: 3 vertex indices per face, updated in place.
+        faceCount: Number of faces.
+        vertexCount: Number of vertices.
+        vertexRemap: Filled with vertexCount indices: the new index of each
+        old vertex.
+    Return Value:
+        Number of vertices used by the faces. The unused vertices are moved
+        after them in their original order.
+    *********************************************************/
+    static int OptimizeVertexFetch(XWORD *indices, int faceCount, int vertexCount, int *vertexRemap)
+    {
+        int i;
+        for (i = 0; i < vertexCount; ++i)
+            vertexRemap[i] = -1;
+        int next = 0;
+        for (i = 0; i < 3 * faceCount; ++i)
+        {
+            int &r = vertexRemap[indices[i]];
+            if (r < 0)
+                r = next++;
+            indices[i] = (XWORD)r;
+        }
+        const int used = next;
+        for (i = 0; i < vertexCount; ++i)
+        {
+            if (vertexRemap[i] < 0)
+                vertexRemap[i] = next++;
+        }
+        return used;
+    }
+
+    /**********************************************************
+    Summary: Computes the average number of cache misses per face.
+
+    Remarks:
+        Simulates a FIFO vertex cache. The result is between 0.5 (best case
+        for a regular grid) and 3 (no vertex shared by consecutive faces).
+    *********************************************************/
+    static float ComputeACMR(const XWORD *indices, int faceCount, int vertexCount, int cacheSize = 16)
+    {
+        if (faceCount <= 0 || vertexCount <= 0)
+            return 0.0f;
+        XArray<int> stamp(vertexCount);
+        stamp.Resize(vertexCount);
+        for (int i = 0; i < vertexCount; ++i)
+            stamp[i] = -cacheSize - 1;
+        int misses = 0;
+        for (int i = 0; i < 3 * faceCount; ++i)
+        {
+            // a vertex is in the FIFO if less than cacheSize misses happened since it was loaded
+            if (misses - stamp[indices[i]] > cacheSize)
+                stamp[indices[i]] = misses++;
+        }
+        return (float)misses / (float)faceCount;
+    }
+
+protected:
+    struct ClusterKey
+    {
+        float m_Key;
+        int m_Cluster;
+    };
+
+    // decreasing keys, the cluster index keeps the order stable
+    static int CompareClusters(const void *e1, const void *e2)
+    {
+        const ClusterKey *a = (const ClusterKey *)e1;
+        const ClusterKey *b = (const ClusterKey *)e2;
+        if (a->m_Key != b->m_Key)
+            return (a->m_Key > b->m_Key) ? -1 : 1;
+        return a->m_Cluster - b->m_Cluster;
+    }
+
+    // Forsyth's scores of the cache positions
+    static void ComputeCacheScores(float *table, int cacheSize)
+    {
+        for (int i = 0; i < cacheSize; ++i)
+        {
+            if (i < 3)
+                table[i] = 0.75f;
+            else
+                table[i] = powf(1.0f - (float)(i - 3) / (float)(cacheSize - 3), 1.5f);
+        }
+    }
+
+    static float VertexScore(const float *table, int pos, int liveFaces)
+    {
+        if (liveFaces <= 0)
+            return -1.0f;
+        float score = (pos >= 0) ? table[pos] : 0.0f;
+        // vertices with few remaining faces are preferred to avoid leaving lone faces behind
+        return score + 2.0f / sqrtf((float)liveFaces);
+    }
+
+    // Centroid and non normalized normal (twice the area) of a face.
+    static void FaceData(const XWORD *idx, const VxStridedData &positions, VxVector &center, VxVector &normal)
+    {
+        const VxVector &p0 = *(const VxVector *)(positions.CPtr + idx[0] * positions.Stride);
+        const VxVector &p1 = *(const VxVector *)(positions.CPtr + idx[1] * positions.Stride);
+        const VxVector &p2 = *(const VxVector *)(positions.CPtr + idx[2] * positions.Stride);
+        center = (p0 + p1 + p2) * (1.0f / 3.0f);
+        normal = CrossProduct(p1 - p0, p2 - p0);
+    }
+
+    // Cuts the face list where the cache gets flushed, then where the cluster
+    // already reaches the cache efficiency of the whole part.
+    static void FindClusters(const XWORD *indices, int faceCount, int vertexCount, int cacheSize, float threshold, XArray<int> &clusters)
+    {
+        XArray<int> stamp(vertexCount);
+        stamp.Resize(vertexCount);
+        int i;
+        for (i = 0; i < vertexCount; ++i)
+            stamp[i] = -cacheSize - 1;
+
+        // hard boundaries and the misses counted before each of them
+        XArray<int> hard, hardMisses;
+        int misses = 0;
+        for (int f = 0; f < faceCount; ++f)
+        {
+            const int before = misses;
+            for (int k = 0; k < 3; ++k)
+            {
+                int v = indices[3 * f + k];
+                if (misses - stamp[v] > cacheSize)
+                    stamp[v] = misses++;
+            }
+            if (f == 0 || misses - before == 3)
+            {
+                hard.PushBack(f);
+                hardMisses.PushBack(before);
+            }
+        }
+        hard.PushBack(faceCount);
+        hardMisses.PushBack(misses);
+
+        // the simulated cache is emptied at each cluster start by ignoring the
+        // vertices loaded before it
+        for (i = 0; i < vertexCount; ++i)
+            stamp[i] = -cacheSize - 1;
+        misses = 0;
+        for (int h = 0; h + 1 < hard.Size(); ++h)
+        {
+            const int first = hard[h], end = hard[h + 1];
+            const float limit = (float)(hardMisses[h + 1] - hardMisses[h]) / (float)(end - first) * threshold;
+            int begin = first;
+            int base = misses;
+            clusters.PushBack(begin);
+            for (int f = first; f < end; ++f)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    int v = indices[3 * f + k];
+                    if (stamp[v] < base || misses - stamp[v] > cacheSize)
+                        stamp[v] = misses++;
+                }
+                // a few faces are needed before the ratio means anything
+                const int count = f + 1 - begin;
+                if (count >= 8 && f + 1 < end && (float)(misses - base) <= limit * (float)count)
+                {
+                    begin = f + 1;
+                    base = misses;
+                    clusters.PushBack(begin);
+                }
+            }
+        }
+    }
+};
+
+#endif // VXMESHOPTIMIZER_H
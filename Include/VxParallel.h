@@ -0,0 +1,181 @@
+#ifndef VXPARALLEL_H
+#define VXPARALLEL_H
+
+#include "VxThread.h"
+#include "VxMutex.h"
+#include "VxAtomic.h"
+#include "XArray.h"
+
+/*************************************************
+Summary: Prototype of a function processing the items [begin,end[ of a
+VxParallelPool::For loop.
+
+See also: VxParallelPool::For
+*************************************************/
+typedef void VxRangeFunction(void *arg, int begin, int end);
+
+/*************************************************
+Summary: Pool of worker threads running parallel loops.
+
+Remarks:
+    o The workers are created once and sleep on a mutex between two
+    loops, so that a loop only costs a few atomic operations to start.
+    o For cuts the items in chunks of grain items which are taken by the
+    workers and the calling thread, it returns when all the items are
+    processed.
+    o The pool must be used from the thread which created it (this thread
+    owns the mutexes the workers wait on) and For calls cannot be nested.
+
+    VxParallelPool pool(3);
+    pool.For(faceCount, 1024, ComputeFaceNormals, &data);
+
+See also: VxThread,VxRangeFunction
+*************************************************/
+class VxParallelPool
+{
+public:
+    explicit VxParallelPool(int workerCount = 3)
+        : m_Generation(0), m_Passed(0), m_Finished(0), m_Next(0), m_Stop(0),
+          m_Func(NULL), m_Arg(NULL), m_Count(0), m_Grain(1)
+    {
+        // the workers are blocked until a loop opens a gate
+        m_Gates[0].EnterMutex();
+        m_Gates[1].EnterMutex();
+        for (int i = 0; i < workerCount; ++i)
+        {
+            Worker *w = new Worker(this);
+            if (!w->CreateThread())
+            {
+                delete w;
+                break;
+            }
+            m_Workers.PushBack(w);
+        }
+    }
+
+    ~VxParallelPool()
+    {
+        VxAtomicStore(&m_Stop, 1);
+        int gate = m_Generation & 1;
+        m_Gates[gate].LeaveMutex();
+        for (int i = 0; i < m_Workers.Size(); ++i)
+        {
+            m_Workers[i]->Wait();
+            delete m_Workers[i];
+        }
+        m_Gates[gate ^ 1].LeaveMutex();
+    }
+
+    int GetWorkerCount() const { return m_Workers.Size(); }
+
+    /*************************************************
+    Summary: Runs a function on a range of items in parallel.
+
+    Arguments:
+        count: Number of items.
+        grain: Number of items processed by each call of func.
+        func: Function processing a range of items.
+        arg: Argument given to func.
+    Remarks:
+        When there are no workers or less than 2 chunks, func is called
+        directly by the calling thread.
+    *************************************************/
+    void For(int count, int grain, VxRangeFunction *func, void *arg)
+    {
+        if (count <= 0)
+            return;
+        if (grain < 1)
+            grain = 1;
+        if (!m_Workers.Size() || count <= grain)
+        {
+            func(arg, 0, count);
+            return;
+        }
+
+        m_Func = func;
+        m_Arg = arg;
+        m_Count = count;
+        m_Grain = grain;
+        VxAtomicStore(&m_Next, 0);
+        VxAtomicStore(&m_Passed, 0);
+        VxAtomicStore(&m_Finished, 0);
+
+        // open the gate of this loop, the other one stays closed
+        const int gate = m_Generation & 1;
+        m_Gates[gate].LeaveMutex();
+        RunChunks();
+
+        // close the gate once every worker went through it
+        int n = m_Workers.Size();
+        while (VxAtomicLoad(&m_Passed) < n)
+            VxSpinPause();
+        m_Gates[gate].EnterMutex();
+        ++m_Generation;
+
+        // every worker must be out of RunChunks before the next loop resets m_Next
+        while (VxAtomicLoad(&m_Finished) < n)
+            VxSpinPause();
+    }
+
+protected:
+    class Worker : public VxThread
+    {
+    public:
+        explicit Worker(VxParallelPool *pool) : m_Pool(pool) {}
+
+    protected:
+        virtual unsigned int Run()
+        {
+            m_Pool->WorkerLoop();
+            return VXT_OK;
+        }
+
+        VxParallelPool *m_Pool;
+    };
+    friend class Worker;
+
+    void WorkerLoop()
+    {
+        for (int generation = 0;; ++generation)
+        {
+            VxMutex &gate = m_Gates[generation & 1];
+            gate.EnterMutex();
+            gate.LeaveMutex();
+            if (VxAtomicLoad(&m_Stop))
+                return;
+            VxAtomicIncrement(&m_Passed);
+            RunChunks();
+            VxAtomicIncrement(&m_Finished);
+        }
+    }
+
+    void RunChunks()
+    {
+        for (;;)
+        {
+            int begin = (int)VxAtomicExchangeAdd(&m_Next, m_Grain);
+            if (begin >= m_Count)
+                return;
+            int end = XMin(begin + m_Grain, m_Count);
+            m_Func(m_Arg, begin, end);
+        }
+    }
+
+    VxMutex m_Gates[2];
+    XArray<Worker *> m_Workers;
+    int m_Generation;
+    volatile long m_Passed;   // workers which went through the gate of the current loop
+    volatile long m_Finished; // workers which are done with the current loop
+    volatile long m_Next;     // next item to process
+    volatile long m_Stop;
+    VxRangeFunction *m_Func;
+    void *m_Arg;
+    int m_Count;
+    int m_Grain;
+
+private:
+    VxParallelPool(const VxParallelPool &);
+    VxParallelPool &operator=(const VxParallelPool &);
+};
+
+#endif // VXPARALLEL_H
@@ -0,0 +1,42 @@
+#ifndef VXPERFCOUNTERS_H
+#define VXPERFCOUNTERS_H
+
+#include "VxMathDefines.h"
+
+typedef unsigned __int64 VxPerfCounterValue;
+
+/*************************************************
+{filename:VxPerfCounterSource}
+Summary: Counters read around a profiled zone, next to the elapsed time.
+
+Remarks:
+    o Read returns the current values of all the counters: the profilers
+    (CKTimeProfiler::SetCounters) read them at the start and at the end of
+    each zone and report the differences.
+    o The processor event counters (cache misses, branch mispredictions,
+    instructions retired) cannot be read from user mode on Windows without
+    a driver: a source reading them (through the driver or library of the
+    processor vendor) can be implemented with this interface.
+    VxThreadPerfCounters gives the counters available to any process.
+
+See also: VxThreadPerfCounters,CKTimeProfiler
+*************************************************/
+class VxPerfCounterSource
+{
+public:
+    enum
+    {
+        MaxCounters = 4
+    };
+
+    virtual ~VxPerfCounterSource() {}
+
+    // At most MaxCounters.
+    virtual int GetCounterCount() = 0;
+    virtual const char *GetCounterName(int index) = 0;
+
+    // The values for the calling thread (or the process for the counters that are not per thread).
+    virtual void Read(VxPerfCounterValue *values) = 0;
+};
+
+#endif // VXPERFCOUNTERS_H
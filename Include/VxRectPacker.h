@@ -0,0 +1,198 @@
+#ifndef VXRECTPACKER_H
+#define VXRECTPACKER_H
+
+#include "VxMathDefines.h"
+#include "XArray.h"
+
+/*************************************************
+{filename:VxRectPacker}
+Summary: Skyline packer placing rectangles in a fixed size area.
+
+Remarks:
+    o The packer keeps the top edge of the placed rectangles (the skyline)
+    as a list of horizontal segments. A rectangle is placed on the segment
+    where its top is the lowest (bottom-left rule), the narrowest segment
+    on a tie, so the segments stay few and the area is filled row by row.
+    o Insert is O(segments) and the rectangles are never moved: this is
+    the packer of texture atlases whose images are added at run time.
+    Inserting the rectangles by decreasing height (see VxSortRectsByHeight)
+    gives the best occupancy when they are all known.
+    o The area under the skyline which is not covered by a rectangle is
+    lost until Reset: an atlas whose images change size is repacked from
+    time to time.
+
+    VxSkylinePacker packer(1024, 1024);
+    int x, y;
+    if (packer.Insert(width, height, x, y))
+        ...
+
+See also: CKTextureAtlas
+*************************************************/
+class VxSkylinePacker
+{
+public:
+    VxSkylinePacker(int width = 0, int height = 0) { Reset(width, height); }
+
+    // Removes all the rectangles, optionally changing the size of the area.
+    void Reset(int width, int height)
+    {
+        m_Width = width;
+        m_Height = height;
+        m_UsedArea = 0;
+        m_Nodes.Resize(0);
+        if (width > 0 && height > 0)
+        {
+            Node n = {0, 0, width};
+            m_Nodes.PushBack(n);
+        }
+    }
+    void Reset() { Reset(m_Width, m_Height); }
+
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+
+    // Sum of the areas of the inserted rectangles.
+    int GetUsedArea() const { return m_UsedArea; }
+
+    // Ratio of the area covered by the inserted rectangles.
+    float GetOccupancy() const { return (m_Width && m_Height) ? (float)m_UsedArea / ((float)m_Width * m_Height) : 0.0f; }
+
+    /************************************************
+    Summary: Places a rectangle.
+
+    Arguments:
+        width, height: Size of the rectangle.
+        x, y: Position of the top left corner of the rectangle if it was placed.
+    Return Value:
+        FALSE if there is no room left for the rectangle.
+    ************************************************/
+    XBOOL Insert(int width, int height, int &x, int &y)
+    {
+        if (width <= 0 || height <= 0 || width > m_Width || height > m_Height)
+            return FALSE;
+        int best = -1;
+        int bestY = m_Height;
+        int bestWidth = m_Width + 1;
+        for (int i = 0; i < m_Nodes.Size(); ++i)
+        {
+            int top;
+            if (!Fit(i, width, height, top))
+                continue;
+            if (top < bestY || (top == bestY && m_Nodes[i].m_Width < bestWidth))
+            {
+                best = i;
+                bestY = top;
+                bestWidth = m_Nodes[i].m_Width;
+            }
+        }
+        if (best < 0)
+            return FALSE;
+        x = m_Nodes[best].m_X;
+        y = bestY;
+        AddNode(best, x, y + height, width);
+        m_UsedArea += width * height;
+        return TRUE;
+    }
+
+protected:
+    struct Node
+    {
+        int m_X;
+        int m_Y; // top of the skyline over the segment
+        int m_Width;
+    };
+
+    // Lowest position of a rectangle starting on node i.
+    XBOOL Fit(int i, int width, int height, int &top) const
+    {
+        const int x = m_Nodes[i].m_X;
+        if (x + width > m_Width)
+            return FALSE;
+        int left = width;
+        top = 0;
+        for (; left > 0; ++i)
+        {
+            if (i >= m_Nodes.Size())
+                return FALSE;
+            if (m_Nodes[i].m_Y > top)
+                top = m_Nodes[i].m_Y;
+            if (top + height > m_Height)
+                return FALSE;
+            left -= m_Nodes[i].m_Width;
+        }
+        return TRUE;
+    }
+
+    void AddNode(int index, int x, int y, int width)
+    {
+        Node n = {x, y, width};
+        m_Nodes.Insert(index, n);
+
+        // the new segment hides the beginning of the following ones
+        const int end = x + width;
+        int i = index + 1;
+        while (i < m_Nodes.Size() && m_Nodes[i].m_X < end)
+        {
+            Node &next = m_Nodes[i];
+            const int nextEnd = next.m_X + next.m_Width;
+            if (nextEnd <= end)
+            {
+                m_Nodes.RemoveAt(i);
+                continue;
+            }
+            next.m_Width = nextEnd - end;
+            next.m_X = end;
+            break;
+        }
+
+        // merges the neighbours of the same height
+        for (i = 0; i < m_Nodes.Size() - 1;)
+        {
+            if (m_Nodes[i].m_Y == m_Nodes[i + 1].m_Y)
+            {
+                m_Nodes[i].m_Width += m_Nodes[i + 1].m_Width;
+                m_Nodes.RemoveAt(i + 1);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    int m_Width;
+    int m_Height;
+    int m_UsedArea;
+    XArray<Node> m_Nodes; // left to right
+};
+
+/*************************************************
+Summary: Sorts rectangle indices by decreasing height (then width).
+
+Arguments:
+    widths, heights: Sizes of the rectangles.
+    count: Number of rectangles.
+    order: Receives the indices of the rectangles in insertion order.
+See also: VxSkylinePacker
+*************************************************/
+inline void VxSortRectsByHeight(const int *widths, const int *heights, int count, XArray<int> &order)
+{
+    order.Resize(count);
+    int i;
+    for (i = 0; i < count; ++i)
+        order[i] = i;
+    // insertion sort, the atlases have a few hundreds images
+    for (i = 1; i < count; ++i)
+    {
+        const int v = order[i];
+        int j = i - 1;
+        while (j >= 0 && (heights[order[j]] < heights[v] || (heights[order[j]] == heights[v] && widths[order[j]] < widths[v])))
+        {
+            order[j + 1] = order[j];
+            --j;
+        }
+        order[j + 1] = v;
+    }
+}
+
+#endif // VXRECTPACKER_H
@@ -0,0 +1,87 @@
+#ifndef VXSIMD_H
+#define VXSIMD_H
+
+#include "VxMathDefines.h"
+
+/*************************************************
+{filename:VxSIMD}
+Summary: SSE support for the inline VxMath kernels.
+
+Remarks:
+    o VX_SIMD_SSE is 1 when the compiler can generate SSE
+    instructions. With Visual C++ 7 and higher on x86 the
+    intrinsics are always available, so the kernels check
+    VxHasSSE at run time before using them.
+    o VX_SIMD_SSE2 is 1 when the code is compiled for SSE2
+    (x64, /arch:SSE2 or -msse2).
+    o Define VX_NO_SIMD to compile the scalar versions only.
+
+See also: GetProcessorFeatures,VxBatchMath
+*************************************************/
+#if !defined(VX_NO_SIMD) && (defined(_M_X64) || (defined(_MSC_VER) && (_MSC_VER >= 1300) && defined(_M_IX86)) || defined(__SSE__))
+#define VX_SIMD_SSE 1
+#include <xmmintrin.h>
+#else
+#define VX_SIMD_SSE 0
+#endif
+
+#if VX_SIMD_SSE && (defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__))
+#define VX_SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define VX_SIMD_SSE2 0
+#endif
+
+VX_EXPORT XULONG GetProcessorFeatures();
+
+/*************************************************
+Summary: Returns whether the SSE code paths can be used.
+
+Remarks:
+    Returns TRUE at compile time when the code is built for
+SSE, otherwise checks PROC_SIMD in GetProcessorFeatures.
+*************************************************/
+inline XBOOL VxHasSSE()
+{
+#if !VX_SIMD_SSE
+    return FALSE;
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1)) || defined(__SSE__)
+    return TRUE;
+#else
+    return (GetProcessorFeatures() & PROC_SIMD) != 0;
+#endif
+}
+
+#if VX_SIMD_SSE
+
+// Loads 4 packed 3 floats vectors (12 floats) and transposes them to x,y,z.
+inline void VxSSELoadVector3x4(const float *src, __m128 &x, __m128 &y, __m128 &z)
+{
+    __m128 a = _mm_loadu_ps(src);     // x0 y0 z0 x1
+    __m128 b = _mm_loadu_ps(src + 4); // y1 z1 x2 y2
+    __m128 c = _mm_loadu_ps(src + 8); // z2 x3 y3 z3
+
+    __m128 t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2));
+    x = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 3, 0));
+    t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 2, 0, 3));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), t, _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+}
+
+// Transposes x,y,z back to 4 packed 3 floats vectors.
+inline void VxSSEStoreVector3x4(float *dst, __m128 x, __m128 y, __m128 z)
+{
+    __m128 a = _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)),
+                              _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 b = _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+                              _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 c = _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+                              _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    _mm_storeu_ps(dst, a);
+    _mm_storeu_ps(dst + 4, b);
+    _mm_storeu_ps(dst + 8, c);
+}
+
+#endif // VX_SIMD_SSE
+
+#endif // VXSIMD_H
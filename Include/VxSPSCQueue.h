@@ -0,0 +1,153 @@
+#ifndef VXSPSCQUEUE_H
+#define VXSPSCQUEUE_H
+
+#include "VxAtomic.h"
+#include "XArray.h"
+#include "XUtil.h"
+
+/*************************************************
+{filename:VxSPSCQueue}
+Summary: Lock-free queue between one producer thread and one consumer thread.
+
+Remarks:
+    o The queue is a ring of a power of two number of elements allocated
+    once (SetCapacity): pushing and popping never allocate nor lock.
+    o Push must only be called by one thread and Pop by one other thread
+    at a time. The producer publishes an element with a release store of
+    its write index, the consumer frees it with a release store of its
+    read index, so T can be any POD type.
+    o Write and Read move several elements at once (a byte stream for
+    example) with at most two copies.
+    o When the queue is full Push fails and the element is counted as
+    dropped (GetDroppedCount), the producer never waits for the consumer.
+
+    VxSPSCQueue<MyEvent> queue(256);
+    // producer thread
+    queue.Push(e);
+    // consumer thread
+    while (queue.Pop(e))
+        ...
+
+See also: VxAtomic,CKInputStream
+*************************************************/
+template <class T>
+class VxSPSCQueue
+{
+public:
+    VxSPSCQueue(int capacity = 256) : m_Write(0), m_Read(0), m_Dropped(0) { SetCapacity(capacity); }
+
+    // Rounded up to a power of two, must not be called while the threads use the queue.
+    void SetCapacity(int capacity)
+    {
+        int size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_Elements.Resize(size);
+        m_Mask = size - 1;
+        m_Write = 0;
+        m_Read = 0;
+        m_Dropped = 0;
+    }
+    int GetCapacity() const { return m_Mask + 1; }
+
+    //---------------------------------------------
+    // Producer thread
+
+    XBOOL Push(const T &value)
+    {
+        const long write = m_Write;
+        if ((unsigned long)write - (unsigned long)VxAtomicLoad(&m_Read) > (unsigned long)m_Mask)
+        {
+            VxAtomicIncrement(&m_Dropped);
+            return FALSE;
+        }
+        m_Elements[write & m_Mask] = value;
+        VxAtomicStore(&m_Write, (long)((unsigned long)write + 1));
+        return TRUE;
+    }
+
+    // Pushes as many of the values as there is room for, returns their number.
+    int Write(const T *values, int count)
+    {
+        const long write = m_Write;
+        const int room = GetCapacity() - (int)((unsigned long)write - (unsigned long)VxAtomicLoad(&m_Read));
+        if (count > room)
+            count = room;
+        if (count <= 0)
+            return 0;
+        const int start = write & m_Mask;
+        const int first = XMin(count, GetCapacity() - start);
+        memcpy(&m_Elements[start], values, first * sizeof(T));
+        if (count > first)
+            memcpy(&m_Elements[0], values + first, (count - first) * sizeof(T));
+        VxAtomicStore(&m_Write, (long)((unsigned long)write + count));
+        return count;
+    }
+
+    //---------------------------------------------
+    // Consumer thread
+
+    // Pops up to count values, returns their number.
+    int Read(T *values, int count)
+    {
+        const long read = m_Read;
+        const int available = (int)((unsigned long)VxAtomicLoad(&m_Write) - (unsigned long)read);
+        if (count > available)
+            count = available;
+        if (count <= 0)
+            return 0;
+        const int start = read & m_Mask;
+        const int first = XMin(count, GetCapacity() - start);
+        memcpy(values, &m_Elements[start], first * sizeof(T));
+        if (count > first)
+            memcpy(values + first, &m_Elements[0], (count - first) * sizeof(T));
+        VxAtomicStore(&m_Read, (long)((unsigned long)read + count));
+        return count;
+    }
+
+    XBOOL Pop(T &value)
+    {
+        const long read = m_Read;
+        if (read == VxAtomicLoad(&m_Write))
+            return FALSE;
+        value = m_Elements[read & m_Mask];
+        VxAtomicStore(&m_Read, (long)((unsigned long)read + 1));
+        return TRUE;
+    }
+
+    // Pops all the elements pushed so far.
+    void Flush() { VxAtomicStore(&m_Read, VxAtomicLoad(&m_Write)); }
+
+    // The next element without removing it, NULL if the queue is empty.
+    const T *Peek()
+    {
+        const long read = m_Read;
+        if (read == VxAtomicLoad(&m_Write))
+            return NULL;
+        return &m_Elements[read & m_Mask];
+    }
+
+    //---------------------------------------------
+    // Either thread
+
+    // Approximate while the other thread is pushing or popping.
+    int GetCount() const { return (int)((unsigned long)VxAtomicLoad(&m_Write) - (unsigned long)VxAtomicLoad(&m_Read)); }
+    XBOOL IsEmpty() const { return GetCount() == 0; }
+
+    // Elements lost because the queue was full, since the last call.
+    int GetDroppedCount() { return (int)VxAtomicExchange(&m_Dropped, 0); }
+
+protected:
+    // indices only grow, wrapping around with the long range
+    volatile long m_Write;
+    volatile long m_Read;
+    volatile long m_Dropped;
+    long m_Mask;
+    XArray<T> m_Elements;
+
+private:
+    VxSPSCQueue(const VxSPSCQueue &);
+    VxSPSCQueue &operator=(const VxSPSCQueue &);
+};
+
+#endif // VXSPSCQUEUE_H
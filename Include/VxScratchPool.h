@@ -0,0 +1,252 @@
+#ifndef VXSCRATCHPOOL_H
+#define VXSCRATCHPOOL_H
+
+#include <windows.h>
+
+#include "XArray.h"
+#include "VxMutex.h"
+
+/****************************************************************
+Summary: Thread safe pool of scratch buffers sorted by size classes.
+
+Remarks:
+    o Buffers are grouped in power of 2 size classes from 256 bytes up to
+    MaxSizeClass. A released buffer is kept in the free list of its class and
+    is handed again to the next request of the same class.
+    o Acquire and Release can be called from any thread (VxThread workers for
+    example) and buffers can be released in any order.
+    o Each thread first uses its own small cache of free buffers, found with
+    a TLS slot, and only locks the shared free lists when its cache is empty
+    (Acquire) or full (Release). A buffer released by another thread goes to
+    the cache of that thread. Threads call ReleaseThreadCache before they
+    end to give their cache back.
+    o Buffers are aligned on 16 bytes.
+    o Use VxScratchLease to get a buffer released automatically.
+    o Unlike CKMemoryPool, which shares the CKContext memory pools with the
+    main thread, this pool does not depend on a CKContext.
+See Also: VxScratchLease,CKMemoryPool,VxMemoryPool
+****************************************************************/
+class VxScratchPool
+{
+public:
+    enum
+    {
+        MinSizeClass = 8,   // 256 bytes
+        MaxSizeClass = 24,  // 16 Mb
+        SizeClassCount = MaxSizeClass - MinSizeClass + 1
+    };
+
+    // maxCachedPerClass: number of free buffers kept by size class in the shared lists.
+    // threadCachedPerClass: number of free buffers kept by size class in each thread cache.
+    explicit VxScratchPool(int maxCachedPerClass = 8, int threadCachedPerClass = 2)
+        : m_MaxCached(maxCachedPerClass), m_ThreadCached(threadCachedPerClass)
+    {
+        m_Tls = TlsAlloc();
+    }
+
+    ~VxScratchPool()
+    {
+        Flush();
+        for (int i = 0; i < m_Caches.Size(); ++i)
+            delete m_Caches[i];
+        if (m_Tls != TLS_OUT_OF_INDEXES)
+            TlsFree(m_Tls);
+    }
+
+    /************************************************
+    Summary: Returns a buffer of at least size bytes.
+
+    Remarks:
+        The buffer must be given back with Release with
+    the same size. Requests larger than the biggest size
+    class are allocated and freed directly.
+    ************************************************/
+    void *Acquire(int size)
+    {
+        int sc = SizeClass(size);
+        if (sc < SizeClassCount)
+        {
+            ThreadCache *cache = GetCache();
+            if (cache && cache->m_Free[sc].Size())
+                return cache->m_Free[sc].PopBack();
+            VxMutexLock lock(m_Mutex);
+            XArray<void *> &freelist = m_Free[sc];
+            if (freelist.Size())
+                return freelist.PopBack();
+        }
+        return VxNewAligned(ClassSize(sc, size), 16);
+    }
+
+    // Gives back a buffer returned by Acquire(size).
+    void Release(void *ptr, int size)
+    {
+        if (!ptr)
+            return;
+        int sc = SizeClass(size);
+        if (sc < SizeClassCount)
+        {
+            ThreadCache *cache = GetCache();
+            if (cache && cache->m_Free[sc].Size() < m_ThreadCached)
+            {
+                cache->m_Free[sc].PushBack(ptr);
+                return;
+            }
+            VxMutexLock lock(m_Mutex);
+            XArray<void *> &freelist = m_Free[sc];
+            if (freelist.Size() < m_MaxCached)
+            {
+                freelist.PushBack(ptr);
+                return;
+            }
+        }
+        VxDeleteAligned(ptr);
+    }
+
+    /************************************************
+    Summary: Frees all the cached buffers.
+
+    Remarks:
+        The buffers of the shared lists and of the caches of all the
+    threads are freed. No other thread must be using the pool during
+    this call (call it once the workers are stopped or idle).
+    ************************************************/
+    void Flush()
+    {
+        VxMutexLock lock(m_Mutex);
+        for (int i = 0; i < m_Caches.Size(); ++i)
+            FreeBuffers(m_Caches[i]->m_Free);
+        FreeBuffers(m_Free);
+    }
+
+    /************************************************
+    Summary: Removes the cache of the calling thread.
+
+    Remarks:
+        A thread which used the pool should call this before it ends
+    (at the end of VxThread::Run for example): its cached buffers go to
+    the shared lists, or are freed when these are full. Otherwise they
+    are only freed by Flush or by the destruction of the pool.
+    ************************************************/
+    void ReleaseThreadCache()
+    {
+        ThreadCache *cache = m_Tls != TLS_OUT_OF_INDEXES ? (ThreadCache *)TlsGetValue(m_Tls) : NULL;
+        if (!cache)
+            return;
+        TlsSetValue(m_Tls, NULL);
+        VxMutexLock lock(m_Mutex);
+        m_Caches.Remove(cache);
+        for (int i = 0; i < SizeClassCount; ++i)
+        {
+            for (void **it = cache->m_Free[i].Begin(); it != cache->m_Free[i].End(); ++it)
+            {
+                if (m_Free[i].Size() < m_MaxCached)
+                    m_Free[i].PushBack(*it);
+                else
+                    VxDeleteAligned(*it);
+            }
+        }
+        delete cache;
+    }
+
+    // Returns the index of the size class used for size bytes.
+    static int SizeClass(int size)
+    {
+        int sc = 0;
+        while (sc < SizeClassCount && (1 << (sc + MinSizeClass)) < size)
+            ++sc;
+        return sc;
+    }
+
+protected:
+    // Free buffers of one thread, only used by this thread.
+    struct ThreadCache
+    {
+        XArray<void *> m_Free[SizeClassCount];
+    };
+
+    static int ClassSize(int sc, int size)
+    {
+        return (sc < SizeClassCount) ? (1 << (sc + MinSizeClass)) : size;
+    }
+
+    static void FreeBuffers(XArray<void *> *lists)
+    {
+        for (int i = 0; i < SizeClassCount; ++i)
+        {
+            for (void **it = lists[i].Begin(); it != lists[i].End(); ++it)
+                VxDeleteAligned(*it);
+            lists[i].Clear();
+        }
+    }
+
+    // Cache of the calling thread, created on its first call.
+    ThreadCache *GetCache()
+    {
+        if (m_Tls == TLS_OUT_OF_INDEXES || m_ThreadCached <= 0)
+            return NULL;
+        ThreadCache *cache = (ThreadCache *)TlsGetValue(m_Tls);
+        if (cache)
+            return cache;
+        cache = new ThreadCache;
+        {
+            VxMutexLock lock(m_Mutex);
+            m_Caches.PushBack(cache);
+        }
+        TlsSetValue(m_Tls, cache);
+        return cache;
+    }
+
+    XArray<void *> m_Free[SizeClassCount];
+    VxMutex m_Mutex;
+    int m_MaxCached;
+    int m_ThreadCached;
+    DWORD m_Tls;
+    XArray<ThreadCache *> m_Caches; // all the thread caches, protected by m_Mutex
+
+private:
+    VxScratchPool(const VxScratchPool &);
+    VxScratchPool &operator=(const VxScratchPool &);
+};
+
+/****************************************************************
+Summary: Scratch buffer taken from a VxScratchPool for the lifetime of the object.
+
+Remarks:
+    The buffer is given back to the pool on destruction. Several leases
+    can be alive at the same time and destroyed in any order.
+
+    {
+        VxScratchLease lease(pool, count * sizeof(VxVector));
+        VxVector *tmp = (VxVector *)lease.Mem();
+        ...
+    }
+See Also: VxScratchPool
+****************************************************************/
+class VxScratchLease
+{
+public:
+    VxScratchLease(VxScratchPool &pool, int size)
+        : m_Pool(pool), m_Memory(pool.Acquire(size)), m_Size(size) {}
+
+    ~VxScratchLease()
+    {
+        m_Pool.Release(m_Memory, m_Size);
+    }
+
+    // Returns access to the memory buffer.
+    void *Mem() const { return m_Memory; }
+
+    // Returns the size requested for this lease.
+    int Size() const { return m_Size; }
+
+protected:
+    VxScratchPool &m_Pool;
+    void *m_Memory;
+    int m_Size;
+
+private:
+    VxScratchLease(const VxScratchLease &);
+    VxScratchLease &operator=(const VxScratchLease &);
+};
+
+#endif // VXSCRATCHPOOL_H
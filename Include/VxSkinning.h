@@ -0,0 +1,207 @@
+#ifndef VXSKINNING_H
+#define VXSKINNING_H
+
+#include "VxMatrix.h"
+#include "VxSIMD.h"
+#include "VxFastMath.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Compiled vertex weights of a skin.
+
+Remarks:
+    o Each vertex keeps its 4 most important bones, the weights are
+    normalized. The 4 bone indices and the 4 weights of a vertex are
+    contiguous, so that the skinning kernel reads them without following
+    the per vertex arrays of a CKSkinVertexData.
+    o Vertices with less than 4 bones use null weights on bone 0.
+    o Skin then computes the vertices of a range with the bone matrices of
+    the current frame.
+
+    VxSkinWeights weights;
+    weights.SetVertexCount(count);
+    for (i = 0; i < count; ++i)
+        weights.SetVertex(i, bones, w, n, initialPos[i], initialNormal[i]);
+    weights.Skin(boneMatrices, 0, count, VxStridedData(pos, 12), VxStridedData(nrm, 12));
+
+See Also : CKSkinDeformer
+*********************************************************/
+class VxSkinWeights
+{
+public:
+    enum
+    {
+        MaxInfluences = 4
+    };
+
+    VxSkinWeights() : m_MaxBone(0) {}
+
+    void SetVertexCount(int count)
+    {
+        m_Bones.Resize(count * MaxInfluences);
+        m_Weights.Resize(count * MaxInfluences);
+        m_Positions.Resize(count);
+        m_Normals.Resize(count);
+        m_MaxBone = 0;
+    }
+
+    int GetVertexCount() const { return m_Positions.Size(); }
+
+    // Highest bone index used by the vertices (the bone matrix array must be larger).
+    int GetMaxBone() const { return m_MaxBone; }
+
+    // Influences of a vertex, weights of unused influences are null.
+    const int *GetBones(int v) const { return m_Bones.Begin() + v * MaxInfluences; }
+    const float *GetWeights(int v) const { return m_Weights.Begin() + v * MaxInfluences; }
+
+    const VxVector &GetPosition(int v) const { return m_Positions[v]; }
+    const VxVector &GetNormal(int v) const { return m_Normals[v]; }
+
+    /************************************************
+    Summary: Sets the influences of a vertex.
+
+    Arguments:
+        v: Index of the vertex.
+        bones: Indices of the bones influencing the vertex.
+        weights: Weights of these bones.
+        count: Number of bones, only the 4 largest weights are kept.
+        pos: Position of the vertex in the initial pose.
+        normal: Normal of the vertex in the initial pose.
+    ************************************************/
+    void SetVertex(int v, const int *bones, const float *weights, int count, const VxVector &pos, const VxVector &normal)
+    {
+        int best[MaxInfluences];
+        float bestWeight[MaxInfluences];
+        int n = 0;
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            // insertion in the sorted list of the largest weights
+            float w = weights[i];
+            int k = XMin(n, (int)MaxInfluences - 1);
+            if (n == MaxInfluences && w <= bestWeight[k])
+                continue;
+            while (k > 0 && bestWeight[k - 1] < w)
+            {
+                best[k] = best[k - 1];
+                bestWeight[k] = bestWeight[k - 1];
+                --k;
+            }
+            best[k] = bones[i];
+            bestWeight[k] = w;
+            if (n < MaxInfluences)
+                ++n;
+        }
+        float sum = 0.0f;
+        for (i = 0; i < n; ++i)
+            sum += bestWeight[i];
+        const float scale = (sum > 0.0f) ? 1.0f / sum : 0.0f;
+        for (i = 0; i < MaxInfluences; ++i)
+        {
+            m_Bones[v * MaxInfluences + i] = (i < n) ? best[i] : 0;
+            m_Weights[v * MaxInfluences + i] = (i < n) ? bestWeight[i] * scale : 0.0f;
+            if (i < n)
+                m_MaxBone = XMax(m_MaxBone, best[i]);
+        }
+        m_Positions[v] = pos;
+        m_Normals[v] = normal;
+    }
+
+    /************************************************
+    Summary: Computes the skinned vertices of a range.
+
+    Arguments:
+        matrices: Matrix of each bone, from the initial pose to the
+        destination space.
+        begin: First vertex.
+        end: Vertex after the last one.
+        positions: Receives the positions of all the vertices (the range
+        is written at its index).
+        normals: If its pointer is not NULL, receives the normalized normals.
+    Remarks:
+        Ranges can be computed by different threads.
+    ************************************************/
+    void Skin(const VxMatrix *matrices, int begin, int end, const VxStridedData &positions, const VxStridedData &normals) const
+    {
+        const int *bones = m_Bones.Begin();
+        const float *weights = m_Weights.Begin();
+        int v = begin;
+#if VX_SIMD_SSE
+        if (VxHasSSE())
+        {
+            for (; v < end; ++v)
+            {
+                const int *b = bones + v * MaxInfluences;
+                const float *w = weights + v * MaxInfluences;
+                // blended matrix, one column per register
+                __m128 c0 = _mm_setzero_ps(), c1 = c0, c2 = c0, c3 = c0;
+                for (int k = 0; k < MaxInfluences; ++k)
+                {
+                    const float *m = (const float *)&matrices[b[k]][0][0];
+                    const __m128 wk = _mm_set1_ps(w[k]);
+                    c0 = _mm_add_ps(c0, _mm_mul_ps(wk, _mm_loadu_ps(m)));
+                    c1 = _mm_add_ps(c1, _mm_mul_ps(wk, _mm_loadu_ps(m + 4)));
+                    c2 = _mm_add_ps(c2, _mm_mul_ps(wk, _mm_loadu_ps(m + 8)));
+                    c3 = _mm_add_ps(c3, _mm_mul_ps(wk, _mm_loadu_ps(m + 12)));
+                }
+                const VxVector &p = m_Positions[v];
+                __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))),
+                                      _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3));
+                float *dst = (float *)(positions.CPtr + v * positions.Stride);
+                _mm_storel_pi((__m64 *)dst, r);
+                _mm_store_ss(dst + 2, _mm_movehl_ps(r, r));
+                if (normals.Ptr)
+                {
+                    const VxVector &n = m_Normals[v];
+                    r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)), _mm_mul_ps(c1, _mm_set1_ps(n.y))),
+                                   _mm_mul_ps(c2, _mm_set1_ps(n.z)));
+                    dst = (float *)(normals.CPtr + v * normals.Stride);
+                    _mm_storel_pi((__m64 *)dst, r);
+                    _mm_store_ss(dst + 2, _mm_movehl_ps(r, r));
+                }
+            }
+        }
+#endif
+        for (; v < end; ++v)
+        {
+            const int *b = bones + v * MaxInfluences;
+            const float *w = weights + v * MaxInfluences;
+            float c[4][3];
+            memset(c, 0, sizeof(c));
+            for (int k = 0; k < MaxInfluences; ++k)
+            {
+                const VxMatrix &m = matrices[b[k]];
+                for (int j = 0; j < 4; ++j)
+                {
+                    c[j][0] += w[k] * m[j][0];
+                    c[j][1] += w[k] * m[j][1];
+                    c[j][2] += w[k] * m[j][2];
+                }
+            }
+            const VxVector &p = m_Positions[v];
+            VxVector &dst = *(VxVector *)(positions.CPtr + v * positions.Stride);
+            dst.x = c[0][0] * p.x + c[1][0] * p.y + c[2][0] * p.z + c[3][0];
+            dst.y = c[0][1] * p.x + c[1][1] * p.y + c[2][1] * p.z + c[3][1];
+            dst.z = c[0][2] * p.x + c[1][2] * p.y + c[2][2] * p.z + c[3][2];
+            if (normals.Ptr)
+            {
+                const VxVector &n = m_Normals[v];
+                VxVector &dn = *(VxVector *)(normals.CPtr + v * normals.Stride);
+                dn.x = c[0][0] * n.x + c[1][0] * n.y + c[2][0] * n.z;
+                dn.y = c[0][1] * n.x + c[1][1] * n.y + c[2][1] * n.z;
+                dn.z = c[0][2] * n.x + c[1][2] * n.y + c[2][2] * n.z;
+            }
+        }
+        if (normals.Ptr && end > begin)
+            VxNormalizeMany(normals.CPtr + begin * normals.Stride, end - begin, normals.Stride);
+    }
+
+protected:
+    XArray<int> m_Bones;     // 4 bone indices per vertex
+    XArray<float> m_Weights; // 4 weights per vertex
+    XArray<VxVector> m_Positions;
+    XArray<VxVector> m_Normals;
+    int m_MaxBone;
+};
+
+#endif // VXSKINNING_H
@@ -0,0 +1,352 @@
+#ifndef VXSYNC_H
+#define VXSYNC_H
+
+#include <windows.h>
+
+#include "VxAtomic.h"
+#include "XUtil.h"
+
+/*************************************************
+{filename:VxSync}
+Summary: Spins, then yields the processor, then sleeps.
+
+Remarks:
+    Used by the waiting loops of VxSpinLock and VxReadWriteLock: Spin is
+    called each time an attempt failed and backs off a little more each
+    time.
+
+See also: VxSpinLock,VxReadWriteLock
+*************************************************/
+class VxSpinWait
+{
+public:
+    explicit VxSpinWait(int spinLimit = 64) : m_Count(0), m_SpinLimit(spinLimit) {}
+
+    // Number of calls to Spin.
+    int GetCount() const { return m_Count; }
+
+    void Spin()
+    {
+        if (m_Count < m_SpinLimit)
+        {
+            // exponential backoff, up to 16 pauses
+            for (int i = 1 << XMin(m_Count, 4); i > 0; --i)
+                VxSpinPause();
+        }
+        else if (m_Count < m_SpinLimit + 16)
+        {
+            SwitchToThread();
+        }
+        else
+        {
+            Sleep(m_Count < m_SpinLimit + 32 ? 0 : 1);
+        }
+        ++m_Count;
+    }
+
+protected:
+    int m_Count;
+    int m_SpinLimit;
+};
+
+/*************************************************
+Summary: Mutual exclusion lock which never enters the kernel to be taken or released.
+
+Remarks:
+    o An uncontended Lock/Unlock costs one compare and exchange and one
+    store, against a call to VxMath for VxMutex.
+    o A waiting thread spins before yielding: the number of spins adapts
+    to how long the lock was waited for the last times, so that locks held
+    for long quickly stop burning processor time.
+    o The lock is not recursive. It suits short critical sections; for
+    long ones (file access, allocation of big blocks) VxMutex is better.
+
+    VxSpinLock lock;
+    {
+        VxSpinLockScope scope(lock);
+        table.Insert(key, value);
+    }
+
+See also: VxSpinLockScope,VxReadWriteLock,VxMutex
+*************************************************/
+class VxSpinLock
+{
+public:
+    VxSpinLock() : m_Locked(0), m_Spins(8) {}
+
+    XBOOL TryLock()
+    {
+        return VxAtomicLoad(&m_Locked) == 0 && VxAtomicCompareExchange(&m_Locked, 1, 0) == 0;
+    }
+
+    void Lock()
+    {
+        if (TryLock())
+            return;
+        VxSpinWait wait(XMin(2 * m_Spins + 8, 256));
+        while (!TryLock())
+            wait.Spin();
+        // not atomic on purpose, this is only a hint
+        m_Spins += (wait.GetCount() - m_Spins) / 8;
+    }
+
+    void Unlock() { VxAtomicStore(&m_Locked, 0); }
+
+    XBOOL IsLocked() const { return VxAtomicLoad(&m_Locked) != 0; }
+
+protected:
+    volatile long m_Locked;
+    int m_Spins; // average number of spins of the last waits
+
+private:
+    VxSpinLock(const VxSpinLock &);
+    VxSpinLock &operator=(const VxSpinLock &);
+};
+
+/*************************************************
+Summary: Holds a VxSpinLock for the lifetime of the object.
+
+See also: VxSpinLock
+*************************************************/
+class VxSpinLockScope
+{
+    VxSpinLock &m_Lock;
+
+public:
+    VxSpinLockScope(VxSpinLock &lock) : m_Lock(lock) { m_Lock.Lock(); }
+    ~VxSpinLockScope() { m_Lock.Unlock(); }
+};
+
+/*************************************************
+Summary: Lock taken either by several readers or by one writer.
+
+Remarks:
+    o The state is a single 32 bits word, -1 when a writer owns the lock,
+    otherwise the number of readers: taking and releasing the lock costs
+    one atomic operation when it is not contended, like the Windows slim
+    reader-writer locks (which are not available before Vista).
+    o A waiting writer stops new readers from entering, so a continuous
+    stream of readers cannot starve it.
+    o The lock is neither recursive nor upgradable: a reader must release
+    it before asking for the exclusive access.
+
+    VxReadWriteLock lock;
+    {
+        VxReadLockScope scope(lock);
+        type = types.Find(guid);
+    }
+
+See also: VxReadLockScope,VxWriteLockScope,VxSpinLock
+*************************************************/
+class VxReadWriteLock
+{
+public:
+    VxReadWriteLock() : m_State(0), m_WaitingWriters(0) {}
+
+    XBOOL TryLockShared()
+    {
+        long state = VxAtomicLoad(&m_State);
+        return state >= 0 && VxAtomicLoad(&m_WaitingWriters) == 0 && VxAtomicCompareExchange(&m_State, state + 1, state) == state;
+    }
+
+    void LockShared()
+    {
+        VxSpinWait wait;
+        while (!TryLockShared())
+            wait.Spin();
+    }
+
+    void UnlockShared() { VxAtomicDecrement(&m_State); }
+
+    XBOOL TryLockExclusive()
+    {
+        return VxAtomicLoad(&m_State) == 0 && VxAtomicCompareExchange(&m_State, -1, 0) == 0;
+    }
+
+    void LockExclusive()
+    {
+        if (TryLockExclusive())
+            return;
+        VxAtomicIncrement(&m_WaitingWriters);
+        VxSpinWait wait;
+        while (!TryLockExclusive())
+            wait.Spin();
+        VxAtomicDecrement(&m_WaitingWriters);
+    }
+
+    void UnlockExclusive() { VxAtomicStore(&m_State, 0); }
+
+protected:
+    volatile long m_State;          // -1: writer, otherwise number of readers
+    volatile long m_WaitingWriters; // new readers wait while not 0
+
+private:
+    VxReadWriteLock(const VxReadWriteLock &);
+    VxReadWriteLock &operator=(const VxReadWriteLock &);
+};
+
+/*************************************************
+Summary: Holds a VxReadWriteLock in shared mode for the lifetime of the object.
+
+See also: VxReadWriteLock,VxWriteLockScope
+*************************************************/
+class VxReadLockScope
+{
+    VxReadWriteLock &m_Lock;
+
+public:
+    VxReadLockScope(VxReadWriteLock &lock) : m_Lock(lock) { m_Lock.LockShared(); }
+    ~VxReadLockScope() { m_Lock.UnlockShared(); }
+};
+
+/*************************************************
+Summary: Holds a VxReadWriteLock in exclusive mode for the lifetime of the object.
+
+See also: VxReadWriteLock,VxReadLockScope
+*************************************************/
+class VxWriteLockScope
+{
+    VxReadWriteLock &m_Lock;
+
+public:
+    VxWriteLockScope(VxReadWriteLock &lock) : m_Lock(lock) { m_Lock.LockExclusive(); }
+    ~VxWriteLockScope() { m_Lock.UnlockExclusive(); }
+};
+
+/*************************************************
+Summary: Windows event a thread can wait on until another one signals it.
+
+Remarks:
+    An auto-reset event wakes one waiting thread and resets itself, a
+    manual-reset event stays signaled (and wakes every waiting thread)
+    until Reset is called.
+
+See also: VxCondition
+*************************************************/
+class VxEvent
+{
+public:
+    explicit VxEvent(XBOOL manualReset = FALSE, XBOOL signaled = FALSE)
+    {
+        m_Event = CreateEventA(NULL, manualReset, signaled, NULL);
+    }
+
+    ~VxEvent() { CloseHandle(m_Event); }
+
+    void Set() { SetEvent(m_Event); }
+    void Reset() { ResetEvent(m_Event); }
+
+    // FALSE when the timeout (in milliseconds) expired before the event was signaled.
+    XBOOL Wait(XULONG timeout = INFINITE) { return WaitForSingleObject(m_Event, timeout) == WAIT_OBJECT_0; }
+
+    HANDLE GetHandle() const { return m_Event; }
+
+protected:
+    HANDLE m_Event;
+
+private:
+    VxEvent(const VxEvent &);
+    VxEvent &operator=(const VxEvent &);
+};
+
+/*************************************************
+Summary: Condition variable and futex-like wait on a sequence number.
+
+Remarks:
+    o Every notification increments a sequence number. WaitForChange
+    sleeps until the sequence is different from the one given, so a
+    notification made between reading the sequence and waiting is never
+    lost. The notifier only enters the kernel when threads are waiting.
+    o Wait releases a VxSpinLock while waiting, as a condition variable
+    does. The predicate must be checked again in a loop as the wait can
+    end without the condition being true.
+
+    VxSpinLock lock;
+    VxCondition ready;
+    ...
+    {
+        VxSpinLockScope scope(lock);
+        while (!queue.Size())
+            ready.Wait(lock);
+        item = queue.PopFront();
+    }
+    ...
+    {
+        VxSpinLockScope scope(lock);
+        queue.PushBack(item);
+    }
+    ready.NotifyOne();
+
+See also: VxSpinLock,VxEvent
+*************************************************/
+class VxCondition
+{
+public:
+    VxCondition() : m_Sequence(0), m_Waiters(0)
+    {
+        m_Semaphore = CreateSemaphoreA(NULL, 0, 0x7fffffff, NULL);
+    }
+
+    ~VxCondition() { CloseHandle(m_Semaphore); }
+
+    long GetSequence() const { return VxAtomicLoad(&m_Sequence); }
+
+    // Waits until the sequence is not seen anymore, FALSE when the timeout (in milliseconds) expired before.
+    XBOOL WaitForChange(long seen, XULONG timeout = INFINITE)
+    {
+        // announced before the check, the notifiers read m_Waiters after changing the sequence
+        VxAtomicIncrement(&m_Waiters);
+        const DWORD start = GetTickCount();
+        XBOOL changed = TRUE;
+        while (VxAtomicLoad(&m_Sequence) == seen)
+        {
+            DWORD remaining = INFINITE;
+            if (timeout != INFINITE)
+            {
+                const DWORD elapsed = GetTickCount() - start;
+                if (elapsed >= timeout)
+                {
+                    changed = FALSE;
+                    break;
+                }
+                remaining = timeout - elapsed;
+            }
+            // a token left by an earlier notification only makes the loop check again
+            WaitForSingleObject(m_Semaphore, remaining);
+        }
+        VxAtomicDecrement(&m_Waiters);
+        return changed;
+    }
+
+    // Releases lock while waiting for a notification and takes it again.
+    XBOOL Wait(VxSpinLock &lock, XULONG timeout = INFINITE)
+    {
+        const long seen = GetSequence();
+        lock.Unlock();
+        XBOOL notified = WaitForChange(seen, timeout);
+        lock.Lock();
+        return notified;
+    }
+
+    void NotifyOne() { Notify(1); }
+    void NotifyAll() { Notify(0x7fffffff); }
+
+protected:
+    void Notify(long count)
+    {
+        VxAtomicIncrement(&m_Sequence);
+        long waiters = VxAtomicLoad(&m_Waiters);
+        if (waiters > 0)
+            ReleaseSemaphore(m_Semaphore, XMin(count, waiters), NULL);
+    }
+
+    volatile long m_Sequence;
+    volatile long m_Waiters;
+    HANDLE m_Semaphore;
+
+private:
+    VxCondition(const VxCondition &);
+    VxCondition &operator=(const VxCondition &);
+};
+
+#endif // VXSYNC_H
@@ -0,0 +1,72 @@
+#ifndef VXTHREADPERFCOUNTERS_H
+#define VXTHREADPERFCOUNTERS_H
+
+#include <windows.h>
+#include <psapi.h>
+
+#include "VxPerfCounters.h"
+
+/*************************************************
+Summary: Processor cycles of the calling thread and page faults of the process.
+
+Remarks:
+    o "cycles" is QueryThreadCycleTime (Windows Vista and later, 0 before):
+    unlike the elapsed time it does not count the time the thread was
+    preempted or waiting, so a zone whose time grows while its cycles do
+    not is being descheduled rather than doing more work.
+    o "page faults" are the soft and hard page faults of the process
+    (GetProcessMemoryInfo): touching memory for the first time or after it
+    was trimmed shows up there.
+    o The functions are loaded from kernel32.dll and psapi.dll when the
+    source is created, nothing needs to be linked.
+
+See also: VxPerfCounterSource,CKTimeProfiler
+*************************************************/
+class VxThreadPerfCounters : public VxPerfCounterSource
+{
+public:
+    VxThreadPerfCounters()
+    {
+        m_QueryThreadCycleTime = (QueryThreadCycleTimeFct)GetProcAddress(GetModuleHandleA("kernel32.dll"), "QueryThreadCycleTime");
+        m_Psapi = LoadLibraryA("psapi.dll");
+        m_GetProcessMemoryInfo = m_Psapi ? (GetProcessMemoryInfoFct)GetProcAddress(m_Psapi, "GetProcessMemoryInfo") : NULL;
+    }
+
+    ~VxThreadPerfCounters()
+    {
+        if (m_Psapi)
+            FreeLibrary(m_Psapi);
+    }
+
+    virtual int GetCounterCount() { return 2; }
+    virtual const char *GetCounterName(int index) { return index == 0 ? "cycles" : "page faults"; }
+
+    virtual void Read(VxPerfCounterValue *values)
+    {
+        values[0] = 0;
+        values[1] = 0;
+        if (m_QueryThreadCycleTime)
+        {
+            ULONG64 cycles = 0;
+            m_QueryThreadCycleTime(GetCurrentThread(), &cycles);
+            values[0] = cycles;
+        }
+        if (m_GetProcessMemoryInfo)
+        {
+            PROCESS_MEMORY_COUNTERS counters;
+            counters.cb = sizeof(counters);
+            if (m_GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+                values[1] = counters.PageFaultCount;
+        }
+    }
+
+protected:
+    typedef BOOL(WINAPI *QueryThreadCycleTimeFct)(HANDLE, ULONG64 *);
+    typedef BOOL(WINAPI *GetProcessMemoryInfoFct)(HANDLE, PROCESS_MEMORY_COUNTERS *, DWORD);
+
+    QueryThreadCycleTimeFct m_QueryThreadCycleTime;
+    GetProcessMemoryInfoFct m_GetProcessMemoryInfo;
+    HMODULE m_Psapi;
+};
+
+#endif // VXTHREADPERFCOUNTERS_H
@@ -0,0 +1,253 @@
+#ifndef VXTRANSFORMHIERARCHY_H
+#define VXTRANSFORMHIERARCHY_H
+
+#include "VxBatchMath.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Hierarchy of transformations with lazily computed world matrices.
+
+Remarks:
+    o Each node has a parent (or -1), a local matrix and a world matrix:
+    World = ParentWorld * Local, as for the 3D entities.
+    o Setting a local or world matrix only marks the node and its
+    descendants dirty (the marking stops at the nodes which are already
+    dirty, so moving a node several times in a frame costs one
+    propagation). The world matrix of a dirty node is computed when it
+    is read, from its first clean ancestor, or by Update which computes
+    all the dirty nodes in one pass, parents first.
+    o The inverse of the world matrix is also kept and only computed
+    when read.
+
+    VxTransformHierarchy h;
+    int root = h.AddNode(-1, rootLocal);
+    int arm = h.AddNode(root, armLocal);
+    h.SetLocalMatrix(root, m);
+    const VxMatrix &w = h.GetWorldMatrix(arm);
+
+See Also: CKTransformCache,Vx3DMultiplyMatrixBatch
+*********************************************************/
+class VxTransformHierarchy
+{
+public:
+    VxTransformHierarchy() : m_OrderValid(TRUE) {}
+
+    int GetNodeCount() const { return m_Nodes.Size(); }
+
+    // Adds a node, parent is -1 for a root.
+    int AddNode(int parent, const VxMatrix &local)
+    {
+        const int i = m_Nodes.Size();
+        Node n;
+        n.m_Parent = -1;
+        n.m_FirstChild = n.m_NextSibling = -1;
+        n.m_Flags = DIRTY_WORLD | DIRTY_INVERSE;
+        m_Nodes.PushBack(n);
+        m_Local.PushBack(local);
+        m_World.PushBack(local);
+        m_InverseWorld.PushBack(local);
+        Link(i, parent);
+        m_Order.PushBack(i);
+        return i;
+    }
+
+    void Clear()
+    {
+        m_Nodes.Resize(0);
+        m_Local.Resize(0);
+        m_World.Resize(0);
+        m_InverseWorld.Resize(0);
+        m_Order.Resize(0);
+        m_OrderValid = TRUE;
+    }
+
+    int GetParent(int i) const { return m_Nodes[i].m_Parent; }
+    int GetFirstChild(int i) const { return m_Nodes[i].m_FirstChild; }
+    int GetNextSibling(int i) const { return m_Nodes[i].m_NextSibling; }
+
+    // Changes the parent of a node, its local matrix is kept (its world matrix changes).
+    void SetParent(int i, int parent)
+    {
+        if (m_Nodes[i].m_Parent == parent)
+            return;
+        Unlink(i);
+        Link(i, parent);
+        m_OrderValid = FALSE;
+        Invalidate(i);
+    }
+
+    const VxMatrix &GetLocalMatrix(int i) const { return m_Local[i]; }
+
+    void SetLocalMatrix(int i, const VxMatrix &local)
+    {
+        m_Local[i] = local;
+        Invalidate(i);
+    }
+
+    // Sets the world matrix of a node, the local matrix is computed from the parent.
+    void SetWorldMatrix(int i, const VxMatrix &world)
+    {
+        const int p = m_Nodes[i].m_Parent;
+        if (p < 0)
+            m_Local[i] = world;
+        else
+            Vx3DMultiplyMatrix(m_Local[i], GetInverseWorldMatrix(p), world);
+        Invalidate(i);
+        m_World[i] = world;
+        m_Nodes[i].m_Flags &= ~DIRTY_WORLD;
+    }
+
+    XBOOL IsDirty(int i) const { return (m_Nodes[i].m_Flags & DIRTY_WORLD) != 0; }
+
+    const VxMatrix &GetWorldMatrix(int i)
+    {
+        if (m_Nodes[i].m_Flags & DIRTY_WORLD)
+            Resolve(i);
+        return m_World[i];
+    }
+
+    const VxMatrix &GetInverseWorldMatrix(int i)
+    {
+        if (m_Nodes[i].m_Flags & (DIRTY_WORLD | DIRTY_INVERSE))
+        {
+            Vx3DInverseMatrixBatch(&m_InverseWorld[i], &GetWorldMatrix(i), 1);
+            m_Nodes[i].m_Flags &= ~DIRTY_INVERSE;
+        }
+        return m_InverseWorld[i];
+    }
+
+    // Computes the world matrices of all the dirty nodes, parents first.
+    void Update()
+    {
+        if (!m_OrderValid)
+            SortNodes();
+        const int *order = m_Order.Begin();
+        const int count = m_Order.Size();
+        for (int k = 0; k < count; ++k)
+        {
+            const int i = order[k];
+            Node &n = m_Nodes[i];
+            if (!(n.m_Flags & DIRTY_WORLD))
+                continue;
+            if (n.m_Parent < 0)
+                m_World[i] = m_Local[i];
+            else
+                Vx3DMultiplyMatrixBatch(&m_World[i], &m_World[n.m_Parent], &m_Local[i], 1);
+            n.m_Flags &= ~DIRTY_WORLD;
+        }
+    }
+
+    // Nodes sorted parents first.
+    const int *GetOrder()
+    {
+        if (!m_OrderValid)
+            SortNodes();
+        return m_Order.Begin();
+    }
+
+protected:
+    enum
+    {
+        DIRTY_WORLD = 1,
+        DIRTY_INVERSE = 2
+    };
+
+    struct Node
+    {
+        int m_Parent;
+        int m_FirstChild;
+        int m_NextSibling;
+        XDWORD m_Flags;
+    };
+
+    void Link(int i, int parent)
+    {
+        m_Nodes[i].m_Parent = parent;
+        if (parent >= 0)
+        {
+            m_Nodes[i].m_NextSibling = m_Nodes[parent].m_FirstChild;
+            m_Nodes[parent].m_FirstChild = i;
+            if (parent > i)
+                m_OrderValid = FALSE;
+        }
+    }
+
+    void Unlink(int i)
+    {
+        const int p = m_Nodes[i].m_Parent;
+        if (p >= 0)
+        {
+            int *link = &m_Nodes[p].m_FirstChild;
+            while (*link != i)
+                link = &m_Nodes[*link].m_NextSibling;
+            *link = m_Nodes[i].m_NextSibling;
+        }
+        m_Nodes[i].m_Parent = -1;
+        m_Nodes[i].m_NextSibling = -1;
+    }
+
+    // Marks a node and its descendants dirty (a dirty node has only dirty descendants).
+    void Invalidate(int i)
+    {
+        m_Nodes[i].m_Flags |= DIRTY_WORLD | DIRTY_INVERSE;
+        m_Stack.Resize(0);
+        for (int c = m_Nodes[i].m_FirstChild; c >= 0; c = m_Nodes[c].m_NextSibling)
+            m_Stack.PushBack(c);
+        while (m_Stack.Size())
+        {
+            const int n = m_Stack.PopBack();
+            if (m_Nodes[n].m_Flags & DIRTY_WORLD)
+                continue;
+            m_Nodes[n].m_Flags |= DIRTY_WORLD | DIRTY_INVERSE;
+            for (int c = m_Nodes[n].m_FirstChild; c >= 0; c = m_Nodes[c].m_NextSibling)
+                m_Stack.PushBack(c);
+        }
+    }
+
+    // Computes a dirty node from its first clean ancestor.
+    void Resolve(int i)
+    {
+        m_Stack.Resize(0);
+        for (int n = i; n >= 0 && (m_Nodes[n].m_Flags & DIRTY_WORLD); n = m_Nodes[n].m_Parent)
+            m_Stack.PushBack(n);
+        while (m_Stack.Size())
+        {
+            const int n = m_Stack.PopBack();
+            const int p = m_Nodes[n].m_Parent;
+            if (p < 0)
+                m_World[n] = m_Local[n];
+            else
+                Vx3DMultiplyMatrixBatch(&m_World[n], &m_World[p], &m_Local[n], 1);
+            m_Nodes[n].m_Flags &= ~DIRTY_WORLD;
+        }
+    }
+
+    // Breadth first order from the roots.
+    void SortNodes()
+    {
+        const int count = m_Nodes.Size();
+        m_Order.Resize(0);
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            if (m_Nodes[i].m_Parent < 0)
+                m_Order.PushBack(i);
+        }
+        for (int k = 0; k < m_Order.Size(); ++k)
+        {
+            for (int c = m_Nodes[m_Order[k]].m_FirstChild; c >= 0; c = m_Nodes[c].m_NextSibling)
+                m_Order.PushBack(c);
+        }
+        m_OrderValid = TRUE;
+    }
+
+    XArray<Node> m_Nodes;
+    XArray<VxMatrix> m_Local;
+    XArray<VxMatrix> m_World;
+    XArray<VxMatrix> m_InverseWorld;
+    XArray<int> m_Order;
+    XArray<int> m_Stack;
+    XBOOL m_OrderValid;
+};
+
+#endif // VXTRANSFORMHIERARCHY_H
@@ -0,0 +1,540 @@
+#ifndef VXTRIANGLEBVH_H
+#define VXTRIANGLEBVH_H
+
+#include "VxVector.h"
+#include "VxRay.h"
+#include "XArray.h"
+
+/**********************************************************
+Summary: Bounding volume hierarchy over the faces of a mesh.
+
+Remarks:
+    o The tree is built with a binned surface area heuristic and answers
+    ray and box queries in logarithmic time instead of testing every face.
+    o The tree keeps its own copy of the vertex positions. When the
+    vertices move without changing the topology (skinning, morphing),
+    Refit updates the boxes in linear time without rebuilding the tree;
+    the queries stay exact but can get slower if the mesh deforms a lot.
+    o Distances are expressed in units of the ray direction, as in
+    VxIntersectBatch.
+
+    VxTriangleBVH bvh;
+    bvh.Build(VxStridedData(positions, stride), vertexCount, indices, faceCount);
+    float dist;
+    int face = bvh.RayIntersection(ray, dist);
+
+See Also : VxIntersectBatch,VxIntersect,CKMeshBVHCache
+*********************************************************/
+class VxTriangleBVH
+{
+public:
+    enum
+    {
+        MaxLeafSize = 4,   // faces under which a node is always a leaf
+        MaxSAHLeafSize = 16, // faces under which a node can be a leaf when splitting does not pay
+        BinCount = 12,
+        MaxDepth = 64
+    };
+
+    // 32 bytes node, children are stored next to each other.
+    struct Node
+    {
+        float m_Min[3];
+        int m_Index; // first child for inner nodes, first face in m_Faces for leaves
+        float m_Max[3];
+        int m_Count; // number of faces of a leaf, 0 for inner nodes
+
+        XBOOL IsLeaf() const { return m_Count != 0; }
+    };
+
+    VxTriangleBVH() {}
+
+    void Clear()
+    {
+        m_Vertices.Clear();
+        m_Indices.Clear();
+        m_Faces.Clear();
+        m_Nodes.Clear();
+    }
+
+    XBOOL IsEmpty() const { return m_Nodes.Size() == 0; }
+    int GetFaceCount() const { return m_Indices.Size() / 3; }
+    int GetVertexCount() const { return m_Vertices.Size(); }
+    int GetNodeCount() const { return m_Nodes.Size(); }
+    const Node *GetNodes() const { return m_Nodes.Begin(); }
+
+    int GetMemoryOccupation() const
+    {
+        return sizeof(*this) + m_Vertices.GetMemoryOccupation() + m_Indices.GetMemoryOccupation() +
+               m_Faces.GetMemoryOccupation() + m_Nodes.GetMemoryOccupation();
+    }
+
+    /**********************************************************
+    Summary: Builds the tree.
+
+    Arguments:
+        positions: Vertex positions.
+        vertexCount: Number of vertices.
+        indices: 3 indices per face (as returned by CKMesh::GetFacesIndices).
+        faceCount: Number of faces.
+    *********************************************************/
+    void Build(const VxStridedData &positions, int vertexCount, const XWORD *indices, int faceCount)
+    {
+        Clear();
+        if (faceCount <= 0)
+            return;
+
+        CopyVertices(positions, vertexCount);
+        m_Indices.Resize(faceCount * 3);
+        for (int i = 0; i < faceCount * 3; ++i)
+            m_Indices[i] = indices[i];
+
+        // face bounds and centroids
+        XArray<FaceBounds> bounds(faceCount);
+        bounds.Resize(faceCount);
+        m_Faces.Resize(faceCount);
+        for (int f = 0; f < faceCount; ++f)
+        {
+            m_Faces[f] = f;
+            FaceBounds &b = bounds[f];
+            const VxVector &a = m_Vertices[m_Indices[3 * f]];
+            const VxVector &v1 = m_Vertices[m_Indices[3 * f + 1]];
+            const VxVector &v2 = m_Vertices[m_Indices[3 * f + 2]];
+            for (int c = 0; c < 3; ++c)
+            {
+                b.m_Min[c] = XMin(a[c], v1[c], v2[c]);
+                b.m_Max[c] = XMax(a[c], v1[c], v2[c]);
+                b.m_Center[c] = (b.m_Min[c] + b.m_Max[c]) * 0.5f;
+            }
+        }
+
+        m_Nodes.Reserve(2 * faceCount / MaxLeafSize + 1);
+        m_Nodes.Resize(1);
+        m_Nodes[0].m_Index = 0;
+        m_Nodes[0].m_Count = faceCount;
+
+        // nodes to split (node index, depth)
+        XArray<int> stack;
+        stack.PushBack(0);
+        stack.PushBack(0);
+        while (stack.Size())
+        {
+            int depth = stack.PopBack();
+            int n = stack.PopBack();
+            int first = m_Nodes[n].m_Index;
+            int count = m_Nodes[n].m_Count;
+
+            float cmin[3], cmax[3];
+            ComputeBounds(bounds, first, count, m_Nodes[n].m_Min, m_Nodes[n].m_Max, cmin, cmax);
+            if (count <= MaxLeafSize || depth >= MaxDepth - 1)
+                continue;
+
+            int mid = Split(bounds, first, count, m_Nodes[n].m_Min, m_Nodes[n].m_Max, cmin, cmax);
+            if (mid < 0)
+                continue; // stays a leaf
+
+            int left = m_Nodes.Size();
+            m_Nodes.Resize(left + 2);
+            m_Nodes[left].m_Index = first;
+            m_Nodes[left].m_Count = mid - first;
+            m_Nodes[left + 1].m_Index = mid;
+            m_Nodes[left + 1].m_Count = first + count - mid;
+            m_Nodes[n].m_Index = left;
+            m_Nodes[n].m_Count = 0;
+
+            stack.PushBack(left);
+            stack.PushBack(depth + 1);
+            stack.PushBack(left + 1);
+            stack.PushBack(depth + 1);
+        }
+    }
+
+    /**********************************************************
+    Summary: Updates the tree after the vertices moved.
+
+    Remarks:
+        The vertex count and the faces must not have changed since Build.
+    *********************************************************/
+    void Refit(const VxStridedData &positions)
+    {
+        CopyVertices(positions, m_Vertices.Size());
+        // children are always stored after their parent
+        for (int n = m_Nodes.Size() - 1; n >= 0; --n)
+        {
+            Node &node = m_Nodes[n];
+            if (node.IsLeaf())
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    node.m_Min[c] = 1e30f;
+                    node.m_Max[c] = -1e30f;
+                }
+                for (int i = node.m_Index; i < node.m_Index + node.m_Count; ++i)
+                {
+                    const int *idx = &m_Indices[3 * m_Faces[i]];
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const VxVector &v = m_Vertices[idx[k]];
+                        for (int c = 0; c < 3; ++c)
+                        {
+                            node.m_Min[c] = XMin(node.m_Min[c], v[c]);
+                            node.m_Max[c] = XMax(node.m_Max[c], v[c]);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                const Node &l = m_Nodes[node.m_Index];
+                const Node &r = m_Nodes[node.m_Index + 1];
+                for (int c = 0; c < 3; ++c)
+                {
+                    node.m_Min[c] = XMin(l.m_Min[c], r.m_Min[c]);
+                    node.m_Max[c] = XMax(l.m_Max[c], r.m_Max[c]);
+                }
+            }
+        }
+    }
+
+    /**********************************************************
+    Summary: Finds the nearest face hit by a ray.
+
+    Arguments:
+        ray: Ray in the coordinates of the mesh.
+        dist: Filled with the distance of the hit.
+        u,v: If not NULL, filled with the barycentric coordinates of the hit.
+        iSegment: TRUE to limit the test to the ray segment.
+        iCulled: TRUE to ignore the faces seen from the back.
+        iFirstContact: TRUE to stop at the first face hit instead of the nearest one.
+    Return Value:
+        Index of the face hit, -1 if none.
+    *********************************************************/
+    int RayIntersection(const VxRay &ray, float &dist, float *u = NULL, float *v = NULL,
+                        XBOOL iSegment = FALSE, XBOOL iCulled = FALSE, XBOOL iFirstContact = FALSE) const
+    {
+        if (IsEmpty())
+            return -1;
+
+        float inv[3];
+        for (int c = 0; c < 3; ++c)
+            inv[c] = (XFabs(ray.m_Direction[c]) > EPSILON) ? 1.0f / ray.m_Direction[c] : ((ray.m_Direction[c] < 0.0f) ? -1e30f : 1e30f);
+
+        float best = iSegment ? 1.0f : 1e30f;
+        int hit = -1;
+        int stack[MaxDepth * 2];
+        int top = 0;
+
+        float tnear;
+        if (!RayNode(ray, inv, m_Nodes[0], best, tnear))
+            return -1;
+        stack[top++] = 0;
+        while (top)
+        {
+            const Node &node = m_Nodes[stack[--top]];
+            if (node.IsLeaf())
+            {
+                for (int i = node.m_Index; i < node.m_Index + node.m_Count; ++i)
+                {
+                    int f = m_Faces[i];
+                    float t, fu, fv;
+                    if (RayFace(ray, f, t, fu, fv, best, iCulled))
+                    {
+                        best = t;
+                        hit = f;
+                        if (u)
+                            *u = fu;
+                        if (v)
+                            *v = fv;
+                        if (iFirstContact)
+                        {
+                            dist = best;
+                            return hit;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // nearest child is visited first
+            float tl, tr;
+            XBOOL hl = RayNode(ray, inv, m_Nodes[node.m_Index], best, tl);
+            XBOOL hr = RayNode(ray, inv, m_Nodes[node.m_Index + 1], best, tr);
+            if (hl && hr)
+            {
+                if (tl <= tr)
+                {
+                    stack[top++] = node.m_Index + 1;
+                    stack[top++] = node.m_Index;
+                }
+                else
+                {
+                    stack[top++] = node.m_Index;
+                    stack[top++] = node.m_Index + 1;
+                }
+            }
+            else if (hl)
+            {
+                stack[top++] = node.m_Index;
+            }
+            else if (hr)
+            {
+                stack[top++] = node.m_Index + 1;
+            }
+        }
+        if (hit >= 0)
+            dist = best;
+        return hit;
+    }
+
+    /**********************************************************
+    Summary: Gets the faces which may overlap a box.
+
+    Arguments:
+        box: Box in the coordinates of the mesh.
+        faces: Indices of the faces whose bounding box overlaps box are added to this array.
+    Return Value:
+        Number of faces added.
+    *********************************************************/
+    int BoxOverlap(const VxBbox &box, XArray<int> &faces) const
+    {
+        if (IsEmpty())
+            return 0;
+        int added = 0;
+        int stack[MaxDepth * 2];
+        int top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const Node &node = m_Nodes[stack[--top]];
+            if (!BoxNode(box, node.m_Min, node.m_Max))
+                continue;
+            if (!node.IsLeaf())
+            {
+                stack[top++] = node.m_Index;
+                stack[top++] = node.m_Index + 1;
+                continue;
+            }
+            for (int i = node.m_Index; i < node.m_Index + node.m_Count; ++i)
+            {
+                const int *idx = &m_Indices[3 * m_Faces[i]];
+                float fmin[3], fmax[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    fmin[c] = XMin(m_Vertices[idx[0]][c], m_Vertices[idx[1]][c], m_Vertices[idx[2]][c]);
+                    fmax[c] = XMax(m_Vertices[idx[0]][c], m_Vertices[idx[1]][c], m_Vertices[idx[2]][c]);
+                }
+                if (BoxNode(box, fmin, fmax))
+                {
+                    faces.PushBack(m_Faces[i]);
+                    ++added;
+                }
+            }
+        }
+        return added;
+    }
+
+protected:
+    struct FaceBounds
+    {
+        float m_Min[3];
+        float m_Max[3];
+        float m_Center[3];
+    };
+
+    void CopyVertices(const VxStridedData &positions, int vertexCount)
+    {
+        m_Vertices.Resize(vertexCount);
+        for (int i = 0; i < vertexCount; ++i)
+            m_Vertices[i] = *(const VxVector *)(positions.CPtr + i * positions.Stride);
+    }
+
+    static float HalfArea(const float *mn, const float *mx)
+    {
+        float dx = mx[0] - mn[0], dy = mx[1] - mn[1], dz = mx[2] - mn[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    void ComputeBounds(const XArray<FaceBounds> &bounds, int first, int count, float *mn, float *mx, float *cmin, float *cmax) const
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            mn[c] = cmin[c] = 1e30f;
+            mx[c] = cmax[c] = -1e30f;
+        }
+        for (int i = first; i < first + count; ++i)
+        {
+            const FaceBounds &b = bounds[m_Faces[i]];
+            for (int c = 0; c < 3; ++c)
+            {
+                mn[c] = XMin(mn[c], b.m_Min[c]);
+                mx[c] = XMax(mx[c], b.m_Max[c]);
+                cmin[c] = XMin(cmin[c], b.m_Center[c]);
+                cmax[c] = XMax(cmax[c], b.m_Center[c]);
+            }
+        }
+    }
+
+    // Partitions the faces of a node, returns the index of the first face of the right child or -1 for a leaf.
+    int Split(const XArray<FaceBounds> &bounds, int first, int count, const float *mn, const float *mx, const float *cmin, const float *cmax)
+    {
+        float bestCost = 1e30f;
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = cmax[axis] - cmin[axis];
+            if (extent <= EPSILON)
+                continue;
+            float scale = BinCount / extent;
+
+            int binCount[BinCount];
+            float binMin[BinCount][3], binMax[BinCount][3];
+            int b, c;
+            for (b = 0; b < BinCount; ++b)
+            {
+                binCount[b] = 0;
+                for (c = 0; c < 3; ++c)
+                {
+                    binMin[b][c] = 1e30f;
+                    binMax[b][c] = -1e30f;
+                }
+            }
+            for (int i = first; i < first + count; ++i)
+            {
+                const FaceBounds &fb = bounds[m_Faces[i]];
+                b = XMin((int)((fb.m_Center[axis] - cmin[axis]) * scale), (int)BinCount - 1);
+                ++binCount[b];
+                for (c = 0; c < 3; ++c)
+                {
+                    binMin[b][c] = XMin(binMin[b][c], fb.m_Min[c]);
+                    binMax[b][c] = XMax(binMax[b][c], fb.m_Max[c]);
+                }
+            }
+
+            // right to left sweep
+            float rightArea[BinCount];
+            int rightCount[BinCount];
+            float rmin[3] = {1e30f, 1e30f, 1e30f}, rmax[3] = {-1e30f, -1e30f, -1e30f};
+            int rc = 0;
+            for (b = BinCount - 1; b > 0; --b)
+            {
+                rc += binCount[b];
+                for (c = 0; c < 3; ++c)
+                {
+                    rmin[c] = XMin(rmin[c], binMin[b][c]);
+                    rmax[c] = XMax(rmax[c], binMax[b][c]);
+                }
+                rightCount[b] = rc;
+                rightArea[b] = rc ? HalfArea(rmin, rmax) : 0.0f;
+            }
+
+            // left to right sweep, split between bin b-1 and b
+            float lmin[3] = {1e30f, 1e30f, 1e30f}, lmax[3] = {-1e30f, -1e30f, -1e30f};
+            int lc = 0;
+            for (b = 1; b < BinCount; ++b)
+            {
+                lc += binCount[b - 1];
+                for (c = 0; c < 3; ++c)
+                {
+                    lmin[c] = XMin(lmin[c], binMin[b - 1][c]);
+                    lmax[c] = XMax(lmax[c], binMax[b - 1][c]);
+                }
+                if (!lc || !rightCount[b])
+                    continue;
+                float cost = lc * HalfArea(lmin, lmax) + rightCount[b] * rightArea[b];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        if (bestAxis < 0)
+        {
+            // all the centroids are at the same place
+            if (count <= MaxSAHLeafSize)
+                return -1;
+            return first + count / 2;
+        }
+
+        // traversal cost relative to an intersection test
+        const float leafCost = count * HalfArea(mn, mx);
+        if (count <= MaxSAHLeafSize && bestCost + HalfArea(mn, mx) >= leafCost)
+            return -1;
+
+        const float scale = BinCount / (cmax[bestAxis] - cmin[bestAxis]);
+        int *lo = m_Faces.Begin() + first;
+        int *hi = lo + count - 1;
+        while (lo <= hi)
+        {
+            const FaceBounds &fb = bounds[*lo];
+            int b = XMin((int)((fb.m_Center[bestAxis] - cmin[bestAxis]) * scale), (int)BinCount - 1);
+            if (b < bestBin)
+            {
+                ++lo;
+            }
+            else
+            {
+                XSwap(*lo, *hi);
+                --hi;
+            }
+        }
+        int mid = (int)(lo - m_Faces.Begin());
+        if (mid == first || mid == first + count)
+            mid = first + count / 2;
+        return mid;
+    }
+
+    static XBOOL RayNode(const VxRay &ray, const float *inv, const Node &node, float tmax, float &tmin)
+    {
+        tmin = 0.0f;
+        for (int c = 0; c < 3; ++c)
+        {
+            float t1 = (node.m_Min[c] - ray.m_Origin[c]) * inv[c];
+            float t2 = (node.m_Max[c] - ray.m_Origin[c]) * inv[c];
+            tmin = XMax(tmin, XMin(t1, t2));
+            tmax = XMin(tmax, XMax(t1, t2));
+        }
+        return tmin <= tmax;
+    }
+
+    static XBOOL BoxNode(const VxBbox &box, const float *mn, const float *mx)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            if (mn[c] > box.Max[c] || mx[c] < box.Min[c])
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    XBOOL RayFace(const VxRay &ray, int f, float &t, float &u, float &v, float tLimit, XBOOL iCulled) const
+    {
+        const VxVector &p0 = m_Vertices[m_Indices[3 * f]];
+        VxVector e1 = m_Vertices[m_Indices[3 * f + 1]] - p0;
+        VxVector e2 = m_Vertices[m_Indices[3 * f + 2]] - p0;
+        VxVector p = CrossProduct(ray.m_Direction, e2);
+        float det = DotProduct(e1, p);
+        if (iCulled ? (det <= EPSILON) : (XFabs(det) <= EPSILON))
+            return FALSE;
+        float invDet = 1.0f / det;
+        VxVector s = ray.m_Origin - p0;
+        u = DotProduct(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return FALSE;
+        VxVector q = CrossProduct(s, e1);
+        v = DotProduct(ray.m_Direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return FALSE;
+        t = DotProduct(e2, q) * invDet;
+        return (t >= 0.0f && t <= tLimit);
+    }
+
+    XArray<VxVector> m_Vertices;
+    XArray<int> m_Indices; // 3 vertex indices per face
+    XArray<int> m_Faces;   // faces sorted by leaves
+    XArray<Node> m_Nodes;
+};
+
+#endif // VXTRIANGLEBVH_H
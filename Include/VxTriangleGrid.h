@@ -0,0 +1,330 @@
+#ifndef VXTRIANGLEGRID_H
+#define VXTRIANGLEGRID_H
+
+#include "VxMathDefines.h"
+#include "VxVector.h"
+#include "VxSIMD.h"
+#include "XArray.h"
+
+/*************************************************
+{filename:VxTriangleGrid}
+Summary: Uniform grid of triangles in the XZ plane answering vertical ray queries.
+
+Remarks:
+    o The triangles are added then Build puts each one in the cells of the
+    grid its XZ extents overlap, the cells being stored in a single array
+    (one offset per cell). A query only looks at the triangles of the cell
+    under the point, which is O(1) on average whatever the number of
+    triangles.
+    o The triangles of a cell are stored by groups of 4 in structure of
+    arrays form, and tested 4 at a time with SSE. The scalar code gives
+    the same results.
+    o GetNearest returns the nearest triangle below and above a point
+    along the Y axis, the triangles steeper than a given angle being
+    skipped.
+    o Without a cell size Build chooses twice the average XZ size of the
+    triangles. The grid is limited to 1024x1024 cells, the cell size
+    growing for larger areas.
+
+    VxTriangleGrid grid;
+    grid.AddTriangle(a, b, c, floorIndex, faceIndex);
+    ...
+    grid.Build();
+    VxTriangleGrid::Hit down, up;
+    int found = grid.GetNearest(position, 0.5f, down, up);
+
+See also: CKFloorIndex
+*************************************************/
+class VxTriangleGrid
+{
+public:
+    enum
+    {
+        MaxCells = 1024, // cells on each axis
+        FOUND_DOWN = 1,
+        FOUND_UP = 2
+    };
+
+    // A triangle found by GetNearest.
+    struct Hit
+    {
+        int m_Owner;
+        int m_Face;
+        VxVector m_Normal;
+        float m_Distance; // height of the triangle minus height of the point
+    };
+
+    VxTriangleGrid() : m_CellSize(1.0f), m_InvCellSize(1.0f), m_Columns(0), m_Rows(0) { m_Min.Set(0.0f, 0.0f, 0.0f); }
+
+    void Clear()
+    {
+        m_Triangles.Resize(0);
+        m_CellStart.Resize(0);
+        m_Blocks.Resize(0);
+        m_Columns = m_Rows = 0;
+    }
+
+    // Adds a triangle, owner and face are returned by the queries.
+    void AddTriangle(const VxVector &a, const VxVector &b, const VxVector &c, int owner, int face)
+    {
+        Triangle t;
+        t.m_A = a;
+        t.m_E1 = b - a;
+        t.m_E2 = c - a;
+        t.m_Normal = CrossProduct(t.m_E1, t.m_E2);
+        const float len = Magnitude(t.m_Normal);
+        if (len < 1e-12f)
+            return;
+        t.m_Normal *= 1.0f / len;
+        // the vertical ray hits the triangle where the XZ barycentric coordinates are in [0,1]
+        const float det = t.m_E1.x * t.m_E2.z - t.m_E1.z * t.m_E2.x;
+        if (XAbs(det) < 1e-12f)
+            return;
+        t.m_InvDet = 1.0f / det;
+        t.m_Owner = owner;
+        t.m_Face = face;
+        t.m_MinX = XMin(a.x, XMin(b.x, c.x));
+        t.m_MaxX = XMax(a.x, XMax(b.x, c.x));
+        t.m_MinZ = XMin(a.z, XMin(b.z, c.z));
+        t.m_MaxZ = XMax(a.z, XMax(b.z, c.z));
+        m_Triangles.PushBack(t);
+    }
+
+    int GetTriangleCount() const { return m_Triangles.Size(); }
+
+    /************************************************
+    Summary: Puts the triangles in the cells.
+
+    Arguments:
+        cellSize: Size of a cell, 0 to choose it from the triangles.
+    ************************************************/
+    void Build(float cellSize = 0.0f)
+    {
+        m_CellStart.Resize(0);
+        m_Blocks.Resize(0);
+        m_Columns = m_Rows = 0;
+        const int count = m_Triangles.Size();
+        if (!count)
+            return;
+        float minX = m_Triangles[0].m_MinX, maxX = m_Triangles[0].m_MaxX;
+        float minZ = m_Triangles[0].m_MinZ, maxZ = m_Triangles[0].m_MaxZ;
+        float extent = 0.0f;
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            const Triangle &t = m_Triangles[i];
+            minX = XMin(minX, t.m_MinX);
+            maxX = XMax(maxX, t.m_MaxX);
+            minZ = XMin(minZ, t.m_MinZ);
+            maxZ = XMax(maxZ, t.m_MaxZ);
+            extent += (t.m_MaxX - t.m_MinX) + (t.m_MaxZ - t.m_MinZ);
+        }
+        if (cellSize <= 0.0f)
+            cellSize = extent / (float)count;
+        const float width = maxX - minX;
+        const float depth = maxZ - minZ;
+        cellSize = XMax(cellSize, XMax(width, depth) / (float)(MaxCells - 1));
+        if (cellSize <= 0.0f)
+            cellSize = 1.0f;
+        m_CellSize = cellSize;
+        m_InvCellSize = 1.0f / cellSize;
+        m_Min.Set(minX, 0.0f, minZ);
+        m_Columns = XMin((int)(width * m_InvCellSize) + 1, (int)MaxCells);
+        m_Rows = XMin((int)(depth * m_InvCellSize) + 1, (int)MaxCells);
+
+        // counts the triangles of each cell then fills the groups of 4 of the cells
+        const int cells = m_Columns * m_Rows;
+        XArray<int> counts;
+        counts.Resize(cells);
+        memset(counts.Begin(), 0, cells * sizeof(int));
+        int x, z;
+        for (i = 0; i < count; ++i)
+        {
+            int x0, z0, x1, z1;
+            Cells(m_Triangles[i], x0, z0, x1, z1);
+            for (z = z0; z <= z1; ++z)
+                for (x = x0; x <= x1; ++x)
+                    ++counts[z * m_Columns + x];
+        }
+        m_CellStart.Resize(cells + 1);
+        m_CellStart[0] = 0;
+        for (i = 0; i < cells; ++i)
+            m_CellStart[i + 1] = m_CellStart[i] + (counts[i] + 3) / 4;
+        m_Blocks.Resize(m_CellStart[cells]);
+        memset(m_Blocks.Begin(), 0, m_Blocks.Size() * sizeof(Block));
+        for (i = 0; i < m_Blocks.Size(); ++i)
+            for (int k = 0; k < 4; ++k)
+                m_Blocks[i].m_Triangle[k] = -1;
+        memset(counts.Begin(), 0, cells * sizeof(int));
+        for (i = 0; i < count; ++i)
+        {
+            const Triangle &t = m_Triangles[i];
+            int x0, z0, x1, z1;
+            Cells(t, x0, z0, x1, z1);
+            for (z = z0; z <= z1; ++z)
+            {
+                for (x = x0; x <= x1; ++x)
+                {
+                    const int cell = z * m_Columns + x;
+                    const int n = counts[cell]++;
+                    Block &b = m_Blocks[m_CellStart[cell] + (n >> 2)];
+                    const int k = n & 3;
+                    b.m_AX[k] = t.m_A.x;
+                    b.m_AY[k] = t.m_A.y;
+                    b.m_AZ[k] = t.m_A.z;
+                    b.m_E1X[k] = t.m_E1.x;
+                    b.m_E1Y[k] = t.m_E1.y;
+                    b.m_E1Z[k] = t.m_E1.z;
+                    b.m_E2X[k] = t.m_E2.x;
+                    b.m_E2Y[k] = t.m_E2.y;
+                    b.m_E2Z[k] = t.m_E2.z;
+                    b.m_InvDet[k] = t.m_InvDet;
+                    b.m_NY[k] = XAbs(t.m_Normal.y);
+                    b.m_Triangle[k] = i;
+                }
+            }
+        }
+    }
+
+    /************************************************
+    Summary: Finds the nearest triangles below and above a point.
+
+    Arguments:
+        p: Point to test.
+        minNormalY: Triangles whose normal has a smaller absolute Y are skipped (cosine of the limit angle).
+        down: Receives the nearest triangle below the point.
+        up: Receives the nearest triangle above the point.
+        excludeOwner: Owner whose triangles are skipped, -1 for none.
+        excluded: If not NULL, the triangles of the owners whose byte is not 0 are skipped.
+    Return Value:
+        Combination of FOUND_DOWN and FOUND_UP.
+    ************************************************/
+    int GetNearest(const VxVector &p, float minNormalY, Hit &down, Hit &up, int excludeOwner = -1, const XBYTE *excluded = NULL) const
+    {
+        if (!m_Columns)
+            return 0;
+        const int x = (int)floorf((p.x - m_Min.x) * m_InvCellSize);
+        const int z = (int)floorf((p.z - m_Min.z) * m_InvCellSize);
+        if (x < 0 || z < 0 || x >= m_Columns || z >= m_Rows)
+            return 0;
+        int found = 0;
+        const int cell = z * m_Columns + x;
+        for (int i = m_CellStart[cell]; i < m_CellStart[cell + 1]; ++i)
+        {
+            const Block &b = m_Blocks[i];
+            float distances[4];
+            int mask = 0;
+#if VX_SIMD_SSE
+            if (VxHasSSE())
+            {
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 dx = _mm_sub_ps(_mm_set1_ps(p.x), _mm_loadu_ps(b.m_AX));
+                const __m128 dz = _mm_sub_ps(_mm_set1_ps(p.z), _mm_loadu_ps(b.m_AZ));
+                const __m128 inv = _mm_loadu_ps(b.m_InvDet);
+                const __m128 u = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dx, _mm_loadu_ps(b.m_E2Z)), _mm_mul_ps(dz, _mm_loadu_ps(b.m_E2X))), inv);
+                const __m128 v = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(b.m_E1X), dz), _mm_mul_ps(_mm_loadu_ps(b.m_E1Z), dx)), inv);
+                __m128 in = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+                in = _mm_and_ps(in, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+                in = _mm_and_ps(in, _mm_cmpge_ps(_mm_loadu_ps(b.m_NY), _mm_set1_ps(minNormalY)));
+                mask = _mm_movemask_ps(in);
+                if (!mask)
+                    continue;
+                const __m128 h = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(b.m_AY), _mm_mul_ps(u, _mm_loadu_ps(b.m_E1Y))), _mm_mul_ps(v, _mm_loadu_ps(b.m_E2Y)));
+                _mm_storeu_ps(distances, _mm_sub_ps(h, _mm_set1_ps(p.y)));
+            }
+            else
+#endif
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    const float dx = p.x - b.m_AX[k];
+                    const float dz = p.z - b.m_AZ[k];
+                    const float u = (dx * b.m_E2Z[k] - dz * b.m_E2X[k]) * b.m_InvDet[k];
+                    const float v = (b.m_E1X[k] * dz - b.m_E1Z[k] * dx) * b.m_InvDet[k];
+                    if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && b.m_NY[k] >= minNormalY)
+                    {
+                        mask |= 1 << k;
+                        distances[k] = (b.m_AY[k] + u * b.m_E1Y[k]) + v * b.m_E2Y[k] - p.y;
+                    }
+                }
+            }
+            for (int k = 0; k < 4; ++k)
+            {
+                // the padding of the groups has no triangle
+                if (!(mask & (1 << k)) || b.m_Triangle[k] < 0)
+                    continue;
+                const Triangle &t = m_Triangles[b.m_Triangle[k]];
+                if (t.m_Owner == excludeOwner || (excluded && excluded[t.m_Owner]))
+                    continue;
+                const float distance = distances[k];
+                Hit *hit = NULL;
+                if (distance <= 0.0f)
+                {
+                    if (!(found & FOUND_DOWN) || distance > down.m_Distance)
+                    {
+                        hit = &down;
+                        found |= FOUND_DOWN;
+                    }
+                }
+                else if (!(found & FOUND_UP) || distance < up.m_Distance)
+                {
+                    hit = &up;
+                    found |= FOUND_UP;
+                }
+                if (hit)
+                {
+                    hit->m_Owner = t.m_Owner;
+                    hit->m_Face = t.m_Face;
+                    hit->m_Normal = t.m_Normal;
+                    hit->m_Distance = distance;
+                }
+            }
+        }
+        return found;
+    }
+
+    float GetCellSize() const { return m_CellSize; }
+
+protected:
+    struct Triangle
+    {
+        VxVector m_A;
+        VxVector m_E1;
+        VxVector m_E2;
+        VxVector m_Normal;
+        float m_InvDet;
+        float m_MinX, m_MaxX, m_MinZ, m_MaxZ;
+        int m_Owner;
+        int m_Face;
+    };
+
+    // 4 triangles of a cell
+    struct Block
+    {
+        float m_AX[4], m_AY[4], m_AZ[4];
+        float m_E1X[4], m_E1Y[4], m_E1Z[4];
+        float m_E2X[4], m_E2Y[4], m_E2Z[4];
+        float m_InvDet[4];
+        float m_NY[4]; // absolute Y of the normal
+        int m_Triangle[4]; // -1 for the padding
+    };
+
+    void Cells(const Triangle &t, int &x0, int &z0, int &x1, int &z1) const
+    {
+        x0 = XMax(0, XMin(m_Columns - 1, (int)((t.m_MinX - m_Min.x) * m_InvCellSize)));
+        x1 = XMax(0, XMin(m_Columns - 1, (int)((t.m_MaxX - m_Min.x) * m_InvCellSize)));
+        z0 = XMax(0, XMin(m_Rows - 1, (int)((t.m_MinZ - m_Min.z) * m_InvCellSize)));
+        z1 = XMax(0, XMin(m_Rows - 1, (int)((t.m_MaxZ - m_Min.z) * m_InvCellSize)));
+    }
+
+    XArray<Triangle> m_Triangles;
+    XArray<int> m_CellStart; // first block of each cell, one more for the end
+    XArray<Block> m_Blocks;
+    VxVector m_Min;
+    float m_CellSize;
+    float m_InvCellSize;
+    int m_Columns;
+    int m_Rows;
+};
+
+#endif // VXTRIANGLEGRID_H
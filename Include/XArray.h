@@ -12,8 +12,8 @@ Summary: Class representation of an array.
 
 Remarks:
 The array has a notion of reserved size, which doubles each time it is
-reached. The reserved size reduces only if the occupation of the array goes
-below 30% of the reserved size.
+reached (see XGrowthPolicy to change this). The reserved size reduces only
+if the occupation of the array goes below 30% of the reserved size.
 You mustn't store classes of variable size into an XArray. Use XClassArray for this.
 
 
@@ -319,10 +319,8 @@ public:
         // we check if the array has enough capacity
 
         // If not, we allocate extra data
-        while (Size() + e > Allocated())
-        {
-            Reserve(Allocated() ? Allocated() * 2 : 2);
-        }
+        if (Size() + e > Allocated())
+            Reserve(XGrowthPolicy<T>::NextSize(Allocated(), Size() + e));
         // We set the end cursor
         m_End += e;
     }
@@ -356,7 +354,7 @@ public:
     {
         if (m_End == m_AllocatedEnd)
         {
-            Reserve(Size() ? Size() * 2 : 2);
+            Reserve(XGrowthPolicy<T>::NextSize(Allocated(), Size() + 1));
         }
 
         *(m_End++) = o;
@@ -987,9 +985,7 @@ protected:
         // Test For Reallocation
         if (m_End == m_AllocatedEnd)
         {
-            int newsize = (m_AllocatedEnd - m_Begin) * 2; //+m_AllocationSize;
-            if (!newsize)
-                newsize = 2;
+            int newsize = XGrowthPolicy<T>::NextSize(Allocated(), Size() + 1);
             T *newdata = Allocate(newsize);
 
             // copy before insertion point
@@ -1067,4 +1063,11 @@ protected:
 
 typedef XArray<void *> XVoidArray;
 
+// An XArray only holds three pointers on its own storage {secret}
+template <class T>
+struct XIsTriviallyRelocatable<XArray<T> >
+{
+    enum { Value = TRUE };
+};
+
 #endif // XARRAY_H
@@ -0,0 +1,849 @@
+#ifndef XBPLUSTREE_H
+#define XBPLUSTREE_H
+
+#include "XBinaryTree.h"
+#include "XArray.h"
+#include "XClassArray.h"
+
+/************************************************
+{filename:XBPlusTree}
+Name: XBPlusTree
+
+Summary: Ordered container stored in a B+ tree.
+
+Remarks:
+    o The interface follows XBTree : Insert, Find, Erase, Begin/End
+    iterators, with the same comparison functor and multi/unique flag.
+    o Values are stored by blocks in the leaves, which are about TNodeSize
+    bytes large (4 cache lines by default), and the leaves are linked
+    together so iterating or scanning a range only walks through
+    contiguous arrays.
+    o BulkLoad builds the tree in linear time from sorted values.
+    o T must be default constructible and assignable. Inserting or erasing
+    invalidates the iterators of the tree.
+
+
+
+See Also : XBTree, XHashTable
+************************************************/
+template <class T, class TCmpFunc = Compare<T>, bool TMulti = true, int TNodeSize = 256>
+class XBPlusTree
+{
+public:
+    typedef T Type;
+    typedef T *Pointer;
+    typedef T &Reference;
+    typedef const T &ConstReference;
+
+protected:
+    enum
+    {
+        LEAFCAPACITY = ((TNodeSize - 4 * sizeof(void *)) / sizeof(T) > 4) ? (TNodeSize - 4 * sizeof(void *)) / sizeof(T) : 4,
+        INNERCAPACITY = ((TNodeSize - 3 * sizeof(void *)) / (sizeof(T) + sizeof(void *)) > 4) ? (TNodeSize - 3 * sizeof(void *)) / (sizeof(T) + sizeof(void *)) : 4,
+        LEAFMIN = LEAFCAPACITY / 2,
+        INNERMIN = INNERCAPACITY / 2
+    };
+
+    struct Inner;
+
+    struct NodeBase
+    {
+        Inner *parent;
+        int count;
+        XBOOL leaf;
+    };
+
+    struct Leaf : public NodeBase
+    {
+        Leaf *prev;
+        Leaf *next;
+        T values[LEAFCAPACITY];
+    };
+
+    // count is the number of keys, there are count+1 children
+    struct Inner : public NodeBase
+    {
+        T keys[INNERCAPACITY];
+        NodeBase *children[INNERCAPACITY + 1];
+    };
+
+public:
+    class ConstIterator;
+
+    // Iterator
+    class Iterator
+    {
+        friend class XBPlusTree;
+        friend class ConstIterator;
+
+    public:
+        Iterator() : m_Leaf(NULL), m_Index(0), m_Tree(NULL) {}
+
+        Iterator(Leaf *iLeaf, int iIndex, const XBPlusTree *iTree) : m_Leaf(iLeaf), m_Index(iIndex), m_Tree(iTree) {}
+
+        Reference operator*() const { return m_Leaf->values[m_Index]; }
+
+        Pointer operator->() const { return &m_Leaf->values[m_Index]; }
+
+        Iterator &operator++()
+        {
+            if (++m_Index >= m_Leaf->count)
+            {
+                m_Leaf = m_Leaf->next;
+                m_Index = 0;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        Iterator &operator--()
+        {
+            if (!m_Leaf)
+            {
+                m_Leaf = m_Tree->m_Last;
+                m_Index = m_Leaf->count - 1;
+            }
+            else if (!m_Index)
+            {
+                m_Leaf = m_Leaf->prev;
+                m_Index = m_Leaf->count - 1;
+            }
+            else
+            {
+                --m_Index;
+            }
+            return *this;
+        }
+
+        Iterator operator--(int)
+        {
+            Iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        int operator==(const Iterator &iIt) const { return m_Leaf == iIt.m_Leaf && m_Index == iIt.m_Index; }
+
+        int operator!=(const Iterator &iIt) const { return !(*this == iIt); }
+
+    protected:
+        Leaf *m_Leaf;
+        int m_Index;
+        const XBPlusTree *m_Tree;
+    };
+
+    // Const iterator
+    class ConstIterator
+    {
+        friend class XBPlusTree;
+
+    public:
+        ConstIterator() {}
+
+        ConstIterator(const Iterator &iIt) : m_It(iIt) {}
+
+        ConstReference operator*() const { return *m_It; }
+
+        const T *operator->() const { return m_It.operator->(); }
+
+        ConstIterator &operator++()
+        {
+            ++m_It;
+            return *this;
+        }
+
+        ConstIterator operator++(int)
+        {
+            ConstIterator tmp = *this;
+            ++m_It;
+            return tmp;
+        }
+
+        ConstIterator &operator--()
+        {
+            --m_It;
+            return *this;
+        }
+
+        ConstIterator operator--(int)
+        {
+            ConstIterator tmp = *this;
+            --m_It;
+            return tmp;
+        }
+
+        int operator==(const ConstIterator &iIt) const { return m_It == iIt.m_It; }
+
+        int operator!=(const ConstIterator &iIt) const { return m_It != iIt.m_It; }
+
+    protected:
+        Iterator m_It;
+    };
+
+    explicit XBPlusTree(const TCmpFunc &iCmp = TCmpFunc())
+        : m_KeyCompare(iCmp), m_Root(NULL), m_First(NULL), m_Last(NULL), m_Size(0) {}
+
+    XBPlusTree(const XBPlusTree &iModel)
+        : m_KeyCompare(iModel.m_KeyCompare), m_Root(NULL), m_First(NULL), m_Last(NULL), m_Size(0)
+    {
+        XCopy(iModel);
+    }
+
+    ~XBPlusTree()
+    {
+        Clear();
+    }
+
+    XBPlusTree &operator=(const XBPlusTree &iModel)
+    {
+        if (this != &iModel)
+        {
+            m_KeyCompare = iModel.m_KeyCompare;
+            XCopy(iModel);
+        }
+        return *this;
+    }
+
+    /************************************************
+    Summary: Returns an iterator on the first element.
+    ************************************************/
+    Iterator Begin() { return Iterator(m_First, 0, this); }
+    ConstIterator Begin() const { return Iterator(m_First, 0, this); }
+
+    /************************************************
+    Summary: Returns an iterator after the last element.
+    ************************************************/
+    Iterator End() { return Iterator(NULL, 0, this); }
+    ConstIterator End() const { return Iterator(NULL, 0, this); }
+
+    /************************************************
+    Summary: Returns the number of elements.
+    ************************************************/
+    unsigned int Size() const { return m_Size; }
+
+    /************************************************
+    Summary: Inserts a value.
+
+    Return Value:
+        An iterator on the inserted value or, for a
+    tree which is not TMulti, on the value already
+    present.
+    ************************************************/
+    Iterator Insert(ConstReference iValue)
+    {
+        if (!m_Root)
+        {
+            Leaf *leaf = XNewLeaf();
+            m_Root = m_First = m_Last = leaf;
+        }
+        else if (!TMulti)
+        {
+            Iterator it = LowerBound(iValue);
+            if (it != End() && !m_KeyCompare(iValue, *it))
+                return it;
+        }
+
+        Leaf *leaf = XFindLeaf(iValue, TRUE);
+        int i = XUpper(leaf->values, leaf->count, iValue);
+        if (leaf->count == LEAFCAPACITY)
+        {
+            Leaf *right = XSplitLeaf(leaf);
+            if (i > leaf->count)
+            {
+                i -= leaf->count;
+                leaf = right;
+            }
+        }
+
+        for (int j = leaf->count; j > i; --j)
+            leaf->values[j] = leaf->values[j - 1];
+        leaf->values[i] = iValue;
+        ++leaf->count;
+        ++m_Size;
+        return Iterator(leaf, i, this);
+    }
+
+    Iterator PushBack(ConstReference iValue) { return Insert(iValue); }
+
+    /************************************************
+    Summary: Removes the element pointed by an iterator.
+
+    Return Value:
+        An iterator on the element following the
+    removed one.
+    ************************************************/
+    Iterator Erase(Iterator iT)
+    {
+        Leaf *leaf = iT.m_Leaf;
+        int pos = iT.m_Index;
+
+        --leaf->count;
+        for (int j = pos; j < leaf->count; ++j)
+            leaf->values[j] = leaf->values[j + 1];
+        --m_Size;
+
+        if (leaf == m_Root)
+        {
+            if (!leaf->count)
+            {
+                XFreeNode(leaf);
+                m_Root = m_First = m_Last = NULL;
+                return End();
+            }
+        }
+        else if (leaf->count < LEAFMIN)
+        {
+            XRebalanceLeaf(leaf, pos);
+        }
+        return XMakeIterator(leaf, pos);
+    }
+
+    /************************************************
+    Summary: Removes the elements in [iFirst,iLast[.
+    ************************************************/
+    Iterator Erase(Iterator iFirst, Iterator iLast)
+    {
+        // the iterators are invalidated by the rebalancing, so we count first
+        int count = 0;
+        for (Iterator it = iFirst; it != iLast; ++it)
+            ++count;
+        while (count--)
+            iFirst = Erase(iFirst);
+        return iFirst;
+    }
+
+    /************************************************
+    Summary: Removes all the elements.
+    ************************************************/
+    void Clear()
+    {
+        if (m_Root)
+            XFreeTree(m_Root);
+        m_Root = NULL;
+        m_First = m_Last = NULL;
+        m_Size = 0;
+    }
+
+    /************************************************
+    Summary: Finds a value.
+
+    Return Value:
+        An iterator on the first element equal to
+    iValue, End() if there is none.
+    ************************************************/
+    Iterator Find(ConstReference iValue)
+    {
+        Iterator it = LowerBound(iValue);
+        if (it != End() && !m_KeyCompare(iValue, *it))
+            return it;
+        return End();
+    }
+
+    ConstIterator Find(ConstReference iValue) const
+    {
+        return const_cast<XBPlusTree *>(this)->Find(iValue);
+    }
+
+    /************************************************
+    Summary: Returns an iterator on the first element
+    which is not less than iValue.
+    ************************************************/
+    Iterator LowerBound(ConstReference iValue) const
+    {
+        if (!m_Root)
+            return Iterator(NULL, 0, this);
+        Leaf *leaf = XFindLeaf(iValue, FALSE);
+        return XMakeIterator(leaf, XLower(leaf->values, leaf->count, iValue));
+    }
+
+    /************************************************
+    Summary: Returns an iterator on the first element
+    which is greater than iValue.
+    ************************************************/
+    Iterator UpperBound(ConstReference iValue) const
+    {
+        if (!m_Root)
+            return Iterator(NULL, 0, this);
+        Leaf *leaf = XFindLeaf(iValue, TRUE);
+        return XMakeIterator(leaf, XUpper(leaf->values, leaf->count, iValue));
+    }
+
+    /************************************************
+    Summary: Replaces the content of the tree by sorted values.
+
+    Input Arguments:
+        iValues: values sorted according to the comparison
+    functor.
+        iCount: number of values.
+
+    Remarks:
+        The tree is built bottom-up in linear time. For a tree
+    which is not TMulti, the duplicated values are skipped.
+    ************************************************/
+    void BulkLoad(const T *iValues, int iCount)
+    {
+        Clear();
+
+        int n = 0;
+        for (int i = 0; i < iCount; ++i)
+        {
+            XASSERT(!i || !m_KeyCompare(iValues[i], iValues[i - 1]));
+            if (TMulti || !i || m_KeyCompare(iValues[i - 1], iValues[i]))
+                ++n;
+        }
+        if (!n)
+            return;
+
+        // leaves, evenly filled
+        XArray<NodeBase *> level;
+        XClassArray<T> mins;
+        int leafCount = (n + LEAFCAPACITY - 1) / LEAFCAPACITY;
+        level.Reserve(leafCount);
+        mins.Reserve(leafCount);
+        int src = 0;
+        Leaf *prev = NULL;
+        for (int l = 0; l < leafCount; ++l)
+        {
+            Leaf *leaf = XNewLeaf();
+            int fill = n / leafCount + ((l < n % leafCount) ? 1 : 0);
+            while (leaf->count < fill)
+            {
+                if (TMulti || !src || m_KeyCompare(iValues[src - 1], iValues[src]))
+                    leaf->values[leaf->count++] = iValues[src];
+                ++src;
+            }
+            leaf->prev = prev;
+            if (prev)
+                prev->next = leaf;
+            else
+                m_First = leaf;
+            prev = leaf;
+            level.PushBack(leaf);
+            mins.PushBack(leaf->values[0]);
+        }
+        m_Last = prev;
+        m_Size = n;
+
+        // inner levels
+        while (level.Size() > 1)
+        {
+            int c = level.Size();
+            int nodeCount = (c + INNERCAPACITY) / (INNERCAPACITY + 1);
+            XArray<NodeBase *> upper;
+            XClassArray<T> upperMins;
+            upper.Reserve(nodeCount);
+            upperMins.Reserve(nodeCount);
+            int child = 0;
+            for (int k = 0; k < nodeCount; ++k)
+            {
+                Inner *inner = XNewInner();
+                int fill = c / nodeCount + ((k < c % nodeCount) ? 1 : 0);
+                upperMins.PushBack(mins[child]);
+                for (int j = 0; j < fill; ++j, ++child)
+                {
+                    if (j)
+                        inner->keys[j - 1] = mins[child];
+                    inner->children[j] = level[child];
+                    level[child]->parent = inner;
+                }
+                inner->count = fill - 1;
+                upper.PushBack(inner);
+            }
+            level.Swap(upper);
+            mins.Swap(upperMins);
+        }
+        m_Root = level[0];
+    }
+
+    /************************************************
+    Summary: Swaps the content of two trees.
+    ************************************************/
+    void Swap(XBPlusTree &iTree)
+    {
+        XSwap(m_KeyCompare, iTree.m_KeyCompare);
+        XSwap(m_Root, iTree.m_Root);
+        XSwap(m_First, iTree.m_First);
+        XSwap(m_Last, iTree.m_Last);
+        XSwap(m_Size, iTree.m_Size);
+    }
+
+protected:
+    // Index of the first element not less than iValue {secret}
+    int XLower(const T *iArray, int iCount, ConstReference iValue) const
+    {
+        int lo = 0;
+        while (iCount > 0)
+        {
+            int half = iCount >> 1;
+            if (m_KeyCompare(iArray[lo + half], iValue))
+            {
+                lo += half + 1;
+                iCount -= half + 1;
+            }
+            else
+            {
+                iCount = half;
+            }
+        }
+        return lo;
+    }
+
+    // Index of the first element greater than iValue {secret}
+    int XUpper(const T *iArray, int iCount, ConstReference iValue) const
+    {
+        int lo = 0;
+        while (iCount > 0)
+        {
+            int half = iCount >> 1;
+            if (!m_KeyCompare(iValue, iArray[lo + half]))
+            {
+                lo += half + 1;
+                iCount -= half + 1;
+            }
+            else
+            {
+                iCount = half;
+            }
+        }
+        return lo;
+    }
+
+    // Leaf where iValue lower (or upper) bound would be {secret}
+    Leaf *XFindLeaf(ConstReference iValue, XBOOL iUpper) const
+    {
+        NodeBase *node = m_Root;
+        while (!node->leaf)
+        {
+            Inner *inner = (Inner *)node;
+            int i = iUpper ? XUpper(inner->keys, inner->count, iValue) : XLower(inner->keys, inner->count, iValue);
+            node = inner->children[i];
+        }
+        return (Leaf *)node;
+    }
+
+    // Iterator on a position, the position after the last value of a leaf being the next leaf {secret}
+    Iterator XMakeIterator(Leaf *iLeaf, int iIndex) const
+    {
+        if (iIndex >= iLeaf->count)
+            return Iterator(iLeaf->next, 0, this);
+        return Iterator(iLeaf, iIndex, this);
+    }
+
+    static int XChildIndex(Inner *iParent, NodeBase *iChild)
+    {
+        int i = 0;
+        while (iParent->children[i] != iChild)
+            ++i;
+        return i;
+    }
+
+    // Moves the upper half of a full leaf in a new leaf {secret}
+    Leaf *XSplitLeaf(Leaf *iLeaf)
+    {
+        Leaf *right = XNewLeaf();
+        int mid = iLeaf->count / 2;
+        for (int i = mid; i < iLeaf->count; ++i)
+            right->values[right->count++] = iLeaf->values[i];
+        iLeaf->count = mid;
+
+        right->prev = iLeaf;
+        right->next = iLeaf->next;
+        if (iLeaf->next)
+            iLeaf->next->prev = right;
+        else
+            m_Last = right;
+        iLeaf->next = right;
+
+        XInsertInParent(iLeaf, right->values[0], right);
+        return right;
+    }
+
+    // Inserts iRight after iLeft in their parent, with iKey as separator {secret}
+    void XInsertInParent(NodeBase *iLeft, ConstReference iKey, NodeBase *iRight)
+    {
+        Inner *p = iLeft->parent;
+        if (!p)
+        {
+            Inner *root = XNewInner();
+            root->keys[0] = iKey;
+            root->children[0] = iLeft;
+            root->children[1] = iRight;
+            root->count = 1;
+            iLeft->parent = root;
+            iRight->parent = root;
+            m_Root = root;
+            return;
+        }
+
+        int idx = XChildIndex(p, iLeft);
+        if (p->count < INNERCAPACITY)
+        {
+            for (int j = p->count; j > idx; --j)
+            {
+                p->keys[j] = p->keys[j - 1];
+                p->children[j + 1] = p->children[j];
+            }
+            p->keys[idx] = iKey;
+            p->children[idx + 1] = iRight;
+            iRight->parent = p;
+            ++p->count;
+            return;
+        }
+
+        // the parent is full : we split it
+        T keys[INNERCAPACITY + 1];
+        NodeBase *children[INNERCAPACITY + 2];
+        int j;
+        for (j = 0; j < idx; ++j)
+            keys[j] = p->keys[j];
+        keys[idx] = iKey;
+        for (j = idx; j < INNERCAPACITY; ++j)
+            keys[j + 1] = p->keys[j];
+        for (j = 0; j <= idx; ++j)
+            children[j] = p->children[j];
+        children[idx + 1] = iRight;
+        for (j = idx + 1; j <= INNERCAPACITY; ++j)
+            children[j + 1] = p->children[j];
+
+        const int total = INNERCAPACITY + 1;
+        const int mid = total / 2;
+        Inner *right = XNewInner();
+
+        p->count = mid;
+        for (j = 0; j < mid; ++j)
+            p->keys[j] = keys[j];
+        for (j = 0; j <= mid; ++j)
+        {
+            p->children[j] = children[j];
+            children[j]->parent = p;
+        }
+
+        right->count = total - mid - 1;
+        for (j = 0; j < right->count; ++j)
+            right->keys[j] = keys[mid + 1 + j];
+        for (j = 0; j <= right->count; ++j)
+        {
+            right->children[j] = children[mid + 1 + j];
+            children[mid + 1 + j]->parent = right;
+        }
+
+        XInsertInParent(p, keys[mid], right);
+    }
+
+    // Refills a leaf under the minimum occupation, ioPos follows the position of the next element {secret}
+    void XRebalanceLeaf(Leaf *&ioLeaf, int &ioPos)
+    {
+        Leaf *leaf = ioLeaf;
+        Inner *p = leaf->parent;
+        int idx = XChildIndex(p, leaf);
+        Leaf *left = (idx > 0) ? (Leaf *)p->children[idx - 1] : NULL;
+        Leaf *right = (idx < p->count) ? (Leaf *)p->children[idx + 1] : NULL;
+        int j;
+
+        if (left && left->count > LEAFMIN)
+        {
+            // borrow the last value of the left sibling
+            for (j = leaf->count; j > 0; --j)
+                leaf->values[j] = leaf->values[j - 1];
+            leaf->values[0] = left->values[--left->count];
+            ++leaf->count;
+            p->keys[idx - 1] = leaf->values[0];
+            ++ioPos;
+        }
+        else if (right && right->count > LEAFMIN)
+        {
+            // borrow the first value of the right sibling
+            leaf->values[leaf->count++] = right->values[0];
+            --right->count;
+            for (j = 0; j < right->count; ++j)
+                right->values[j] = right->values[j + 1];
+            p->keys[idx] = right->values[0];
+        }
+        else if (left)
+        {
+            // merge into the left sibling
+            ioPos += left->count;
+            for (j = 0; j < leaf->count; ++j)
+                left->values[left->count++] = leaf->values[j];
+            XUnlinkLeaf(leaf);
+            XFreeNode(leaf);
+            ioLeaf = left;
+            XRemoveFromInner(p, idx - 1);
+        }
+        else
+        {
+            // merge the right sibling
+            for (j = 0; j < right->count; ++j)
+                leaf->values[leaf->count++] = right->values[j];
+            XUnlinkLeaf(right);
+            XFreeNode(right);
+            XRemoveFromInner(p, idx);
+        }
+    }
+
+    void XUnlinkLeaf(Leaf *iLeaf)
+    {
+        if (iLeaf->prev)
+            iLeaf->prev->next = iLeaf->next;
+        else
+            m_First = iLeaf->next;
+        if (iLeaf->next)
+            iLeaf->next->prev = iLeaf->prev;
+        else
+            m_Last = iLeaf->prev;
+    }
+
+    // Removes the key iKey and the child after it {secret}
+    void XRemoveFromInner(Inner *p, int iKey)
+    {
+        --p->count;
+        for (int j = iKey; j < p->count; ++j)
+        {
+            p->keys[j] = p->keys[j + 1];
+            p->children[j + 1] = p->children[j + 2];
+        }
+
+        if (p == m_Root)
+        {
+            if (!p->count)
+            {
+                m_Root = p->children[0];
+                m_Root->parent = NULL;
+                XFreeNode(p);
+            }
+        }
+        else if (p->count < INNERMIN)
+        {
+            XRebalanceInner(p);
+        }
+    }
+
+    void XRebalanceInner(Inner *n)
+    {
+        Inner *p = n->parent;
+        int idx = XChildIndex(p, n);
+        Inner *left = (idx > 0) ? (Inner *)p->children[idx - 1] : NULL;
+        Inner *right = (idx < p->count) ? (Inner *)p->children[idx + 1] : NULL;
+        int j;
+
+        if (left && left->count > INNERMIN)
+        {
+            // rotate from the left sibling through the parent
+            for (j = n->count; j > 0; --j)
+                n->keys[j] = n->keys[j - 1];
+            for (j = n->count + 1; j > 0; --j)
+                n->children[j] = n->children[j - 1];
+            n->keys[0] = p->keys[idx - 1];
+            n->children[0] = left->children[left->count];
+            n->children[0]->parent = n;
+            p->keys[idx - 1] = left->keys[left->count - 1];
+            --left->count;
+            ++n->count;
+        }
+        else if (right && right->count > INNERMIN)
+        {
+            // rotate from the right sibling through the parent
+            n->keys[n->count] = p->keys[idx];
+            n->children[n->count + 1] = right->children[0];
+            right->children[0]->parent = n;
+            ++n->count;
+            p->keys[idx] = right->keys[0];
+            for (j = 0; j < right->count - 1; ++j)
+                right->keys[j] = right->keys[j + 1];
+            for (j = 0; j < right->count; ++j)
+                right->children[j] = right->children[j + 1];
+            --right->count;
+        }
+        else if (left)
+        {
+            XMergeInner(left, p->keys[idx - 1], n);
+            XRemoveFromInner(p, idx - 1);
+        }
+        else
+        {
+            XMergeInner(n, p->keys[idx], right);
+            XRemoveFromInner(p, idx);
+        }
+    }
+
+    // Appends iKey and the content of iRight to iLeft, then frees iRight {secret}
+    void XMergeInner(Inner *iLeft, ConstReference iKey, Inner *iRight)
+    {
+        iLeft->keys[iLeft->count] = iKey;
+        int j;
+        for (j = 0; j < iRight->count; ++j)
+            iLeft->keys[iLeft->count + 1 + j] = iRight->keys[j];
+        for (j = 0; j <= iRight->count; ++j)
+        {
+            iLeft->children[iLeft->count + 1 + j] = iRight->children[j];
+            iRight->children[j]->parent = iLeft;
+        }
+        iLeft->count += iRight->count + 1;
+        XFreeNode(iRight);
+    }
+
+    void XCopy(const XBPlusTree &iModel)
+    {
+        XClassArray<T> values;
+        values.Reserve(iModel.Size());
+        for (ConstIterator it = iModel.Begin(); it != iModel.End(); ++it)
+            values.PushBack(*it);
+        BulkLoad(values.Begin(), values.Size());
+    }
+
+    //
+    // (De)Allocation methods
+
+    Leaf *XNewLeaf()
+    {
+        Leaf *leaf = VxNew(Leaf);
+        leaf->parent = NULL;
+        leaf->count = 0;
+        leaf->leaf = TRUE;
+        leaf->prev = NULL;
+        leaf->next = NULL;
+        return leaf;
+    }
+
+    Inner *XNewInner()
+    {
+        Inner *inner = VxNew(Inner);
+        inner->parent = NULL;
+        inner->count = 0;
+        inner->leaf = FALSE;
+        return inner;
+    }
+
+    void XFreeNode(NodeBase *iNode)
+    {
+        if (iNode->leaf)
+            VxDelete<Leaf>((Leaf *)iNode);
+        else
+            VxDelete<Inner>((Inner *)iNode);
+    }
+
+    void XFreeTree(NodeBase *iNode)
+    {
+        if (!iNode->leaf)
+        {
+            Inner *inner = (Inner *)iNode;
+            for (int i = 0; i <= inner->count; ++i)
+                XFreeTree(inner->children[i]);
+        }
+        XFreeNode(iNode);
+    }
+
+    TCmpFunc m_KeyCompare;
+    NodeBase *m_Root;
+    Leaf *m_First;
+    Leaf *m_Last;
+    unsigned int m_Size;
+};
+
+#endif // XBPLUSTREE_H
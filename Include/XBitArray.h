@@ -3,6 +3,11 @@
 
 #include "XUtil.h"
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#define XBITARRAY_SSE2
+#include <emmintrin.h>
+#endif
+
 /************************************************
 {filename:XBitArray}
 Summary: Set of bit flags.
@@ -239,8 +244,8 @@ public:
     // Summary: Performs a binary AND with another array
     void And(XBitArray &a)
     {
-        int size = a.m_Size >> 5;
-        int i = 0;
+        int size = XMin(a.m_Size, m_Size) >> 5;
+        int i = XBitOp(m_Data, a.m_Data, size, OpAnd);
         for (; i < size; ++i)
         {
             m_Data[i] &= a.m_Data[i];
@@ -256,8 +261,8 @@ public:
     // Summary: subtract bits from another bitarray
     XBitArray &operator-=(XBitArray &a)
     {
-        int size = a.m_Size >> 5;
-        int i = 0;
+        int size = XMin(a.m_Size, m_Size) >> 5;
+        int i = XBitOp(m_Data, a.m_Data, size, OpAndNot);
         for (; i < size; ++i)
         {
             m_Data[i] &= ~a.m_Data[i];
@@ -268,7 +273,7 @@ public:
     // Summary: Returns TRUE if at least one common bit is set in two arrays
     XBOOL CheckCommon(XBitArray &a)
     {
-        int size = a.m_Size >> 5;
+        int size = XMin(a.m_Size, m_Size) >> 5;
         for (int i = 0; i < size; ++i)
         {
             if (m_Data[i] & a.m_Data[i])
@@ -282,7 +287,7 @@ public:
     {
         CheckSameSize(a);
         int size = a.m_Size >> 5;
-        for (int i = 0; i < size; ++i)
+        for (int i = XBitOp(m_Data, a.m_Data, size, OpOr); i < size; ++i)
         {
             m_Data[i] |= a.m_Data[i];
         }
@@ -293,7 +298,7 @@ public:
     {
         CheckSameSize(a);
         int size = a.m_Size >> 5;
-        for (int i = 0; i < size; ++i)
+        for (int i = XBitOp(m_Data, a.m_Data, size, OpXOr); i < size; ++i)
         {
             m_Data[i] ^= a.m_Data[i];
         }
@@ -310,42 +315,28 @@ public:
     }
 
     // Summary: Returns the number of bits set
-    int BitSet()
+    int BitSet() const
     {
         int set = 0;
         int size = m_Size >> 5;
         for (int i = 0; i < size; ++i)
         {
-            int mask = 1;
-            for (int j = 0; j < 32; ++j)
-            {
-                if (m_Data[i] & mask)
-                    ++set;
-                mask <<= 1;
-            }
+            set += BitCount(m_Data[i]);
         }
         return set;
     }
 
     // Summary: Returns the position of the n-th set(1) bit
-    int GetSetBitPosition(int n)
+    int GetSetBitPosition(int n) const
     {
-        int set = 0;
-        int pos = 0;
         int size = m_Size >> 5;
         for (int i = 0; i < size; ++i)
         {
-            int mask = 1;
-            for (int j = 0; j < 32; ++j, ++pos)
-            {
-                if (m_Data[i] & mask)
-                {
-                    if (set == n)
-                        return pos;
-                    ++set;
-                }
-                mask <<= 1;
-            }
+            XDWORD bits = m_Data[i];
+            int count = BitCount(bits);
+            if (n < count)
+                return (i << 5) + XNthBit(bits, n);
+            n -= count;
         }
         return -1;
     }
@@ -353,28 +344,100 @@ public:
     // Summary: Returns the position of the n-th unset(0) bit
     int GetUnsetBitPosition(int n)
     {
-        int unset = 0;
-        int pos = 0;
         int size = m_Size >> 5;
         for (int i = 0; i < size; ++i)
         {
-            int mask = 1;
-            for (int j = 0; j < 32; ++j, ++pos)
-            {
-                if (!(m_Data[i] & mask))
-                {
-                    if (unset == n)
-                        return pos;
-                    ++unset;
-                }
-                mask <<= 1;
-            }
+            XDWORD bits = ~m_Data[i];
+            int count = BitCount(bits);
+            if (n < count)
+                return (i << 5) + XNthBit(bits, n);
+            n -= count;
         }
         // We haven't found an unsetted bit yet : we reallocate
+        int pos = size << 5;
         CheckSize(pos);
         return pos;
     }
 
+    /************************************************
+    Summary: Returns the position of the first set(1) bit at or after n.
+
+    Remarks:
+        Returns -1 if there is no set bit after n.
+    ************************************************/
+    int GetNextSetBit(int n) const
+    {
+        if (n < 0)
+            n = 0;
+        if (n >= m_Size)
+            return -1;
+        int i = n >> 5;
+        XDWORD bits = m_Data[i] & (0xFFFFFFFF << (n & 31));
+        int size = m_Size >> 5;
+        while (!bits)
+        {
+            if (++i >= size)
+                return -1;
+            bits = m_Data[i];
+        }
+        return (i << 5) + LowestBitIndex(bits);
+    }
+
+    /************************************************
+    Summary: Returns the position of the first unset(0) bit at or after n.
+
+    Remarks:
+        Returns Size() if all the bits after n are set.
+    ************************************************/
+    int GetNextUnsetBit(int n) const
+    {
+        if (n < 0)
+            n = 0;
+        if (n >= m_Size)
+            return m_Size;
+        int i = n >> 5;
+        XDWORD bits = ~m_Data[i] & (0xFFFFFFFF << (n & 31));
+        int size = m_Size >> 5;
+        while (!bits)
+        {
+            if (++i >= size)
+                return m_Size;
+            bits = ~m_Data[i];
+        }
+        return (i << 5) + LowestBitIndex(bits);
+    }
+
+    /************************************************
+    Summary: Iterates on the positions of the set bits.
+
+    Remarks:
+        The array must not be resized during the iteration.
+
+        for (XBitArray::SetBitIterator it(array); it.IsValid(); ++it)
+            DoSomething(*it);
+    ************************************************/
+    class SetBitIterator
+    {
+    public:
+        explicit SetBitIterator(const XBitArray &a) : m_Array(a), m_Pos(a.GetNextSetBit(0)) {}
+
+        XBOOL IsValid() const { return m_Pos >= 0; }
+
+        int operator*() const { return m_Pos; }
+
+        SetBitIterator &operator++()
+        {
+            m_Pos = m_Array.GetNextSetBit(m_Pos + 1);
+            return *this;
+        }
+
+    private:
+        const XBitArray &m_Array;
+        int m_Pos;
+
+        SetBitIterator &operator=(const SetBitIterator &);
+    };
+
     char *ConvertToString(char *buffer)
     {
         if (buffer)
@@ -403,6 +466,47 @@ public:
     }
 
 private:
+    enum XBitOperation
+    {
+        OpAnd,
+        OpAndNot,
+        OpOr,
+        OpXOr
+    };
+
+    // Applies op on the first dwords 4 at a time, returns the number of dwords processed {secret}
+    static int XBitOp(XDWORD *dst, const XDWORD *src, int count, XBitOperation op)
+    {
+#ifdef XBITARRAY_SSE2
+        int i = 0;
+        int end = count & ~3;
+        for (; i < end; i += 4)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+            switch (op)
+            {
+            case OpAnd: a = _mm_and_si128(a, b); break;
+            case OpAndNot: a = _mm_andnot_si128(b, a); break;
+            case OpOr: a = _mm_or_si128(a, b); break;
+            case OpXOr: a = _mm_xor_si128(a, b); break;
+            }
+            _mm_storeu_si128((__m128i *)(dst + i), a);
+        }
+        return end;
+#else
+        return 0;
+#endif
+    }
+
+    // Position of the n-th set bit of a dword which has more than n bits set {secret}
+    static int XNthBit(XDWORD bits, int n)
+    {
+        while (n--)
+            bits &= bits - 1;
+        return LowestBitIndex(bits);
+    }
+
     XDWORD *Allocate(int size)
     {
 #ifdef NO_VX_MALLOC
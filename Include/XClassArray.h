@@ -4,6 +4,10 @@
 #include "VxMathDefines.h"
 #include "XUtil.h"
 
+#if VX_HAS_CXX11
+#include <utility>
+#endif
+
 #ifdef VX_MSVC
 #pragma warning(disable : 4786)
 #endif
@@ -18,6 +22,9 @@ Remarks:
     This array is designed to hold structure or class
 which have something specific to do on the construction,
 deletion or recopy, like allocating/destroying pointers.
+    When the storage grows, elements are moved (C++11) or
+copied to the new storage. Types marked with
+XIsTriviallyRelocatable are moved with a single memcpy instead.
 
 
 
@@ -162,12 +169,19 @@ public:
     ************************************************/
     void Reserve(int size)
     {
+#ifndef NO_VX_MALLOC
+        if (XIsTriviallyRelocatable<T>::Value)
+        {
+            XRelocate(size);
+            return;
+        }
+#endif
         // allocation of new size
         T *newdata = Allocate(size);
 
         // Recopy of old elements
         T *last = XMin(m_Begin + size, m_End);
-        XCopy(newdata, m_Begin, last);
+        XTransfer(newdata, m_Begin, last);
 
         // new Pointers
         Free();
@@ -219,10 +233,8 @@ public:
         // we check if the array has enough capacity
 
         // If not, we allocate extra data
-        while (Size() + e > Allocated())
-        {
-            Reserve(Allocated() ? Allocated() * 2 : 2);
-        }
+        if (Size() + e > Allocated())
+            Reserve(XGrowthPolicy<T>::NextSize(Allocated(), Size() + e));
         // We set the end cursor
         m_End += e;
     }
@@ -525,6 +537,21 @@ protected:
         }
     }
 
+    // Same as XCopy but the source elements may be moved from {secret}
+    void XTransfer(T *dest, T *start, T *end)
+    {
+#if VX_HAS_CXX11
+        while (start != end)
+        {
+            *dest = std::move(*start);
+            start++;
+            dest++;
+        }
+#else
+        XCopy(dest, start, end);
+#endif
+    }
+
     void XMove(T *dest, T *start, T *end)
     {
         if (dest > start)
@@ -534,11 +561,37 @@ protected:
             {
                 --dest;
                 --end;
+#if VX_HAS_CXX11
+                *dest = std::move(*end);
+#else
                 *dest = *end;
+#endif
             }
         }
         else
-            XCopy(dest, start, end);
+            XTransfer(dest, start, end);
+    }
+
+    // Moves the elements to a new storage of size elements with a raw copy {secret}
+    void XRelocate(int size)
+    {
+        T *newdata = (size) ? (T *)VxMalloc(sizeof(T) * size) : NULL;
+
+        T *last = XMin(m_Begin + size, m_End);
+        int count = last - m_Begin;
+        if (count)
+            memcpy((void *)newdata, m_Begin, count * sizeof(T));
+        for (T *t = newdata + count; t < newdata + size; ++t)
+            new (t) T;
+
+        // the elements which were not relocated are still alive here
+        for (T *t = last; t < m_AllocatedEnd; ++t)
+            t->~T();
+        VxFree(m_Begin);
+
+        m_Begin = newdata;
+        m_End = newdata + count;
+        m_AllocatedEnd = newdata + size;
     }
 
     void XInsert(T *i, const T &o)
@@ -546,20 +599,37 @@ protected:
         // Test For Reallocation
         if (m_End + 1 > m_AllocatedEnd)
         {
-            int newsize = (m_AllocatedEnd - m_Begin) * 2; //+m_AllocationSize;
-            if (!newsize)
-                newsize = 1;
+            int newsize = XGrowthPolicy<T>::NextSize(Allocated(), Size() + 1);
+#ifndef NO_VX_MALLOC
+            if (XIsTriviallyRelocatable<T>::Value)
+            {
+                int pos = i - m_Begin;
+                if (&o >= m_Begin && &o < m_End)
+                {
+                    // o lives in the storage we are going to release
+                    T tmp = o;
+                    XRelocate(newsize);
+                    XInsert(m_Begin + pos, tmp);
+                }
+                else
+                {
+                    XRelocate(newsize);
+                    XInsert(m_Begin + pos, o);
+                }
+                return;
+            }
+#endif
             T *newdata = Allocate(newsize);
 
             // copy before insertion point
-            XCopy(newdata, m_Begin, i);
+            XTransfer(newdata, m_Begin, i);
 
             // copy the new element
             T *insertionpoint = newdata + (i - m_Begin);
             *(insertionpoint) = o;
 
             // copy after insertion point
-            XCopy(insertionpoint + 1, i, m_End);
+            XTransfer(insertionpoint + 1, i, m_End);
 
             // New Pointers
             m_End = newdata + (m_End - m_Begin);
@@ -609,7 +679,7 @@ protected:
 #ifdef NO_VX_MALLOC
         delete[] m_Begin;
 #else
-        VxDeallocate<T>(m_Begin, (m_AllocatedEnd - m_Begin) / sizeof(T));
+        VxDeallocate<T>(m_Begin, m_AllocatedEnd - m_Begin);
 #endif
     }
 
@@ -623,4 +693,11 @@ protected:
     T *m_AllocatedEnd;
 };
 
+// An XClassArray only holds three pointers on its own storage {secret}
+template <class T>
+struct XIsTriviallyRelocatable<XClassArray<T> >
+{
+    enum { Value = TRUE };
+};
+
 #endif // XCLASSARRAY_H
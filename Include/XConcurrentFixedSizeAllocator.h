@@ -0,0 +1,197 @@
+#ifndef XCONCURRENTFIXEDSIZEALLOCATOR_H
+#define XCONCURRENTFIXEDSIZEALLOCATOR_H
+
+#include "FixedSizeAllocator.h"
+#include "VxMutex.h"
+#include "VxAtomic.h"
+
+/************************************************
+{filename:XConcurrentFixedSizeAllocator}
+Name: XConcurrentFixedSizeAllocator
+
+Summary: Fixed size block allocator usable from several threads.
+
+Remarks:
+    o Allocations lock a VxMutex: a refill pops its batch from the free
+    blocks taken from the depot, and gets new blocks from an
+    XFixedSizeAllocator when there are not enough of them. With a
+    Magazine the mutex is entered once per batch, not once per block.
+    o Free() never locks: released blocks are pushed on a lock free
+    depot list, which is taken back as a whole (one exchange, so no ABA
+    problem) by the next refill needing blocks. The blocks of the depot
+    are used before the XFixedSizeAllocator grows.
+    o Each thread should allocate through its own
+    XConcurrentFixedSizeAllocator::Magazine, a small cache which gets and
+    gives back blocks by batches, so most allocations do not touch any
+    shared data.
+    o Blocks are only given back to the underlying allocator by Clear().
+
+    XConcurrentFixedSizeAllocator allocator(sizeof(SoundPacket));
+    ...
+    // In the reader thread
+    XConcurrentFixedSizeAllocator::Magazine cache(allocator);
+    SoundPacket *p = (SoundPacket *)cache.Allocate();
+
+See Also: XFixedSizeAllocator, VxMutex
+************************************************/
+class XConcurrentFixedSizeAllocator
+{
+public:
+    XConcurrentFixedSizeAllocator(const int iBlockSize, const int iPageSize = XFixedSizeAllocator::DEFAULT_CHUNK_SIZE)
+        : m_Allocator(XMax(iBlockSize, (int)sizeof(void *)), iPageSize), m_Free(NULL), m_Depot(NULL) {}
+
+    /************************************************
+    Summary: Per thread cache of blocks.
+
+    Remarks:
+        A Magazine must only be used by one thread.
+    It gives its blocks back to the allocator when destroyed.
+    ************************************************/
+    class Magazine
+    {
+    public:
+        explicit Magazine(XConcurrentFixedSizeAllocator &iAllocator, const int iCapacity = 32)
+            : m_Allocator(iAllocator), m_Capacity(XMax(iCapacity, 2))
+        {
+            m_Blocks.Reserve(m_Capacity);
+        }
+
+        ~Magazine()
+        {
+            Flush();
+        }
+
+        void *Allocate()
+        {
+            if (!m_Blocks.Size())
+            {
+                m_Blocks.Resize(m_Capacity / 2);
+                m_Allocator.AllocateBatch(m_Blocks.Begin(), m_Blocks.Size());
+            }
+            return m_Blocks.PopBack();
+        }
+
+        void Free(void *iP)
+        {
+            if (m_Blocks.Size() == m_Capacity)
+            {
+                // we give back half of the magazine
+                int half = m_Capacity / 2;
+                m_Allocator.FreeBatch(m_Blocks.End() - half, half);
+                m_Blocks.Resize(m_Capacity - half);
+            }
+            m_Blocks.PushBack(iP);
+        }
+
+        // Gives all the cached blocks back to the allocator
+        void Flush()
+        {
+            m_Allocator.FreeBatch(m_Blocks.Begin(), m_Blocks.Size());
+            m_Blocks.Resize(0);
+        }
+
+    private:
+        XConcurrentFixedSizeAllocator &m_Allocator;
+        XArray<void *> m_Blocks;
+        int m_Capacity;
+
+        Magazine(const Magazine &);
+        Magazine &operator=(const Magazine &);
+    };
+
+    void *Allocate()
+    {
+        void *p;
+        AllocateBatch(&p, 1);
+        return p;
+    }
+
+    void Free(void *iP)
+    {
+        FreeBatch(&iP, 1);
+    }
+
+    // Fills oBlocks with iCount blocks, under the mutex
+    void AllocateBatch(void **oBlocks, int iCount)
+    {
+        VxMutexLock lock(m_Mutex);
+
+        int i = 0;
+        while (i < iCount)
+        {
+            if (!m_Free)
+            {
+                // we take back everything that was freed since the last refill
+                m_Free = (Link *)VxAtomicExchangePointer(&m_Depot, NULL);
+                if (!m_Free)
+                    break;
+            }
+            oBlocks[i++] = m_Free;
+            m_Free = m_Free->m_Next;
+        }
+        for (; i < iCount; ++i)
+            oBlocks[i] = m_Allocator.Allocate();
+    }
+
+    // Gives back iCount blocks without locking
+    void FreeBatch(void **iBlocks, int iCount)
+    {
+        if (iCount <= 0)
+            return;
+
+        // we chain the blocks together
+        Link *first = (Link *)iBlocks[0];
+        Link *last = first;
+        for (int i = 1; i < iCount; ++i)
+        {
+            last->m_Next = (Link *)iBlocks[i];
+            last = last->m_Next;
+        }
+        PushChain(first, last);
+    }
+
+    /************************************************
+    Summary: Frees all the blocks.
+
+    Remarks:
+        No thread must be using the allocator or one
+    of its magazines during this call.
+    ************************************************/
+    void Clear()
+    {
+        VxMutexLock lock(m_Mutex);
+        m_Free = NULL;
+        m_Depot = NULL;
+        m_Allocator.Clear();
+    }
+
+private:
+    struct Link
+    {
+        Link *m_Next;
+    };
+
+    // Pushes a chain of blocks on the depot
+    void PushChain(Link *iFirst, Link *iLast)
+    {
+        void *head;
+        do
+        {
+            head = VxAtomicLoadPointer(&m_Depot);
+            iLast->m_Next = (Link *)head;
+        } while (VxAtomicCompareExchangePointer(&m_Depot, iFirst, head) != head);
+    }
+
+    // Blocks provider, protected by m_Mutex
+    XFixedSizeAllocator m_Allocator;
+    VxMutex m_Mutex;
+    // free blocks taken from the depot, protected by m_Mutex
+    Link *m_Free;
+    // lock free list of the returned blocks
+    void *volatile m_Depot;
+
+    XConcurrentFixedSizeAllocator(const XConcurrentFixedSizeAllocator &);
+    XConcurrentFixedSizeAllocator &operator=(const XConcurrentFixedSizeAllocator &);
+};
+
+#endif // XCONCURRENTFIXEDSIZEALLOCATOR_H
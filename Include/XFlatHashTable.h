@@ -0,0 +1,824 @@
+#ifndef XFLATHASHTABLE_H
+#define XFLATHASHTABLE_H
+
+#include "XArray.h"
+#include "XClassArray.h"
+#include "XHashFun.h"
+
+#if VX_HAS_CXX11
+#include <utility>
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XFLATHASH_SSE2 1
+#else
+#define XFLATHASH_SSE2 0
+#endif
+
+#ifdef VX_MSVC
+#pragma warning(disable : 4786)
+#endif
+
+template <class T, class K, class H, class Eq>
+class XFlatHashTable;
+
+// Number of control bytes probed at once
+#define XFLATHASH_GROUP_SIZE 16
+
+// Control byte values (a full slot stores the 7 low bits of its hash)
+#define XFLATHASH_EMPTY   0x80
+#define XFLATHASH_DELETED 0xFE
+
+template <class T, class K>
+class XFlatHashTableEntry
+{
+public:
+    XFlatHashTableEntry() : m_Key(), m_Data() {}
+    XFlatHashTableEntry(const XFlatHashTableEntry<T, K> &e) : m_Key(e.m_Key), m_Data(e.m_Data) {}
+#if VX_HAS_CXX11
+    XFlatHashTableEntry(XFlatHashTableEntry<T, K> &&e) VX_NOEXCEPT : m_Key(std::move(e.m_Key)), m_Data(std::move(e.m_Data)) {}
+    XFlatHashTableEntry<T, K> &operator=(const XFlatHashTableEntry<T, K> &e)
+    {
+        m_Key = e.m_Key;
+        m_Data = e.m_Data;
+        return *this;
+    }
+    XFlatHashTableEntry<T, K> &operator=(XFlatHashTableEntry<T, K> &&e) VX_NOEXCEPT
+    {
+        m_Key = std::move(e.m_Key);
+        m_Data = std::move(e.m_Data);
+        return *this;
+    }
+#endif
+    ~XFlatHashTableEntry() {}
+
+    K m_Key;
+    T m_Data;
+};
+
+/************************************************
+Summary: Iterator on a flat hash table.
+
+Remarks: This iterator is the only way to iterate on
+elements in a flat hash table. The iteration will be in no
+specific order, not in the insertion order. Here is an example
+of how to use it:
+
+Example:
+
+    XFlatHashTableIt<T,K,H> it = hashtable.Begin();
+    while (it != hashtable.End()) {
+        // access to the key
+        it.GetKey();
+
+        // access to the element
+        *it;
+
+        // next element
+        ++it;
+    }
+
+
+************************************************/
+template <class T, class K, class H = XHashFun<K>, class Eq = XEqual<K> >
+class XFlatHashTableIt
+{
+    typedef XFlatHashTableIt<T, K, H, Eq> tIterator;
+    typedef XFlatHashTable<T, K, H, Eq> *tTable;
+
+    friend class XFlatHashTable<T, K, H, Eq>;
+
+public:
+    /************************************************
+    Summary: Default constructor of the iterator.
+    ************************************************/
+    XFlatHashTableIt() : m_Index(0), m_Table(0) {}
+
+    /************************************************
+    Summary: Copy constructor of the iterator.
+    ************************************************/
+    XFlatHashTableIt(const tIterator &n) : m_Index(n.m_Index), m_Table(n.m_Table) {}
+
+    /************************************************
+    Summary: Operator Equal of the iterator.
+    ************************************************/
+    int operator==(const tIterator &it) const { return m_Index == it.m_Index; }
+
+    /************************************************
+    Summary: Operator Not Equal of the iterator.
+    ************************************************/
+    int operator!=(const tIterator &it) const { return m_Index != it.m_Index; }
+
+    /************************************************
+    Summary: Returns a constant reference on the data
+    pointed	by the iterator.
+    ************************************************/
+    const T &operator*() const { return m_Table->m_Slots[m_Index].m_Data; }
+
+    /************************************************
+    Summary: Returns a reference on the data pointed
+    by the iterator.
+    ************************************************/
+    T &operator*() { return m_Table->m_Slots[m_Index].m_Data; }
+
+    /************************************************
+    Summary: Returns a pointer on a T object.
+    ************************************************/
+    operator const T *() const { return &(m_Table->m_Slots[m_Index].m_Data); }
+
+    /************************************************
+    Summary: Returns a pointer on a T object.
+    ************************************************/
+    operator T *() { return &(m_Table->m_Slots[m_Index].m_Data); }
+
+    /************************************************
+    Summary: Returns a const reference on the key of
+    the pointed entry.
+    ************************************************/
+    const K &GetKey() const { return m_Table->m_Slots[m_Index].m_Key; }
+    K &GetKey() { return m_Table->m_Slots[m_Index].m_Key; }
+
+    /************************************************
+    Summary: Jumps to next entry in the hashtable.
+    ************************************************/
+    tIterator &operator++()
+    {
+        m_Index = m_Table->XNextFull(m_Index + 1);
+        return *this;
+    }
+
+    /************************************************
+    Summary: Jumps to next entry in the hashtable.
+    ************************************************/
+    tIterator operator++(int)
+    {
+        tIterator tmp = *this;
+        ++*this;
+        return tmp;
+    }
+
+    XFlatHashTableIt(int n, tTable t) : m_Index(n), m_Table(t) {}
+
+    int m_Index;
+
+    tTable m_Table;
+};
+
+/************************************************
+Summary: Constant Iterator on a flat hash table.
+
+Remarks: Same as XFlatHashTableIt for constant
+hash tables.
+
+
+************************************************/
+template <class T, class K, class H = XHashFun<K>, class Eq = XEqual<K> >
+class XFlatHashTableConstIt
+{
+    typedef XFlatHashTableConstIt<T, K, H, Eq> tConstIterator;
+    typedef XFlatHashTable<T, K, H, Eq> const *tConstTable;
+
+    friend class XFlatHashTable<T, K, H, Eq>;
+
+public:
+    /************************************************
+    Summary: Default constructor of the iterator.
+    ************************************************/
+    XFlatHashTableConstIt() : m_Index(0), m_Table(0) {}
+
+    /************************************************
+    Summary: Copy constructor of the iterator.
+    ************************************************/
+    XFlatHashTableConstIt(const tConstIterator &n) : m_Index(n.m_Index), m_Table(n.m_Table) {}
+
+    /************************************************
+    Summary: Operator Equal of the iterator.
+    ************************************************/
+    int operator==(const tConstIterator &it) const { return m_Index == it.m_Index; }
+
+    /************************************************
+    Summary: Operator Not Equal of the iterator.
+    ************************************************/
+    int operator!=(const tConstIterator &it) const { return m_Index != it.m_Index; }
+
+    /************************************************
+    Summary: Returns a constant reference on the data
+    pointed	by the iterator.
+    ************************************************/
+    const T &operator*() const { return m_Table->m_Slots[m_Index].m_Data; }
+
+    /************************************************
+    Summary: Returns a pointer on a T object.
+    ************************************************/
+    operator const T *() const { return &(m_Table->m_Slots[m_Index].m_Data); }
+
+    /************************************************
+    Summary: Returns a const reference on the key of
+    the pointed entry.
+    ************************************************/
+    const K &GetKey() const { return m_Table->m_Slots[m_Index].m_Key; }
+
+    /************************************************
+    Summary: Jumps to next entry in the hashtable.
+    ************************************************/
+    tConstIterator &operator++()
+    {
+        m_Index = m_Table->XNextFull(m_Index + 1);
+        return *this;
+    }
+
+    /************************************************
+    Summary: Jumps to next entry in the hashtable.
+    ************************************************/
+    tConstIterator operator++(int)
+    {
+        tConstIterator tmp = *this;
+        ++*this;
+        return tmp;
+    }
+
+    XFlatHashTableConstIt(int n, tConstTable t) : m_Index(n), m_Table(t) {}
+
+    int m_Index;
+
+    tConstTable m_Table;
+};
+
+/************************************************
+Summary: Struct containing an iterator on an object
+inserted and a BOOL determining if it were really
+inserted (TRUE) or already there (FALSE).
+
+
+************************************************/
+template <class T, class K, class H = XHashFun<K>, class Eq = XEqual<K> >
+class XFlatHashTablePair
+{
+public:
+    XFlatHashTablePair(XFlatHashTableIt<T, K, H, Eq> it, int n) : m_Iterator(it), m_New(n){};
+
+    XFlatHashTableIt<T, K, H, Eq> m_Iterator;
+    XBOOL m_New;
+};
+
+/************************************************
+Summary: Class representation of an open addressing
+Hash Table container.
+
+Remarks:
+    T is the type of element to insert
+    K is the type of the key
+    H is the hash function to hash the key
+
+    This hash table offers the same interface as
+XHashTable but stores its elements in a single flat
+array of slots, with no per entry link. A parallel
+array holds one control byte per slot (empty, deleted
+or the 7 low bits of the element hash) and lookups
+compare a whole group of 16 control bytes at once (with
+SSE2 when available). Only elements whose control byte
+matches are compared with Eq, so a lookup usually touches
+a single cache line of control bytes and one slot.
+
+    The hash returned by H is mixed before use, so the
+simple identity hashes of XHashFun.h are fine.
+
+    The table grows when it reaches 7/8 of its
+capacity. Use Reserve before populating the table to
+avoid intermediate rehashes.
+
+    Unlike XHashTable, removing an element never moves
+other elements, so iterators on other elements remain
+valid. Inserting may rehash and invalidate all iterators.
+
+
+************************************************/
+template <class T, class K, class H = XHashFun<K>, class Eq = XEqual<K> >
+class XFlatHashTable
+{
+    // Types
+    typedef XFlatHashTable<T, K, H, Eq> tTable;
+    typedef XFlatHashTableIt<T, K, H, Eq> tIterator;
+    typedef XFlatHashTableConstIt<T, K, H, Eq> tConstIterator;
+    typedef XFlatHashTablePair<T, K, H, Eq> tPair;
+    // Friendship
+    friend class XFlatHashTableIt<T, K, H, Eq>;
+    // Friendship
+    friend class XFlatHashTableConstIt<T, K, H, Eq>;
+
+public:
+    typedef XFlatHashTableEntry<T, K> Entry;
+    typedef XFlatHashTablePair<T, K, H, Eq> Pair;
+    typedef XFlatHashTableIt<T, K, H, Eq> Iterator;
+    typedef XFlatHashTableConstIt<T, K, H, Eq> ConstIterator;
+
+    /************************************************
+    Summary: Default Constructor.
+
+    Input Arguments:
+        initialize: The default number of slots
+        (will be converted to a power of 2 of at least 16).
+    ************************************************/
+    explicit XFlatHashTable(int initialize = 16) : m_Count(0), m_Deleted(0)
+    {
+        XAllocate(XSlotCount(initialize));
+    }
+
+    /************************************************
+    Summary: Removes all the elements from the table.
+
+    Remarks:
+        The hash table keeps its capacity after a clear.
+    ************************************************/
+    void Clear()
+    {
+        m_Control.Fill(XFLATHASH_EMPTY);
+        for (Entry *e = m_Slots.Begin(); e != m_Slots.End(); ++e)
+            *e = Entry();
+        m_Count = 0;
+        m_Deleted = 0;
+    }
+
+    /************************************************
+    Summary: Inserts an element in the table.
+
+    Input Arguments:
+        key: key of the element to insert.
+        o: element to insert.
+        override: if the key is already present, should
+    the old element be overridden ?
+
+    Remarks:
+        Insert will automatically override the old value
+    and InsertUnique will not replace the old value.
+    TestInsert returns a XFlatHashTablePair, which allow you to know
+    if the element was already present.
+    ************************************************/
+    XBOOL Insert(const K &key, const T &o, XBOOL override)
+    {
+        XDWORD h = XHash(key);
+        int index = XFind(h, key);
+        if (index < 0)
+        {
+            XInsert(h, key, o);
+        }
+        else
+        {
+            if (!override)
+                return FALSE;
+            m_Slots[index].m_Data = o;
+        }
+        return TRUE;
+    }
+
+    Iterator Insert(const K &key, const T &o)
+    {
+        XDWORD h = XHash(key);
+        int index = XFind(h, key);
+        if (index < 0)
+            return Iterator(XInsert(h, key, o), this);
+
+        m_Slots[index].m_Data = o;
+        return Iterator(index, this);
+    }
+
+    Pair TestInsert(const K &key, const T &o)
+    {
+        XDWORD h = XHash(key);
+        int index = XFind(h, key);
+        if (index < 0)
+            return Pair(Iterator(XInsert(h, key, o), this), 1);
+
+        return Pair(Iterator(index, this), 0);
+    }
+
+    Iterator InsertUnique(const K &key, const T &o)
+    {
+        XDWORD h = XHash(key);
+        int index = XFind(h, key);
+        if (index < 0)
+            return Iterator(XInsert(h, key, o), this);
+
+        return Iterator(index, this);
+    }
+
+    /************************************************
+    Summary: Removes an element.
+
+    Input Arguments:
+        key: key of the element to remove.
+        it: iterator on the object to remove.
+
+    Return Value: iterator on the element next to
+    the one just removed.
+    ************************************************/
+    void Remove(const K &key)
+    {
+        int index = XFind(XHash(key), key);
+        if (index >= 0)
+            XRemove(index);
+    }
+
+    Iterator Remove(const tIterator &it)
+    {
+        if (it.m_Index < 0 || it.m_Index >= m_Control.Size())
+            return End();
+
+        XRemove(it.m_Index);
+        return Iterator(XNextFull(it.m_Index + 1), this);
+    }
+
+    /************************************************
+    Summary: Access to an hash table element.
+
+    Input Arguments:
+        key: key of the element to access.
+
+    Return Value: a reference on the element found.
+
+    Remarks:
+        If no element correspond to the key, an element
+    constructed with 0 is inserted.
+    ************************************************/
+    T &operator[](const K &key)
+    {
+        XDWORD h = XHash(key);
+        int index = XFind(h, key);
+        if (index < 0)
+            index = XInsert(h, key, T());
+        return m_Slots[index].m_Data;
+    }
+
+    /************************************************
+    Summary: Access to an hash table element.
+
+    Input Arguments:
+        key: key of the element to access.
+
+    Return Value: an iterator of the element found. End()
+    if not found.
+    ************************************************/
+    Iterator Find(const K &key)
+    {
+        int index = XFind(XHash(key), key);
+        return Iterator((index < 0) ? m_Control.Size() : index, this);
+    }
+
+    ConstIterator Find(const K &key) const
+    {
+        int index = XFind(XHash(key), key);
+        return ConstIterator((index < 0) ? m_Control.Size() : index, this);
+    }
+
+    /************************************************
+    Summary: Access to an hash table element.
+
+    Input Arguments:
+        key: key of the element to access.
+
+    Return Value: a pointer on the element found. NULL
+    if not found.
+    ************************************************/
+    T *FindPtr(const K &key) const
+    {
+        int index = XFind(XHash(key), key);
+        if (index < 0)
+            return 0;
+        return &m_Slots[index].m_Data;
+    }
+
+    /************************************************
+    Summary: search for an hash table element.
+
+    Input Arguments:
+        key: key of the element to access.
+        value: value to receive the element found value.
+
+    Return Value: TRUE if the key was found, FALSE
+    otherwise..
+    ************************************************/
+    XBOOL LookUp(const K &key, T &value) const
+    {
+        int index = XFind(XHash(key), key);
+        if (index < 0)
+            return FALSE;
+        value = m_Slots[index].m_Data;
+        return TRUE;
+    }
+
+    /************************************************
+    Summary: test for the presence of a key.
+
+    Input Arguments:
+        key: key of the element to access.
+
+    Return Value: TRUE if the key was found, FALSE
+    otherwise..
+    ************************************************/
+    XBOOL IsHere(const K &key) const
+    {
+        return XFind(XHash(key), key) >= 0;
+    }
+
+    /************************************************
+    Summary: Returns an iterator on the first element.
+    ************************************************/
+    Iterator Begin()
+    {
+        return Iterator(XNextFull(0), this);
+    }
+
+    ConstIterator Begin() const
+    {
+        return ConstIterator(XNextFull(0), this);
+    }
+
+    /************************************************
+    Summary: Returns an iterator out of the hash table.
+    ************************************************/
+    Iterator End()
+    {
+        return Iterator(m_Control.Size(), this);
+    }
+
+    ConstIterator End() const
+    {
+        return ConstIterator(m_Control.Size(), this);
+    }
+
+    /************************************************
+    Summary: Returns the elements number.
+    ************************************************/
+    int Size() const
+    {
+        return m_Count;
+    }
+
+    /************************************************
+    Summary: Returns the number of slots of the table.
+    ************************************************/
+    int Capacity() const
+    {
+        return m_Control.Size();
+    }
+
+    /************************************************
+    Summary: Return the occupied size in bytes.
+
+    Parameters:
+        addstatic: TRUE if you want to add the size occupied
+    by the class itself.
+    ************************************************/
+    int GetMemoryOccupation(XBOOL addstatic = FALSE) const
+    {
+        return m_Control.GetMemoryOccupation(addstatic) +
+               m_Slots.GetMemoryOccupation(addstatic) +
+               (addstatic ? sizeof(*this) : 0);
+    }
+
+    /************************************************
+    Summary: Reserve an estimation of future hash occupation.
+
+    Parameters:
+        iCount: count of elements to reserve
+    Remarks:
+        The table is rehashed only if its capacity
+    is not large enough to hold iCount elements.
+    ************************************************/
+    void Reserve(const int iCount)
+    {
+        int capacity = XCapacity(iCount);
+        if (capacity > m_Control.Size())
+            Rehash(capacity);
+    }
+
+    /************************************************
+    Summary: Rebuilds the table with the given number of slots.
+
+    Parameters:
+        iSize: new number of slots (converted to a power
+    of 2 large enough to hold the current elements).
+    Remarks:
+        Rehashing also purges the deleted slots left by
+    Remove. All the iterators are invalidated.
+    ************************************************/
+    void Rehash(int iSize)
+    {
+        int capacity = XSlotCount(iSize);
+        while (m_Count > XMaxLoad(capacity))
+            capacity <<= 1;
+
+        tTable tmp(capacity);
+        for (int i = XNextFull(0); i < m_Control.Size(); i = XNextFull(i + 1))
+        {
+            Entry &e = m_Slots[i];
+            XDWORD h = XHash(e.m_Key);
+            int index = tmp.XFindFree(h);
+            tmp.m_Control[index] = XH2(h);
+            tmp.m_Slots[index] = e;
+        }
+        tmp.m_Count = m_Count;
+        Swap(tmp);
+    }
+
+    /************************************************
+    Summary: Swaps two hash tables.
+    ************************************************/
+    void Swap(tTable &a)
+    {
+        m_Control.Swap(a.m_Control);
+        m_Slots.Swap(a.m_Slots);
+        XSwap(m_Count, a.m_Count);
+        XSwap(m_Deleted, a.m_Deleted);
+    }
+
+private:
+    ///
+    // Methods
+
+    // Valid number of slots : a power of 2 of at least one group
+    static int XSlotCount(int iSize)
+    {
+        if (iSize <= XFLATHASH_GROUP_SIZE)
+            return XFLATHASH_GROUP_SIZE;
+        return Near2Power(iSize);
+    }
+
+    // Smallest valid capacity able to hold iCount elements
+    static int XCapacity(int iCount)
+    {
+        int capacity = XFLATHASH_GROUP_SIZE;
+        while (iCount > XMaxLoad(capacity))
+            capacity <<= 1;
+        return capacity;
+    }
+
+    static int XMaxLoad(int capacity)
+    {
+        return capacity - (capacity >> 3);
+    }
+
+    void XAllocate(int capacity)
+    {
+        m_Control.Resize(capacity);
+        m_Control.Fill(XFLATHASH_EMPTY);
+        m_Slots.Resize(capacity);
+    }
+
+    static XDWORD XHash(const K &key)
+    {
+        H hashfun;
+        XDWORD h = (XDWORD)hashfun(key);
+        // 32 bits finalizer : spreads weak hashes over all the bits
+        h ^= h >> 16;
+        h *= 0x85EBCA6B;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35;
+        h ^= h >> 16;
+        return h;
+    }
+
+    static XBYTE XH2(XDWORD h) { return (XBYTE)(h & 0x7F); }
+
+    // Returns a mask with bit i set if control byte i of the group equals c
+    static XDWORD XMatch(const XBYTE *group, XBYTE c)
+    {
+#if XFLATHASH_SSE2
+        __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+        return (XDWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+#else
+        XDWORD mask = 0;
+        for (int i = 0; i < XFLATHASH_GROUP_SIZE; ++i)
+        {
+            if (group[i] == c)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Returns a mask with bit i set if slot i of the group is empty or deleted
+    static XDWORD XMatchFree(const XBYTE *group)
+    {
+#if XFLATHASH_SSE2
+        return (XDWORD)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+        XDWORD mask = 0;
+        for (int i = 0; i < XFLATHASH_GROUP_SIZE; ++i)
+        {
+            if (group[i] & 0x80)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    int XFind(XDWORD h, const K &key) const
+    {
+        Eq equalFunc;
+        XBYTE h2 = XH2(h);
+        int groupMask = (m_Control.Size() / XFLATHASH_GROUP_SIZE) - 1;
+        int group = (int)(h >> 7) & groupMask;
+
+        // triangular probing : visits every group once
+        for (int probe = 0; probe <= groupMask; ++probe)
+        {
+            int base = group * XFLATHASH_GROUP_SIZE;
+            const XBYTE *ctrl = m_Control.Begin() + base;
+            for (XDWORD match = XMatch(ctrl, h2); match; match &= match - 1)
+            {
+                int index = base + LowestBitIndex(match);
+                if (equalFunc(m_Slots[index].m_Key, key))
+                    return index;
+            }
+            // An empty slot ends the probe sequence
+            if (XMatch(ctrl, XFLATHASH_EMPTY))
+                return -1;
+            group = (group + probe + 1) & groupMask;
+        }
+        return -1;
+    }
+
+    // First empty or deleted slot on the probe sequence of h
+    int XFindFree(XDWORD h) const
+    {
+        int groupMask = (m_Control.Size() / XFLATHASH_GROUP_SIZE) - 1;
+        int group = (int)(h >> 7) & groupMask;
+        for (int probe = 0; probe <= groupMask; ++probe)
+        {
+            int base = group * XFLATHASH_GROUP_SIZE;
+            XDWORD match = XMatchFree(m_Control.Begin() + base);
+            if (match)
+                return base + LowestBitIndex(match);
+            group = (group + probe + 1) & groupMask;
+        }
+        XASSERT(0);
+        return -1;
+    }
+
+    int XInsert(XDWORD h, const K &key, const T &o)
+    {
+        if (m_Count + m_Deleted >= XMaxLoad(m_Control.Size()))
+        {
+            // Grow if the table is really getting full, otherwise
+            // only purge the deleted slots
+            if (2 * (m_Count + 1) > XMaxLoad(m_Control.Size()))
+                Rehash(m_Control.Size() * 2);
+            else
+                Rehash(m_Control.Size());
+        }
+
+        int index = XFindFree(h);
+        if (m_Control[index] == XFLATHASH_DELETED)
+            --m_Deleted;
+        m_Control[index] = XH2(h);
+        m_Slots[index].m_Key = key;
+        m_Slots[index].m_Data = o;
+        ++m_Count;
+        return index;
+    }
+
+    void XRemove(int index)
+    {
+        if (m_Control[index] & 0x80)
+            return;
+
+        // If the group still has an empty slot, no probe sequence
+        // can go through it so the slot can be marked empty again
+        const XBYTE *ctrl = m_Control.Begin() + (index & ~(XFLATHASH_GROUP_SIZE - 1));
+        if (XMatch(ctrl, XFLATHASH_EMPTY))
+        {
+            m_Control[index] = XFLATHASH_EMPTY;
+        }
+        else
+        {
+            m_Control[index] = XFLATHASH_DELETED;
+            ++m_Deleted;
+        }
+        m_Slots[index] = Entry();
+        --m_Count;
+    }
+
+    int XNextFull(int index) const
+    {
+        const int size = m_Control.Size();
+        while (index < size && (m_Control[index] & 0x80))
+            ++index;
+        return index;
+    }
+
+    ///
+    // Members
+
+    // the control bytes {secret}
+    XArray<XBYTE> m_Control;
+    // the slots {secret}
+    XClassArray<Entry> m_Slots;
+    // the number of elements {secret}
+    int m_Count;
+    // the number of deleted slots {secret}
+    int m_Deleted;
+};
+
+#endif // XFLATHASHTABLE_H
@@ -32,6 +32,24 @@ public:
 #endif
     ~XHashTableEntry() {}
 
+    // Used by the pool when an entry is moved (the link is remapped afterwards).
+    XHashTableEntry<T, K> &operator=(const XHashTableEntry<T, K> &e)
+    {
+        m_Key = e.m_Key;
+        m_Data = e.m_Data;
+        m_Next = e.m_Next;
+        return *this;
+    }
+#if VX_HAS_CXX11
+    XHashTableEntry<T, K> &operator=(XHashTableEntry<T, K> &&e) VX_NOEXCEPT
+    {
+        m_Key = std::move(e.m_Key);
+        m_Data = std::move(e.m_Data);
+        m_Next = e.m_Next;
+        return *this;
+    }
+#endif
+
     K m_Key;
     T m_Data;
     tEntry m_Next;
@@ -396,7 +414,7 @@ public:
     /************************************************
     Summary: Move constructor.
     ************************************************/
-    XHashTable(XHashTable &&a) VX_NOEXCEPT { XMove(a); }
+    XHashTable(XHashTable &&a) VX_NOEXCEPT { XMove(std::move(a)); }
 #endif
 
     /************************************************
@@ -497,7 +515,7 @@ public:
             // We clear the current table
             Clear();
             // we then move the content of a
-            XMove(a);
+            XMove(std::move(a));
         }
         return *this;
     }
@@ -3,6 +3,7 @@
 
 #include "VxMathDefines.h"
 #include "XUtil.h"
+#include "FixedSizeAllocator.h"
 
 #if VX_HAS_CXX11
 #include <algorithm>
@@ -12,6 +13,8 @@ template <class T>
 class XNode
 {
 public:
+    XNode() : m_Next(NULL), m_Prev(NULL) {}
+
 #if VX_HAS_CXX11
     XNode(XNode<T> &&e) VX_NOEXCEPT : m_Data(std::move(e.m_Data)), m_Next(e.m_Next), m_Prev(e.m_Prev)
     {
@@ -141,7 +144,7 @@ public:
         list: list to recopy in the new one.
 
     ************************************************/
-    XList()
+    XList() : m_Pool(NULL), m_OwnPool(FALSE)
     {
 #ifdef NO_VX_MALLOC
         m_Node = new XNode<T>;
@@ -153,7 +156,7 @@ public:
         m_Count = 0;
     }
 
-    XList(const XList<T> &list)
+    XList(const XList<T> &list) : m_Pool(NULL), m_OwnPool(FALSE)
     {
 #ifdef NO_VX_MALLOC
         m_Node = new XNode<T>;
@@ -174,8 +177,12 @@ public:
     {
         m_Node = list.m_Node;
         m_Count = list.m_Count;
+        m_Pool = list.m_Pool;
+        m_OwnPool = list.m_OwnPool;
         list.m_Node = NULL;
         list.m_Count = 0;
+        list.m_Pool = NULL;
+        list.m_OwnPool = FALSE;
     }
 #endif
 
@@ -204,11 +211,8 @@ public:
     {
         if (this != &list)
         {
-            Clear();
-            m_Node = list.m_Node;
-            m_Count = list.m_Count;
-            list.m_Node = NULL;
-            list.m_Count = 0;
+            XList<T> tmp(static_cast<XList<T> &&>(list));
+            Swap(tmp);
         }
         return *this;
     }
@@ -230,6 +234,8 @@ public:
 #else
         VxDelete< XNode<T> >(m_Node);
 #endif
+        if (m_OwnPool)
+            VxDelete<XFixedSizeAllocator>(m_Pool);
     }
 
     /************************************************
@@ -237,18 +243,23 @@ public:
     ************************************************/
     void Clear()
     {
+        if (!m_Node)
+            return;
+
         tNode tmp = XBegin();
         tNode del;
         while (tmp != XEnd())
         {
             del = tmp;
             tmp = tmp->m_Next;
-#ifdef NO_VX_MALLOC
-            delete del;
-#else
-            VxDelete<XNode<T> >(del);
-#endif
+            if (m_OwnPool)
+                del->~XNode<T>();
+            else
+                XFreeNode(del);
         }
+        // the pages of an owned pool are released at once
+        if (m_OwnPool)
+            m_Pool->Clear();
         m_Node->m_Prev = m_Node;
         m_Node->m_Next = m_Node;
         m_Count = 0;
@@ -459,6 +470,55 @@ public:
     {
         XSwap(m_Node, a.m_Node);
         XSwap(m_Count, a.m_Count);
+        XSwap(m_Pool, a.m_Pool);
+        XSwap(m_OwnPool, a.m_OwnPool);
+    }
+
+    /************************************************
+    Summary: Makes the list allocate its nodes from its own pool.
+
+    Input Arguments:
+        iPageSize: size in bytes of the pages of the pool.
+
+    Remarks:
+        The list is cleared. Nodes are then taken from pages
+    of iPageSize bytes, and Clear() releases the whole pages
+    at once instead of deleting every node.
+    See Also: SetNodePool
+    ************************************************/
+    void EnableNodePool(int iPageSize = XFixedSizeAllocator::DEFAULT_CHUNK_SIZE)
+    {
+        XFixedSizeAllocator *pool = VxNew(XFixedSizeAllocator)(sizeof(XNode<T>), iPageSize);
+        SetNodePool(pool);
+        m_OwnPool = TRUE;
+    }
+
+    /************************************************
+    Summary: Makes the list allocate its nodes from a shared pool.
+
+    Input Arguments:
+        iPool: pool of sizeof(XNode<T>) blocks, or NULL to go back
+    to the default heap allocation.
+
+    Remarks:
+        The list is cleared. The pool can be shared by several lists
+    of the same type and must outlive them. It is not thread safe.
+    Copies of the list do not use the pool.
+    See Also: EnableNodePool
+    ************************************************/
+    void SetNodePool(XFixedSizeAllocator *iPool)
+    {
+        Clear();
+        if (m_OwnPool)
+            VxDelete<XFixedSizeAllocator>(m_Pool);
+        m_Pool = iPool;
+        m_OwnPool = FALSE;
+    }
+
+    // Returns the pool the nodes are allocated from, NULL for the heap.
+    XFixedSizeAllocator *GetNodePool() const
+    {
+        return m_Pool;
     }
 
 private:
@@ -469,13 +529,35 @@ private:
 
     XNode<T> *XEnd() const { return tNode(m_Node); }
 
-    XNode<T> *XInsert(XNode<T> *i, const T &o)
+    XNode<T> *XAllocNode()
+    {
+        if (m_Pool)
+            return new (m_Pool->Allocate()) XNode<T>;
+#ifdef NO_VX_MALLOC
+        return new XNode<T>;
+#else
+        return VxNew(XNode<T>);
+#endif
+    }
+
+    void XFreeNode(XNode<T> *n)
     {
+        if (m_Pool)
+        {
+            n->~XNode<T>();
+            m_Pool->Free(n);
+            return;
+        }
 #ifdef NO_VX_MALLOC
-        XNode<T> *n = new XNode<T>;
+        delete n;
 #else
-        XNode<T> *n = VxNew(XNode<T>);
+        VxDelete<XNode<T> >(n);
 #endif
+    }
+
+    XNode<T> *XInsert(XNode<T> *i, const T &o)
+    {
+        XNode<T> *n = XAllocNode();
         // Data
         n->m_Data = o;
         // Pointers
@@ -495,11 +577,7 @@ private:
         prev->m_Next = next;
         next->m_Prev = prev;
         // we delete the old node
-#ifdef NO_VX_MALLOC
-        delete i;
-#else
-        VxDelete<XNode<T> >(i);
-#endif
+        XFreeNode(i);
         m_Count--;
         // We return the element just after
         return next;
@@ -511,6 +589,11 @@ private:
     XNode<T> *m_Node;
 
     int m_Count;
+
+    // node pool, NULL to use the heap {secret}
+    XFixedSizeAllocator *m_Pool;
+    // TRUE if m_Pool belongs to the list {secret}
+    XBOOL m_OwnPool;
 };
 
 #endif // XLIST_H
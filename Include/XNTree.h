@@ -3,6 +3,7 @@
 
 #include "XHashFun.h"
 #include "XUtil.h"
+#include "FixedSizeAllocator.h"
 
 /************************************************
 Summary: Class representation of a N tree.
@@ -136,6 +137,9 @@ public:
 
     // Methods
 
+    // Ctor
+    XNTree() : m_INodePool(sizeof(INode)), m_LeafPool(sizeof(Leaf)) {}
+
     // Dtor
     ~XNTree()
     {
@@ -378,6 +382,10 @@ public:
 
         // We clear the array
         m_Roots.Resize(0);
+
+        // and give the node pages back
+        m_INodePool.Clear();
+        m_LeafPool.Clear();
     }
 
     void DeleteSubTree(Node *iRoot)
@@ -460,44 +468,37 @@ private:
         }
     }
 
+    // Nodes and leaves are taken from the pools of the tree
     INode *AllocateInternalNode()
     {
-#ifdef NO_VX_MALLOC
-        return new INode;
-#else
-        return VxNew(INode);
-#endif
+        return new (m_INodePool.Allocate()) INode;
     }
 
     Leaf *AllocateLeaf()
     {
-#ifdef NO_VX_MALLOC
-        return new Leaf;
-#else
-        return VxNew(Leaf);
-#endif
+        return new (m_LeafPool.Allocate()) Leaf;
     }
 
     void ReleaseInternalNode(INode *iNode)
     {
-#ifdef NO_VX_MALLOC
-        delete iNode;
-#else
-        VxDelete<INode>(iNode);
-#endif
+        iNode->~INode();
+        m_INodePool.Free(iNode);
     }
 
     void ReleaseLeaf(Leaf *iLeaf)
     {
-#ifdef NO_VX_MALLOC
-        delete iLeaf;
-#else
-        VxDelete<Leaf>(iLeaf);
-#endif
+        iLeaf->~Leaf();
+        m_LeafPool.Free(iLeaf);
     }
 
+    // the nodes own the pool memory : no copy
+    XNTree(const XNTree &);
+    XNTree &operator=(const XNTree &);
+
     // Members
     XArray<Node *> m_Roots;
+    XFixedSizeAllocator m_INodePool;
+    XFixedSizeAllocator m_LeafPool;
 };
 
 #endif // NTREE_H
\ No newline at end of file
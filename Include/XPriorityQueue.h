@@ -172,4 +172,268 @@ protected:
     XArray<T> m_Cells;
 };
 
+/************************************************
+Name: XIndexedPriorityQueue
+
+Summary: Priority queue with handles on its elements.
+
+Template Parameters:
+    T : type of object to store into the queue
+    PF : priority function, which is use to tell the priority (an int)
+    of a T object.
+
+Remarks:
+  Like XPriorityQueue, the higher priority element is popped first, but
+  Insert returns a handle on the inserted element which can be used later
+  to change its priority (Update) or to remove it (Remove), both in O(log(n)).
+  A* like searches can thus lower the cost of an open node instead of
+  inserting it again.
+  The elements are stored flat in a 4-ary heap, which is shallower than a
+  binary heap and keeps the children of a node on the same cache line.
+  The handles of removed elements are reused by the following insertions.
+  You can not store objects with ctor and dtor in it because they won't be called.
+
+
+
+See Also : XPriorityQueue, XArray
+************************************************/
+template <class T, class PF = XPriority<T> >
+class XIndexedPriorityQueue
+{
+public:
+    /************************************************
+    Summary: Constructors.
+
+    Input Arguments:
+        iBaseNumber: Default number of reserved elements.
+    ************************************************/
+    explicit XIndexedPriorityQueue(int iBaseNumber = 0) : m_FreeHandle(-1)
+    {
+        Reserve(iBaseNumber);
+    }
+
+    // Reserves the memory for iCount elements.
+    void Reserve(int iCount)
+    {
+        if (iCount > m_Heap.Allocated())
+            m_Heap.Reserve(iCount);
+        if (iCount > m_Positions.Allocated())
+            m_Positions.Reserve(iCount);
+    }
+
+    /************************************************
+    Summary: Removes all the elements from the queue.
+
+    Remarks:
+        The memory allocated is not freed by this call and
+    all the handles become invalid.
+    ************************************************/
+    void Clear()
+    {
+        m_Heap.Resize(0);
+        m_Positions.Resize(0);
+        m_FreeHandle = -1;
+    }
+
+    // Returns the number of elements in the queue.
+    int Size() const { return m_Heap.Size(); }
+
+    /************************************************
+    Summary: Inserts an element.
+
+    Return Value: the handle of the element.
+    ************************************************/
+    int Insert(const T &iT)
+    {
+        int handle;
+        if (m_FreeHandle >= 0)
+        {
+            handle = m_FreeHandle;
+            m_FreeHandle = -2 - m_Positions[handle];
+        }
+        else
+        {
+            handle = m_Positions.Size();
+            m_Positions.PushBack(0);
+        }
+
+        Cell c;
+        c.value = iT;
+        c.priority = PF()(iT);
+        c.handle = handle;
+        m_Heap.PushBack(c);
+        XSiftUp(m_Heap.Size() - 1, c);
+        return handle;
+    }
+
+    // Returns TRUE if the handle designates an element of the queue.
+    XBOOL Contains(int iHandle) const
+    {
+        return iHandle >= 0 && iHandle < m_Positions.Size() && m_Positions[iHandle] >= 0;
+    }
+
+    // Returns the element of a handle.
+    const T &Get(int iHandle) const
+    {
+        XASSERT(Contains(iHandle));
+        return m_Heap[m_Positions[iHandle]].value;
+    }
+
+    /************************************************
+    Summary: Replaces the element of a handle.
+
+    Remarks:
+        The element moves up or down in the queue,
+    according to its new priority.
+    ************************************************/
+    void Update(int iHandle, const T &iT)
+    {
+        XASSERT(Contains(iHandle));
+        int i = m_Positions[iHandle];
+        Cell c = m_Heap[i];
+        int oldPriority = c.priority;
+        c.value = iT;
+        c.priority = PF()(iT);
+        if (c.priority > oldPriority)
+            XSiftUp(i, c);
+        else
+            XSiftDown(i, c);
+    }
+
+    // Removes the element of a handle from the queue.
+    void Remove(int iHandle)
+    {
+        XASSERT(Contains(iHandle));
+        XRemoveAt(m_Positions[iHandle]);
+    }
+
+    /************************************************
+    Summary: Removes the higher priority element of
+    the queue.
+
+    Input Arguments:
+        oT: pointer to the T object that will be filled
+        with the higher priority element.
+        The pointer need to be valid.
+        oHandle: optional pointer filled with the handle
+        the element had.
+
+    Return Value: TRUE if an object is popped.
+    ************************************************/
+    XBOOL Pop(T *oT, int *oHandle = NULL)
+    {
+        if (!m_Heap.Size())
+            return 0;
+        *oT = m_Heap[0].value;
+        if (oHandle)
+            *oHandle = m_Heap[0].handle;
+        XRemoveAt(0);
+        return 1;
+    }
+
+    /************************************************
+    Summary: Peeks the higher priority element of
+    the queue.
+
+    Return Value: TRUE if there is an element.
+    ************************************************/
+    XBOOL Peek(T *oT, int *oHandle = NULL) const
+    {
+        if (!m_Heap.Size())
+            return 0;
+        *oT = m_Heap[0].value;
+        if (oHandle)
+            *oHandle = m_Heap[0].handle;
+        return 1;
+    }
+
+    /************************************************
+    Summary: Returns the occupied size in memory in bytes
+
+    Parameters:
+        addstatic: TRUE if you want to add the size occupied
+    by the class itself.
+    ************************************************/
+    int GetMemoryOccupation(XBOOL iAddStatic = FALSE) const
+    {
+        return m_Heap.GetMemoryOccupation(FALSE) + m_Positions.GetMemoryOccupation(FALSE) + (iAddStatic ? sizeof(*this) : 0);
+    }
+
+protected:
+    struct Cell
+    {
+        T value;
+        int priority;
+        int handle;
+    };
+
+    // Puts c at position i or above {secret}
+    void XSiftUp(int i, const Cell &c)
+    {
+        Cell *cells = m_Heap.Begin();
+        while (i > 0)
+        {
+            int parent = (i - 1) >> 2;
+            if (cells[parent].priority >= c.priority)
+                break;
+            cells[i] = cells[parent];
+            m_Positions[cells[i].handle] = i;
+            i = parent;
+        }
+        cells[i] = c;
+        m_Positions[c.handle] = i;
+    }
+
+    // Puts c at position i or below {secret}
+    void XSiftDown(int i, const Cell &c)
+    {
+        Cell *cells = m_Heap.Begin();
+        int size = m_Heap.Size();
+        for (;;)
+        {
+            int first = (i << 2) + 1;
+            if (first >= size)
+                break;
+            // highest of the (up to) 4 children
+            int best = first;
+            int last = XMin(first + 4, size);
+            for (int j = first + 1; j < last; ++j)
+            {
+                if (cells[j].priority > cells[best].priority)
+                    best = j;
+            }
+            if (cells[best].priority <= c.priority)
+                break;
+            cells[i] = cells[best];
+            m_Positions[cells[i].handle] = i;
+            i = best;
+        }
+        cells[i] = c;
+        m_Positions[c.handle] = i;
+    }
+
+    void XRemoveAt(int i)
+    {
+        int handle = m_Heap[i].handle;
+        Cell last = m_Heap.PopBack();
+        if (i < m_Heap.Size())
+        {
+            if (last.priority > m_Heap[i].priority)
+                XSiftUp(i, last);
+            else
+                XSiftDown(i, last);
+        }
+        // the handle goes to the free list
+        m_Positions[handle] = -2 - m_FreeHandle;
+        m_FreeHandle = handle;
+    }
+
+    // heap of the elements
+    XArray<Cell> m_Heap;
+    // position in the heap of each handle, or -2 - next free handle
+    XArray<int> m_Positions;
+    // first free handle
+    int m_FreeHandle;
+};
+
 #endif // XPRIORITYQUEUE_H
\ No newline at end of file
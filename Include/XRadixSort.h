@@ -0,0 +1,113 @@
+#ifndef XRADIXSORT_H
+#define XRADIXSORT_H
+
+#include "XArray.h"
+
+/************************************************
+Summary: Radix sort of 32 or 64 bits unsigned keys.
+
+Remarks:
+    o The keys are not moved, Sort returns the indices of the keys in
+    increasing order. The sort is stable: equal keys keep their order.
+    o The keys are sorted 8 bits at a time. The passes where all the keys
+    have the same digit are skipped, so the sort costs little more than a
+    histogram when only a few bits of the keys vary.
+    o The sorter keeps its buffers between calls, use one sorter per kind
+    of array sorted every frame.
+
+    XRadixSorter sorter;
+    const int *order = sorter.Sort(lowKeys, highKeys, count);
+    for (int i = 0; i < count; ++i)
+        Draw(items[order[i]]);
+
+See Also: XArray::Sort
+************************************************/
+class XRadixSorter
+{
+public:
+    XRadixSorter() {}
+
+    /************************************************
+    Summary: Sorts 32 bits keys.
+
+    Return Value:
+        Indices of the keys in increasing order, valid until the next call.
+    ************************************************/
+    const int *Sort(const XDWORD *keys, int count)
+    {
+        Prepare(count);
+        for (int pass = 0; pass < 4; ++pass)
+            Pass(keys, count, pass << 3);
+        return m_Ranks.Begin();
+    }
+
+    /************************************************
+    Summary: Sorts 64 bits keys given as two arrays of 32 bits halves.
+
+    Arguments:
+        low: Least significant 32 bits of the keys.
+        high: Most significant 32 bits of the keys.
+        count: Number of keys.
+    Return Value:
+        Indices of the keys in increasing order, valid until the next call.
+    ************************************************/
+    const int *Sort(const XDWORD *low, const XDWORD *high, int count)
+    {
+        Prepare(count);
+        int pass;
+        for (pass = 0; pass < 4; ++pass)
+            Pass(low, count, pass << 3);
+        for (pass = 0; pass < 4; ++pass)
+            Pass(high, count, pass << 3);
+        return m_Ranks.Begin();
+    }
+
+    // Indices returned by the last sort.
+    const int *GetRanks() const { return m_Ranks.Begin(); }
+
+protected:
+    void Prepare(int count)
+    {
+        m_Ranks.Resize(count);
+        m_Temp.Resize(count);
+        for (int i = 0; i < count; ++i)
+            m_Ranks[i] = i;
+    }
+
+    void Pass(const XDWORD *keys, int count, int shift)
+    {
+        int histogram[256];
+        memset(histogram, 0, sizeof(histogram));
+        int i;
+        for (i = 0; i < count; ++i)
+            ++histogram[(keys[i] >> shift) & 0xFF];
+        // every key has the same digit: the order does not change
+        if (!count || histogram[(keys[0] >> shift) & 0xFF] == count)
+            return;
+
+        int offset = 0;
+        for (i = 0; i < 256; ++i)
+        {
+            int n = histogram[i];
+            histogram[i] = offset;
+            offset += n;
+        }
+        const int *src = m_Ranks.Begin();
+        int *dst = m_Temp.Begin();
+        for (i = 0; i < count; ++i)
+        {
+            int r = src[i];
+            dst[histogram[(keys[r] >> shift) & 0xFF]++] = r;
+        }
+        m_Ranks.Swap(m_Temp);
+    }
+
+    XArray<int> m_Ranks;
+    XArray<int> m_Temp;
+
+private:
+    XRadixSorter(const XRadixSorter &);
+    XRadixSorter &operator=(const XRadixSorter &);
+};
+
+#endif // XRADIXSORT_H
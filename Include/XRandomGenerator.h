@@ -9,6 +9,8 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include "VxSIMD.h"
+
 //
 template <class R>
 float GaussianDistribution(const R &iRG, float iMean, float iDeviation)
@@ -87,6 +89,216 @@ private:
 
 const float StandardRandomGenerator::INVRANDMAX = 1.0f / RAND_MAX;
 
+//
+// xoshiro128** generator with 4 interleaved lanes: the values are
+// generated 4 at a time (with SSE2 when available), the sequence is
+// the same whether they are read one by one or by the Fill methods.
+// Each instance has its own state and is not thread safe: use one
+// per thread, with the same seed and a different stream, so that a
+// given seed always gives the same values.
+class FastRandomGenerator
+{
+public:
+    FastRandomGenerator(unsigned int iSeed = 1, unsigned int iStream = 0)
+    {
+        Init(iSeed, iStream);
+    }
+
+    // Initialize the random generator
+    // for a given seed and stream, the sequence
+    // of generated number will be the same
+    void Init(unsigned int iSeed, unsigned int iStream = 0) const
+    {
+        unsigned int h = iSeed ^ (iStream * 0x85EBCA6Bu);
+        for (int k = 0; k < 16; ++k)
+        {
+            // murmur3 finalizer of a Weyl sequence, never 0 for all the words of a lane
+            h += 0x9E3779B9u;
+            unsigned int x = h ^ (iStream << 16);
+            x ^= x >> 16;
+            x *= 0x85EBCA6Bu;
+            x ^= x >> 13;
+            x *= 0xC2B2AE35u;
+            x ^= x >> 16;
+            m_State[k] = x ? x : 0x6A09E667u;
+        }
+        m_Next = 4;
+    }
+
+    // Returns an uniformly distributed unsigned int
+    unsigned int NextUInt() const
+    {
+        if (m_Next == 4)
+        {
+            Generate(m_Buffer);
+            m_Next = 0;
+        }
+        return m_Buffer[m_Next++];
+    }
+
+    // Returns an uniformly distributed float
+    // value : [0,1)
+    float operator()() const
+    {
+        return (NextUInt() >> 8) * Inv24();
+    }
+
+    // returns a random number distributed
+    // "gaussianly" with a mean and a deviation
+    // value : [iMean-iDeviation,iMean+iDeviation)
+    float Gaussian(float iMean, float iDeviation) const
+    {
+        return GaussianDistribution(*this, iMean, iDeviation);
+    }
+
+    // Fills an array with uniformly distributed floats
+    // value : [iMin,iMax)
+    void FillFloats(float *oValues, int iCount, float iMin = 0.0f, float iMax = 1.0f) const
+    {
+        const float scale = (iMax - iMin) * Inv24();
+        int i = 0;
+        for (; i < iCount && m_Next < 4; ++i)
+            oValues[i] = iMin + (m_Buffer[m_Next++] >> 8) * scale;
+#if VX_SIMD_SSE2
+        if (VxHasSSE())
+        {
+            const __m128 s = _mm_set1_ps(scale);
+            const __m128 m = _mm_set1_ps(iMin);
+            for (; i + 4 <= iCount; i += 4)
+            {
+                const __m128i r = _mm_srli_epi32(Next4(), 8);
+                _mm_storeu_ps(oValues + i, _mm_add_ps(m, _mm_mul_ps(_mm_cvtepi32_ps(r), s)));
+            }
+        }
+#endif
+        unsigned int block[4];
+        for (; i + 4 <= iCount; i += 4)
+        {
+            Generate(block);
+            for (int k = 0; k < 4; ++k)
+                oValues[i + k] = iMin + (block[k] >> 8) * scale;
+        }
+        for (; i < iCount; ++i)
+            oValues[i] = iMin + (NextUInt() >> 8) * scale;
+    }
+
+    // Fills an array with uniformly distributed ints
+    // value : [iMin,iMax]
+    void FillInts(int *oValues, int iCount, int iMin, int iMax) const
+    {
+        const unsigned int range = (unsigned int)(iMax - iMin) + 1u;
+        unsigned int block[4];
+        int i = 0;
+        while (i < iCount)
+        {
+            int n = 1;
+            if (m_Next < 4)
+            {
+                block[0] = m_Buffer[m_Next++];
+            }
+            else if (i + 4 <= iCount)
+            {
+                Generate(block);
+                n = 4;
+            }
+            else
+            {
+                block[0] = NextUInt();
+            }
+            for (int k = 0; k < n; ++k, ++i)
+            {
+                // multiply and keep the high part (no modulo bias), a null range is the full 32 bits range
+                oValues[i] = range ? iMin + (int)(((unsigned __int64)block[k] * range) >> 32) : (int)block[k];
+            }
+        }
+    }
+
+    // Fills an array with random unit vectors (x,y,z floats)
+    // uniformly distributed on the sphere
+    // iStride : floats between two vectors
+    void FillUnitVectors(float *oVectors, int iCount, int iStride = 3) const
+    {
+        const float twoPi = 6.283185307f;
+        for (int i = 0; i < iCount; ++i, oVectors += iStride)
+        {
+            const float z = 2.0f * (*this)() - 1.0f;
+            const float phi = twoPi * (*this)();
+            const float r = sqrtf(1.0f - z * z);
+            oVectors[0] = r * cosf(phi);
+            oVectors[1] = r * sinf(phi);
+            oVectors[2] = z;
+        }
+    }
+
+private:
+    static unsigned int Rotl(unsigned int x, int k)
+    {
+        return (x << k) | (x >> (32 - k));
+    }
+
+    // One step of the 4 lanes, the state is stored as s0[4],s1[4],s2[4],s3[4]
+    void Generate(unsigned int *oValues) const
+    {
+#if VX_SIMD_SSE2
+        if (VxHasSSE())
+        {
+            _mm_storeu_si128((__m128i *)oValues, Next4());
+            return;
+        }
+#endif
+        unsigned int *s = m_State;
+        for (int l = 0; l < 4; ++l)
+        {
+            const unsigned int s1 = s[4 + l];
+            oValues[l] = Rotl(s1 * 5, 7) * 9;
+            const unsigned int t = s1 << 9;
+            s[8 + l] ^= s[l];
+            s[12 + l] ^= s1;
+            s[4 + l] ^= s[8 + l];
+            s[l] ^= s[12 + l];
+            s[8 + l] ^= t;
+            s[12 + l] = Rotl(s[12 + l], 11);
+        }
+    }
+
+#if VX_SIMD_SSE2
+    static __m128i Rotl4(__m128i x, int k)
+    {
+        return _mm_or_si128(_mm_slli_epi32(x, k), _mm_srli_epi32(x, 32 - k));
+    }
+
+    __m128i Next4() const
+    {
+        __m128i s0 = _mm_loadu_si128((const __m128i *)m_State);
+        __m128i s1 = _mm_loadu_si128((const __m128i *)(m_State + 4));
+        __m128i s2 = _mm_loadu_si128((const __m128i *)(m_State + 8));
+        __m128i s3 = _mm_loadu_si128((const __m128i *)(m_State + 12));
+        // s1 * 5 and * 9 with shifts, SSE2 has no 32 bits multiply
+        __m128i r = Rotl4(_mm_add_epi32(s1, _mm_slli_epi32(s1, 2)), 7);
+        r = _mm_add_epi32(r, _mm_slli_epi32(r, 3));
+        const __m128i t = _mm_slli_epi32(s1, 9);
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = Rotl4(s3, 11);
+        _mm_storeu_si128((__m128i *)m_State, s0);
+        _mm_storeu_si128((__m128i *)(m_State + 4), s1);
+        _mm_storeu_si128((__m128i *)(m_State + 8), s2);
+        _mm_storeu_si128((__m128i *)(m_State + 12), s3);
+        return r;
+    }
+#endif
+
+    // 2^-24, maps the 24 high bits of a value to [0,1)
+    static float Inv24() { return 1.0f / 16777216.0f; }
+
+    mutable unsigned int m_State[16];
+    mutable unsigned int m_Buffer[4];
+    mutable int m_Next; // next value of m_Buffer, 4 when empty
+};
+
 //
 class QuasiRandomGenerator
 {
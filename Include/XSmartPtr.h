@@ -1,6 +1,10 @@
 #ifndef XSMARTPTR_H
 #define XSMARTPTR_H
 
+#include "VxMathDefines.h"
+#include "VxMemory.h"
+#include "VxAtomic.h"
+
 #if VX_MSVC > 1000
 #pragma warning(disable : 4284)
 #endif
@@ -31,11 +35,79 @@ public:
     XRefCount(const XRefCount &) { m_RefCount = 0; }
 };
 
+// Reference counting used by XSmartPtr {secret}
+inline void XIntrusiveAddRef(const XRefCount *p) { ++p->m_RefCount; }
+// Returns TRUE when the last reference is released {secret}
+inline XBOOL XIntrusiveRelease(const XRefCount *p) { return --p->m_RefCount == 0; }
+
+// Counters shared by an XAtomicRefCount object and its weak pointers {secret}
+struct XRefCountBlock
+{
+    // references held by the XSmartPtr
+    volatile long m_Strong;
+    // references held by the XWeakPtr, plus one for the object itself
+    volatile long m_Weak;
+};
+
+// Releases a weak reference on a block {secret}
+inline void XReleaseRefCountBlock(XRefCountBlock *b)
+{
+    if (VxAtomicDecrement(&b->m_Weak) == 0)
+        VxDelete<XRefCountBlock>(b);
+}
+
+/************************************************
+Summary: a thread safe reference counting class. You must derive from this
+class to use smart pointers and weak pointers shared between threads.
+
+Remarks:
+    The counter is incremented and decremented with atomic operations, so
+XSmartPtr copies of the same object can be created and destroyed from
+several threads (a given XSmartPtr variable must still not be modified by
+two threads at the same time).
+    The counters are stored in a small block allocated with the object,
+which outlives it as long as XWeakPtr reference it.
+
+See Also : XRefCount,XSmartPtr,XWeakPtr
+************************************************/
+class XAtomicRefCount
+{
+public:
+    XAtomicRefCount() : m_RefBlock(XCreateBlock()) {}
+    /// copy cons must NOT copy the counters
+    XAtomicRefCount(const XAtomicRefCount &) : m_RefBlock(XCreateBlock()) {}
+    /// operator= must NOT copy the counters
+    XAtomicRefCount &operator=(const XAtomicRefCount &) { return *this; }
+    ~XAtomicRefCount() { XReleaseRefCountBlock(m_RefBlock); }
+
+    // Returns the current number of XSmartPtr on the object.
+    long GetRefCount() const { return VxAtomicLoad(&m_RefBlock->m_Strong); }
+
+    // Counters {secret}
+    XRefCountBlock *m_RefBlock;
+
+private:
+    static XRefCountBlock *XCreateBlock()
+    {
+        XRefCountBlock *b = VxNew(XRefCountBlock);
+        b->m_Strong = 0;
+        b->m_Weak = 1;
+        return b;
+    }
+};
+
+// Reference counting used by XSmartPtr {secret}
+inline void XIntrusiveAddRef(const XAtomicRefCount *p) { VxAtomicIncrement(&p->m_RefBlock->m_Strong); }
+// Returns TRUE when the last reference is released {secret}
+inline XBOOL XIntrusiveRelease(const XAtomicRefCount *p) { return VxAtomicDecrement(&p->m_RefBlock->m_Strong) == 0; }
+
 /************************************************
 Summary: Smart pointer class.
 
 Remarks:
-See Also : XP,XRefCount
+    T must derive from XRefCount or, to be shared between
+threads, from XAtomicRefCount.
+See Also : XP,XRefCount,XAtomicRefCount,XWeakPtr
 ************************************************/
 template <class T>
 class XSmartPtr
@@ -71,7 +143,7 @@ public:
     XSmartPtr<T> &operator=(T *p)
     {
         if (p)
-            ++p->m_RefCount;
+            XIntrusiveAddRef(p);
         Release();
         m_Pointee = p;
 
@@ -97,15 +169,25 @@ protected:
     void AddRef()
     {
         if (m_Pointee)
-            ++m_Pointee->m_RefCount;
+            XIntrusiveAddRef(m_Pointee);
     }
 
     void Release()
     {
-        if (m_Pointee && (--(m_Pointee->m_RefCount) == 0))
+        if (m_Pointee && XIntrusiveRelease(m_Pointee))
             delete m_Pointee;
     }
 
+    template <class U>
+    friend class XWeakPtr;
+
+    // Takes a pointer whose reference was already added {secret}
+    void XAttach(T *p)
+    {
+        Release();
+        m_Pointee = p;
+    }
+
     ///
     // Members
 
@@ -113,6 +195,112 @@ protected:
     T *m_Pointee;
 };
 
+/************************************************
+Summary: Weak pointer on an object derived from XAtomicRefCount.
+
+Remarks:
+    A weak pointer does not keep the object alive. Lock()
+returns an XSmartPtr on the object, or a NULL XSmartPtr if
+the object has already been deleted, and can be called from
+any thread.
+
+    XWeakPtr<MeshData> weak(shared);
+    ...
+    XSmartPtr<MeshData> data = weak.Lock();
+    if (data)
+        Use(data);
+
+See Also : XSmartPtr,XAtomicRefCount
+************************************************/
+template <class T>
+class XWeakPtr
+{
+public:
+    XWeakPtr() : m_Pointee(NULL), m_Block(NULL) {}
+
+    XWeakPtr(const XSmartPtr<T> &p) : m_Pointee(NULL), m_Block(NULL) { XSet(p.m_Pointee); }
+
+    XWeakPtr(const XWeakPtr &a) : m_Pointee(a.m_Pointee), m_Block(a.m_Block)
+    {
+        if (m_Block)
+            VxAtomicIncrement(&m_Block->m_Weak);
+    }
+
+    ~XWeakPtr() { Reset(); }
+
+    XWeakPtr &operator=(const XWeakPtr &a)
+    {
+        if (a.m_Block)
+            VxAtomicIncrement(&a.m_Block->m_Weak);
+        Reset();
+        m_Pointee = a.m_Pointee;
+        m_Block = a.m_Block;
+        return *this;
+    }
+
+    XWeakPtr &operator=(const XSmartPtr<T> &p)
+    {
+        Reset();
+        XSet(p.m_Pointee);
+        return *this;
+    }
+
+    /************************************************
+    Summary: Returns a smart pointer on the object.
+
+    Return Value:
+        A NULL smart pointer if the object was deleted.
+    ************************************************/
+    XSmartPtr<T> Lock() const
+    {
+        XSmartPtr<T> p;
+        if (!m_Block)
+            return p;
+
+        // we only add a reference if there is still one
+        long count = VxAtomicLoad(&m_Block->m_Strong);
+        while (count > 0)
+        {
+            long old = VxAtomicCompareExchange(&m_Block->m_Strong, count + 1, count);
+            if (old == count)
+            {
+                p.XAttach(m_Pointee);
+                break;
+            }
+            count = old;
+        }
+        return p;
+    }
+
+    // Returns TRUE if the object has been deleted (or was never set).
+    XBOOL Expired() const { return !m_Block || VxAtomicLoad(&m_Block->m_Strong) <= 0; }
+
+    // Releases the weak reference.
+    void Reset()
+    {
+        if (m_Block)
+            XReleaseRefCountBlock(m_Block);
+        m_Pointee = NULL;
+        m_Block = NULL;
+    }
+
+protected:
+    void XSet(T *p)
+    {
+        if (p)
+        {
+            m_Pointee = p;
+            m_Block = p->m_RefBlock;
+            VxAtomicIncrement(&m_Block->m_Weak);
+        }
+    }
+
+    // The pointee object
+    T *m_Pointee;
+    // Its counters
+    XRefCountBlock *m_Block;
+};
+
 /************************************************
 Summary: Strided pointers iterator class.
 
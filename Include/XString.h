@@ -1023,4 +1023,11 @@ protected:
     }
 };
 
+// An XString only holds a pointer on its own buffer {secret}
+template <>
+struct XIsTriviallyRelocatable<XString>
+{
+    enum { Value = TRUE };
+};
+
 #endif // XSTRING_H
@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+#include <intrin.h>
+#endif
 
 #include <assert.h>
 #define XASSERT(a) assert(a)
@@ -312,6 +315,92 @@ inline int Near2Power(int v)
     return i;
 }
 
+/*************************************************
+Summary: return the index of the lowest bit set in v
+
+Remarks:
+    v must not be 0.
+*************************************************/
+inline int LowestBitIndex(XDWORD v)
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return (int)index;
+#elif defined(__GNUC__)
+    return __builtin_ctz(v);
+#else
+    static const int DeBruijnBitPosition[32] =
+    {
+        0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+        31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+    };
+    return DeBruijnBitPosition[((XDWORD)((v & -(int)v) * 0x077CB531U)) >> 27];
+#endif
+}
+
+/*************************************************
+Summary: return the number of bits set in v
+
+Remarks:
+*************************************************/
+inline int BitCount(XDWORD v)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(v);
+#else
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (int)((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#endif
+}
+
+/*************************************************
+Summary: Tells whether a type can be moved in memory with a raw copy.
+
+Remarks:
+    A trivially relocatable type can be moved to a new address
+by copying its bytes, without calling its copy constructor at
+the new location or its destructor at the old one. XClassArray
+uses this to grow its storage with a single memcpy.
+    The default is FALSE. Specialize it for classes which do not
+keep pointers to themselves or register their address elsewhere.
+
+    template <>
+    struct XIsTriviallyRelocatable<MyClass> { enum { Value = TRUE }; };
+
+See Also: XClassArray, XGrowthPolicy
+*************************************************/
+template <class T>
+struct XIsTriviallyRelocatable
+{
+    enum { Value = FALSE };
+};
+
+/*************************************************
+Summary: Computes the new reserved size of a growing array.
+
+Remarks:
+    XArray and XClassArray call NextSize when they run out of
+reserved space. It must return at least iRequired. The default
+policy doubles the reserved size.
+    Specialize it for an element type to change the growth of
+every array holding that type.
+
+See Also: XArray, XClassArray, XIsTriviallyRelocatable
+*************************************************/
+template <class T>
+struct XGrowthPolicy
+{
+    static int NextSize(int iAllocated, int iRequired)
+    {
+        int size = iAllocated ? iAllocated * 2 : 2;
+        while (size < iRequired)
+            size *= 2;
+        return size;
+    }
+};
+
 /*******************************************************************************
 Summary: Global Unique Identifier Structure.
 